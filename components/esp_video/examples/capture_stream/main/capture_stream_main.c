@@ -15,6 +15,15 @@
 #include "esp_timer.h"
 #include "esp_check.h"
 #include "example_video_common.h"
+#if CONFIG_EXAMPLE_PERF_REPORT
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_video_ioctl.h"
+#endif
+#if CONFIG_EXAMPLE_PERF_ENCODE
+#include "esp_video_device.h"
+#endif
 #if CONFIG_EXAMPLE_VIDEO_BUFFER_TYPE_USER
 #include "esp_heap_caps.h"
 
@@ -26,9 +35,199 @@
 
 #define BUFFER_COUNT 2
 #define CAPTURE_SECONDS 3
+#if CONFIG_EXAMPLE_PERF_ENCODE
+#define PERF_ENCODE_COUNT 10
+#endif
 
 static const char *TAG = "example";
 
+#if CONFIG_EXAMPLE_PERF_REPORT
+/**
+ * @brief Run time of the idle tasks at the start of a stream, the CPU load of each core is
+ * the share of the stream time its idle task did not run.
+ */
+typedef struct perf_cpu {
+    configRUN_TIME_COUNTER_TYPE start;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    configRUN_TIME_COUNTER_TYPE idle[portNUM_PROCESSORS];
+#endif
+} perf_cpu_t;
+
+static void perf_cpu_start(perf_cpu_t *cpu)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    cpu->start = portGET_RUN_TIME_COUNTER_VALUE();
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        cpu->idle[i] = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(i));
+    }
+#else
+    cpu->start = 0;
+#endif
+}
+
+static void perf_cpu_load(const perf_cpu_t *cpu, char *str, size_t len)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    configRUN_TIME_COUNTER_TYPE total = portGET_RUN_TIME_COUNTER_VALUE() - cpu->start;
+    int n = 0;
+
+    for (int i = 0; i < portNUM_PROCESSORS && total; i++) {
+        configRUN_TIME_COUNTER_TYPE idle = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(i)) - cpu->idle[i];
+
+        n += snprintf(str + n, len - n, "%s%.1f", i ? "," : "", 100.0 - MIN(100.0, 100.0 * idle / total));
+        if ((size_t)n >= len) {
+            break;
+        }
+    }
+    if (!total) {
+        snprintf(str, len, "-");
+    }
+#else
+    snprintf(str, len, "-");
+#endif
+}
+
+/**
+ * @brief Print one line of key=value pairs the performance test parses, see pytest_capture_stream_perf.py.
+ */
+static void perf_report(int fd, int type, uint32_t v4l2_format, uint32_t width, uint32_t height,
+                        uint32_t frame_count, uint32_t frame_size, int64_t time_us, const char *cpu_load,
+                        uint32_t encode_us)
+{
+    struct esp_video_stream_stats stats = {
+        .type = type,
+    };
+
+    /* The counters are reset by VIDIOC_STREAMON only, they are still valid after VIDIOC_STREAMOFF */
+    if (ioctl(fd, VIDIOC_G_STREAM_STATS, &stats) != 0) {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ESP_LOGI(TAG, "perf: format=%c%c%c%c width=%" PRIu32 " height=%" PRIu32 " fps=%.2f size=%" PRIu32
+             " latency_avg_us=%" PRIu32 " latency_max_us=%" PRIu32 " dropped=%" PRIu32
+             " encode_us=%" PRIu32 " heap_min_free=%zu psram_min_free=%zu cpu=%s",
+             (char)(v4l2_format & 0xff), (char)((v4l2_format >> 8) & 0xff),
+             (char)((v4l2_format >> 16) & 0xff), (char)((v4l2_format >> 24) & 0xff),
+             width, height, time_us ? (double)frame_count * 1000000 / time_us : 0.0,
+             frame_count ? frame_size / frame_count : 0,
+             stats.latency_avg_us, stats.latency_max_us, stats.dropped, encode_us,
+             heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+             heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM), cpu_load);
+}
+
+#if CONFIG_EXAMPLE_PERF_ENCODE
+/**
+ * @brief Average time the hardware JPEG encoder takes for one frame, from queueing the frame to
+ * dequeueing the JPEG image. Returns 0 if the format is no input format of the encoder.
+ */
+static uint32_t perf_encode_time(const uint8_t *frame, uint32_t size, uint32_t v4l2_format,
+                                 uint32_t width, uint32_t height)
+{
+    int fd;
+    int type;
+    int64_t total_us = 0;
+    uint32_t encoded = 0;
+    struct v4l2_buffer buf;
+    struct v4l2_requestbuffers req;
+    struct v4l2_format format = {
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+        .fmt.pix.width = width,
+        .fmt.pix.height = height,
+        .fmt.pix.pixelformat = v4l2_format,
+    };
+
+    fd = open(ESP_VIDEO_JPEG_DEVICE_NAME, O_RDONLY);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "failed to open JPEG device");
+        return 0;
+    }
+
+    if (ioctl(fd, VIDIOC_S_FMT, &format) != 0) {
+        goto exit;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.count  = 1;
+    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    if (ioctl(fd, VIDIOC_REQBUFS, &req) != 0) {
+        goto exit;
+    }
+
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_JPEG;
+    if (ioctl(fd, VIDIOC_S_FMT, &format) != 0) {
+        goto exit;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.count  = 1;
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(fd, VIDIOC_REQBUFS, &req) != 0) {
+        goto exit;
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(fd, VIDIOC_STREAMON, &type) != 0) {
+        goto exit;
+    }
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    if (ioctl(fd, VIDIOC_STREAMON, &type) != 0) {
+        goto exit_stream;
+    }
+
+    for (int i = 0; i < PERF_ENCODE_COUNT; i++) {
+        int64_t start_us = esp_timer_get_time();
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = 0;
+        if (ioctl(fd, VIDIOC_QBUF, &buf) != 0) {
+            break;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type      = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory    = V4L2_MEMORY_USERPTR;
+        buf.index     = 0;
+        buf.m.userptr = (unsigned long)frame;
+        buf.length    = size;
+        if (ioctl(fd, VIDIOC_QBUF, &buf) != 0) {
+            break;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (ioctl(fd, VIDIOC_DQBUF, &buf) != 0) {
+            break;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_USERPTR;
+        if (ioctl(fd, VIDIOC_DQBUF, &buf) != 0) {
+            break;
+        }
+
+        total_us += esp_timer_get_time() - start_us;
+        encoded++;
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ioctl(fd, VIDIOC_STREAMOFF, &type);
+exit_stream:
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ioctl(fd, VIDIOC_STREAMOFF, &type);
+exit:
+    close(fd);
+    return encoded ? (uint32_t)(total_us / encoded) : 0;
+}
+#endif
+#endif
+
 static esp_err_t camera_capture_stream_by_format(int fd, int type, uint32_t v4l2_format, uint32_t width, uint32_t height)
 {
     uint8_t *buffer[BUFFER_COUNT];
@@ -37,6 +236,15 @@ static esp_err_t camera_capture_stream_by_format(int fd, int type, uint32_t v4l2
 #endif
     uint32_t frame_size;
     uint32_t frame_count;
+#if CONFIG_EXAMPLE_PERF_REPORT
+    char cpu_load[8 * portNUM_PROCESSORS];
+    int64_t stream_time_us;
+    uint32_t encode_us = 0;
+#endif
+#if CONFIG_EXAMPLE_PERF_ENCODE
+    uint32_t last_index = 0;
+    uint32_t last_size = 0;
+#endif
     struct v4l2_buffer buf;
     struct v4l2_requestbuffers req;
     struct v4l2_format format = {
@@ -101,6 +309,10 @@ static esp_err_t camera_capture_stream_by_format(int fd, int type, uint32_t v4l2
 
     frame_count = 0;
     frame_size = 0;
+#if CONFIG_EXAMPLE_PERF_REPORT
+    perf_cpu_t perf_cpu;
+    perf_cpu_start(&perf_cpu);
+#endif
     int64_t start_time_us = esp_timer_get_time();
     while (esp_timer_get_time() - start_time_us < (CAPTURE_SECONDS * 1000 * 1000)) {
         memset(&buf, 0, sizeof(buf));
@@ -118,6 +330,10 @@ static esp_err_t camera_capture_stream_by_format(int fd, int type, uint32_t v4l2
         if (buf.flags & V4L2_BUF_FLAG_DONE) {
             frame_size += buf.bytesused;
             frame_count++;
+#if CONFIG_EXAMPLE_PERF_ENCODE
+            last_index = buf.index;
+            last_size = buf.bytesused;
+#endif
         }
 
 #if CONFIG_EXAMPLE_VIDEO_BUFFER_TYPE_USER
@@ -130,11 +346,28 @@ static esp_err_t camera_capture_stream_by_format(int fd, int type, uint32_t v4l2
         }
     }
 
+#if CONFIG_EXAMPLE_PERF_REPORT
+    stream_time_us = esp_timer_get_time() - start_time_us;
+    perf_cpu_load(&perf_cpu, cpu_load, sizeof(cpu_load));
+#endif
+
     if (ioctl(fd, VIDIOC_STREAMOFF, &type) != 0) {
         ESP_LOGE(TAG, "failed to stop stream");
         return ESP_FAIL;
     }
 
+#if CONFIG_EXAMPLE_PERF_REPORT
+#if CONFIG_EXAMPLE_PERF_ENCODE
+    /* The buffers are no longer written by the camera, the last frame is encoded from where it is */
+    if (last_size) {
+        encode_us = perf_encode_time(buffer[last_index], last_size, v4l2_format,
+                                     format.fmt.pix.width, format.fmt.pix.height);
+    }
+#endif
+    perf_report(fd, type, v4l2_format, format.fmt.pix.width, format.fmt.pix.height,
+                frame_count, frame_size, stream_time_us, cpu_load, encode_us);
+#endif
+
 #if CONFIG_EXAMPLE_VIDEO_BUFFER_TYPE_USER
     for (int i = 0; i < BUFFER_COUNT; i++) {
         heap_caps_free(buffer[i]);
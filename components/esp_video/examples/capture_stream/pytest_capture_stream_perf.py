@@ -0,0 +1,127 @@
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: ESPRESSIF MIT
+"""
+Performance regression test of the capture_stream example.
+
+The app built with sdkconfig.ci.<target>.perf prints one "perf:" line for each
+format and resolution it streams. The results are written to
+perf_results/<target>_<config>.json and compared with perf_baseline.json, the
+test fails if a value regressed beyond its tolerance, or if there is no
+baseline for the target and config, so a missing baseline never passes
+unnoticed.
+
+Environment variables:
+    PERF_BASELINE            Baseline file, perf_baseline.json next to this file by default
+    PERF_RESULTS_DIR         Results directory, perf_results next to this file by default
+    PERF_UPDATE_BASELINE=1   Store the results as the new baseline instead of comparing
+"""
+import json
+import os
+import re
+from typing import Dict, List
+
+import pytest
+from pytest_embedded import Dut
+
+APP_DIR = os.path.dirname(os.path.abspath(__file__))
+
+PERF_RE = re.compile(rb'perf: (.+?)\r?\n')
+END_RE = re.compile(rb'Returned from app_main')
+
+# Key: (higher is better, allowed relative change, allowed absolute change)
+TOLERANCE = {
+    'fps': (True, 0.05, 0.5),
+    'latency_avg_us': (False, 0.20, 500),
+    'latency_max_us': (False, 0.50, 2000),
+    'dropped': (False, 0.0, 2),
+    'encode_us': (False, 0.20, 500),
+    'heap_min_free': (True, 0.10, 4096),
+    'psram_min_free': (True, 0.10, 65536),
+    'cpu': (False, 0.0, 10.0),
+}
+
+
+def parse_perf(line: str) -> Dict:
+    values = dict(item.split('=', 1) for item in line.split())
+    result = {}
+    for key, value in values.items():
+        if key == 'format':
+            result[key] = value
+        elif key == 'cpu':
+            result[key] = [float(v) for v in value.split(',')] if value != '-' else []
+        elif key == 'fps':
+            result[key] = float(value)
+        else:
+            result[key] = int(value)
+    return result
+
+
+def stream_key(result: Dict) -> str:
+    return '{}_{}x{}'.format(result['format'], result['width'], result['height'])
+
+
+def regressed(key: str, baseline: float, value: float) -> bool:
+    higher_is_better, rel, abs_ = TOLERANCE[key]
+    margin = max(abs(baseline) * rel, abs_)
+    if higher_is_better:
+        return value < baseline - margin
+    return value > baseline + margin
+
+
+def compare(baseline: Dict, results: Dict) -> List[str]:
+    failures = []
+    for stream, result in results.items():
+        if stream not in baseline:
+            continue
+        for key in TOLERANCE:
+            if key not in result or key not in baseline[stream]:
+                continue
+            if key == 'cpu':
+                pairs = zip(baseline[stream][key], result[key])
+            else:
+                pairs = [(baseline[stream][key], result[key])]
+            for base, value in pairs:
+                if regressed(key, base, value):
+                    failures.append('{} {}: {} -> {}'.format(stream, key, base, value))
+    for stream in baseline:
+        if stream not in results:
+            failures.append('{}: not streamed'.format(stream))
+    return failures
+
+
+@pytest.mark.esp32p4
+@pytest.mark.generic
+@pytest.mark.parametrize('config', ['perf'], indirect=True)
+def test_capture_stream_perf(dut: Dut, config: str) -> None:
+    results = {}
+    while True:
+        match = dut.expect([PERF_RE, END_RE], timeout=60)
+        if match.re is END_RE:
+            break
+        result = parse_perf(match.group(1).decode())
+        results[stream_key(result)] = result
+
+    assert results, 'no stream reported its performance'
+
+    target = dut.target
+    results_dir = os.getenv('PERF_RESULTS_DIR', os.path.join(APP_DIR, 'perf_results'))
+    os.makedirs(results_dir, exist_ok=True)
+    with open(os.path.join(results_dir, '{}_{}.json'.format(target, config)), 'w') as f:
+        json.dump(results, f, indent=4, sort_keys=True)
+
+    baseline_path = os.getenv('PERF_BASELINE', os.path.join(APP_DIR, 'perf_baseline.json'))
+    with open(baseline_path) as f:
+        baselines = json.load(f)
+    name = '{}_{}'.format(target, config)
+
+    if os.getenv('PERF_UPDATE_BASELINE') == '1':
+        baselines[name] = results
+        with open(baseline_path, 'w') as f:
+            json.dump(baselines, f, indent=4, sort_keys=True)
+        return
+
+    assert name in baselines, 'no baseline for {}, run with PERF_UPDATE_BASELINE=1 on a known good build ' \
+        'and commit {}'.format(name, os.path.relpath(baseline_path, APP_DIR))
+
+    failures = compare(baselines[name], results)
+    assert not failures, 'performance regressed:\n' + '\n'.join(failures)
@@ -21,7 +21,14 @@
 #include <sys/errno.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/param.h>
+#include <unistd.h>
 #include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
 #include "esp_check.h"
 #include "driver/gpio.h"
 #include "tinyusb.h"
@@ -65,6 +72,11 @@
 #define SKIP_STARTUP_FRAME_COUNT   2
 #define BASE_PATH "/data" /* base path to mount the partition */
 
+#define STORAGE_PATH_LEN           48
+#define STORAGE_BLOCK_SIZE         (CONFIG_EXAMPLE_STORAGE_BLOCK_KB * 1024)
+#define STORAGE_COMMIT_SIZE        (CONFIG_EXAMPLE_STORAGE_COMMIT_KB * 1024)
+#define STORAGE_WRITER_PRIORITY    (tskIDLE_PRIORITY + 4)
+
 /**
  * @brief The format of the stored image data
  */
@@ -87,6 +99,32 @@ typedef struct usb_msc_fb {
     struct timeval timestamp;   /*!< Timestamp since boot of the frame */
 } usb_msc_fb_t;
 
+/**
+ * @brief Data staged for the storage writer
+ */
+typedef struct storage_item {
+    char path[STORAGE_PATH_LEN];    /*!< File to create for the data, empty to append to the open file */
+    bool close;                     /*!< Close the file after the data */
+    size_t len;                     /*!< Data length */
+    uint8_t data[];                 /*!< Data */
+} storage_item_t;
+
+/**
+ * @brief Background writer of the staged data
+ */
+typedef struct storage_writer {
+    QueueHandle_t queue;            /*!< Staged items, NULL stops the writer */
+    SemaphoreHandle_t done;         /*!< Given when the writer has written everything */
+    uint8_t *block;                 /*!< DMA capable write block */
+    size_t fill;                    /*!< Data in the write block */
+    int fd;                         /*!< File being written, -1 if none */
+    size_t uncommitted;             /*!< Bytes written since the FAT was last committed */
+    bool failed;                    /*!< A file could not be opened or written */
+    uint32_t files;                 /*!< Files closed */
+    uint64_t bytes;                 /*!< Bytes staged and written */
+    int64_t busy_us;                /*!< Time spent writing */
+} storage_writer_t;
+
 typedef struct usb_msc_storage {
     int cap_fd;
     uint32_t format;
@@ -97,6 +135,7 @@ typedef struct usb_msc_storage {
 #endif
     usb_msc_fb_t um_fb;
     uint64_t storage_max_capacity;
+    storage_writer_t writer;
 } usb_msc_storage_t;
 
 /* TinyUSB descriptors
@@ -230,20 +269,163 @@ static esp_err_t init_codec_video(usb_msc_storage_t *umsc)
 }
 #endif
 
-static esp_err_t example_write_file(FILE *f, const uint8_t *data, size_t len)
+/*
+ * Write-behind storage: the capture task stages each frame in RAM and goes
+ * on capturing, the writer task copies the staged data into a DMA capable
+ * block of a whole number of clusters and writes it in one go. The FAT and
+ * the directory entry are only committed every CONFIG_EXAMPLE_STORAGE_COMMIT_KB
+ * and when a file is closed, instead of after every frame.
+ */
+static void storage_writer_flush(storage_writer_t *w)
+{
+    if (w->fill && w->fd >= 0 && !w->failed) {
+        if (write(w->fd, w->block, w->fill) != w->fill) {
+            ESP_LOGE(TAG, "failed to write storage: %d", errno);
+            w->failed = true;
+        }
+        w->uncommitted += w->fill;
+    }
+    w->fill = 0;
+}
+
+static void storage_writer_close(storage_writer_t *w)
+{
+    storage_writer_flush(w);
+    if (w->fd >= 0) {
+        close(w->fd);
+        w->fd = -1;
+        w->uncommitted = 0;
+        w->files++;
+    }
+}
+
+static void storage_writer_task(void *arg)
+{
+    storage_writer_t *w = (storage_writer_t *)arg;
+    storage_item_t *item;
+
+    while (xQueueReceive(w->queue, &item, portMAX_DELAY) == pdTRUE && item) {
+        int64_t start_us = esp_timer_get_time();
+
+        if (item->path[0]) {
+            storage_writer_close(w);
+            w->fd = open(item->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (w->fd < 0) {
+                ESP_LOGE(TAG, "Failed to open %s for writing", item->path);
+                w->failed = true;
+            }
+        }
+
+        for (size_t offset = 0; offset < item->len;) {
+            size_t n = MIN(item->len - offset, STORAGE_BLOCK_SIZE - w->fill);
+
+            memcpy(w->block + w->fill, item->data + offset, n);
+            w->fill += n;
+            offset += n;
+            if (w->fill == STORAGE_BLOCK_SIZE) {
+                storage_writer_flush(w);
+            }
+        }
+        w->bytes += item->len;
+
+        if (item->close) {
+            storage_writer_close(w);
+        } else if (w->uncommitted >= STORAGE_COMMIT_SIZE && w->fd >= 0) {
+            fsync(w->fd);
+            w->uncommitted = 0;
+        }
+
+        w->busy_us += esp_timer_get_time() - start_us;
+        free(item);
+    }
+
+    storage_writer_close(w);
+    xSemaphoreGive(w->done);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t storage_writer_start(storage_writer_t *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    w->block = heap_caps_malloc(STORAGE_BLOCK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    ESP_RETURN_ON_FALSE(w->block, ESP_ERR_NO_MEM, TAG, "failed to allocate write block");
+
+    w->queue = xQueueCreate(CONFIG_EXAMPLE_STORAGE_QUEUE_DEPTH, sizeof(storage_item_t *));
+    w->done = xSemaphoreCreateBinary();
+    if (!w->queue || !w->done ||
+            xTaskCreate(storage_writer_task, "storage_writer", 4096, w, STORAGE_WRITER_PRIORITY, NULL) != pdPASS) {
+        if (w->queue) {
+            vQueueDelete(w->queue);
+        }
+        if (w->done) {
+            vSemaphoreDelete(w->done);
+        }
+        free(w->block);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/* Wait until everything staged is on the storage */
+static esp_err_t storage_writer_stop(storage_writer_t *w)
+{
+    storage_item_t *stop = NULL;
+
+    xQueueSend(w->queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(w->done, portMAX_DELAY);
+
+    vQueueDelete(w->queue);
+    vSemaphoreDelete(w->done);
+    free(w->block);
+
+    ESP_LOGI(TAG, "%" PRIu32 " file(s), %llu bytes written, writer busy %lld ms",
+             w->files, w->bytes, w->busy_us / 1000);
+
+    return w->failed ? ESP_FAIL : ESP_OK;
+}
+
+/**
+ * Copy data to the staging queue, path opens a new file and close ends it.
+ * Waits while the queue is full or the memory is taken by staged frames.
+ */
+static esp_err_t storage_writer_stage(storage_writer_t *w, const char *path, const uint8_t *data, size_t len, bool close)
 {
-    size_t written;
+    storage_item_t *item;
+
+    while (!(item = heap_caps_malloc_prefer(sizeof(storage_item_t) + len, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT))) {
+        if (!uxQueueMessagesWaiting(w->queue)) {
+            ESP_LOGE(TAG, "failed to stage %zu bytes", len);
+            return ESP_ERR_NO_MEM;
+        }
+        vTaskDelay(1);
+    }
 
-    do {
-        written = fwrite(data, 1, len, f);
-        len -= written;
-        data += written;
-    } while ( written && len );
-    fflush(f);
+    strlcpy(item->path, path ? path : "", sizeof(item->path));
+    item->close = close;
+    item->len = len;
+    memcpy(item->data, data, len);
+    xQueueSend(w->queue, &item, portMAX_DELAY);
 
     return ESP_OK;
 }
 
+/* File name from the capture time of the frame */
+static void example_file_name(char *name, size_t size, const struct timeval *tv)
+{
+#if CONFIG_EXAMPLE_FORMAT_MJPEG
+    const char *ext = ".jpg";
+#elif CONFIG_EXAMPLE_FORMAT_H264
+    const char *ext = "_h264.bin";
+#else
+    const char *ext = ".bin";
+#endif
+
+    snprintf(name, size, BASE_PATH "/%d_%d%s", (int)tv->tv_sec, (int)tv->tv_usec, ext);
+}
+
 /* mount the partition and show all the files in BASE_PATH */
 static void example_mount_msc(void)
 {
@@ -555,80 +737,61 @@ static esp_err_t store_image_to_fat(usb_msc_storage_t *umsc)
         return ESP_FAIL;
     }
     ESP_LOGD(TAG, "write to storage:");
-    char string[32] = {0};
-    char file_name_str[48] = {0};
-    int current_time_us;
-    struct timeval current_time;
+    char file_name_str[STORAGE_PATH_LEN];
     usb_msc_fb_t *image_fb = NULL;
-    FILE *f = NULL;
-    struct stat st;
+    storage_writer_t *w = &umsc->writer;
+    uint64_t bytes_staged = 0;
+    esp_err_t ret = ESP_OK;
 
+    ESP_ERROR_CHECK(storage_writer_start(w));
     ESP_ERROR_CHECK(example_video_start(umsc));
-    current_time_us = esp_timer_get_time();
-    current_time.tv_sec = current_time_us / 1000000UL;;
-    current_time.tv_usec = current_time_us % 1000000UL;
-    /* Generate a file name based on the current time */
-    itoa((int)current_time.tv_sec, string, 10);
-    strcat(strcpy(file_name_str, BASE_PATH"/"), string);
-    memset(string, 0x0, sizeof(string));
-    itoa((int)current_time.tv_usec, string, 10);
-    strcat(file_name_str, "_");
-    strcat(file_name_str, string);
-#if CONFIG_EXAMPLE_FORMAT_MJPEG
-    strcat(file_name_str, ".jpg");
-#elif CONFIG_EXAMPLE_FORMAT_H264
-    strcat(file_name_str, "_h264.bin");
-#elif CONFIG_EXAMPLE_FORMAT_NON_ENCODE
-    strcat(file_name_str, ".bin");
-#endif
-
-    ESP_LOGI(TAG, "file name:%s", file_name_str);
-
-    if (stat(file_name_str, &st) == 0) {
-        /* Delete it if it exists */
-        ESP_LOGW(TAG, "Delete original file %s", file_name_str);
-        unlink(file_name_str);
-    }
 
 #if (CONFIG_EXAMPLE_FORMAT_MJPEG || CONFIG_EXAMPLE_FORMAT_NON_ENCODE)
-    f = fopen(file_name_str, "wb");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file for writing");
-        return ESP_FAIL;
-    }
-    image_fb = example_video_fb_get(umsc);
-    if (image_fb->buf_bytesused < umsc->storage_max_capacity) {
-        example_write_file(f, image_fb->buf, image_fb->buf_bytesused);
-    } else {
-        ESP_LOGE(TAG, "Image size is too large, increase storage space");
-    }
+    /* Every image of the burst is a file of its own, capture does not wait for the previous ones */
+    for (int i = 0; i < CONFIG_EXAMPLE_BURST_IMAGE_COUNT && ret == ESP_OK; i++) {
+        image_fb = example_video_fb_get(umsc);
+        if ((bytes_staged += image_fb->buf_bytesused) < umsc->storage_max_capacity) {
+            example_file_name(file_name_str, sizeof(file_name_str), &image_fb->timestamp);
+            ESP_LOGI(TAG, "file name:%s", file_name_str);
+            ret = storage_writer_stage(w, file_name_str, image_fb->buf, image_fb->buf_bytesused, true);
+        } else {
+            ESP_LOGE(TAG, "Image size is too large, increase storage space");
+            ret = ESP_ERR_NO_MEM;
+        }
 
-    example_video_fb_return(umsc);
-    fclose(f);
-#elif CONFIG_EXAMPLE_FORMAT_H264
-    f = fopen(file_name_str, "ab");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file for writing");
-        return ESP_FAIL;
+        example_video_fb_return(umsc);
     }
+#elif CONFIG_EXAMPLE_FORMAT_H264
     int64_t start_time_us = esp_timer_get_time();
-    uint32_t bytes_written = 0;
-    while (esp_timer_get_time() - start_time_us < (CAPTURE_SECONDS * 1000 * 1000)) {
+    const char *path = file_name_str;
+
+    while (esp_timer_get_time() - start_time_us < (CAPTURE_SECONDS * 1000 * 1000) && ret == ESP_OK) {
         image_fb = example_video_fb_get(umsc);
-        if ((bytes_written += image_fb->buf_bytesused) < umsc->storage_max_capacity) {
-            example_write_file(f, image_fb->buf, image_fb->buf_bytesused);
+        if (path) {
+            example_file_name(file_name_str, sizeof(file_name_str), &image_fb->timestamp);
+            ESP_LOGI(TAG, "file name:%s", file_name_str);
+        }
+
+        if ((bytes_staged += image_fb->buf_bytesused) < umsc->storage_max_capacity) {
+            ret = storage_writer_stage(w, path, image_fb->buf, image_fb->buf_bytesused, false);
+            path = NULL;
         } else {
             ESP_LOGE(TAG, "Image size is too large, increase storage space");
+            ret = ESP_ERR_NO_MEM;
         }
 
         example_video_fb_return(umsc);
     }
-    fclose(f);
 #endif
-    ESP_LOGI(TAG, "File written");
     example_video_stop(umsc);
 
-    return ESP_OK;
+    /* Capture is over, the staged frames may still be on their way to the storage */
+    if (storage_writer_stop(w) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "File written");
+
+    return ret;
 }
 
 /* callback that is delivered when storage is mounted/unmounted by application. */
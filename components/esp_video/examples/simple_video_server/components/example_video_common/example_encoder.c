@@ -10,6 +10,10 @@
 #include "esp_video_ioctl.h"
 #include "esp_video_init.h"
 #include "esp_cam_sensor_xclk.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
 #include "driver/jpeg_encode.h"
 #else
@@ -29,13 +33,165 @@ typedef struct example_encoder {
 static const char *TAG = "example_encoder";
 
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
+#define ENCODER_SERVICE_TASK_STACK_SIZE 3072
+#define ENCODER_SERVICE_QUEUE_DEPTH     CONFIG_EXAMPLE_JPEG_ENCODER_QUEUE_DEPTH
+
 /**
- * @brief JPEG hardware encoder handle to provide a single instance for all video streams
+ * @brief Encoding job, the configuration is copied when the job is submitted
  */
-static jpeg_encoder_handle_t s_jpeg_hw_handle;
-static uint32_t s_jpeg_hw_ref_count;
+typedef struct encoder_job {
+    jpeg_encode_cfg_t config;
+    uint8_t *src_buf;
+    uint32_t src_size;
+    uint8_t *dst_buf;
+    uint32_t dst_size;
+    example_encoder_done_cb_t done_cb;
+    void *arg;
+} encoder_job_t;
+
+/**
+ * @brief JPEG encode service, the single owner of the hardware encoder for all video streams
+ *
+ * One task runs the jobs of all encoders, the highest priority queue first. Jobs
+ * submitted while the engine is busy wait in their queue, so the engine starts the
+ * next one as soon as the current one is done.
+ */
+typedef struct encoder_service {
+    jpeg_encoder_handle_t engine;
+    uint32_t ref_count;
+    QueueHandle_t queue[EXAMPLE_ENCODER_PRIORITY_MAX];
+    SemaphoreHandle_t jobs;             /*!< Counts the jobs in all queues, plus the stop request */
+    TaskHandle_t stop_waiter;
+    volatile bool stopping;
+} encoder_service_t;
+
+static encoder_service_t s_service;
+
+static void encoder_service_task(void *arg)
+{
+    encoder_job_t job;
+
+    while (1) {
+        int i;
+
+        xSemaphoreTake(s_service.jobs, portMAX_DELAY);
+        for (i = 0; i < EXAMPLE_ENCODER_PRIORITY_MAX; i++) {
+            if (xQueueReceive(s_service.queue[i], &job, 0) == pdTRUE) {
+                break;
+            }
+        }
+
+        if (i == EXAMPLE_ENCODER_PRIORITY_MAX) {
+            if (s_service.stopping) {
+                break;
+            }
+            continue;
+        }
+
+        uint32_t dst_size_out = 0;
+        esp_err_t ret = jpeg_encoder_process(s_service.engine, &job.config, job.src_buf, job.src_size,
+                                             job.dst_buf, job.dst_size, &dst_size_out);
+        job.done_cb(ret, dst_size_out, job.arg);
+    }
+
+    xTaskNotifyGive(s_service.stop_waiter);
+    vTaskDelete(NULL);
+}
+
+static void encoder_service_free(void)
+{
+    for (int i = 0; i < EXAMPLE_ENCODER_PRIORITY_MAX; i++) {
+        if (s_service.queue[i]) {
+            vQueueDelete(s_service.queue[i]);
+            s_service.queue[i] = NULL;
+        }
+    }
+
+    if (s_service.jobs) {
+        vSemaphoreDelete(s_service.jobs);
+        s_service.jobs = NULL;
+    }
+
+    if (s_service.engine) {
+        jpeg_del_encoder_engine(s_service.engine);
+        s_service.engine = NULL;
+    }
+}
+
+static esp_err_t encoder_service_get(void)
+{
+    esp_err_t ret = ESP_OK;
+    jpeg_encode_engine_cfg_t encode_eng_cfg = {
+        .timeout_ms = 5000,
+    };
+
+    if (s_service.ref_count++) {
+        return ESP_OK;
+    }
+
+    ESP_GOTO_ON_ERROR(jpeg_new_encoder_engine(&encode_eng_cfg, &s_service.engine), fail0, TAG, "failed to create jpeg encoder engine");
+
+    for (int i = 0; i < EXAMPLE_ENCODER_PRIORITY_MAX; i++) {
+        s_service.queue[i] = xQueueCreate(ENCODER_SERVICE_QUEUE_DEPTH, sizeof(encoder_job_t));
+        ESP_GOTO_ON_FALSE(s_service.queue[i], ESP_ERR_NO_MEM, fail1, TAG, "failed to create job queue");
+    }
+
+    s_service.jobs = xSemaphoreCreateCounting(ENCODER_SERVICE_QUEUE_DEPTH * EXAMPLE_ENCODER_PRIORITY_MAX + 1, 0);
+    ESP_GOTO_ON_FALSE(s_service.jobs, ESP_ERR_NO_MEM, fail1, TAG, "failed to create job semaphore");
+
+    s_service.stopping = false;
+    ESP_GOTO_ON_FALSE(xTaskCreate(encoder_service_task, "jpeg_enc", ENCODER_SERVICE_TASK_STACK_SIZE, NULL,
+                                  CONFIG_EXAMPLE_JPEG_ENCODER_TASK_PRIORITY, NULL) == pdPASS,
+                      ESP_ERR_NO_MEM, fail1, TAG, "failed to create jpeg encoder task");
+
+    return ESP_OK;
+
+fail1:
+    encoder_service_free();
+fail0:
+    s_service.ref_count--;
+    return ret;
+}
+
+static void encoder_service_put(void)
+{
+    if (!s_service.ref_count) {
+        ESP_LOGW(TAG, "jpeg hardware encoder ref count already 0, possible double deinit");
+        return;
+    }
+
+    if (--s_service.ref_count) {
+        return;
+    }
+
+    /* The task runs the jobs still queued before it sees the stop request */
+    s_service.stop_waiter = xTaskGetCurrentTaskHandle();
+    s_service.stopping = true;
+    xSemaphoreGive(s_service.jobs);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    encoder_service_free();
+}
 #endif
 
+/**
+ * @brief Blocking wait of a submitted job
+ */
+typedef struct encoder_wait {
+    SemaphoreHandle_t done;
+    esp_err_t ret;
+    uint32_t dst_size_out;
+} encoder_wait_t;
+
+static void encoder_wait_done(esp_err_t ret, uint32_t dst_size_out, void *arg)
+{
+    encoder_wait_t *wait = (encoder_wait_t *)arg;
+
+    wait->ret = ret;
+    wait->dst_size_out = dst_size_out;
+    xSemaphoreGive(wait->done);
+}
+
 /**
  * @brief Initialize the encoder
  *
@@ -56,7 +212,6 @@ esp_err_t example_encoder_init(example_encoder_config_t *config, example_encoder
     uint32_t jpeg_enc_input_src_size;
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
     jpeg_encode_cfg_t jpeg_enc_config = {0};
-    jpeg_encoder_handle_t jpeg_handle = NULL;
 #else
     jpeg_enc_handle_t jpeg_handle = NULL;
     jpeg_enc_config_t jpeg_enc_config = {0};
@@ -95,12 +250,7 @@ esp_err_t example_encoder_init(example_encoder_config_t *config, example_encoder
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    if (!s_jpeg_hw_handle) {
-        jpeg_encode_engine_cfg_t encode_eng_cfg = {
-            .timeout_ms = 5000,
-        };
-        ESP_RETURN_ON_ERROR(jpeg_new_encoder_engine(&encode_eng_cfg, &jpeg_handle), TAG, "failed to create jpeg encoder engine");
-    }
+    ESP_RETURN_ON_ERROR(encoder_service_get(), TAG, "failed to start jpeg encode service");
 #else
     jpeg_enc_config.quality = config->quality;
 
@@ -129,10 +279,6 @@ esp_err_t example_encoder_init(example_encoder_config_t *config, example_encoder
 
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
     encoder->jpeg_enc_config = jpeg_enc_config;
-    if (!s_jpeg_hw_ref_count) {
-        s_jpeg_hw_ref_count++;
-        s_jpeg_hw_handle = jpeg_handle;
-    }
 #else
     encoder->jpeg_handle = jpeg_handle;
 #endif
@@ -145,7 +291,7 @@ esp_err_t example_encoder_init(example_encoder_config_t *config, example_encoder
 
 fail0:
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    jpeg_del_encoder_engine(jpeg_handle);
+    encoder_service_put();
 #else
     jpeg_enc_close(jpeg_handle);
 #endif
@@ -164,7 +310,7 @@ fail0:
 esp_err_t example_encoder_alloc_output_buffer(example_encoder_handle_t handle, uint8_t **buf, uint32_t *size)
 {
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    if (!s_jpeg_hw_ref_count) {
+    if (!s_service.ref_count) {
         ESP_LOGE(TAG, "jpeg hardware encoder is not initialized");
         return ESP_ERR_INVALID_STATE;
     }
@@ -211,7 +357,7 @@ esp_err_t example_encoder_alloc_output_buffer(example_encoder_handle_t handle, u
 esp_err_t example_encoder_free_output_buffer(example_encoder_handle_t handle, uint8_t *buf)
 {
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    if (!s_jpeg_hw_ref_count) {
+    if (!s_service.ref_count) {
         ESP_LOGE(TAG, "jpeg hardware encoder is not initialized");
         return ESP_ERR_INVALID_STATE;
     }
@@ -231,43 +377,318 @@ esp_err_t example_encoder_free_output_buffer(example_encoder_handle_t handle, ui
 }
 
 /**
- * @brief Process the encoder
+ * @brief Submit a frame to the encoder
  *
  * @param handle Encoder handle
+ * @param priority Job priority
  * @param src_buf Source buffer
  * @param src_size Source buffer size
  * @param dst_buf Destination buffer
  * @param dst_size Destination buffer size
- * @param dst_size_out Output destination buffer size
+ * @param done_cb Callback called with the result
+ * @param arg User argument of done_cb
  *
  * @return ESP_OK on success or other value on failure
  */
-esp_err_t example_encoder_process(example_encoder_handle_t handle, uint8_t *src_buf, uint32_t src_size,
-                                  uint8_t *dst_buf, uint32_t dst_size, uint32_t *dst_size_out)
+esp_err_t example_encoder_submit(example_encoder_handle_t handle, example_encoder_priority_t priority,
+                                 uint8_t *src_buf, uint32_t src_size, uint8_t *dst_buf, uint32_t dst_size,
+                                 example_encoder_done_cb_t done_cb, void *arg)
 {
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    if (!s_jpeg_hw_ref_count) {
+    if (!s_service.ref_count) {
         ESP_LOGE(TAG, "jpeg hardware encoder is not initialized");
         return ESP_ERR_INVALID_STATE;
     }
 #endif
 
-    if (!handle || !src_buf || !src_size || !dst_buf || !dst_size || !dst_size_out) {
+    if (!handle || priority >= EXAMPLE_ENCODER_PRIORITY_MAX || !src_buf || !src_size ||
+            !dst_buf || !dst_size || !done_cb) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    esp_err_t ret = ESP_OK;
     example_encoder_t *encoder = (example_encoder_t *)handle;
 
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    ret = jpeg_encoder_process(s_jpeg_hw_handle, &encoder->jpeg_enc_config, src_buf, src_size, dst_buf, dst_size, dst_size_out);
+    encoder_job_t job = {
+        .config = encoder->jpeg_enc_config,
+        .src_buf = src_buf,
+        .src_size = src_size,
+        .dst_buf = dst_buf,
+        .dst_size = dst_size,
+        .done_cb = done_cb,
+        .arg = arg,
+    };
+
+    ESP_RETURN_ON_FALSE(xQueueSend(s_service.queue[priority], &job, portMAX_DELAY) == pdTRUE,
+                        ESP_FAIL, TAG, "failed to queue jpeg job");
+    xSemaphoreGive(s_service.jobs);
 #else
-    ret = jpeg_enc_process(encoder->jpeg_handle, src_buf, src_size, dst_buf, dst_size, (int *)dst_size_out);
+    /* The software encoder runs in the caller's task, there is nothing to share */
+    int out_size = 0;
+    esp_err_t ret = jpeg_enc_process(encoder->jpeg_handle, src_buf, src_size, dst_buf, dst_size, &out_size);
+    done_cb(ret, ret == ESP_OK ? (uint32_t)out_size : 0, arg);
 #endif
 
+    return ESP_OK;
+}
+
+/**
+ * @brief Process the encoder with the given priority and wait for the result
+ *
+ * @param handle Encoder handle
+ * @param priority Job priority
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param dst_buf Destination buffer
+ * @param dst_size Destination buffer size
+ * @param dst_size_out Output destination buffer size
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_process_priority(example_encoder_handle_t handle, example_encoder_priority_t priority,
+                                           uint8_t *src_buf, uint32_t src_size, uint8_t *dst_buf,
+                                           uint32_t dst_size, uint32_t *dst_size_out)
+{
+    esp_err_t ret;
+    StaticSemaphore_t done_buf;
+    encoder_wait_t wait = {0};
+
+    if (!dst_size_out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    wait.done = xSemaphoreCreateBinaryStatic(&done_buf);
+    ret = example_encoder_submit(handle, priority, src_buf, src_size, dst_buf, dst_size, encoder_wait_done, &wait);
+    if (ret == ESP_OK) {
+        xSemaphoreTake(wait.done, portMAX_DELAY);
+        ret = wait.ret;
+        *dst_size_out = wait.dst_size_out;
+    }
+    vSemaphoreDelete(wait.done);
+
+    return ret;
+}
+
+/**
+ * @brief Process the encoder
+ *
+ * @param handle Encoder handle
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param dst_buf Destination buffer
+ * @param dst_size Destination buffer size
+ * @param dst_size_out Output destination buffer size
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_process(example_encoder_handle_t handle, uint8_t *src_buf, uint32_t src_size,
+                                  uint8_t *dst_buf, uint32_t dst_size, uint32_t *dst_size_out)
+{
+    return example_encoder_process_priority(handle, EXAMPLE_ENCODER_PRIORITY_LIVE, src_buf, src_size,
+                                            dst_buf, dst_size, dst_size_out);
+}
+
+/**
+ * @brief Encoder pipeline frame, the done callback finds its pipeline here
+ */
+typedef struct encoder_pipeline_frame {
+    example_encoder_frame_t frame;
+    example_encoder_pipeline_handle_t pipeline;
+} encoder_pipeline_frame_t;
+
+/**
+ * @brief Encoder pipeline, frames go from the free queue to the encoder and from the done queue to the caller
+ */
+struct example_encoder_pipeline {
+    example_encoder_handle_t encoder;
+    QueueHandle_t free_queue;
+    QueueHandle_t done_queue;
+    uint32_t count;
+    uint32_t in_flight;         /*!< Submitted frames not returned by example_encoder_pipeline_complete yet */
+    encoder_pipeline_frame_t frame[];
+};
+
+static void encoder_pipeline_done(esp_err_t ret, uint32_t dst_size_out, void *arg)
+{
+    encoder_pipeline_frame_t *pipeline_frame = (encoder_pipeline_frame_t *)arg;
+    example_encoder_frame_t *frame = &pipeline_frame->frame;
+
+    frame->ret = ret;
+    frame->size = dst_size_out;
+    xQueueSend(pipeline_frame->pipeline->done_queue, &frame, portMAX_DELAY);
+}
+
+static void encoder_pipeline_free(example_encoder_pipeline_handle_t pipeline)
+{
+    for (uint32_t i = 0; i < pipeline->count; i++) {
+        if (pipeline->frame[i].frame.buf) {
+            example_encoder_free_output_buffer(pipeline->encoder, pipeline->frame[i].frame.buf);
+        }
+    }
+
+    if (pipeline->free_queue) {
+        vQueueDelete(pipeline->free_queue);
+    }
+    if (pipeline->done_queue) {
+        vQueueDelete(pipeline->done_queue);
+    }
+    free(pipeline);
+}
+
+/**
+ * @brief Create an encoder pipeline with a pool of output buffers
+ *
+ * @param handle Encoder handle
+ * @param count Number of output buffers
+ * @param ret_pipeline Pipeline handle
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_create(example_encoder_handle_t handle, uint32_t count,
+                                          example_encoder_pipeline_handle_t *ret_pipeline)
+{
+    esp_err_t ret = ESP_OK;
+    example_encoder_pipeline_handle_t pipeline;
+
+    if (!handle || !count || !ret_pipeline) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pipeline = calloc(1, sizeof(struct example_encoder_pipeline) + count * sizeof(encoder_pipeline_frame_t));
+    ESP_RETURN_ON_FALSE(pipeline, ESP_ERR_NO_MEM, TAG, "failed to alloc encoder pipeline");
+    pipeline->encoder = handle;
+    pipeline->count = count;
+
+    pipeline->free_queue = xQueueCreate(count, sizeof(example_encoder_frame_t *));
+    pipeline->done_queue = xQueueCreate(count, sizeof(example_encoder_frame_t *));
+    ESP_GOTO_ON_FALSE(pipeline->free_queue && pipeline->done_queue, ESP_ERR_NO_MEM, fail0, TAG, "failed to create frame queues");
+
+    for (uint32_t i = 0; i < count; i++) {
+        example_encoder_frame_t *frame = &pipeline->frame[i].frame;
+
+        pipeline->frame[i].pipeline = pipeline;
+        ESP_GOTO_ON_ERROR(example_encoder_alloc_output_buffer(handle, &frame->buf, &frame->buf_size),
+                          fail0, TAG, "failed to alloc output buffer");
+        xQueueSend(pipeline->free_queue, &frame, 0);
+    }
+
+    *ret_pipeline = pipeline;
+
+    return ESP_OK;
+
+fail0:
+    encoder_pipeline_free(pipeline);
     return ret;
 }
 
+/**
+ * @brief Submit a frame to the encoder pipeline
+ *
+ * @param pipeline Pipeline handle
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param user_data User data returned with the frame
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_submit(example_encoder_pipeline_handle_t pipeline, uint8_t *src_buf,
+                                          uint32_t src_size, void *user_data)
+{
+    esp_err_t ret;
+    example_encoder_frame_t *frame;
+
+    if (!pipeline || !src_buf || !src_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xQueueReceive(pipeline->free_queue, &frame, portMAX_DELAY);
+
+    frame->user_data = user_data;
+    frame->size = 0;
+    pipeline->in_flight++;
+    ret = example_encoder_submit(pipeline->encoder, EXAMPLE_ENCODER_PRIORITY_LIVE, src_buf, src_size,
+                                 frame->buf, frame->buf_size, encoder_pipeline_done,
+                                 (encoder_pipeline_frame_t *)frame);
+    if (ret != ESP_OK) {
+        pipeline->in_flight--;
+        xQueueSend(pipeline->free_queue, &frame, 0);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Wait for the oldest submitted frame
+ *
+ * @param pipeline Pipeline handle
+ * @param ret_frame Encoded frame
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_complete(example_encoder_pipeline_handle_t pipeline, example_encoder_frame_t **ret_frame)
+{
+    example_encoder_frame_t *frame;
+
+    if (!pipeline || !ret_frame) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!pipeline->in_flight) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xQueueReceive(pipeline->done_queue, &frame, portMAX_DELAY);
+    pipeline->in_flight--;
+    *ret_frame = frame;
+
+    return frame->ret;
+}
+
+/**
+ * @brief Give a frame's output buffer back to the pipeline
+ *
+ * @param pipeline Pipeline handle
+ * @param frame Frame returned by example_encoder_pipeline_complete
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_release(example_encoder_pipeline_handle_t pipeline, example_encoder_frame_t *frame)
+{
+    if (!pipeline || !frame) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xQueueSend(pipeline->free_queue, &frame, 0);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Delete an encoder pipeline
+ *
+ * @param pipeline Pipeline handle
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_delete(example_encoder_pipeline_handle_t pipeline)
+{
+    example_encoder_frame_t *frame;
+
+    if (!pipeline) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The encoder still writes the output buffers of the frames in flight */
+    while (pipeline->in_flight) {
+        example_encoder_pipeline_complete(pipeline, &frame);
+    }
+
+    encoder_pipeline_free(pipeline);
+
+    return ESP_OK;
+}
+
 /**
  * @brief Set the JPEG quality
  *
@@ -308,15 +729,7 @@ esp_err_t example_encoder_deinit(example_encoder_handle_t handle)
     }
 
 #if CONFIG_EXAMPLE_SELECT_JPEG_HW_DRIVER
-    if (s_jpeg_hw_ref_count) {
-        s_jpeg_hw_ref_count--;
-        if (!s_jpeg_hw_ref_count) {
-            jpeg_del_encoder_engine(s_jpeg_hw_handle);
-            s_jpeg_hw_handle = NULL;
-        }
-    } else {
-        ESP_LOGW(TAG, "jpeg hardware encoder ref count already 0, possible double deinit");
-    }
+    encoder_service_put();
 #else
     jpeg_enc_close(encoder->jpeg_handle);
 #endif
@@ -167,6 +167,24 @@ extern "C" {
  */
 typedef void *example_encoder_handle_t;
 
+/**
+ * @brief Example encoder job priority, jobs of a higher priority are encoded first
+ */
+typedef enum example_encoder_priority {
+    EXAMPLE_ENCODER_PRIORITY_LIVE = 0,          /**< Live stream frame */
+    EXAMPLE_ENCODER_PRIORITY_SNAPSHOT,          /**< Still image capture */
+    EXAMPLE_ENCODER_PRIORITY_MAX,
+} example_encoder_priority_t;
+
+/**
+ * @brief Example encoder job done callback
+ *
+ * @param ret Encoding result
+ * @param dst_size_out Output data size, 0 on failure
+ * @param arg User argument given to example_encoder_submit
+ */
+typedef void (*example_encoder_done_cb_t)(esp_err_t ret, uint32_t dst_size_out, void *arg);
+
 /**
  * @brief Example encoder configuration
  */
@@ -236,6 +254,128 @@ esp_err_t example_encoder_free_output_buffer(example_encoder_handle_t handle, ui
  */
 esp_err_t example_encoder_process(example_encoder_handle_t handle, uint8_t *src_buf, uint32_t src_size, uint8_t *dst_buf, uint32_t dst_size, uint32_t *dst_size_out);
 
+/**
+ * @brief Process the encoder with the given priority
+ *
+ * All encoders share a single hardware JPEG encoder, the calling task waits
+ * while the jobs of higher priority queued by other streams are encoded.
+ *
+ * @param handle Encoder handle
+ * @param priority Job priority
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param dst_buf Destination buffer
+ * @param dst_size Destination buffer size
+ * @param dst_size_out Output destination buffer size
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_process_priority(example_encoder_handle_t handle, example_encoder_priority_t priority,
+                                           uint8_t *src_buf, uint32_t src_size, uint8_t *dst_buf,
+                                           uint32_t dst_size, uint32_t *dst_size_out);
+
+/**
+ * @brief Submit a frame to the encoder without waiting for the result
+ *
+ * The encoder configuration, e.g. the JPEG quality, is taken when the job is
+ * submitted. The source and destination buffers must not be accessed until
+ * done_cb is called, done_cb is called from the encoder task, or from the
+ * calling task with the software encoder.
+ *
+ * @param handle Encoder handle
+ * @param priority Job priority
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param dst_buf Destination buffer
+ * @param dst_size Destination buffer size
+ * @param done_cb Callback called with the result
+ * @param arg User argument of done_cb
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_submit(example_encoder_handle_t handle, example_encoder_priority_t priority,
+                                 uint8_t *src_buf, uint32_t src_size, uint8_t *dst_buf, uint32_t dst_size,
+                                 example_encoder_done_cb_t done_cb, void *arg);
+
+/**
+ * @brief Example encoder pipeline handle
+ */
+typedef struct example_encoder_pipeline *example_encoder_pipeline_handle_t;
+
+/**
+ * @brief Example encoder pipeline frame
+ */
+typedef struct example_encoder_frame {
+    uint8_t *buf;               /**< Output buffer, from example_encoder_alloc_output_buffer */
+    uint32_t buf_size;          /**< Output buffer size */
+    uint32_t size;              /**< Encoded data size */
+    esp_err_t ret;              /**< Encoding result */
+    void *user_data;            /**< User data given to example_encoder_pipeline_submit */
+} example_encoder_frame_t;
+
+/**
+ * @brief Create an encoder pipeline with a pool of output buffers
+ *
+ * Frames are encoded in the order they are submitted, so the caller can send
+ * an encoded frame while the next one is being encoded.
+ *
+ * @param handle Encoder handle
+ * @param count Number of output buffers, at least 2 for frames to overlap
+ * @param ret_pipeline Pipeline handle
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_create(example_encoder_handle_t handle, uint32_t count,
+                                          example_encoder_pipeline_handle_t *ret_pipeline);
+
+/**
+ * @brief Submit a frame to the encoder pipeline
+ *
+ * Waits for a free output buffer. The source buffer must not be modified
+ * until the frame is returned by example_encoder_pipeline_complete.
+ *
+ * @param pipeline Pipeline handle
+ * @param src_buf Source buffer
+ * @param src_size Source buffer size
+ * @param user_data User data returned with the frame
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_submit(example_encoder_pipeline_handle_t pipeline, uint8_t *src_buf,
+                                          uint32_t src_size, void *user_data);
+
+/**
+ * @brief Wait for the oldest submitted frame
+ *
+ * The frame is returned also when encoding failed, and must be given back
+ * with example_encoder_pipeline_release.
+ *
+ * @param pipeline Pipeline handle
+ * @param ret_frame Encoded frame
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no frame is submitted, or the encoding result
+ */
+esp_err_t example_encoder_pipeline_complete(example_encoder_pipeline_handle_t pipeline, example_encoder_frame_t **ret_frame);
+
+/**
+ * @brief Give a frame's output buffer back to the pipeline
+ *
+ * @param pipeline Pipeline handle
+ * @param frame Frame returned by example_encoder_pipeline_complete
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_release(example_encoder_pipeline_handle_t pipeline, example_encoder_frame_t *frame);
+
+/**
+ * @brief Delete an encoder pipeline, after the frames still being encoded are done
+ *
+ * @param pipeline Pipeline handle
+ *
+ * @return ESP_OK on success or other value on failure
+ */
+esp_err_t example_encoder_pipeline_delete(example_encoder_pipeline_handle_t pipeline);
+
 /**
  * @brief Set the JPEG quality
  *
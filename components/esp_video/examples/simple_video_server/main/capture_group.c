@@ -0,0 +1,190 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "linux/videodev2.h"
+#include "esp_video_ioctl.h"
+#include "capture_group.h"
+
+struct capture_group {
+    int fd[CAPTURE_GROUP_MAX_MEMBERS];
+    uint32_t count;
+    uint32_t tolerance_us;
+    bool hw_sync;
+
+    capture_group_frame_t held[CAPTURE_GROUP_MAX_MEMBERS];  /* Frame dequeued from each device, while matching */
+    bool is_held[CAPTURE_GROUP_MAX_MEMBERS];
+
+    capture_group_stats_t stats;
+};
+
+static const char *TAG = "capture_group";
+
+static esp_err_t capture_group_queue(capture_group_t *group, uint32_t member, uint32_t index)
+{
+    struct v4l2_buffer buf = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory = V4L2_MEMORY_MMAP,
+        .index = index,
+    };
+
+    ESP_RETURN_ON_FALSE(ioctl(group->fd[member], VIDIOC_QBUF, &buf) == 0, ESP_FAIL, TAG,
+                        "member %" PRIu32 ": failed to queue buffer", member);
+
+    return ESP_OK;
+}
+
+/* Dequeue the next complete frame of a member and time it */
+static esp_err_t capture_group_dequeue(capture_group_t *group, uint32_t member)
+{
+    struct v4l2_buffer buf;
+    capture_group_frame_t *frame = &group->held[member];
+
+    do {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        ESP_RETURN_ON_FALSE(ioctl(group->fd[member], VIDIOC_DQBUF, &buf) == 0, ESP_FAIL, TAG,
+                            "member %" PRIu32 ": failed to dequeue buffer", member);
+        if (!(buf.flags & V4L2_BUF_FLAG_DONE)) {
+            ESP_RETURN_ON_ERROR(capture_group_queue(group, member, buf.index), TAG, "failed to requeue buffer");
+        }
+    } while (!(buf.flags & V4L2_BUF_FLAG_DONE));
+
+    frame->index = buf.index;
+    frame->bytesused = buf.bytesused;
+    frame->sequence = buf.sequence;
+    frame->timestamp_us = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    frame->triggered = false;
+
+    if (group->hw_sync && (buf.flags & V4L2_BUF_FLAG_ESP_TRIGGERED)) {
+        struct esp_video_frame_meta meta = {
+            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .index = buf.index,
+        };
+
+        if (ioctl(group->fd[member], VIDIOC_G_FRAME_META, &meta) == 0 && (meta.flags & ESP_VIDEO_FRAME_META_TRIGGER)) {
+            frame->timestamp_us = meta.trigger_us;
+            frame->triggered = true;
+        }
+    }
+
+    group->is_held[member] = true;
+
+    return ESP_OK;
+}
+
+esp_err_t capture_group_create(const capture_group_config_t *config, capture_group_t **ret_group)
+{
+    capture_group_t *group;
+
+    ESP_RETURN_ON_FALSE(config && config->fds && ret_group, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->count >= 2 && config->count <= CAPTURE_GROUP_MAX_MEMBERS, ESP_ERR_INVALID_ARG, TAG,
+                        "a group has 2 to %d members", CAPTURE_GROUP_MAX_MEMBERS);
+
+    group = calloc(1, sizeof(capture_group_t));
+    ESP_RETURN_ON_FALSE(group, ESP_ERR_NO_MEM, TAG, "failed to allocate group");
+
+    for (uint32_t i = 0; i < config->count; i++) {
+        group->fd[i] = config->fds[i];
+    }
+    group->count = config->count;
+    group->tolerance_us = config->tolerance_us;
+    group->hw_sync = config->hw_sync;
+
+    *ret_group = group;
+
+    return ESP_OK;
+}
+
+esp_err_t capture_group_get(capture_group_t *group, capture_group_set_t *set)
+{
+    bool matched;
+    int64_t newest;
+    int64_t oldest;
+
+    for (uint32_t i = 0; i < group->count; i++) {
+        if (!group->is_held[i]) {
+            ESP_RETURN_ON_ERROR(capture_group_dequeue(group, i), TAG, "failed to get frame");
+        }
+    }
+
+    /*
+     * Replace every frame too old for the newest one with the next frame of its
+     * device. A replacement may itself be the newest frame, so check again until
+     * a pass replaces nothing.
+     */
+    do {
+        matched = true;
+        newest = group->held[0].timestamp_us;
+        for (uint32_t i = 1; i < group->count; i++) {
+            newest = MAX(newest, group->held[i].timestamp_us);
+        }
+
+        for (uint32_t i = 0; i < group->count; i++) {
+            if (newest - group->held[i].timestamp_us > group->tolerance_us) {
+                group->is_held[i] = false;
+                ESP_RETURN_ON_ERROR(capture_group_queue(group, i, group->held[i].index), TAG, "failed to drop frame");
+                ESP_RETURN_ON_ERROR(capture_group_dequeue(group, i), TAG, "failed to get frame");
+                group->stats.discarded++;
+                matched = false;
+            }
+        }
+    } while (!matched);
+
+    oldest = newest;
+    for (uint32_t i = 0; i < group->count; i++) {
+        set->frame[i] = group->held[i];
+        group->is_held[i] = false;
+        oldest = MIN(oldest, set->frame[i].timestamp_us);
+    }
+    set->count = group->count;
+    set->spread_us = (uint32_t)(newest - oldest);
+
+    group->stats.sets++;
+    group->stats.max_spread_us = MAX(group->stats.max_spread_us, set->spread_us);
+
+    return ESP_OK;
+}
+
+esp_err_t capture_group_put(capture_group_t *group, const capture_group_set_t *set)
+{
+    esp_err_t ret = ESP_OK;
+
+    /* Queue all frames, even if one fails */
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (capture_group_queue(group, i, set->frame[i].index) != ESP_OK) {
+            ret = ESP_FAIL;
+        }
+    }
+
+    return ret;
+}
+
+void capture_group_get_stats(const capture_group_t *group, capture_group_stats_t *stats)
+{
+    *stats = group->stats;
+}
+
+void capture_group_delete(capture_group_t *group)
+{
+    if (!group) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < group->count; i++) {
+        if (group->is_held[i]) {
+            capture_group_queue(group, i, group->held[i].index);
+        }
+    }
+
+    free(group);
+}
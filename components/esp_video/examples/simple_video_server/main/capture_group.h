@@ -0,0 +1,131 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * Capture group: frames of several streaming capture devices taken as sets
+ *
+ * Every device of the group keeps one dequeued frame. The frames older than
+ * the newest one by more than the tolerance are queued again and replaced by
+ * the next frame of their device, until all frames are within the tolerance.
+ * They are then handed out as one set, so the frames of a stereo or
+ * multispectral rig are matched on the device instead of by arrival time on
+ * the host.
+ *
+ * A frame is timed by the time the hardware finished it. With hardware sync, a
+ * frame that started at a trigger edge, V4L2_BUF_FLAG_ESP_TRIGGERED, is timed
+ * by that edge instead, which does not depend on the readout time of its sensor.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_GROUP_MAX_MEMBERS   4   /*!< Largest number of devices in a group */
+
+/**
+ * @brief Capture group configuration
+ */
+typedef struct capture_group_config {
+    const int *fds;                 /*!< Capture devices, streaming with MMAP buffers */
+    uint32_t count;                 /*!< Number of devices, 2 to CAPTURE_GROUP_MAX_MEMBERS */
+    uint32_t tolerance_us;          /*!< Largest time between the frames of a set */
+    bool hw_sync;                   /*!< Time triggered frames by their trigger edge */
+} capture_group_config_t;
+
+/**
+ * @brief One frame of a set, dequeued from its device
+ */
+typedef struct capture_group_frame {
+    uint32_t index;                 /*!< Buffer index */
+    uint32_t bytesused;             /*!< Frame size in bytes */
+    uint32_t sequence;              /*!< Sequence number of the frame on its device */
+    int64_t timestamp_us;           /*!< Time the frame is matched by, esp_timer clock */
+    bool triggered;                 /*!< timestamp_us is the trigger edge of the frame */
+} capture_group_frame_t;
+
+/**
+ * @brief Set of frames, one per device in the configuration order
+ */
+typedef struct capture_group_set {
+    capture_group_frame_t frame[CAPTURE_GROUP_MAX_MEMBERS];
+    uint32_t count;                 /*!< Number of frames */
+    uint32_t spread_us;             /*!< Time from the earliest to the latest frame */
+} capture_group_set_t;
+
+/**
+ * @brief Capture group statistics
+ */
+typedef struct capture_group_stats {
+    uint32_t sets;                  /*!< Sets handed out */
+    uint32_t discarded;             /*!< Frames queued again without a match */
+    uint32_t max_spread_us;         /*!< Largest spread of a set */
+} capture_group_stats_t;
+
+typedef struct capture_group capture_group_t;
+
+/**
+ * @brief Create a capture group
+ *
+ * @param config    Group configuration, the devices must be streaming
+ * @param ret_group Returned group
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+esp_err_t capture_group_create(const capture_group_config_t *config, capture_group_t **ret_group);
+
+/**
+ * @brief Wait for the next set of matching frames
+ *
+ * The frames of the set belong to the caller until capture_group_put().
+ *
+ * @param group Group handle
+ * @param set   Returned set
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if a device failed to dequeue or queue a buffer
+ */
+esp_err_t capture_group_get(capture_group_t *group, capture_group_set_t *set);
+
+/**
+ * @brief Queue the frames of a set again
+ *
+ * @param group Group handle
+ * @param set   Set returned by capture_group_get()
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if a device failed to queue a buffer
+ */
+esp_err_t capture_group_put(capture_group_t *group, const capture_group_set_t *set);
+
+/**
+ * @brief Get the statistics of a group
+ *
+ * @param group Group handle
+ * @param stats Returned statistics
+ */
+void capture_group_get_stats(const capture_group_t *group, capture_group_stats_t *stats);
+
+/**
+ * @brief Delete a capture group, the frames it holds are queued again
+ *
+ * @param group Group handle
+ */
+void capture_group_delete(capture_group_t *group);
+
+#ifdef __cplusplus
+}
+#endif
@@ -20,6 +20,7 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "esp_check.h"
 #include "esp_http_server.h"
 #include "protocol_examples_common.h"
@@ -27,20 +28,43 @@
 #include "lwip/inet.h"
 #include "lwip/apps/netbiosns.h"
 #include "example_video_common.h"
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+#include "esp_heap_caps.h"
+#include "esp_video_mem_stats.h"
+#endif
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+#include "capture_group.h"
+#endif
 
 #define EXAMPLE_CAMERA_VIDEO_BUFFER_NUMBER  CONFIG_EXAMPLE_CAMERA_VIDEO_BUFFER_NUMBER
 
 #define EXAMPLE_JPEG_ENC_QUALITY            CONFIG_EXAMPLE_JPEG_COMPRESSION_QUALITY
+#define EXAMPLE_STREAM_JPEG_BUFFER_NUMBER   2   /* One frame is sent while the next one is encoded */
 
 #define EXAMPLE_MDNS_INSTANCE               CONFIG_EXAMPLE_MDNS_INSTANCE
 #define EXAMPLE_MDNS_HOST_NAME              CONFIG_EXAMPLE_MDNS_HOST_NAME
 
 #define EXAMPLE_PART_BOUNDARY               CONFIG_EXAMPLE_HTTP_PART_BOUNDARY
 
+#define EXAMPLE_NVS_NAMESPACE               "web_cam"
+
 static const char *STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" EXAMPLE_PART_BOUNDARY;
 static const char *STREAM_BOUNDARY = "\r\n--" EXAMPLE_PART_BOUNDARY "\r\n";
 static const char *STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %d.%06d\r\n\r\n";
 
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+#define EXAMPLE_GROUP_TOLERANCE_US          CONFIG_EXAMPLE_CAPTURE_GROUP_TOLERANCE_US
+#define EXAMPLE_GROUP_BOUNDARY              "frameset"
+
+/* Each part of the group stream is a multipart/mixed body with the image of every camera */
+static const char *STREAM_GROUP_PART = "Content-Type: multipart/mixed;boundary=" EXAMPLE_GROUP_BOUNDARY "\r\n"
+                                       "Content-Length: %" PRIu32 "\r\nX-Timestamp: %d.%06d\r\nX-Spread-Us: %" PRIu32 "\r\n\r\n";
+static const char *STREAM_GROUP_IMAGE = "--" EXAMPLE_GROUP_BOUNDARY "\r\nContent-Type: image/jpeg\r\n"
+                                        "Content-Length: %" PRIu32 "\r\nX-Camera: %d\r\nX-Timestamp: %d.%06d\r\n"
+                                        "X-Sequence: %" PRIu32 "\r\n\r\n";
+static const char *STREAM_GROUP_END = "--" EXAMPLE_GROUP_BOUNDARY "--\r\n";
+#endif
+
 extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
 extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
 extern const uint8_t loading_jpg_gz_start[] asm("_binary_loading_jpg_gz_start");
@@ -79,6 +103,9 @@ typedef struct web_cam_video {
 } web_cam_video_t;
 
 typedef struct web_cam {
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+    int group_port;                         /* Port of the group stream server, 0 if none */
+#endif
     uint8_t video_count;
     web_cam_video_t video[0];
 } web_cam_t;
@@ -151,8 +178,10 @@ static esp_err_t capture_video_image(httpd_req_t *req, web_cam_video_t *video, b
         jpeg_encoded_size = buf.bytesused;
     } else {
         ESP_GOTO_ON_FALSE(xSemaphoreTake(video->sem, portMAX_DELAY) == pdPASS, ESP_FAIL, fail0, TAG, "failed to take semaphore");
-        ret = example_encoder_process(video->encoder_handle, video->buffer[buf.index], video->buffer_size,
-                                      video->jpeg_out_buf, video->jpeg_out_size, &jpeg_encoded_size);
+        /* A still image may wait behind the live stream frames of all cameras */
+        ret = example_encoder_process_priority(video->encoder_handle, EXAMPLE_ENCODER_PRIORITY_SNAPSHOT,
+                                               video->buffer[buf.index], video->buffer_size,
+                                               video->jpeg_out_buf, video->jpeg_out_size, &jpeg_encoded_size);
         xSemaphoreGive(video->sem);
         ESP_GOTO_ON_ERROR(ret, fail0, TAG, "failed to encode video frame");
         ESP_GOTO_ON_ERROR(httpd_resp_send(req, (char *)video->jpeg_out_buf, jpeg_encoded_size), fail0, TAG, "failed to send %s", type_str);
@@ -239,11 +268,68 @@ static char *get_cameras_json(web_cam_t *web_cam)
         cJSON_AddItemToArray(cameras, camera);
     }
 
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+    if (web_cam->group_port) {
+        char group_src[32];
+
+        assert(snprintf(group_src, sizeof(group_src), ":%d/group_stream", web_cam->group_port) > 0);
+        cJSON_AddStringToObject(root, "groupSrc", group_src);
+    }
+#endif
+
     char *output = cJSON_Print(root);
     cJSON_Delete(root);
     return output;
 }
 
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+static void add_heap_json(cJSON *heap, const char *name, uint32_t caps)
+{
+    cJSON *item = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(item, "free", heap_caps_get_free_size(caps));
+    cJSON_AddNumberToObject(item, "minFree", heap_caps_get_minimum_free_size(caps));
+    cJSON_AddNumberToObject(item, "largestFreeBlock", heap_caps_get_largest_free_block(caps));
+    cJSON_AddItemToObject(heap, name, item);
+}
+
+static char *get_memory_json(void)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON *owners = cJSON_CreateArray();
+    cJSON *heap = cJSON_CreateObject();
+
+    for (int i = 0; i < ESP_VIDEO_MEM_OWNER_MAX; i++) {
+        esp_video_mem_usage_t usage;
+
+        if (esp_video_mem_stats_get(i, &usage) != ESP_OK) {
+            continue;
+        }
+
+        cJSON *owner = cJSON_CreateObject();
+        cJSON_AddStringToObject(owner, "owner", esp_video_mem_owner_name(i));
+        cJSON_AddNumberToObject(owner, "internal", usage.internal_size);
+        cJSON_AddNumberToObject(owner, "internalPeak", usage.internal_peak_size);
+        cJSON_AddNumberToObject(owner, "psram", usage.psram_size);
+        cJSON_AddNumberToObject(owner, "psramPeak", usage.psram_peak_size);
+        cJSON_AddNumberToObject(owner, "blocks", usage.block_count);
+        cJSON_AddNumberToObject(owner, "failures", usage.fail_count);
+        cJSON_AddNumberToObject(owner, "lastFailureSize", usage.fail_size);
+        cJSON_AddItemToArray(owners, owner);
+    }
+    cJSON_AddItemToObject(root, "owners", owners);
+
+    /* Free heap left for more streams */
+    add_heap_json(heap, "internal", MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    add_heap_json(heap, "psram", MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    cJSON_AddItemToObject(root, "heap", heap);
+
+    char *output = cJSON_Print(root);
+    cJSON_Delete(root);
+    return output;
+}
+#endif
+
 static esp_err_t set_camera_jpeg_quality(web_cam_video_t *video, int quality)
 {
     esp_err_t ret = ESP_OK;
@@ -295,6 +381,54 @@ static esp_err_t set_camera_jpeg_quality(web_cam_video_t *video, int quality)
     return ret;
 }
 
+#if CONFIG_EXAMPLE_SAVE_CAMERA_CONFIG
+static void camera_config_key(const web_cam_video_t *video, char *key, size_t size)
+{
+    snprintf(key, size, "jpeg_q%d", video->index);
+}
+
+/* Returns the JPEG quality saved by set_camera_config before the last reboot, or the Kconfig default */
+static int load_camera_jpeg_quality(const web_cam_video_t *video)
+{
+    nvs_handle_t handle;
+    uint8_t quality;
+    char key[16];
+
+    camera_config_key(video, key, sizeof(key));
+    if (nvs_open(EXAMPLE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return EXAMPLE_JPEG_ENC_QUALITY;
+    }
+    if (nvs_get_u8(handle, key, &quality) != ESP_OK) {
+        quality = EXAMPLE_JPEG_ENC_QUALITY;
+    } else {
+        ESP_LOGI(TAG, "video%d: restore saved jpeg quality %d", video->index, quality);
+    }
+    nvs_close(handle);
+
+    return quality;
+}
+
+static void save_camera_jpeg_quality(const web_cam_video_t *video)
+{
+    nvs_handle_t handle;
+    esp_err_t ret;
+    char key[16];
+
+    camera_config_key(video, key, sizeof(key));
+    ret = nvs_open(EXAMPLE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_u8(handle, key, video->jpeg_quality);
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "video%d: failed to save jpeg quality: %s", video->index, esp_err_to_name(ret));
+    }
+}
+#endif
+
 static esp_err_t camera_info_handler(httpd_req_t *req)
 {
     esp_err_t ret;
@@ -308,6 +442,20 @@ static esp_err_t camera_info_handler(httpd_req_t *req)
     return ret;
 }
 
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+static esp_err_t memory_info_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+    char *output = get_memory_json();
+
+    httpd_resp_set_type(req, "application/json");
+    ret = httpd_resp_sendstr(req, output);
+    free(output);
+
+    return ret;
+}
+#endif
+
 static esp_err_t camera_settings_handler(httpd_req_t *req)
 {
     esp_err_t ret;
@@ -343,6 +491,9 @@ static esp_err_t camera_settings_handler(httpd_req_t *req)
     json_root = NULL;
 
     ESP_GOTO_ON_ERROR(set_camera_jpeg_quality(&web_cam->video[index], jpeg_quality), fail1, TAG, "failed to set camera jpeg quality");
+#if CONFIG_EXAMPLE_SAVE_CAMERA_CONFIG
+    save_camera_jpeg_quality(&web_cam->video[index]);
+#endif
 
     httpd_resp_sendstr(req, "OK");
     return ESP_OK;
@@ -396,28 +547,30 @@ static esp_err_t static_file_handler(httpd_req_t *req)
     return ESP_FAIL;
 }
 
-static esp_err_t image_stream_handler(httpd_req_t *req)
+static esp_err_t image_stream_send_part(httpd_req_t *req, const uint8_t *data, uint32_t size)
 {
-    esp_err_t ret;
-    struct v4l2_buffer buf;
+    int hlen;
+    struct timespec ts;
     char http_string[128];
-    bool locked = false;
-    web_cam_video_t *video = (web_cam_video_t *)req->user_ctx;
 
-    ESP_RETURN_ON_FALSE(snprintf(http_string, sizeof(http_string), "%" PRIu32, video->frame_rate) > 0,
-                        ESP_FAIL, TAG, "failed to format framerate buffer");
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY)), TAG, "failed to send boundary");
 
-    ESP_RETURN_ON_ERROR(httpd_resp_set_type(req, STREAM_CONTENT_TYPE), TAG, "failed to set content type");
-    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*"), TAG, "failed to set access control allow origin");
-    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "X-Framerate", http_string), TAG, "failed to set x framerate");
+    ESP_RETURN_ON_ERROR(clock_gettime(CLOCK_MONOTONIC, &ts), TAG, "failed to get time");
+    ESP_RETURN_ON_FALSE((hlen = snprintf(http_string, sizeof(http_string), STREAM_PART, size, ts.tv_sec, ts.tv_nsec)) > 0,
+                        ESP_FAIL, TAG, "failed to format part buffer");
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, http_string, hlen), TAG, "failed to send boundary");
 
-    while (1) {
-        int hlen;
-        struct timespec ts;
-        uint32_t jpeg_encoded_size;
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, (const char *)data, size), TAG, "failed to send jpeg");
 
-        locked = false;
+    return ESP_OK;
+}
+
+static esp_err_t image_stream_camera_jpeg(httpd_req_t *req, web_cam_video_t *video)
+{
+    esp_err_t ret;
+    struct v4l2_buffer buf;
 
+    while (1) {
         memset(&buf, 0, sizeof(buf));
         buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory = V4L2_MEMORY_MMAP;
@@ -427,43 +580,216 @@ static esp_err_t image_stream_handler(httpd_req_t *req)
             continue;
         }
 
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY)), fail0, TAG, "failed to send boundary");
+        ret = image_stream_send_part(req, video->buffer[buf.index], buf.bytesused);
+        ESP_RETURN_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), TAG, "failed to queue video frame");
+        ESP_RETURN_ON_ERROR(ret, TAG, "failed to send video frame");
+    }
 
-        if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
-            video->jpeg_out_buf = video->buffer[buf.index];
-            jpeg_encoded_size = buf.bytesused;
-        } else {
-            ESP_GOTO_ON_FALSE(xSemaphoreTake(video->sem, portMAX_DELAY) == pdPASS, ESP_FAIL, fail0, TAG, "failed to take semaphore");
-            locked = true;
+    return ESP_OK;
+}
+
+/**
+ * Frame N is sent while frame N+1 is encoded into the other output buffer of
+ * the pipeline, so the encoding time of a frame is hidden behind the network
+ * send of the previous one.
+ */
+static esp_err_t image_stream_encoded(httpd_req_t *req, web_cam_video_t *video)
+{
+    esp_err_t ret;
+    struct v4l2_buffer buf;
+    example_encoder_pipeline_handle_t pipeline;
+    example_encoder_frame_t *frame = NULL;
+
+    ESP_RETURN_ON_ERROR(example_encoder_pipeline_create(video->encoder_handle, EXAMPLE_STREAM_JPEG_BUFFER_NUMBER, &pipeline),
+                        TAG, "failed to create encoder pipeline");
+
+    while (1) {
+        example_encoder_frame_t *next;
 
-            ESP_GOTO_ON_ERROR(example_encoder_process(video->encoder_handle, video->buffer[buf.index], video->buffer_size,
-                              video->jpeg_out_buf, video->jpeg_out_size, &jpeg_encoded_size),
-                              fail0, TAG, "failed to encode video frame");
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_DQBUF, &buf), fail0, TAG, "failed to receive video frame");
+        if (!(buf.flags & V4L2_BUF_FLAG_DONE)) {
+            ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), fail0, TAG, "failed to queue video frame");
+            continue;
         }
 
-        ESP_GOTO_ON_ERROR(clock_gettime(CLOCK_MONOTONIC, &ts), fail0, TAG, "failed to get time");
-        ESP_GOTO_ON_FALSE((hlen = snprintf(http_string, sizeof(http_string), STREAM_PART, jpeg_encoded_size, ts.tv_sec, ts.tv_nsec)) > 0,
-                          ESP_FAIL, fail0, TAG, "failed to format part buffer");
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, http_string, hlen), fail0, TAG, "failed to send boundary");
+        ESP_GOTO_ON_ERROR(example_encoder_pipeline_submit(pipeline, video->buffer[buf.index], video->buffer_size, NULL),
+                          fail1, TAG, "failed to encode video frame");
 
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, (char *)video->jpeg_out_buf, jpeg_encoded_size), fail0, TAG, "failed to send jpeg");
-        if (locked) {
-            xSemaphoreGive(video->sem);
-            locked = false;
+        if (frame) {
+            ret = image_stream_send_part(req, frame->buf, frame->size);
+            example_encoder_pipeline_release(pipeline, frame);
+            frame = NULL;
+            ESP_GOTO_ON_ERROR(ret, fail1, TAG, "failed to send video frame");
         }
 
-        ESP_RETURN_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), TAG, "failed to queue video frame");
+        ret = example_encoder_pipeline_complete(pipeline, &next);
+        ioctl(video->fd, VIDIOC_QBUF, &buf);
+        if (ret != ESP_OK) {
+            example_encoder_pipeline_release(pipeline, next);
+            ESP_LOGE(TAG, "failed to encode video frame");
+            goto fail0;
+        }
+        frame = next;
     }
 
     return ESP_OK;
 
+fail1:
+    /* The encoder may still read the camera buffer until the pipeline is deleted */
+    example_encoder_pipeline_delete(pipeline);
+    ioctl(video->fd, VIDIOC_QBUF, &buf);
+    return ret;
 fail0:
-    if (locked) {
-        xSemaphoreGive(video->sem);
+    if (frame) {
+        example_encoder_pipeline_release(pipeline, frame);
     }
-    ioctl(video->fd, VIDIOC_QBUF, &buf);
+    example_encoder_pipeline_delete(pipeline);
+    return ret;
+}
+
+static esp_err_t image_stream_handler(httpd_req_t *req)
+{
+    char http_string[128];
+    web_cam_video_t *video = (web_cam_video_t *)req->user_ctx;
+
+    ESP_RETURN_ON_FALSE(snprintf(http_string, sizeof(http_string), "%" PRIu32, video->frame_rate) > 0,
+                        ESP_FAIL, TAG, "failed to format framerate buffer");
+
+    ESP_RETURN_ON_ERROR(httpd_resp_set_type(req, STREAM_CONTENT_TYPE), TAG, "failed to set content type");
+    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*"), TAG, "failed to set access control allow origin");
+    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "X-Framerate", http_string), TAG, "failed to set x framerate");
+
+    if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
+        return image_stream_camera_jpeg(req, video);
+    }
+
+    return image_stream_encoded(req, video);
+}
+
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+/* The image of a set frame, encoded into the JPEG output buffer of its camera unless the camera gives JPEG */
+static esp_err_t group_stream_image(web_cam_video_t *video, const capture_group_frame_t *frame,
+                                    const uint8_t **data, uint32_t *size)
+{
+    if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
+        *data = video->buffer[frame->index];
+        *size = frame->bytesused;
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_ERROR(example_encoder_process_priority(video->encoder_handle, EXAMPLE_ENCODER_PRIORITY_LIVE,
+                                                         video->buffer[frame->index], video->buffer_size,
+                                                         video->jpeg_out_buf, video->jpeg_out_size, size),
+                        TAG, "failed to encode video%d frame", video->index);
+    *data = video->jpeg_out_buf;
+
+    return ESP_OK;
+}
+
+static esp_err_t group_stream_send_set(httpd_req_t *req, web_cam_video_t **videos, const capture_group_set_t *set)
+{
+    int hlen;
+    char http_string[160];
+    char image_header[CAPTURE_GROUP_MAX_MEMBERS][160];
+    int image_header_len[CAPTURE_GROUP_MAX_MEMBERS];
+    const uint8_t *data[CAPTURE_GROUP_MAX_MEMBERS];
+    uint32_t size[CAPTURE_GROUP_MAX_MEMBERS];
+    uint32_t length = strlen(STREAM_GROUP_END);
+    int64_t timestamp_us = set->frame[0].timestamp_us;
+
+    /* All images are ready before the part starts, its length covers them all */
+    for (uint32_t i = 0; i < set->count; i++) {
+        const capture_group_frame_t *frame = &set->frame[i];
+
+        ESP_RETURN_ON_ERROR(group_stream_image(videos[i], frame, &data[i], &size[i]), TAG, "failed to get image");
+        image_header_len[i] = snprintf(image_header[i], sizeof(image_header[i]), STREAM_GROUP_IMAGE, size[i],
+                                       videos[i]->index, (int)(frame->timestamp_us / 1000000),
+                                       (int)(frame->timestamp_us % 1000000), frame->sequence);
+        ESP_RETURN_ON_FALSE(image_header_len[i] > 0 && (size_t)image_header_len[i] < sizeof(image_header[i]), ESP_FAIL,
+                            TAG, "failed to format image header");
+        length += image_header_len[i] + size[i] + 2;
+    }
+
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY)), TAG, "failed to send boundary");
+    ESP_RETURN_ON_FALSE((hlen = snprintf(http_string, sizeof(http_string), STREAM_GROUP_PART, length,
+                                         (int)(timestamp_us / 1000000), (int)(timestamp_us % 1000000), set->spread_us)) > 0,
+                        ESP_FAIL, TAG, "failed to format part buffer");
+    ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, http_string, hlen), TAG, "failed to send part header");
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, image_header[i], image_header_len[i]), TAG, "failed to send image header");
+        ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, (const char *)data[i], size[i]), TAG, "failed to send jpeg");
+        ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, "\r\n", 2), TAG, "failed to send image end");
+    }
+
+    return httpd_resp_send_chunk(req, STREAM_GROUP_END, strlen(STREAM_GROUP_END));
+}
+
+/* Hold the JPEG output buffers of the cameras, always taken in camera order */
+static void group_stream_lock(web_cam_video_t **videos, uint32_t count, bool lock)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (lock) {
+            xSemaphoreTake(videos[i]->sem, portMAX_DELAY);
+        } else {
+            xSemaphoreGive(videos[i]->sem);
+        }
+    }
+}
+
+static esp_err_t group_stream_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+    uint32_t count = 0;
+    int fds[CAPTURE_GROUP_MAX_MEMBERS];
+    web_cam_video_t *videos[CAPTURE_GROUP_MAX_MEMBERS];
+    capture_group_t *group;
+    capture_group_set_t set;
+    capture_group_stats_t stats;
+    web_cam_t *web_cam = (web_cam_t *)req->user_ctx;
+
+    for (int i = 0; i < web_cam->video_count && count < CAPTURE_GROUP_MAX_MEMBERS; i++) {
+        if (is_valid_web_cam(&web_cam->video[i])) {
+            videos[count] = &web_cam->video[i];
+            fds[count++] = web_cam->video[i].fd;
+        }
+    }
+
+    capture_group_config_t config = {
+        .fds = fds,
+        .count = count,
+        .tolerance_us = EXAMPLE_GROUP_TOLERANCE_US,
+#if CONFIG_EXAMPLE_CAPTURE_GROUP_HW_SYNC
+        .hw_sync = true,
+#endif
+    };
+    ESP_RETURN_ON_ERROR(capture_group_create(&config, &group), TAG, "failed to create capture group");
+
+    ESP_GOTO_ON_ERROR(httpd_resp_set_type(req, STREAM_CONTENT_TYPE), exit, TAG, "failed to set content type");
+    ESP_GOTO_ON_ERROR(httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*"), exit, TAG, "failed to set access control allow origin");
+
+    while (1) {
+        ESP_GOTO_ON_ERROR(capture_group_get(group, &set), exit, TAG, "failed to get frame set");
+
+        group_stream_lock(videos, count, true);
+        ret = group_stream_send_set(req, videos, &set);
+        group_stream_lock(videos, count, false);
+
+        capture_group_put(group, &set);
+        ESP_GOTO_ON_ERROR(ret, exit, TAG, "failed to send frame set");
+    }
+
+exit:
+    capture_group_get_stats(group, &stats);
+    ESP_LOGI(TAG, "group stream: %" PRIu32 " sets, %" PRIu32 " unmatched frames dropped, largest spread %" PRIu32 " us",
+             stats.sets, stats.discarded, stats.max_spread_us);
+    capture_group_delete(group);
     return ret;
 }
+#endif
 
 static esp_err_t capture_image_handler(httpd_req_t *req)
 {
@@ -505,6 +831,23 @@ static esp_err_t init_web_cam_video(web_cam_video_t *video, const web_cam_video_
     fd = open(config->dev_name, O_RDWR);
     ESP_RETURN_ON_FALSE(fd >= 0, ESP_ERR_NOT_FOUND, TAG, "Open video device %s failed", config->dev_name);
 
+#if CONFIG_EXAMPLE_CAPTURE_GROUP_HW_SYNC
+    /* The MIPI-CSI sensor drives XVS for the others, its frames are timed at the XVS edges */
+    if (strcmp(config->dev_name, ESP_VIDEO_MIPI_CSI_DEVICE_NAME) == 0) {
+        struct v4l2_ext_controls controls = {0};
+        struct v4l2_ext_control control[1] = {0};
+
+        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+        controls.count = 1;
+        controls.controls = control;
+        control[0].id = V4L2_CID_ESP_SENSOR_SYNC_MODE;
+        control[0].value = ESP_VIDEO_SENSOR_SYNC_LEADER;
+        if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
+            ESP_LOGW(TAG, "video%d: sensor can not lead the XVS sync, frames are matched by readout time", index);
+        }
+    }
+#endif
+
     memset(&sparm, 0, sizeof(sparm));
     sparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ESP_GOTO_ON_ERROR(ioctl(fd, VIDIOC_G_PARM, &sparm), fail0, TAG, "failed to get frame rate from %s", config->dev_name);
@@ -541,21 +884,28 @@ static esp_err_t init_web_cam_video(web_cam_video_t *video, const web_cam_video_
     video->width = format.fmt.pix.width;
     video->height = format.fmt.pix.height;
     video->pixel_format = format.fmt.pix.pixelformat;
+#if CONFIG_EXAMPLE_SAVE_CAMERA_CONFIG
+    video->jpeg_quality = load_camera_jpeg_quality(video);
+#else
     video->jpeg_quality = EXAMPLE_JPEG_ENC_QUALITY;
+#endif
 
     if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
-        ESP_GOTO_ON_ERROR(set_camera_jpeg_quality(video, EXAMPLE_JPEG_ENC_QUALITY), fail0, TAG, "failed to set jpeg quality");
+        ESP_GOTO_ON_ERROR(set_camera_jpeg_quality(video, video->jpeg_quality), fail0, TAG, "failed to set jpeg quality");
     } else {
         example_encoder_config_t encoder_config = {0};
 
         encoder_config.width = video->width;
         encoder_config.height = video->height;
         encoder_config.pixel_format = video->pixel_format;
-        encoder_config.quality = EXAMPLE_JPEG_ENC_QUALITY;
+        encoder_config.quality = video->jpeg_quality;
         ESP_GOTO_ON_ERROR(example_encoder_init(&encoder_config, &video->encoder_handle), fail0, TAG, "failed to init encoder");
 
         ESP_GOTO_ON_ERROR(example_encoder_alloc_output_buffer(video->encoder_handle, &video->jpeg_out_buf, &video->jpeg_out_size),
                           fail1, TAG, "failed to alloc jpeg output buf");
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+        esp_video_mem_stats_add(ESP_VIDEO_MEM_OWNER_APP, video->jpeg_out_buf, video->jpeg_out_size);
+#endif
 
         video->support_control_jpeg_quality = 1;
     }
@@ -568,6 +918,9 @@ static esp_err_t init_web_cam_video(web_cam_video_t *video, const web_cam_video_
 
 fail2:
     if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+        esp_video_mem_stats_remove(ESP_VIDEO_MEM_OWNER_APP, video->jpeg_out_buf, video->jpeg_out_size);
+#endif
         example_encoder_free_output_buffer(video->encoder_handle, video->jpeg_out_buf);
         video->jpeg_out_buf = NULL;
     }
@@ -590,6 +943,9 @@ static esp_err_t deinit_web_cam_video(web_cam_video_t *video)
     }
 
     if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+        esp_video_mem_stats_remove(ESP_VIDEO_MEM_OWNER_APP, video->jpeg_out_buf, video->jpeg_out_size);
+#endif
         example_encoder_free_output_buffer(video->encoder_handle, video->jpeg_out_buf);
         example_encoder_deinit(video->encoder_handle);
     }
@@ -706,6 +1062,15 @@ static esp_err_t http_server_init(web_cam_t *web_cam)
         .user_ctx = (void *)web_cam
     };
 
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+    httpd_uri_t memory_info_uri = {
+        .uri = "/api/get_memory_info",
+        .method = HTTP_GET,
+        .handler = memory_info_handler,
+        .user_ctx = NULL
+    };
+#endif
+
     config.stack_size = 1024 * 6;
     ESP_LOGI(TAG, "Starting stream server on port: '%d'", config.server_port);
     if (httpd_start(&stream_httpd, &config) == ESP_OK) {
@@ -714,6 +1079,12 @@ static esp_err_t http_server_init(web_cam_t *web_cam)
         httpd_register_uri_handler(stream_httpd, &capture_binary_uri);
         httpd_register_uri_handler(stream_httpd, &camera_info_uri);
         httpd_register_uri_handler(stream_httpd, &camera_settings_uri);
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+        httpd_register_uri_handler(stream_httpd, &memory_info_uri);
+
+        /* The server task stack is internal RAM, like the server object */
+        esp_video_mem_stats_add(ESP_VIDEO_MEM_OWNER_APP, stream_httpd, config.stack_size);
+#endif
 
         /* Register wildcard static file handler to catch all other requests */
         httpd_register_uri_handler(stream_httpd, &static_file_uri);
@@ -736,8 +1107,42 @@ static esp_err_t http_server_init(web_cam_t *web_cam)
         config.ctrl_port += 1;
         if (httpd_start(&stream_httpd, &config) == ESP_OK) {
             httpd_register_uri_handler(stream_httpd, &stream_0_uri);
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+            esp_video_mem_stats_add(ESP_VIDEO_MEM_OWNER_APP, stream_httpd, config.stack_size);
+#endif
+        }
+    }
+
+#if CONFIG_EXAMPLE_CAPTURE_GROUP
+    int valid_count = 0;
+
+    for (int i = 0; i < web_cam->video_count; i++) {
+        valid_count += is_valid_web_cam(&web_cam->video[i]);
+    }
+
+    if (valid_count >= 2) {
+        httpd_uri_t group_stream_uri = {
+            .uri = "/group_stream",
+            .method = HTTP_GET,
+            .handler = group_stream_handler,
+            .user_ctx = (void *)web_cam
+        };
+
+        config.stack_size = 1024 * 8;
+        config.server_port += 1;
+        config.ctrl_port += 1;
+        if (httpd_start(&stream_httpd, &config) == ESP_OK) {
+            httpd_register_uri_handler(stream_httpd, &group_stream_uri);
+            web_cam->group_port = config.server_port;
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+            esp_video_mem_stats_add(ESP_VIDEO_MEM_OWNER_APP, stream_httpd, config.stack_size);
+#endif
+            ESP_LOGI(TAG, "Starting group stream server on port: '%d'", config.server_port);
         }
+    } else {
+        ESP_LOGW(TAG, "the group stream needs two cameras, %d found", valid_count);
     }
+#endif
 
     return ESP_OK;
 }
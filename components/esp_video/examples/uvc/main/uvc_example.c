@@ -5,14 +5,19 @@
  */
 
 #include <string.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_log.h"
-#include "esp_timer.h"
+#include "esp_video_handle.h"
 #include "usb_device_uvc.h"
 #include "uvc_frame_config.h"
 #include "example_video_common.h"
@@ -20,6 +25,7 @@
 #if CONFIG_FORMAT_MJPEG_CAM1
 #define ENCODE_DEV_PATH     ESP_VIDEO_JPEG_DEVICE_NAME
 #define UVC_OUTPUT_FORMAT   V4L2_PIX_FMT_JPEG
+#define M2M_BUFFER_COUNT    3   /* One sent, one waiting for the UVC stack, one being encoded */
 #elif CONFIG_FORMAT_H264_CAM1
 #if CONFIG_EXAMPLE_H264_MAX_QP <= CONFIG_EXAMPLE_H264_MIN_QP
 #error "CONFIG_EXAMPLE_H264_MAX_QP should larger than CONFIG_EXAMPLE_H264_MIN_QP"
@@ -27,17 +33,31 @@
 
 #define ENCODE_DEV_PATH     ESP_VIDEO_H264_DEVICE_NAME
 #define UVC_OUTPUT_FORMAT   V4L2_PIX_FMT_H264
+#define M2M_BUFFER_COUNT    2   /* The H.264 device sizes each buffer at width * height * 4 */
 #endif
 
-#define BUFFER_COUNT        2
+#define BUFFER_COUNT        3   /* One being captured, one waiting for the encoder, one being encoded */
+
+#define ENCODE_TASK_STACK_SIZE  4096
+#define ENCODE_TASK_PRIORITY    5
+#define ENCODE_WAIT_MS          100     /* The encoder task checks for a stop this often */
+#define FB_WAIT_MS              1000
 
 typedef struct uvc {
     int cap_fd;
     uint32_t format;
-    uint8_t *cap_buffer[BUFFER_COUNT];
+    esp_video_handle_t cap_handle;
 
     int m2m_fd;
-    uint8_t *m2m_cap_buffer;
+    uint8_t *m2m_cap_buffer[M2M_BUFFER_COUNT];
+    esp_video_handle_t m2m_handle;
+
+    int width;
+    int height;
+    volatile bool streaming;            /*!< Cleared to stop the encoder task */
+    SemaphoreHandle_t encode_done;      /*!< Given by the encoder task when it exits */
+    QueueHandle_t ready;                /*!< Newest encoded frame, esp_video_frame_t */
+    uint32_t fb_index;                  /*!< Codec capture buffer held by the UVC stack */
 
     uvc_fb_t fb;
 } uvc_t;
@@ -98,6 +118,7 @@ static esp_err_t init_capture_video(uvc_t *uvc)
 
     ESP_ERROR_CHECK(ioctl(fd, VIDIOC_QUERYCAP, &capability));
     print_video_device_info(&capability);
+    ESP_ERROR_CHECK(ioctl(fd, VIDIOC_G_VIDEO_HANDLE, &uvc->cap_handle));
 
     uvc->cap_fd = fd;
 
@@ -165,12 +186,17 @@ static esp_err_t init_codec_video(uvc_t *uvc)
     }
 #endif
 
+    ESP_ERROR_CHECK(ioctl(fd, VIDIOC_G_VIDEO_HANDLE, &uvc->m2m_handle));
+
     uvc->format = UVC_OUTPUT_FORMAT;
     uvc->m2m_fd = fd;
 
     return 0;
 }
 
+static void video_stop_cb(void *cb_ctx);
+static void video_encode_task(void *arg);
+
 static esp_err_t video_start_cb(uvc_format_t uvc_format, int width, int height, int rate, void *cb_ctx)
 {
     int type;
@@ -233,21 +259,7 @@ static esp_err_t video_start_cb(uvc_format_t uvc_format, int width, int height,
     req.memory = V4L2_MEMORY_MMAP;
     ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_REQBUFS, &req));
 
-    for (int i = 0; i < BUFFER_COUNT; i++) {
-        memset(&buf, 0, sizeof(buf));
-        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory      = V4L2_MEMORY_MMAP;
-        buf.index       = i;
-        ESP_ERROR_CHECK (ioctl(uvc->cap_fd, VIDIOC_QUERYBUF, &buf));
-
-        uvc->cap_buffer[i] = (uint8_t *)mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
-                                             MAP_SHARED, uvc->cap_fd, buf.m.offset);
-        assert(uvc->cap_buffer[i]);
-
-        ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_QBUF, &buf));
-    }
-
-    /* Configure codec output stream */
+    /* Configure codec output stream, its buffers borrow the camera buffers once linked */
 
     memset(&format, 0, sizeof(format));
     format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
@@ -257,7 +269,7 @@ static esp_err_t video_start_cb(uvc_format_t uvc_format, int width, int height,
     ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_S_FMT, &format));
 
     memset(&req, 0, sizeof(req));
-    req.count  = 1;
+    req.count  = BUFFER_COUNT;
     req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
     req.memory = V4L2_MEMORY_USERPTR;
     ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_REQBUFS, &req));
@@ -272,22 +284,38 @@ static esp_err_t video_start_cb(uvc_format_t uvc_format, int width, int height,
     ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_S_FMT, &format));
 
     memset(&req, 0, sizeof(req));
-    req.count  = 1;
+    req.count  = M2M_BUFFER_COUNT;
     req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
     ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_REQBUFS, &req));
 
-    memset(&buf, 0, sizeof(buf));
-    buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory      = V4L2_MEMORY_MMAP;
-    buf.index       = 0;
-    ESP_ERROR_CHECK (ioctl(uvc->m2m_fd, VIDIOC_QUERYBUF, &buf));
+    for (int i = 0; i < M2M_BUFFER_COUNT; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory      = V4L2_MEMORY_MMAP;
+        buf.index       = i;
+        ESP_ERROR_CHECK (ioctl(uvc->m2m_fd, VIDIOC_QUERYBUF, &buf));
+
+        uvc->m2m_cap_buffer[i] = (uint8_t *)mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED, uvc->m2m_fd, buf.m.offset);
+        assert(uvc->m2m_cap_buffer[i]);
+
+        ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_QBUF, &buf));
+    }
 
-    uvc->m2m_cap_buffer = (uint8_t *)mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
-                                          MAP_SHARED, uvc->m2m_fd, buf.m.offset);
-    assert(uvc->m2m_cap_buffer);
+    /*
+     * Camera frames go to the codec from the driver's done path, the
+     * application never dequeues them. Queue the camera buffers after linking.
+     */
+    ESP_ERROR_CHECK(esp_video_handle_link(uvc->cap_handle, uvc->m2m_handle));
 
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_QBUF, &buf));
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory      = V4L2_MEMORY_MMAP;
+        buf.index       = i;
+        ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_QBUF, &buf));
+    }
 
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_STREAMON, &type));
@@ -297,6 +325,17 @@ static esp_err_t video_start_cb(uvc_format_t uvc_format, int width, int height,
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_STREAMON, &type));
 
+    uvc->width = width;
+    uvc->height = height;
+    uvc->streaming = true;
+    xQueueReset(uvc->ready);
+    if (xTaskCreate(video_encode_task, "uvc_encode", ENCODE_TASK_STACK_SIZE, uvc, ENCODE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create encoder task");
+        uvc->streaming = false;
+        video_stop_cb(uvc);
+        return ESP_ERR_NO_MEM;
+    }
+
     return ESP_OK;
 }
 
@@ -307,6 +346,12 @@ static void video_stop_cb(void *cb_ctx)
 
     ESP_LOGD(TAG, "UVC stop");
 
+    if (uvc->streaming) {
+        uvc->streaming = false;
+        xSemaphoreTake(uvc->encode_done, portMAX_DELAY);
+    }
+
+    /* The camera stops first, a linked frame must not reach a stopped codec */
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ioctl(uvc->cap_fd, VIDIOC_STREAMOFF, &type);
 
@@ -314,68 +359,84 @@ static void video_stop_cb(void *cb_ctx)
     ioctl(uvc->m2m_fd, VIDIOC_STREAMOFF, &type);
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ioctl(uvc->m2m_fd, VIDIOC_STREAMOFF, &type);
+
+    esp_video_handle_unlink(uvc->cap_handle);
+    xQueueReset(uvc->ready);
 }
 
-static uvc_fb_t *video_fb_get_cb(void *cb_ctx)
+static void video_requeue(uvc_t *uvc, uint32_t index)
 {
-    int64_t us;
-    uvc_t *uvc = (uvc_t *)cb_ctx;
-    struct v4l2_format format;
-    struct v4l2_buffer cap_buf;
-    struct v4l2_buffer m2m_out_buf;
-    struct v4l2_buffer m2m_cap_buf;
+    esp_video_frame_t frame = {
+        .index = index,
+    };
 
-    ESP_LOGD(TAG, "UVC get");
+    if (esp_video_handle_qbuf(uvc->m2m_handle, V4L2_BUF_TYPE_VIDEO_CAPTURE, &frame) != ESP_OK) {
+        /* Expected for a frame returned after the stream stopped */
+        ESP_LOGD(TAG, "failed to queue codec buffer %" PRIu32, index);
+    }
+}
+
+/*
+ * Dequeuing an encoded frame runs the codec on the oldest linked camera frame,
+ * so encoding overlaps with the UVC stack sending the previous frame and the
+ * camera capturing the next one.
+ */
+static void video_encode_task(void *arg)
+{
+    uvc_t *uvc = (uvc_t *)arg;
+    esp_video_frame_t frame;
+    esp_video_frame_t stale;
+
+    while (uvc->streaming) {
+        if (esp_video_handle_dqbuf(uvc->m2m_handle, V4L2_BUF_TYPE_VIDEO_CAPTURE, pdMS_TO_TICKS(ENCODE_WAIT_MS),
+                                   &frame) != ESP_OK) {
+            continue;
+        }
 
-    memset(&cap_buf, 0, sizeof(cap_buf));
-    cap_buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    cap_buf.memory = V4L2_MEMORY_MMAP;
-    ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_DQBUF, &cap_buf));
+        /* The host wants the newest frame, a frame it did not pick up yet goes back to the codec */
+        if (xQueueReceive(uvc->ready, &stale, 0) == pdTRUE) {
+            video_requeue(uvc, stale.index);
+        }
+        xQueueSend(uvc->ready, &frame, 0);
+    }
 
-    memset(&m2m_out_buf, 0, sizeof(m2m_out_buf));
-    m2m_out_buf.index  = 0;
-    m2m_out_buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    m2m_out_buf.memory = V4L2_MEMORY_USERPTR;
-    m2m_out_buf.m.userptr = (unsigned long)uvc->cap_buffer[cap_buf.index];
-    m2m_out_buf.length = cap_buf.bytesused;
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_QBUF, &m2m_out_buf));
+    xSemaphoreGive(uvc->encode_done);
+    vTaskDelete(NULL);
+}
 
-    memset(&m2m_cap_buf, 0, sizeof(m2m_cap_buf));
-    m2m_cap_buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    m2m_cap_buf.memory = V4L2_MEMORY_MMAP;
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_DQBUF, &m2m_cap_buf));
+static uvc_fb_t *video_fb_get_cb(void *cb_ctx)
+{
+    uvc_t *uvc = (uvc_t *)cb_ctx;
+    esp_video_frame_t frame;
 
-    ESP_ERROR_CHECK(ioctl(uvc->cap_fd, VIDIOC_QBUF, &cap_buf));
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_DQBUF, &m2m_out_buf));
+    ESP_LOGD(TAG, "UVC get");
 
-    memset(&format, 0, sizeof(format));
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_G_FMT, &format));
+    if (xQueueReceive(uvc->ready, &frame, pdMS_TO_TICKS(FB_WAIT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "no encoded frame");
+        return NULL;
+    }
 
-    uvc->fb.buf = uvc->m2m_cap_buffer;
-    uvc->fb.len = m2m_cap_buf.bytesused;
-    uvc->fb.width = format.fmt.pix.width;
-    uvc->fb.height = format.fmt.pix.height;
-    uvc->fb.format = format.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG ? UVC_FORMAT_JPEG : UVC_FORMAT_H264;
+    uvc->fb_index = frame.index;
+    uvc->fb.buf = uvc->m2m_cap_buffer[frame.index];
+    uvc->fb.len = frame.bytesused;
+    uvc->fb.width = uvc->width;
+    uvc->fb.height = uvc->height;
+    uvc->fb.format = uvc->format == V4L2_PIX_FMT_JPEG ? UVC_FORMAT_JPEG : UVC_FORMAT_H264;
 
-    us = esp_timer_get_time();
-    uvc->fb.timestamp.tv_sec = us / 1000000UL;;
-    uvc->fb.timestamp.tv_usec = us % 1000000UL;
+    /* Encoded frames keep the capture time of their camera frame */
+    uvc->fb.timestamp.tv_sec = frame.timestamp_us / 1000000UL;
+    uvc->fb.timestamp.tv_usec = frame.timestamp_us % 1000000UL;
 
     return &uvc->fb;
 }
 
 static void video_fb_return_cb(uvc_fb_t *fb, void *cb_ctx)
 {
-    struct v4l2_buffer m2m_cap_buf;
     uvc_t *uvc = (uvc_t *)cb_ctx;
 
     ESP_LOGD(TAG, "UVC return");
 
-    m2m_cap_buf.index  = 0;
-    m2m_cap_buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    m2m_cap_buf.memory = V4L2_MEMORY_MMAP;
-    ESP_ERROR_CHECK(ioctl(uvc->m2m_fd, VIDIOC_QBUF, &m2m_cap_buf));
+    video_requeue(uvc, uvc->fb_index);
 }
 
 static esp_err_t init_uvc(uvc_t *uvc)
@@ -408,6 +469,9 @@ void app_main(void)
 {
     uvc_t *uvc = calloc(1, sizeof(uvc_t));
     assert(uvc);
+    uvc->encode_done = xSemaphoreCreateBinary();
+    uvc->ready = xQueueCreate(1, sizeof(esp_video_frame_t));
+    assert(uvc->encode_done && uvc->ready);
 
     ESP_ERROR_CHECK(example_video_init());
     ESP_ERROR_CHECK(init_capture_video(uvc));
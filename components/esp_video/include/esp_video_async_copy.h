@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Asynchronous frame copy object handle
+ */
+typedef struct esp_video_async_copy *esp_video_async_copy_handle_t;
+
+/**
+ * @brief Copy done callback, called in ISR context
+ *
+ * @param dst   Destination buffer, the copied data is visible to the CPU
+ * @param size  Copied data size
+ * @param arg   User argument given to esp_video_async_copy_start
+ *
+ * @return true if a higher priority task was woken up, false otherwise
+ */
+typedef bool (*esp_video_async_copy_done_cb_t)(void *dst, size_t size, void *arg);
+
+#define ESP_VIDEO_ASYNC_COPY_FLAG_NO_SRC_CLEAN  (1 << 0)    /*!< The CPU did not write the source, its cache holds no dirty line */
+
+/**
+ * @brief Asynchronous frame copy configuration
+ */
+typedef struct esp_video_async_copy_config {
+    uint32_t backlog;                           /*!< Maximum number of copies in flight, 0 for 1 */
+} esp_video_async_copy_config_t;
+
+/**
+ * @brief Create asynchronous frame copy object
+ *
+ * The copy runs on a GDMA channel, so a dequeued video buffer element can be
+ * moved to a staging buffer without the CPU and returned to the driver as
+ * soon as the copy is done.
+ *
+ * @param config        Configuration, NULL for the default one
+ * @param ret_handle    Returned object handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if ret_handle is NULL
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ *      - Others if the DMA channel could not be allocated
+ */
+esp_err_t esp_video_async_copy_create(const esp_video_async_copy_config_t *config,
+                                      esp_video_async_copy_handle_t *ret_handle);
+
+/**
+ * @brief Start copying a buffer
+ *
+ * The source is written back and the destination is invalidated in the
+ * cache before the DMA starts, and the destination is invalidated again
+ * before done_cb is called. Neither buffer may be accessed until done_cb is
+ * called. A source only written by a DMA, e.g. a capture buffer dequeued
+ * with V4L2_BUF_FLAG_NO_CACHE_CLEAN, needs no write back.
+ *
+ * @param handle    Object handle
+ * @param dst       Destination buffer, aligned to the cache line of its memory
+ * @param src       Source buffer, aligned to the cache line of its memory
+ * @param size      Data size, a multiple of the cache line size
+ * @param flags     ESP_VIDEO_ASYNC_COPY_FLAG_XXX
+ * @param done_cb   Callback called when the copy is done
+ * @param arg       User argument of done_cb
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid or a buffer is not aligned
+ *      - ESP_ERR_INVALID_STATE if the backlog is full
+ *      - Others if the copy could not be started
+ */
+esp_err_t esp_video_async_copy_start(esp_video_async_copy_handle_t handle, void *dst, const void *src, size_t size,
+                                     uint32_t flags, esp_video_async_copy_done_cb_t done_cb, void *arg);
+
+/**
+ * @brief Delete asynchronous frame copy object
+ *
+ * @param handle    Object handle, no copy may be in flight
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if handle is NULL
+ *      - ESP_ERR_INVALID_STATE if a copy is in flight
+ */
+esp_err_t esp_video_async_copy_delete(esp_video_async_copy_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Conversions of the color converter
+ */
+typedef enum esp_video_color_convert_type {
+    ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565,   /*!< V4L2_PIX_FMT_RGB24 to V4L2_PIX_FMT_RGB565 */
+    ESP_VIDEO_COLOR_CONVERT_RGB888_TO_YUV420,   /*!< V4L2_PIX_FMT_RGB24 to V4L2_PIX_FMT_YUV420, the layout of the ISP output */
+    ESP_VIDEO_COLOR_CONVERT_RAW8_TO_RGB888,     /*!< 8-bit Bayer RAW to V4L2_PIX_FMT_RGB24 of half the width and height */
+} esp_video_color_convert_type_t;
+
+/**
+ * @brief Order of the 2x2 Bayer cell, top row first
+ */
+typedef enum esp_video_color_convert_bayer {
+    ESP_VIDEO_COLOR_CONVERT_BAYER_RGGB,
+    ESP_VIDEO_COLOR_CONVERT_BAYER_GRBG,
+    ESP_VIDEO_COLOR_CONVERT_BAYER_GBRG,
+    ESP_VIDEO_COLOR_CONVERT_BAYER_BGGR,
+} esp_video_color_convert_bayer_t;
+
+/**
+ * @brief Color converter configuration
+ */
+typedef struct esp_video_color_convert_config {
+    esp_video_color_convert_type_t type;        /*!< Conversion */
+    uint32_t width;                             /*!< Source width in pixels, even */
+    uint32_t height;                            /*!< Source height in pixels, even */
+    esp_video_color_convert_bayer_t bayer;      /*!< Bayer order of ESP_VIDEO_COLOR_CONVERT_RAW8_TO_RGB888 */
+} esp_video_color_convert_config_t;
+
+/**
+ * @brief Video color converter object handle
+ */
+typedef struct esp_video_color_convert *esp_video_color_convert_handle_t;
+
+/**
+ * @brief Create video color converter object
+ *
+ * The converter turns one frame captured from the ISP into the format of
+ * another consumer, so that a single ISP output can feed e.g. an RGB565
+ * display, a YUV420 encoder and an RGB888 stream. RGB888 conversions run on
+ * the PPA or on the CPU, as configured. The Bayer RAW conversion always runs
+ * on the CPU, every output pixel is one 2x2 cell, with the average of its
+ * two green pixels.
+ *
+ * YUV is BT.601 full range, as the JPEG encoder expects it.
+ *
+ * @param config        Configuration
+ * @param ret_handle    Returned object handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ *      - Others if the PPA could not be set up
+ */
+esp_err_t esp_video_color_convert_create(const esp_video_color_convert_config_t *config,
+                                         esp_video_color_convert_handle_t *ret_handle);
+
+/**
+ * @brief Convert one frame
+ *
+ * @param handle        Object handle
+ * @param src           Source frame pointer
+ * @param src_size      Source data size, that of a whole frame
+ * @param dst           Destination buffer pointer, cache line aligned for the PPA
+ * @param dst_size      Destination buffer size, a multiple of the cache line size for the PPA
+ * @param ret_size      Returned converted data size
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_INVALID_SIZE if the sizes do not match the frame
+ *      - Others if the PPA failed
+ */
+esp_err_t esp_video_color_convert_process(esp_video_color_convert_handle_t handle, const void *src, size_t src_size,
+                                          void *dst, size_t dst_size, size_t *ret_size);
+
+/**
+ * @brief Delete video color converter object
+ *
+ * @param handle    Object handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if handle is NULL
+ */
+esp_err_t esp_video_color_convert_delete(esp_video_color_convert_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -31,6 +31,12 @@ extern "C" {
 #define ESP_VIDEO_SPI_DEVICE_1_ID           4
 #define ESP_VIDEO_SPI_DEVICE_1_NAME         "/dev/video4"
 
+/**
+ * @brief Virtual capture device, generates frames without camera hardware
+ */
+#define ESP_VIDEO_VIRTUAL_DEVICE_ID         5
+#define ESP_VIDEO_VIRTUAL_DEVICE_NAME       "/dev/video5"
+
 #if CONFIG_ESP_VIDEO_ENABLE_THE_SECOND_SPI_VIDEO_DEVICE
 #define ESP_VIDEO_SPI_DEVICE_NUM            2
 #elif CONFIG_ESP_VIDEO_ENABLE_SPI_VIDEO_DEVICE
@@ -70,6 +76,18 @@ extern "C" {
 #define ESP_VIDEO_H264_DEVICE_ID            11
 #define ESP_VIDEO_H264_DEVICE_NAME          "/dev/video11"
 
+#define ESP_VIDEO_RAW_CODEC_DEVICE_ID       12
+#define ESP_VIDEO_RAW_CODEC_DEVICE_NAME     "/dev/video12"
+
+#define ESP_VIDEO_HDR_MERGE_DEVICE_ID       13
+#define ESP_VIDEO_HDR_MERGE_DEVICE_NAME     "/dev/video13"
+
+#define ESP_VIDEO_NDVI_DEVICE_ID            14
+#define ESP_VIDEO_NDVI_DEVICE_NAME          "/dev/video14"
+
+#define ESP_VIDEO_PPA_DEVICE_ID             15
+#define ESP_VIDEO_PPA_DEVICE_NAME           "/dev/video15"
+
 /**
  * @brief ISP video device
  */
@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_video_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Video device handle, it exchanges buffers with the driver without the VFS layer
+ */
+typedef struct esp_video *esp_video_handle_t;
+
+/**
+ * @brief Get the handle of an opened video device, the argument is a "esp_video_handle_t *".
+ *
+ * The handle stays valid until the last file descriptor of the device is closed.
+ */
+#define VIDIOC_G_VIDEO_HANDLE   _IOR('V',  BASE_VIDIOC_PRIVATE + 9, esp_video_handle_t)
+
+/**
+ * @brief Buffer exchanged by esp_video_handle_qbuf and esp_video_handle_dqbuf
+ */
+typedef struct esp_video_frame {
+    uint32_t index;                             /*!< Buffer index */
+    uint8_t *buffer;                            /*!< Buffer pointer, set by the application for USERPTR buffers */
+    uint32_t length;                            /*!< Buffer size */
+    uint32_t bytesused;                         /*!< Data size, set by the application for output buffers */
+    uint32_t flags;                             /*!< V4L2_BUF_FLAG_XXX, cache hints on queue and status on dequeue */
+    uint32_t sequence;                          /*!< Frame sequence number */
+    uint32_t dropped;                           /*!< Frames dropped since VIDIOC_STREAMON */
+    int64_t timestamp_us;                       /*!< Frame timestamp in microseconds, monotonic */
+} esp_video_frame_t;
+
+/**
+ * @brief Part of a frame the driver has received so far
+ */
+typedef struct esp_video_slice {
+    uint32_t index;                             /*!< Buffer index */
+    uint8_t *buffer;                            /*!< Buffer pointer, the frame starts here */
+    uint32_t size;                              /*!< Bytes received from the start of the frame, visible to the CPU */
+    uint32_t slice;                             /*!< Latest done slice, from 0 */
+    uint32_t slices;                            /*!< Slices per frame, the last one is only reported by dequeuing the buffer */
+    uint32_t sequence;                          /*!< Sequence number the buffer will be dequeued with */
+} esp_video_slice_t;
+
+/**
+ * @brief Dequeue a done buffer
+ *
+ * Same as VIDIOC_DQBUF on one of the single-planar buffer types. The buffers
+ * are set up and streamed with the usual ioctl commands on the device's file
+ * descriptor, the handle only replaces the per-frame round trip.
+ *
+ * @param handle Video device handle
+ * @param type   Buffer type, V4L2_BUF_TYPE_VIDEO_CAPTURE or V4L2_BUF_TYPE_VIDEO_OUTPUT
+ * @param ticks  Ticks to wait, 0 to return at once and portMAX_DELAY to wait forever
+ * @param frame  Returned buffer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_TIMEOUT if no buffer was done in time
+ */
+esp_err_t esp_video_handle_dqbuf(esp_video_handle_t handle, uint32_t type, TickType_t ticks, esp_video_frame_t *frame);
+
+/**
+ * @brief Queue a buffer
+ *
+ * Same as VIDIOC_QBUF on one of the single-planar buffer types, with MMAP or
+ * USERPTR buffers. index and flags are used for every buffer, buffer and
+ * length for USERPTR buffers and bytesused for output buffers.
+ *
+ * @param handle Video device handle
+ * @param type   Buffer type, V4L2_BUF_TYPE_VIDEO_CAPTURE or V4L2_BUF_TYPE_VIDEO_OUTPUT
+ * @param frame  Buffer to queue
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid or the buffer is already queued
+ *      - ESP_ERR_NOT_SUPPORTED if the buffers are DMABUF ones, they are queued with VIDIOC_QBUF
+ */
+esp_err_t esp_video_handle_qbuf(esp_video_handle_t handle, uint32_t type, const esp_video_frame_t *frame);
+
+/**
+ * @brief Wait for the next slice of the frame being captured
+ *
+ * With a capture device that delivers frames in slices, the top of a frame
+ * can be read while the rest is still being received. The buffer stays
+ * owned by the driver: only the first "size" bytes may be read, and the
+ * frame may still be dropped, then it is never dequeued. Slices a late
+ * consumer missed are covered by the latest one. One task at a time may
+ * wait for slices of a stream.
+ *
+ * @param handle Video device handle
+ * @param ticks  Ticks to wait, 0 to return at once and portMAX_DELAY to wait forever
+ * @param slice  Returned slice
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_NOT_SUPPORTED if slice delivery is not enabled
+ *      - ESP_ERR_TIMEOUT if no slice was done in time
+ */
+esp_err_t esp_video_handle_wait_slice(esp_video_handle_t handle, TickType_t ticks, esp_video_slice_t *slice);
+
+/**
+ * @brief Feed the capture stream of a device to the output stream of an M2M device
+ *
+ * Once linked, a frame the capture device finished is queued to the M2M
+ * output stream from the driver's done path, and its buffer goes back to the
+ * capture queue as soon as the M2M device processed it. The application only
+ * queues and dequeues the M2M capture buffers, e.g. the encoded frames, which
+ * keep the timestamp and sequence number of the captured frame.
+ *
+ * Set up both devices before linking: the capture buffers as usual and the
+ * same number of USERPTR buffers on the M2M output stream, which borrow the
+ * capture payloads. Queue the capture buffers and start all streams after
+ * linking, never queue or dequeue the linked streams, and stop the capture
+ * stream before the M2M device.
+ *
+ * @param source Capture device handle
+ * @param sink   M2M device handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the devices can not be linked, or data preprocessing is enabled
+ *      - ESP_ERR_INVALID_STATE if a stream is linked or started, or the buffers do not match
+ */
+esp_err_t esp_video_handle_link(esp_video_handle_t source, esp_video_handle_t sink);
+
+/**
+ * @brief Remove the link of a capture device, both streams must be stopped
+ *
+ * @param source Capture device handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the device is not linked or a stream is started
+ */
+esp_err_t esp_video_handle_unlink(esp_video_handle_t source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -157,6 +157,39 @@ typedef struct esp_video_init_cam_motor_config {
 } esp_video_init_cam_motor_config_t;
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+/**
+ * @brief Test pattern of the virtual video device
+ */
+typedef enum esp_video_virtual_pattern {
+    ESP_VIDEO_VIRTUAL_PATTERN_COLOR_BARS = 0,   /*!< Eight 75% color bars */
+    ESP_VIDEO_VIRTUAL_PATTERN_GRADIENT,         /*!< Black to white ramp from left to right */
+} esp_video_virtual_pattern_t;
+
+/**
+ * @brief Virtual video device initialization configuration
+ *
+ * The device has a single format, frames are produced every 1/fps second and
+ * carry that time as their timestamp. A white bar moves over the pattern by
+ * 4 pixels per frame, so consecutive frames differ.
+ */
+typedef struct esp_video_init_virtual_config {
+    uint32_t pixel_format;                      /*!< V4L2_PIX_FMT_SBGGR8, SGBRG8, SGRBG8, SRGGB8, SBGGR10 or SBGGR12 (both MIPI packed),
+                                                     GREY, RGB565, RGB24 or YUV422P */
+    uint16_t width;                             /*!< Frame width, a multiple of 4 and at least 32 */
+    uint16_t height;                            /*!< Frame height */
+    uint16_t fps;                               /*!< Frames per second */
+    esp_video_virtual_pattern_t pattern;        /*!< Test pattern, unused if file_path is set */
+    const char *file_path;                      /*!< File of back to back frames in pixel_format, replayed in a loop
+                                                     instead of the pattern, e.g. on SPIFFS or an SD card. NULL to
+                                                     generate the pattern */
+
+    uint32_t task_stack;                        /*!< Frame task stack size, 0 for the default */
+    uint8_t task_priority;                      /*!< Frame task priority, 0 for the default */
+    int task_affinity;                          /*!< Frame task affinity, -1 means no affinity */
+} esp_video_init_virtual_config_t;
+#endif /* CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE */
+
 /**
  * @brief Video hardware initialization configuration
  */
@@ -179,6 +212,9 @@ typedef struct esp_video_init_config {
 #if CONFIG_ESP_VIDEO_ENABLE_USB_UVC_VIDEO_DEVICE
     const esp_video_init_usb_uvc_config_t *usb_uvc; /*!< USB UVC video device initialization configuration */
 #endif
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+    const esp_video_init_virtual_config_t *virtual_cam; /*!< Virtual video device initialization configuration, NULL for none */
+#endif
 } esp_video_init_config_t;
 
 /**
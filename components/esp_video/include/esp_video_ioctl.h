@@ -29,11 +29,376 @@ extern "C" {
 #define VIDIOC_S_MOTOR_FMT  _IOWR('V',  BASE_VIDIOC_PRIVATE + 4, esp_cam_motor_format_t)
 #define VIDIOC_G_MOTOR_FMT  _IOWR('V',  BASE_VIDIOC_PRIVATE + 5, esp_cam_motor_format_t)
 
+/**
+ * @brief Camera sensor private ioctl command to program the sensor readout window.
+ *
+ * The argument is a "struct v4l2_rect" in pixels of the current sensor format, a rectangle
+ * covering the whole format restores full readout. The MIPI-CSI video device issues it on
+ * VIDIOC_S_SELECTION, sensors that cannot crop return ESP_ERR_NOT_SUPPORTED.
+ */
+#define ESP_VIDEO_SENSOR_IOC_S_WINDOW   _IOW('V',  BASE_VIDIOC_PRIVATE + 6, struct v4l2_rect)
+
+/**
+ * @brief Camera sensor private ioctl command to get the exposure and gain delay.
+ *
+ * The argument is a uint32_t, set to the number of frames between the frame being output when
+ * exposure or gain is written and the first frame captured with the new values. Sensors that
+ * do not know it return ESP_ERR_NOT_SUPPORTED.
+ */
+#define ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY _IOR('V', BASE_VIDIOC_PRIVATE + 15, uint32_t)
+
+#define ESP_VIDEO_SENSOR_SYNC_MASTER    0   /*!< Free-running, XVS/XHS are not driven */
+#define ESP_VIDEO_SENSOR_SYNC_LEADER    1   /*!< Free-running, XVS/XHS are driven for follower sensors */
+#define ESP_VIDEO_SENSOR_SYNC_FOLLOWER  2   /*!< Frames and lines start at the XVS/XHS inputs */
+
+/**
+ * @brief Camera sensor private ioctl command to select the frame synchronization mode.
+ *
+ * The argument is a uint32_t ESP_VIDEO_SENSOR_SYNC_XXX, taking effect at the next stream start.
+ * Sensors without external synchronization return ESP_ERR_NOT_SUPPORTED.
+ */
+#define ESP_VIDEO_SENSOR_IOC_S_SYNC_MODE _IOW('V', BASE_VIDIOC_PRIVATE + 18, uint32_t)
+
+/**
+ * @brief Buffers queued or dequeued by one VIDIOC_QBUF_BATCH or VIDIOC_DQBUF_BATCH call.
+ */
+struct esp_video_buffer_batch {
+    struct v4l2_buffer *buffers;                /*!< Buffers, each filled as for VIDIOC_QBUF or VIDIOC_DQBUF */
+    uint32_t count;                             /*!< Number of buffers */
+    uint32_t done;                              /*!< Returned number of buffers queued or dequeued */
+};
+
+/**
+ * @brief Queue an array of buffers in one call.
+ *
+ * The buffers are queued in order as by VIDIOC_QBUF, the first one that is refused stops the
+ * batch and fails the call, "done" tells how many were queued before it.
+ */
+#define VIDIOC_QBUF_BATCH   _IOWR('V',  BASE_VIDIOC_PRIVATE + 7, struct esp_video_buffer_batch)
+
+/**
+ * @brief Dequeue up to "count" buffers in one call.
+ *
+ * The first buffer is waited for as by VIDIOC_DQBUF, the following ones are only taken if they
+ * are already done. The call succeeds once a buffer was dequeued, "done" tells how many.
+ */
+#define VIDIOC_DQBUF_BATCH  _IOWR('V',  BASE_VIDIOC_PRIVATE + 8, struct esp_video_buffer_batch)
+
+#define ESP_VIDEO_DROP_NEWEST   0           /*!< The new frame is lost, done buffers wait for DQBUF, the default */
+#define ESP_VIDEO_DROP_OLDEST   1           /*!< The oldest done buffer not dequeued yet captures the new frame */
+
+/**
+ * @brief What a capture stream gives up when a frame starts and no buffer is queued.
+ */
+struct esp_video_drop_policy {
+    uint32_t type;                              /*!< Buffer type, only V4L2_BUF_TYPE_VIDEO_CAPTURE */
+    uint32_t policy;                            /*!< ESP_VIDEO_DROP_XXX */
+};
+
+/**
+ * @brief Set or get the drop policy of a capture stream.
+ *
+ * With ESP_VIDEO_DROP_OLDEST a consumer that falls behind always dequeues the latest frames,
+ * each recycled buffer counts as a dropped frame. The policy can be changed while streaming.
+ */
+#define VIDIOC_S_DROP_POLICY _IOW('V',  BASE_VIDIOC_PRIVATE + 10, struct esp_video_drop_policy)
+#define VIDIOC_G_DROP_POLICY _IOWR('V', BASE_VIDIOC_PRIVATE + 11, struct esp_video_drop_policy)
+
+/**
+ * @brief Statistics of a video stream, counted since VIDIOC_STREAMON.
+ */
+struct esp_video_stream_stats {
+    uint32_t type;                              /*!< Buffer type, given by the caller */
+    uint32_t sequence;                          /*!< Frames done by the hardware */
+    uint32_t delivered;                         /*!< Frames put in the done list or handed to a linked device */
+    uint32_t dropped;                           /*!< Frames lost, for lack of a free buffer or recycled */
+    uint32_t skipped;                           /*!< Frames discarded to lower the frame rate set by VIDIOC_S_PARM */
+    uint32_t no_buffer;                         /*!< Frames started with no buffer queued, e.g. into the MIPI-CSI backup buffer */
+    uint32_t recycled;                          /*!< Done buffers captured into again by ESP_VIDEO_DROP_OLDEST */
+    uint32_t max_done_depth;                    /*!< Most done buffers waiting for DQBUF at once */
+    uint32_t latency_min_us;                    /*!< Shortest time from frame done to DQBUF */
+    uint32_t latency_avg_us;                    /*!< Average time from frame done to DQBUF */
+    uint32_t latency_max_us;                    /*!< Longest time from frame done to DQBUF */
+    uint32_t rx_crc_errors;                     /*!< Frames with a frame or payload CRC error in the receiver, e.g. MIPI-CSI */
+    uint32_t rx_ecc_errors;                     /*!< Frames with an uncorrectable packet header ECC error */
+    uint32_t rx_phy_errors;                     /*!< Frames with a PHY error, e.g. a MIPI D-PHY start of transmission error */
+    uint32_t rx_frame_errors;                   /*!< Frames with frame start and end out of order or a frame number mismatch */
+    uint32_t rx_overflows;                      /*!< Frames the receiver FIFO overflowed in, their data is incomplete */
+    uint32_t recoveries;                        /*!< Stalls the device restarted the receiver from, without VIDIOC_STREAMOFF */
+};
+
+/**
+ * @brief Get the statistics of a video stream.
+ *
+ * The counters are updated from the ISR without locking, so the values of one call may be one
+ * frame apart from each other. The receiver error counters are only counted by devices that
+ * can read them, they stay 0 otherwise. A recovery loses the frame being received when the
+ * stream stalled, the queued and done buffers are kept and DQBUF goes on with the next frame.
+ */
+#define VIDIOC_G_STREAM_STATS _IOWR('V', BASE_VIDIOC_PRIVATE + 12, struct esp_video_stream_stats)
+
+#define ESP_VIDEO_CONVERGENCE_OFF       0   /*!< Frames are delivered as they come, the default */
+#define ESP_VIDEO_CONVERGENCE_PENDING   1   /*!< The image algorithms are converging, from VIDIOC_STREAMON */
+#define ESP_VIDEO_CONVERGENCE_DONE      2   /*!< The image algorithms converged, frames carry V4L2_BUF_FLAG_ESP_CONVERGED */
+
+/**
+ * @brief Convergence state of a capture stream.
+ */
+struct esp_video_convergence {
+    uint32_t type;                              /*!< Buffer type, only V4L2_BUF_TYPE_VIDEO_CAPTURE */
+    uint32_t state;                             /*!< ESP_VIDEO_CONVERGENCE_XXX */
+    uint32_t hold;                              /*!< Frames done while pending are recycled instead of delivered */
+};
+
+/**
+ * @brief Set or get the convergence state of a capture stream.
+ *
+ * Once the state is not ESP_VIDEO_CONVERGENCE_OFF, every VIDIOC_STREAMON sets it back to
+ * ESP_VIDEO_CONVERGENCE_PENDING and the ISP pipeline controller sets ESP_VIDEO_CONVERGENCE_DONE
+ * when AE and AWB reached their tolerance. Held frames count as skipped.
+ */
+#define VIDIOC_S_CONVERGENCE _IOW('V',  BASE_VIDIOC_PRIVATE + 13, struct esp_video_convergence)
+#define VIDIOC_G_CONVERGENCE _IOWR('V', BASE_VIDIOC_PRIVATE + 14, struct esp_video_convergence)
+
+/**
+ * @brief Get the exposure and gain delay of the camera sensor in frames, see
+ * ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY. Statistics of the frames within the delay of a write still
+ * come from the previous values.
+ */
+#define VIDIOC_G_SENSOR_CTRL_DELAY _IOR('V', BASE_VIDIOC_PRIVATE + 16, uint32_t)
+
+#define ESP_VIDEO_FRAME_META_EXPOSURE   (1 << 0)    /*!< exposure is valid */
+#define ESP_VIDEO_FRAME_META_GAIN       (1 << 1)    /*!< gain is valid */
+#define ESP_VIDEO_FRAME_META_TRIGGER    (1 << 2)    /*!< trigger_us is valid */
+#define ESP_VIDEO_FRAME_META_LENS_MOVING (1 << 3)   /*!< The lens moved while the frame was read out */
+#define ESP_VIDEO_FRAME_META_REQUEST    (1 << 4)    /*!< The frame fulfilled capture request request_id */
+
+/**
+ * @brief Sensor settings a captured frame was exposed with.
+ */
+struct esp_video_frame_meta {
+    uint32_t type;                              /*!< Buffer type, given by the caller */
+    uint32_t index;                             /*!< Buffer index, given by the caller */
+    uint32_t sequence;                          /*!< Sequence number of the frame in the buffer */
+    uint32_t flags;                             /*!< ESP_VIDEO_FRAME_META_XXX */
+    uint32_t exposure;                          /*!< Sensor exposure, in the unit of V4L2_CID_EXPOSURE */
+    uint32_t gain;                              /*!< Sensor gain, the V4L2_CID_GAIN menu index */
+    int64_t trigger_us;                         /*!< esp_timer time of the frame start trigger edge */
+    uint32_t request_id;                        /*!< Capture request the frame fulfilled */
+};
+
+/**
+ * @brief Get the sensor settings of the frame in a dequeued capture buffer.
+ *
+ * Exposure and gain written with VIDIOC_S_EXT_CTRLS are attributed to the frames from the
+ * sensor's control delay (VIDIOC_G_SENSOR_CTRL_DELAY) on, so they are the values the frame was
+ * exposed with rather than the last written ones. Valid until the buffer is queued again.
+ */
+#define VIDIOC_G_FRAME_META _IOWR('V', BASE_VIDIOC_PRIVATE + 17, struct esp_video_frame_meta)
+
+/**
+ * @brief Latest frame of a capture device, returned in place by VIDIOC_READ_FRAME.
+ */
+struct esp_video_read_frame {
+    const uint8_t *data;                        /*!< Frame data in the capture buffer */
+    uint32_t size;                              /*!< Frame size in bytes */
+    uint32_t index;                             /*!< Capture buffer index */
+    uint32_t sequence;                          /*!< Sequence number of the frame */
+    uint32_t flags;                             /*!< V4L2_BUF_FLAG_XXX as returned by VIDIOC_DQBUF */
+    struct timeval timestamp;                   /*!< Time the hardware finished the frame */
+};
+
+/**
+ * @brief Get the latest frame of a capture device without copying it.
+ *
+ * The zero-copy form of read(): on the first call the device sets up its own buffers and starts
+ * streaming, like read() does. The frame stays valid and is not written by the hardware until
+ * the next VIDIOC_READ_FRAME or read() call, or until the device is closed. Fails with EBUSY
+ * while the application streams with its own buffers, and with EAGAIN on an O_NONBLOCK file
+ * when no frame is done yet.
+ */
+#define VIDIOC_READ_FRAME   _IOR('V',  BASE_VIDIOC_PRIVATE + 19, struct esp_video_read_frame)
+
+#define ESP_VIDEO_REQUEST_EXPOSURE      (1 << 0)    /*!< exposure is set by the request */
+#define ESP_VIDEO_REQUEST_GAIN          (1 << 1)    /*!< gain is set by the request */
+
+/**
+ * @brief Sensor settings of one frame, queued with VIDIOC_QUEUE_REQUEST.
+ */
+struct esp_video_capture_request {
+    uint32_t id;                                /*!< Request identifier chosen by the application */
+    uint32_t flags;                             /*!< ESP_VIDEO_REQUEST_XXX */
+    uint32_t exposure;                          /*!< Sensor exposure, in the unit of V4L2_CID_EXPOSURE */
+    uint32_t gain;                              /*!< Sensor gain, the V4L2_CID_GAIN menu index */
+};
+
+/**
+ * @brief Queue sensor settings for one frame of a MIPI-CSI capture device.
+ *
+ * One request is written to the sensor at each frame end, with group hold when the sensor
+ * supports V4L2_CID_CAMERA_GROUP, so the requests of a bracket take effect on consecutive frames
+ * from the sensor's control delay on. The frame each request took effect on is dequeued with
+ * V4L2_BUF_FLAG_ESP_REQUEST and VIDIOC_G_FRAME_META returns its id. Fields a request does not set
+ * keep the current sensor value. Automatic exposure should be off, its writes would interleave.
+ * Fails with EBUSY when the queue is full, requests left at stream off are dropped.
+ */
+#define VIDIOC_QUEUE_REQUEST _IOW('V', BASE_VIDIOC_PRIVATE + 20, struct esp_video_capture_request)
+
+#define ESP_VIDEO_FORMAT_CAP_ISP        (1 << 0)    /*!< The ISP produces the format, otherwise sensor data is passed through */
+#define ESP_VIDEO_FORMAT_CAP_CURRENT    (1 << 1)    /*!< The sensor mode is the one set now, no VIDIOC_S_SENSOR_FMT needed */
+#define ESP_VIDEO_FORMAT_CAP_JPEG       (1 << 2)    /*!< The hardware JPEG encoder takes the format as input */
+#define ESP_VIDEO_FORMAT_CAP_H264       (1 << 3)    /*!< The H.264 encoder takes the format as input */
+
+/**
+ * @brief One valid combination of sensor mode and capture format.
+ */
+struct esp_video_format_cap {
+    uint32_t index;                             /*!< Entry index, given by the caller */
+    const esp_cam_sensor_format_t *sensor_format; /*!< Sensor mode, for VIDIOC_S_SENSOR_FMT */
+    uint32_t width;                             /*!< Frame width */
+    uint32_t height;                            /*!< Frame height */
+    uint32_t fps;                               /*!< Frame rate of the sensor mode */
+    uint32_t pixelformat;                       /*!< Capture pixel format, for VIDIOC_S_FMT */
+    uint32_t sizeimage;                         /*!< Bytes of one capture buffer */
+    uint32_t link_kbps;                         /*!< MIPI link rate of all data lanes */
+    uint32_t mem_kbps;                          /*!< Rate the frames are written to memory at fps */
+    uint32_t flags;                             /*!< ESP_VIDEO_FORMAT_CAP_XXX */
+};
+
+/**
+ * @brief Enumerate the capture formats of every sensor mode of a MIPI-CSI capture device.
+ *
+ * The list is built and checked against the VIDIOC_S_FMT rules when the device is created, so
+ * every entry can be set without trial: VIDIOC_S_SENSOR_FMT with sensor_format unless the entry
+ * has ESP_VIDEO_FORMAT_CAP_CURRENT, then VIDIOC_S_FMT with width, height and pixelformat. Fails
+ * with EINVAL past the last entry.
+ */
+#define VIDIOC_ENUM_FORMAT_CAPS _IOWR('V', BASE_VIDIOC_PRIVATE + 21, struct esp_video_format_cap)
+
+/**
+ * @brief Requirements of VIDIOC_QUERY_BEST_FORMAT and the entry found.
+ */
+struct esp_video_format_query {
+    uint32_t pixelformat;                       /*!< Capture pixel format, 0 for any */
+    uint32_t min_fps;                           /*!< Lowest frame rate */
+    uint32_t max_mem_kbps;                      /*!< Highest memory write rate, 0 for no limit */
+    uint32_t flags;                             /*!< ESP_VIDEO_FORMAT_CAP_XXX the entry must have */
+    struct esp_video_format_cap cap;            /*!< Returned entry */
+};
+
+/**
+ * @brief Find the best entry of VIDIOC_ENUM_FORMAT_CAPS for the requirements.
+ *
+ * The entry with the most pixels wins, then the one with the higher frame rate, the lower memory
+ * write rate, and the current sensor mode, which needs no mode change. Fails with ESRCH when no
+ * entry meets the requirements.
+ */
+#define VIDIOC_QUERY_BEST_FORMAT _IOWR('V', BASE_VIDIOC_PRIVATE + 22, struct esp_video_format_query)
+
+/**
+ * @brief The frame was captured after the image algorithms converged, see VIDIOC_S_CONVERGENCE.
+ *
+ * The bit is not used by V4L2.
+ */
+#define V4L2_BUF_FLAG_ESP_CONVERGED     0x10000000
+
+/**
+ * @brief The frame started at a frame trigger edge, VIDIOC_G_FRAME_META returns its time.
+ *
+ * The bit is not used by V4L2.
+ */
+#define V4L2_BUF_FLAG_ESP_TRIGGERED     0x20000000
+
+/**
+ * @brief The lens moved while the frame was read out, its focus is not that of one position.
+ *
+ * Contrast autofocus should not rate a position by such a frame. The bit is not used by V4L2.
+ */
+#define V4L2_BUF_FLAG_ESP_LENS_MOVING   0x40000000
+
+/**
+ * @brief The frame is the first one exposed with a capture request, see VIDIOC_QUEUE_REQUEST.
+ *
+ * The bit is not used by V4L2.
+ */
+#define V4L2_BUF_FLAG_ESP_REQUEST       0x80000000
+
+/**
+ * @brief Lossless Rice coded RAW10 Bayer frames, produced by the RAW codec video device.
+ *
+ * Every line is coded on its own with a same-color left prediction and a per-line Rice
+ * parameter, the layout is described in esp_video_raw_codec_device.c.
+ */
+#define V4L2_PIX_FMT_ESP_RAW10_RICE     v4l2_fourcc('R', '1', '0', 'R')
+
+/**
+ * @brief Frames the driver dropped since VIDIOC_STREAMON, up to a buffer returned by VIDIOC_DQBUF.
+ *
+ * A frame is dropped when the hardware finished it while no buffer was queued. Capture
+ * devices return the counter in the otherwise unused reserved2 field, and it always equals
+ * the gaps in v4l2_buffer.sequence.
+ */
+#define ESP_VIDEO_BUF_DROPPED(vbuf)     ((vbuf)->reserved2)
+
 #define V4L2_CID_CAMERA_AE_LEVEL        (V4L2_CID_CAMERA_CLASS_BASE + 40)
 #define V4L2_CID_CAMERA_STATS           (V4L2_CID_CAMERA_CLASS_BASE + 41)
 #define V4L2_CID_CAMERA_GROUP           (V4L2_CID_CAMERA_CLASS_BASE + 42)
 #define V4L2_CID_MOTOR_START_TIME       (V4L2_CID_CAMERA_CLASS_BASE + 43)
 
+/**
+ * @brief Frame synchronization mode of the MIPI-CSI camera sensor, a menu of
+ * ESP_VIDEO_SENSOR_SYNC_XXX that can only be set while the stream is off.
+ *
+ * In the leader and follower modes the frame trigger GPIO, CONFIG_ESP_VIDEO_MIPI_CSI_TRIGGER_GPIO,
+ * is wired to XVS. Every frame starting at an edge of it carries V4L2_BUF_FLAG_ESP_TRIGGERED, so
+ * frames of boards sharing XVS are matched by their trigger times.
+ */
+#define V4L2_CID_ESP_SENSOR_SYNC_MODE   (V4L2_CID_CAMERA_CLASS_BASE + 44)
+
+/**
+ * @brief Target compressed bytes per frame of the JPEG rate control, enabled by
+ * V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE. If it is 0, the target is V4L2_CID_MPEG_VIDEO_BITRATE
+ * spread over the frame interval set by VIDIOC_S_PARM.
+ */
+#define V4L2_CID_JPEG_ESP_FRAME_SIZE    (V4L2_CID_JPEG_CLASS_BASE + 40)
+
+/**
+ * @brief Controls of the HDR merge video device, which turns a frame of interleaved long and
+ * short exposure rows into one 16-bit linear frame in long exposure units.
+ *
+ * - V4L2_CID_ESP_HDR_RATIO: long to short exposure time ratio in 1/16 steps, e.g. 256 for 16x
+ * - V4L2_CID_ESP_HDR_KNEE: long exposure level, black level subtracted, from which a pixel is
+ *   taken from the scaled short exposure
+ * - V4L2_CID_ESP_HDR_BLACK_LEVEL: black level subtracted from both exposures
+ */
+#define V4L2_CID_ESP_HDR_RATIO          (V4L2_CID_IMAGE_PROC_CLASS_BASE + 40)
+#define V4L2_CID_ESP_HDR_KNEE           (V4L2_CID_IMAGE_PROC_CLASS_BASE + 41)
+#define V4L2_CID_ESP_HDR_BLACK_LEVEL    (V4L2_CID_IMAGE_PROC_CLASS_BASE + 42)
+
+/**
+ * @brief Controls of the NDVI video device, which turns each 2x2 cell of a RAW10 Bayer frame
+ * into one normalized difference index (nir - red) / (nir + red).
+ *
+ * - V4L2_CID_ESP_NDVI_NIR_CHANNEL: cell position of the near infrared pixel, 0 top left,
+ *   1 top right, 2 bottom left, 3 bottom right
+ * - V4L2_CID_ESP_NDVI_RED_CHANNEL: cell position of the red or other visible pixel
+ * - V4L2_CID_ESP_NDVI_NIR_GAIN: calibration gain of the near infrared pixel in 1/256 steps
+ * - V4L2_CID_ESP_NDVI_RED_GAIN: calibration gain of the visible pixel in 1/256 steps
+ * - V4L2_CID_ESP_NDVI_BLACK_LEVEL: black level subtracted from both pixels before the gains
+ */
+#define V4L2_CID_ESP_NDVI_NIR_CHANNEL   (V4L2_CID_IMAGE_PROC_CLASS_BASE + 43)
+#define V4L2_CID_ESP_NDVI_RED_CHANNEL   (V4L2_CID_IMAGE_PROC_CLASS_BASE + 44)
+#define V4L2_CID_ESP_NDVI_NIR_GAIN      (V4L2_CID_IMAGE_PROC_CLASS_BASE + 45)
+#define V4L2_CID_ESP_NDVI_RED_GAIN      (V4L2_CID_IMAGE_PROC_CLASS_BASE + 46)
+#define V4L2_CID_ESP_NDVI_BLACK_LEVEL   (V4L2_CID_IMAGE_PROC_CLASS_BASE + 47)
+
+/**
+ * @brief Read-only SPS and PPS of the last H.264 key frame, as Annex-B NAL units in "p_u8".
+ * "size" is set to their length, ESP_ERR_INVALID_SIZE is returned if the buffer is smaller and
+ * ESP_ERR_NOT_FOUND if no key frame was encoded since VIDIOC_STREAMON.
+ */
+#define V4L2_CID_MPEG_VIDEO_H264_ESP_PARAM_SETS     (V4L2_CTRL_CLASS_CODEC | 0x1a00)
+
 /**
  * @brief Use this class to call esp_cam_sensor ioctl commands directly, this is only
  * used for camera sensor, not for motor controller.
@@ -30,6 +30,7 @@ extern "C" {
 #define V4L2_CID_USER_ESP_ISP_LSC           (V4L2_CID_USER_ESP_ISP_BASE + 0x0006)   /*!< LSC V4L2 controller ID */
 #define V4L2_CID_USER_ESP_ISP_AF            (V4L2_CID_USER_ESP_ISP_BASE + 0x0007)   /*!< Auto focus V4L2 controller ID */
 #define V4L2_CID_USER_ESP_ISP_AWB           (V4L2_CID_USER_ESP_ISP_BASE + 0x0008)   /*!< Auto white balance statistics V4L2 controller ID */
+#define V4L2_CID_USER_ESP_ISP_PROFILE       (V4L2_CID_USER_ESP_ISP_BASE + 0x0009)   /*!< Pipeline profile V4L2 controller ID */
 
 /**
  * @brief ESP32XXX ISP image statistics output, data type is "esp_ipa_stats_t"
@@ -201,6 +202,21 @@ typedef struct esp_video_isp_awb {
     float bg_min;                   /*!< Minimum blue/green ratio */
 } esp_video_isp_awb_t;
 
+/**
+ * @brief ISP pipeline profile, the blocks the ISP may run.
+ *
+ * A profile only limits the blocks, a block in the profile still runs only
+ * when its own control enables it. Blocks outside the profile are left off,
+ * with their interrupts. A new profile takes effect when the ISP pipeline
+ * starts next, i.e. on the next stream on of the capture device.
+ */
+typedef enum esp_video_isp_profile {
+    ESP_VIDEO_ISP_PROFILE_AUTO = 0,     /*!< FULL for RGB/YUV output, RAW for RAW output */
+    ESP_VIDEO_ISP_PROFILE_FULL,         /*!< Every block */
+    ESP_VIDEO_ISP_PROFILE_RAW,          /*!< Bayer domain blocks only: BF, LSC and a histogram of the RAW data */
+    ESP_VIDEO_ISP_PROFILE_HIST,         /*!< Only a histogram of the RAW data, e.g. for the AE of RAW captures */
+} esp_video_isp_profile_t;
+
 /**
  * @brief ISP statistics.
  */
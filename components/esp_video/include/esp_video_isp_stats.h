@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_video_isp_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief ISP statistics of one frame
+ */
+typedef struct esp_video_isp_frame_stats {
+    uint32_t frame_sequence;                    /*!< v4l2_buffer.sequence of the capture frame the statistics were taken from */
+    int64_t timestamp_us;                       /*!< esp_timer time the ISP controller received the statistics */
+    uint32_t exposure_us;                       /*!< Sensor exposure time last written, the frame may still use an older one */
+    float gain;                                 /*!< Sensor gain last written, 1.0 is the minimum gain */
+    esp_video_isp_stats_t stats;                /*!< Statistics, stats.flags tells which ones are valid */
+} esp_video_isp_frame_stats_t;
+
+/**
+ * @brief ISP statistics callback
+ *
+ * Called in the ISP controller task for every statistics set, before the
+ * image algorithms run on it. The callback must return quickly and copy what
+ * it keeps, the statistics are only valid during the call.
+ *
+ * @param stats Statistics of one frame
+ * @param arg   User argument given to esp_video_isp_stats_subscribe
+ *
+ * @return None
+ */
+typedef void (*esp_video_isp_stats_cb_t)(const esp_video_isp_frame_stats_t *stats, void *arg);
+
+/**
+ * @brief ISP controller run statistics, since the ISP controller started
+ */
+typedef struct esp_video_isp_run_stats {
+    uint32_t frames;                            /*!< Statistics sets received */
+    uint32_t runs;                              /*!< Frames the image algorithms ran on */
+    uint32_t overruns;                          /*!< Runs longer than CONFIG_ESP_VIDEO_ISP_PIPELINE_RUN_BUDGET_US */
+    uint32_t throttled;                         /*!< Frames skipped to pay back overruns */
+    uint32_t last_run_us;                       /*!< Duration of the last run */
+    uint32_t max_run_us;                        /*!< Longest run */
+    uint64_t total_run_us;                      /*!< Sum of the run durations */
+} esp_video_isp_run_stats_t;
+
+/**
+ * @brief Get the ISP controller run statistics
+ *
+ * @param stats Returned statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stats is NULL
+ *      - ESP_ERR_INVALID_STATE if the ISP controller is not running
+ */
+esp_err_t esp_video_isp_pipeline_get_run_stats(esp_video_isp_run_stats_t *stats);
+
+/**
+ * @brief ISP controller start-up times, of the last esp_video_isp_pipeline_init()
+ */
+typedef struct esp_video_isp_init_times {
+    uint32_t ipa_create_us;                     /*!< Creating the image algorithm pipeline from its configuration */
+    uint32_t cam_dev_us;                        /*!< Opening the camera device and reading the sensor controls */
+    uint32_t isp_dev_us;                        /*!< Opening the ISP device and starting its statistics stream */
+    uint32_t ipa_init_us;                       /*!< Initializing the image algorithms, with the warm start state */
+    uint32_t config_us;                         /*!< Writing the initial ISP and sensor configuration */
+    uint32_t task_us;                           /*!< Creating the ISP controller task */
+    uint32_t init_us;                           /*!< Whole esp_video_isp_pipeline_init() */
+    uint32_t first_stats_us;                    /*!< From the ISP controller task start to the first statistics, 0 until then */
+    uint32_t deferred_us;                       /*!< Set-up deferred past the first statistics, 0 if none ran */
+} esp_video_isp_init_times_t;
+
+/**
+ * @brief Get the ISP controller start-up times
+ *
+ * first_stats_us includes the time the application took to start the capture
+ * stream after the ISP controller started, deferred_us is that of the set-up
+ * CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT leaves until the first statistics.
+ *
+ * @param times Returned times
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if times is NULL
+ *      - ESP_ERR_INVALID_STATE if the ISP controller is not running
+ */
+esp_err_t esp_video_isp_pipeline_get_init_times(esp_video_isp_init_times_t *times);
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS > 0
+/**
+ * @brief Subscribe to the ISP statistics
+ *
+ * The subscription may be made before the ISP controller starts, and is kept
+ * if the ISP controller is deinitialized and started again.
+ *
+ * @param cb    Callback
+ * @param arg   User argument of cb
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if cb is NULL
+ *      - ESP_ERR_INVALID_STATE if cb is already subscribed with arg
+ *      - ESP_ERR_NO_MEM if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS callbacks are subscribed
+ */
+esp_err_t esp_video_isp_stats_subscribe(esp_video_isp_stats_cb_t cb, void *arg);
+
+/**
+ * @brief Unsubscribe from the ISP statistics
+ *
+ * The callback is not running anymore, and will not be called again, when
+ * this function returns. It must not be called from the callback.
+ *
+ * @param cb    Callback given to esp_video_isp_stats_subscribe
+ * @param arg   User argument given to esp_video_isp_stats_subscribe
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if cb is not subscribed with arg
+ */
+esp_err_t esp_video_isp_stats_unsubscribe(esp_video_isp_stats_cb_t cb, void *arg);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Video memory pool statistics
+ */
+typedef struct esp_video_mem_pool_stats {
+    size_t arena_size;                          /*!< Arena size, 0 if the arena is not allocated */
+    size_t carved_size;                         /*!< Arena bytes split into blocks so far */
+    size_t used_size;                           /*!< Bytes of the blocks in use */
+    size_t peak_used_size;                      /*!< High-water mark of used_size */
+    uint32_t block_count;                       /*!< Blocks carved from the arena */
+    uint32_t used_block_count;                  /*!< Blocks in use */
+    uint32_t heap_fallback_count;               /*!< Allocations that did not fit the arena and went to the heap */
+} esp_video_mem_pool_stats_t;
+
+/**
+ * @brief Allocate a video buffer from the video memory pool
+ *
+ * The size is rounded up to its size class. A free block of the same or a
+ * slightly larger class is reused, otherwise a new block is carved from the
+ * arena. Memory the arena can not provide, because of the capabilities, the
+ * alignment or the space left, comes from heap_caps_aligned_alloc.
+ *
+ * @param align Alignment in bytes, a power of two
+ * @param size  Buffer size in bytes
+ * @param caps  Memory capabilities, refer to esp_heap_caps.h MALLOC_CAP_XXX
+ *
+ * @return
+ *      - Buffer pointer on success
+ *      - NULL if there is not enough memory
+ */
+void *esp_video_mem_pool_alloc(size_t align, size_t size, uint32_t caps);
+
+/**
+ * @brief Free a buffer allocated by esp_video_mem_pool_alloc
+ *
+ * An arena block is kept for the next allocation of its class, it is never
+ * returned to the heap.
+ *
+ * @param ptr Buffer pointer, NULL is ignored
+ *
+ * @return None
+ */
+void esp_video_mem_pool_free(void *ptr);
+
+/**
+ * @brief Get video memory pool statistics
+ *
+ * @param stats Returned statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t esp_video_mem_pool_get_stats(esp_video_mem_pool_stats_t *stats);
+
+/**
+ * @brief Free the arena if no block of it is in use
+ *
+ * @return
+ *      - ESP_OK on success or if the arena is not allocated
+ *      - ESP_ERR_INVALID_STATE if a block is in use
+ */
+esp_err_t esp_video_mem_pool_release(void);
+
+#ifdef __cplusplus
+}
+#endif
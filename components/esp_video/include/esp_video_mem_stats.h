@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Owner of video memory
+ */
+typedef enum esp_video_mem_owner {
+    ESP_VIDEO_MEM_OWNER_CAPTURE = 0,            /*!< Frame buffers of capture video devices */
+    ESP_VIDEO_MEM_OWNER_M2M,                    /*!< Source and result buffers of M2M video devices, e.g. encoded frames */
+    ESP_VIDEO_MEM_OWNER_META,                   /*!< Metadata buffers, e.g. ISP statistics */
+    ESP_VIDEO_MEM_OWNER_DEVICE,                 /*!< Video device objects and driver work buffers */
+    ESP_VIDEO_MEM_OWNER_REPROCESSING,           /*!< Swap, color convert and RAW unpack objects */
+    ESP_VIDEO_MEM_OWNER_ISP_PIPELINE,           /*!< ISP pipeline controller task */
+    ESP_VIDEO_MEM_OWNER_APP,                    /*!< Memory the application accounts, e.g. streaming buffers and server task stacks */
+    ESP_VIDEO_MEM_OWNER_MAX,                    /*!< Number of owners */
+} esp_video_mem_owner_t;
+
+/**
+ * @brief Memory usage of one owner
+ */
+typedef struct esp_video_mem_usage {
+    size_t internal_size;                       /*!< Internal RAM bytes in use */
+    size_t internal_peak_size;                  /*!< High-water mark of internal_size */
+    size_t psram_size;                          /*!< PSRAM bytes in use */
+    size_t psram_peak_size;                     /*!< High-water mark of psram_size */
+    uint32_t block_count;                       /*!< Blocks in use */
+    uint32_t fail_count;                        /*!< Allocations that failed */
+    size_t fail_size;                           /*!< Size of the last allocation that failed */
+} esp_video_mem_usage_t;
+
+/**
+ * @brief Get the memory usage of an owner
+ *
+ * @param owner Memory owner
+ * @param usage Returned memory usage
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the owner is invalid or usage is NULL
+ */
+esp_err_t esp_video_mem_stats_get(esp_video_mem_owner_t owner, esp_video_mem_usage_t *usage);
+
+/**
+ * @brief Set the high-water marks of all owners to the current usage
+ *
+ * @return
+ *      - ESP_OK on success
+ */
+esp_err_t esp_video_mem_stats_reset_peak(void);
+
+/**
+ * @brief Get the name of an owner, e.g. for a report
+ *
+ * @param owner Memory owner
+ *
+ * @return Owner name, "unknown" if the owner is invalid
+ */
+const char *esp_video_mem_owner_name(esp_video_mem_owner_t owner);
+
+/**
+ * @brief Account allocated memory to an owner
+ *
+ * Whether the memory is internal RAM or PSRAM is taken from its address.
+ * Applications account their own buffers and task stacks to
+ * ESP_VIDEO_MEM_OWNER_APP, so one report covers the whole video path.
+ *
+ * @param owner Memory owner
+ * @param ptr   Allocated memory, NULL is ignored
+ * @param size  Allocated size in bytes
+ *
+ * @return None
+ */
+void esp_video_mem_stats_add(esp_video_mem_owner_t owner, const void *ptr, size_t size);
+
+/**
+ * @brief Remove memory accounted by esp_video_mem_stats_add before it is freed
+ *
+ * @param owner Memory owner given to esp_video_mem_stats_add
+ * @param ptr   Allocated memory, NULL is ignored
+ * @param size  Size given to esp_video_mem_stats_add
+ *
+ * @return None
+ */
+void esp_video_mem_stats_remove(esp_video_mem_owner_t owner, const void *ptr, size_t size);
+
+/**
+ * @brief Count an allocation of an owner that failed
+ *
+ * @param owner Memory owner
+ * @param size  Requested size in bytes
+ *
+ * @return None
+ */
+void esp_video_mem_stats_fail(esp_video_mem_owner_t owner, size_t size);
+
+/**
+ * @brief Check if buffers fit the free heap before they are requested
+ *
+ * For example a stream needs count buffers of sizeimage, given by
+ * VIDIOC_G_FMT, with the memory capabilities of the device. Each buffer must
+ * fit a free block, so the result does not guarantee the allocations succeed
+ * on a fragmented heap, but a failure tells they can not.
+ *
+ * @param size  Buffer size in bytes
+ * @param count Buffer count
+ * @param caps  Memory capabilities, refer to esp_heap_caps.h MALLOC_CAP_XXX
+ *
+ * @return
+ *      - ESP_OK if the buffers fit
+ *      - ESP_ERR_INVALID_ARG if size or count is 0
+ *      - ESP_ERR_NO_MEM if the buffers do not fit
+ */
+esp_err_t esp_video_mem_stats_check_fit(size_t size, uint32_t count, uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Power management locks held while any video stream is started
+ */
+typedef enum esp_video_pm_policy {
+    ESP_VIDEO_PM_POLICY_NONE = 0,               /*!< No lock, DFS and light sleep act as configured by esp_pm_configure */
+    ESP_VIDEO_PM_POLICY_NO_SLEEP,               /*!< No light sleep, the CPU frequency may still scale */
+    ESP_VIDEO_PM_POLICY_BALANCED,               /*!< No light sleep and the APB at its maximum frequency */
+    ESP_VIDEO_PM_POLICY_PERFORMANCE,            /*!< No light sleep and the CPU and APB at their maximum frequencies */
+} esp_video_pm_policy_t;
+
+/**
+ * @brief Set the power management policy of video streaming
+ *
+ * The locks of the policy are acquired at the first VIDIOC_STREAMON of any
+ * video device and released after the last VIDIOC_STREAMOFF, so frames are
+ * paced without light sleep wakeups or clock switches while streaming and
+ * the system still saves power when idle. A new policy takes effect at once,
+ * also while streaming.
+ *
+ * The default policy is set by CONFIG_ESP_VIDEO_STREAM_PM_POLICY.
+ *
+ * @param policy Power management policy
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the policy is invalid
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM is disabled
+ *      - Others if a lock can not be created
+ */
+esp_err_t esp_video_pm_set_policy(esp_video_pm_policy_t policy);
+
+/**
+ * @brief Get the power management policy of video streaming
+ *
+ * @return Power management policy, ESP_VIDEO_PM_POLICY_NONE if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM is disabled
+ */
+esp_video_pm_policy_t esp_video_pm_get_policy(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Packed RAW layouts the unpacker reads
+ */
+typedef enum esp_video_raw_unpack_format {
+    ESP_VIDEO_RAW_UNPACK_RAW10,                 /*!< MIPI RAW10, 4 pixels in 5 bytes, the 5th byte holds the 2 LSBs of each */
+    ESP_VIDEO_RAW_UNPACK_RAW12,                 /*!< MIPI RAW12, 2 pixels in 3 bytes, the 3rd byte holds the 4 LSBs of each */
+} esp_video_raw_unpack_format_t;
+
+/**
+ * @brief Video RAW unpack object handle
+ */
+typedef struct esp_video_raw_unpack *esp_video_raw_unpack_handle_t;
+
+/**
+ * @brief Create video RAW unpack object
+ *
+ * The unpacker turns MIPI packed RAW data into one little endian 16-bit word
+ * per pixel, with the value in the low 10 or 12 bits. It runs on the
+ * BitScrambler in loopback mode or on the CPU, as configured.
+ *
+ * @param format        Packed input layout
+ * @param max_size      Maximum input data size in bytes
+ * @param ret_handle    Returned object handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ *      - Others if the BitScrambler could not be set up
+ */
+esp_err_t esp_video_raw_unpack_create(esp_video_raw_unpack_format_t format, size_t max_size,
+                                      esp_video_raw_unpack_handle_t *ret_handle);
+
+/**
+ * @brief Process video RAW unpack
+ *
+ * @param handle        Object handle
+ * @param src           Packed source buffer pointer
+ * @param src_size      Source data size, a multiple of 5 bytes for RAW10 and of 3 bytes for RAW12, and of a
+ *                      whole row if a black level is set
+ * @param dst           Destination buffer pointer, cache line aligned for the BitScrambler
+ * @param dst_size      Destination buffer size, 8/5 of src_size for RAW10 and 4/3 for RAW12 at least
+ * @param ret_size      Returned unpacked data size
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_ERR_INVALID_SIZE if the sizes do not match the format
+ *      - Others if the BitScrambler failed
+ */
+esp_err_t esp_video_raw_unpack_process(esp_video_raw_unpack_handle_t handle, const void *src, size_t src_size,
+                                       void *dst, size_t dst_size, size_t *ret_size);
+
+/**
+ * @brief Set the black level subtracted from the unpacked pixels
+ *
+ * The black level of each Bayer channel is subtracted from its pixels and
+ * the result is clamped at 0, row by row right after unpacking. The source
+ * of esp_video_raw_unpack_process must then start at the first pixel of an
+ * even row. With CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BLACK_LEVEL_PIE rows of a
+ * 16-byte aligned destination are processed 8 pixels at a time.
+ *
+ * @param handle        Object handle
+ * @param width         Pixels of a row, a multiple of 4 for RAW10 and of 2 for RAW12
+ * @param black_level   Black level of the pixels of a 2x2 Bayer cell in raster order, i.e. even rows
+ *                      alternate [0] and [1] and odd rows [2] and [3], NULL to subtract nothing
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid or a black level exceeds the pixel bits
+ */
+esp_err_t esp_video_raw_unpack_set_black_level(esp_video_raw_unpack_handle_t handle, uint32_t width,
+                                               const uint16_t black_level[4]);
+
+/**
+ * @brief Delete video RAW unpack object
+ *
+ * @param handle    Object handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if handle is NULL
+ */
+esp_err_t esp_video_raw_unpack_delete(esp_video_raw_unpack_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,64 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_video_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief USB bus usage of one UVC video device
+ */
+typedef struct esp_video_usb_uvc_stream_stats {
+    uint8_t dev_addr;                           /*!< USB address of the camera, 0 if none is connected */
+    bool streaming;                             /*!< The stream is started */
+    bool isochronous;                           /*!< The payload fits an isochronous endpoint, otherwise the camera streams over bulk */
+    uint32_t payload_size;                      /*!< Negotiated dwMaxPayloadTransferSize in bytes */
+    uint32_t reserved;                          /*!< Bytes reserved in each microframe, 0 for bulk streams */
+    uint32_t frame_interval;                    /*!< Negotiated frame interval in 100 ns units */
+    uint32_t frames;                            /*!< Frames received since the stream started */
+    uint64_t bytes;                             /*!< Frame bytes received since the stream started */
+    uint32_t bytes_per_sec;                     /*!< Average frame bytes per second since the stream started */
+} esp_video_usb_uvc_stream_stats_t;
+
+/**
+ * @brief USB bus usage of all UVC video devices
+ */
+typedef struct esp_video_usb_uvc_bus_stats {
+    uint32_t budget;                            /*!< Bytes per microframe isochronous streams may reserve, CONFIG_ESP_VIDEO_USB_UVC_ISOC_BUDGET */
+    uint32_t reserved;                          /*!< Bytes per microframe reserved by the started streams */
+    uint32_t bytes_per_sec;                     /*!< Frame bytes per second received by all started streams */
+    uint32_t load_permille;                     /*!< bytes_per_sec in 1/1000 of the high-speed bus capacity */
+    uint8_t stream_num;                         /*!< Valid entries of stream */
+    esp_video_usb_uvc_stream_stats_t stream[ESP_VIDEO_USB_UVC_DEVICE_ID_NUM]; /*!< Usage of each UVC video device, by device number */
+} esp_video_usb_uvc_bus_stats_t;
+
+/**
+ * @brief Get the USB bus usage of the UVC video devices
+ *
+ * Shows how close the bus is to its limit when several cameras stream, the
+ * isochronous reservation decides whether one more can start, the measured
+ * load also counts bulk streams.
+ *
+ * @param stats Returned bus usage
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if stats is NULL
+ *      - ESP_ERR_INVALID_STATE if the USB UVC driver is not installed
+ */
+esp_err_t esp_video_usb_uvc_get_bus_stats(esp_video_usb_uvc_bus_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
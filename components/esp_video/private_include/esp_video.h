@@ -15,6 +15,8 @@
 #include "linux/videodev2.h"
 #include "esp_video_buffer.h"
 #include "esp_video_internal.h"
+#include "esp_video_ioctl.h"
+#include "esp_video_handle.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +38,70 @@ struct esp_video_param {
     uint16_t skip_count;                    /*!< Skip frame count */
 };
 
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+/**
+ * @brief Progress of the frame being received in slices.
+ */
+struct esp_video_slice_state {
+    SemaphoreHandle_t sem;                  /*!< Given when a slice is done, created by the first slice consumer */
+    uint32_t index;                         /*!< Buffer element index of the latest done slice */
+    uint32_t sequence;                      /*!< Sequence number the frame will be done with */
+    uint16_t slice;                         /*!< Latest done slice */
+    uint16_t slices;                        /*!< Slices per frame */
+    uint32_t size;                          /*!< Bytes received from the start of the frame */
+    uint32_t synced_sequence;               /*!< Frame the consumer last invalidated the cache of */
+    uint32_t synced_size;                   /*!< Bytes of that frame already invalidated */
+};
+#endif
+
+/**
+ * @brief Video stream counters, reset at VIDIOC_STREAMON.
+ */
+struct esp_video_stream_counters {
+    uint32_t delivered;                     /*!< Frames put in the done ring or handed to a linked device */
+    uint32_t skipped;                       /*!< Frames discarded by frame skipping */
+    uint32_t no_buffer;                     /*!< Queued element requests that found the queued ring empty */
+    uint32_t recycled;                      /*!< Done elements taken back by ESP_VIDEO_DROP_OLDEST */
+    uint32_t max_done_depth;                /*!< High-water mark of the done ring */
+    uint32_t latency_min_us;                /*!< Shortest time from done to dequeue */
+    uint32_t latency_max_us;                /*!< Longest time from done to dequeue */
+    uint32_t latency_count;                 /*!< Dequeued elements the latency was measured on */
+    uint64_t latency_total_us;              /*!< Sum of the done to dequeue times */
+    uint32_t rx_crc_errors;                 /*!< Frames with ESP_VIDEO_RX_ERROR_CRC */
+    uint32_t rx_ecc_errors;                 /*!< Frames with ESP_VIDEO_RX_ERROR_ECC */
+    uint32_t rx_phy_errors;                 /*!< Frames with ESP_VIDEO_RX_ERROR_PHY */
+    uint32_t rx_frame_errors;               /*!< Frames with ESP_VIDEO_RX_ERROR_FRAME */
+    uint32_t rx_overflows;                  /*!< Frames with ESP_VIDEO_RX_ERROR_OVERFLOW */
+    uint32_t recoveries;                    /*!< Restarts of a stalled stream by the device */
+};
+
+#define ESP_VIDEO_RX_ERROR_CRC          (1 << 0)    /*!< Frame or payload CRC mismatch */
+#define ESP_VIDEO_RX_ERROR_ECC          (1 << 1)    /*!< Packet header ECC error that could not be corrected */
+#define ESP_VIDEO_RX_ERROR_PHY          (1 << 2)    /*!< PHY error, e.g. a lane start of transmission error */
+#define ESP_VIDEO_RX_ERROR_FRAME        (1 << 3)    /*!< Frame start and end out of order, or a frame number mismatch */
+#define ESP_VIDEO_RX_ERROR_OVERFLOW     (1 << 4)    /*!< Receiver FIFO overflow, data was lost before the DMA */
+
+#define ESP_VIDEO_SENSOR_PENDING_NUM    4   /*!< Sensor setting writes waiting for their first frame */
+
+/**
+ * @brief Camera sensor settings of a capture stream, written settings only apply to later frames.
+ */
+struct esp_video_sensor_track {
+    struct esp_video_sensor_settings current;           /*!< Settings of the frames being captured */
+    struct {
+        uint32_t sequence;                              /*!< First frame captured with the settings */
+        struct esp_video_sensor_settings settings;
+    } pending[ESP_VIDEO_SENSOR_PENDING_NUM];            /*!< Written settings, oldest first */
+    uint8_t pending_num;
+    int64_t trigger_us;                                 /*!< Trigger edge not yet given to a frame, 0 if none */
+    int64_t frame_end_us;                               /*!< Done time of the last frame, 0 if none */
+    int64_t lens_start_us;                              /*!< Start of the last lens move, 0 if none */
+    int64_t lens_end_us;                                /*!< Time the last lens move settles */
+};
+
+#define ESP_VIDEO_POLL_IN       (1 << 0)    /*!< A capture buffer can be dequeued */
+#define ESP_VIDEO_POLL_OUT      (1 << 1)    /*!< An output buffer can be dequeued */
+
 /**
  * @brief Video stream object.
  */
@@ -45,14 +111,32 @@ struct esp_video_stream {
     struct v4l2_format format;              /*!< Video stream format */
     struct esp_video_buffer_info buf_info;  /*!< Video stream buffer information */
 
-    esp_video_buffer_list_t queued_list;    /*!< Workqueue buffer elements list */
-    esp_video_buffer_list_t done_list;      /*!< Done buffer elements list */
+    esp_video_buffer_ring_t queued_ring;    /*!< Workqueue buffer elements ring */
+    esp_video_buffer_ring_t done_ring;      /*!< Done buffer elements ring */
 
     struct esp_video_buffer *buffer;        /*!< Video stream buffer */
     SemaphoreHandle_t ready_sem;            /*!< Video stream buffer element ready semaphore */
 
     struct v4l2_rect rect;                  /*!< Selection rectangles */
 
+    uint32_t sequence;                      /*!< Frames done by the hardware, including those without a free element */
+    uint32_t dropped;                       /*!< Frames done by the hardware without a free element */
+
+    struct esp_video *link;                 /*!< Linked device, the M2M sink of a capture stream or the source of an M2M output stream */
+
+    uint8_t drop_policy;                    /*!< ESP_VIDEO_DROP_XXX, done elements are recycled with ESP_VIDEO_DROP_OLDEST */
+    uint8_t convergence;                    /*!< ESP_VIDEO_CONVERGENCE_XXX */
+    uint8_t convergence_hold;               /*!< Done elements are recycled while the convergence is pending */
+    uint8_t rx_error;                       /*!< ESP_VIDEO_RX_ERROR_XXX of the frame being received, flagged on its element */
+
+    struct esp_video_stream_counters counters; /*!< Video stream counters */
+
+    struct esp_video_sensor_track sensor;   /*!< Sensor settings of the captured frames, guarded by stream_lock */
+
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+    struct esp_video_slice_state slice;     /*!< Slice progress of the frame being received */
+#endif
+
     struct esp_video_param param;           /*!< Video stream parameters */
 };
 
@@ -70,13 +154,23 @@ struct esp_video {
 
     void *priv;                             /*!< Video device private data */
 
-    portMUX_TYPE stream_lock;               /*!< Stream list lock */
+    portMUX_TYPE stream_lock;               /*!< Serializes M2M consumers taking an element of both streams and the sensor tracks */
     struct esp_video_stream *stream;        /*!< Video device stream, capture-only or output-only device has 1 stream, M2M device has 2 streams */
 
     SemaphoreHandle_t mutex;                /*!< Video device mutex lock */
     uint8_t reference;                      /*!< video device open reference count */
 
     uint8_t inited : 1;                     /*!< video device is initialized */
+    uint8_t nonblock : 1;                   /*!< DQBUF returns at once if no buffer is done, O_NONBLOCK */
+    uint8_t read_io : 1;                    /*!< Capture was started by read(), stopped on the last close */
+    uint8_t read_held : 1;                  /*!< read_index is lent to the reader */
+    uint8_t read_index;                     /*!< Capture buffer of the last VIDIOC_READ_FRAME */
+
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+    TaskHandle_t m2m_worker;                /*!< M2M worker task, processes queued pairs while the device streams */
+    SemaphoreHandle_t m2m_worker_exit;      /*!< Given by the M2M worker task when it exits */
+    volatile bool m2m_worker_run;           /*!< Cleared to make the M2M worker task exit */
+#endif
 };
 
 /**
@@ -204,6 +298,28 @@ esp_err_t esp_video_set_format(struct esp_video *video, const struct v4l2_format
  */
 esp_err_t esp_video_setup_buffer(struct esp_video *video, uint32_t type, uint32_t memory_type, uint32_t count);
 
+/**
+ * @brief Add buffers to a video stream.
+ *
+ * Existing buffers keep their index, state and memory. New MMAP buffers
+ * have the size of the existing ones. Without buffers this is the same as
+ * esp_video_setup_buffer.
+ *
+ * @param video       Video object
+ * @param type        Video stream type
+ * @param memory_type Video buffer memory type, refer to v4l2_memory in videodev2.h
+ * @param count       Number of buffers to add
+ * @param index       Returned index of the first added buffer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the memory type differs or there would be too many buffers
+ *      - ESP_ERR_INVALID_STATE if the stream is started or linked
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+esp_err_t esp_video_add_buffer(struct esp_video *video, uint32_t type, uint32_t memory_type, uint32_t count,
+                               uint32_t *index);
+
 /**
  * @brief Get video buffer count.
  *
@@ -264,6 +380,18 @@ struct esp_video_buffer_element *esp_video_get_done_element(struct esp_video *vi
  */
 void esp_video_stream_done_element(struct esp_video *video, struct esp_video_stream *stream, struct esp_video_buffer_element *element);
 
+/**
+ * @brief Get buffer element at the head of buffer done list without removing it.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ *
+ * @return
+ *      - Video buffer element object pointer on success
+ *      - NULL if failed
+ */
+struct esp_video_buffer_element *esp_video_peek_done_element(struct esp_video *video, uint32_t type);
+
 /**
  * @brief Put element into done lost and give semaphore.
  *
@@ -291,6 +419,95 @@ esp_err_t esp_video_done_element(struct esp_video *video, uint32_t type, struct
  */
 esp_err_t esp_video_done_buffer(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t n);
 
+/**
+ * @brief Process a video buffer element's payload which receives data done at a given time.
+ *
+ * The stream frame counter is incremented even if the payload is not one of the stream's
+ * elements, e.g. a driver backup buffer, so the gaps in v4l2_buffer.sequence count the
+ * frames that were lost that way.
+ *
+ * @param video        Video object
+ * @param type         Video stream type
+ * @param buffer       Video buffer element's payload
+ * @param n            Video buffer element's payload valid data size
+ * @param timestamp_us esp_timer time at which the hardware finished the frame
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_done_buffer_timestamp(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t n, int64_t timestamp_us);
+
+/**
+ * @brief Count a frame the hardware finished without a free element to return it in.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ *
+ * @return None
+ */
+void esp_video_drop_frame(struct esp_video *video, uint32_t type);
+
+/**
+ * @brief Count the receiver errors of the frame being received.
+ *
+ * Each error type is counted once per frame. With flag_frame, the element the frame is done
+ * in next, by esp_video_done_buffer_timestamp(), carries V4L2_BUF_FLAG_ERROR.
+ *
+ * @param video      Video object
+ * @param type       Video stream type
+ * @param errors     ESP_VIDEO_RX_ERROR_XXX
+ * @param flag_frame Flag the element of the frame
+ *
+ * @return None
+ */
+void esp_video_rx_error(struct esp_video *video, uint32_t type, uint32_t errors, bool flag_frame);
+
+/**
+ * @brief Count a restart of a stalled stream by the device, without VIDIOC_STREAMOFF.
+ *
+ * The device queued the element of the lost frame again, the rings are kept.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ *
+ * @return None
+ */
+void esp_video_stream_recovered(struct esp_video *video, uint32_t type);
+
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+/**
+ * @brief Report a done slice of the frame being received into a buffer element.
+ *
+ * @param video  Video object
+ * @param type   Video stream type
+ * @param buffer Video buffer element's payload
+ * @param slice  Done slice, from 0
+ * @param slices Slices per frame
+ * @param size   Bytes received from the start of the frame
+ *
+ * @return None
+ */
+void esp_video_done_slice(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t slice, uint32_t slices,
+                          uint32_t size);
+
+/**
+ * @brief Wait for a slice of the frame being received.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ * @param ticks Ticks to wait
+ * @param slice Returned slice
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ *      - ESP_ERR_NO_MEM if the slice semaphore could not be created
+ *      - ESP_ERR_TIMEOUT if no slice was done in time
+ */
+esp_err_t esp_video_wait_slice(struct esp_video *video, uint32_t type, uint32_t ticks, esp_video_slice_t *slice);
+#endif
+
 /**
  * @brief Receive buffer element from video device.
  *
@@ -345,6 +562,20 @@ esp_err_t esp_video_queue_element_index(struct esp_video *video, uint32_t type,
  */
 esp_err_t esp_video_queue_element_index_buffer(struct esp_video *video, uint32_t type, int index, uint8_t *buffer, uint32_t size);
 
+/**
+ * @brief Export buffer element index as a DMABUF handle.
+ *
+ * @param video   Video object
+ * @param type    Video stream type
+ * @param index   Video buffer element index
+ * @param fd      Returned DMABUF handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_export_element_index(struct esp_video *video, uint32_t type, int index, int *fd);
+
 /**
  * @brief Get buffer element payload.
  *
@@ -358,6 +589,47 @@ esp_err_t esp_video_queue_element_index_buffer(struct esp_video *video, uint32_t
  */
 uint8_t *esp_video_get_element_index_payload(struct esp_video *video, uint32_t type, int index);
 
+/**
+ * @brief Set the QBUF attributes of a buffer element index, before it is queued.
+ *
+ * @param video     Video object
+ * @param type      Video stream type
+ * @param index     Video buffer element index
+ * @param bytesused Valid data size of an output buffer, 0 for the whole buffer
+ * @param flags     V4L2_BUF_FLAG_NO_CACHE_INVALIDATE and V4L2_BUF_FLAG_NO_CACHE_CLEAN hints
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_prepare_element_index(struct esp_video *video, uint32_t type, int index, uint32_t bytesused, uint32_t flags);
+
+/**
+ * @brief Link the capture stream of a video device to the output stream of an M2M device.
+ *
+ * Done capture elements are queued to the M2M output stream in the done path,
+ * and go back to the capture queue once the M2M device consumed them.
+ *
+ * @param source Capture video object
+ * @param sink   M2M video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_link(struct esp_video *source, struct esp_video *sink);
+
+/**
+ * @brief Remove the link of a capture video device.
+ *
+ * @param source Capture video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_unlink(struct esp_video *source);
+
 /**
  * @brief Get video object by name
  *
@@ -367,6 +639,15 @@ uint8_t *esp_video_get_element_index_payload(struct esp_video *video, uint32_t t
  */
 struct esp_video *esp_video_device_get_object(const char *name);
 
+/**
+ * @brief Get video object by ID
+ *
+ * @param id The video device ID, which is also its VFS file descriptor
+ *
+ * @return Video object pointer if found by ID
+ */
+struct esp_video *esp_video_device_get_object_by_id(uint8_t id);
+
 /**
  * @brief Get video stream object pointer by stream type.
  *
@@ -377,6 +658,20 @@ struct esp_video *esp_video_device_get_object(const char *name);
  */
 struct esp_video_stream *esp_video_get_stream(struct esp_video *video, enum v4l2_buf_type type);
 
+/**
+ * @brief Get the events a poll or select on the video device reports.
+ *
+ * ESP_VIDEO_POLL_IN is set if a capture buffer can be dequeued without
+ * blocking, for an M2M device also if a buffer pair is queued, which DQBUF
+ * processes itself. ESP_VIDEO_POLL_OUT is set if an output buffer can be
+ * dequeued without blocking.
+ *
+ * @param video Video object
+ *
+ * @return ESP_VIDEO_POLL_XXX event bits
+ */
+uint32_t esp_video_get_poll_events(struct esp_video *video);
+
 /**
  * @brief Get video buffer type.
  *
@@ -568,6 +863,108 @@ esp_err_t esp_video_set_sensor_format(struct esp_video *video, const esp_cam_sen
  */
 esp_err_t esp_video_get_sensor_format(struct esp_video *video, esp_cam_sensor_format_t *format);
 
+/**
+ * @brief Get exposure and gain delay of sensor
+ *
+ * @param video  Video object
+ * @param frames Returned frames between a write and the first frame captured with it
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the sensor does not report it
+ *      - Others if failed
+ */
+esp_err_t esp_video_get_sensor_ctrl_delay(struct esp_video *video, uint32_t *frames);
+
+/**
+ * @brief Queue sensor settings for one frame of a capture device
+ *
+ * @param video   Video object
+ * @param request Capture request
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device does not take capture requests
+ *      - ESP_ERR_NOT_FINISHED if the request queue is full
+ *      - Others if failed
+ */
+esp_err_t esp_video_queue_capture_request(struct esp_video *video, const struct esp_video_capture_request *request);
+
+/**
+ * @brief Enumerate valid combinations of sensor mode and capture format
+ *
+ * @param video Video object
+ * @param cap   Format capability, index given by the caller
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device has no format capabilities
+ *      - ESP_ERR_INVALID_ARG if the index is past the last entry
+ */
+esp_err_t esp_video_enum_format_cap(struct esp_video *video, struct esp_video_format_cap *cap);
+
+/**
+ * @brief Find the best format capability for the requirements
+ *
+ * @param video Video object
+ * @param query Requirements, the entry found is returned in it
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if no entry meets the requirements
+ */
+esp_err_t esp_video_query_best_format(struct esp_video *video, struct esp_video_format_query *query);
+
+/**
+ * @brief Record camera sensor settings that apply to the frames from a delay on
+ *
+ * @param video    Video object
+ * @param type     Video stream type
+ * @param settings Settings just written to the sensor
+ * @param delay    Frames between the frame being captured and the first frame with the settings
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_set_sensor_settings(struct esp_video *video, uint32_t type,
+                                        const struct esp_video_sensor_settings *settings, uint32_t delay);
+
+/**
+ * @brief Get the sensor settings of the frame in a buffer
+ *
+ * @param video Video object
+ * @param meta  Frame metadata, the type and index are given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the index is invalid
+ */
+esp_err_t esp_video_get_frame_meta(struct esp_video *video, struct esp_video_frame_meta *meta);
+
+/**
+ * @brief Record the frame start trigger edge of the frame being captured, called from an ISR
+ *
+ * @param video        Video object
+ * @param type         Video stream type
+ * @param timestamp_us esp_timer time of the edge
+ *
+ * @return None
+ */
+void esp_video_set_frame_trigger(struct esp_video *video, uint32_t type, int64_t timestamp_us);
+
+/**
+ * @brief Record a lens move, the frames read out while the lens moves are flagged
+ *
+ * @param video    Video object
+ * @param type     Video stream type
+ * @param start_us esp_timer time the move started
+ * @param end_us   esp_timer time the lens settles
+ *
+ * @return None
+ */
+void esp_video_set_lens_move(struct esp_video *video, uint32_t type, int64_t start_us, int64_t end_us);
+
 /**
  * @brief Query menu value
  *
@@ -666,6 +1063,66 @@ esp_err_t esp_video_set_parm(struct esp_video *video, struct v4l2_streamparm *st
  */
 esp_err_t esp_video_get_parm(struct esp_video *video, struct v4l2_streamparm *stream_parm);
 
+/**
+ * @brief Set the drop policy of a capture stream
+ *
+ * @param video  Video object
+ * @param policy Drop policy
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the policy is invalid
+ */
+esp_err_t esp_video_set_drop_policy(struct esp_video *video, const struct esp_video_drop_policy *policy);
+
+/**
+ * @brief Get the drop policy of a capture stream
+ *
+ * @param video  Video object
+ * @param policy Drop policy, the type is given and the policy is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_drop_policy(struct esp_video *video, struct esp_video_drop_policy *policy);
+
+/**
+ * @brief Set the convergence state of a capture stream
+ *
+ * @param video       Video object
+ * @param convergence Convergence state
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the state is invalid
+ */
+esp_err_t esp_video_set_convergence(struct esp_video *video, const struct esp_video_convergence *convergence);
+
+/**
+ * @brief Get the convergence state of a capture stream
+ *
+ * @param video       Video object
+ * @param convergence Convergence state, the type is given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_convergence(struct esp_video *video, struct esp_video_convergence *convergence);
+
+/**
+ * @brief Get the statistics of a video stream
+ *
+ * @param video Video object
+ * @param stats Statistics, the type is given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_stream_stats(struct esp_video *video, struct esp_video_stream_stats *stats);
+
 /**
  * @brief Skip video buffer
  *
@@ -699,6 +1156,49 @@ esp_err_t esp_video_enum_framesizes(struct esp_video *video, struct v4l2_frmsize
  */
 esp_err_t esp_video_enum_frameintervals(struct esp_video *video, struct v4l2_frmivalenum *frmival);
 
+/**
+ * @brief Get the latest frame of a capture device for read() and VIDIOC_READ_FRAME.
+ *
+ * @param video Video object
+ * @param ticks Wait OS tick
+ * @param frame Returned frame, valid until the next call, esp_video_read_release or close
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device is no capture device
+ *      - ESP_ERR_INVALID_STATE if the application streams with its own buffers
+ *      - ESP_ERR_TIMEOUT if ticks is 0 and no frame is done
+ *      - Others if failed
+ */
+esp_err_t esp_video_read_frame(struct esp_video *video, uint32_t ticks, struct esp_video_read_frame *frame);
+
+/**
+ * @brief Queue the capture buffer of the last esp_video_read_frame call again.
+ *
+ * @param video Video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_read_release(struct esp_video *video);
+
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+/**
+ * @brief Count a started video stream, the first one acquires the locks of the power management policy.
+ *
+ * @return None
+ */
+void esp_video_pm_stream_start(void);
+
+/**
+ * @brief Count a stopped video stream, the last one releases the locks of the power management policy.
+ *
+ * @return None
+ */
+void esp_video_pm_stream_stop(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
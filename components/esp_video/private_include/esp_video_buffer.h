@@ -9,8 +9,10 @@
 #include "sdkconfig.h"
 #include <stdint.h>
 #include <stddef.h>
-#include <sys/queue.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "esp_attr.h"
+#include "linux/videodev2.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -25,19 +27,31 @@ extern "C" {
 #define ELEMENT_SET_FREE(e)                 { (e)->free = true; }
 #define ELEMENT_SET_ALLOCATED(e)            { (e)->free = false; }
 #define ELEMENT_IS_FREE(e)                  ((e)->free == true)
+/* The CPU wrote the payload, e.g. in data preprocessing, so it must be cleaned before a DMA reads it */
+#define ELEMENT_SET_CPU_WRITTEN(e)          { (e)->flags &= ~V4L2_BUF_FLAG_NO_CACHE_CLEAN; }
 
-struct esp_video_buffer_element;
+#define ESP_VIDEO_BUFFER_RING_SIZE          32  /*!< Element ring capacity, a power of two, also the buffer count limit */
 
 /**
- * @brief Video buffer element.
+ * @brief Video buffer element ring cell.
  */
-typedef TAILQ_ENTRY(esp_video_buffer_element) esp_video_buffer_node_t;
+struct esp_video_buffer_ring_cell {
+    uint32_t sequence;                                /*!< Ring position the cell is ready for */
+    uint32_t index;                                   /*!< Buffer element index */
+};
 
 /**
- * @brief Video buffer list.
+ * @brief Bounded lock-free ring of buffer element indexes.
+ *
+ * Hands elements over between tasks and ISRs without a critical section:
+ * any number of producers and consumers, each cell carries the position it
+ * may next be written or read at (D. Vyukov's bounded MPMC queue).
  */
-typedef TAILQ_HEAD(esp_video_buffer_list, esp_video_buffer_element) esp_video_buffer_list_t;
-
+typedef struct esp_video_buffer_ring {
+    uint32_t enqueue_pos;                             /*!< Next position to push */
+    uint32_t dequeue_pos;                             /*!< Next position to pop */
+    struct esp_video_buffer_ring_cell cell[ESP_VIDEO_BUFFER_RING_SIZE]; /*!< Ring cells */
+} esp_video_buffer_ring_t;
 
 struct esp_video_buffer;
 
@@ -50,6 +64,18 @@ struct esp_video_buffer_info {
     uint32_t align_size;                              /*!< Buffer align size in byte, if buffer capability contains of MALLOC_CAP_CACHE_ALIGNED, this value will be unused */
     uint32_t caps;                                    /*!< Buffer capability: refer to esp_heap_caps.h MALLOC_CAP_XXX */
     uint32_t memory_type;                             /*!< Buffer memory type: refer to v4l2_memory in videodev2.h. */
+    uint32_t owner;                                   /*!< Memory owner of the MMAP payloads: refer to esp_video_mem_owner_t */
+};
+
+/**
+ * @brief Camera sensor settings and frame trigger of a frame.
+ */
+struct esp_video_sensor_settings {
+    uint32_t flags;                                   /*!< ESP_VIDEO_FRAME_META_XXX of the valid fields */
+    uint32_t exposure;                                /*!< Sensor exposure, in the unit of V4L2_CID_EXPOSURE */
+    uint32_t gain;                                    /*!< Sensor gain, the V4L2_CID_GAIN menu index */
+    int64_t trigger_us;                               /*!< Time of the frame start trigger edge */
+    uint32_t request_id;                              /*!< Capture request the settings were written for */
 };
 
 /**
@@ -58,12 +84,19 @@ struct esp_video_buffer_info {
 struct esp_video_buffer_element {
     bool free;                                        /*!< Mark if this element is free */
 
-    esp_video_buffer_node_t node;                     /*!< List node */
     struct esp_video_buffer *video_buffer;            /*!< Source buffer object */
     uint32_t index;                                   /*!< List node index */
     uint8_t *buffer;                                  /*!< Buffer space to fill data */
+    uint8_t *payload;                                 /*!< Allocated block of an MMAP element, buffer may be staggered into it */
 
     uint32_t valid_size;                              /*!< Valid data size */
+    int64_t timestamp_us;                             /*!< esp_timer time at which the data was done */
+    uint32_t sequence;                                /*!< Stream frame counter at which the data was done */
+    uint32_t dropped;                                 /*!< Stream drop counter at which the data was done */
+    struct esp_video_sensor_settings sensor;          /*!< Sensor settings the frame was exposed with */
+
+    uint32_t flags;                                   /*!< V4L2_BUF_FLAG_NO_CACHE_XXX hints given by QBUF */
+    uint32_t bytesused;                               /*!< Data size of an output buffer given by QBUF, 0 for the whole buffer */
 };
 
 /**
@@ -71,9 +104,151 @@ struct esp_video_buffer_element {
  */
 struct esp_video_buffer {
     struct esp_video_buffer_info info;              /*!< Buffer information */
+    uint32_t alloc_count;                           /*!< Elements allocated, info.count of them are in use */
+    uint32_t alloc_size;                            /*!< Allocated size of an MMAP element buffer, info.size is at most this */
     struct esp_video_buffer_element element[0];     /*!< Element buffer */
 };
 
+/**
+ * @brief Empty a buffer element ring, no push or pop may run concurrently
+ *
+ * @param ring Buffer element ring
+ *
+ * @return None
+ */
+FORCE_INLINE_ATTR void esp_video_buffer_ring_reset(esp_video_buffer_ring_t *ring)
+{
+    for (uint32_t i = 0; i < ESP_VIDEO_BUFFER_RING_SIZE; i++) {
+        __atomic_store_n(&ring->cell[i].sequence, i, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->enqueue_pos, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->dequeue_pos, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Push a buffer element index at the tail of a ring, safe in ISR
+ *
+ * @param ring  Buffer element ring
+ * @param index Buffer element index
+ *
+ * @return true on success, false if the ring is full
+ */
+FORCE_INLINE_ATTR bool esp_video_buffer_ring_push(esp_video_buffer_ring_t *ring, uint32_t index)
+{
+    struct esp_video_buffer_ring_cell *cell;
+    uint32_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        cell = &ring->cell[pos & (ESP_VIDEO_BUFFER_RING_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->index = index;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * @brief Pop the buffer element index at the head of a ring, safe in ISR
+ *
+ * @param ring  Buffer element ring
+ * @param index Returned buffer element index
+ *
+ * @return true on success, false if the ring is empty
+ */
+FORCE_INLINE_ATTR bool esp_video_buffer_ring_pop(esp_video_buffer_ring_t *ring, uint32_t *index)
+{
+    struct esp_video_buffer_ring_cell *cell;
+    uint32_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        cell = &ring->cell[pos & (ESP_VIDEO_BUFFER_RING_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *index = cell->index;
+    __atomic_store_n(&cell->sequence, pos + ESP_VIDEO_BUFFER_RING_SIZE, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * @brief Get the buffer element index at the head of a ring without popping it
+ *
+ * @note The head only stays the same if no other consumer pops concurrently.
+ *
+ * @param ring  Buffer element ring
+ * @param index Returned buffer element index
+ *
+ * @return true on success, false if the ring is empty
+ */
+FORCE_INLINE_ATTR bool esp_video_buffer_ring_peek(esp_video_buffer_ring_t *ring, uint32_t *index)
+{
+    uint32_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    struct esp_video_buffer_ring_cell *cell = &ring->cell[pos & (ESP_VIDEO_BUFFER_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+        return false;
+    }
+
+    *index = cell->index;
+
+    return true;
+}
+
+/**
+ * @brief Get the number of buffer element indexes in a ring
+ *
+ * @note A snapshot, pushes and pops running concurrently may change it right away.
+ *
+ * @param ring  Buffer element ring
+ *
+ * @return Number of indexes
+ */
+FORCE_INLINE_ATTR uint32_t esp_video_buffer_ring_count(esp_video_buffer_ring_t *ring)
+{
+    uint32_t dequeue_pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&ring->enqueue_pos, __ATOMIC_ACQUIRE) - dequeue_pos;
+}
+
+/**
+ * @brief Take a free buffer element, so that it can be pushed into a ring only once
+ *
+ * @param element Video buffer element object
+ *
+ * @return true if the element was free, false if it is already in a ring
+ */
+FORCE_INLINE_ATTR bool esp_video_buffer_element_try_allocate(struct esp_video_buffer_element *element)
+{
+    bool expected = true;
+
+    return __atomic_compare_exchange_n(&element->free, &expected, false, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Create video buffer object.
  *
@@ -110,6 +285,39 @@ struct esp_video_buffer *esp_video_buffer_clone(const struct esp_video_buffer *b
  */
 esp_err_t esp_video_buffer_destroy(struct esp_video_buffer *buffer);
 
+/**
+ * @brief Reuse a video buffer object for new buffer information
+ *
+ * The allocated elements are kept if they can hold the new buffers: same
+ * memory type, capabilities and alignment, no more elements than allocated
+ * and, for MMAP, the aligned size fits the allocated size. The element
+ * states are reset and handles of elements no longer in use are invalidated.
+ *
+ * @param buffer Video buffer object
+ * @param info   New buffer information
+ *
+ * @return
+ *      - ESP_OK if the buffer object is reused
+ *      - ESP_ERR_INVALID_SIZE if the new buffers do not fit, the object is not changed
+ */
+esp_err_t esp_video_buffer_reconfigure(struct esp_video_buffer *buffer, const struct esp_video_buffer_info *info);
+
+/**
+ * @brief Add elements to a video buffer object
+ *
+ * Existing elements keep their index, payload and state, new MMAP elements
+ * get the allocated size of the existing ones. The object may move, element
+ * pointers taken before are invalid on success except through DMABUF handles.
+ *
+ * @param buffer Video buffer object
+ * @param count  New element count, not less than the current one
+ *
+ * @return
+ *      - Video buffer object pointer on success
+ *      - NULL if failed, the original object is not changed
+ */
+struct esp_video_buffer *esp_video_buffer_grow(struct esp_video_buffer *buffer, uint32_t count);
+
 /**
  * @brief Get element object pointer by buffer
  *
@@ -122,6 +330,45 @@ esp_err_t esp_video_buffer_destroy(struct esp_video_buffer *buffer);
  */
 struct esp_video_buffer_element *esp_video_buffer_get_element_by_buffer(struct esp_video_buffer *buffer, uint8_t *ptr);
 
+/**
+ * @brief Export a buffer element as a DMABUF handle
+ *
+ * The handle can be queued to another video device as a V4L2_MEMORY_DMABUF
+ * buffer. Exporting the same element again returns the same handle. The
+ * handle is invalidated when the buffer is destroyed.
+ *
+ * @param element Video buffer element object, of an MMAP buffer
+ * @param fd      Returned DMABUF handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the element is not driver allocated
+ *      - ESP_ERR_NO_MEM if the export table is full
+ */
+esp_err_t esp_video_buffer_export_element(struct esp_video_buffer_element *element, int *fd);
+
+/**
+ * @brief Get the buffer behind a DMABUF handle
+ *
+ * @param fd     DMABUF handle
+ * @param buffer Returned buffer pointer
+ * @param size   Returned buffer size
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the handle is unknown or its buffer was freed
+ */
+esp_err_t esp_video_buffer_import(int fd, uint8_t **buffer, uint32_t *size);
+
+/**
+ * @brief Get the DMABUF handle of an exported buffer
+ *
+ * @param buffer Buffer pointer
+ *
+ * @return DMABUF handle, or -1 if the buffer is not exported
+ */
+int esp_video_buffer_get_dmabuf_fd(const uint8_t *buffer);
+
 /**
  * @brief Get one element buffer total size
  *
@@ -14,9 +14,14 @@
 extern "C" {
 #endif
 
+#define ESP_VIDEO_CAM_DESC_CACHE_SIZE   16  /*!< Controls whose description is cached, at least the mapped ones */
+
 typedef struct esp_video_cam {
     esp_cam_sensor_device_t *sensor;
     esp_cam_motor_device_t *motor;
+
+    uint32_t desc_valid;                                        /*!< Bit n is set if desc[n] is valid */
+    esp_cam_sensor_param_desc_t desc[ESP_VIDEO_CAM_DESC_CACHE_SIZE]; /*!< Descriptions by control map index */
 } esp_video_cam_t;
 
 /**
@@ -55,6 +60,21 @@ esp_err_t esp_video_cam_get_ext_ctrls(esp_video_cam_t *cam, struct v4l2_ext_cont
  */
 esp_err_t esp_video_cam_query_ext_ctrls(esp_video_cam_t *cam, struct v4l2_query_ext_ctrl *qctrl);
 
+/**
+ * @brief Forget the cached control descriptions of the camera device
+ *
+ * Control ranges, e.g. the exposure range, depend on the sensor format, so this
+ * has to be called whenever the sensor format or window is changed.
+ *
+ * @param cam      Camera device pointer
+ *
+ * @return None
+ */
+static inline void esp_video_cam_flush_desc(esp_video_cam_t *cam)
+{
+    cam->desc_valid = 0;
+}
+
 /**
  * @brief Query menu value from camera device
  *
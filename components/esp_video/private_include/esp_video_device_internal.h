@@ -13,6 +13,9 @@
 #include "driver/jpeg_encode.h"
 #endif
 #include "esp_video_device.h"
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+#include "esp_video_init.h"
+#endif
 #include "hal/cam_ctlr_types.h"
 #include "esp_cam_ctlr_spi.h"
 #include "linux/videodev2.h"
@@ -21,6 +24,12 @@
 extern "C" {
 #endif
 
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x)               (sizeof(x) / sizeof((x)[0]))    /*!< Number of elements of an array */
+#endif
+
+#define RAW10_PACKED_LINE_SIZE(w)   ((w) * 5 / 4)                   /*!< Bytes of a line of w packed RAW10 pixels */
+
 /**
  * @brief ISP video device configuration
  */
@@ -164,7 +173,7 @@ esp_cam_sensor_device_t *esp_video_get_dvp_video_device_sensor(void);
 /**
  * @brief Create H.264 video device
  *
- * @param hw_codec true: hardware H.264, false: software H.264(has not supported)
+ * @param hw_codec true: hardware H.264, false: software H.264
  *
  * @return
  *      - ESP_OK on success
@@ -175,7 +184,7 @@ esp_err_t esp_video_create_h264_video_device(bool hw_codec);
 /**
  * @brief Destroy H.264 video device
  *
- * @param hw_codec true: hardware H.264, false: software H.264(has not supported)
+ * @param hw_codec true: hardware H.264, false: software H.264
  *
  * @return
  *      - ESP_OK on success
@@ -211,6 +220,127 @@ esp_err_t esp_video_create_jpeg_video_device(jpeg_encoder_handle_t enc_handle);
 esp_err_t esp_video_destroy_jpeg_video_device(void);
 #endif
 
+#ifdef CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+/**
+ * @brief Create lossless RAW codec video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_raw_codec_video_device(void);
+
+/**
+ * @brief Destroy lossless RAW codec video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_raw_codec_video_device(void);
+#endif
+
+#ifdef CONFIG_ESP_VIDEO_ENABLE_HDR_MERGE_VIDEO_DEVICE
+/**
+ * @brief Create HDR merge video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_hdr_merge_video_device(void);
+
+/**
+ * @brief Destroy HDR merge video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_hdr_merge_video_device(void);
+#endif
+
+#ifdef CONFIG_ESP_VIDEO_ENABLE_NDVI_VIDEO_DEVICE
+/**
+ * @brief Create NDVI video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_ndvi_video_device(void);
+
+/**
+ * @brief Destroy NDVI video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_ndvi_video_device(void);
+#endif
+
+#ifdef CONFIG_ESP_VIDEO_ENABLE_PPA_VIDEO_DEVICE
+/**
+ * @brief Create PPA video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_ppa_video_device(void);
+
+/**
+ * @brief Destroy PPA video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_ppa_video_device(void);
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+/**
+ * @brief Create virtual capture video device
+ *
+ * @param config Frame format, rate and source
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_virtual_video_device(const esp_video_init_virtual_config_t *config);
+
+/**
+ * @brief Destroy virtual capture video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if the device was not created
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_virtual_video_device(void);
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_ISP
 /**
  * @brief Start ISP process based on MIPI-CSI state
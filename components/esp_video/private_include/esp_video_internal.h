@@ -6,9 +6,11 @@
 
 #pragma once
 
+#include "sdkconfig.h"
 #include "esp_err.h"
 #include "esp_cam_sensor.h"
 #include "esp_cam_motor.h"
+#include "esp_video_mem_stats.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,6 +20,16 @@ extern "C" {
 
 #define VIDEO_PRIV_DATA(t, v)               ((t)(v)->priv)
 
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_STATS
+#define VIDEO_MEM_ADD(o, p, s)              esp_video_mem_stats_add(o, p, s)
+#define VIDEO_MEM_REMOVE(o, p, s)           esp_video_mem_stats_remove(o, p, s)
+#define VIDEO_MEM_FAIL(o, s)                esp_video_mem_stats_fail(o, s)
+#else
+#define VIDEO_MEM_ADD(o, p, s)
+#define VIDEO_MEM_REMOVE(o, p, s)
+#define VIDEO_MEM_FAIL(o, s)
+#endif
+
 #define STREAM_FORMAT(s)                    (&(s)->format)
 #define STREAM_BUF_INFO(s)                  (&(s)->buf_info)
 #define STREAM_RECT(s)                      (&(s)->rect)
@@ -83,7 +95,16 @@ extern "C" {
 #define CAPTURE_VIDEO_BUF_SIZE(v)           STREAM_BUFFER_SIZE(CAPTURE_VIDEO_STREAM(v))
 
 #define CAPTURE_VIDEO_DONE_BUF(v, b, n)     esp_video_done_buffer(v, V4L2_BUF_TYPE_VIDEO_CAPTURE, b, n)
+#define CAPTURE_VIDEO_DONE_BUF_TIMESTAMP(v, b, n, t)                    \
+    esp_video_done_buffer_timestamp(v, V4L2_BUF_TYPE_VIDEO_CAPTURE, b, n, t)
+
+#define CAPTURE_VIDEO_DROP_FRAME(v)                                     \
+    esp_video_drop_frame(v, V4L2_BUF_TYPE_VIDEO_CAPTURE)
 #define CAPTURE_VIDEO_SKIP_BUF(v, b)        esp_video_skip_buffer(v, V4L2_BUF_TYPE_VIDEO_CAPTURE, b)
+#define CAPTURE_VIDEO_RX_ERROR(v, e, f)     esp_video_rx_error(v, V4L2_BUF_TYPE_VIDEO_CAPTURE, e, f)
+#define CAPTURE_VIDEO_RECOVERED(v)          esp_video_stream_recovered(v, V4L2_BUF_TYPE_VIDEO_CAPTURE)
+#define CAPTURE_VIDEO_DONE_SLICE(v, b, s, c, n)                         \
+    esp_video_done_slice(v, V4L2_BUF_TYPE_VIDEO_CAPTURE, b, s, c, n)
 
 #define CAPTURE_VIDEO_PARAM(v)              STREAM_PARAM(CAPTURE_VIDEO_STREAM(v))
 
@@ -126,7 +147,7 @@ extern "C" {
     esp_video_get_queued_element(v, V4L2_BUF_TYPE_VIDEO_CAPTURE)
 
 #define CAPTURE_VIDEO_GET_FIRST_DONE_ELEMENT_PTR(v)                     \
-    TAILQ_FIRST(&CAPTURE_VIDEO_STREAM(v)->done_list)
+    esp_video_peek_done_element(v, V4L2_BUF_TYPE_VIDEO_CAPTURE)
 
 /* video M2M operations */
 
@@ -266,10 +287,13 @@ enum esp_video_event {
     ESP_VIDEO_BUFFER_VALID = 0,     /*!< Video buffer is freed and it can be allocated by video device */
     ESP_VIDEO_M2M_TRIGGER,          /*!< Trigger M2M video device transforming event */
     ESP_VIDEO_DATA_PREPROCESSING,   /*!< Trigger data preprocessing */
+    ESP_VIDEO_BUFFER_QUEUED,        /*!< Video buffer element is queued again, the argument is the element */
 };
 
 struct esp_video;
 struct esp_video_stream;
+struct esp_video_capture_request;
+struct esp_video_format_cap;
 
 /**
  * @brief M2M video device process function
@@ -340,6 +364,18 @@ struct esp_video_ops {
 
     esp_err_t (*get_sensor_format)(struct esp_video *video, esp_cam_sensor_format_t *format);
 
+    /*!< Get exposure and gain delay of sensor in frames */
+
+    esp_err_t (*get_sensor_ctrl_delay)(struct esp_video *video, uint32_t *frames);
+
+    /*!< Queue sensor settings for one frame */
+
+    esp_err_t (*queue_capture_request)(struct esp_video *video, const struct esp_video_capture_request *request);
+
+    /*!< Enumerate valid combinations of sensor mode and capture format */
+
+    esp_err_t (*enum_format_cap)(struct esp_video *video, struct esp_video_format_cap *cap);
+
     /*!< Query menu value */
 
     esp_err_t (*query_menu)(struct esp_video *video, struct v4l2_querymenu *qmenu);
@@ -58,6 +58,10 @@ void esp_video_swap_byte_free(esp_video_swap_byte_t *swap_byte);
 /**
  * @brief Process video swap byte
  *
+ * dst may be src, the frame is then swapped in place and needs no second
+ * buffer: the RISC-V backend loads each block before storing it, and the
+ * bitscrambler one swaps on the capture DMA and leaves the buffer alone.
+ *
  * @param swap_byte     Video swap byte object pointer
  * @param src           Source buffer pointer
  * @param src_size      Source buffer size
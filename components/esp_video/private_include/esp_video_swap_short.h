@@ -43,6 +43,10 @@ esp_video_swap_short_t *esp_video_swap_short_create(size_t max_size);
 /**
  * @brief Process video swap short
  *
+ * dst may be src, the frame is then swapped in place and needs no second
+ * buffer: the CPU backends load each block before storing it and the
+ * bitscrambler loopback writes a byte only after it has read it.
+ *
  * @param swap_short    Video swap short object pointer
  * @param src           Source buffer pointer
  * @param src_size      Source buffer size
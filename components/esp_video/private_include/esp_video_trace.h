@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#if CONFIG_ESP_VIDEO_ENABLE_TRACE
+#include "SEGGER_SYSVIEW.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief SystemView marker IDs of the video pipeline stages.
+ *
+ * Applications adding markers of their own, e.g. around the network send of a
+ * frame, should use IDs out of this range.
+ */
+typedef enum esp_video_trace_marker {
+    ESP_VIDEO_TRACE_FRAME_START = 0x5600,   /*!< The capture controller starts receiving a frame, ISR */
+    ESP_VIDEO_TRACE_FRAME_END,              /*!< The capture controller finished receiving a frame, ISR */
+    ESP_VIDEO_TRACE_DONE_BUFFER,            /*!< A done frame is put into the done list or handed to a linked device */
+    ESP_VIDEO_TRACE_DQBUF,                  /*!< DQBUF from the call to the wakeup with a done frame */
+    ESP_VIDEO_TRACE_M2M_PROCESS,            /*!< An M2M device encodes or converts one frame */
+    ESP_VIDEO_TRACE_ISP_IPA,                /*!< The ISP pipeline controller runs the image algorithms */
+    ESP_VIDEO_TRACE_RECOVERY,               /*!< A device restarts the receiver of a stalled stream */
+} esp_video_trace_marker_t;
+
+#if CONFIG_ESP_VIDEO_ENABLE_TRACE
+/**
+ * @brief Send the names of the markers to the host.
+ *
+ * SystemView only learns names while recording, so they are sent at every
+ * stream start rather than once at boot.
+ *
+ * @return None
+ */
+static inline void esp_video_trace_name_markers(void)
+{
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_FRAME_START, "video frame start");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_FRAME_END, "video frame end");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_DONE_BUFFER, "video done buffer");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_DQBUF, "video DQBUF");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_M2M_PROCESS, "video M2M process");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_ISP_IPA, "video ISP IPA");
+    SEGGER_SYSVIEW_NameMarker(ESP_VIDEO_TRACE_RECOVERY, "video recovery");
+}
+
+#define ESP_VIDEO_TRACE_NAME_MARKERS()  esp_video_trace_name_markers()
+#define ESP_VIDEO_TRACE_MARK(m)         SEGGER_SYSVIEW_Mark(m)
+#define ESP_VIDEO_TRACE_START(m)        SEGGER_SYSVIEW_MarkStart(m)
+#define ESP_VIDEO_TRACE_STOP(m)         SEGGER_SYSVIEW_MarkStop(m)
+#else
+#define ESP_VIDEO_TRACE_NAME_MARKERS()
+#define ESP_VIDEO_TRACE_MARK(m)
+#define ESP_VIDEO_TRACE_START(m)
+#define ESP_VIDEO_TRACE_STOP(m)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -46,6 +46,15 @@ esp_err_t esp_video_vfs_dev_register(const char *name, struct esp_video *video);
  */
 esp_err_t esp_video_vfs_dev_unregister(const char *name);
 
+/**
+ * @brief Wake up the select calls waiting on a video device, safe in ISR.
+ *
+ * @param video Video object whose poll events may have changed
+ *
+ * @return None
+ */
+void esp_video_vfs_notify(struct esp_video *video);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,245 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_video_color_convert.h"
+#include "esp_video_internal.h"
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+#include "driver/ppa.h"
+#endif
+
+/* BT.601 full range in 8-bit fixed point, the coefficients of each row add up to 256 or 0 */
+#define COLOR_CONVERT_Y(r, g, b)    ((77 * (r) + 150 * (g) + 29 * (b) + 128) >> 8)
+
+struct esp_video_color_convert {
+    esp_video_color_convert_config_t config;
+    size_t in_size;
+    size_t out_size;
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+    ppa_client_handle_t ppa;
+#endif
+};
+
+static const char *TAG = "color_convert";
+
+static inline uint8_t color_convert_clamp(int32_t value)
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+#if !CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+static void color_convert_rgb888_to_rgb565(const uint8_t *src, size_t pixels, uint16_t *dst)
+{
+    for (const uint8_t *end = src + pixels * 3; src < end; src += 3) {
+        *dst++ = ((src[0] & 0xf8) << 8) | ((src[1] & 0xfc) << 3) | (src[2] >> 3);
+    }
+}
+
+/**
+ * @brief RGB888 to the ISP YUV420 layout, 2 rows at a time
+ *
+ * Per pixel pair the top row of a pair holds U Y Y and the bottom row V Y Y,
+ * U and V are those of the average of the 2x2 cell.
+ */
+static void color_convert_rgb888_to_yuv420(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst)
+{
+    size_t src_stride = width * 3;
+    size_t dst_stride = width * 3 / 2;
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        const uint8_t *s0 = src + y * src_stride;
+        const uint8_t *s1 = s0 + src_stride;
+        uint8_t *d0 = dst + y * dst_stride;
+        uint8_t *d1 = d0 + dst_stride;
+
+        for (uint32_t x = 0; x < width; x += 2, s0 += 6, s1 += 6, d0 += 3, d1 += 3) {
+            int32_t r = s0[0] + s0[3] + s1[0] + s1[3];
+            int32_t g = s0[1] + s0[4] + s1[1] + s1[4];
+            int32_t b = s0[2] + s0[5] + s1[2] + s1[5];
+
+            d0[0] = color_convert_clamp(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128);
+            d0[1] = COLOR_CONVERT_Y(s0[0], s0[1], s0[2]);
+            d0[2] = COLOR_CONVERT_Y(s0[3], s0[4], s0[5]);
+            d1[0] = color_convert_clamp(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128);
+            d1[1] = COLOR_CONVERT_Y(s1[0], s1[1], s1[2]);
+            d1[2] = COLOR_CONVERT_Y(s1[3], s1[4], s1[5]);
+        }
+    }
+}
+#endif
+
+static void color_convert_raw8_to_rgb888(const uint8_t *src, uint32_t width, uint32_t height,
+                                         esp_video_color_convert_bayer_t bayer, uint8_t *dst)
+{
+    /* Offsets of R, G, G and B in the cell, the second row starts at width */
+    static const uint8_t s_cell[][4] = {
+        [ESP_VIDEO_COLOR_CONVERT_BAYER_RGGB] = {0, 1, 2, 3},
+        [ESP_VIDEO_COLOR_CONVERT_BAYER_GRBG] = {1, 0, 3, 2},
+        [ESP_VIDEO_COLOR_CONVERT_BAYER_GBRG] = {2, 0, 3, 1},
+        [ESP_VIDEO_COLOR_CONVERT_BAYER_BGGR] = {3, 1, 2, 0},
+    };
+    const uint8_t *cell = s_cell[bayer];
+    const uint8_t *row[2];
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        row[0] = src + y * width;
+        row[1] = row[0] + width;
+
+        for (uint32_t x = 0; x < width; x += 2, dst += 3) {
+#define CELL_PIXEL(i)   row[(i) >> 1][x + ((i) & 1)]
+            dst[0] = CELL_PIXEL(cell[0]);
+            dst[1] = (CELL_PIXEL(cell[1]) + CELL_PIXEL(cell[2]) + 1) >> 1;
+            dst[2] = CELL_PIXEL(cell[3]);
+#undef CELL_PIXEL
+        }
+    }
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+static esp_err_t color_convert_ppa(esp_video_color_convert_handle_t handle, const void *src, void *dst, size_t dst_size)
+{
+    const esp_video_color_convert_config_t *config = &handle->config;
+    /* The PPA syncs the caches of both buffers itself */
+    ppa_srm_oper_config_t srm_config = {
+        .in = {
+            .buffer = src,
+            .pic_w = config->width,
+            .pic_h = config->height,
+            .block_w = config->width,
+            .block_h = config->height,
+            .srm_cm = PPA_SRM_COLOR_MODE_RGB888,
+        },
+        .out = {
+            .buffer = dst,
+            .buffer_size = dst_size,
+            .pic_w = config->width,
+            .pic_h = config->height,
+        },
+        .rotation_angle = PPA_SRM_ROTATION_ANGLE_0,
+        .scale_x = 1.0f,
+        .scale_y = 1.0f,
+        .mode = PPA_TRANS_MODE_BLOCKING,
+    };
+
+    if (config->type == ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565) {
+        srm_config.out.srm_cm = PPA_SRM_COLOR_MODE_RGB565;
+    } else {
+        srm_config.out.srm_cm = PPA_SRM_COLOR_MODE_YUV420;
+        srm_config.out.yuv_range = PPA_COLOR_RANGE_FULL;
+        srm_config.out.yuv_std = PPA_COLOR_CONV_STD_RGB_YUV_BT601;
+    }
+
+    return ppa_do_scale_rotate_mirror(handle->ppa, &srm_config);
+}
+#endif
+
+esp_err_t esp_video_color_convert_create(const esp_video_color_convert_config_t *config,
+                                         esp_video_color_convert_handle_t *ret_handle)
+{
+    esp_video_color_convert_handle_t handle;
+    size_t pixels;
+
+    ESP_RETURN_ON_FALSE(config && ret_handle, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->type <= ESP_VIDEO_COLOR_CONVERT_RAW8_TO_RGB888 &&
+                        config->bayer <= ESP_VIDEO_COLOR_CONVERT_BAYER_BGGR, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid conversion");
+    ESP_RETURN_ON_FALSE(config->width && config->height && !(config->width & 1) && !(config->height & 1),
+                        ESP_ERR_INVALID_ARG, TAG, "width and height must be even");
+
+    handle = heap_caps_calloc(1, sizeof(struct esp_video_color_convert), MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_NO_MEM, TAG, "failed to allocate color converter");
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_color_convert));
+
+    handle->config = *config;
+    pixels = config->width * config->height;
+    switch (config->type) {
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565:
+        handle->in_size = pixels * 3;
+        handle->out_size = pixels * 2;
+        break;
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_YUV420:
+        handle->in_size = pixels * 3;
+        handle->out_size = pixels * 3 / 2;
+        break;
+    default:
+        handle->in_size = pixels;
+        handle->out_size = pixels / 4 * 3;
+        break;
+    }
+
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+    if (config->type != ESP_VIDEO_COLOR_CONVERT_RAW8_TO_RGB888) {
+        esp_err_t ret;
+        ppa_client_config_t ppa_config = {
+            .oper_type = PPA_OPERATION_SRM,
+            .max_pending_trans_num = 1,
+        };
+
+        ret = ppa_register_client(&ppa_config, &handle->ppa);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "failed to register PPA client: %s", esp_err_to_name(ret));
+            VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_color_convert));
+            heap_caps_free(handle);
+            return ret;
+        }
+    }
+#endif
+
+    *ret_handle = handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_video_color_convert_process(esp_video_color_convert_handle_t handle, const void *src, size_t src_size,
+                                          void *dst, size_t dst_size, size_t *ret_size)
+{
+    const esp_video_color_convert_config_t *config;
+
+    ESP_RETURN_ON_FALSE(handle && src && dst && ret_size, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(src_size == handle->in_size && dst_size >= handle->out_size, ESP_ERR_INVALID_SIZE, TAG,
+                        "src_size=%zu dst_size=%zu do not fit", src_size, dst_size);
+
+    config = &handle->config;
+    switch (config->type) {
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565:
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_YUV420:
+        ESP_RETURN_ON_ERROR(color_convert_ppa(handle, src, dst, dst_size), TAG, "failed to convert on PPA");
+        break;
+#else
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565:
+        color_convert_rgb888_to_rgb565(src, config->width * config->height, dst);
+        break;
+    case ESP_VIDEO_COLOR_CONVERT_RGB888_TO_YUV420:
+        color_convert_rgb888_to_yuv420(src, config->width, config->height, dst);
+        break;
+#endif
+    default:
+        color_convert_raw8_to_rgb888(src, config->width, config->height, config->bayer, dst);
+        break;
+    }
+    *ret_size = handle->out_size;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_color_convert_delete(esp_video_color_convert_handle_t handle)
+{
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL");
+
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+    if (handle->ppa) {
+        ppa_unregister_client(handle->ppa);
+    }
+#endif
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_color_convert));
+    heap_caps_free(handle);
+
+    return ESP_OK;
+}
@@ -0,0 +1,268 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_video_raw_unpack.h"
+#include "esp_video_internal.h"
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+#include "driver/bitscrambler_loopback.h"
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_PARL_IO
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_PARL_IO
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_LCD_CAM
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_LCD_CAM
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_GPSPI2
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_GPSPI2
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_GPSPI3
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_GPSPI3
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_I2S0
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_I2S0
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_I2S1
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_I2S1
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER_I2S2
+#define ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL SOC_BITSCRAMBLER_ATTACH_I2S2
+#endif
+BITSCRAMBLER_PROGRAM(esp_video_raw10_unpack, "esp_video_raw10_unpack");
+BITSCRAMBLER_PROGRAM(esp_video_raw12_unpack, "esp_video_raw12_unpack");
+#endif /* CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER */
+
+#define RAW_UNPACK_PIE_ALIGN            16      /*!< Size of a PIE register */
+#define RAW_UNPACK_PIE_LANES            (RAW_UNPACK_PIE_ALIGN / sizeof(uint16_t))
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BLACK_LEVEL_PIE
+extern void esp_video_raw_black_level_pie(uint16_t *data, size_t size, const uint16_t *pattern);
+#endif
+
+/**
+ * @brief Packed group geometry of a format
+ */
+typedef struct raw_unpack_group {
+    uint8_t in_size;                            /*!< Packed bytes of a group */
+    uint8_t out_size;                           /*!< Unpacked bytes of a group */
+    uint8_t pixels;                             /*!< Pixels of a group */
+    uint8_t bits;                               /*!< Bits of a pixel */
+} raw_unpack_group_t;
+
+struct esp_video_raw_unpack {
+    /* Black level of one row per lane, even rows alternate [0]/[1] and odd rows [2]/[3] */
+    uint16_t black_level[2][RAW_UNPACK_PIE_LANES] __attribute__((aligned(RAW_UNPACK_PIE_ALIGN)));
+    esp_video_raw_unpack_format_t format;
+    size_t max_size;
+    uint32_t width;                             /*!< Pixels of a row, 0 if no black level is subtracted */
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+    bitscrambler_handle_t bs;
+#endif
+};
+
+static const char *TAG = "raw_unpack";
+
+static const raw_unpack_group_t s_raw_unpack_group[] = {
+    [ESP_VIDEO_RAW_UNPACK_RAW10] = { .in_size = 5, .out_size = 8, .pixels = 4, .bits = 10 },
+    [ESP_VIDEO_RAW_UNPACK_RAW12] = { .in_size = 3, .out_size = 4, .pixels = 2, .bits = 12 },
+};
+
+#if !CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+static void raw_unpack_raw10(const uint8_t *src, size_t src_size, uint16_t *dst)
+{
+    for (const uint8_t *end = src + src_size; src < end; src += 5, dst += 4) {
+        uint8_t lsb = src[4];
+
+        dst[0] = (src[0] << 2) | (lsb & 0x03);
+        dst[1] = (src[1] << 2) | ((lsb >> 2) & 0x03);
+        dst[2] = (src[2] << 2) | ((lsb >> 4) & 0x03);
+        dst[3] = (src[3] << 2) | (lsb >> 6);
+    }
+}
+
+static void raw_unpack_raw12(const uint8_t *src, size_t src_size, uint16_t *dst)
+{
+    for (const uint8_t *end = src + src_size; src < end; src += 3, dst += 2) {
+        uint8_t lsb = src[2];
+
+        dst[0] = (src[0] << 4) | (lsb & 0x0f);
+        dst[1] = (src[1] << 4) | (lsb >> 4);
+    }
+}
+
+static void raw_unpack_run(esp_video_raw_unpack_format_t format, const uint8_t *src, size_t src_size, uint16_t *dst)
+{
+    if (format == ESP_VIDEO_RAW_UNPACK_RAW10) {
+        raw_unpack_raw10(src, src_size, dst);
+    } else {
+        raw_unpack_raw12(src, src_size, dst);
+    }
+}
+#endif
+
+/**
+ * @brief Subtract the black level of one row, clamping at 0
+ *
+ * @param pattern   Black level of each lane, the row starts on lane 0
+ * @param data      Unpacked row
+ * @param pixels    Pixels of the row, even
+ */
+static void raw_unpack_black_level(const uint16_t *pattern, uint16_t *data, size_t pixels)
+{
+    size_t done = 0;
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BLACK_LEVEL_PIE
+    /* Rows of a width that is not a multiple of 8 start unaligned every other row */
+    if (!((uintptr_t)data & (RAW_UNPACK_PIE_ALIGN - 1))) {
+        done = pixels & ~(RAW_UNPACK_PIE_LANES - 1);
+        if (done) {
+            esp_video_raw_black_level_pie(data, done * sizeof(uint16_t), pattern);
+        }
+    }
+#endif
+
+    /* done is a whole number of lanes, so the tail keeps the lane parity */
+    for (size_t i = done; i < pixels; i++) {
+        uint16_t black = pattern[i & 1];
+
+        data[i] = data[i] > black ? data[i] - black : 0;
+    }
+}
+
+esp_err_t esp_video_raw_unpack_create(esp_video_raw_unpack_format_t format, size_t max_size,
+                                      esp_video_raw_unpack_handle_t *ret_handle)
+{
+    esp_video_raw_unpack_handle_t handle;
+
+    ESP_RETURN_ON_FALSE(format <= ESP_VIDEO_RAW_UNPACK_RAW12 && max_size && ret_handle, ESP_ERR_INVALID_ARG, TAG,
+                        "invalid argument");
+
+    handle = heap_caps_aligned_calloc(RAW_UNPACK_PIE_ALIGN, 1, sizeof(struct esp_video_raw_unpack), MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_NO_MEM, TAG, "failed to allocate RAW unpack");
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_raw_unpack));
+
+    handle->format = format;
+    handle->max_size = max_size;
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+    esp_err_t ret;
+    const raw_unpack_group_t *group = &s_raw_unpack_group[format];
+
+    /* The loopback buffer limit applies to the larger, unpacked side */
+    ESP_GOTO_ON_ERROR(bitscrambler_loopback_create(&handle->bs, ESP_VIDEO_RAW_UNPACK_BITSCRAMBLER_PERIPHERAL,
+                                                   max_size / group->in_size * group->out_size),
+                      exit_0, TAG, "Failed to create loopback bitscrambler");
+
+    ESP_GOTO_ON_ERROR(bitscrambler_load_program(handle->bs, format == ESP_VIDEO_RAW_UNPACK_RAW10 ?
+                                                esp_video_raw10_unpack : esp_video_raw12_unpack),
+                      exit_1, TAG, "Failed to load bitscrambler program");
+#endif
+
+    *ret_handle = handle;
+    return ESP_OK;
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+exit_1:
+    bitscrambler_free(handle->bs);
+exit_0:
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_raw_unpack));
+    heap_caps_free(handle);
+    return ret;
+#endif
+}
+
+esp_err_t esp_video_raw_unpack_process(esp_video_raw_unpack_handle_t handle, const void *src, size_t src_size,
+                                       void *dst, size_t dst_size, size_t *ret_size)
+{
+    const raw_unpack_group_t *group;
+    size_t out_size;
+
+    ESP_RETURN_ON_FALSE(handle && src && dst && ret_size, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    group = &s_raw_unpack_group[handle->format];
+    out_size = src_size / group->in_size * group->out_size;
+    ESP_RETURN_ON_FALSE(src_size <= handle->max_size && !(src_size % group->in_size) && dst_size >= out_size,
+                        ESP_ERR_INVALID_SIZE, TAG, "src_size=%zu dst_size=%zu do not fit", src_size, dst_size);
+
+    if (!handle->width) {
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+        return bitscrambler_loopback_run(handle->bs, (void *)src, src_size, dst, out_size, ret_size);
+#else
+        raw_unpack_run(handle->format, src, src_size, dst);
+        *ret_size = out_size;
+
+        return ESP_OK;
+#endif
+    }
+
+    size_t row_in_size = handle->width / group->pixels * group->in_size;
+    size_t rows = src_size / row_in_size;
+    uint16_t *row = dst;
+
+    ESP_RETURN_ON_FALSE(!(src_size % row_in_size), ESP_ERR_INVALID_SIZE, TAG,
+                        "src_size=%zu is not a whole number of %" PRIu32 " pixel rows", src_size, handle->width);
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+    ESP_RETURN_ON_ERROR(bitscrambler_loopback_run(handle->bs, (void *)src, src_size, dst, out_size, ret_size),
+                        TAG, "failed to unpack");
+
+    for (size_t i = 0; i < rows; i++, row += handle->width) {
+        raw_unpack_black_level(handle->black_level[i & 1], row, handle->width);
+    }
+#else
+    /* Subtract row by row, while the unpacked row is still in the cache */
+    for (size_t i = 0; i < rows; i++, row += handle->width) {
+        raw_unpack_run(handle->format, (const uint8_t *)src + i * row_in_size, row_in_size, row);
+        raw_unpack_black_level(handle->black_level[i & 1], row, handle->width);
+    }
+    *ret_size = out_size;
+#endif
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_raw_unpack_set_black_level(esp_video_raw_unpack_handle_t handle, uint32_t width,
+                                               const uint16_t black_level[4])
+{
+    const raw_unpack_group_t *group;
+
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL");
+
+    if (!black_level) {
+        handle->width = 0;
+        return ESP_OK;
+    }
+
+    group = &s_raw_unpack_group[handle->format];
+    ESP_RETURN_ON_FALSE(width && !(width % group->pixels), ESP_ERR_INVALID_ARG, TAG,
+                        "width=%" PRIu32 " is not a whole number of groups", width);
+    for (int i = 0; i < 4; i++) {
+        ESP_RETURN_ON_FALSE(black_level[i] < (1 << group->bits), ESP_ERR_INVALID_ARG, TAG,
+                            "black_level[%d]=%u exceeds %u bits", i, black_level[i], group->bits);
+    }
+
+    for (int i = 0; i < RAW_UNPACK_PIE_LANES; i++) {
+        handle->black_level[0][i] = black_level[i & 1];
+        handle->black_level[1][i] = black_level[2 + (i & 1)];
+    }
+    handle->width = width;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_raw_unpack_delete(esp_video_raw_unpack_handle_t handle)
+{
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL");
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+    bitscrambler_free(handle->bs);
+#endif
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, handle, sizeof(struct esp_video_raw_unpack));
+    heap_caps_free(handle);
+
+    return ESP_OK;
+}
@@ -10,6 +10,7 @@
 #include "esp_attr.h"
 #include "esp_heap_caps.h"
 #include "esp_video_swap_byte.h"
+#include "esp_video_internal.h"
 
 static const char *TAG = "swap_byte";
 
@@ -33,6 +34,7 @@ esp_video_swap_byte_t *esp_video_swap_byte_create(void)
         ESP_LOGE(TAG, "Failed to allocate memory for swap byte");
         return NULL;
     }
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_byte, sizeof(esp_video_swap_byte_t));
 
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_BYTE_BITSCRAMBLER
     esp_err_t ret;
@@ -57,6 +59,7 @@ esp_video_swap_byte_t *esp_video_swap_byte_create(void)
 exit_1:
     bitscrambler_free(swap_byte->bs);
 exit_0:
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_byte, sizeof(esp_video_swap_byte_t));
     heap_caps_free(swap_byte);
     return NULL;
 #else
@@ -109,12 +112,17 @@ void esp_video_swap_byte_free(esp_video_swap_byte_t *swap_byte)
     bitscrambler_free(swap_byte->bs);
 #endif
 
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_byte, sizeof(esp_video_swap_byte_t));
     heap_caps_free(swap_byte);
 }
 
 /**
  * @brief Process video swap byte
  *
+ * dst may be src, the frame is then swapped in place and needs no second
+ * buffer: the RISC-V backend loads each block before storing it, and the
+ * bitscrambler one swaps on the capture DMA and leaves the buffer alone.
+ *
  * @param swap_byte     Video swap byte object pointer
  * @param src           Source buffer pointer
  * @param src_size      Source buffer size
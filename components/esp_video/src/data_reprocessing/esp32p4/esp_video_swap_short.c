@@ -9,6 +9,7 @@
 #include "esp_err.h"
 #include "esp_heap_caps.h"
 #include "esp_video_swap_short.h"
+#include "esp_video_internal.h"
 #if CONFIG_ESP_VIDEO_ENABLE_BITSCRAMBLER
 #include "driver/bitscrambler_loopback.h"
 #endif
@@ -74,6 +75,7 @@ esp_video_swap_short_t *esp_video_swap_short_create(size_t max_size)
     if (!swap_short) {
         return NULL;
     }
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_short, sizeof(esp_video_swap_short_t));
 
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT_BITSCRAMBLER
     esp_err_t ret;
@@ -105,6 +107,7 @@ esp_video_swap_short_t *esp_video_swap_short_create(size_t max_size)
 exit_1:
     bitscrambler_free(bs);
 exit_0:
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_short, sizeof(esp_video_swap_short_t));
     heap_caps_free(swap_short);
     return NULL;
 #endif
@@ -113,6 +116,10 @@ exit_0:
 /**
  * @brief Process video swap short
  *
+ * dst may be src, the frame is then swapped in place and needs no second
+ * buffer: the CPU backends load each block before storing it and the
+ * bitscrambler loopback writes a byte only after it has read it.
+ *
  * @param swap_short    Video swap short object pointer
  * @param src           Source buffer pointer
  * @param src_size      Source buffer size
@@ -179,5 +186,6 @@ void esp_video_swap_short_free(esp_video_swap_short_t *swap_short)
     bitscrambler_free((bitscrambler_handle_t)swap_short->priv);
 #endif
 
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_REPROCESSING, swap_short, sizeof(esp_video_swap_short_t));
     heap_caps_free(swap_short);
 }
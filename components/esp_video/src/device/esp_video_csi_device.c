@@ -7,18 +7,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/param.h>
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_attr.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 #include "esp_private/esp_cache_private.h"
 #include "esp_ldo_regulator.h"
+#include "driver/gpio.h"
 #include "esp_cam_ctlr.h"
 #include "esp_cam_ctlr_csi.h"
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_STATS
+#include "soc/mipi_csi_host_struct.h"
+#include "soc/mipi_csi_bridge_struct.h"
+#endif
 
 #include "esp_video.h"
 #include "esp_video_cam.h"
+#include "esp_video_ioctl.h"
 #include "esp_video_device_internal.h"
+#include "esp_video_trace.h"
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
 #include "esp_video_swap_short.h"
 #endif
@@ -41,6 +50,43 @@
 /* AEG-1488 */
 #define CSI_BYTE_SWAP_EN            false
 
+/* Readout window alignment, in pixels */
+#define CSI_CROP_H_ALIGN            8
+#define CSI_CROP_V_ALIGN            4
+
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+#define CSI_SLICES                  CONFIG_ESP_VIDEO_MIPI_CSI_SLICES
+#endif
+
+#define CSI_TRIGGER_GPIO            CONFIG_ESP_VIDEO_MIPI_CSI_TRIGGER_GPIO
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_FLAG_FRAMES
+#define CSI_RX_ERROR_FLAG           true
+#else
+#define CSI_RX_ERROR_FLAG           false
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+#define CSI_LENS_VBLANK_US          CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_VBLANK_US
+#define CSI_LENS_SYNC_TIMEOUT_MS    200     /* Longer than a frame at the lowest frame rate */
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+#define CSI_WATCHDOG_FRAMES         CONFIG_ESP_VIDEO_MIPI_CSI_WATCHDOG_FRAMES
+#define CSI_WATCHDOG_TASK_NAME      "csi_wdt"
+#define CSI_WATCHDOG_TASK_STACK     3072
+#define CSI_WATCHDOG_TASK_PRIORITY  (configMAX_PRIORITIES - 2)  /* Above the application, a stall costs frames */
+#define CSI_WATCHDOG_LOG_RESTARTS   3       /* Restarts in a row logged before only every 100th is */
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+#define CSI_REQUEST_NUM             CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUEST_NUM
+#define CSI_REQUEST_TASK_NAME       "csi_req"
+#define CSI_REQUEST_TASK_STACK      3072
+#define CSI_REQUEST_TASK_PRIORITY   (configMAX_PRIORITIES - 2)  /* The write has to end in the vertical blank */
+#define CSI_REQUEST_FLAGS           (ESP_VIDEO_REQUEST_EXPOSURE | ESP_VIDEO_REQUEST_GAIN)
+#endif
+
 #define CSI_DEFAULT_OUT_COLOR       CAM_CTLR_COLOR_RGB565
 #define CSI_DEFAULT_OUT_BPP         16
 #define V4L2_DEFAULT_OUT_COLOR      V4L2_PIX_FMT_RGB565
@@ -49,16 +95,53 @@ struct csi_video {
     esp_video_csi_state_t state;
 
     esp_cam_ctlr_handle_t cam_ctrl_handle;
+    esp_cam_ctlr_csi_config_t csi_config;           /*!< Configuration of cam_ctrl_handle, kept while streaming is off */
+    bool streaming;
     esp_ldo_channel_handle_t ldo_handle;
+    uint32_t sync_mode;                             /*!< ESP_VIDEO_SENSOR_SYNC_XXX the sensor starts in */
+    bool trigger_enabled;                           /*!< The frame trigger GPIO interrupt is installed */
+    struct esp_video_format_cap *caps;              /*!< Valid sensor mode and capture format pairs, built at creation */
+    uint32_t cap_num;                               /*!< Entries in caps */
 
 #if CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER
     struct esp_video_buffer_element *element;
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    struct esp_video_buffer_element *slice_element; /*!< Element the bands of the frame being received go to, NULL for the backup buffer */
+    uint32_t slice_size;                            /*!< Bytes per band, one DMA transaction */
+    uint8_t fill_slice;                             /*!< Band the next new transaction receives */
+    uint8_t done_slice;                             /*!< Band the next finished transaction carried */
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
     esp_video_swap_short_t *swap_short;
 #endif
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    SemaphoreHandle_t frame_end_sem;                /*!< Given at every frame end, lens moves wait for it */
+    volatile int64_t frame_end_us;                  /*!< esp_timer time of the last frame end */
+    int32_t lens_pos;                               /*!< Last lens position code set, -1 if unknown */
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    TaskHandle_t wdt_task;                          /*!< Watchdog task, runs while streaming */
+    SemaphoreHandle_t wdt_exit;                     /*!< Given by the watchdog task when it exits */
+    volatile bool wdt_run;                          /*!< Cleared to make the watchdog task exit */
+    TickType_t wdt_period;                          /*!< Frame period the watchdog checks the frame ends at */
+    volatile uint32_t frame_ends;                   /*!< DMA transactions finished, counted in the ISR */
+    struct esp_video_buffer_element *rx_element;    /*!< Element of the last new transaction, the one being received */
+    bool ctlr_stopped;                              /*!< A restart stopped the CSI controller but failed to start it */
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    QueueHandle_t req_queue;                        /*!< Capture requests not written to the sensor yet */
+    TaskHandle_t req_task;                          /*!< Request task, writes one request per frame end while streaming */
+    SemaphoreHandle_t req_exit;                     /*!< Given by the request task when it exits */
+    volatile bool req_run;                          /*!< Cleared to make the request task exit */
+    bool req_group;                                 /*!< The sensor takes exposure and gain in one group hold */
+#endif
+
     esp_video_cam_t cam;
 };
 
@@ -236,31 +319,120 @@ static esp_err_t csi_get_input_bayer_order(const esp_cam_sensor_isp_info_t *isp_
     return ret;
 }
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_STATS
+/**
+ * @brief Read and clear the receiver errors since the last frame end, as ESP_VIDEO_RX_ERROR_XXX
+ *
+ * The CSI host interrupt status registers are cleared by reading them, the
+ * bridge raw interrupt bits are cleared by hand. None of these interrupts is
+ * enabled, so they are only polled here once per frame.
+ */
+static uint32_t IRAM_ATTR csi_video_get_rx_errors(void)
+{
+    uint32_t errors = 0;
+
+    if (MIPI_CSI_HOST.int_st_crc_frame_fatal.val | MIPI_CSI_HOST.int_st_pld_crc_fatal.val) {
+        errors |= ESP_VIDEO_RX_ERROR_CRC;
+    }
+    if (MIPI_CSI_HOST.int_st_pkt_fatal.val) {
+        errors |= ESP_VIDEO_RX_ERROR_ECC;
+    }
+    if (MIPI_CSI_HOST.int_st_phy_fatal.val | MIPI_CSI_HOST.int_st_phy.val) {
+        errors |= ESP_VIDEO_RX_ERROR_PHY;
+    }
+    if (MIPI_CSI_HOST.int_st_bndry_frame_fatal.val | MIPI_CSI_HOST.int_st_seq_frame_fatal.val) {
+        errors |= ESP_VIDEO_RX_ERROR_FRAME;
+    }
+    if (MIPI_CSI_BRIDGE.int_raw.csi_buf_overrun_int_raw || MIPI_CSI_BRIDGE.int_raw.csi_async_fifo_ovf_int_raw) {
+        MIPI_CSI_BRIDGE.int_clr.csi_buf_overrun_int_clr = 1;
+        MIPI_CSI_BRIDGE.int_clr.csi_async_fifo_ovf_int_clr = 1;
+        errors |= ESP_VIDEO_RX_ERROR_OVERFLOW;
+    }
+
+    return errors;
+}
+#endif
+
 static bool IRAM_ATTR csi_video_on_trans_finished(esp_cam_ctlr_handle_t handle, esp_cam_ctlr_trans_t *trans, void *user_data)
 {
     struct esp_video *video = (struct esp_video *)user_data;
     struct esp_video_param *param = CAPTURE_VIDEO_PARAM(video);
+    int64_t timestamp_us = esp_timer_get_time();
 
     ESP_EARLY_LOGD(TAG, "size=%zu", trans->received_size);
 
-#if CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE || CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER || \
+    CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC || CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG || \
+    CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
-    if (trans->buffer != csi_video->element->buffer) {
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    /* Any band received tells the watchdog the stream is alive */
+    csi_video->frame_ends++;
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    /* Transactions finish in order, so the band count tells where in the frame this one was */
+    uint32_t slice = csi_video->done_slice;
+    uint8_t *buffer = (uint8_t *)trans->buffer - slice * csi_video->slice_size;
+    size_t received_size = slice * csi_video->slice_size + trans->received_size;
+
+    csi_video->done_slice = (slice + 1) % CSI_SLICES;
+    if (slice < CSI_SLICES - 1) {
+        /* A band in the backup buffer matches no element and is not reported */
+        if (!param->skip_count) {
+            CAPTURE_VIDEO_DONE_SLICE(video, buffer, slice, CSI_SLICES, received_size);
+        }
+        return true;
+    }
+#else
+    uint8_t *buffer = trans->buffer;
+    size_t received_size = trans->received_size;
+#endif
+
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_END);
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_STATS
+    CAPTURE_VIDEO_RX_ERROR(video, csi_video_get_rx_errors(), CSI_RX_ERROR_FLAG);
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    /* The vertical blank starts, a lens move waiting for it can go */
+    csi_video->frame_end_us = timestamp_us;
+    if (csi_video->frame_end_sem) {
+        xSemaphoreGiveFromISR(csi_video->frame_end_sem, NULL);
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    /* The next request is written in the vertical blank that starts now */
+    if (csi_video->req_task && !xQueueIsQueueEmptyFromISR(csi_video->req_queue)) {
+        vTaskNotifyGiveFromISR(csi_video->req_task, NULL);
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER
+    if (buffer != csi_video->element->buffer) {
         if (!param->skip_count) {
-            CAPTURE_VIDEO_DONE_BUF(video, trans->buffer, trans->received_size);
+            CAPTURE_VIDEO_DONE_BUF_TIMESTAMP(video, buffer, received_size, timestamp_us);
         } else {
-            CAPTURE_VIDEO_SKIP_BUF(video, trans->buffer);
+            CAPTURE_VIDEO_SKIP_BUF(video, buffer);
         }
 
         if (param->skip_frames) {
             param->skip_count = (param->skip_count + 1) % param->skip_frames;
         }
+    } else {
+        /* The held element was overwritten, count the lost frame */
+        CAPTURE_VIDEO_DROP_FRAME(video);
     }
 #else
+    /* Frames received in the driver backup buffer are counted but not found in the stream */
     if (!param->skip_count) {
-        CAPTURE_VIDEO_DONE_BUF(video, trans->buffer, trans->received_size);
+        CAPTURE_VIDEO_DONE_BUF_TIMESTAMP(video, buffer, received_size, timestamp_us);
     } else {
-        CAPTURE_VIDEO_SKIP_BUF(video, trans->buffer);
+        CAPTURE_VIDEO_SKIP_BUF(video, buffer);
     }
 
     if (param->skip_frames) {
@@ -275,11 +447,33 @@ static bool IRAM_ATTR csi_video_on_get_new_trans(esp_cam_ctlr_handle_t handle, e
 {
     struct esp_video_buffer_element *element;
     struct esp_video *video = (struct esp_video *)user_data;
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE || CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER || \
+    CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    uint32_t slice = csi_video->fill_slice;
+
+    csi_video->fill_slice = (slice + 1) % CSI_SLICES;
+
+    /* The following bands of a frame go to the element its first band got */
+    if (slice) {
+        element = csi_video->slice_element;
+        if (!element) {
+            return false;
+        }
+
+        trans->buffer = element->buffer + slice * csi_video->slice_size;
+        trans->buflen = csi_video->slice_size;
+        return true;
+    }
+#endif
+
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_START);
 
     element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
 #if CONFIG_ESP_VIDEO_DISABLE_MIPI_CSI_DRIVER_BACKUP_BUFFER
-    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
-
     if (!element) {
         element = csi_video->element;
     } else {
@@ -287,16 +481,51 @@ static bool IRAM_ATTR csi_video_on_get_new_trans(esp_cam_ctlr_handle_t handle, e
     }
 #else
     if (!element) {
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+        csi_video->slice_element = NULL;
+#endif
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+        csi_video->rx_element = NULL;
+#endif
         return false;
     }
 #endif
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    /* With one queue item the last new transaction is the one in the DMA */
+    csi_video->rx_element = element;
+#endif
+
     trans->buffer = element->buffer;
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    csi_video->slice_element = element;
+    trans->buflen = csi_video->slice_size;
+#else
     trans->buflen = ELEMENT_SIZE(element);
+#endif
 
     return true;
 }
 
+static esp_err_t csi_set_buf_info(struct esp_video *video, uint8_t out_bpp)
+{
+    uint32_t buf_size = CAPTURE_VIDEO_GET_FORMAT_WIDTH(video) * CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video) * out_bpp / 8;
+
+    ESP_LOGD(TAG, "buffer size=%" PRIu32, buf_size);
+
+    size_t alignments = 0;
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(CSI_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+    ESP_LOGD(TAG, "alignments=%zu", alignments);
+
+    CAPTURE_VIDEO_SET_BUF_INFO(video, buf_size, alignments, CSI_MEM_CAPS);
+
+    return ESP_OK;
+}
+
 static esp_err_t init_config(struct esp_video *video)
 {
     uint8_t csi_in_bpp;
@@ -337,21 +566,57 @@ static esp_err_t init_config(struct esp_video *video)
                              sensor_format.height,
                              v4l2_format);
 
-    uint32_t buf_size = CAPTURE_VIDEO_GET_FORMAT_WIDTH(video) * CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video) * csi_video->state.out_bpp / 8;
+    /* A new sensor format is read out in full, any previous window is dropped */
+    memset(STREAM_RECT(CAPTURE_VIDEO_STREAM(video)), 0, sizeof(struct v4l2_rect));
 
-    ESP_LOGD(TAG, "buffer size=%" PRIu32, buf_size);
+    return csi_set_buf_info(video, csi_video->state.out_bpp);
+}
 
-    size_t alignments = 0;
-#if CONFIG_SPIRAM
-    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(CSI_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
-#else
-    alignments = 4;
-#endif
-    ESP_LOGD(TAG, "alignments=%zu", alignments);
+/* The controller only depends on these, the other fields are constant */
+static bool csi_config_is_equal(const esp_cam_ctlr_csi_config_t *a, const esp_cam_ctlr_csi_config_t *b)
+{
+    return a->h_res == b->h_res &&
+           a->v_res == b->v_res &&
+           a->data_lane_num == b->data_lane_num &&
+           a->input_data_color_type == b->input_data_color_type &&
+           a->output_data_color_type == b->output_data_color_type &&
+           a->lane_bit_rate_mbps == b->lane_bit_rate_mbps;
+}
 
-    CAPTURE_VIDEO_SET_BUF_INFO(video, buf_size, alignments, CSI_MEM_CAPS);
+/*
+ * Get a disabled CSI controller for the configuration. The controller of the
+ * previous stream is kept, so that a restart in the same mode skips the PHY
+ * and backup buffer setup, it is only replaced if the configuration changed.
+ */
+static esp_err_t csi_get_ctlr(struct esp_video *video, const esp_cam_ctlr_csi_config_t *csi_config)
+{
+    esp_err_t ret;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    esp_cam_ctlr_evt_cbs_t cam_ctrl_cbs = {
+        .on_get_new_trans = csi_video_on_get_new_trans,
+        .on_trans_finished = csi_video_on_trans_finished
+    };
+
+    if (csi_video->cam_ctrl_handle) {
+        if (csi_config_is_equal(&csi_video->csi_config, csi_config)) {
+            return ESP_OK;
+        }
+
+        ESP_RETURN_ON_ERROR(esp_cam_ctlr_del(csi_video->cam_ctrl_handle), TAG, "failed to delete CAM ctlr");
+        csi_video->cam_ctrl_handle = NULL;
+    }
+
+    ESP_RETURN_ON_ERROR(esp_cam_new_csi_ctlr(csi_config, &csi_video->cam_ctrl_handle), TAG, "failed to new CSI");
+    ESP_GOTO_ON_ERROR(esp_cam_ctlr_register_event_callbacks(csi_video->cam_ctrl_handle, &cam_ctrl_cbs, video),
+                      fail, TAG, "failed to register CAM ctlr event callback");
+    csi_video->csi_config = *csi_config;
 
     return ESP_OK;
+
+fail:
+    esp_cam_ctlr_del(csi_video->cam_ctrl_handle);
+    csi_video->cam_ctrl_handle = NULL;
+    return ret;
 }
 
 static esp_err_t csi_video_init(struct esp_video *video)
@@ -365,6 +630,7 @@ static esp_err_t csi_video_init(struct esp_video *video)
 
     ESP_RETURN_ON_ERROR(esp_ldo_acquire_channel(&ldo_cfg, &csi_video->ldo_handle), TAG, "failed to init LDO");
 
+    esp_video_cam_flush_desc(&csi_video->cam);
     ESP_GOTO_ON_ERROR(esp_cam_sensor_set_format(csi_video->cam.sensor, NULL), fail_0, TAG, "failed to set basic format");
     ESP_GOTO_ON_ERROR(init_config(video), fail_0, TAG, "failed to initialize config");
 
@@ -376,6 +642,375 @@ fail_0:
     return ret;
 }
 
+#if CSI_TRIGGER_GPIO >= 0
+static void IRAM_ATTR csi_video_on_trigger(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+
+    esp_video_set_frame_trigger(video, V4L2_BUF_TYPE_VIDEO_CAPTURE, esp_timer_get_time());
+}
+#endif
+
+/* Time the frame starts at the XVS edges when the sensor is synchronized with others */
+static esp_err_t csi_video_enable_trigger(struct esp_video *video)
+{
+#if CSI_TRIGGER_GPIO >= 0
+    esp_err_t ret;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    const gpio_config_t io_config = {
+        .pin_bit_mask = BIT64(CSI_TRIGGER_GPIO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+
+    if (csi_video->sync_mode == ESP_VIDEO_SENSOR_SYNC_MASTER) {
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_ERROR(gpio_config(&io_config), TAG, "failed to configure trigger GPIO");
+
+    /* The service may be installed by the application already */
+    ret = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    ESP_RETURN_ON_FALSE(ret == ESP_OK || ret == ESP_ERR_INVALID_STATE, ret, TAG, "failed to install GPIO ISR service");
+
+    ESP_RETURN_ON_ERROR(gpio_isr_handler_add(CSI_TRIGGER_GPIO, csi_video_on_trigger, video),
+                        TAG, "failed to add trigger GPIO ISR");
+    csi_video->trigger_enabled = true;
+#endif
+
+    return ESP_OK;
+}
+
+static void csi_video_disable_trigger(struct esp_video *video)
+{
+#if CSI_TRIGGER_GPIO >= 0
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (csi_video->trigger_enabled) {
+        gpio_isr_handler_remove(CSI_TRIGGER_GPIO);
+        gpio_set_intr_type(CSI_TRIGGER_GPIO, GPIO_INTR_DISABLE);
+        csi_video->trigger_enabled = false;
+    }
+#endif
+}
+
+/*
+ * Attribute the sensor exposure and gain to the frames captured from delay
+ * frames on, the first of them fulfills the request if one is given
+ */
+static void csi_video_track_sensor_settings(struct esp_video *video, uint32_t delay,
+                                            const struct esp_video_capture_request *request)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    struct esp_video_sensor_settings settings = {0};
+
+    if (request) {
+        settings.flags |= ESP_VIDEO_FRAME_META_REQUEST;
+        settings.request_id = request->id;
+    }
+
+    if (esp_cam_sensor_get_para_value(csi_video->cam.sensor, ESP_CAM_SENSOR_EXPOSURE_VAL,
+                                      &settings.exposure, sizeof(settings.exposure)) == ESP_OK) {
+        settings.flags |= ESP_VIDEO_FRAME_META_EXPOSURE;
+    }
+    if (esp_cam_sensor_get_para_value(csi_video->cam.sensor, ESP_CAM_SENSOR_GAIN,
+                                      &settings.gain, sizeof(settings.gain)) == ESP_OK) {
+        settings.flags |= ESP_VIDEO_FRAME_META_GAIN;
+    }
+
+    esp_video_set_sensor_settings(video, V4L2_BUF_TYPE_VIDEO_CAPTURE, &settings, delay);
+}
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+/*
+ * Restart the receiver of a stalled stream, the rings are kept. The CSI
+ * controller resynchronizes at the next frame start, with toggle_sensor the
+ * sensor stream is restarted as well, for a sensor that stopped sending.
+ */
+static esp_err_t csi_video_restart(struct esp_video *video, bool toggle_sensor)
+{
+    esp_err_t ret = ESP_OK;
+    int flags = 0;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    ESP_VIDEO_TRACE_START(ESP_VIDEO_TRACE_RECOVERY);
+
+    if (toggle_sensor && esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_CAM_SENSOR_IOC_S_STREAM, &flags) != ESP_OK) {
+        ESP_LOGW(TAG, "failed to stop sensor stream");
+    }
+
+    if (!csi_video->ctlr_stopped) {
+        ESP_GOTO_ON_ERROR(esp_cam_ctlr_stop(csi_video->cam_ctrl_handle), exit, TAG, "failed to stop CAM ctlr");
+        csi_video->ctlr_stopped = true;
+    }
+
+    /* The DMA is stopped, the element it was receiving into is lost unless queued again */
+    if (csi_video->rx_element) {
+        esp_video_queue_element(video, V4L2_BUF_TYPE_VIDEO_CAPTURE, csi_video->rx_element);
+        csi_video->rx_element = NULL;
+    }
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    csi_video->slice_element = NULL;
+    csi_video->fill_slice = 0;
+    csi_video->done_slice = 0;
+#endif
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_STATS
+    /* The errors that stalled the stream are not counted in the next frame */
+    csi_video_get_rx_errors();
+#endif
+    CAPTURE_VIDEO_RECOVERED(video);
+
+    ESP_GOTO_ON_ERROR(esp_cam_ctlr_start(csi_video->cam_ctrl_handle), exit, TAG, "failed to start CAM ctlr");
+    csi_video->ctlr_stopped = false;
+
+exit:
+    if (toggle_sensor) {
+        flags = 1;
+        if (esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_CAM_SENSOR_IOC_S_STREAM, &flags) != ESP_OK) {
+            ESP_LOGW(TAG, "failed to start sensor stream");
+        }
+    }
+
+    ESP_VIDEO_TRACE_STOP(ESP_VIDEO_TRACE_RECOVERY);
+    return ret;
+}
+
+static void csi_video_watchdog_task(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    uint32_t frame_ends = csi_video->frame_ends;
+    int32_t idle = -CSI_WATCHDOG_FRAMES;    /* The first frame also waits for the sensor start-up */
+    uint32_t restarts = 0;
+    int64_t stall_us = 0;
+
+    while (csi_video->wdt_run) {
+        ulTaskNotifyTake(pdTRUE, csi_video->wdt_period);
+        if (!csi_video->wdt_run) {
+            break;
+        }
+
+        if (csi_video->frame_ends != frame_ends) {
+            frame_ends = csi_video->frame_ends;
+            if (restarts) {
+                ESP_LOGW(TAG, "stream recovered after %" PRIu32 " restarts, %" PRIi64 " ms without frames",
+                         restarts, (esp_timer_get_time() - stall_us) / 1000);
+            }
+            idle = 0;
+            restarts = 0;
+            continue;
+        }
+
+        if (++idle < CSI_WATCHDOG_FRAMES) {
+            continue;
+        }
+
+        /* The controller alone is restarted first, it costs no sensor start-up time */
+        if (!restarts) {
+            stall_us = esp_timer_get_time() - (int64_t)idle * pdTICKS_TO_MS(csi_video->wdt_period) * 1000;
+        }
+        if (restarts < CSI_WATCHDOG_LOG_RESTARTS || restarts % 100 == 0) {
+            ESP_LOGW(TAG, "no frame for %" PRIi32 " frame periods, restarting %s", idle,
+                     restarts ? "CSI and sensor" : "CSI");
+        }
+        csi_video_restart(video, restarts > 0);
+
+        restarts++;
+        idle = 0;
+        frame_ends = csi_video->frame_ends;
+    }
+
+    xSemaphoreGive(csi_video->wdt_exit);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Watch the frame ends of a free-running sensor, a follower waits for its
+ * leader's XVS pulses. The stream goes on without a watchdog if the task can
+ * not be created.
+ */
+static void csi_video_watchdog_start(struct esp_video *video)
+{
+    esp_cam_sensor_format_t sensor_format;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (csi_video->sync_mode == ESP_VIDEO_SENSOR_SYNC_FOLLOWER ||
+            esp_cam_sensor_get_format(csi_video->cam.sensor, &sensor_format) != ESP_OK || !sensor_format.fps) {
+        return;
+    }
+
+    csi_video->wdt_period = MAX(pdMS_TO_TICKS(1000 / sensor_format.fps), 1);
+    csi_video->wdt_exit = xSemaphoreCreateBinary();
+    if (!csi_video->wdt_exit) {
+        ESP_LOGW(TAG, "no memory for the watchdog");
+        return;
+    }
+
+    csi_video->wdt_run = true;
+    if (xTaskCreate(csi_video_watchdog_task, CSI_WATCHDOG_TASK_NAME, CSI_WATCHDOG_TASK_STACK, video,
+                    CSI_WATCHDOG_TASK_PRIORITY, &csi_video->wdt_task) != pdPASS) {
+        ESP_LOGW(TAG, "failed to create watchdog task");
+        csi_video->wdt_run = false;
+        csi_video->wdt_task = NULL;
+        vSemaphoreDelete(csi_video->wdt_exit);
+        csi_video->wdt_exit = NULL;
+    }
+}
+
+/* Make the watchdog task exit, after the restart it may be doing */
+static void csi_video_watchdog_stop(struct esp_video *video)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (!csi_video->wdt_task) {
+        return;
+    }
+
+    csi_video->wdt_run = false;
+    xTaskNotifyGive(csi_video->wdt_task);
+    xSemaphoreTake(csi_video->wdt_exit, portMAX_DELAY);
+
+    csi_video->wdt_task = NULL;
+    vSemaphoreDelete(csi_video->wdt_exit);
+    csi_video->wdt_exit = NULL;
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+/* Write the settings of a request, with group hold when the sensor has it */
+static void csi_video_write_request(struct esp_video *video, const struct esp_video_capture_request *request)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    esp_cam_sensor_gh_exp_gain_t group = {0};
+    struct v4l2_ext_control control[2];
+    struct v4l2_ext_controls ctrls = {
+        .ctrl_class = V4L2_CID_CAMERA_CLASS,
+        .count = 0,
+        .controls = control,
+    };
+    uint32_t delay = 0;
+
+    if (csi_video->req_group) {
+        /* A group takes both values, the one not requested keeps what the sensor holds */
+        if (request->flags & ESP_VIDEO_REQUEST_EXPOSURE) {
+            group.exposure_val = request->exposure;
+        } else {
+            esp_cam_sensor_get_para_value(csi_video->cam.sensor, ESP_CAM_SENSOR_EXPOSURE_VAL,
+                                          &group.exposure_val, sizeof(group.exposure_val));
+        }
+        if (request->flags & ESP_VIDEO_REQUEST_GAIN) {
+            group.gain_index = request->gain;
+        } else {
+            esp_cam_sensor_get_para_value(csi_video->cam.sensor, ESP_CAM_SENSOR_GAIN,
+                                          &group.gain_index, sizeof(group.gain_index));
+        }
+
+        control[0].id = V4L2_CID_CAMERA_GROUP;
+        control[0].p_u8 = (uint8_t *)&group;
+        control[0].size = sizeof(group);
+        ctrls.count = 1;
+    } else {
+        if (request->flags & ESP_VIDEO_REQUEST_EXPOSURE) {
+            control[ctrls.count].id = V4L2_CID_EXPOSURE;
+            control[ctrls.count].value = request->exposure;
+            ctrls.count++;
+        }
+        if (request->flags & ESP_VIDEO_REQUEST_GAIN) {
+            control[ctrls.count].id = V4L2_CID_GAIN;
+            control[ctrls.count].value = request->gain;
+            ctrls.count++;
+        }
+    }
+
+    if (esp_video_cam_set_ext_ctrls(&csi_video->cam, &ctrls) != ESP_OK) {
+        ESP_LOGW(TAG, "failed to write capture request %" PRIu32, request->id);
+        return;
+    }
+
+    esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY, &delay);
+    csi_video_track_sensor_settings(video, delay, request);
+}
+
+static void csi_video_request_task(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    struct esp_video_capture_request request;
+
+    while (csi_video->req_run) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!csi_video->req_run) {
+            break;
+        }
+
+        /* One request per frame, the next one waits for the next frame end */
+        if (xQueueReceive(csi_video->req_queue, &request, 0) == pdTRUE) {
+            csi_video_write_request(video, &request);
+        }
+    }
+
+    xSemaphoreGive(csi_video->req_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t csi_video_request_start(struct esp_video *video)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    struct v4l2_query_ext_ctrl qctrl = {
+        .id = V4L2_CID_CAMERA_GROUP,
+    };
+
+    csi_video->req_group = esp_video_cam_query_ext_ctrls(&csi_video->cam, &qctrl) == ESP_OK;
+    csi_video->req_exit = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(csi_video->req_exit, ESP_ERR_NO_MEM, TAG, "no memory for the request task");
+
+    csi_video->req_run = true;
+    if (xTaskCreate(csi_video_request_task, CSI_REQUEST_TASK_NAME, CSI_REQUEST_TASK_STACK, video,
+                    CSI_REQUEST_TASK_PRIORITY, &csi_video->req_task) != pdPASS) {
+        csi_video->req_run = false;
+        csi_video->req_task = NULL;
+        vSemaphoreDelete(csi_video->req_exit);
+        csi_video->req_exit = NULL;
+        ESP_LOGE(TAG, "failed to create request task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/* Make the request task exit after the write it may be doing, the requests left are dropped */
+static void csi_video_request_stop(struct esp_video *video)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (!csi_video->req_task) {
+        return;
+    }
+
+    csi_video->req_run = false;
+    xTaskNotifyGive(csi_video->req_task);
+    xSemaphoreTake(csi_video->req_exit, portMAX_DELAY);
+
+    csi_video->req_task = NULL;
+    vSemaphoreDelete(csi_video->req_exit);
+    csi_video->req_exit = NULL;
+    xQueueReset(csi_video->req_queue);
+}
+
+static esp_err_t csi_video_queue_capture_request(struct esp_video *video, const struct esp_video_capture_request *request)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    ESP_RETURN_ON_FALSE(request->flags && !(request->flags & ~CSI_REQUEST_FLAGS), ESP_ERR_INVALID_ARG, TAG,
+                        "invalid request flags");
+    ESP_RETURN_ON_FALSE(xQueueSend(csi_video->req_queue, request, 0) == pdTRUE, ESP_ERR_NOT_FINISHED, TAG,
+                        "request queue is full");
+
+    return ESP_OK;
+}
+#endif
+
 static esp_err_t csi_video_start(struct esp_video *video, uint32_t type)
 {
     esp_err_t ret;
@@ -393,13 +1028,37 @@ static esp_err_t csi_video_start(struct esp_video *video, uint32_t type)
     }
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_SLICE_MODE
+    uint32_t v_res = CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video) / CSI_SLICES;
+    uint32_t align_size = CAPTURE_VIDEO_STREAM(video)->buf_info.align_size;
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
+    /* The data preprocessing works on whole frames, after the last band */
+    ESP_GOTO_ON_FALSE(!csi_video->swap_short, ESP_ERR_NOT_SUPPORTED, exit_0, TAG, "slices need unswapped data");
+#endif
+    ESP_GOTO_ON_FALSE(v_res * CSI_SLICES == CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video), ESP_ERR_INVALID_SIZE, exit_0,
+                      TAG, "height is not a multiple of %d slices", CSI_SLICES);
+
+    /* Every band starts on a cache line, so that it can be invalidated on its own */
+    csi_video->slice_size = CAPTURE_VIDEO_GET_FORMAT_WIDTH(video) * v_res * csi_video->state.out_bpp / 8;
+    ESP_GOTO_ON_FALSE(!align_size || csi_video->slice_size % align_size == 0, ESP_ERR_INVALID_SIZE, exit_0,
+                      TAG, "slice size %" PRIu32 " is not aligned to %" PRIu32, csi_video->slice_size, align_size);
+
+    csi_video->slice_element = NULL;
+    csi_video->fill_slice = 0;
+    csi_video->done_slice = 0;
+#else
+    uint32_t v_res = CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video);
+#endif
+
+    /* In slice mode the controller sees frames of one band, each DMA transaction is one band */
     esp_cam_ctlr_csi_config_t csi_config = {
         .ctlr_id = CSI_CTRL_ID,
         .clk_src = CSI_CLK_SRC,
         .byte_swap_en = CSI_BYTE_SWAP_EN,
         .queue_items = CSI_QUEUE_ITEMS,
         .h_res = CAPTURE_VIDEO_GET_FORMAT_WIDTH(video),
-        .v_res = CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video),
+        .v_res = v_res,
         .data_lane_num = csi_video->state.lane_num,
         .input_data_color_type = csi_video->state.in_color,
         .output_data_color_type = csi_video->state.out_color,
@@ -408,14 +1067,7 @@ static esp_err_t csi_video_start(struct esp_video *video, uint32_t type)
         .bk_buffer_dis = true,
 #endif
     };
-    ESP_GOTO_ON_ERROR(esp_cam_new_csi_ctlr(&csi_config, &csi_video->cam_ctrl_handle), exit_0, TAG, "failed to new CSI");
-
-    esp_cam_ctlr_evt_cbs_t cam_ctrl_cbs = {
-        .on_get_new_trans = csi_video_on_get_new_trans,
-        .on_trans_finished = csi_video_on_trans_finished
-    };
-    ESP_GOTO_ON_ERROR(esp_cam_ctlr_register_event_callbacks(csi_video->cam_ctrl_handle, &cam_ctrl_cbs, video),
-                      exit_1, TAG, "failed to register CAM ctlr event callback");
+    ESP_GOTO_ON_ERROR(csi_get_ctlr(video, &csi_config), exit_0, TAG, "failed to get CSI");
 
     ESP_GOTO_ON_ERROR(esp_cam_ctlr_enable(csi_video->cam_ctrl_handle), exit_1, TAG, "failed to enable CAM ctlr");
     ESP_GOTO_ON_ERROR(esp_cam_ctlr_start(csi_video->cam_ctrl_handle), exit_2, TAG, "failed to start CAM ctlr");
@@ -423,12 +1075,38 @@ static esp_err_t csi_video_start(struct esp_video *video, uint32_t type)
     ESP_GOTO_ON_ERROR(esp_video_isp_start_by_csi(&csi_video->state, STREAM_FORMAT(CAPTURE_VIDEO_STREAM(video))),
                       exit_3, TAG, "failed to start ISP");
 
+    /* The first frames are exposed with what the sensor holds now */
+    csi_video_track_sensor_settings(video, 0, NULL);
+
+    ESP_GOTO_ON_ERROR(csi_video_enable_trigger(video), exit_4, TAG, "failed to enable frame trigger");
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    ESP_GOTO_ON_ERROR(csi_video_request_start(video), exit_5, TAG, "failed to start capture requests");
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_RX_ERROR_STATS
+    /* Errors left from the last stream are not counted in this one */
+    csi_video_get_rx_errors();
+#endif
+
     int flags = 1;
     ESP_GOTO_ON_ERROR(esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_CAM_SENSOR_IOC_S_STREAM, &flags),
-                      exit_4, TAG, "failed to start sensor stream");
+                      exit_6, TAG, "failed to start sensor stream");
+
+    csi_video->streaming = true;
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    csi_video_watchdog_start(video);
+#endif
 
     return ESP_OK;
 
+exit_6:
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    csi_video_request_stop(video);
+#endif
+exit_5:
+    csi_video_disable_trigger(video);
 exit_4:
     esp_video_isp_stop(&csi_video->state);
 exit_3:
@@ -452,17 +1130,34 @@ static esp_err_t csi_video_stop(struct esp_video *video, uint32_t type)
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    /* No restart may touch the controller or the sensor from here on */
+    csi_video_watchdog_stop(video);
+#endif
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    csi_video_request_stop(video);
+#endif
+
     int flags = 0;
     ESP_RETURN_ON_ERROR(esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_CAM_SENSOR_IOC_S_STREAM, &flags),
                         TAG, "failed to stop sensor stream");
+    csi_video->streaming = false;
+    csi_video_disable_trigger(video);
 
     ESP_RETURN_ON_ERROR(esp_video_isp_stop(&csi_video->state), TAG, "failed to stop ISP");
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_STREAM_WATCHDOG
+    if (!csi_video->ctlr_stopped) {
+        ESP_RETURN_ON_ERROR(esp_cam_ctlr_stop(csi_video->cam_ctrl_handle), TAG, "failed to stop CAM ctlr");
+    }
+    csi_video->ctlr_stopped = false;
+#else
     ESP_RETURN_ON_ERROR(esp_cam_ctlr_stop(csi_video->cam_ctrl_handle), TAG, "failed to stop CAM ctlr");
+#endif
     ESP_RETURN_ON_ERROR(esp_cam_ctlr_disable(csi_video->cam_ctrl_handle), TAG, "failed to disable CAM ctlr");
 
-    ESP_RETURN_ON_ERROR(esp_cam_ctlr_del(csi_video->cam_ctrl_handle), TAG, "failed to delete CAM ctlr");
-    csi_video->cam_ctrl_handle = NULL;
+    /* The disabled controller stays allocated for the next start, see csi_get_ctlr() */
 
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
     if (csi_video->swap_short) {
@@ -478,6 +1173,11 @@ static esp_err_t csi_video_deinit(struct esp_video *video)
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
 
+    if (csi_video->cam_ctrl_handle) {
+        ESP_RETURN_ON_ERROR(esp_cam_ctlr_del(csi_video->cam_ctrl_handle), TAG, "failed to delete CAM ctlr");
+        csi_video->cam_ctrl_handle = NULL;
+    }
+
     ESP_RETURN_ON_ERROR(esp_ldo_release_channel(csi_video->ldo_handle), TAG, "failed to release LDO");
     csi_video->ldo_handle = NULL;
 
@@ -494,9 +1194,33 @@ static esp_err_t csi_video_enum_format(struct esp_video *video, uint32_t type, u
     return ret;
 }
 
+/*
+ * Check a capture format against the sensor input of a state, the rules of
+ * VIDIOC_S_FMT and of the format capabilities. Not logged, the capabilities
+ * are built by trying every candidate.
+ */
+static esp_err_t csi_check_output_format(esp_video_csi_state_t *state, const struct v4l2_format *format,
+                                         cam_ctlr_color_t *out_color, uint8_t *out_bpp, bool *bypass_isp)
+{
+    if (csi_get_output_frame_type_from_v4l2(format->fmt.pix.pixelformat, out_color, out_bpp) != ESP_OK) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (esp_video_isp_check_format(state, format) == ESP_OK) {
+        *bypass_isp = false;
+    } else if (state->in_color == *out_color) {
+        *bypass_isp = true;
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
 static esp_err_t csi_video_set_format(struct esp_video *video, const struct v4l2_format *format)
 {
     uint8_t out_bpp;
+    bool bypass_isp;
     cam_ctlr_color_t out_color;
     const struct v4l2_pix_format *pix = &format->fmt.pix;
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
@@ -507,33 +1231,123 @@ static esp_err_t csi_video_set_format(struct esp_video *video, const struct v4l2
         return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_RETURN_ON_ERROR(csi_get_output_frame_type_from_v4l2(pix->pixelformat, &out_color, &out_bpp),
-                        TAG, "CSI does not support format=%" PRIx32, pix->pixelformat);
-
-    if (esp_video_isp_check_format(&csi_video->state, format) == ESP_OK) {
-        csi_video->state.bypass_isp = false;
-    } else {
-        ESP_RETURN_ON_FALSE(csi_video->state.in_color == out_color, ESP_ERR_NOT_SUPPORTED,
-                            TAG, "ISP does not support format=%" PRIx32, pix->pixelformat);
-        csi_video->state.bypass_isp = true;
-    }
+    ESP_RETURN_ON_ERROR(csi_check_output_format(&csi_video->state, format, &out_color, &out_bpp, &bypass_isp),
+                        TAG, "CSI or ISP does not support format=%" PRIx32, pix->pixelformat);
 
+    csi_video->state.bypass_isp = bypass_isp;
     csi_video->state.out_color = out_color;
     csi_video->state.out_bpp = out_bpp;
 
-    uint32_t buf_size = CAPTURE_VIDEO_GET_FORMAT_WIDTH(video) * CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video) * out_bpp / 8;
+    return csi_set_buf_info(video, out_bpp);
+}
 
-    ESP_LOGD(TAG, "buffer size=%" PRIu32, buf_size);
+/*
+ * Add the capture formats of one sensor mode to caps, or only count them if
+ * caps is NULL. The candidates are the formats VIDIOC_ENUM_FMT lists with the
+ * ISP in use, which include the pass-through format of the sensor input.
+ */
+static uint32_t csi_add_format_caps(const esp_cam_sensor_format_t *sensor_format, struct esp_video_format_cap *caps)
+{
+    uint8_t in_bpp;
+    uint8_t lane_num;
+    uint32_t pixel_format;
+    uint32_t num = 0;
+    esp_video_csi_state_t state = {
+        .bypass_isp = false,
+    };
 
-    size_t alignments = 0;
-#if CONFIG_SPIRAM
-    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(CSI_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
-#else
-    alignments = 4;
-#endif
-    ESP_LOGD(TAG, "alignments=%zu", alignments);
+    if (sensor_format->port != ESP_CAM_SENSOR_MIPI_CSI ||
+            csi_get_data_lane(sensor_format->mipi_info.lane_num, &lane_num) != ESP_OK ||
+            csi_get_input_frame_type(sensor_format->format, &state.in_color, &in_bpp, &state.in_fmt) != ESP_OK) {
+        return 0;
+    }
 
-    CAPTURE_VIDEO_SET_BUF_INFO(video, buf_size, alignments, CSI_MEM_CAPS);
+    for (uint32_t i = 0; esp_video_isp_enum_format(&state, i, &pixel_format) == ESP_OK; i++) {
+        uint8_t out_bpp;
+        bool bypass_isp;
+        cam_ctlr_color_t out_color;
+        struct v4l2_format format = {
+            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .fmt.pix = {
+                .width = sensor_format->width,
+                .height = sensor_format->height,
+                .pixelformat = pixel_format,
+            },
+        };
+
+        if (csi_check_output_format(&state, &format, &out_color, &out_bpp, &bypass_isp) != ESP_OK) {
+            continue;
+        }
+
+        if (caps) {
+            struct esp_video_format_cap *cap = &caps[num];
+
+            cap->sensor_format = sensor_format;
+            cap->width = sensor_format->width;
+            cap->height = sensor_format->height;
+            cap->fps = sensor_format->fps;
+            cap->pixelformat = pixel_format;
+            cap->sizeimage = sensor_format->width * sensor_format->height * out_bpp / 8;
+            cap->link_kbps = sensor_format->mipi_info.mipi_clk / 1000 * lane_num;
+            cap->mem_kbps = (uint64_t)cap->sizeimage * 8 * cap->fps / 1000;
+            cap->flags = bypass_isp ? 0 : ESP_VIDEO_FORMAT_CAP_ISP;
+        }
+        num++;
+    }
+
+    return num;
+}
+
+/* Build the format capabilities once, format negotiation is then a table lookup */
+static esp_err_t csi_build_format_caps(struct csi_video *csi_video)
+{
+    uint32_t num = 0;
+    esp_cam_sensor_format_array_t modes = {0};
+
+    /* Sensors that cannot list their modes have no capabilities, S_FMT still works */
+    if (esp_cam_sensor_query_format(csi_video->cam.sensor, &modes) != ESP_OK || !modes.count) {
+        return ESP_OK;
+    }
+
+    for (uint32_t i = 0; i < modes.count; i++) {
+        num += csi_add_format_caps(&modes.format_array[i], NULL);
+    }
+    if (!num) {
+        return ESP_OK;
+    }
+
+    csi_video->caps = heap_caps_calloc(num, sizeof(struct esp_video_format_cap), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    ESP_RETURN_ON_FALSE(csi_video->caps, ESP_ERR_NO_MEM, TAG, "failed to allocate format capabilities");
+
+    for (uint32_t i = 0; i < modes.count; i++) {
+        csi_video->cap_num += csi_add_format_caps(&modes.format_array[i], &csi_video->caps[csi_video->cap_num]);
+    }
+    for (uint32_t i = 0; i < csi_video->cap_num; i++) {
+        csi_video->caps[i].index = i;
+    }
+
+    ESP_LOGD(TAG, "%" PRIu32 " format capabilities in %" PRIu32 " sensor modes", csi_video->cap_num, modes.count);
+    return ESP_OK;
+}
+
+static esp_err_t csi_video_enum_format_cap(struct esp_video *video, struct esp_video_format_cap *cap)
+{
+    esp_cam_sensor_format_t current;
+    const esp_cam_sensor_format_t *mode;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (cap->index >= csi_video->cap_num) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *cap = csi_video->caps[cap->index];
+
+    mode = cap->sensor_format;
+    if (esp_cam_sensor_get_format(csi_video->cam.sensor, &current) == ESP_OK &&
+            current.format == mode->format && current.width == mode->width && current.height == mode->height &&
+            current.fps == mode->fps && current.mipi_info.mipi_clk == mode->mipi_info.mipi_clk) {
+        cap->flags |= ESP_VIDEO_FORMAT_CAP_CURRENT;
+    }
 
     return ESP_OK;
 }
@@ -556,6 +1370,7 @@ static esp_err_t csi_video_notify(struct esp_video *video, enum esp_video_event
             if (ret == ESP_OK) {
                 element->valid_size = ret_size;
             }
+            ELEMENT_SET_CPU_WRITTEN(element);
         }
     }
 #endif
@@ -563,17 +1378,108 @@ static esp_err_t csi_video_notify(struct esp_video *video, enum esp_video_event
     return ret;
 }
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+/* Start a lens move in a vertical blank, right after a frame end, so that it spoils as few frames as possible */
+static void csi_video_wait_lens_vblank(struct csi_video *csi_video)
+{
+    xSemaphoreTake(csi_video->frame_end_sem, 0);
+    if (esp_timer_get_time() - csi_video->frame_end_us < CSI_LENS_VBLANK_US) {
+        return;
+    }
+
+    xSemaphoreTake(csi_video->frame_end_sem, pdMS_TO_TICKS(CSI_LENS_SYNC_TIMEOUT_MS));
+}
+
+/* Flag the frames read out from the start of the move until the lens settles */
+static void csi_video_track_lens_move(struct esp_video *video, int32_t pos)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    esp_cam_motor_format_t format;
+    int64_t start_us;
+    int64_t end_us;
+
+    if (esp_cam_motor_get_para_value(csi_video->cam.motor, ESP_CAM_MOTOR_MOVING_START_TIME,
+                                     &start_us, sizeof(start_us)) != ESP_OK) {
+        start_us = esp_timer_get_time();
+    }
+
+    end_us = start_us;
+    if (esp_cam_motor_get_format(csi_video->cam.motor, &format) == ESP_OK) {
+        uint32_t codes = csi_video->lens_pos >= 0 ? abs(pos - csi_video->lens_pos) : 0;
+        uint32_t steps = 1;
+
+        if (format.step_period.codes_per_step) {
+            steps = MAX((codes + format.step_period.codes_per_step - 1) / format.step_period.codes_per_step, 1);
+        }
+        end_us += (int64_t)steps * format.step_period.period_in_us;
+    }
+    csi_video->lens_pos = pos;
+
+    esp_video_set_lens_move(video, V4L2_BUF_TYPE_VIDEO_CAPTURE, start_us, end_us);
+}
+#endif
+
 static esp_err_t csi_video_set_ext_ctrl(struct esp_video *video, const struct v4l2_ext_controls *ctrls)
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    uint32_t delay = 0;
+
+    /* The synchronization mode is kept here for the next stream start, and set on its own */
+    if (ctrls->count == 1 && ctrls->controls[0].id == V4L2_CID_ESP_SENSOR_SYNC_MODE) {
+        uint32_t mode = ctrls->controls[0].value;
+
+        ESP_RETURN_ON_FALSE(mode <= ESP_VIDEO_SENSOR_SYNC_FOLLOWER, ESP_ERR_INVALID_ARG, TAG, "invalid sync mode");
+        ESP_RETURN_ON_FALSE(!csi_video->streaming, ESP_ERR_INVALID_STATE, TAG, "stream is on");
+        ESP_RETURN_ON_ERROR(esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_VIDEO_SENSOR_IOC_S_SYNC_MODE, &mode),
+                            TAG, "sensor does not support sync mode %" PRIu32, mode);
+        csi_video->sync_mode = mode;
+        return ESP_OK;
+    }
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    int32_t lens_pos = -1;
+
+    for (uint32_t i = 0; i < ctrls->count; i++) {
+        if (ctrls->controls[i].id == V4L2_CID_FOCUS_ABSOLUTE) {
+            lens_pos = ctrls->controls[i].value;
+        }
+    }
+    if (lens_pos >= 0 && csi_video->streaming && csi_video->frame_end_sem) {
+        csi_video_wait_lens_vblank(csi_video);
+    }
+#endif
 
-    return esp_video_cam_set_ext_ctrls(&csi_video->cam, ctrls);
+    ESP_RETURN_ON_ERROR(esp_video_cam_set_ext_ctrls(&csi_video->cam, ctrls), TAG, "failed to set sensor controls");
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    if (lens_pos >= 0 && csi_video->cam.motor) {
+        csi_video_track_lens_move(video, lens_pos);
+    }
+#endif
+
+    for (uint32_t i = 0; i < ctrls->count; i++) {
+        uint32_t id = ctrls->controls[i].id;
+
+        if (id == V4L2_CID_EXPOSURE || id == V4L2_CID_EXPOSURE_ABSOLUTE ||
+                id == V4L2_CID_GAIN || id == V4L2_CID_CAMERA_GROUP) {
+            esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY, &delay);
+            csi_video_track_sensor_settings(video, delay, NULL);
+            break;
+        }
+    }
+
+    return ESP_OK;
 }
 
 static esp_err_t csi_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ext_controls *ctrls)
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
 
+    if (ctrls->count == 1 && ctrls->controls[0].id == V4L2_CID_ESP_SENSOR_SYNC_MODE) {
+        ctrls->controls[0].value = csi_video->sync_mode;
+        return ESP_OK;
+    }
+
     return esp_video_cam_get_ext_ctrls(&csi_video->cam, ctrls);
 }
 
@@ -581,6 +1487,17 @@ static esp_err_t csi_video_query_ext_ctrl(struct esp_video *video, struct v4l2_q
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
 
+    if (qctrl->id == V4L2_CID_ESP_SENSOR_SYNC_MODE) {
+        qctrl->type = V4L2_CTRL_TYPE_MENU;
+        qctrl->maximum = ESP_VIDEO_SENSOR_SYNC_FOLLOWER;
+        qctrl->minimum = ESP_VIDEO_SENSOR_SYNC_MASTER;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = ESP_VIDEO_SENSOR_SYNC_MASTER;
+        return ESP_OK;
+    }
+
     return esp_video_cam_query_ext_ctrls(&csi_video->cam, qctrl);
 }
 
@@ -588,6 +1505,7 @@ static esp_err_t csi_video_set_sensor_format(struct esp_video *video, const esp_
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
 
+    esp_video_cam_flush_desc(&csi_video->cam);
     ESP_RETURN_ON_ERROR(esp_cam_sensor_set_format(csi_video->cam.sensor, format), TAG, "failed to set customer format");
     ESP_RETURN_ON_ERROR(init_config(video), TAG, "failed to initialize config");
 
@@ -601,9 +1519,23 @@ static esp_err_t csi_video_get_sensor_format(struct esp_video *video, esp_cam_se
     return esp_cam_sensor_get_format(csi_video->cam.sensor, format);
 }
 
+static esp_err_t csi_video_get_sensor_ctrl_delay(struct esp_video *video, uint32_t *frames)
+{
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    return esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY, frames);
+}
+
 static esp_err_t csi_video_query_menu(struct esp_video *video, struct v4l2_querymenu *qmenu)
 {
     struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+    static const char *const sync_mode_names[] = {"Master", "Leader", "Follower"};
+
+    if (qmenu->id == V4L2_CID_ESP_SENSOR_SYNC_MODE) {
+        ESP_RETURN_ON_FALSE(qmenu->index < ARRAY_SIZE(sync_mode_names), ESP_ERR_INVALID_ARG, TAG, "invalid menu index");
+        strlcpy((char *)qmenu->name, sync_mode_names[qmenu->index], sizeof(qmenu->name));
+        return ESP_OK;
+    }
 
     return esp_video_cam_query_menu(&csi_video->cam, qmenu);
 }
@@ -670,6 +1602,53 @@ static esp_err_t csi_video_set_parm(struct esp_video *video, struct v4l2_streamp
     return ret;
 }
 
+static esp_err_t csi_video_set_selection(struct esp_video *video, struct v4l2_selection *selection)
+{
+    esp_cam_sensor_format_t sensor_format;
+    struct v4l2_rect *rect = &selection->r;
+    struct csi_video *csi_video = VIDEO_PRIV_DATA(struct csi_video *, video);
+
+    if (selection->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (csi_video->streaming) {
+        ESP_LOGE(TAG, "MIPI-CSI should be stream off");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_RETURN_ON_ERROR(esp_cam_sensor_get_format(csi_video->cam.sensor, &sensor_format), TAG, "failed to get sensor format");
+
+    /* An empty rectangle selects the whole sensor format */
+    if (!rect->width || !rect->height) {
+        rect->left = 0;
+        rect->top = 0;
+        rect->width = sensor_format.width;
+        rect->height = sensor_format.height;
+    }
+
+    /* Round the window down to the alignment, this keeps the Bayer phase and whole RAW10 groups */
+    rect->left &= ~(CSI_CROP_H_ALIGN - 1);
+    rect->top &= ~(CSI_CROP_V_ALIGN - 1);
+    rect->width &= ~(CSI_CROP_H_ALIGN - 1);
+    rect->height &= ~(CSI_CROP_V_ALIGN - 1);
+    if ((rect->left < 0) || (rect->top < 0) || !rect->width || !rect->height ||
+            (rect->left + rect->width > sensor_format.width) ||
+            (rect->top + rect->height > sensor_format.height)) {
+        ESP_LOGE(TAG, "selection (%" PRIi32 ",%" PRIi32 ") %" PRIu32 "x%" PRIu32 " is out of the %ux%u sensor format",
+                 rect->left, rect->top, rect->width, rect->height, sensor_format.width, sensor_format.height);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_video_cam_flush_desc(&csi_video->cam);
+    ESP_RETURN_ON_ERROR(esp_cam_sensor_ioctl(csi_video->cam.sensor, ESP_VIDEO_SENSOR_IOC_S_WINDOW, rect),
+                        TAG, "sensor does not support readout window");
+
+    CAPTURE_VIDEO_SET_FORMAT(video, rect->width, rect->height, CAPTURE_VIDEO_GET_FORMAT_PIXEL_FORMAT(video));
+
+    return csi_set_buf_info(video, csi_video->state.out_bpp);
+}
+
 static const struct esp_video_ops s_csi_video_ops = {
     .init          = csi_video_init,
     .deinit        = csi_video_deinit,
@@ -683,11 +1662,17 @@ static const struct esp_video_ops s_csi_video_ops = {
     .query_ext_ctrl = csi_video_query_ext_ctrl,
     .set_sensor_format = csi_video_set_sensor_format,
     .get_sensor_format = csi_video_get_sensor_format,
+    .get_sensor_ctrl_delay = csi_video_get_sensor_ctrl_delay,
+    .enum_format_cap = csi_video_enum_format_cap,
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    .queue_capture_request = csi_video_queue_capture_request,
+#endif
     .query_menu    = csi_video_query_menu,
     .set_motor_format = csi_video_set_motor_format,
     .get_motor_format = csi_video_get_motor_format,
     .set_parm      = csi_video_set_parm,
     .get_parm      = csi_video_get_parm,
+    .set_selection = csi_video_set_selection,
 };
 
 /**
@@ -713,8 +1698,26 @@ esp_err_t esp_video_create_csi_video_device(esp_cam_sensor_device_t *sensor)
 
     csi_video->cam.sensor = sensor;
 
+    if (csi_build_format_caps(csi_video) != ESP_OK) {
+        heap_caps_free(csi_video);
+        return ESP_ERR_NO_MEM;
+    }
+
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    csi_video->req_queue = xQueueCreate(CSI_REQUEST_NUM, sizeof(struct esp_video_capture_request));
+    if (!csi_video->req_queue) {
+        heap_caps_free(csi_video->caps);
+        heap_caps_free(csi_video);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
     video = esp_video_create(CSI_NAME, ESP_VIDEO_MIPI_CSI_DEVICE_ID, &s_csi_video_ops, csi_video, caps, device_caps);
     if (!video) {
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+        vQueueDelete(csi_video->req_queue);
+#endif
+        heap_caps_free(csi_video->caps);
         heap_caps_free(csi_video);
         return ESP_FAIL;
     }
@@ -747,6 +1750,14 @@ esp_err_t esp_video_csi_video_device_add_motor(esp_cam_motor_device_t *motor_dev
         return ESP_ERR_INVALID_STATE;
     }
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    csi_video->frame_end_sem = xSemaphoreCreateBinary();
+    if (!csi_video->frame_end_sem) {
+        return ESP_ERR_NO_MEM;
+    }
+    csi_video->lens_pos = -1;
+#endif
+
     csi_video->cam.motor = motor_dev;
 
     return ESP_OK;
@@ -779,6 +1790,15 @@ esp_err_t esp_video_destroy_csi_video_device(void)
         return ret;
     }
 
+#if CONFIG_ESP_VIDEO_MIPI_CSI_LENS_MOVE_SYNC
+    if (csi_video->frame_end_sem) {
+        vSemaphoreDelete(csi_video->frame_end_sem);
+    }
+#endif
+#if CONFIG_ESP_VIDEO_MIPI_CSI_CAPTURE_REQUESTS
+    vQueueDelete(csi_video->req_queue);
+#endif
+    heap_caps_free(csi_video->caps);
     heap_caps_free(csi_video);
 
     return ESP_OK;
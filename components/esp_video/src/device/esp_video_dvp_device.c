@@ -15,6 +15,7 @@
 #include "esp_video.h"
 #include "esp_video_cam.h"
 #include "esp_video_device_internal.h"
+#include "esp_video_trace.h"
 #if CONFIG_ESP_VIDEO_ENABLE_SWAP_BYTE
 #include "esp_video_swap_byte.h"
 #endif
@@ -115,6 +116,8 @@ static bool IRAM_ATTR dvp_video_on_trans_finished(esp_cam_ctlr_handle_t handle,
 
     ESP_EARLY_LOGD(TAG, "size=%d", (int)trans->received_size);
 
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_END);
+
     CAPTURE_VIDEO_DONE_BUF(video, trans->buffer, trans->received_size);
 
     return true;
@@ -136,6 +139,8 @@ static bool IRAM_ATTR dvp_video_on_get_new_trans(esp_cam_ctlr_handle_t handle, e
     }
 #endif
 
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_START);
+
     element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
     if (!element) {
         return false;
@@ -193,6 +198,7 @@ static esp_err_t dvp_video_init(struct esp_video *video)
 {
     struct dvp_video *dvp_video = VIDEO_PRIV_DATA(struct dvp_video *, video);
 
+    esp_video_cam_flush_desc(&dvp_video->cam);
     ESP_RETURN_ON_ERROR(esp_cam_sensor_set_format(dvp_video->cam.sensor, NULL), TAG, "failed to set basic format");
     ESP_RETURN_ON_ERROR(init_config(video), TAG, "failed to initialize config");
 
@@ -394,6 +400,7 @@ static esp_err_t dvp_video_notify(struct esp_video *video, enum esp_video_event
             if (ret == ESP_OK) {
                 element->valid_size = ret_size;
             }
+            ELEMENT_SET_CPU_WRITTEN(element);
         }
     }
 #endif
@@ -426,6 +433,7 @@ static esp_err_t dvp_video_set_sensor_format(struct esp_video *video, const esp_
 {
     struct dvp_video *dvp_video = VIDEO_PRIV_DATA(struct dvp_video *, video);
 
+    esp_video_cam_flush_desc(&dvp_video->cam);
     ESP_RETURN_ON_ERROR(esp_cam_sensor_set_format(dvp_video->cam.sensor, format), TAG, "failed to set customer format");
     ESP_RETURN_ON_ERROR(init_config(video), TAG, "failed to initialize config");
 
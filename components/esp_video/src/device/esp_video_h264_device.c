@@ -6,10 +6,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <sys/param.h>
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_check.h"
 #include "esp_attr.h"
+#include "esp_cache.h"
 #include "esp_private/esp_cache_private.h"
 #include "esp_h264_enc_single_hw.h"
 #include "esp_h264_enc_single_sw.h"
@@ -30,6 +33,16 @@
 #define H264_VIDEO_DEVICE_MIN_QP    25
 #define H264_VIDEO_DEVICE_MAX_QP    26
 #define H264_VIDEO_DEVICE_BITRATE   10000000
+#define H264_VIDEO_DEVICE_FPS       30
+
+#if CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+/* Low resolution and frame rate profile of the software encoder */
+#define H264_SW_VIDEO_DEVICE_FPS        CONFIG_ESP_VIDEO_SW_H264_DEFAULT_FPS
+#define H264_SW_VIDEO_DEVICE_GOP        MIN(H264_SW_VIDEO_DEVICE_FPS * 2, H264_VIDEO_MAX_I_PERIOD)
+#define H264_SW_VIDEO_DEVICE_BITRATE    256000
+#define H264_SW_VIDEO_MAX_WIDTH         CONFIG_ESP_VIDEO_SW_H264_MAX_WIDTH
+#define H264_SW_VIDEO_MAX_HEIGHT        CONFIG_ESP_VIDEO_SW_H264_MAX_HEIGHT
+#endif
 
 #define H264_VIDEO_MAX_I_PERIOD     120
 #define H264_VIDEO_MIN_I_PERIOD     1
@@ -43,9 +56,18 @@
 #define H264_VIDEO_MIN_QP           0
 #define H264_VIDEO_QP_STEP          1
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(x)   sizeof(x) / sizeof((x)[0])
-#endif
+/* Changes made while streaming, applied by the M2M task before the next frame */
+#define H264_PENDING_PARAM          (1 << 0)    /*!< Bitrate, GOP or frame rate, set on the running encoder */
+#define H264_PENDING_RESTART        (1 << 1)    /*!< QP range, the encoder is created again */
+#define H264_PENDING_KEY_FRAME      (1 << 2)    /*!< IDR frame, a new encoder starts with SPS, PPS and IDR */
+
+#define H264_PARAM_SETS_SIZE        128         /* SPS and PPS of the hardware encoder take about 30 bytes */
+
+#define H264_NAL_TYPE(b)            ((b) & 0x1f)
+#define H264_NAL_SLICE              1
+#define H264_NAL_IDR                5
+#define H264_NAL_SPS                7
+#define H264_NAL_PPS                8
 
 struct h264_video {
     bool hw_codec;
@@ -55,7 +77,14 @@ struct h264_video {
     uint8_t min_qp;
     uint8_t max_qp;
     uint32_t bitrate;
+    uint8_t fps;
     esp_h264_enc_handle_t enc_handle;
+    atomic_uint_least32_t pending;      /*!< H264_PENDING_XXX */
+
+    bool repeat_seq_header;             /*!< Put the cached SPS and PPS in front of IDR frames without them */
+    portMUX_TYPE param_sets_lock;
+    uint32_t param_sets_size;
+    uint8_t param_sets[H264_PARAM_SETS_SIZE];   /*!< Annex-B SPS and PPS of the last key frame */
 };
 
 static const char *TAG = "h.264_video";
@@ -80,10 +109,21 @@ static esp_err_t errno_h264_to_std(esp_h264_err_t h264_err)
     }
 }
 
-static esp_err_t h264_get_input_format_from_v4l2(uint32_t v4l2_format, esp_h264_raw_format_t *input_format, uint8_t *input_bpp)
+static esp_err_t h264_get_input_format_from_v4l2(bool hw_codec, uint32_t v4l2_format, esp_h264_raw_format_t *input_format, uint8_t *input_bpp)
 {
     esp_err_t ret = ESP_OK;
 
+    if (!hw_codec) {
+        /* The software encoder takes packed YUYV, the ISP/DVP output of chips without H.264 codec */
+        if (v4l2_format != V4L2_PIX_FMT_YUV422P) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        *input_format = ESP_H264_RAW_FMT_YUYV;
+        *input_bpp = 16;
+        return ESP_OK;
+    }
+
     switch (v4l2_format) {
     case V4L2_PIX_FMT_YUV420:
         *input_format = ESP_H264_RAW_FMT_O_UYY_E_VYY;
@@ -97,6 +137,261 @@ static esp_err_t h264_get_input_format_from_v4l2(uint32_t v4l2_format, esp_h264_
     return ret;
 }
 
+static esp_err_t h264_encoder_open(struct esp_video *video)
+{
+    esp_h264_err_t h264_err = ESP_H264_ERR_UNSUPPORTED;
+    struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
+    esp_h264_enc_cfg_hw_t config = {
+        .pic_type = h264_video->input_format,
+        .gop = h264_video->gop,
+        .fps = h264_video->fps,
+        .res = {
+            .width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video),
+            .height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video),
+        },
+        .rc = {
+            .bitrate = h264_video->bitrate,
+            .qp_min = h264_video->min_qp,
+            .qp_max = h264_video->max_qp,
+        }
+    };
+
+    if (h264_video->hw_codec) {
+        h264_err = esp_h264_enc_hw_new(&config, &h264_video->enc_handle);
+    } else {
+#if CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+        esp_h264_enc_cfg_sw_t sw_config = {
+            .pic_type = config.pic_type,
+            .gop = config.gop,
+            .fps = config.fps,
+            .res = {
+                .width = config.res.width,
+                .height = config.res.height,
+            },
+            .rc = {
+                .bitrate = config.rc.bitrate,
+                .qp_min = config.rc.qp_min,
+                .qp_max = config.rc.qp_max,
+            }
+        };
+
+        h264_err = esp_h264_enc_sw_new(&sw_config, &h264_video->enc_handle);
+#else
+        h264_err = ESP_H264_ERR_UNSUPPORTED;
+#endif
+    }
+
+    if (h264_err != ESP_H264_ERR_OK) {
+        ESP_LOGE(TAG, "failed to create H.264 encoder");
+        return errno_h264_to_std(h264_err);
+    }
+
+    h264_err = esp_h264_enc_open(h264_video->enc_handle);
+    if (h264_err != ESP_H264_ERR_OK) {
+        esp_h264_enc_del(h264_video->enc_handle);
+        h264_video->enc_handle = NULL;
+
+        ESP_LOGE(TAG, "failed to open H.264 encoder");
+        return errno_h264_to_std(h264_err);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t h264_encoder_close(struct h264_video *h264_video)
+{
+    esp_h264_err_t h264_err;
+
+    if (!h264_video->enc_handle) {
+        return ESP_OK;
+    }
+
+    h264_err = esp_h264_enc_close(h264_video->enc_handle);
+    if (h264_err != ESP_H264_ERR_OK) {
+        ESP_LOGE(TAG, "failed to close H.264 encoder");
+        return errno_h264_to_std(h264_err);
+    }
+
+    h264_err = esp_h264_enc_del(h264_video->enc_handle);
+    if (h264_err != ESP_H264_ERR_OK) {
+        ESP_LOGE(TAG, "failed to delete H.264 encoder");
+        return errno_h264_to_std(h264_err);
+    }
+    h264_video->enc_handle = NULL;
+
+    return ESP_OK;
+}
+
+static esp_h264_err_t h264_encoder_set_param(struct h264_video *h264_video)
+{
+    esp_h264_err_t h264_err;
+    esp_h264_enc_param_handle_t param = NULL;
+
+    if (h264_video->hw_codec) {
+        esp_h264_enc_param_hw_handle_t param_hd = NULL;
+
+        h264_err = esp_h264_enc_hw_get_param_hd(h264_video->enc_handle, &param_hd);
+        if (h264_err == ESP_H264_ERR_OK) {
+            param = &param_hd->base;
+        }
+    } else {
+#if CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+        esp_h264_enc_param_sw_handle_t param_hd = NULL;
+
+        h264_err = esp_h264_enc_sw_get_param_hd(h264_video->enc_handle, &param_hd);
+        if (h264_err == ESP_H264_ERR_OK) {
+            param = &param_hd->base;
+        }
+#else
+        h264_err = ESP_H264_ERR_UNSUPPORTED;
+#endif
+    }
+
+    if (h264_err == ESP_H264_ERR_OK) {
+        h264_err = esp_h264_enc_set_bitrate(param, h264_video->bitrate);
+    }
+    if (h264_err == ESP_H264_ERR_OK) {
+        h264_err = esp_h264_enc_set_gop(param, h264_video->gop);
+    }
+    if (h264_err == ESP_H264_ERR_OK) {
+        h264_err = esp_h264_enc_set_fps(param, h264_video->fps);
+    }
+
+    return h264_err;
+}
+
+/**
+ * @brief Apply the controls changed while streaming, between two frames
+ *
+ * The encoder has no setter for the QP range and no way to force an IDR
+ * frame, so both create the encoder again. A new encoder starts with SPS,
+ * PPS and an IDR frame, which costs one intra frame, not a stream restart.
+ */
+static esp_err_t h264_apply_pending(struct esp_video *video)
+{
+    esp_err_t ret;
+    struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
+    uint32_t pending = atomic_exchange(&h264_video->pending, 0);
+
+    if (!h264_video->enc_handle) {
+        pending |= H264_PENDING_RESTART;
+    }
+
+    if ((pending & H264_PENDING_PARAM) && !(pending & (H264_PENDING_RESTART | H264_PENDING_KEY_FRAME))) {
+        if (h264_encoder_set_param(h264_video) == ESP_H264_ERR_OK) {
+            ESP_LOGD(TAG, "bitrate=%" PRIu32 " gop=%u fps=%u", h264_video->bitrate, h264_video->gop, h264_video->fps);
+            return ESP_OK;
+        }
+
+        ESP_LOGW(TAG, "failed to set encoder parameters, creating the encoder again");
+        pending |= H264_PENDING_RESTART;
+    }
+
+    if (pending & (H264_PENDING_RESTART | H264_PENDING_KEY_FRAME)) {
+        ESP_RETURN_ON_ERROR(h264_encoder_close(h264_video), TAG, "failed to close encoder");
+        ret = h264_encoder_open(video);
+        if (ret != ESP_OK) {
+            /* Try again before the next frame */
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_RESTART);
+            return ret;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/* Find the next Annex-B start code from p, returns the NAL unit after it or NULL */
+static uint8_t *h264_next_nal(uint8_t *p, uint8_t *end, uint8_t **start_code)
+{
+    for (; p + 3 <= end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            *start_code = p;
+            return p + 3;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Cache the SPS and PPS in front of the first slice of an access unit
+ *
+ * Only the NAL units before the first slice are scanned, never the slice data.
+ *
+ * @return Type of the first slice NAL unit, 0 if there is none
+ */
+static uint8_t h264_cache_param_sets(struct h264_video *h264_video, uint8_t *data, uint32_t size, bool *has_sps)
+{
+    uint8_t *end = data + size;
+    uint8_t *start_code;
+    uint8_t *nal = h264_next_nal(data, end, &start_code);
+    uint8_t sets[H264_PARAM_SETS_SIZE];
+    uint32_t sets_size = 0;
+    bool fits = true;
+
+    *has_sps = false;
+    while (nal && nal < end) {
+        uint8_t type = H264_NAL_TYPE(nal[0]);
+        uint8_t *next;
+        uint8_t *nal_end = end;
+
+        if (type == H264_NAL_SLICE || type == H264_NAL_IDR) {
+            if (*has_sps && fits) {
+                portENTER_CRITICAL(&h264_video->param_sets_lock);
+                memcpy(h264_video->param_sets, sets, sets_size);
+                h264_video->param_sets_size = sets_size;
+                portEXIT_CRITICAL(&h264_video->param_sets_lock);
+            }
+
+            return type;
+        }
+
+        next = h264_next_nal(nal, end, &nal_end);
+        if (type == H264_NAL_SPS || type == H264_NAL_PPS) {
+            /* Trailing zero bytes and a 4-byte start code belong to no NAL unit */
+            while (nal_end > nal && !nal_end[-1]) {
+                nal_end--;
+            }
+
+            if (sets_size + 4 + (nal_end - nal) <= sizeof(sets)) {
+                static const uint8_t start[4] = {0, 0, 0, 1};
+
+                memcpy(&sets[sets_size], start, sizeof(start));
+                memcpy(&sets[sets_size + sizeof(start)], nal, nal_end - nal);
+                sets_size += sizeof(start) + (nal_end - nal);
+            } else {
+                fits = false;
+            }
+            *has_sps |= type == H264_NAL_SPS;
+        }
+        nal = next;
+    }
+
+    return 0;
+}
+
+static uint32_t h264_prepend_param_sets(struct h264_video *h264_video, uint8_t *dst, uint32_t size, uint32_t dst_size)
+{
+    uint8_t sets[H264_PARAM_SETS_SIZE];
+    uint32_t sets_size;
+
+    portENTER_CRITICAL(&h264_video->param_sets_lock);
+    sets_size = h264_video->param_sets_size;
+    memcpy(sets, h264_video->param_sets, sets_size);
+    portEXIT_CRITICAL(&h264_video->param_sets_lock);
+
+    if (!sets_size || size + sets_size > dst_size) {
+        return size;
+    }
+
+    memmove(dst + sets_size, dst, size);
+    memcpy(dst, sets, sets_size);
+    /* The buffer was written by the encoder DMA, a DMA reading it next must see the CPU writes */
+    esp_cache_msync(dst, size + sets_size, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_UNALIGNED);
+
+    return size + sets_size;
+}
+
 static esp_err_t h264_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
 {
     esp_h264_err_t h264_err;
@@ -114,9 +409,21 @@ static esp_err_t h264_video_m2m_process(struct esp_video *video, uint8_t *src, u
     };
     struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
 
+    if (atomic_load(&h264_video->pending) || !h264_video->enc_handle) {
+        ESP_RETURN_ON_ERROR(h264_apply_pending(video), TAG, "failed to apply H.264 controls");
+    }
+
     h264_err = esp_h264_enc_process(h264_video->enc_handle, &in_frame, &out_frame);
     if (h264_err == ESP_H264_ERR_OK) {
-        *dst_out_size = out_frame.length;
+        bool has_sps;
+        uint32_t size = out_frame.length;
+
+        if (h264_cache_param_sets(h264_video, dst, size, &has_sps) == H264_NAL_IDR && !has_sps &&
+                h264_video->repeat_seq_header) {
+            size = h264_prepend_param_sets(h264_video, dst, size, dst_size);
+        }
+
+        *dst_out_size = size;
     }
 
     return errno_h264_to_std(h264_err);
@@ -137,7 +444,6 @@ static esp_err_t h264_video_deinit(struct esp_video *video)
 
 static esp_err_t h264_video_start(struct esp_video *video, uint32_t type)
 {
-    esp_h264_err_t h264_err = ESP_H264_ERR_UNSUPPORTED;
     struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
 
     if ((M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video) != M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video)) ||
@@ -147,40 +453,10 @@ static esp_err_t h264_video_start(struct esp_video *video, uint32_t type)
     }
 
     if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
-        esp_h264_enc_cfg_hw_t config = {
-            .pic_type = h264_video->input_format,
-            .gop = h264_video->gop,
-            .fps = h264_video->gop,
-            .res = {
-                .width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video),
-                .height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video),
-            },
-            .rc = {
-                .bitrate = h264_video->bitrate,
-                .qp_min = h264_video->min_qp,
-                .qp_max = h264_video->max_qp,
-            }
-        };
-
-        if (h264_video->hw_codec) {
-            h264_err = esp_h264_enc_hw_new(&config, &h264_video->enc_handle);
-        } else {
-            h264_err = ESP_H264_ERR_UNSUPPORTED;
-        }
-
-        if (h264_err != ESP_H264_ERR_OK) {
-            ESP_LOGE(TAG, "failed to create H.264 encoder");
-            return errno_h264_to_std(h264_err);
-        }
-
-        h264_err = esp_h264_enc_open(h264_video->enc_handle);
-        if (h264_err != ESP_H264_ERR_OK) {
-            esp_h264_enc_del(h264_video->enc_handle);
-            h264_video->enc_handle = NULL;
-
-            ESP_LOGE(TAG, "failed to open H.264 encoder");
-            return errno_h264_to_std(h264_err);
-        }
+        /* The new encoder takes every control as it is now, and the resolution may have changed */
+        atomic_store(&h264_video->pending, 0);
+        h264_video->param_sets_size = 0;
+        ESP_RETURN_ON_ERROR(h264_encoder_open(video), TAG, "failed to open encoder");
     }
 
     return ESP_OK;
@@ -188,22 +464,10 @@ static esp_err_t h264_video_start(struct esp_video *video, uint32_t type)
 
 static esp_err_t h264_video_stop(struct esp_video *video, uint32_t type)
 {
-    esp_h264_err_t h264_err;
     struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
 
     if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
-        h264_err = esp_h264_enc_close(h264_video->enc_handle);
-        if (h264_err != ESP_H264_ERR_OK) {
-            ESP_LOGE(TAG, "failed to close H.264 encoder");
-            return errno_h264_to_std(h264_err);
-        }
-
-        h264_err = esp_h264_enc_del(h264_video->enc_handle);
-        if (h264_err != ESP_H264_ERR_OK) {
-            ESP_LOGE(TAG, "failed to delete H.264 encoder");
-            return errno_h264_to_std(h264_err);
-        }
-        h264_video->enc_handle = NULL;
+        return h264_encoder_close(h264_video);
     }
 
     return ESP_OK;
@@ -225,6 +489,16 @@ static esp_err_t h264_video_enum_format(struct esp_video *video, uint32_t type,
         static const uint32_t h264_output_format[] = {
             V4L2_PIX_FMT_YUV420,
         };
+        struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
+
+        if (!h264_video->hw_codec) {
+            if (index) {
+                return ESP_ERR_INVALID_ARG;
+            }
+
+            *pixel_format = V4L2_PIX_FMT_YUV422P;
+            return ESP_OK;
+        }
 
         if (index >= ARRAY_SIZE(h264_output_format)) {
             return ESP_ERR_INVALID_ARG;
@@ -252,6 +526,14 @@ static esp_err_t h264_video_set_format(struct esp_video *video, const struct v4l
 #endif
     ESP_LOGD(TAG, "alignments=%zu", alignments);
 
+#if CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+    if (!h264_video->hw_codec && (pix->width > H264_SW_VIDEO_MAX_WIDTH || pix->height > H264_SW_VIDEO_MAX_HEIGHT)) {
+        ESP_LOGE(TAG, "%" PRIu32 "x%" PRIu32 " exceeds the software encoder limit of %dx%d",
+                 pix->width, pix->height, H264_SW_VIDEO_MAX_WIDTH, H264_SW_VIDEO_MAX_HEIGHT);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+
     if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
         uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
         uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
@@ -280,7 +562,7 @@ static esp_err_t h264_video_set_format(struct esp_video *video, const struct v4l
             return ESP_ERR_INVALID_ARG;
         }
 
-        ret = h264_get_input_format_from_v4l2(pix->pixelformat, &h264_video->input_format, &input_bpp);
+        ret = h264_get_input_format_from_v4l2(h264_video->hw_codec, pix->pixelformat, &h264_video->input_format, &input_bpp);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "pixel format is invalid");
             return ret;
@@ -332,15 +614,25 @@ static esp_err_t h264_video_set_ext_ctrl(struct esp_video *video, const struct v
         switch (ctrl->id) {
         case V4L2_CID_MPEG_VIDEO_H264_I_PERIOD:
             h264_video->gop = ctrl->value;
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_PARAM);
             break;
         case V4L2_CID_MPEG_VIDEO_BITRATE:
             h264_video->bitrate = ctrl->value;
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_PARAM);
             break;
         case V4L2_CID_MPEG_VIDEO_H264_MIN_QP:
             h264_video->min_qp = ctrl->value;
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_RESTART);
             break;
         case V4L2_CID_MPEG_VIDEO_H264_MAX_QP:
             h264_video->max_qp = ctrl->value;
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_RESTART);
+            break;
+        case V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME:
+            atomic_fetch_or(&h264_video->pending, H264_PENDING_KEY_FRAME);
+            break;
+        case V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER:
+            h264_video->repeat_seq_header = !!ctrl->value;
             break;
         default:
             ret = ESP_ERR_NOT_SUPPORTED;
@@ -373,6 +665,27 @@ static esp_err_t h264_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ex
         case V4L2_CID_MPEG_VIDEO_H264_MAX_QP:
             ctrl->value = h264_video->max_qp;
             break;
+        case V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER:
+            ctrl->value = h264_video->repeat_seq_header;
+            break;
+        case V4L2_CID_MPEG_VIDEO_H264_ESP_PARAM_SETS: {
+            uint32_t size;
+
+            portENTER_CRITICAL(&h264_video->param_sets_lock);
+            size = h264_video->param_sets_size;
+            if (size && ctrl->p_u8 && ctrl->size >= size) {
+                memcpy(ctrl->p_u8, h264_video->param_sets, size);
+            }
+            portEXIT_CRITICAL(&h264_video->param_sets_lock);
+
+            if (!size) {
+                ret = ESP_ERR_NOT_FOUND;
+            } else if (!ctrl->p_u8 || ctrl->size < size) {
+                ret = ESP_ERR_INVALID_SIZE;
+            }
+            ctrl->size = size;
+            break;
+        }
         default:
             ret = ESP_ERR_NOT_SUPPORTED;
             ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
@@ -432,6 +745,35 @@ static esp_err_t h264_video_query_ext_ctrl(struct esp_video *video, struct v4l2_
         qctrl->nr_of_dims = 0;
         qctrl->default_value = H264_VIDEO_DEVICE_MAX_QP;
         break;
+    case V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER:
+        qctrl->type = V4L2_CTRL_TYPE_BOOLEAN;
+        qctrl->maximum = 1;
+        qctrl->minimum = 0;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = 0;
+        break;
+    case V4L2_CID_MPEG_VIDEO_H264_ESP_PARAM_SETS:
+        qctrl->type = V4L2_CTRL_TYPE_U8;
+        qctrl->maximum = UINT8_MAX;
+        qctrl->minimum = 0;
+        qctrl->step = 1;
+        qctrl->elems = H264_PARAM_SETS_SIZE;
+        qctrl->nr_of_dims = 1;
+        qctrl->dims[0] = H264_PARAM_SETS_SIZE;
+        qctrl->default_value = 0;
+        qctrl->flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE;
+        break;
+    case V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME:
+        qctrl->type = V4L2_CTRL_TYPE_BUTTON;
+        qctrl->maximum = 0;
+        qctrl->minimum = 0;
+        qctrl->step = 0;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = 0;
+        break;
     default:
         ret = ESP_ERR_NOT_SUPPORTED;
         ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", qctrl->id);
@@ -441,6 +783,47 @@ static esp_err_t h264_video_query_ext_ctrl(struct esp_video *video, struct v4l2_
     return ret;
 }
 
+static struct v4l2_fract *h264_video_timeperframe(struct v4l2_streamparm *stream_parm)
+{
+    if (stream_parm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        stream_parm->parm.output.capability |= V4L2_CAP_TIMEPERFRAME;
+        return &stream_parm->parm.output.timeperframe;
+    }
+
+    stream_parm->parm.capture.capability |= V4L2_CAP_TIMEPERFRAME;
+    return &stream_parm->parm.capture.timeperframe;
+}
+
+/**
+ * @brief Set the frame rate the bitrate is spread over, the device can not measure it
+ */
+static esp_err_t h264_video_set_parm(struct esp_video *video, struct v4l2_streamparm *stream_parm, struct esp_video_stream *stream)
+{
+    struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
+    struct v4l2_fract *timeperframe = h264_video_timeperframe(stream_parm);
+
+    ESP_RETURN_ON_FALSE(timeperframe->numerator && timeperframe->denominator, ESP_ERR_INVALID_ARG, TAG,
+                        "frame interval is invalid");
+    h264_video->fps = MIN(MAX(timeperframe->denominator / timeperframe->numerator, 1), UINT8_MAX);
+    atomic_fetch_or(&h264_video->pending, H264_PENDING_PARAM);
+
+    timeperframe->numerator = 1;
+    timeperframe->denominator = h264_video->fps;
+
+    return ESP_OK;
+}
+
+static esp_err_t h264_video_get_parm(struct esp_video *video, struct v4l2_streamparm *stream_parm, struct esp_video_stream *stream)
+{
+    struct h264_video *h264_video = VIDEO_PRIV_DATA(struct h264_video *, video);
+    struct v4l2_fract *timeperframe = h264_video_timeperframe(stream_parm);
+
+    timeperframe->numerator = 1;
+    timeperframe->denominator = h264_video->fps;
+
+    return ESP_OK;
+}
+
 static const struct esp_video_ops s_h264_video_ops = {
     .init           = h264_video_init,
     .deinit         = h264_video_deinit,
@@ -452,12 +835,14 @@ static const struct esp_video_ops s_h264_video_ops = {
     .set_ext_ctrl   = h264_video_set_ext_ctrl,
     .get_ext_ctrl   = h264_video_get_ext_ctrl,
     .query_ext_ctrl = h264_video_query_ext_ctrl,
+    .set_parm       = h264_video_set_parm,
+    .get_parm       = h264_video_get_parm,
 };
 
 /**
  * @brief Create H.264 video device
  *
- * @param hw_codec true: hardware H.264, false: software H.264(has not supported)
+ * @param hw_codec true: hardware H.264, false: software H.264
  *
  * @return
  *      - ESP_OK on success
@@ -470,9 +855,11 @@ esp_err_t esp_video_create_h264_video_device(bool hw_codec)
     uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
     uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
 
+#if !CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
     if (hw_codec == false) {
         return ESP_ERR_NOT_SUPPORTED;
     }
+#endif
 
     h264_video = heap_caps_calloc(1, sizeof(struct h264_video), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
     if (!h264_video) {
@@ -484,6 +871,15 @@ esp_err_t esp_video_create_h264_video_device(bool hw_codec)
     h264_video->min_qp = H264_VIDEO_DEVICE_MIN_QP;
     h264_video->max_qp = H264_VIDEO_DEVICE_MAX_QP;
     h264_video->bitrate = H264_VIDEO_DEVICE_BITRATE;
+    h264_video->fps = H264_VIDEO_DEVICE_FPS;
+#if CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+    if (!hw_codec) {
+        h264_video->gop = H264_SW_VIDEO_DEVICE_GOP;
+        h264_video->bitrate = H264_SW_VIDEO_DEVICE_BITRATE;
+        h264_video->fps = H264_SW_VIDEO_DEVICE_FPS;
+    }
+#endif
+    h264_video->param_sets_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
 
     video = esp_video_create(H264_NAME, ESP_VIDEO_H264_DEVICE_ID, &s_h264_video_ops, h264_video, caps, device_caps);
     if (!video) {
@@ -497,7 +893,7 @@ esp_err_t esp_video_create_h264_video_device(bool hw_codec)
 /**
  * @brief Destroy H.264 video device
  *
- * @param hw_codec true: hardware H.264, false: software H.264(has not supported)
+ * @param hw_codec true: hardware H.264, false: software H.264
  *
  * @return
  *      - ESP_OK on success
@@ -509,9 +905,11 @@ esp_err_t esp_video_destroy_h264_video_device(bool hw_codec)
     struct esp_video *video;
     struct h264_video *h264_video;
 
+#if !CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
     if (hw_codec == false) {
         return ESP_ERR_NOT_SUPPORTED;
     }
+#endif
 
     video = esp_video_device_get_object(H264_NAME);
     if (!video) {
@@ -0,0 +1,539 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * HDR merge video device
+ *
+ * Merges the two exposures of a DOL-HDR sensor mode into one linear frame. The
+ * input is a MIPI packed RAW10 Bayer frame whose rows alternate between the long
+ * and the short exposure of the same sensor row, long first, so it has twice
+ * the rows of the output. The output is one little endian 16-bit word per pixel:
+ *
+ *   l = max(long - black_level, 0)
+ *   s = max(short - black_level, 0)
+ *   out = l < knee ? l : s * ratio
+ *
+ * The result is in long exposure units, a 10-bit sensor at a 64x ratio still
+ * fits. Both exposures are integrated within the same frame, so nothing moves
+ * between them the way it does between bracketed frames.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_private/esp_cache_private.h"
+
+#include "esp_video.h"
+#include "esp_video_ioctl.h"
+#include "esp_video_device_internal.h"
+
+#define HDR_MERGE_NAME                  "HDR_MERGE"
+
+#if CONFIG_SPIRAM
+#define HDR_MERGE_MEM_CAPS              (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define HDR_MERGE_MEM_CAPS              (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
+#endif
+
+#define HDR_MERGE_PIE_ALIGN             16      /* Size of a PIE register */
+#define HDR_MERGE_PIE_LANES             (HDR_MERGE_PIE_ALIGN / sizeof(uint16_t))
+
+#define HDR_MERGE_RATIO_SHIFT           4       /* V4L2_CID_ESP_HDR_RATIO is in 1/16 steps */
+#define HDR_MERGE_RATIO_MIN             (1 << HDR_MERGE_RATIO_SHIFT)
+#define HDR_MERGE_RATIO_MAX             (64 << HDR_MERGE_RATIO_SHIFT)
+#define HDR_MERGE_RATIO_DEFAULT         (16 << HDR_MERGE_RATIO_SHIFT)
+#define HDR_MERGE_PIXEL_MAX             1023    /* RAW10 */
+#define HDR_MERGE_KNEE_DEFAULT          896
+
+enum {
+    HDR_MERGE_PARAM_BLACK,
+    HDR_MERGE_PARAM_KNEE,               /* knee - 1, the PIE compare is "greater than" */
+    HDR_MERGE_PARAM_LIMIT,              /* Largest short exposure whose scaled value fits 16 bits */
+    HDR_MERGE_PARAM_RATIO,
+    HDR_MERGE_PARAM_NUM,
+};
+
+struct hdr_merge_video {
+    /* Merge parameters, each repeated in all PIE lanes */
+    uint16_t params[HDR_MERGE_PARAM_NUM][HDR_MERGE_PIE_LANES] __attribute__((aligned(HDR_MERGE_PIE_ALIGN)));
+    uint16_t *rows;                     /* Unpacked long exposure row, then the short one */
+    uint32_t row_stride;                /* Pixels from the long to the short row, a whole number of lanes */
+    uint32_t ratio;
+    uint32_t knee;
+    uint32_t black_level;
+    uint32_t frames;
+};
+
+static const char *TAG = "hdr_merge_video";
+
+#if CONFIG_ESP_VIDEO_HDR_MERGE_PIE
+extern void esp_video_hdr_merge_pie(const uint16_t *long_row, const uint16_t *short_row, uint16_t *dst,
+                                    size_t size, const uint16_t *params);
+#endif
+
+static const uint32_t s_hdr_merge_output_format[] = {
+    V4L2_PIX_FMT_SBGGR10,
+    V4L2_PIX_FMT_SGBRG10,
+    V4L2_PIX_FMT_SGRBG10,
+    V4L2_PIX_FMT_SRGGB10,
+};
+
+static const uint32_t s_hdr_merge_capture_format[] = {
+    V4L2_PIX_FMT_SBGGR16,
+    V4L2_PIX_FMT_SGBRG16,
+    V4L2_PIX_FMT_SGRBG16,
+    V4L2_PIX_FMT_SRGGB16,
+};
+
+/* 16-bit capture format of the same Bayer order as a RAW10 output format, 0 if there is none */
+static uint32_t hdr_merge_capture_format(uint32_t output_format)
+{
+    for (int i = 0; i < ARRAY_SIZE(s_hdr_merge_output_format); i++) {
+        if (s_hdr_merge_output_format[i] == output_format) {
+            return s_hdr_merge_capture_format[i];
+        }
+    }
+
+    return 0;
+}
+
+static void hdr_merge_update_params(struct hdr_merge_video *hdr_merge_video)
+{
+    uint32_t limit = MIN((UINT16_MAX << HDR_MERGE_RATIO_SHIFT) / hdr_merge_video->ratio, UINT16_MAX);
+
+    for (int i = 0; i < HDR_MERGE_PIE_LANES; i++) {
+        hdr_merge_video->params[HDR_MERGE_PARAM_BLACK][i] = hdr_merge_video->black_level;
+        hdr_merge_video->params[HDR_MERGE_PARAM_KNEE][i] = hdr_merge_video->knee - 1;
+        hdr_merge_video->params[HDR_MERGE_PARAM_LIMIT][i] = limit;
+        hdr_merge_video->params[HDR_MERGE_PARAM_RATIO][i] = hdr_merge_video->ratio;
+    }
+}
+
+static void hdr_merge_unpack_row(const uint8_t *src, uint16_t *row, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, src += 5) {
+        uint8_t lsb = src[4];
+
+        row[x + 0] = (src[0] << 2) | ((lsb >> 0) & 0x3);
+        row[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+        row[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+        row[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+    }
+}
+
+/* Merge one row, the C loop gives the same result as the PIE one */
+static void hdr_merge_row(const struct hdr_merge_video *hdr_merge_video, const uint16_t *long_row,
+                          const uint16_t *short_row, uint16_t *dst, uint32_t width)
+{
+    uint32_t black = hdr_merge_video->black_level;
+    uint32_t limit = hdr_merge_video->params[HDR_MERGE_PARAM_LIMIT][0];
+    uint32_t done = 0;
+
+#if CONFIG_ESP_VIDEO_HDR_MERGE_PIE
+    /* The unpacked rows are aligned, a capture row is if the width is a whole number of lanes */
+    if (!((uintptr_t)dst & (HDR_MERGE_PIE_ALIGN - 1))) {
+        done = width & ~(HDR_MERGE_PIE_LANES - 1);
+        if (done) {
+            esp_video_hdr_merge_pie(long_row, short_row, dst, done * sizeof(uint16_t), hdr_merge_video->params[0]);
+        }
+    }
+#endif
+
+    for (uint32_t x = done; x < width; x++) {
+        uint32_t l = long_row[x] > black ? long_row[x] - black : 0;
+        uint32_t s = short_row[x] > black ? short_row[x] - black : 0;
+
+        dst[x] = l < hdr_merge_video->knee ? l : (MIN(s, limit) * hdr_merge_video->ratio) >> HDR_MERGE_RATIO_SHIFT;
+    }
+}
+
+static esp_err_t hdr_merge_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
+{
+    struct hdr_merge_video *hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+    uint32_t width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+    uint32_t height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+    uint32_t line_size = RAW10_PACKED_LINE_SIZE(width);
+    uint16_t *long_row = hdr_merge_video->rows;
+    uint16_t *short_row = hdr_merge_video->rows + hdr_merge_video->row_stride;
+    uint16_t *out = (uint16_t *)dst;
+
+    if (src_size < line_size * height * 2 || dst_size < width * height * sizeof(uint16_t)) {
+        ESP_LOGE(TAG, "buffer is too small");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        hdr_merge_unpack_row(src, long_row, width);
+        hdr_merge_unpack_row(src + line_size, short_row, width);
+        hdr_merge_row(hdr_merge_video, long_row, short_row, out, width);
+
+        src += line_size * 2;
+        out += width;
+    }
+
+    *dst_out_size = width * height * sizeof(uint16_t);
+
+    hdr_merge_video->frames++;
+    ESP_LOGD(TAG, "frame %" PRIu32 " merged", hdr_merge_video->frames);
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_init(struct esp_video *video)
+{
+    M2M_VIDEO_SET_CAPTURE_FORMAT(video, 0, 0, 0);
+    M2M_VIDEO_SET_OUTPUT_FORMAT(video, 0, 0, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_deinit(struct esp_video *video)
+{
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_start(struct esp_video *video, uint32_t type)
+{
+    struct hdr_merge_video *hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+    uint32_t width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+
+    if ((width != M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video)) ||
+            (M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video) * 2 != M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video))) {
+        ESP_LOGE(TAG, "width or height is invalid");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE && !hdr_merge_video->rows) {
+        /* Both rows are read right after they are unpacked, keep them in internal RAM */
+        hdr_merge_video->row_stride = ESP_VIDEO_ALIGN(width, HDR_MERGE_PIE_LANES);
+        hdr_merge_video->rows = heap_caps_aligned_alloc(HDR_MERGE_PIE_ALIGN,
+                                                        hdr_merge_video->row_stride * 2 * sizeof(uint16_t),
+                                                        MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        if (!hdr_merge_video->rows) {
+            ESP_LOGE(TAG, "failed to allocate row buffers");
+            return ESP_ERR_NO_MEM;
+        }
+        VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, hdr_merge_video->rows, hdr_merge_video->row_stride * 2 * sizeof(uint16_t));
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_stop(struct esp_video *video, uint32_t type)
+{
+    struct hdr_merge_video *hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, hdr_merge_video->rows, hdr_merge_video->row_stride * 2 * sizeof(uint16_t));
+        heap_caps_free(hdr_merge_video->rows);
+        hdr_merge_video->rows = NULL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        if (index >= ARRAY_SIZE(s_hdr_merge_capture_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = s_hdr_merge_capture_format[index];
+    } else if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        if (index >= ARRAY_SIZE(s_hdr_merge_output_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = s_hdr_merge_output_format[index];
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+
+    size_t alignments = 0;
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(HDR_MERGE_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+    ESP_LOGD(TAG, "alignments=%zu", alignments);
+
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+        uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video) / 2;
+
+        if (!width || !height) {
+            ESP_LOGE(TAG, "output buffer format should be set firstly");
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        /* Each output row pair makes one capture row */
+        if ((pix->pixelformat != hdr_merge_capture_format(M2M_VIDEO_GET_OUTPUT_FORMAT_PIXEL_FORMAT(video))) ||
+                (pix->width != width) || (pix->height != height)) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t buf_size = ESP_VIDEO_ALIGN(width * height * sizeof(uint16_t), alignments);
+
+        ESP_LOGD(TAG, "capture buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_CAPTURE_FORMAT(video, width, height, pix->pixelformat);
+        M2M_VIDEO_SET_CAPTURE_BUF_INFO(video, buf_size, alignments, HDR_MERGE_MEM_CAPS);
+    } else if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        uint32_t width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+        uint32_t height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+
+        if ((width && (pix->width != width)) ||
+                (height && (pix->height != height * 2))) {
+            ESP_LOGE(TAG, "width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        /* Packed RAW10 groups 4 pixels, the rows come in long and short pairs */
+        if (!hdr_merge_capture_format(pix->pixelformat) || !pix->width || (pix->width % 4) ||
+                !pix->height || (pix->height % 2)) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t buf_size = RAW10_PACKED_LINE_SIZE(pix->width) * pix->height;
+
+        ESP_LOGD(TAG, "output buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_OUTPUT_BUF_INFO(video, buf_size, alignments, HDR_MERGE_MEM_CAPS);
+        M2M_VIDEO_SET_OUTPUT_FORMAT(video, pix->width, pix->height, pix->pixelformat);
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    esp_err_t ret;
+
+    if (event == ESP_VIDEO_M2M_TRIGGER) {
+        uint32_t type = *(uint32_t *)arg;
+
+        if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            ret = esp_video_m2m_process(video,
+                                        V4L2_BUF_TYPE_VIDEO_OUTPUT,
+                                        V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                        hdr_merge_video_m2m_process);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "failed to process M2M device data");
+                return ret;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t hdr_merge_video_set_ext_ctrl(struct esp_video *video, const struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct hdr_merge_video *hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_ESP_HDR_RATIO:
+            if (ctrl->value < HDR_MERGE_RATIO_MIN || ctrl->value > HDR_MERGE_RATIO_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            hdr_merge_video->ratio = ctrl->value;
+            break;
+        case V4L2_CID_ESP_HDR_KNEE:
+            if (ctrl->value < 1 || ctrl->value > HDR_MERGE_PIXEL_MAX + 1) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            hdr_merge_video->knee = ctrl->value;
+            break;
+        case V4L2_CID_ESP_HDR_BLACK_LEVEL:
+            if (ctrl->value < 0 || ctrl->value > HDR_MERGE_PIXEL_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            hdr_merge_video->black_level = ctrl->value;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    hdr_merge_update_params(hdr_merge_video);
+
+    return ret;
+}
+
+static esp_err_t hdr_merge_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct hdr_merge_video *hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_ESP_HDR_RATIO:
+            ctrl->value = hdr_merge_video->ratio;
+            break;
+        case V4L2_CID_ESP_HDR_KNEE:
+            ctrl->value = hdr_merge_video->knee;
+            break;
+        case V4L2_CID_ESP_HDR_BLACK_LEVEL:
+            ctrl->value = hdr_merge_video->black_level;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static esp_err_t hdr_merge_video_query_ext_ctrl(struct esp_video *video, struct v4l2_query_ext_ctrl *qctrl)
+{
+    esp_err_t ret = ESP_OK;
+
+    switch (qctrl->id) {
+    case V4L2_CID_ESP_HDR_RATIO:
+        qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+        qctrl->maximum = HDR_MERGE_RATIO_MAX;
+        qctrl->minimum = HDR_MERGE_RATIO_MIN;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = HDR_MERGE_RATIO_DEFAULT;
+        break;
+    case V4L2_CID_ESP_HDR_KNEE:
+        qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+        qctrl->maximum = HDR_MERGE_PIXEL_MAX + 1;
+        qctrl->minimum = 1;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = HDR_MERGE_KNEE_DEFAULT;
+        break;
+    case V4L2_CID_ESP_HDR_BLACK_LEVEL:
+        qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+        qctrl->maximum = HDR_MERGE_PIXEL_MAX;
+        qctrl->minimum = 0;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = 0;
+        break;
+    default:
+        ret = ESP_ERR_NOT_SUPPORTED;
+        ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", qctrl->id);
+        break;
+    }
+
+    return ret;
+}
+
+static const struct esp_video_ops s_hdr_merge_video_ops = {
+    .init           = hdr_merge_video_init,
+    .deinit         = hdr_merge_video_deinit,
+    .start          = hdr_merge_video_start,
+    .stop           = hdr_merge_video_stop,
+    .enum_format    = hdr_merge_video_enum_format,
+    .set_format     = hdr_merge_video_set_format,
+    .notify         = hdr_merge_video_notify,
+    .set_ext_ctrl   = hdr_merge_video_set_ext_ctrl,
+    .get_ext_ctrl   = hdr_merge_video_get_ext_ctrl,
+    .query_ext_ctrl = hdr_merge_video_query_ext_ctrl,
+};
+
+/**
+ * @brief Create HDR merge video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_hdr_merge_video_device(void)
+{
+    struct esp_video *video;
+    struct hdr_merge_video *hdr_merge_video;
+    uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
+    uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
+
+    /* The PIE loads the parameters with aligned vector loads */
+    hdr_merge_video = heap_caps_aligned_calloc(HDR_MERGE_PIE_ALIGN, 1, sizeof(struct hdr_merge_video),
+                                               MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    if (!hdr_merge_video) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    hdr_merge_video->ratio = HDR_MERGE_RATIO_DEFAULT;
+    hdr_merge_video->knee = HDR_MERGE_KNEE_DEFAULT;
+    hdr_merge_update_params(hdr_merge_video);
+
+    video = esp_video_create(HDR_MERGE_NAME, ESP_VIDEO_HDR_MERGE_DEVICE_ID, &s_hdr_merge_video_ops, hdr_merge_video, caps, device_caps);
+    if (!video) {
+        heap_caps_free(hdr_merge_video);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Destroy HDR merge video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_hdr_merge_video_device(void)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct hdr_merge_video *hdr_merge_video;
+
+    video = esp_video_device_get_object(HDR_MERGE_NAME);
+    if (!video) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    hdr_merge_video = VIDEO_PRIV_DATA(struct hdr_merge_video *, video);
+
+    ret = esp_video_destroy(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, hdr_merge_video->rows, hdr_merge_video->row_stride * 2 * sizeof(uint16_t));
+    heap_caps_free(hdr_merge_video->rows);
+    heap_caps_free(hdr_merge_video);
+
+    return ESP_OK;
+}
@@ -5,6 +5,7 @@
  */
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +29,11 @@
  */
 #include "soc/isp_struct.h"
 
+#if CONFIG_ESP_VIDEO_ISP_TUNING_TABLES
+/* Generated at build time from CONFIG_ESP_VIDEO_ISP_TUNING_JSON */
+#include "esp_video_isp_tuning.h"
+#endif
+
 #define ISP_NAME                   "ISP"
 
 #define ISP_DMA_ALIGN_BYTES         4
@@ -52,10 +58,6 @@
 #define ISP_UNLOCK(i)
 #endif
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(x)               sizeof(x) / sizeof((x)[0])
-#endif
-
 #define ISP_REGION_START            (0.2)
 #define ISP_REGION_END              (0.8)
 
@@ -67,10 +69,55 @@
 #define ISP_STATS_SHARPEN_FLAG      ESP_VIDEO_ISP_STATS_FLAG_SHARPEN
 #define ISP_STATS_AF_FLAG           ESP_VIDEO_ISP_STATS_FLAG_AF
 
-#define ISP_STATS_FLAGS             (ISP_STATS_AE_FLAG | ISP_STATS_HIST_FLAG)
+#define ISP_STATS_SLOT_COUNT        2
+
+#define ISP_UPDATE_BF_FLAG          (1 << 0)
+#define ISP_UPDATE_CCM_FLAG         (1 << 1)
+#define ISP_UPDATE_WB_FLAG          (1 << 2)
+#define ISP_UPDATE_SHARPEN_FLAG     (1 << 3)
+#define ISP_UPDATE_GAMMA_FLAG       (1 << 4)
+#define ISP_UPDATE_DEMOSAIC_FLAG    (1 << 5)
+#define ISP_UPDATE_COLOR_FLAG       (1 << 6)
+#define ISP_UPDATE_AWB_FLAG         (1 << 7)
+#define ISP_UPDATE_LSC_FLAG         (1 << 8)
+#define ISP_UPDATE_AF_FLAG          (1 << 9)
+
+#define ISP_BLOCK_BF                (1 << 0)
+#define ISP_BLOCK_CCM               (1 << 1)
+#define ISP_BLOCK_AWB               (1 << 2)
+#define ISP_BLOCK_AE                (1 << 3)
+#define ISP_BLOCK_HIST              (1 << 4)
+#define ISP_BLOCK_SHARPEN           (1 << 5)
+#define ISP_BLOCK_GAMMA             (1 << 6)
+#define ISP_BLOCK_DEMOSAIC          (1 << 7)
+#define ISP_BLOCK_COLOR             (1 << 8)
+#define ISP_BLOCK_LSC               (1 << 9)
+#define ISP_BLOCK_AF                (1 << 10)
+
+/* RAW output leaves the ISP before demosaic, the blocks after it and the statistics they feed are wasted on it */
+#define ISP_BLOCKS_FULL             ((ISP_BLOCK_AF << 1) - 1)
+#define ISP_BLOCKS_RAW              (ISP_BLOCK_BF | ISP_BLOCK_LSC | ISP_BLOCK_HIST)
+#define ISP_BLOCKS_HIST             (ISP_BLOCK_HIST)
+
+#define ISP_BLOCK_ACTIVE(iv, b)     (((iv)->blocks & (b)) != 0)
 
 #define ISP_LSC_GET_GRIDS(res)      (((res) - 1) / 2 / ISP_LL_LSC_GRID_HEIGHT + 2)
 
+#if CONFIG_ESP_VIDEO_ENABLE_ISP_VIDEO_DEVICE
+/**
+ * @brief Statistics of one frame in assembly
+ *
+ * Every statistics block has its own field, so the ISR of a block fills it
+ * without a lock and then sets its flag. The ISR whose flag completes the
+ * frame copies the slot to a meta capture buffer, while the blocks of the
+ * next frame go to the other slot.
+ */
+struct isp_stats_slot {
+    esp_video_isp_stats_t stats;
+    atomic_uint_least32_t flags;        /*!< ISP_STATS_XXX_FLAG of the blocks filled in */
+};
+#endif
+
 struct isp_video {
     isp_proc_handle_t isp_proc;
 
@@ -82,7 +129,6 @@ struct isp_video {
     isp_hist_ctlr_t hist_ctlr;
     isp_af_ctlr_t af_ctlr;
 
-    portMUX_TYPE spinlock;
     SemaphoreHandle_t mutex;
 
     /* AWB configuration */
@@ -134,6 +180,12 @@ struct isp_video {
 
     esp_video_isp_af_t af_config;
 
+    /* Pipeline profile, the blocks of the running pipeline and the statistics completing a frame */
+
+    esp_video_isp_profile_t profile;
+    uint16_t blocks;
+    uint32_t stats_flags;
+
     /* Application command target */
 
     uint8_t red_balance_enable      : 1;
@@ -146,6 +198,9 @@ struct isp_video {
 
 #if ESP_VIDEO_ISP_DEVICE_LSC
     uint8_t lsc_enable              : 1;
+#if ISP_TUNING_LSC
+    uint8_t lsc_tuning              : 1;    /* LSC gains come from the tuning tables, until they are set */
+#endif
 #endif
 
     /* ISP pipeline state */
@@ -156,6 +211,7 @@ struct isp_video {
     uint8_t gamma_started           : 1;
     uint8_t demosaic_started        : 1;
     uint8_t awb_started             : 1;
+    uint8_t color_started           : 1;
 
 #if ESP_VIDEO_ISP_DEVICE_LSC
     uint8_t lsc_started             : 1;
@@ -170,6 +226,7 @@ struct isp_video {
      */
 
     uint8_t af_support              : 1;
+    uint8_t raw_output              : 1;
 
     /* Meta capture state */
 
@@ -179,7 +236,8 @@ struct isp_video {
     /* Statistics data */
 
     uint64_t seq;
-    esp_video_isp_stats_t *stats_buffer;
+    struct isp_stats_slot stats_slot[ISP_STATS_SLOT_COUNT];
+    atomic_uint_least32_t stats_slot_index;
 #endif
 };
 
@@ -352,6 +410,17 @@ static const struct v4l2_query_ext_ctrl s_isp_qctrl[] = {
         .default_value = 0,
         .name = "AF",
     },
+    {
+        .id = V4L2_CID_USER_ESP_ISP_PROFILE,
+        .type = V4L2_CTRL_TYPE_INTEGER,
+        .maximum = ESP_VIDEO_ISP_PROFILE_HIST,
+        .minimum = ESP_VIDEO_ISP_PROFILE_AUTO,
+        .step = 1,
+        .elems = sizeof(uint32_t),
+        .nr_of_dims = 1,
+        .default_value = ESP_VIDEO_ISP_PROFILE_AUTO,
+        .name = "pipeline profile",
+    },
 };
 #endif
 static const char *TAG = "isp_video";
@@ -431,70 +500,39 @@ static void video_rect2window(struct esp_video *video, isp_window_t *window)
 
 static esp_err_t isp_stats_done(struct isp_video *isp_video, const void *buffer, uint32_t flags)
 {
-    esp_err_t ret = ESP_OK;
-    uint32_t target_flags = ISP_STATS_FLAGS;
+    uint32_t done_flags;
+    uint32_t target_flags = isp_video->stats_flags;
+    struct isp_stats_slot *slot;
+    struct esp_video_buffer_element *element;
 
     if (!isp_video->capture_meta) {
         return false;
     }
 
-    portENTER_CRITICAL(&isp_video->spinlock);
-    if (!isp_video->stats_buffer) {
-        struct esp_video_buffer_element *element;
-
-        element = META_VIDEO_GET_QUEUED_ELEMENT(isp_video->video);
-        if (!element) {
-            ret = ESP_ERR_NO_MEM;
-            goto exit;
-        }
-
-        isp_video->stats_buffer = (esp_video_isp_stats_t *)element->buffer;
-        isp_video->stats_buffer->flags = 0;
-    }
+    slot = &isp_video->stats_slot[atomic_load_explicit(&isp_video->stats_slot_index, memory_order_acquire) %
+                                                       ISP_STATS_SLOT_COUNT];
 
     switch (flags) {
-    case ISP_STATS_AWB_FLAG: {
-        const esp_isp_awb_evt_data_t *edata = (const esp_isp_awb_evt_data_t *)buffer;
-        esp_isp_awb_evt_data_t *awb_stats = &isp_video->stats_buffer->awb;
-
-        *awb_stats = *edata;
+    case ISP_STATS_AWB_FLAG:
+        slot->stats.awb = *(const esp_isp_awb_evt_data_t *)buffer;
         break;
-    }
-    case ISP_STATS_AE_FLAG: {
-        const esp_isp_ae_env_detector_evt_data_t *edata = (const esp_isp_ae_env_detector_evt_data_t *)buffer;
-        esp_isp_ae_env_detector_evt_data_t *ae_stats = &isp_video->stats_buffer->ae;
-
-        *ae_stats = *edata;
+    case ISP_STATS_AE_FLAG:
+        slot->stats.ae = *(const esp_isp_ae_env_detector_evt_data_t *)buffer;
         break;
-    }
-    case ISP_STATS_HIST_FLAG: {
-        const esp_isp_hist_evt_data_t *edata = (const esp_isp_hist_evt_data_t *)buffer;
-        esp_isp_hist_evt_data_t *hist_stats = &isp_video->stats_buffer->hist;
-
-        *hist_stats = *edata;
+    case ISP_STATS_HIST_FLAG:
+        slot->stats.hist = *(const esp_isp_hist_evt_data_t *)buffer;
         break;
-    }
-    case ISP_STATS_SHARPEN_FLAG: {
-        const esp_isp_sharpen_evt_data_t *edata = (const esp_isp_sharpen_evt_data_t *)buffer;
-        esp_isp_sharpen_evt_data_t *sharpen_stats = &isp_video->stats_buffer->sharpen;
-
-        *sharpen_stats = *edata;
+    case ISP_STATS_SHARPEN_FLAG:
+        slot->stats.sharpen = *(const esp_isp_sharpen_evt_data_t *)buffer;
         break;
-    }
-    case ISP_STATS_AF_FLAG: {
-        const esp_isp_af_env_detector_evt_data_t *edata = (const esp_isp_af_env_detector_evt_data_t *)buffer;
-        esp_isp_af_env_detector_evt_data_t *af_stats = &isp_video->stats_buffer->af;
-
-        *af_stats = *edata;
+    case ISP_STATS_AF_FLAG:
+        slot->stats.af = *(const esp_isp_af_env_detector_evt_data_t *)buffer;
         break;
-    }
     default:
         ESP_EARLY_LOGE(TAG, "flags=%" PRIx32 " is not supported", flags);
-        ret = ESP_ERR_INVALID_ARG;
-        goto exit;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    isp_video->stats_buffer->flags |= flags;
     if (isp_video->sharpen_started) {
         target_flags |= ISP_STATS_SHARPEN_FLAG;
     }
@@ -504,15 +542,32 @@ static esp_err_t isp_stats_done(struct isp_video *isp_video, const void *buffer,
     if (isp_video->awb_started) {
         target_flags |= ISP_STATS_AWB_FLAG;
     }
-    if ((isp_video->stats_buffer->flags & target_flags) == target_flags) {
-        isp_video->stats_buffer->seq = isp_video->seq++;
-        META_VIDEO_DONE_BUF(isp_video->video, isp_video->stats_buffer, sizeof(esp_video_isp_stats_t));
-        isp_video->stats_buffer = NULL;
+
+    /* Release the block copy to the ISR completing the frame, only one ISR sees the frame complete */
+    done_flags = atomic_fetch_or_explicit(&slot->flags, flags, memory_order_acq_rel);
+    if ((done_flags & target_flags) == target_flags || ((done_flags | flags) & target_flags) != target_flags) {
+        return ESP_OK;
     }
+    done_flags |= flags;
 
-exit:
-    portEXIT_CRITICAL(&isp_video->spinlock);
-    return ret;
+    atomic_fetch_add_explicit(&isp_video->stats_slot_index, 1, memory_order_release);
+
+    element = META_VIDEO_GET_QUEUED_ELEMENT(isp_video->video);
+    if (element) {
+        esp_video_isp_stats_t *stats = (esp_video_isp_stats_t *)element->buffer;
+
+        *stats = slot->stats;
+        stats->flags = done_flags;
+        stats->seq = isp_video->seq++;
+    }
+    atomic_store_explicit(&slot->flags, 0, memory_order_release);
+
+    if (!element) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    META_VIDEO_DONE_BUF(isp_video->video, element->buffer, sizeof(esp_video_isp_stats_t));
+    return ESP_OK;
 }
 
 static bool isp_hist_stats_done(isp_hist_ctlr_t hist_ctlr, const esp_isp_hist_evt_data_t *edata, void *user_data)
@@ -548,6 +603,11 @@ static esp_err_t isp_start_hist(struct isp_video *isp_video)
         .on_statistics_done = isp_hist_stats_done,
     };
 
+    /* Without the color blocks there is no luma, count the Bayer samples instead */
+    if (!ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_COLOR)) {
+        hist_config.hist_mode = ISP_HIST_SAMPLING_RAW;
+    }
+
     video_rect2window(isp_video->video, &hist_config.window);
 
     ESP_RETURN_ON_ERROR(esp_isp_new_hist_controller(isp_video->isp_proc, &hist_config, &isp_video->hist_ctlr), TAG, "failed to new histogram");
@@ -568,6 +628,10 @@ fail_0:
 
 static esp_err_t isp_stop_hist(struct isp_video *isp_video)
 {
+    if (!isp_video->hist_ctlr) {
+        return ESP_OK;
+    }
+
     ESP_RETURN_ON_ERROR(esp_isp_hist_controller_stop_continuous_statistics(isp_video->hist_ctlr), TAG, "failed to stop histogram");
     ESP_RETURN_ON_ERROR(esp_isp_hist_controller_disable(isp_video->hist_ctlr), TAG, "failed to disable histogram");
     ESP_RETURN_ON_ERROR(esp_isp_del_hist_controller(isp_video->hist_ctlr), TAG, "failed to delete histogram");
@@ -820,6 +884,10 @@ static esp_err_t isp_start_ae(struct isp_video *isp_video)
 
 static esp_err_t isp_stop_ae(struct isp_video *isp_video)
 {
+    if (!isp_video->ae_ctlr) {
+        return ESP_OK;
+    }
+
     ESP_ERROR_CHECK(esp_isp_ae_controller_stop_continuous_statistics(isp_video->ae_ctlr));
     ESP_ERROR_CHECK(esp_isp_ae_controller_disable(isp_video->ae_ctlr));
     ESP_ERROR_CHECK(esp_isp_del_ae_controller(isp_video->ae_ctlr));
@@ -1017,6 +1085,7 @@ static esp_err_t isp_start_color(struct isp_video *isp_video)
 {
     ESP_RETURN_ON_ERROR(esp_isp_color_configure(isp_video->isp_proc, &isp_video->color_config), TAG, "failed to configure color");
     ESP_RETURN_ON_ERROR(esp_isp_color_enable(isp_video->isp_proc), TAG, "failed to enable color");
+    isp_video->color_started = true;
 
     return ESP_OK;
 }
@@ -1030,12 +1099,47 @@ static esp_err_t isp_reconfigure_color(struct isp_video *isp_video)
 
 static esp_err_t isp_stop_color(struct isp_video *isp_video)
 {
+    if (!isp_video->color_started) {
+        return ESP_OK;
+    }
+
     ESP_RETURN_ON_ERROR(esp_isp_color_disable(isp_video->isp_proc), TAG, "failed to disable color");
+    isp_video->color_started = false;
 
     return ESP_OK;
 }
 
 #if ESP_VIDEO_ISP_DEVICE_LSC
+#if ISP_TUNING_LSC
+/**
+ * @brief Point the LSC gains at the tuning table of the current resolution, no gain is copied
+ */
+static void isp_load_tuning_lsc(struct isp_video *isp_video)
+{
+    uint32_t width = META_VIDEO_GET_FORMAT_WIDTH(isp_video->video);
+    uint32_t height = META_VIDEO_GET_FORMAT_HEIGHT(isp_video->video);
+
+    if (!isp_video->lsc_tuning) {
+        return;
+    }
+
+    isp_video->lsc_enable = false;
+    for (int i = 0; i < ARRAY_SIZE(s_isp_tuning_lsc); i++) {
+        const struct isp_tuning_lsc *lsc = &s_isp_tuning_lsc[i];
+
+        if (lsc->width == width && lsc->height == height) {
+            isp_video->lsc_gain_size = lsc->gain_size;
+            isp_video->lsc_gain_array.gain_r = (isp_lsc_gain_t *)lsc->gain[0];
+            isp_video->lsc_gain_array.gain_gr = (isp_lsc_gain_t *)lsc->gain[1];
+            isp_video->lsc_gain_array.gain_gb = (isp_lsc_gain_t *)lsc->gain[2];
+            isp_video->lsc_gain_array.gain_b = (isp_lsc_gain_t *)lsc->gain[3];
+            isp_video->lsc_enable = true;
+            break;
+        }
+    }
+}
+#endif
+
 static esp_err_t isp_start_lsc(struct isp_video *isp_video)
 {
     uint32_t h = ISP_LSC_GET_GRIDS(META_VIDEO_GET_FORMAT_HEIGHT(isp_video->video));
@@ -1160,45 +1264,159 @@ static esp_err_t isp_reconfig_af(struct isp_video *isp_video)
     return ESP_OK;
 }
 
+/**
+ * @brief Bring the modules whose parameters changed in line with them
+ *
+ * Every module is written once however many of its controls came in one
+ * VIDIOC_S_EXT_CTRLS, e.g. the CCM matrix and both white balance gains end
+ * up in a single CCM write, so a parameter set is never seen half applied.
+ */
+static esp_err_t isp_update_modules(struct isp_video *isp_video, uint32_t update)
+{
+    if (update & ISP_UPDATE_BF_FLAG) {
+        ESP_RETURN_ON_ERROR(isp_stop_bf(isp_video), TAG, "failed to stop BF");
+        if (isp_video->bf_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_BF)) {
+            ESP_RETURN_ON_ERROR(isp_start_bf(isp_video), TAG, "failed to start BF");
+        }
+    }
+
+    if (update & ISP_UPDATE_DEMOSAIC_FLAG) {
+        if (isp_video->demosaic_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_DEMOSAIC)) {
+            ESP_RETURN_ON_ERROR(isp_reconfigure_demosaic(isp_video), TAG, "failed to reconfigure demosaic");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_demosaic(isp_video), TAG, "failed to stop demosaic");
+        }
+    }
+
+    /* White balance gains are folded into the CCM, a gain keeps the CCM running */
+    if (update & (ISP_UPDATE_CCM_FLAG | ISP_UPDATE_WB_FLAG)) {
+        if ((isp_video->ccm_enable || (update & ISP_UPDATE_WB_FLAG)) && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_CCM)) {
+            ESP_RETURN_ON_ERROR(isp_reconfig_ccm(isp_video), TAG, "failed to reconfigure CCM");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_ccm(isp_video), TAG, "failed to stop CCM");
+        }
+    }
+
+    if (update & ISP_UPDATE_GAMMA_FLAG) {
+        if (isp_video->gamma_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_GAMMA)) {
+            ESP_RETURN_ON_ERROR(isp_reconfigure_gamma(isp_video), TAG, "failed to reconfigure GAMMA");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_gamma(isp_video), TAG, "failed to stop GAMMA");
+        }
+    }
+
+    if (update & ISP_UPDATE_SHARPEN_FLAG) {
+        if (isp_video->sharpen_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_SHARPEN)) {
+            ESP_RETURN_ON_ERROR(isp_reconfig_sharpen(isp_video), TAG, "failed to reconfigure sharpen");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_sharpen(isp_video), TAG, "failed to stop sharpen");
+        }
+    }
+
+    if ((update & ISP_UPDATE_COLOR_FLAG) && isp_video->color_started) {
+        ESP_RETURN_ON_ERROR(isp_reconfigure_color(isp_video), TAG, "failed to reconfigure color");
+    }
+
+#if ESP_VIDEO_ISP_DEVICE_LSC
+    if (update & ISP_UPDATE_LSC_FLAG) {
+        if (isp_video->lsc_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_LSC)) {
+            ESP_RETURN_ON_ERROR(isp_reconfigure_lsc(isp_video), TAG, "failed to reconfigure LSC");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_lsc(isp_video), TAG, "failed to stop LSC");
+        }
+    }
+#endif
+
+    if (update & ISP_UPDATE_AWB_FLAG) {
+        if (isp_video->awb.enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AWB)) {
+            ESP_RETURN_ON_ERROR(isp_reconfigure_awb(isp_video), TAG, "failed to reconfigure AWB");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_awb(isp_video), TAG, "failed to stop AWB");
+        }
+    }
+
+    if (update & ISP_UPDATE_AF_FLAG) {
+        if (isp_video->af_config.enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AF)) {
+            ESP_RETURN_ON_ERROR(isp_reconfig_af(isp_video), TAG, "failed to reconfigure AF");
+        } else {
+            ESP_RETURN_ON_ERROR(isp_stop_af(isp_video), TAG, "failed to stop AF");
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Blocks of a pipeline profile, AUTO picks the profile from the output format
+ */
+static uint16_t isp_get_profile_blocks(const struct isp_video *isp_video)
+{
+    switch (isp_video->profile) {
+    case ESP_VIDEO_ISP_PROFILE_FULL:
+        return ISP_BLOCKS_FULL;
+    case ESP_VIDEO_ISP_PROFILE_RAW:
+        return ISP_BLOCKS_RAW;
+    case ESP_VIDEO_ISP_PROFILE_HIST:
+        return ISP_BLOCKS_HIST;
+    default:
+        return isp_video->raw_output ? ISP_BLOCKS_RAW : ISP_BLOCKS_FULL;
+    }
+}
+
 static esp_err_t isp_start_pipeline(struct isp_video *isp_video)
 {
     esp_err_t ret;
 
-    if (isp_video->ccm_enable || isp_video->red_balance_enable || isp_video->blue_balance_enable) {
+    isp_video->blocks = isp_get_profile_blocks(isp_video);
+    isp_video->stats_flags = (ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AE) ? ISP_STATS_AE_FLAG : 0) |
+                             (ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_HIST) ? ISP_STATS_HIST_FLAG : 0);
+    ESP_LOGD(TAG, "pipeline profile=%d blocks=0x%03x", isp_video->profile, isp_video->blocks);
+
+    if ((isp_video->ccm_enable || isp_video->red_balance_enable || isp_video->blue_balance_enable) &&
+            ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_CCM)) {
         ESP_RETURN_ON_ERROR(isp_start_ccm(isp_video), TAG, "failed to start CCM");
     }
-    if (isp_video->bf_enable) {
+    if (isp_video->bf_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_BF)) {
         ESP_GOTO_ON_ERROR(isp_start_bf(isp_video), fail_0, TAG, "failed to start BF");
     }
 
-    if (isp_video->awb.enable) {
+    if (isp_video->awb.enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AWB)) {
         ESP_GOTO_ON_ERROR(isp_start_awb(isp_video), fail_1, TAG, "failed to start AWB");
     }
 
-    ESP_GOTO_ON_ERROR(isp_start_ae(isp_video), fail_2, TAG, "failed to start AE");
-    ESP_GOTO_ON_ERROR(isp_start_hist(isp_video), fail_3, TAG, "failed to start histogram");
+    if (ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AE)) {
+        ESP_GOTO_ON_ERROR(isp_start_ae(isp_video), fail_2, TAG, "failed to start AE");
+    }
+    if (ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_HIST)) {
+        ESP_GOTO_ON_ERROR(isp_start_hist(isp_video), fail_3, TAG, "failed to start histogram");
+    }
 
-    if (isp_video->sharpen_enable) {
+    if (isp_video->sharpen_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_SHARPEN)) {
         ESP_GOTO_ON_ERROR(isp_start_sharpen(isp_video), fail_4, TAG, "failed to start sharpen");
     }
 
-    if (isp_video->gamma_enable) {
+    if (isp_video->gamma_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_GAMMA)) {
         ESP_GOTO_ON_ERROR(isp_start_gamma(isp_video), fail_5, TAG, "failed to start GAMMA");
     }
 
-    if (isp_video->demosaic_enable) {
+    if (isp_video->demosaic_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_DEMOSAIC)) {
         ESP_GOTO_ON_ERROR(isp_start_demosaic(isp_video), fail_6, TAG, "failed to start demosaic");
     }
 
-    ESP_GOTO_ON_ERROR(isp_start_color(isp_video), fail_7, TAG, "failed to start color");
+    if (ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_COLOR)) {
+        ESP_GOTO_ON_ERROR(isp_start_color(isp_video), fail_7, TAG, "failed to start color");
+    }
 
 #if ESP_VIDEO_ISP_DEVICE_LSC
-    if (isp_video->lsc_enable) {
+#if ISP_TUNING_LSC
+    isp_load_tuning_lsc(isp_video);
+#endif
+    if (isp_video->lsc_enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_LSC)) {
         ESP_GOTO_ON_ERROR(isp_start_lsc(isp_video), fail_8, TAG, "failed to start LSC");
     }
 #endif
 
-    if (isp_video->af_config.enable) {
+    if (isp_video->af_config.enable && ISP_BLOCK_ACTIVE(isp_video, ISP_BLOCK_AF)) {
         ESP_GOTO_ON_ERROR(isp_start_af(isp_video), fail_9, TAG, "failed to start AF");
     }
 
@@ -1281,6 +1499,10 @@ static esp_err_t isp_video_start(struct esp_video *video, uint32_t type)
     ISP_LOCK(isp_video);
 
     if (type == V4L2_BUF_TYPE_META_CAPTURE) {
+        /* Drop the blocks of a frame left incomplete by the last stop */
+        for (int i = 0; i < ISP_STATS_SLOT_COUNT; i++) {
+            atomic_store(&isp_video->stats_slot[i].flags, 0);
+        }
         isp_video->capture_meta = true;
     }
 
@@ -1343,6 +1565,7 @@ static esp_err_t isp_video_notify(struct esp_video *video, enum esp_video_event
 static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4l2_ext_controls *ctrls)
 {
     esp_err_t ret = ESP_OK;
+    uint32_t update = 0;
     struct isp_video *isp_video = VIDEO_PRIV_DATA(struct isp_video *, video);
 
     ISP_LOCK(isp_video);
@@ -1362,16 +1585,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                         isp_video->bf_matrix[i][j] = bf->matrix[i][j];
                     }
                 }
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_bf(isp_video), exit, TAG, "failed to stop BF");
-                    ESP_GOTO_ON_ERROR(isp_start_bf(isp_video), exit, TAG, "failed to start BF");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_bf(isp_video), exit, TAG, "failed to stop BF");
-                }
             }
+            update |= ISP_UPDATE_BF_FLAG;
             break;
         }
         case V4L2_CID_USER_ESP_ISP_CCM: {
@@ -1384,15 +1599,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                         isp_video->ccm_matrix[i][j] = ccm->matrix[i][j];
                     }
                 }
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfig_ccm(isp_video), exit, TAG, "failed to reconfigure CCM");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_ccm(isp_video), exit, TAG, "failed to stop CCM");
-                }
             }
+            update |= ISP_UPDATE_CCM_FLAG;
             break;
         }
         case V4L2_CID_RED_BALANCE:
@@ -1403,9 +1611,7 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                 isp_video->red_balance_enable = false;
             }
 
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfig_ccm(isp_video), exit, TAG, "failed to reconfigure red balance");
-            }
+            update |= ISP_UPDATE_WB_FLAG;
             break;
         case V4L2_CID_BLUE_BALANCE:
             if (ctrl->value > 0) {
@@ -1415,9 +1621,7 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                 isp_video->blue_balance_enable = false;
             }
 
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfig_ccm(isp_video), exit, TAG, "failed to reconfigure blue balance");
-            }
+            update |= ISP_UPDATE_WB_FLAG;
             break;
         case V4L2_CID_USER_ESP_ISP_SHARPEN: {
             const esp_video_isp_sharpen_t *sharpen = (const esp_video_isp_sharpen_t *)ctrl->p_u8;
@@ -1433,15 +1637,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                         isp_video->sharpen_matrix[i][j] = sharpen->matrix[i][j];
                     }
                 }
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfig_sharpen(isp_video), exit, TAG, "failed to reconfigure sharpen");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_sharpen(isp_video), exit, TAG, "failed to stop sharpen");
-                }
             }
+            update |= ISP_UPDATE_SHARPEN_FLAG;
             break;
         }
         case V4L2_CID_USER_ESP_ISP_GAMMA: {
@@ -1453,15 +1650,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                     isp_video->gamma_points[i].x = gamma->points[i].x;
                     isp_video->gamma_points[i].y = gamma->points[i].y;
                 }
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfigure_gamma(isp_video), exit, TAG, "failed to reconfigure GAMMA");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_gamma(isp_video), exit, TAG, "failed to stop GAMMA");
-                }
             }
+            update |= ISP_UPDATE_GAMMA_FLAG;
             break;
         }
         case V4L2_CID_USER_ESP_ISP_DEMOSAIC: {
@@ -1470,15 +1660,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
             isp_video->demosaic_enable = demosaic->enable;
             if (demosaic->enable) {
                 isp_video->gradient_ratio = demosaic->gradient_ratio;
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfigure_demosaic(isp_video), exit, TAG, "failed to reconfigure demosaic");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_demosaic(isp_video), exit, TAG, "failed to stop demosaic");
-                }
             }
+            update |= ISP_UPDATE_DEMOSAIC_FLAG;
             break;
         }
         case V4L2_CID_USER_ESP_ISP_WB: {
@@ -1490,38 +1673,27 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                 isp_video->red_balance_gain = wb->red_gain;
                 isp_video->blue_balance_gain = wb->blue_gain;
             }
-
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfigure_white_blance(isp_video), exit, TAG, "failed to reconfigure demosaic");
-            }
+            update |= ISP_UPDATE_WB_FLAG;
             break;
         }
         case V4L2_CID_BRIGHTNESS: {
             isp_video->color_config.color_brightness = ctrl->value;
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfigure_color(isp_video), exit, TAG, "failed to reconfigure color");
-            }
+            update |= ISP_UPDATE_COLOR_FLAG;
             break;
         }
         case V4L2_CID_CONTRAST: {
             isp_video->color_config.color_contrast.val = ctrl->value;
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfigure_color(isp_video), exit, TAG, "failed to reconfigure color");
-            }
+            update |= ISP_UPDATE_COLOR_FLAG;
             break;
         }
         case V4L2_CID_SATURATION: {
             isp_video->color_config.color_saturation.val = ctrl->value;
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfigure_color(isp_video), exit, TAG, "failed to reconfigure color");
-            }
+            update |= ISP_UPDATE_COLOR_FLAG;
             break;
         }
         case V4L2_CID_HUE: {
             isp_video->color_config.color_hue = ctrl->value;
-            if (ISP_STARTED(isp_video)) {
-                ESP_GOTO_ON_ERROR(isp_reconfigure_color(isp_video), exit, TAG, "failed to reconfigure color");
-            }
+            update |= ISP_UPDATE_COLOR_FLAG;
             break;
         }
         case V4L2_CID_USER_ESP_ISP_AWB: {
@@ -1537,21 +1709,16 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
             }
 
             memcpy(&isp_video->awb, awb, sizeof(esp_video_isp_awb_t));
-            if (awb->enable) {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfigure_awb(isp_video), exit, TAG, "failed to reconfigure AWB");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_awb(isp_video), exit, TAG, "failed to reconfigure AWB");
-                }
-            }
+            update |= ISP_UPDATE_AWB_FLAG;
             break;
         }
 #if ESP_VIDEO_ISP_DEVICE_LSC
         case V4L2_CID_USER_ESP_ISP_LSC: {
             const esp_video_isp_lsc_t *lsc = (const esp_video_isp_lsc_t *)ctrl->p_u8;
 
+#if ISP_TUNING_LSC
+            isp_video->lsc_tuning = false;
+#endif
             isp_video->lsc_enable = lsc->enable;
             if (lsc->enable) {
                 isp_video->lsc_gain_size = lsc->lsc_gain_size;
@@ -1559,16 +1726,8 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
                 isp_video->lsc_gain_array.gain_gr = (isp_lsc_gain_t *)lsc->gain_gr;
                 isp_video->lsc_gain_array.gain_gb = (isp_lsc_gain_t *)lsc->gain_gb;
                 isp_video->lsc_gain_array.gain_b = (isp_lsc_gain_t *)lsc->gain_b;
-
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfigure_lsc(isp_video), exit, TAG, "failed to reconfigure LSC");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_lsc(isp_video), exit, TAG, "failed to stop LSC");
-                }
             }
-
+            update |= ISP_UPDATE_LSC_FLAG;
             break;
         }
 #endif
@@ -1576,15 +1735,17 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
             esp_video_isp_af_t *af = (esp_video_isp_af_t *)ctrl->p_u8;
 
             isp_video->af_config = *af;
-            if (af->enable) {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_reconfig_af(isp_video), exit, TAG, "failed to reconfigure AF");
-                }
-            } else {
-                if (ISP_STARTED(isp_video)) {
-                    ESP_GOTO_ON_ERROR(isp_stop_af(isp_video), exit, TAG, "failed to stop AF");
-                }
+            update |= ISP_UPDATE_AF_FLAG;
+            break;
+        }
+        case V4L2_CID_USER_ESP_ISP_PROFILE: {
+            if (ctrl->value < ESP_VIDEO_ISP_PROFILE_AUTO || ctrl->value > ESP_VIDEO_ISP_PROFILE_HIST) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
             }
+
+            /* Applied when the pipeline starts next, restarting it here would drop a frame of statistics */
+            isp_video->profile = ctrl->value;
             break;
         }
         default:
@@ -1597,7 +1758,15 @@ static esp_err_t isp_video_set_ext_ctrl(struct esp_video *video, const struct v4
         }
     }
 
-exit:
+    /* The controls taken before a failing one are applied all the same */
+    if (update && ISP_STARTED(isp_video)) {
+        esp_err_t update_ret = isp_update_modules(isp_video, update);
+
+        if (ret == ESP_OK) {
+            ret = update_ret;
+        }
+    }
+
     ISP_UNLOCK(isp_video);
     return ret;
 }
@@ -1721,6 +1890,10 @@ static esp_err_t isp_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ext
             *af = isp_video->af_config;
             break;
         }
+        case V4L2_CID_USER_ESP_ISP_PROFILE: {
+            ctrl->value = isp_video->profile;
+            break;
+        }
         default:
             ret = ESP_ERR_NOT_SUPPORTED;
             break;
@@ -1830,8 +2003,6 @@ esp_err_t esp_video_create_isp_video_device(void)
         return ESP_ERR_NO_MEM;
     }
 
-    s_isp_video.spinlock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
-
     s_isp_video.video = esp_video_create(ISP_NAME, ESP_VIDEO_ISP1_DEVICE_ID, &s_isp_video_ops, &s_isp_video, caps, device_caps);
     if (!s_isp_video.video) {
         vSemaphoreDelete(s_isp_video.mutex);
@@ -1840,9 +2011,22 @@ esp_err_t esp_video_create_isp_video_device(void)
 
     s_isp_video.red_balance_gain = 1.0;
     s_isp_video.blue_balance_gain = 1.0;
+#if ISP_TUNING_CCM
+    /* The sensor tuning is used until the image algorithms set their own values */
+    memcpy(s_isp_video.ccm_matrix, s_isp_tuning_ccm, sizeof(s_isp_video.ccm_matrix));
+    s_isp_video.ccm_enable = true;
+#else
     s_isp_video.ccm_matrix[0][0] = 1.0;
     s_isp_video.ccm_matrix[1][1] = 1.0;
     s_isp_video.ccm_matrix[2][2] = 1.0;
+#endif
+#if ISP_TUNING_GAMMA
+    memcpy(s_isp_video.gamma_points, s_isp_tuning_gamma, sizeof(s_isp_video.gamma_points));
+    s_isp_video.gamma_enable = true;
+#endif
+#if ISP_TUNING_LSC
+    s_isp_video.lsc_tuning = true;
+#endif
 
     s_isp_video.color_config.color_contrast.val = ISP_CONTRAST_DEFAULT;
     s_isp_video.color_config.color_saturation.val = ISP_SATURATION_DEFAULT;
@@ -1997,6 +2181,7 @@ esp_err_t esp_video_isp_start_by_csi(const esp_video_csi_state_t *state, const s
         } else {
             isp_video->af_support = 0;
         }
+        isp_video->raw_output = COLOR_SPACE_TYPE(isp_out_color) == COLOR_SPACE_RAW;
 
         META_VIDEO_SET_FORMAT(isp_video->video, width, height, V4L2_META_FMT_ESP_ISP_STATS);
         ESP_GOTO_ON_ERROR(isp_start_pipeline(isp_video), fail_3, TAG, "failed to start ISP pipeline");
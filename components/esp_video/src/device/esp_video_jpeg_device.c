@@ -9,7 +9,9 @@
 #include <sys/param.h>
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_check.h"
 #include "esp_attr.h"
+#include "esp_idf_version.h"
 #include "esp_private/esp_cache_private.h"
 #include "driver/jpeg_encode.h"
 
@@ -26,6 +28,27 @@
 
 #define JPEG_MAX_COMP_RATE              0.75
 
+/* The encoder of older ESP-IDF versions has no YUV420 input */
+#define JPEG_YUV420_INPUT_SUPPORTED     (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 5, 0))
+
+#define JPEG_SIZE_MODEL                 (CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE || CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL)
+
+#if JPEG_SIZE_MODEL
+#define JPEG_HEADER_SIZE                1024    /* Markers and tables, the hardware writes about 620 bytes */
+#endif
+
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+#define JPEG_SIZE_MARGIN                (1.0f + CONFIG_ESP_VIDEO_JPEG_CAPTURE_SIZE_MARGIN_PERCENT / 100.0f)
+#define JPEG_RETRY_QUALITY_STEP         15
+#define JPEG_RETRY_COUNT                2
+#endif
+
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+#define JPEG_RC_DEFAULT_FPS             30
+#define JPEG_RC_QUALITY_UP_STEP         5       /* Quality rises slowly, one easy frame must not overshoot the next */
+#define JPEG_RC_COMPLEXITY_WEIGHT       0.25f   /* Weight of the last frame while the scene gets simpler */
+#endif
+
 #define JPEG_VIDEO_MAX_COMP_QUALITY     100
 #define JPEG_VIDEO_MIN_COMP_QUALITY     1
 #define JPEG_VIDEO_COMP_QUALITY_STEP    1
@@ -33,10 +56,6 @@
 #define JPEG_VIDEO_CHROMA_SUBSAMPLING   JPEG_DOWN_SAMPLING_YUV422
 #define JPEG_VIDEO_COMP_QUALITY         80
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(x)                   sizeof(x) / sizeof((x)[0])
-#endif
-
 struct jpeg_video {
     bool jpeg_inited;
     jpeg_encoder_handle_t enc_handle;
@@ -44,6 +63,20 @@ struct jpeg_video {
     jpeg_enc_input_format_t src_type;
     jpeg_down_sampling_type_t sub_sample;
     uint8_t image_quality;
+
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+    float scene_factor;                 /*!< Largest compressed size seen over the estimated one, at least 1 */
+    uint32_t overflow_count;            /*!< Frames encoded again because they did not fit */
+#endif
+
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    bool rc_enable;
+    uint32_t rc_bitrate;                /*!< Target bits per second, used if rc_frame_size is 0 */
+    uint32_t rc_frame_size;             /*!< Target compressed bytes per frame */
+    struct v4l2_fract rc_timeperframe;  /*!< Frame interval rc_bitrate is spread over */
+    uint8_t rc_quality;                 /*!< Quality of the next frame */
+    float rc_complexity;                /*!< Compressed size over the estimated one, 0 before the first frame */
+#endif
 };
 
 static const char *TAG = "jpeg_video";
@@ -68,6 +101,14 @@ static esp_err_t jpeg_get_input_format_from_v4l2(uint32_t v4l2_format, jpeg_enc_
         *src_bpp = 16;
         *sub_sample = JPEG_DOWN_SAMPLING_YUV422;
         break;
+#if JPEG_YUV420_INPUT_SUPPORTED
+    case V4L2_PIX_FMT_YUV420:
+        /* Same layout as the ISP YUV420 output, the encoder reads it without color conversion */
+        *src_type = JPEG_ENCODE_IN_FORMAT_YUV420;
+        *src_bpp = 12;
+        *sub_sample = JPEG_DOWN_SAMPLING_YUV420;
+        break;
+#endif
     case V4L2_PIX_FMT_GREY:
         *src_type = JPEG_ENCODE_IN_FORMAT_GRAY;
         *src_bpp = 8;
@@ -80,10 +121,49 @@ static esp_err_t jpeg_get_input_format_from_v4l2(uint32_t v4l2_format, jpeg_enc_
 
     return ret;
 }
+#if JPEG_SIZE_MODEL
+/**
+ * @brief Expected compressed bits per pixel of a detailed scene
+ *
+ * Luma bits per pixel by quality step of 10, a chroma sample costs about
+ * half a luma sample.
+ */
+static float jpeg_estimate_bpp(uint8_t quality, jpeg_down_sampling_type_t sub_sample)
+{
+    static const float luma_bpp[] = {0.25, 0.45, 0.6, 0.75, 0.9, 1.0, 1.2, 1.45, 1.9, 2.8, 8.0};
+    uint32_t index = MIN(quality, JPEG_VIDEO_MAX_COMP_QUALITY) / 10;
+    uint32_t next = MIN(index + 1, ARRAY_SIZE(luma_bpp) - 1);
+    float bpp = luma_bpp[index] + (luma_bpp[next] - luma_bpp[index]) * (quality % 10) / 10.0f;
+    float chroma_samples;
+
+    switch (sub_sample) {
+    case JPEG_DOWN_SAMPLING_YUV444:
+        chroma_samples = 2.0f;
+        break;
+    case JPEG_DOWN_SAMPLING_YUV422:
+        chroma_samples = 1.0f;
+        break;
+    case JPEG_DOWN_SAMPLING_YUV420:
+        chroma_samples = 0.5f;
+        break;
+    default:
+        chroma_samples = 0.0f;
+        break;
+    }
+
+    return bpp * (1.0f + 0.5f * chroma_samples);
+}
+
+static uint32_t jpeg_estimate_size(struct jpeg_video *jpeg_video, uint32_t pixels, uint8_t quality)
+{
+    return (uint32_t)(pixels * jpeg_estimate_bpp(quality, jpeg_video->sub_sample) / 8) + JPEG_HEADER_SIZE;
+}
+#endif
 
-static uint32_t jpeg_capture_size(uint32_t output_size)
+static uint32_t jpeg_capture_size(struct esp_video *video, uint32_t output_size)
 {
     size_t alignments = 0;
+    uint32_t size = (uint32_t)(output_size * JPEG_MAX_COMP_RATE);
 #if CONFIG_SPIRAM
     ESP_RETURN_ON_ERROR(esp_cache_get_alignment(JPEG_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
 #else
@@ -91,8 +171,99 @@ static uint32_t jpeg_capture_size(uint32_t output_size)
 #endif
     ESP_LOGD(TAG, "alignments=%zu", alignments);
 
-    return ESP_VIDEO_ALIGN((uint32_t)(output_size * JPEG_MAX_COMP_RATE), alignments);
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+    struct jpeg_video *jpeg_video = VIDEO_PRIV_DATA(struct jpeg_video *, video);
+    uint32_t pixels = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video) * M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+
+    if (output_size && pixels) {
+        uint32_t estimate = jpeg_estimate_size(jpeg_video, pixels, jpeg_video->image_quality) *
+                            jpeg_video->scene_factor * JPEG_SIZE_MARGIN;
+
+        /* The raw size bound holds whatever the scene, it stays the upper limit */
+        size = MIN(size, estimate);
+    }
+#endif
+
+    return ESP_VIDEO_ALIGN(size, alignments);
+}
+
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+static uint32_t jpeg_rc_target_size(struct jpeg_video *jpeg_video)
+{
+    if (jpeg_video->rc_frame_size) {
+        return jpeg_video->rc_frame_size;
+    }
+
+    return (uint64_t)jpeg_video->rc_bitrate * jpeg_video->rc_timeperframe.numerator /
+           (8 * jpeg_video->rc_timeperframe.denominator);
+}
+
+static void jpeg_rc_reset(struct jpeg_video *jpeg_video)
+{
+    jpeg_video->rc_quality = jpeg_video->image_quality;
+    jpeg_video->rc_complexity = 0.0f;
+}
+
+/**
+ * @brief Pick the quality of the next frame from the compressed size of the last one
+ *
+ * The scene complexity follows a harder scene at once and a simpler one
+ * slowly, and the next quality is the highest one whose expected size fits
+ * the target, never above the quality set by V4L2_CID_JPEG_COMPRESSION_QUALITY.
+ */
+static void jpeg_rc_update(struct jpeg_video *jpeg_video, uint32_t pixels, uint8_t quality, uint32_t size)
+{
+    uint32_t target = jpeg_rc_target_size(jpeg_video);
+    float ratio;
+    uint8_t next;
+
+    if (!jpeg_video->rc_enable || !target) {
+        return;
+    }
+
+    ratio = (float)size / jpeg_estimate_size(jpeg_video, pixels, quality);
+
+    if (ratio > jpeg_video->rc_complexity) {
+        jpeg_video->rc_complexity = ratio;
+    } else {
+        jpeg_video->rc_complexity += (ratio - jpeg_video->rc_complexity) * JPEG_RC_COMPLEXITY_WEIGHT;
+    }
+
+    for (next = jpeg_video->image_quality; next > JPEG_VIDEO_MIN_COMP_QUALITY; next--) {
+        if (jpeg_estimate_size(jpeg_video, pixels, next) * jpeg_video->rc_complexity <= target) {
+            break;
+        }
+    }
+
+    jpeg_video->rc_quality = MIN(next, quality + JPEG_RC_QUALITY_UP_STEP);
+    ESP_LOGD(TAG, "size=%" PRIu32 " target=%" PRIu32 " quality=%u->%u", size, target, quality, jpeg_video->rc_quality);
 }
+#endif
+
+static uint8_t jpeg_frame_quality(struct jpeg_video *jpeg_video)
+{
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    if (jpeg_video->rc_enable && jpeg_rc_target_size(jpeg_video)) {
+        return MIN(jpeg_video->rc_quality, jpeg_video->image_quality);
+    }
+#endif
+
+    return jpeg_video->image_quality;
+}
+
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+/**
+ * @brief Follow the compressed size of the scene, for the capture buffers requested next
+ */
+static void jpeg_update_scene_factor(struct jpeg_video *jpeg_video, uint32_t pixels, uint8_t quality, uint32_t size)
+{
+    float factor = (float)size / jpeg_estimate_size(jpeg_video, pixels, quality);
+
+    if (factor > jpeg_video->scene_factor) {
+        jpeg_video->scene_factor = factor;
+    }
+}
+#endif
 
 static esp_err_t jpeg_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
 {
@@ -102,7 +273,7 @@ static esp_err_t jpeg_video_m2m_process(struct esp_video *video, uint8_t *src, u
     jpeg_encode_cfg_t enc_config = {
         .src_type = jpeg_video->src_type,
         .sub_sample = jpeg_video->sub_sample,
-        .image_quality = jpeg_video->image_quality,
+        .image_quality = jpeg_frame_quality(jpeg_video),
         .width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video),
         .height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video),
     };
@@ -114,6 +285,40 @@ static esp_err_t jpeg_video_m2m_process(struct esp_video *video, uint8_t *src, u
                                dst,
                                dst_size,
                                &jpeg_codeced_size);
+#if JPEG_SIZE_MODEL
+    uint32_t pixels = enc_config.width * enc_config.height;
+#endif
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+    uint8_t quality = enc_config.image_quality;
+
+    /* A full output buffer stalls the encoder until its timeout */
+    for (int i = 0; i < JPEG_RETRY_COUNT && (ret == ESP_ERR_TIMEOUT || ret == ESP_ERR_INVALID_SIZE) &&
+            enc_config.image_quality > JPEG_VIDEO_MIN_COMP_QUALITY; i++) {
+        /* The frame takes at least the whole buffer at the requested quality */
+        jpeg_update_scene_factor(jpeg_video, pixels, quality, dst_size);
+        jpeg_video->overflow_count++;
+        ESP_LOGW(TAG, "frame does not fit %" PRIu32 " bytes at quality %u, overflow count=%" PRIu32,
+                 dst_size, enc_config.image_quality, jpeg_video->overflow_count);
+
+        enc_config.image_quality = MAX(enc_config.image_quality - JPEG_RETRY_QUALITY_STEP, JPEG_VIDEO_MIN_COMP_QUALITY);
+        ret = jpeg_encoder_process(jpeg_video->enc_handle,
+                                   &enc_config,
+                                   src,
+                                   src_size,
+                                   dst,
+                                   dst_size,
+                                   &jpeg_codeced_size);
+    }
+
+    if (ret == ESP_OK) {
+        jpeg_update_scene_factor(jpeg_video, pixels, enc_config.image_quality, jpeg_codeced_size);
+    }
+#endif
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    if (ret == ESP_OK) {
+        jpeg_rc_update(jpeg_video, pixels, enc_config.image_quality, jpeg_codeced_size);
+    }
+#endif
     if (ret == ESP_OK) {
         *dst_out_size = jpeg_codeced_size;
     }
@@ -171,6 +376,10 @@ static esp_err_t jpeg_video_start(struct esp_video *video, uint32_t type)
         return ESP_ERR_INVALID_ARG;
     }
 
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    jpeg_rc_reset(VIDEO_PRIV_DATA(struct jpeg_video *, video));
+#endif
+
     return ESP_OK;
 }
 
@@ -196,6 +405,9 @@ static esp_err_t jpeg_video_enum_format(struct esp_video *video, uint32_t type,
             V4L2_PIX_FMT_RGB565,
             V4L2_PIX_FMT_RGB24,
             V4L2_PIX_FMT_YUV422P,
+#if JPEG_YUV420_INPUT_SUPPORTED
+            V4L2_PIX_FMT_YUV420,
+#endif
             V4L2_PIX_FMT_GREY,
         };
 
@@ -236,7 +448,7 @@ static esp_err_t jpeg_video_set_format(struct esp_video *video, const struct v4l
             return ESP_ERR_INVALID_ARG;
         }
 
-        uint32_t buf_size = jpeg_capture_size(M2M_VIDEO_OUTPUT_BUF_SIZE(video));
+        uint32_t buf_size = jpeg_capture_size(video, M2M_VIDEO_OUTPUT_BUF_SIZE(video));
         if (!buf_size) {
             ESP_LOGE(TAG, "output buffer format should be set fistly");
             return ESP_ERR_INVALID_STATE;
@@ -313,6 +525,18 @@ static esp_err_t jpeg_video_set_ext_ctrl(struct esp_video *video, const struct v
         case V4L2_CID_JPEG_COMPRESSION_QUALITY:
             jpeg_video->image_quality = ctrl->value;
             break;
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+        case V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE:
+            jpeg_video->rc_enable = !!ctrl->value;
+            jpeg_rc_reset(jpeg_video);
+            break;
+        case V4L2_CID_MPEG_VIDEO_BITRATE:
+            jpeg_video->rc_bitrate = ctrl->value;
+            break;
+        case V4L2_CID_JPEG_ESP_FRAME_SIZE:
+            jpeg_video->rc_frame_size = ctrl->value;
+            break;
+#endif
         default:
             ret = ESP_ERR_NOT_SUPPORTED;
             ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
@@ -320,6 +544,15 @@ static esp_err_t jpeg_video_set_ext_ctrl(struct esp_video *video, const struct v
         }
     }
 
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+    struct esp_video_buffer_info *info = STREAM_BUF_INFO(M2M_VIDEO_CAPTURE_STREAM(video));
+
+    /* The estimate follows the quality and subsampling until the capture buffers are requested */
+    if (info->size && !M2M_VIDEO_CAPTURE_STREAM(video)->buffer) {
+        info->size = jpeg_capture_size(video, M2M_VIDEO_OUTPUT_BUF_SIZE(video));
+    }
+#endif
+
     return ret;
 }
 
@@ -338,6 +571,17 @@ static esp_err_t jpeg_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ex
         case V4L2_CID_JPEG_COMPRESSION_QUALITY:
             ctrl->value = jpeg_video->image_quality;
             break;
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+        case V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE:
+            ctrl->value = jpeg_video->rc_enable;
+            break;
+        case V4L2_CID_MPEG_VIDEO_BITRATE:
+            ctrl->value = jpeg_video->rc_bitrate;
+            break;
+        case V4L2_CID_JPEG_ESP_FRAME_SIZE:
+            ctrl->value = jpeg_video->rc_frame_size;
+            break;
+#endif
         default:
             ret = ESP_ERR_NOT_SUPPORTED;
             ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
@@ -370,6 +614,27 @@ static esp_err_t jpeg_video_query_ext_ctrl(struct esp_video *video, struct v4l2_
         qctrl->nr_of_dims = 0;
         qctrl->default_value = JPEG_VIDEO_COMP_QUALITY;
         break;
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    case V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE:
+        qctrl->type = V4L2_CTRL_TYPE_BOOLEAN;
+        qctrl->maximum = 1;
+        qctrl->minimum = 0;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = 0;
+        break;
+    case V4L2_CID_MPEG_VIDEO_BITRATE:
+    case V4L2_CID_JPEG_ESP_FRAME_SIZE:
+        qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+        qctrl->maximum = INT32_MAX;
+        qctrl->minimum = 0;
+        qctrl->step = 1;
+        qctrl->elems = 1;
+        qctrl->nr_of_dims = 0;
+        qctrl->default_value = 0;
+        break;
+#endif
     default:
         ret = ESP_ERR_NOT_SUPPORTED;
         ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", qctrl->id);
@@ -379,6 +644,43 @@ static esp_err_t jpeg_video_query_ext_ctrl(struct esp_video *video, struct v4l2_
     return ret;
 }
 
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+static struct v4l2_fract *jpeg_video_timeperframe(struct v4l2_streamparm *stream_parm)
+{
+    if (stream_parm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        stream_parm->parm.output.capability |= V4L2_CAP_TIMEPERFRAME;
+        return &stream_parm->parm.output.timeperframe;
+    }
+
+    stream_parm->parm.capture.capability |= V4L2_CAP_TIMEPERFRAME;
+    return &stream_parm->parm.capture.timeperframe;
+}
+
+/**
+ * @brief Set the frame interval V4L2_CID_MPEG_VIDEO_BITRATE is spread over, the device can not measure it
+ */
+static esp_err_t jpeg_video_set_parm(struct esp_video *video, struct v4l2_streamparm *stream_parm, struct esp_video_stream *stream)
+{
+    struct jpeg_video *jpeg_video = VIDEO_PRIV_DATA(struct jpeg_video *, video);
+    struct v4l2_fract *timeperframe = jpeg_video_timeperframe(stream_parm);
+
+    ESP_RETURN_ON_FALSE(timeperframe->numerator && timeperframe->denominator, ESP_ERR_INVALID_ARG, TAG,
+                        "frame interval is invalid");
+    jpeg_video->rc_timeperframe = *timeperframe;
+
+    return ESP_OK;
+}
+
+static esp_err_t jpeg_video_get_parm(struct esp_video *video, struct v4l2_streamparm *stream_parm, struct esp_video_stream *stream)
+{
+    struct jpeg_video *jpeg_video = VIDEO_PRIV_DATA(struct jpeg_video *, video);
+
+    *jpeg_video_timeperframe(stream_parm) = jpeg_video->rc_timeperframe;
+
+    return ESP_OK;
+}
+#endif
+
 static const struct esp_video_ops s_jpeg_video_ops = {
     .init           = jpeg_video_init,
     .deinit         = jpeg_video_deinit,
@@ -390,6 +692,10 @@ static const struct esp_video_ops s_jpeg_video_ops = {
     .set_ext_ctrl   = jpeg_video_set_ext_ctrl,
     .get_ext_ctrl   = jpeg_video_get_ext_ctrl,
     .query_ext_ctrl = jpeg_video_query_ext_ctrl,
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    .set_parm       = jpeg_video_set_parm,
+    .get_parm       = jpeg_video_get_parm,
+#endif
 };
 
 /**
@@ -421,6 +727,14 @@ esp_err_t esp_video_create_jpeg_video_device(jpeg_encoder_handle_t enc_handle)
     }
     jpeg_video->sub_sample = JPEG_VIDEO_CHROMA_SUBSAMPLING;
     jpeg_video->image_quality = JPEG_VIDEO_COMP_QUALITY;
+#if CONFIG_ESP_VIDEO_JPEG_ESTIMATE_CAPTURE_SIZE
+    jpeg_video->scene_factor = 1.0f;
+#endif
+#if CONFIG_ESP_VIDEO_JPEG_RATE_CONTROL
+    jpeg_video->rc_timeperframe.numerator = 1;
+    jpeg_video->rc_timeperframe.denominator = JPEG_RC_DEFAULT_FPS;
+    jpeg_rc_reset(jpeg_video);
+#endif
 
     video = esp_video_create(JPEG_NAME, ESP_VIDEO_JPEG_DEVICE_ID, &s_jpeg_video_ops, jpeg_video, caps, device_caps);
     if (!video) {
@@ -0,0 +1,577 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * NDVI video device
+ *
+ * Computes a normalized difference index map from a MIPI packed RAW10 Bayer
+ * frame of a sensor whose 2x2 cells carry a near infrared and a red (or other
+ * visible) channel, e.g. a camera without IR cut filter behind a blue filter.
+ * Each cell gives one index:
+ *
+ *   n = max(cell[nir] - black_level, 0) * nir_gain
+ *   r = max(cell[red] - black_level, 0) * red_gain
+ *   index = (n - r) / (n + r)
+ *
+ * The index in [-1, 1] is stored offset binary, 128 + 127 * index for GREY
+ * and 32768 + 32767 * index for Y16, so the map has a quarter of the pixels
+ * and a fifth (GREY) or two fifths (Y16) of the bytes of the RAW10 frame.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_private/esp_cache_private.h"
+
+#include "esp_video.h"
+#include "esp_video_ioctl.h"
+#include "esp_video_device_internal.h"
+
+#define NDVI_NAME                       "NDVI"
+
+#if CONFIG_SPIRAM
+#define NDVI_MEM_CAPS                   (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define NDVI_MEM_CAPS                   (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
+#endif
+
+#define NDVI_PIE_ALIGN                  16      /* Size of a PIE register */
+#define NDVI_PIE_LANES                  (NDVI_PIE_ALIGN / sizeof(uint16_t))
+
+#define NDVI_GAIN_SHIFT                 8       /* V4L2_CID_ESP_NDVI_NIR_GAIN and RED_GAIN are in 1/256 steps */
+#define NDVI_GAIN_MIN                   1
+#define NDVI_GAIN_MAX                   (4 << NDVI_GAIN_SHIFT)
+#define NDVI_GAIN_DEFAULT               (1 << NDVI_GAIN_SHIFT)
+#define NDVI_PIXEL_MAX                  1023    /* RAW10 */
+#define NDVI_CHANNEL_MAX                3       /* Cell positions: top left, top right, bottom left, bottom right */
+#define NDVI_NIR_CHANNEL_DEFAULT        0       /* R of RGGB */
+#define NDVI_RED_CHANNEL_DEFAULT        3       /* B of RGGB */
+
+struct ndvi_video {
+    /* Scaling parameters, each repeated in the PIE lanes, gains alternate with the column */
+    uint16_t black[NDVI_PIE_LANES] __attribute__((aligned(NDVI_PIE_ALIGN)));
+    uint16_t gain[2][NDVI_PIE_LANES] __attribute__((aligned(NDVI_PIE_ALIGN)));
+    uint16_t *rows;                     /* Unpacked top row of a cell row, then the bottom one */
+    uint32_t row_stride;                /* Pixels from the top to the bottom row, a whole number of lanes */
+    uint32_t nir_channel;
+    uint32_t red_channel;
+    uint32_t nir_gain;
+    uint32_t red_gain;
+    uint32_t black_level;
+    uint32_t frames;
+};
+
+static const char *TAG = "ndvi_video";
+
+#if CONFIG_ESP_VIDEO_NDVI_PIE
+extern void esp_video_ndvi_scale_pie(uint16_t *row, size_t size, const uint16_t *black, const uint16_t *gain);
+#endif
+
+static const uint32_t s_ndvi_output_format[] = {
+    V4L2_PIX_FMT_SBGGR10,
+    V4L2_PIX_FMT_SGBRG10,
+    V4L2_PIX_FMT_SGRBG10,
+    V4L2_PIX_FMT_SRGGB10,
+};
+
+static const uint32_t s_ndvi_capture_format[] = {
+    V4L2_PIX_FMT_GREY,
+    V4L2_PIX_FMT_Y16,
+};
+
+static bool ndvi_is_output_format(uint32_t pixel_format)
+{
+    for (int i = 0; i < ARRAY_SIZE(s_ndvi_output_format); i++) {
+        if (s_ndvi_output_format[i] == pixel_format) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Gain of a cell position, 0 for the positions no index is computed from */
+static uint32_t ndvi_channel_gain(const struct ndvi_video *ndvi_video, uint32_t channel)
+{
+    if (channel == ndvi_video->nir_channel) {
+        return ndvi_video->nir_gain;
+    } else if (channel == ndvi_video->red_channel) {
+        return ndvi_video->red_gain;
+    }
+
+    return 0;
+}
+
+static void ndvi_update_params(struct ndvi_video *ndvi_video)
+{
+    for (int i = 0; i < NDVI_PIE_LANES; i++) {
+        ndvi_video->black[i] = ndvi_video->black_level;
+        ndvi_video->gain[0][i] = ndvi_channel_gain(ndvi_video, i & 1);
+        ndvi_video->gain[1][i] = ndvi_channel_gain(ndvi_video, 2 + (i & 1));
+    }
+}
+
+static void ndvi_unpack_row(const uint8_t *src, uint16_t *row, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, src += 5) {
+        uint8_t lsb = src[4];
+
+        row[x + 0] = (src[0] << 2) | ((lsb >> 0) & 0x3);
+        row[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+        row[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+        row[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+    }
+}
+
+/* Subtract the black level and apply the channel gains, the C loop gives the same result as the PIE one */
+static void ndvi_scale_row(const struct ndvi_video *ndvi_video, uint16_t *row, const uint16_t *gain, uint32_t width)
+{
+    uint32_t black = ndvi_video->black_level;
+    uint32_t done = 0;
+
+#if CONFIG_ESP_VIDEO_NDVI_PIE
+    /* The unpacked rows are aligned and padded to a whole number of lanes */
+    done = ESP_VIDEO_ALIGN(width, NDVI_PIE_LANES);
+    esp_video_ndvi_scale_pie(row, done * sizeof(uint16_t), ndvi_video->black, gain);
+#endif
+
+    for (uint32_t x = done; x < width; x++) {
+        row[x] = ((row[x] > black ? row[x] - black : 0) * gain[x & 1]) >> NDVI_GAIN_SHIFT;
+    }
+}
+
+/* Index of one cell, 0 for a black cell */
+static inline int32_t ndvi_index(const struct ndvi_video *ndvi_video, const uint16_t *top, const uint16_t *bottom,
+                                 int32_t scale)
+{
+    int32_t n = (ndvi_video->nir_channel < 2 ? top : bottom)[ndvi_video->nir_channel & 1];
+    int32_t r = (ndvi_video->red_channel < 2 ? top : bottom)[ndvi_video->red_channel & 1];
+
+    return n + r ? (n - r) * scale / (n + r) : 0;
+}
+
+static esp_err_t ndvi_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
+{
+    struct ndvi_video *ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+    uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+    uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+    uint32_t bpp = M2M_VIDEO_GET_CAPTURE_FORMAT_PIXEL_FORMAT(video) == V4L2_PIX_FMT_Y16 ? sizeof(uint16_t) : 1;
+    uint32_t line_size = RAW10_PACKED_LINE_SIZE(width);
+    uint32_t out_size = (width / 2) * (height / 2) * bpp;
+    uint16_t *top = ndvi_video->rows;
+    uint16_t *bottom = ndvi_video->rows + ndvi_video->row_stride;
+
+    if (src_size < line_size * height || dst_size < out_size) {
+        ESP_LOGE(TAG, "buffer is too small");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        ndvi_unpack_row(src, top, width);
+        ndvi_unpack_row(src + line_size, bottom, width);
+        ndvi_scale_row(ndvi_video, top, ndvi_video->gain[0], width);
+        ndvi_scale_row(ndvi_video, bottom, ndvi_video->gain[1], width);
+
+        if (bpp == 1) {
+            for (uint32_t x = 0; x < width; x += 2) {
+                *dst++ = 128 + ndvi_index(ndvi_video, top + x, bottom + x, 127);
+            }
+        } else {
+            uint16_t *out = (uint16_t *)dst;
+
+            for (uint32_t x = 0; x < width; x += 2) {
+                *out++ = 32768 + ndvi_index(ndvi_video, top + x, bottom + x, 32767);
+            }
+            dst = (uint8_t *)out;
+        }
+
+        src += line_size * 2;
+    }
+
+    *dst_out_size = out_size;
+
+    ndvi_video->frames++;
+    ESP_LOGD(TAG, "frame %" PRIu32 " processed", ndvi_video->frames);
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_init(struct esp_video *video)
+{
+    M2M_VIDEO_SET_CAPTURE_FORMAT(video, 0, 0, 0);
+    M2M_VIDEO_SET_OUTPUT_FORMAT(video, 0, 0, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_deinit(struct esp_video *video)
+{
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_start(struct esp_video *video, uint32_t type)
+{
+    struct ndvi_video *ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+    uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+
+    if ((M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video) * 2 != width) ||
+            (M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video) * 2 != M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video))) {
+        ESP_LOGE(TAG, "width or height is invalid");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE && !ndvi_video->rows) {
+        /* Both rows are read right after they are unpacked, keep them in internal RAM */
+        ndvi_video->row_stride = ESP_VIDEO_ALIGN(width, NDVI_PIE_LANES);
+        ndvi_video->rows = heap_caps_aligned_calloc(NDVI_PIE_ALIGN, ndvi_video->row_stride * 2, sizeof(uint16_t),
+                                                    MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        if (!ndvi_video->rows) {
+            ESP_LOGE(TAG, "failed to allocate row buffers");
+            return ESP_ERR_NO_MEM;
+        }
+        VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, ndvi_video->rows, ndvi_video->row_stride * 2 * sizeof(uint16_t));
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_stop(struct esp_video *video, uint32_t type)
+{
+    struct ndvi_video *ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, ndvi_video->rows, ndvi_video->row_stride * 2 * sizeof(uint16_t));
+        heap_caps_free(ndvi_video->rows);
+        ndvi_video->rows = NULL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        if (index >= ARRAY_SIZE(s_ndvi_capture_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = s_ndvi_capture_format[index];
+    } else if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        if (index >= ARRAY_SIZE(s_ndvi_output_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = s_ndvi_output_format[index];
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+
+    size_t alignments = 0;
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(NDVI_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+    ESP_LOGD(TAG, "alignments=%zu", alignments);
+
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video) / 2;
+        uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video) / 2;
+
+        if (!width || !height) {
+            ESP_LOGE(TAG, "output buffer format should be set firstly");
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        /* Each 2x2 cell of the output frame makes one capture pixel */
+        if (((pix->pixelformat != V4L2_PIX_FMT_GREY) && (pix->pixelformat != V4L2_PIX_FMT_Y16)) ||
+                (pix->width != width) || (pix->height != height)) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t bpp = pix->pixelformat == V4L2_PIX_FMT_Y16 ? sizeof(uint16_t) : 1;
+        uint32_t buf_size = ESP_VIDEO_ALIGN(width * height * bpp, alignments);
+
+        ESP_LOGD(TAG, "capture buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_CAPTURE_FORMAT(video, width, height, pix->pixelformat);
+        M2M_VIDEO_SET_CAPTURE_BUF_INFO(video, buf_size, alignments, NDVI_MEM_CAPS);
+    } else if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        uint32_t width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+        uint32_t height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+
+        if ((width && (pix->width != width * 2)) ||
+                (height && (pix->height != height * 2))) {
+            ESP_LOGE(TAG, "width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        /* Packed RAW10 groups 4 pixels, the cells take 2 rows */
+        if (!ndvi_is_output_format(pix->pixelformat) || !pix->width || (pix->width % 4) ||
+                !pix->height || (pix->height % 2)) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t buf_size = RAW10_PACKED_LINE_SIZE(pix->width) * pix->height;
+
+        ESP_LOGD(TAG, "output buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_OUTPUT_BUF_INFO(video, buf_size, alignments, NDVI_MEM_CAPS);
+        M2M_VIDEO_SET_OUTPUT_FORMAT(video, pix->width, pix->height, pix->pixelformat);
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    esp_err_t ret;
+
+    if (event == ESP_VIDEO_M2M_TRIGGER) {
+        uint32_t type = *(uint32_t *)arg;
+
+        if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            ret = esp_video_m2m_process(video,
+                                        V4L2_BUF_TYPE_VIDEO_OUTPUT,
+                                        V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                        ndvi_video_m2m_process);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "failed to process M2M device data");
+                return ret;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ndvi_video_set_ext_ctrl(struct esp_video *video, const struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct ndvi_video *ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_ESP_NDVI_NIR_CHANNEL:
+            if (ctrl->value < 0 || ctrl->value > NDVI_CHANNEL_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ndvi_video->nir_channel = ctrl->value;
+            break;
+        case V4L2_CID_ESP_NDVI_RED_CHANNEL:
+            if (ctrl->value < 0 || ctrl->value > NDVI_CHANNEL_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ndvi_video->red_channel = ctrl->value;
+            break;
+        case V4L2_CID_ESP_NDVI_NIR_GAIN:
+            if (ctrl->value < NDVI_GAIN_MIN || ctrl->value > NDVI_GAIN_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ndvi_video->nir_gain = ctrl->value;
+            break;
+        case V4L2_CID_ESP_NDVI_RED_GAIN:
+            if (ctrl->value < NDVI_GAIN_MIN || ctrl->value > NDVI_GAIN_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ndvi_video->red_gain = ctrl->value;
+            break;
+        case V4L2_CID_ESP_NDVI_BLACK_LEVEL:
+            if (ctrl->value < 0 || ctrl->value > NDVI_PIXEL_MAX) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ndvi_video->black_level = ctrl->value;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    ndvi_update_params(ndvi_video);
+
+    return ret;
+}
+
+static esp_err_t ndvi_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct ndvi_video *ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_ESP_NDVI_NIR_CHANNEL:
+            ctrl->value = ndvi_video->nir_channel;
+            break;
+        case V4L2_CID_ESP_NDVI_RED_CHANNEL:
+            ctrl->value = ndvi_video->red_channel;
+            break;
+        case V4L2_CID_ESP_NDVI_NIR_GAIN:
+            ctrl->value = ndvi_video->nir_gain;
+            break;
+        case V4L2_CID_ESP_NDVI_RED_GAIN:
+            ctrl->value = ndvi_video->red_gain;
+            break;
+        case V4L2_CID_ESP_NDVI_BLACK_LEVEL:
+            ctrl->value = ndvi_video->black_level;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static esp_err_t ndvi_video_query_ext_ctrl(struct esp_video *video, struct v4l2_query_ext_ctrl *qctrl)
+{
+    esp_err_t ret = ESP_OK;
+
+    qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+    qctrl->step = 1;
+    qctrl->elems = 1;
+    qctrl->nr_of_dims = 0;
+
+    switch (qctrl->id) {
+    case V4L2_CID_ESP_NDVI_NIR_CHANNEL:
+        qctrl->maximum = NDVI_CHANNEL_MAX;
+        qctrl->minimum = 0;
+        qctrl->default_value = NDVI_NIR_CHANNEL_DEFAULT;
+        break;
+    case V4L2_CID_ESP_NDVI_RED_CHANNEL:
+        qctrl->maximum = NDVI_CHANNEL_MAX;
+        qctrl->minimum = 0;
+        qctrl->default_value = NDVI_RED_CHANNEL_DEFAULT;
+        break;
+    case V4L2_CID_ESP_NDVI_NIR_GAIN:
+    case V4L2_CID_ESP_NDVI_RED_GAIN:
+        qctrl->maximum = NDVI_GAIN_MAX;
+        qctrl->minimum = NDVI_GAIN_MIN;
+        qctrl->default_value = NDVI_GAIN_DEFAULT;
+        break;
+    case V4L2_CID_ESP_NDVI_BLACK_LEVEL:
+        qctrl->maximum = NDVI_PIXEL_MAX;
+        qctrl->minimum = 0;
+        qctrl->default_value = 0;
+        break;
+    default:
+        ret = ESP_ERR_NOT_SUPPORTED;
+        ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", qctrl->id);
+        break;
+    }
+
+    return ret;
+}
+
+static const struct esp_video_ops s_ndvi_video_ops = {
+    .init           = ndvi_video_init,
+    .deinit         = ndvi_video_deinit,
+    .start          = ndvi_video_start,
+    .stop           = ndvi_video_stop,
+    .enum_format    = ndvi_video_enum_format,
+    .set_format     = ndvi_video_set_format,
+    .notify         = ndvi_video_notify,
+    .set_ext_ctrl   = ndvi_video_set_ext_ctrl,
+    .get_ext_ctrl   = ndvi_video_get_ext_ctrl,
+    .query_ext_ctrl = ndvi_video_query_ext_ctrl,
+};
+
+/**
+ * @brief Create NDVI video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_ndvi_video_device(void)
+{
+    struct esp_video *video;
+    struct ndvi_video *ndvi_video;
+    uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
+    uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
+
+    /* The PIE loads the parameters with aligned vector loads */
+    ndvi_video = heap_caps_aligned_calloc(NDVI_PIE_ALIGN, 1, sizeof(struct ndvi_video),
+                                          MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    if (!ndvi_video) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ndvi_video->nir_channel = NDVI_NIR_CHANNEL_DEFAULT;
+    ndvi_video->red_channel = NDVI_RED_CHANNEL_DEFAULT;
+    ndvi_video->nir_gain = NDVI_GAIN_DEFAULT;
+    ndvi_video->red_gain = NDVI_GAIN_DEFAULT;
+    ndvi_update_params(ndvi_video);
+
+    video = esp_video_create(NDVI_NAME, ESP_VIDEO_NDVI_DEVICE_ID, &s_ndvi_video_ops, ndvi_video, caps, device_caps);
+    if (!video) {
+        heap_caps_free(ndvi_video);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Destroy NDVI video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_ndvi_video_device(void)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct ndvi_video *ndvi_video;
+
+    video = esp_video_device_get_object(NDVI_NAME);
+    if (!video) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ndvi_video = VIDEO_PRIV_DATA(struct ndvi_video *, video);
+
+    ret = esp_video_destroy(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, ndvi_video->rows, ndvi_video->row_stride * 2 * sizeof(uint16_t));
+    heap_caps_free(ndvi_video->rows);
+    heap_caps_free(ndvi_video);
+
+    return ESP_OK;
+}
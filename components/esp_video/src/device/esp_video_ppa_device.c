@@ -0,0 +1,572 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * PPA video device
+ *
+ * Runs the scale-rotate-mirror engine of the Pixel Processing Accelerator on
+ * each output frame: the crop rectangle set with VIDIOC_S_SELECTION on the
+ * output stream is scaled down to the capture size, rotated by
+ * V4L2_CID_ROTATE, mirrored by V4L2_CID_HFLIP and V4L2_CID_VFLIP and
+ * converted to the capture pixel format, in one DMA pass without the CPU.
+ *
+ * The PPA scales in 1/16 steps. The crop is shrunk around its center to the
+ * largest block whose scaled size is exactly the capture size, so the
+ * capture frame is always filled.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_private/esp_cache_private.h"
+#include "driver/ppa.h"
+
+#include "esp_video.h"
+#include "esp_video_ioctl.h"
+#include "esp_video_device_internal.h"
+
+#define PPA_NAME                        "PPA"
+
+#if CONFIG_SPIRAM
+#define PPA_MEM_CAPS                    (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define PPA_MEM_CAPS                    (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
+#endif
+
+#define PPA_SCALE_STEPS                 16      /* Scale precision of the SRM engine */
+
+struct ppa_video {
+    ppa_client_handle_t srm;
+    uint32_t rotation;                  /* Clockwise, in degrees */
+    bool hflip;
+    bool vflip;
+    uint32_t frames;
+};
+
+/* Input block of the output frame and the scale that maps it onto the capture frame */
+struct ppa_video_block {
+    struct v4l2_rect rect;
+    uint32_t scale_x;                   /* In 1/PPA_SCALE_STEPS */
+    uint32_t scale_y;
+};
+
+static const char *TAG = "ppa_video";
+
+static const uint32_t s_ppa_format[] = {
+    V4L2_PIX_FMT_RGB565,
+    V4L2_PIX_FMT_RGB24,
+    V4L2_PIX_FMT_YUV420,
+};
+
+static esp_err_t ppa_get_color_mode(uint32_t pixel_format, ppa_srm_color_mode_t *color_mode, uint32_t *bpp)
+{
+    switch (pixel_format) {
+    case V4L2_PIX_FMT_RGB565:
+        *color_mode = PPA_SRM_COLOR_MODE_RGB565;
+        *bpp = 16;
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        *color_mode = PPA_SRM_COLOR_MODE_RGB888;
+        *bpp = 24;
+        break;
+    case V4L2_PIX_FMT_YUV420:
+        *color_mode = PPA_SRM_COLOR_MODE_YUV420;
+        *bpp = 12;
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static ppa_srm_rotation_angle_t ppa_rotation_angle(uint32_t rotation)
+{
+    /* The PPA rotates counterclockwise */
+    switch (rotation) {
+    case 90:
+        return PPA_SRM_ROTATION_ANGLE_270;
+    case 180:
+        return PPA_SRM_ROTATION_ANGLE_180;
+    case 270:
+        return PPA_SRM_ROTATION_ANGLE_90;
+    default:
+        return PPA_SRM_ROTATION_ANGLE_0;
+    }
+}
+
+/**
+ * @brief Fit one axis of the crop to the capture size
+ *
+ * Picks the smallest scale of at least size / crop_size whose block, centered
+ * in the crop and aligned for the pixel format, scales to exactly size. 1:1
+ * always fits, so this fails only for upscaling.
+ */
+static esp_err_t ppa_fit_axis(uint32_t crop_offset, uint32_t crop_size, uint32_t size, uint32_t align,
+                              uint32_t *offset, uint32_t *block_size, uint32_t *scale)
+{
+    if (size > crop_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint32_t k = (size * PPA_SCALE_STEPS + crop_size - 1) / crop_size; k <= PPA_SCALE_STEPS; k++) {
+        uint32_t block = ESP_VIDEO_ALIGN((size * PPA_SCALE_STEPS + k - 1) / k, align);
+
+        if (block <= crop_size && block * k / PPA_SCALE_STEPS == size) {
+            *offset = crop_offset + ((crop_size - block) / 2) / align * align;
+            *block_size = block;
+            *scale = k;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t ppa_video_get_block(struct esp_video *video, const struct v4l2_rect *crop, struct ppa_video_block *block)
+{
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+    uint32_t in_width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+    uint32_t in_height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+    uint32_t out_width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+    uint32_t out_height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+    uint32_t align = M2M_VIDEO_GET_OUTPUT_FORMAT_PIXEL_FORMAT(video) == V4L2_PIX_FMT_YUV420 ? 2 : 1;
+    struct v4l2_rect rect = {
+        .width = in_width,
+        .height = in_height,
+    };
+    uint32_t left;
+    uint32_t top;
+
+    if (crop->width && crop->height) {
+        rect = *crop;
+    }
+
+    /* At 90 and 270 degrees the capture rows come from the crop columns */
+    if (ppa_video->rotation == 90 || ppa_video->rotation == 270) {
+        uint32_t tmp = out_width;
+
+        out_width = out_height;
+        out_height = tmp;
+    }
+
+    if (ppa_fit_axis(rect.left, rect.width, out_width, align, &left, &block->rect.width, &block->scale_x) != ESP_OK ||
+            ppa_fit_axis(rect.top, rect.height, out_height, align, &top, &block->rect.height, &block->scale_y) != ESP_OK) {
+        ESP_LOGE(TAG, "crop %" PRIu32 "x%" PRIu32 " can't be scaled to %" PRIu32 "x%" PRIu32,
+                 rect.width, rect.height, out_width, out_height);
+        return ESP_ERR_INVALID_ARG;
+    }
+    block->rect.left = left;
+    block->rect.top = top;
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
+{
+    esp_err_t ret;
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+    uint32_t out_width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+    uint32_t out_height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+    bool swap_axes = ppa_video->rotation == 90 || ppa_video->rotation == 270;
+    struct ppa_video_block block;
+    ppa_srm_color_mode_t in_cm;
+    ppa_srm_color_mode_t out_cm;
+    uint32_t in_bpp;
+    uint32_t out_bpp;
+
+    ESP_RETURN_ON_ERROR(ppa_video_get_block(video, STREAM_RECT(M2M_VIDEO_OUTPUT_STREAM(video)), &block),
+                        TAG, "failed to fit crop");
+    ppa_get_color_mode(M2M_VIDEO_GET_OUTPUT_FORMAT_PIXEL_FORMAT(video), &in_cm, &in_bpp);
+    ppa_get_color_mode(M2M_VIDEO_GET_CAPTURE_FORMAT_PIXEL_FORMAT(video), &out_cm, &out_bpp);
+
+    /* The PPA syncs the caches of both buffers itself */
+    ppa_srm_oper_config_t srm_config = {
+        .in = {
+            .buffer = src,
+            .pic_w = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video),
+            .pic_h = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video),
+            .block_w = block.rect.width,
+            .block_h = block.rect.height,
+            .block_offset_x = block.rect.left,
+            .block_offset_y = block.rect.top,
+            .srm_cm = in_cm,
+            .yuv_range = PPA_COLOR_RANGE_FULL,
+            .yuv_std = PPA_COLOR_CONV_STD_RGB_YUV_BT601,
+        },
+        .out = {
+            .buffer = dst,
+            .buffer_size = dst_size,
+            .pic_w = out_width,
+            .pic_h = out_height,
+            .srm_cm = out_cm,
+            .yuv_range = PPA_COLOR_RANGE_FULL,
+            .yuv_std = PPA_COLOR_CONV_STD_RGB_YUV_BT601,
+        },
+        .rotation_angle = ppa_rotation_angle(ppa_video->rotation),
+        .scale_x = (float)block.scale_x / PPA_SCALE_STEPS,
+        .scale_y = (float)block.scale_y / PPA_SCALE_STEPS,
+        /* The PPA mirrors the input block, the controls flip the rotated picture */
+        .mirror_x = swap_axes ? ppa_video->vflip : ppa_video->hflip,
+        .mirror_y = swap_axes ? ppa_video->hflip : ppa_video->vflip,
+        .mode = PPA_TRANS_MODE_BLOCKING,
+    };
+
+    ret = ppa_do_scale_rotate_mirror(ppa_video->srm, &srm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to run PPA SRM");
+        return ret;
+    }
+
+    *dst_out_size = out_width * out_height * out_bpp / 8;
+
+    ppa_video->frames++;
+    ESP_LOGD(TAG, "frame %" PRIu32 " processed", ppa_video->frames);
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_init(struct esp_video *video)
+{
+    M2M_VIDEO_SET_CAPTURE_FORMAT(video, 0, 0, 0);
+    M2M_VIDEO_SET_OUTPUT_FORMAT(video, 0, 0, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_deinit(struct esp_video *video)
+{
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_start(struct esp_video *video, uint32_t type)
+{
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+    struct ppa_video_block block;
+
+    if (!M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video) || !M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video)) {
+        ESP_LOGE(TAG, "output and capture format should be set firstly");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_RETURN_ON_ERROR(ppa_video_get_block(video, STREAM_RECT(M2M_VIDEO_OUTPUT_STREAM(video)), &block),
+                        TAG, "width or height is invalid");
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE && !ppa_video->srm) {
+        esp_err_t ret;
+        ppa_client_config_t ppa_config = {
+            .oper_type = PPA_OPERATION_SRM,
+            .max_pending_trans_num = 1,
+        };
+
+        ret = ppa_register_client(&ppa_config, &ppa_video->srm);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "failed to register PPA client: %s", esp_err_to_name(ret));
+            return ret;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_stop(struct esp_video *video, uint32_t type)
+{
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE && ppa_video->srm) {
+        ppa_unregister_client(ppa_video->srm);
+        ppa_video->srm = NULL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (type != V4L2_BUF_TYPE_VIDEO_CAPTURE && type != V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (index >= ARRAY_SIZE(s_ppa_format)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *pixel_format = s_ppa_format[index];
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+    ppa_srm_color_mode_t color_mode;
+    uint32_t bpp;
+
+    size_t alignments = 0;
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(PPA_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+    ESP_LOGD(TAG, "alignments=%zu", alignments);
+
+    /* YUV420 shares the chroma of 2x2 cells */
+    if ((ppa_get_color_mode(pix->pixelformat, &color_mode, &bpp) != ESP_OK) || !pix->width || !pix->height ||
+            ((pix->pixelformat == V4L2_PIX_FMT_YUV420) && ((pix->width % 2) || (pix->height % 2)))) {
+        ESP_LOGE(TAG, "pixel format or width or height is invalid");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The PPA writes whole cache lines of the capture buffer */
+    uint32_t buf_size = ESP_VIDEO_ALIGN(pix->width * pix->height * bpp / 8, alignments);
+
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        ESP_LOGD(TAG, "capture buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_CAPTURE_FORMAT(video, pix->width, pix->height, pix->pixelformat);
+        M2M_VIDEO_SET_CAPTURE_BUF_INFO(video, buf_size, alignments, PPA_MEM_CAPS);
+    } else if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        ESP_LOGD(TAG, "output buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_OUTPUT_BUF_INFO(video, buf_size, alignments, PPA_MEM_CAPS);
+        M2M_VIDEO_SET_OUTPUT_FORMAT(video, pix->width, pix->height, pix->pixelformat);
+
+        /* A new frame size drops the crop */
+        memset(STREAM_RECT(M2M_VIDEO_OUTPUT_STREAM(video)), 0, sizeof(struct v4l2_rect));
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    esp_err_t ret;
+
+    if (event == ESP_VIDEO_M2M_TRIGGER) {
+        uint32_t type = *(uint32_t *)arg;
+
+        if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            ret = esp_video_m2m_process(video,
+                                        V4L2_BUF_TYPE_VIDEO_OUTPUT,
+                                        V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                        ppa_video_m2m_process);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "failed to process M2M device data");
+                return ret;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t ppa_video_set_ext_ctrl(struct esp_video *video, const struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_HFLIP:
+            ppa_video->hflip = !!ctrl->value;
+            break;
+        case V4L2_CID_VFLIP:
+            ppa_video->vflip = !!ctrl->value;
+            break;
+        case V4L2_CID_ROTATE:
+            if (ctrl->value < 0 || ctrl->value > 270 || ctrl->value % 90) {
+                ret = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            ppa_video->rotation = ctrl->value;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static esp_err_t ppa_video_get_ext_ctrl(struct esp_video *video, struct v4l2_ext_controls *ctrls)
+{
+    esp_err_t ret = ESP_OK;
+    struct ppa_video *ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+
+    for (int i = 0; i < ctrls->count; i++) {
+        struct v4l2_ext_control *ctrl = &ctrls->controls[i];
+
+        switch (ctrl->id) {
+        case V4L2_CID_HFLIP:
+            ctrl->value = ppa_video->hflip;
+            break;
+        case V4L2_CID_VFLIP:
+            ctrl->value = ppa_video->vflip;
+            break;
+        case V4L2_CID_ROTATE:
+            ctrl->value = ppa_video->rotation;
+            break;
+        default:
+            ret = ESP_ERR_NOT_SUPPORTED;
+            ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", ctrl->id);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static esp_err_t ppa_video_query_ext_ctrl(struct esp_video *video, struct v4l2_query_ext_ctrl *qctrl)
+{
+    esp_err_t ret = ESP_OK;
+
+    qctrl->elems = 1;
+    qctrl->nr_of_dims = 0;
+    qctrl->minimum = 0;
+    qctrl->default_value = 0;
+
+    switch (qctrl->id) {
+    case V4L2_CID_HFLIP:
+    case V4L2_CID_VFLIP:
+        qctrl->type = V4L2_CTRL_TYPE_BOOLEAN;
+        qctrl->maximum = 1;
+        qctrl->step = 1;
+        break;
+    case V4L2_CID_ROTATE:
+        qctrl->type = V4L2_CTRL_TYPE_INTEGER;
+        qctrl->maximum = 270;
+        qctrl->step = 90;
+        break;
+    default:
+        ret = ESP_ERR_NOT_SUPPORTED;
+        ESP_LOGE(TAG, "id=%" PRIx32 " is not supported", qctrl->id);
+        break;
+    }
+
+    return ret;
+}
+
+static esp_err_t ppa_video_set_selection(struct esp_video *video, struct v4l2_selection *selection)
+{
+    const struct v4l2_rect *r = &selection->r;
+    uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+    uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+    struct ppa_video_block block;
+
+    if (selection->type != V4L2_BUF_TYPE_VIDEO_OUTPUT || selection->target != V4L2_SEL_TGT_CROP) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (!width || !height) {
+        ESP_LOGE(TAG, "output buffer format should be set firstly");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* An empty rectangle selects the whole frame */
+    if (r->width || r->height) {
+        if (r->left < 0 || r->top < 0 || !r->width || !r->height ||
+                r->left + r->width > width || r->top + r->height > height ||
+                ((M2M_VIDEO_GET_OUTPUT_FORMAT_PIXEL_FORMAT(video) == V4L2_PIX_FMT_YUV420) &&
+                 ((r->left | r->top | r->width | r->height) & 1))) {
+            ESP_LOGE(TAG, "crop is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    /* The crop can change while streaming, as long as it still fills the capture frame */
+    if (M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video)) {
+        ESP_RETURN_ON_ERROR(ppa_video_get_block(video, r, &block), TAG, "crop is too small");
+    }
+
+    return ESP_OK;
+}
+
+static const struct esp_video_ops s_ppa_video_ops = {
+    .init           = ppa_video_init,
+    .deinit         = ppa_video_deinit,
+    .start          = ppa_video_start,
+    .stop           = ppa_video_stop,
+    .enum_format    = ppa_video_enum_format,
+    .set_format     = ppa_video_set_format,
+    .notify         = ppa_video_notify,
+    .set_ext_ctrl   = ppa_video_set_ext_ctrl,
+    .get_ext_ctrl   = ppa_video_get_ext_ctrl,
+    .query_ext_ctrl = ppa_video_query_ext_ctrl,
+    .set_selection  = ppa_video_set_selection,
+};
+
+/**
+ * @brief Create PPA video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_ppa_video_device(void)
+{
+    struct esp_video *video;
+    struct ppa_video *ppa_video;
+    uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
+    uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
+
+    ppa_video = heap_caps_calloc(1, sizeof(struct ppa_video), MALLOC_CAP_8BIT);
+    if (!ppa_video) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    video = esp_video_create(PPA_NAME, ESP_VIDEO_PPA_DEVICE_ID, &s_ppa_video_ops, ppa_video, caps, device_caps);
+    if (!video) {
+        heap_caps_free(ppa_video);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Destroy PPA video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_ppa_video_device(void)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct ppa_video *ppa_video;
+
+    video = esp_video_device_get_object(PPA_NAME);
+    if (!video) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ppa_video = VIDEO_PRIV_DATA(struct ppa_video *, video);
+
+    ret = esp_video_destroy(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (ppa_video->srm) {
+        ppa_unregister_client(ppa_video->srm);
+    }
+    heap_caps_free(ppa_video);
+
+    return ESP_OK;
+}
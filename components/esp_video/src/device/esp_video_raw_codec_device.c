@@ -0,0 +1,489 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * Lossless RAW10 codec video device
+ *
+ * Compresses MIPI packed RAW10 Bayer frames (4 pixels in 5 bytes) into
+ * V4L2_PIX_FMT_ESP_RAW10_RICE. Every pixel is predicted from the pixel of the
+ * same color two columns to the left, the zigzag mapped residual is coded with
+ * a Rice code whose parameter k is chosen per line. Lines only depend on
+ * themselves, so a corrupted line does not spread and the decoder can work on
+ * whole lines at once.
+ *
+ * Bitstream, all multi-byte fields are little endian:
+ *
+ *   frame header  magic "R10R", u16 width, u16 height, u32 source pixel format
+ *   per line      u8 k, u8 reserved, u16 unary_len
+ *                 k < 0xff:  width remainders of k bits, MSB first, padded to a byte
+ *                            unary_len bytes of quotients, q zeros then a one, MSB first
+ *                 k == 0xff: the packed RAW10 line, stored as is
+ *
+ * A line is stored as is when its code would be larger, so a frame is never larger
+ * than the packed frame plus the headers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_private/esp_cache_private.h"
+
+#include "esp_video.h"
+#include "esp_video_ioctl.h"
+#include "esp_video_device_internal.h"
+
+#define RAW_CODEC_NAME                  "RAW_CODEC"
+
+#if CONFIG_SPIRAM
+#define RAW_CODEC_MEM_CAPS              (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define RAW_CODEC_MEM_CAPS              (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
+#endif
+
+#define RAW_CODEC_MAGIC                 "R10R"
+#define RAW_CODEC_FRAME_HEADER_SIZE     12
+#define RAW_CODEC_LINE_HEADER_SIZE      4
+#define RAW_CODEC_LINE_STORED           0xff
+#define RAW_CODEC_MAX_K                 10
+#define RAW_CODEC_PREDICTION_INIT       512     /* Mid-scale prediction of the first two pixels */
+
+struct raw_codec_video {
+    uint16_t *line;                     /* Unpacked pixels of one line, then their mapped residuals */
+    uint32_t frames;
+};
+
+/* MSB first bit writer with a hard end, used to detect lines that do not compress */
+typedef struct {
+    uint8_t *ptr;
+    uint8_t *end;
+    uint32_t acc;
+    uint32_t bits;
+} raw_codec_bit_writer_t;
+
+static const char *TAG = "raw_codec_video";
+
+static inline bool bit_writer_put(raw_codec_bit_writer_t *bw, uint32_t value, uint32_t bits)
+{
+    bw->acc = (bw->acc << bits) | value;
+    bw->bits += bits;
+
+    while (bw->bits >= 8) {
+        if (bw->ptr >= bw->end) {
+            return false;
+        }
+
+        bw->bits -= 8;
+        *bw->ptr++ = (uint8_t)(bw->acc >> bw->bits);
+    }
+
+    return true;
+}
+
+static inline bool bit_writer_flush(raw_codec_bit_writer_t *bw)
+{
+    if (bw->bits) {
+        return bit_writer_put(bw, 0, 8 - bw->bits);
+    }
+
+    return true;
+}
+
+static bool raw_codec_is_bayer10(uint32_t pixel_format)
+{
+    return pixel_format == V4L2_PIX_FMT_SBGGR10 || pixel_format == V4L2_PIX_FMT_SGBRG10 ||
+           pixel_format == V4L2_PIX_FMT_SGRBG10 || pixel_format == V4L2_PIX_FMT_SRGGB10;
+}
+
+static uint32_t raw_codec_capture_size(uint32_t width, uint32_t height)
+{
+    return RAW_CODEC_FRAME_HEADER_SIZE + height * (RAW_CODEC_LINE_HEADER_SIZE + RAW10_PACKED_LINE_SIZE(width));
+}
+
+/*
+ * Unpack one line and replace every pixel by its zigzag mapped prediction residual,
+ * returns the sum of the mapped residuals.
+ */
+static uint32_t raw_codec_map_line(const uint8_t *src, uint16_t *line, uint32_t width)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t x = 0; x < width; x += 4) {
+        uint8_t lsb = src[4];
+
+        line[x + 0] = (src[0] << 2) | ((lsb >> 0) & 0x3);
+        line[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+        line[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+        line[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+        src += 5;
+    }
+
+    /* Walk backwards so the same-color left neighbour is still a pixel value */
+    for (uint32_t x = width; x-- > 0;) {
+        int32_t prediction = x >= 2 ? line[x - 2] : RAW_CODEC_PREDICTION_INIT;
+        int32_t residual = (int32_t)line[x] - prediction;
+        uint16_t mapped = residual >= 0 ? residual << 1 : ((-residual) << 1) - 1;
+
+        line[x] = mapped;
+        sum += mapped;
+    }
+
+    return sum;
+}
+
+/* Rice code one line, returns the coded size or 0 if it is not smaller than the stored line */
+static uint32_t raw_codec_code_line(const uint16_t *line, uint32_t width, uint32_t sum, uint8_t *dst)
+{
+    uint32_t k = 0;
+    uint32_t line_size = RAW10_PACKED_LINE_SIZE(width);
+    uint32_t rem_size;
+    uint32_t unary_size;
+    raw_codec_bit_writer_t rem;
+    raw_codec_bit_writer_t unary;
+
+    /* Same estimate as JPEG-LS: the smallest k for which width << k covers the residual sum */
+    while (k < RAW_CODEC_MAX_K && (width << k) < sum) {
+        k++;
+    }
+
+    rem_size = (width * k + 7) / 8;
+    if (rem_size >= line_size) {
+        return 0;
+    }
+
+    rem = (raw_codec_bit_writer_t) {
+        .ptr = dst + RAW_CODEC_LINE_HEADER_SIZE,
+        .end = dst + RAW_CODEC_LINE_HEADER_SIZE + rem_size,
+    };
+    unary = (raw_codec_bit_writer_t) {
+        .ptr = rem.end,
+        .end = dst + RAW_CODEC_LINE_HEADER_SIZE + line_size,
+    };
+
+    for (uint32_t x = 0; x < width; x++) {
+        uint32_t q = line[x] >> k;
+
+        if (k && !bit_writer_put(&rem, line[x] & ((1 << k) - 1), k)) {
+            return 0;
+        }
+
+        while (q >= 16) {
+            if (!bit_writer_put(&unary, 0, 16)) {
+                return 0;
+            }
+            q -= 16;
+        }
+
+        if (!bit_writer_put(&unary, 1, q + 1)) {
+            return 0;
+        }
+    }
+
+    if (!bit_writer_flush(&rem) || !bit_writer_flush(&unary)) {
+        return 0;
+    }
+
+    unary_size = unary.ptr - rem.end;
+    dst[0] = k;
+    dst[1] = 0;
+    dst[2] = unary_size & 0xff;
+    dst[3] = unary_size >> 8;
+
+    return RAW_CODEC_LINE_HEADER_SIZE + rem_size + unary_size;
+}
+
+static esp_err_t raw_codec_video_m2m_process(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
+{
+    struct raw_codec_video *raw_codec_video = VIDEO_PRIV_DATA(struct raw_codec_video *, video);
+    uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+    uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+    uint32_t pixel_format = M2M_VIDEO_GET_OUTPUT_FORMAT_PIXEL_FORMAT(video);
+    uint32_t line_size = RAW10_PACKED_LINE_SIZE(width);
+    uint8_t *out = dst;
+
+    if (src_size < line_size * height || dst_size < raw_codec_capture_size(width, height)) {
+        ESP_LOGE(TAG, "buffer is too small");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(out, RAW_CODEC_MAGIC, 4);
+    out[4] = width & 0xff;
+    out[5] = width >> 8;
+    out[6] = height & 0xff;
+    out[7] = height >> 8;
+    out[8] = pixel_format & 0xff;
+    out[9] = (pixel_format >> 8) & 0xff;
+    out[10] = (pixel_format >> 16) & 0xff;
+    out[11] = pixel_format >> 24;
+    out += RAW_CODEC_FRAME_HEADER_SIZE;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t sum = raw_codec_map_line(src, raw_codec_video->line, width);
+        uint32_t size = raw_codec_code_line(raw_codec_video->line, width, sum, out);
+
+        if (!size) {
+            out[0] = RAW_CODEC_LINE_STORED;
+            out[1] = 0;
+            out[2] = 0;
+            out[3] = 0;
+            memcpy(out + RAW_CODEC_LINE_HEADER_SIZE, src, line_size);
+            size = RAW_CODEC_LINE_HEADER_SIZE + line_size;
+        }
+
+        out += size;
+        src += line_size;
+    }
+
+    *dst_out_size = out - dst;
+
+    raw_codec_video->frames++;
+    ESP_LOGD(TAG, "frame %" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes", raw_codec_video->frames,
+             line_size * height, *dst_out_size);
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_init(struct esp_video *video)
+{
+    M2M_VIDEO_SET_CAPTURE_FORMAT(video, 0, 0, 0);
+    M2M_VIDEO_SET_OUTPUT_FORMAT(video, 0, 0, 0);
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_deinit(struct esp_video *video)
+{
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_start(struct esp_video *video, uint32_t type)
+{
+    struct raw_codec_video *raw_codec_video = VIDEO_PRIV_DATA(struct raw_codec_video *, video);
+
+    if ((M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video) != M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video)) ||
+            (M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video) != M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video))) {
+        ESP_LOGE(TAG, "width or height is invalid");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE && !raw_codec_video->line) {
+        /* The line is walked twice per pixel, keep it in internal RAM */
+        raw_codec_video->line = heap_caps_malloc(M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video) * sizeof(uint16_t),
+                                                 MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        if (!raw_codec_video->line) {
+            ESP_LOGE(TAG, "failed to allocate line buffer");
+            return ESP_ERR_NO_MEM;
+        }
+        VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, raw_codec_video->line, M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video) * sizeof(uint16_t));
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_stop(struct esp_video *video, uint32_t type)
+{
+    struct raw_codec_video *raw_codec_video = VIDEO_PRIV_DATA(struct raw_codec_video *, video);
+
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, raw_codec_video->line, M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video) * sizeof(uint16_t));
+        heap_caps_free(raw_codec_video->line);
+        raw_codec_video->line = NULL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        static const uint32_t raw_codec_capture_format[] = {
+            V4L2_PIX_FMT_ESP_RAW10_RICE,
+        };
+
+        if (index >= ARRAY_SIZE(raw_codec_capture_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = raw_codec_capture_format[index];
+    } else if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        static const uint32_t raw_codec_output_format[] = {
+            V4L2_PIX_FMT_SBGGR10,
+            V4L2_PIX_FMT_SGBRG10,
+            V4L2_PIX_FMT_SGRBG10,
+            V4L2_PIX_FMT_SRGGB10,
+        };
+
+        if (index >= ARRAY_SIZE(raw_codec_output_format)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *pixel_format = raw_codec_output_format[index];
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+
+    size_t alignments = 0;
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(RAW_CODEC_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+    ESP_LOGD(TAG, "alignments=%zu", alignments);
+
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        uint32_t width = M2M_VIDEO_GET_OUTPUT_FORMAT_WIDTH(video);
+        uint32_t height = M2M_VIDEO_GET_OUTPUT_FORMAT_HEIGHT(video);
+
+        if ((pix->pixelformat != V4L2_PIX_FMT_ESP_RAW10_RICE) ||
+                (width && (pix->width != width)) ||
+                (height && (pix->height != height))) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!width || !height) {
+            ESP_LOGE(TAG, "output buffer format should be set firstly");
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        uint32_t buf_size = ESP_VIDEO_ALIGN(raw_codec_capture_size(width, height), alignments);
+
+        ESP_LOGD(TAG, "capture buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_CAPTURE_FORMAT(video, width, height, pix->pixelformat);
+        M2M_VIDEO_SET_CAPTURE_BUF_INFO(video, buf_size, alignments, RAW_CODEC_MEM_CAPS);
+    } else if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        uint32_t width = M2M_VIDEO_GET_CAPTURE_FORMAT_WIDTH(video);
+        uint32_t height = M2M_VIDEO_GET_CAPTURE_FORMAT_HEIGHT(video);
+
+        if ((width && (pix->width != width)) ||
+                (height && (pix->height != height))) {
+            ESP_LOGE(TAG, "width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        /* Packed RAW10 groups 4 pixels, the headers store sizes in 16 bits */
+        if (!raw_codec_is_bayer10(pix->pixelformat) || !pix->width || (pix->width % 4) ||
+                RAW10_PACKED_LINE_SIZE(pix->width) > UINT16_MAX || !pix->height || pix->height > UINT16_MAX) {
+            ESP_LOGE(TAG, "pixel format or width or height is invalid");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t buf_size = RAW10_PACKED_LINE_SIZE(pix->width) * pix->height;
+
+        ESP_LOGD(TAG, "output buffer size=%" PRIu32, buf_size);
+
+        M2M_VIDEO_SET_OUTPUT_BUF_INFO(video, buf_size, alignments, RAW_CODEC_MEM_CAPS);
+        M2M_VIDEO_SET_OUTPUT_FORMAT(video, pix->width, pix->height, pix->pixelformat);
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw_codec_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    esp_err_t ret;
+
+    if (event == ESP_VIDEO_M2M_TRIGGER) {
+        uint32_t type = *(uint32_t *)arg;
+
+        if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            ret = esp_video_m2m_process(video,
+                                        V4L2_BUF_TYPE_VIDEO_OUTPUT,
+                                        V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                                        raw_codec_video_m2m_process);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "failed to process M2M device data");
+                return ret;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static const struct esp_video_ops s_raw_codec_video_ops = {
+    .init           = raw_codec_video_init,
+    .deinit         = raw_codec_video_deinit,
+    .start          = raw_codec_video_start,
+    .stop           = raw_codec_video_stop,
+    .enum_format    = raw_codec_video_enum_format,
+    .set_format     = raw_codec_video_set_format,
+    .notify         = raw_codec_video_notify,
+};
+
+/**
+ * @brief Create lossless RAW codec video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_raw_codec_video_device(void)
+{
+    struct esp_video *video;
+    struct raw_codec_video *raw_codec_video;
+    uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
+    uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
+
+    raw_codec_video = heap_caps_calloc(1, sizeof(struct raw_codec_video), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    if (!raw_codec_video) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    video = esp_video_create(RAW_CODEC_NAME, ESP_VIDEO_RAW_CODEC_DEVICE_ID, &s_raw_codec_video_ops, raw_codec_video, caps, device_caps);
+    if (!video) {
+        heap_caps_free(raw_codec_video);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Destroy lossless RAW codec video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_raw_codec_video_device(void)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct raw_codec_video *raw_codec_video;
+
+    video = esp_video_device_get_object(RAW_CODEC_NAME);
+    if (!video) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    raw_codec_video = VIDEO_PRIV_DATA(struct raw_codec_video *, video);
+
+    ret = esp_video_destroy(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    heap_caps_free(raw_codec_video->line);
+    heap_caps_free(raw_codec_video);
+
+    return ESP_OK;
+}
@@ -15,6 +15,7 @@
 #include "esp_video.h"
 #include "esp_video_device_internal.h"
 #include "esp_video_cam.h"
+#include "esp_video_trace.h"
 
 #define SPI_NAME                        "SPI"
 
@@ -24,15 +25,14 @@
 #define SPI_MEM_CAPS                    (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
 #endif
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(x)                   sizeof(x) / sizeof((x)[0])
-#endif
-
 struct spi_video {
     cam_ctlr_color_t in_color;
     esp_cam_ctlr_handle_t cam_ctrl_handle;
     esp_video_cam_t cam;
     esp_video_spi_device_config_t spi_config;
+#if CONFIG_ESP_VIDEO_SPI_VIDEO_CONTINUOUS_RECEIVE
+    struct esp_video_buffer_element *element;   /*!< Element the next frame is received in, held by the driver */
+#endif
 };
 
 static const char *TAG = "spi_video";
@@ -99,7 +99,25 @@ static bool IRAM_ATTR spi_video_on_trans_finished(esp_cam_ctlr_handle_t handle,
 
     ESP_EARLY_LOGD(TAG, "size=%zu", trans->received_size);
 
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_END);
+
+#if CONFIG_ESP_VIDEO_SPI_VIDEO_CONTINUOUS_RECEIVE
+    struct spi_video *spi_video = VIDEO_PRIV_DATA(struct spi_video *, video);
+    struct esp_video_buffer_element *element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
+
+    /*
+     * The frame is only handed over once the next one has an element to go to,
+     * otherwise its element is received into again and the frame is lost.
+     */
+    if (element) {
+        spi_video->element = element;
+        CAPTURE_VIDEO_DONE_BUF(video, trans->buffer, trans->received_size);
+    } else {
+        CAPTURE_VIDEO_DROP_FRAME(video);
+    }
+#else
     CAPTURE_VIDEO_DONE_BUF(video, trans->buffer, trans->received_size);
+#endif
 
     return true;
 }
@@ -109,7 +127,18 @@ static bool IRAM_ATTR spi_video_on_get_new_trans(esp_cam_ctlr_handle_t handle, e
     struct esp_video_buffer_element *element;
     struct esp_video *video = (struct esp_video *)user_data;
 
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_FRAME_START);
+
+#if CONFIG_ESP_VIDEO_SPI_VIDEO_CONTINUOUS_RECEIVE
+    struct spi_video *spi_video = VIDEO_PRIV_DATA(struct spi_video *, video);
+
+    if (!spi_video->element) {
+        spi_video->element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
+    }
+    element = spi_video->element;
+#else
     element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
+#endif
     if (!element) {
         return false;
     }
@@ -162,6 +191,7 @@ static esp_err_t spi_video_init(struct esp_video *video)
 {
     struct spi_video *spi_video = VIDEO_PRIV_DATA(struct spi_video *, video);
 
+    esp_video_cam_flush_desc(&spi_video->cam);
     ESP_RETURN_ON_ERROR(esp_cam_sensor_set_format(spi_video->cam.sensor, NULL), TAG, "failed to set basic format");
     ESP_RETURN_ON_ERROR(init_config(video), TAG, "failed to initialize config");
 
@@ -191,6 +221,10 @@ static esp_err_t spi_video_start(struct esp_video *video, uint32_t type)
 
     ESP_RETURN_ON_ERROR(esp_cam_new_spi_ctlr(&spi_config, &spi_video->cam_ctrl_handle), TAG, "failed to create SPI");
 
+#if CONFIG_ESP_VIDEO_SPI_VIDEO_CONTINUOUS_RECEIVE
+    spi_video->element = NULL;
+#endif
+
     esp_cam_ctlr_evt_cbs_t cam_ctrl_cbs = {
         .on_get_new_trans = spi_video_on_get_new_trans,
         .on_trans_finished = spi_video_on_trans_finished
@@ -276,6 +310,7 @@ static esp_err_t spi_video_notify(struct esp_video *video, enum esp_video_event
             } else {
                 element->valid_size = 0;
             }
+            ELEMENT_SET_CPU_WRITTEN(element);
         }
     }
 
@@ -307,6 +342,7 @@ static esp_err_t spi_video_set_sensor_format(struct esp_video *video, const esp_
 {
     struct spi_video *spi_video = VIDEO_PRIV_DATA(struct spi_video *, video);
 
+    esp_video_cam_flush_desc(&spi_video->cam);
     ESP_RETURN_ON_ERROR(esp_cam_sensor_set_format(spi_video->cam.sensor, format), TAG, "failed to set customer format");
     ESP_RETURN_ON_ERROR(init_config(video), TAG, "failed to initialize config");
 
@@ -8,8 +8,11 @@
 // #define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
 
 #include <string.h>
+#include <math.h>
+#include <sys/param.h>
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -23,6 +26,7 @@
 #include "esp_video_device.h"
 #include "esp_video_device_internal.h"
 #include "esp_video_ioctl.h"
+#include "esp_video_usb_uvc_stats.h"
 
 #define UVC_NAME_PREFIX    "USB-UVC"
 
@@ -32,10 +36,17 @@
 #define FRAME_MEM_CAPS                  MALLOC_CAP_DEFAULT
 #endif
 
+/* Lent frames are read by DMA of the linked M2M device, they start at a cache line */
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+#define HOST_FRAME_MEM_CAPS             (FRAME_MEM_CAPS | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define HOST_FRAME_MEM_CAPS             FRAME_MEM_CAPS
+#endif
+
 #define UVC_DEVICE_INIT_TASK_STACK_SIZE (3 * 1024)
 #define UVC_DEVICE_INIT_TASK_PRIORITY   5
 
-#define UVC_DEVICE_FRAME_COUNT          3
+#define UVC_DEVICE_FRAME_COUNT          CONFIG_ESP_VIDEO_USB_UVC_FRAME_BUFFER_NUM
 
 #define UVC_DEVICE_URB_SIZE             (10 * 1024)
 #define UVC_DEVICE_URB_NUM              (4)
@@ -44,6 +55,9 @@
 
 #define UVC_INTERVAL_DENOMINATOR        (10 * 1000 * 1000)
 
+#define UVC_ISOC_MAX_PAYLOAD            (3 * 1024)      /* High-bandwidth isochronous endpoint, 3 transactions of 1024 bytes */
+#define UVC_BUS_BYTES_PER_SEC           (7500 * 8000)   /* High-speed microframe bytes, 8000 microframes per second */
+
 struct uvc_video {
     uvc_host_stream_hdl_t stream_hdl;
 
@@ -54,6 +68,20 @@ struct uvc_video {
     uint8_t *frame_info_fmt_index;
 
     SemaphoreHandle_t ready_sem;
+
+    /* Bus usage, guarded by the core lock */
+    bool streaming;                 /* Stream is started, its reservation counts */
+    uint32_t payload_size;          /* Negotiated dwMaxPayloadTransferSize */
+    uint32_t reserved;              /* Bytes reserved in each microframe, 0 for a bulk stream */
+    uint32_t frame_interval;        /* Negotiated frame interval in 100 ns units */
+    uint32_t frames;                /* Frames received since the stream started */
+    uint64_t bytes;                 /* Frame bytes received since the stream started */
+    int64_t start_us;               /* esp_timer time the stream started */
+
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+    uvc_host_frame_t *lent_frame[ESP_VIDEO_BUFFER_RING_SIZE]; /* Host frame each capture element borrows */
+    uint8_t *payload[ESP_VIDEO_BUFFER_RING_SIZE];            /* Own payload of each element borrowing a host frame */
+#endif
 };
 
 struct uvc_video_core {
@@ -109,18 +137,79 @@ static esp_err_t v4l2_to_uvc_format(uint32_t v4l2_format, enum uvc_host_stream_f
     }
 }
 
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+/* Only consumers reading the payload the dequeued buffer reports can be given a host frame */
+static bool uvc_can_lend_frame(struct esp_video *video, const uvc_host_frame_t *frame)
+{
+    struct esp_video_stream *stream = CAPTURE_VIDEO_STREAM(video);
+    uint32_t align_size;
+
+    if (stream->link) {
+        struct esp_video_stream *sink_stream = esp_video_get_stream(stream->link, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+
+        align_size = sink_stream->buffer->info.align_size;
+    } else if (stream->buffer->info.memory_type == V4L2_MEMORY_USERPTR) {
+        align_size = stream->buffer->info.align_size;
+    } else {
+        return false;
+    }
+
+    return !align_size || !((uintptr_t)frame->data % align_size);
+}
+
+/* Give the host frame an element borrows back to the UVC host driver */
+static void uvc_return_frame(struct uvc_video *device, struct esp_video_buffer_element *element)
+{
+    uvc_host_frame_t *frame = __atomic_exchange_n(&device->lent_frame[element->index], NULL, __ATOMIC_ACQ_REL);
+
+    if (frame) {
+        /* QBUF of a USERPTR buffer has already set the application payload */
+        if (ELEMENT_BUFFER(element) == frame->data) {
+            element->buffer = device->payload[element->index];
+        }
+        uvc_host_frame_return(device->stream_hdl, frame);
+    }
+}
+#endif
+
 static bool uvc_frame_callback(const uvc_host_frame_t *frame, void *user_ctx)
 {
     struct esp_video *video = (struct esp_video *)user_ctx;
+    struct uvc_video *device = VIDEO_PRIV_DATA(struct uvc_video *, video);
     struct esp_video_buffer_element *element;
 
+    portENTER_CRITICAL(&s_uvc_video_core->lock);
+    device->frames++;
+    device->bytes += frame->data_len;
+    portEXIT_CRITICAL(&s_uvc_video_core->lock);
+
     element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
     if (element) {
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+        /* An element recycled or skipped without QBUF still borrows its last frame */
+        uvc_return_frame(device, element);
+#endif
+
         if (frame->data_len > ELEMENT_SIZE(element)) {
             CAPTURE_VIDEO_SKIP_BUF(video, ELEMENT_BUFFER(element));
             ESP_EARLY_LOGE(TAG, "Frame data length is greater than element buffer size");
+            return true;
+        }
+
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+        if (uvc_can_lend_frame(video, frame)) {
+            device->payload[element->index] = ELEMENT_BUFFER(element);
+            element->buffer = frame->data;
+            __atomic_store_n(&device->lent_frame[element->index], (uvc_host_frame_t *)frame, __ATOMIC_RELEASE);
+
+            /* The host driver assembled the frame with the CPU */
+            ELEMENT_SET_CPU_WRITTEN(element);
+            CAPTURE_VIDEO_DONE_BUF(video, frame->data, frame->data_len);
+
+            /* Kept until the element is queued again */
             return false;
         }
+#endif
 
         memcpy(ELEMENT_BUFFER(element), frame->data, frame->data_len);
         CAPTURE_VIDEO_DONE_BUF(video, ELEMENT_BUFFER(element), frame->data_len);
@@ -141,6 +230,10 @@ static void uvc_event_callback(const uvc_host_stream_event_data_t *event, void *
 
         ESP_LOGD(TAG, "Device disconnected, dev_addr = %d, stream_index = %d", device->dev_addr, device->stream_index);
 
+        portENTER_CRITICAL(&s_uvc_video_core->lock);
+        device->streaming = false;
+        portEXIT_CRITICAL(&s_uvc_video_core->lock);
+
         device->dev_addr = 0;
         device->stream_index = 0;
         device->frame_info_num = 0;
@@ -259,7 +352,7 @@ static esp_err_t uvc_video_init(struct esp_video *video)
         .advanced = {
             .number_of_frame_buffers = UVC_DEVICE_FRAME_COUNT,
             .frame_size = 0,
-            .frame_heap_caps = FRAME_MEM_CAPS,
+            .frame_heap_caps = HOST_FRAME_MEM_CAPS,
             .number_of_urbs = UVC_DEVICE_URB_NUM,
             .urb_size = UVC_DEVICE_URB_SIZE,
         },
@@ -320,13 +413,136 @@ fail0:
     return ret;
 }
 
+/* Bytes per microframe reserved by the started streams, called with the core lock held */
+static uint32_t uvc_video_bus_reserved(struct uvc_video_core *core)
+{
+    uint32_t reserved = 0;
+
+    for (int i = 0; i < core->uvc_video_num; i++) {
+        if (core->uvc_video[i].streaming) {
+            reserved += core->uvc_video[i].reserved;
+        }
+    }
+
+    return reserved;
+}
+
+/* Next longer frame interval of the current format and resolution, false if there is none */
+static bool uvc_video_next_interval(struct uvc_video *device, const uvc_host_stream_format_t *format, uint32_t *interval)
+{
+    uint32_t current = *interval;
+    bool found = false;
+
+    for (int i = 0; i < device->frame_info_num; i++) {
+        const uvc_host_frame_info_t *info = &device->frame_info[i];
+
+        if ((info->format != format->format) || (info->h_res != format->h_res) || (info->v_res != format->v_res)) {
+            continue;
+        }
+
+        if (!info->interval_type) {
+            if (info->interval_step && (current + info->interval_step <= info->interval_max)) {
+                *interval = current + info->interval_step;
+                found = true;
+            }
+        } else {
+            int num = MIN(info->interval_type, CONFIG_UVC_INTERVAL_ARRAY_SIZE);
+
+            for (int j = 0; j < num; j++) {
+                if ((info->interval[j] > current) && (!found || (info->interval[j] < *interval))) {
+                    *interval = info->interval[j];
+                    found = true;
+                }
+            }
+        }
+        break;
+    }
+
+    return found;
+}
+
+/**
+ * The UVC host driver picks the alternate setting of the streaming interface
+ * from the payload the camera asks for in the probe and commit negotiation.
+ * The isochronous payloads of all started streams share the periodic part of
+ * each microframe, so the frame interval is lengthened until this one fits.
+ * A payload too large for an isochronous endpoint is a bulk stream, it gets
+ * what the periodic transfers leave and reserves nothing.
+ */
+static esp_err_t uvc_video_reserve_bandwidth(struct uvc_video *device)
+{
+    struct uvc_video_core *core = s_uvc_video_core;
+    uvc_host_stream_format_t format;
+    uvc_host_buf_info_t buf_info;
+    uint32_t interval;
+    bool fits;
+
+    ESP_RETURN_ON_ERROR(uvc_host_stream_format_get(device->stream_hdl, &format), TAG, "Failed to get UVC format");
+    ESP_RETURN_ON_FALSE(format.fps > 0.0, ESP_ERR_INVALID_STATE, TAG, "Invalid FPS");
+    interval = lroundf(UVC_INTERVAL_DENOMINATOR / format.fps);
+
+    while (true) {
+        ESP_RETURN_ON_ERROR(uvc_host_buf_info_get(device->stream_hdl, &buf_info), TAG, "Failed to get UVC buffer info");
+
+        uint32_t reserve = buf_info.dwMaxPayloadTransferSize <= UVC_ISOC_MAX_PAYLOAD ? buf_info.dwMaxPayloadTransferSize : 0;
+        uint32_t reserved;
+
+        portENTER_CRITICAL(&core->lock);
+        reserved = uvc_video_bus_reserved(core);
+        fits = reserved + reserve <= CONFIG_ESP_VIDEO_USB_UVC_ISOC_BUDGET;
+        if (fits) {
+            device->payload_size = buf_info.dwMaxPayloadTransferSize;
+            device->reserved = reserve;
+            device->frame_interval = interval;
+            device->frames = 0;
+            device->bytes = 0;
+            device->start_us = esp_timer_get_time();
+            device->streaming = true;
+        }
+        portEXIT_CRITICAL(&core->lock);
+
+        if (fits) {
+            return ESP_OK;
+        }
+
+        ESP_RETURN_ON_FALSE(uvc_video_next_interval(device, &format, &interval), ESP_ERR_NOT_SUPPORTED, TAG,
+                            "Payload %" PRIu32 " does not fit beside %" PRIu32 " reserved bytes per microframe",
+                            buf_info.dwMaxPayloadTransferSize, reserved);
+        ESP_LOGW(TAG, "Payload %" PRIu32 " does not fit beside %" PRIu32 " reserved bytes per microframe, trying frame interval %" PRIu32,
+                 buf_info.dwMaxPayloadTransferSize, reserved, interval);
+
+        uvc_host_stream_format_t f = {
+            .h_res = 0,  // 0 means do not change resolution
+            .v_res = 0,
+            .fps = (float)UVC_INTERVAL_DENOMINATOR / (float)interval,
+            .format = 0, // 0 means do not change format
+        };
+        ESP_RETURN_ON_ERROR(uvc_host_stream_format_select(device->stream_hdl, &f), TAG, "Failed to set UVC format");
+    }
+}
+
+static void uvc_video_release_bandwidth(struct uvc_video *device)
+{
+    portENTER_CRITICAL(&s_uvc_video_core->lock);
+    device->streaming = false;
+    portEXIT_CRITICAL(&s_uvc_video_core->lock);
+}
+
 static esp_err_t uvc_video_start(struct esp_video *video, uint32_t type)
 {
+    esp_err_t ret;
     struct uvc_video *device = VIDEO_PRIV_DATA(struct uvc_video *, video);
 
     ESP_RETURN_ON_FALSE(device->dev_addr, ESP_ERR_NOT_FOUND, TAG, "UVC device=%p is not connected", device);
 
-    ESP_RETURN_ON_ERROR(uvc_host_stream_start(device->stream_hdl), TAG, "Failed to start UVC stream");
+    ESP_RETURN_ON_ERROR(uvc_video_reserve_bandwidth(device), TAG, "Failed to reserve USB bandwidth");
+
+    ret = uvc_host_stream_start(device->stream_hdl);
+    if (ret != ESP_OK) {
+        uvc_video_release_bandwidth(device);
+        ESP_LOGE(TAG, "Failed to start UVC stream");
+        return ret;
+    }
 
     return ESP_OK;
 }
@@ -338,6 +554,16 @@ static esp_err_t uvc_video_stop(struct esp_video *video, uint32_t type)
     ESP_RETURN_ON_FALSE(device->dev_addr, ESP_ERR_NOT_FOUND, TAG, "UVC device=%p is not connected", device);
 
     ESP_RETURN_ON_ERROR(uvc_host_stream_stop(device->stream_hdl), TAG, "Failed to stop UVC stream");
+    uvc_video_release_bandwidth(device);
+
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+    /* Stopping takes all elements back, with the frames they borrow */
+    struct esp_video_buffer *buffer = CAPTURE_VIDEO_STREAM(video)->buffer;
+
+    for (int i = 0; i < buffer->info.count; i++) {
+        uvc_return_frame(device, ESP_VIDEO_BUFFER_ELEMENT(buffer, i));
+    }
+#endif
 
     return ESP_OK;
 }
@@ -422,6 +648,12 @@ static esp_err_t uvc_video_set_format(struct esp_video *video, const struct v4l2
 
 static esp_err_t uvc_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
 {
+#if CONFIG_ESP_VIDEO_USB_UVC_ZERO_COPY
+    if (event == ESP_VIDEO_BUFFER_QUEUED) {
+        uvc_return_frame(VIDEO_PRIV_DATA(struct uvc_video *, video), (struct esp_video_buffer_element *)arg);
+    }
+#endif
+
     return ESP_OK;
 }
 
@@ -636,3 +868,49 @@ esp_err_t esp_video_uninstall_usb_uvc_driver(void)
 
     return uvc_host_uninstall();
 }
+
+esp_err_t esp_video_usb_uvc_get_bus_stats(esp_video_usb_uvc_bus_stats_t *stats)
+{
+    struct uvc_video_core *core = s_uvc_video_core;
+    int64_t now_us = esp_timer_get_time();
+    uint64_t bytes_per_sec = 0;
+
+    ESP_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG, "stats is NULL");
+    ESP_RETURN_ON_FALSE(core, ESP_ERR_INVALID_STATE, TAG, "USB UVC driver is not installed");
+
+    memset(stats, 0, sizeof(*stats));
+    stats->budget = CONFIG_ESP_VIDEO_USB_UVC_ISOC_BUDGET;
+    stats->stream_num = core->uvc_video_num;
+
+    for (int i = 0; i < core->uvc_video_num; i++) {
+        struct uvc_video *device = &core->uvc_video[i];
+        esp_video_usb_uvc_stream_stats_t *stream = &stats->stream[i];
+        int64_t start_us;
+
+        portENTER_CRITICAL(&core->lock);
+        stream->dev_addr = device->dev_addr;
+        stream->streaming = device->streaming;
+        stream->isochronous = device->payload_size && device->payload_size <= UVC_ISOC_MAX_PAYLOAD;
+        stream->payload_size = device->payload_size;
+        stream->reserved = device->reserved;
+        stream->frame_interval = device->frame_interval;
+        stream->frames = device->frames;
+        stream->bytes = device->bytes;
+        start_us = device->start_us;
+        portEXIT_CRITICAL(&core->lock);
+
+        if (now_us > start_us) {
+            stream->bytes_per_sec = stream->bytes * 1000000 / (now_us - start_us);
+        }
+
+        if (stream->streaming) {
+            stats->reserved += stream->reserved;
+            bytes_per_sec += stream->bytes_per_sec;
+        }
+    }
+
+    stats->bytes_per_sec = bytes_per_sec;
+    stats->load_permille = bytes_per_sec * 1000 / UVC_BUS_BYTES_PER_SEC;
+
+    return ESP_OK;
+}
@@ -0,0 +1,586 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+/*
+ * Virtual capture video device
+ *
+ * Produces frames at the configured rate without camera hardware, either a
+ * test pattern or the frames of a RAW file replayed in a loop. An esp_timer
+ * marks the frame times, which become the frame timestamps, and a task
+ * fills the queued buffer, so the timing does not depend on how long the
+ * fill takes. Periods the task could not serve, e.g. because the file
+ * system was slow, are counted as dropped frames like a sensor would lose
+ * them.
+ *
+ * The pattern frame is rendered once at stream start, each frame copies it
+ * and draws a white bar that moves one step per frame over it.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_private/esp_cache_private.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_video.h"
+#include "esp_video_device_internal.h"
+
+#define VIRTUAL_NAME                    "VIRTUAL"
+
+#if CONFIG_SPIRAM
+#define VIRTUAL_MEM_CAPS                (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED)
+#else
+#define VIRTUAL_MEM_CAPS                (MALLOC_CAP_8BIT | MALLOC_CAP_DMA)
+#endif
+
+#define VIRTUAL_TASK_STACK_SIZE         (3 * 1024)
+#define VIRTUAL_TASK_PRIORITY           10
+
+#define VIRTUAL_BAR_WIDTH               16      /* Moving bar width in pixels */
+#define VIRTUAL_BAR_STEP                4       /* Pixels the bar moves per frame */
+
+#define VIRTUAL_VALUE_MAX               4095    /* Pattern colors are 12-bit, the widest supported sample */
+#define VIRTUAL_VALUE_BAR               3071    /* 75% color bars */
+
+enum virtual_kind {
+    VIRTUAL_KIND_BAYER,
+    VIRTUAL_KIND_GREY,
+    VIRTUAL_KIND_RGB565,
+    VIRTUAL_KIND_RGB24,
+    VIRTUAL_KIND_YUYV,
+};
+
+struct virtual_format {
+    uint32_t pixel_format;
+    uint8_t bpp;
+    uint8_t kind;
+    uint8_t cfa[4];                     /* Color channel, 0 R, 1 G and 2 B, of the even and odd pixels of the even and odd rows */
+};
+
+static const struct virtual_format s_virtual_format[] = {
+    {V4L2_PIX_FMT_SBGGR8,   8,  VIRTUAL_KIND_BAYER,  {2, 1, 1, 0}},
+    {V4L2_PIX_FMT_SGBRG8,   8,  VIRTUAL_KIND_BAYER,  {1, 2, 0, 1}},
+    {V4L2_PIX_FMT_SGRBG8,   8,  VIRTUAL_KIND_BAYER,  {1, 0, 2, 1}},
+    {V4L2_PIX_FMT_SRGGB8,   8,  VIRTUAL_KIND_BAYER,  {0, 1, 1, 2}},
+    {V4L2_PIX_FMT_SBGGR10,  10, VIRTUAL_KIND_BAYER,  {2, 1, 1, 0}},
+    {V4L2_PIX_FMT_SBGGR12,  12, VIRTUAL_KIND_BAYER,  {2, 1, 1, 0}},
+    {V4L2_PIX_FMT_GREY,     8,  VIRTUAL_KIND_GREY},
+    {V4L2_PIX_FMT_RGB565,   16, VIRTUAL_KIND_RGB565},
+    {V4L2_PIX_FMT_RGB24,    24, VIRTUAL_KIND_RGB24},
+    {V4L2_PIX_FMT_YUV422P,  16, VIRTUAL_KIND_YUYV},
+};
+
+struct virtual_video {
+    esp_video_init_virtual_config_t config;
+    char *file_path;                    /* Copy of config.file_path */
+    const struct virtual_format *format;
+    uint32_t line_size;
+    uint32_t frame_size;
+
+    uint8_t *pattern;                   /* Rendered pattern, NULL when replaying a file */
+    int fd;                             /* Replayed file, -1 if none */
+    uint32_t frames;                    /* Frame periods since the stream started, moves the bar */
+
+    esp_timer_handle_t timer;
+    TaskHandle_t task;
+    SemaphoreHandle_t mutex;            /* Held by the task while it fills a frame */
+    SemaphoreHandle_t exit_sem;
+    bool run;                           /* Stream is started, guarded by mutex */
+    volatile bool exit;
+
+    portMUX_TYPE lock;
+    int64_t tick_us;                    /* Time of the latest frame period, guarded by lock */
+};
+
+static const char *TAG = "virtual_video";
+
+static const struct virtual_format *virtual_get_format(uint32_t pixel_format)
+{
+    for (int i = 0; i < ARRAY_SIZE(s_virtual_format); i++) {
+        if (s_virtual_format[i].pixel_format == pixel_format) {
+            return &s_virtual_format[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* 12-bit R, G and B of a pattern pixel */
+static void virtual_pattern_color(const struct virtual_video *virtual_video, uint32_t x, bool bar, uint16_t *rgb)
+{
+    /* White, yellow, cyan, green, magenta, red, blue and black, bit 0 is R */
+    static const uint8_t color_bars[] = {7, 3, 6, 2, 5, 1, 4, 0};
+    uint32_t width = virtual_video->config.width;
+
+    if (bar) {
+        rgb[0] = rgb[1] = rgb[2] = VIRTUAL_VALUE_MAX;
+    } else if (virtual_video->config.pattern == ESP_VIDEO_VIRTUAL_PATTERN_GRADIENT) {
+        rgb[0] = rgb[1] = rgb[2] = x * VIRTUAL_VALUE_MAX / (width - 1);
+    } else {
+        uint8_t color = color_bars[x * ARRAY_SIZE(color_bars) / width];
+
+        for (int i = 0; i < 3; i++) {
+            rgb[i] = color & (1 << i) ? VIRTUAL_VALUE_BAR : 0;
+        }
+    }
+}
+
+/*
+ * Render pixels [x0, x1) of line y. x0 and x1 are multiples of 4, the
+ * largest group of pixels a format packs together.
+ */
+static void virtual_render_span(const struct virtual_video *virtual_video, uint8_t *frame, uint32_t y, uint32_t x0, uint32_t x1, bool bar)
+{
+    const struct virtual_format *format = virtual_video->format;
+    uint8_t *line = frame + y * virtual_video->line_size;
+
+    for (uint32_t x = x0; x < x1; x += 4) {
+        uint16_t rgb[4][3];
+        uint16_t v[4];
+
+        for (int i = 0; i < 4; i++) {
+            virtual_pattern_color(virtual_video, x + i, bar, rgb[i]);
+        }
+
+        switch (format->kind) {
+        case VIRTUAL_KIND_BAYER:
+            for (int i = 0; i < 4; i++) {
+                v[i] = rgb[i][format->cfa[(y & 1) * 2 + ((x + i) & 1)]];
+            }
+
+            if (format->bpp == 8) {
+                for (int i = 0; i < 4; i++) {
+                    line[x + i] = v[i] >> 4;
+                }
+            } else if (format->bpp == 10) {
+                /* MIPI packed, the high bits of 4 pixels then their low bits */
+                uint8_t *p = line + x / 4 * 5;
+
+                for (int i = 0; i < 4; i++) {
+                    v[i] >>= 2;
+                    p[i] = v[i] >> 2;
+                }
+                p[4] = (v[0] & 3) | ((v[1] & 3) << 2) | ((v[2] & 3) << 4) | ((v[3] & 3) << 6);
+            } else {
+                /* MIPI packed, the high bits of 2 pixels then their low bits */
+                uint8_t *p = line + x / 2 * 3;
+
+                for (int i = 0; i < 4; i += 2) {
+                    p[0] = v[i] >> 4;
+                    p[1] = v[i + 1] >> 4;
+                    p[2] = (v[i] & 0xf) | ((v[i + 1] & 0xf) << 4);
+                    p += 3;
+                }
+            }
+            break;
+        case VIRTUAL_KIND_GREY:
+            for (int i = 0; i < 4; i++) {
+                line[x + i] = (rgb[i][0] * 77 + rgb[i][1] * 150 + rgb[i][2] * 29) >> 12;
+            }
+            break;
+        case VIRTUAL_KIND_RGB565:
+            for (int i = 0; i < 4; i++) {
+                uint16_t pixel = ((rgb[i][0] >> 7) << 11) | ((rgb[i][1] >> 6) << 5) | (rgb[i][2] >> 7);
+
+                line[(x + i) * 2] = pixel & 0xff;
+                line[(x + i) * 2 + 1] = pixel >> 8;
+            }
+            break;
+        case VIRTUAL_KIND_RGB24:
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 3; j++) {
+                    line[(x + i) * 3 + j] = rgb[i][j] >> 4;
+                }
+            }
+            break;
+        case VIRTUAL_KIND_YUYV:
+            /* BT.601 limited range, the chroma of a pair is that of its first pixel */
+            for (int i = 0; i < 4; i++) {
+                int r = rgb[i][0] >> 4;
+                int g = rgb[i][1] >> 4;
+                int b = rgb[i][2] >> 4;
+                uint8_t *p = line + (x + i) * 2;
+
+                p[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+                if (!(i & 1)) {
+                    p[1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+                } else {
+                    int r0 = rgb[i - 1][0] >> 4;
+                    int g0 = rgb[i - 1][1] >> 4;
+                    int b0 = rgb[i - 1][2] >> 4;
+
+                    p[1] = ((112 * r0 - 94 * g0 - 18 * b0 + 128) >> 8) + 128;
+                }
+            }
+            break;
+        }
+    }
+}
+
+static esp_err_t virtual_read_frame(struct virtual_video *virtual_video, uint8_t *buffer)
+{
+    uint32_t size = 0;
+    bool rewound = false;
+
+    while (size < virtual_video->frame_size) {
+        ssize_t n = read(virtual_video->fd, buffer + size, virtual_video->frame_size - size);
+
+        if (n < 0) {
+            return ESP_FAIL;
+        } else if (n == 0) {
+            /* Replay from the start, a partial frame at the end of the file is skipped */
+            if (rewound || lseek(virtual_video->fd, 0, SEEK_SET) != 0) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            rewound = true;
+            size = 0;
+        } else {
+            size += n;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t virtual_fill_frame(struct virtual_video *virtual_video, uint8_t *buffer)
+{
+    if (virtual_video->fd >= 0) {
+        return virtual_read_frame(virtual_video, buffer);
+    }
+
+    uint32_t travel = virtual_video->config.width - VIRTUAL_BAR_WIDTH;
+    uint32_t x = virtual_video->frames * VIRTUAL_BAR_STEP % travel / 4 * 4;
+
+    memcpy(buffer, virtual_video->pattern, virtual_video->frame_size);
+    for (uint32_t y = 0; y < virtual_video->config.height; y++) {
+        virtual_render_span(virtual_video, buffer, y, x, x + VIRTUAL_BAR_WIDTH, true);
+    }
+
+    return ESP_OK;
+}
+
+static void virtual_video_timer(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+
+    portENTER_CRITICAL(&virtual_video->lock);
+    virtual_video->tick_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&virtual_video->lock);
+
+    xTaskNotifyGive(virtual_video->task);
+}
+
+static void virtual_video_produce(struct esp_video *video, uint32_t periods)
+{
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+    struct esp_video_buffer_element *element;
+    int64_t timestamp_us;
+
+    portENTER_CRITICAL(&virtual_video->lock);
+    timestamp_us = virtual_video->tick_us;
+    portEXIT_CRITICAL(&virtual_video->lock);
+
+    /* Only the latest of the periods the task was late for gets a frame */
+    for (uint32_t i = 1; i < periods; i++) {
+        CAPTURE_VIDEO_DROP_FRAME(video);
+    }
+    virtual_video->frames += periods;
+
+    element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
+    if (!element) {
+        CAPTURE_VIDEO_DROP_FRAME(video);
+        return;
+    }
+
+    if (virtual_fill_frame(virtual_video, element->buffer) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to read frame from %s", virtual_video->file_path);
+        CAPTURE_VIDEO_SKIP_BUF(video, element->buffer);
+        CAPTURE_VIDEO_DROP_FRAME(video);
+        return;
+    }
+
+    ELEMENT_SET_CPU_WRITTEN(element);
+    CAPTURE_VIDEO_DONE_BUF_TIMESTAMP(video, element->buffer, virtual_video->frame_size, timestamp_us);
+}
+
+static void virtual_video_task(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+
+    while (1) {
+        uint32_t periods = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (virtual_video->exit) {
+            break;
+        }
+
+        /* A period that fires while the stream stops is ignored */
+        xSemaphoreTake(virtual_video->mutex, portMAX_DELAY);
+        if (virtual_video->run) {
+            virtual_video_produce(video, periods);
+        }
+        xSemaphoreGive(virtual_video->mutex);
+    }
+
+    xSemaphoreGive(virtual_video->exit_sem);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t virtual_video_init(struct esp_video *video)
+{
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+    size_t alignments = 0;
+
+#if CONFIG_SPIRAM
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(VIRTUAL_MEM_CAPS, &alignments), TAG, "failed to get cache alignment");
+#else
+    alignments = 4;
+#endif
+
+    CAPTURE_VIDEO_SET_FORMAT(video,
+                             virtual_video->config.width,
+                             virtual_video->config.height,
+                             virtual_video->config.pixel_format);
+    CAPTURE_VIDEO_SET_BUF_INFO(video, virtual_video->frame_size, alignments, VIRTUAL_MEM_CAPS);
+
+    return ESP_OK;
+}
+
+static void virtual_video_release_source(struct virtual_video *virtual_video)
+{
+    if (virtual_video->fd >= 0) {
+        close(virtual_video->fd);
+        virtual_video->fd = -1;
+    }
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, virtual_video->pattern, virtual_video->frame_size);
+    heap_caps_free(virtual_video->pattern);
+    virtual_video->pattern = NULL;
+}
+
+static esp_err_t virtual_video_start(struct esp_video *video, uint32_t type)
+{
+    esp_err_t ret;
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+    const esp_video_init_virtual_config_t *config = &virtual_video->config;
+
+    if (virtual_video->file_path) {
+        virtual_video->fd = open(virtual_video->file_path, O_RDONLY);
+        ESP_RETURN_ON_FALSE(virtual_video->fd >= 0, ESP_ERR_NOT_FOUND, TAG, "failed to open %s", virtual_video->file_path);
+    } else {
+        virtual_video->pattern = heap_caps_malloc(virtual_video->frame_size, VIRTUAL_MEM_CAPS);
+        ESP_RETURN_ON_FALSE(virtual_video->pattern, ESP_ERR_NO_MEM, TAG, "failed to allocate pattern frame");
+        VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, virtual_video->pattern, virtual_video->frame_size);
+
+        for (uint32_t y = 0; y < config->height; y++) {
+            virtual_render_span(virtual_video, virtual_video->pattern, y, 0, config->width, false);
+        }
+    }
+
+    /* Periods of the previous stream are not owed frames */
+    ulTaskNotifyValueClear(virtual_video->task, UINT32_MAX);
+    virtual_video->frames = 0;
+    virtual_video->run = true;
+
+    ret = esp_timer_start_periodic(virtual_video->timer, 1000 * 1000 / config->fps);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to start timer");
+        virtual_video->run = false;
+        virtual_video_release_source(virtual_video);
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t virtual_video_stop(struct esp_video *video, uint32_t type)
+{
+    struct virtual_video *virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+
+    esp_timer_stop(virtual_video->timer);
+
+    /* Wait for the frame being filled */
+    xSemaphoreTake(virtual_video->mutex, portMAX_DELAY);
+    virtual_video->run = false;
+    xSemaphoreGive(virtual_video->mutex);
+
+    virtual_video_release_source(virtual_video);
+
+    return ESP_OK;
+}
+
+static esp_err_t virtual_video_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (index > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *pixel_format = CAPTURE_VIDEO_GET_FORMAT_PIXEL_FORMAT(video);
+
+    return ESP_OK;
+}
+
+static esp_err_t virtual_video_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+
+    /* The format is the configured one, as a sensor only has the format it was set up with */
+    if ((pix->width != CAPTURE_VIDEO_GET_FORMAT_WIDTH(video)) ||
+            (pix->height != CAPTURE_VIDEO_GET_FORMAT_HEIGHT(video)) ||
+            (pix->pixelformat != CAPTURE_VIDEO_GET_FORMAT_PIXEL_FORMAT(video))) {
+        ESP_LOGE(TAG, "format is not the configured one");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t virtual_video_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    return ESP_OK;
+}
+
+static const struct esp_video_ops s_virtual_video_ops = {
+    .init           = virtual_video_init,
+    .start          = virtual_video_start,
+    .stop           = virtual_video_stop,
+    .enum_format    = virtual_video_enum_format,
+    .set_format     = virtual_video_set_format,
+    .notify         = virtual_video_notify,
+};
+
+/**
+ * @brief Create virtual capture video device
+ *
+ * @param config Frame format, rate and source
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_create_virtual_video_device(const esp_video_init_virtual_config_t *config)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct virtual_video *virtual_video;
+    const struct virtual_format *format;
+    uint32_t device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_EXT_PIX_FORMAT | V4L2_CAP_STREAMING;
+    uint32_t caps = device_caps | V4L2_CAP_DEVICE_CAPS;
+
+    ESP_RETURN_ON_FALSE(config, ESP_ERR_INVALID_ARG, TAG, "config is NULL");
+    format = virtual_get_format(config->pixel_format);
+    ESP_RETURN_ON_FALSE(format, ESP_ERR_NOT_SUPPORTED, TAG, "pixel format is not supported");
+    ESP_RETURN_ON_FALSE(config->width >= 2 * VIRTUAL_BAR_WIDTH && !(config->width % 4) && config->height &&
+                        config->fps, ESP_ERR_INVALID_ARG, TAG, "width, height or fps is invalid");
+
+    virtual_video = heap_caps_calloc(1, sizeof(struct virtual_video), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    ESP_RETURN_ON_FALSE(virtual_video, ESP_ERR_NO_MEM, TAG, "failed to allocate virtual video");
+
+    virtual_video->config = *config;
+    virtual_video->format = format;
+    virtual_video->line_size = config->width * format->bpp / 8;
+    virtual_video->frame_size = virtual_video->line_size * config->height;
+    virtual_video->fd = -1;
+    portMUX_INITIALIZE(&virtual_video->lock);
+
+    if (config->file_path) {
+        virtual_video->file_path = strdup(config->file_path);
+        ESP_GOTO_ON_FALSE(virtual_video->file_path, ESP_ERR_NO_MEM, fail_0, TAG, "failed to copy file path");
+    }
+    virtual_video->config.file_path = virtual_video->file_path;
+
+    virtual_video->mutex = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(virtual_video->mutex, ESP_ERR_NO_MEM, fail_1, TAG, "failed to create mutex");
+    virtual_video->exit_sem = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(virtual_video->exit_sem, ESP_ERR_NO_MEM, fail_2, TAG, "failed to create semaphore");
+
+    video = esp_video_create(VIRTUAL_NAME, ESP_VIDEO_VIRTUAL_DEVICE_ID, &s_virtual_video_ops, virtual_video, caps, device_caps);
+    ESP_GOTO_ON_FALSE(video, ESP_FAIL, fail_3, TAG, "failed to create video device");
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = virtual_video_timer,
+        .arg = video,
+        .name = "virtual_video",
+    };
+    ESP_GOTO_ON_ERROR(esp_timer_create(&timer_args, &virtual_video->timer), fail_4, TAG, "failed to create timer");
+
+    if (xTaskCreatePinnedToCore(virtual_video_task, "virtual_video",
+                                config->task_stack ? config->task_stack : VIRTUAL_TASK_STACK_SIZE,
+                                video,
+                                config->task_priority ? config->task_priority : VIRTUAL_TASK_PRIORITY,
+                                &virtual_video->task,
+                                config->task_affinity >= 0 ? config->task_affinity : tskNO_AFFINITY) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create task");
+        ret = ESP_ERR_NO_MEM;
+        goto fail_5;
+    }
+
+    return ESP_OK;
+
+fail_5:
+    esp_timer_delete(virtual_video->timer);
+fail_4:
+    esp_video_destroy(video);
+fail_3:
+    vSemaphoreDelete(virtual_video->exit_sem);
+fail_2:
+    vSemaphoreDelete(virtual_video->mutex);
+fail_1:
+    free(virtual_video->file_path);
+fail_0:
+    heap_caps_free(virtual_video);
+    return ret;
+}
+
+/**
+ * @brief Destroy virtual capture video device
+ *
+ * @param None
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if the device was not created
+ *      - Others if failed
+ */
+esp_err_t esp_video_destroy_virtual_video_device(void)
+{
+    esp_err_t ret;
+    struct esp_video *video;
+    struct virtual_video *virtual_video;
+
+    video = esp_video_device_get_object(VIRTUAL_NAME);
+    if (!video) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    virtual_video = VIDEO_PRIV_DATA(struct virtual_video *, video);
+
+    ret = esp_video_destroy(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    esp_timer_delete(virtual_video->timer);
+
+    virtual_video->exit = true;
+    xTaskNotifyGive(virtual_video->task);
+    xSemaphoreTake(virtual_video->exit_sem, portMAX_DELAY);
+
+    vSemaphoreDelete(virtual_video->exit_sem);
+    vSemaphoreDelete(virtual_video->mutex);
+    free(virtual_video->file_path);
+    heap_caps_free(virtual_video);
+
+    return ESP_OK;
+}
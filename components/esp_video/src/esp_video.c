@@ -11,8 +11,13 @@
 #include "esp_check.h"
 #include "esp_memory_utils.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+#include "esp_cache.h"
+#endif
 #include "esp_video.h"
 #include "esp_video_vfs.h"
+#include "esp_video_trace.h"
 #include "esp_video_device.h"
 #include "esp_cam_sensor.h"
 
@@ -20,6 +25,20 @@
 
 #define ALLOC_RAM_ATTR (MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL)
 
+#define READ_BUFFER_COUNT           CONFIG_ESP_VIDEO_READ_BUFFER_COUNT
+
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+#define M2M_WORKER_TASK_NAME        "video_m2m"
+#if CONFIG_ESP_VIDEO_M2M_WORKER_TASK_CORE >= 0
+#define M2M_WORKER_TASK_CORE        CONFIG_ESP_VIDEO_M2M_WORKER_TASK_CORE
+#else
+#define M2M_WORKER_TASK_CORE        tskNO_AFFINITY
+#endif
+#define M2M_WORKER_RUNNING(v)       ((v)->m2m_worker != NULL)
+#else
+#define M2M_WORKER_RUNNING(v)       false
+#endif
+
 #if CONFIG_ESP_VIDEO_CHECK_PARAMETERS
 #define CHECK_VIDEO_OBJ(v)                                  \
 {                                                           \
@@ -133,6 +152,47 @@ uint32_t esp_video_get_buffer_type_bits(struct esp_video *video)
     return buffer_type_bits;
 }
 
+/**
+ * @brief Get the events a poll or select on the video device reports.
+ *
+ * @param video Video object
+ *
+ * @return ESP_VIDEO_POLL_XXX event bits
+ */
+uint32_t IRAM_ATTR esp_video_get_poll_events(struct esp_video *video)
+{
+    uint32_t index;
+    uint32_t events = 0;
+    struct esp_video_stream *stream;
+
+    if (!video->stream) {
+        return 0;
+    }
+
+    if (video->caps & V4L2_CAP_VIDEO_M2M) {
+        struct esp_video_stream *capture = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+        struct esp_video_stream *output = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+
+        /* Capture DQBUF triggers the processing, so a queued pair is as good as a done one, unless a worker does it */
+        if (esp_video_buffer_ring_peek(&capture->done_ring, &index) ||
+                (!M2M_WORKER_RUNNING(video) &&
+                 esp_video_buffer_ring_peek(&capture->queued_ring, &index) &&
+                 esp_video_buffer_ring_peek(&output->queued_ring, &index))) {
+            events |= ESP_VIDEO_POLL_IN;
+        }
+        if (esp_video_buffer_ring_peek(&output->done_ring, &index)) {
+            events |= ESP_VIDEO_POLL_OUT;
+        }
+    } else {
+        stream = video->stream;
+        if (esp_video_buffer_ring_peek(&stream->done_ring, &index)) {
+            events |= video->caps & V4L2_CAP_VIDEO_OUTPUT ? ESP_VIDEO_POLL_OUT : ESP_VIDEO_POLL_IN;
+        }
+    }
+
+    return events;
+}
+
 /**
  * @brief Set video stream buffer
  *
@@ -234,6 +294,50 @@ struct esp_video_stream *IRAM_ATTR esp_video_get_stream(struct esp_video *video,
     return stream;
 }
 
+/**
+ * @brief Get the sensor settings a frame was captured with.
+ *
+ * @param video    Video object
+ * @param stream   Video stream object
+ * @param sequence Sequence number of the frame
+ * @param settings Sensor settings buffer pointer
+ *
+ * @return None
+ */
+static void IRAM_ATTR esp_video_sensor_settings_at(struct esp_video *video, struct esp_video_stream *stream,
+                                                   uint32_t sequence, int64_t timestamp_us,
+                                                   struct esp_video_sensor_settings *settings)
+{
+    struct esp_video_sensor_track *track = &stream->sensor;
+    int n = 0;
+
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    while (n < track->pending_num && (int32_t)(sequence - track->pending[n].sequence) >= 0) {
+        track->current = track->pending[n].settings;
+        n++;
+    }
+    if (n) {
+        for (int i = n; i < track->pending_num; i++) {
+            track->pending[i - n] = track->pending[i];
+        }
+        track->pending_num -= n;
+    }
+    *settings = track->current;
+    /* A request is fulfilled by the first frame with its settings only */
+    track->current.flags &= ~ESP_VIDEO_FRAME_META_REQUEST;
+    if (track->trigger_us) {
+        settings->flags |= ESP_VIDEO_FRAME_META_TRIGGER;
+        settings->trigger_us = track->trigger_us;
+        track->trigger_us = 0;
+    }
+    /* The frame was read out since the previous one was done */
+    if (track->lens_start_us && track->lens_start_us < timestamp_us && track->lens_end_us > track->frame_end_us) {
+        settings->flags |= ESP_VIDEO_FRAME_META_LENS_MOVING;
+    }
+    track->frame_end_us = timestamp_us;
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+}
+
 /**
  * @brief Get video object by name
  *
@@ -258,6 +362,28 @@ struct esp_video *esp_video_device_get_object(const char *name)
     return NULL;
 }
 
+/**
+ * @brief Get video object by ID
+ *
+ * @param id The video device ID, which is also its VFS file descriptor
+ *
+ * @return Video object pointer if found by ID
+ */
+struct esp_video *esp_video_device_get_object_by_id(uint8_t id)
+{
+    struct esp_video *video;
+
+    _lock_acquire(&s_video_lock);
+    SLIST_FOREACH(video, &s_video_list, node) {
+        if (video->id == id) {
+            break;
+        }
+    }
+    _lock_release(&s_video_lock);
+
+    return video;
+}
+
 #if CONFIG_ESP_VIDEO_CHECK_PARAMETERS
 /**
  * @brief Check if video is valid
@@ -386,6 +512,9 @@ struct esp_video *esp_video_create(const char *name, uint8_t id, const struct es
         goto exit_3;
     }
 
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, video, size);
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_DEVICE, video->stream, stream_count * sizeof(struct esp_video_stream));
+
     _lock_release(&s_video_lock);
     return video;
 
@@ -430,6 +559,10 @@ esp_err_t esp_video_destroy(struct esp_video *video)
     SLIST_REMOVE(&s_video_list, video, esp_video, node);
     _lock_release(&s_video_lock);
 
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, video->stream,
+                     (video->caps & V4L2_CAP_VIDEO_M2M ? 2 : 1) * sizeof(struct esp_video_stream));
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_DEVICE, video, sizeof(struct esp_video) + strlen(video->dev_name) + 1);
+
     vSemaphoreDelete(video->mutex);
     heap_caps_free(video->stream);
     heap_caps_free(video);
@@ -500,8 +633,8 @@ esp_err_t esp_video_open(const char *name, struct esp_video **video_ret)
 
                     stream->buffer = NULL;
                     memset(&stream->param, 0, sizeof(struct esp_video_param));
-                    TAILQ_INIT(&stream->queued_list);
-                    TAILQ_INIT(&stream->done_list);
+                    esp_video_buffer_ring_reset(&stream->queued_ring);
+                    esp_video_buffer_ring_reset(&stream->done_ring);
                 }
 
                 video->inited = 1;
@@ -550,6 +683,17 @@ esp_err_t esp_video_close(struct esp_video *video)
         goto exit_0;
     }
 
+    /* Capturing started by read() ends with the last file descriptor */
+    if (video->read_io) {
+        struct esp_video_stream *stream = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+
+        if (stream && stream->started) {
+            esp_video_stop_capture(video, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+        }
+        video->read_io = 0;
+        video->read_held = 0;
+    }
+
     /**
      * Only deinitialize the video device although reference is 0, because the
      * reference can be set by other tasks.
@@ -570,6 +714,13 @@ esp_err_t esp_video_close(struct esp_video *video)
                         stream->ready_sem = NULL;
                     }
 
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+                    if (stream->slice.sem) {
+                        vSemaphoreDelete(stream->slice.sem);
+                        stream->slice.sem = NULL;
+                    }
+#endif
+
                     if (stream->buffer) {
                         esp_video_buffer_destroy(stream->buffer);
                         stream->buffer = NULL;
@@ -589,6 +740,121 @@ exit_0:
     return ret;
 }
 
+/**
+ * @brief Wake up the M2M worker task of a video device, safe in ISR.
+ *
+ * @param video Video object
+ *
+ * @return None
+ */
+static void IRAM_ATTR esp_video_m2m_worker_notify(struct esp_video *video)
+{
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+    TaskHandle_t task = video->m2m_worker;
+
+    if (!task) {
+        return;
+    }
+
+    if (xPortInIsrContext()) {
+        BaseType_t wakeup = pdFALSE;
+
+        vTaskNotifyGiveFromISR(task, &wakeup);
+        if (wakeup == pdTRUE) {
+            portYIELD_FROM_ISR();
+        }
+    } else {
+        xTaskNotifyGive(task);
+    }
+#endif
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+static void esp_video_m2m_worker_task(void *arg)
+{
+    uint32_t index;
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    struct esp_video *video = (struct esp_video *)arg;
+    struct esp_video_stream *capture = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    struct esp_video_stream *output = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+
+    while (video->m2m_worker_run) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /* Process every queued pair, as long as the application keeps up with the results */
+        while (video->m2m_worker_run &&
+                (esp_video_buffer_ring_count(&capture->done_ring) < CONFIG_ESP_VIDEO_M2M_WORKER_QUEUE_DEPTH) &&
+                esp_video_buffer_ring_peek(&capture->queued_ring, &index) &&
+                esp_video_buffer_ring_peek(&output->queued_ring, &index)) {
+            if (video->ops->notify(video, ESP_VIDEO_M2M_TRIGGER, &type) != ESP_OK) {
+                break;
+            }
+        }
+    }
+
+    xSemaphoreGive(video->m2m_worker_exit);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Create the M2M worker task of a video device.
+ *
+ * @param video Video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+static esp_err_t esp_video_m2m_worker_start(struct esp_video *video)
+{
+    video->m2m_worker_exit = xSemaphoreCreateBinary();
+    if (!video->m2m_worker_exit) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    video->m2m_worker_run = true;
+    if (xTaskCreatePinnedToCore(esp_video_m2m_worker_task, M2M_WORKER_TASK_NAME, CONFIG_ESP_VIDEO_M2M_WORKER_TASK_STACK_SIZE,
+                                video, CONFIG_ESP_VIDEO_M2M_WORKER_TASK_PRIORITY, &video->m2m_worker,
+                                M2M_WORKER_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create M2M worker task");
+        video->m2m_worker_run = false;
+        video->m2m_worker = NULL;
+        vSemaphoreDelete(video->m2m_worker_exit);
+        video->m2m_worker_exit = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Buffers may have been queued before STREAMON */
+    xTaskNotifyGive(video->m2m_worker);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Make the M2M worker task of a video device exit, once the pair it processes is done.
+ *
+ * @param video Video object
+ *
+ * @return None
+ */
+static void esp_video_m2m_worker_stop(struct esp_video *video)
+{
+    TaskHandle_t task = video->m2m_worker;
+
+    if (!task) {
+        return;
+    }
+
+    video->m2m_worker_run = false;
+    xTaskNotifyGive(task);
+    xSemaphoreTake(video->m2m_worker_exit, portMAX_DELAY);
+
+    video->m2m_worker = NULL;
+    vSemaphoreDelete(video->m2m_worker_exit);
+    video->m2m_worker_exit = NULL;
+}
+#endif
+
 /**
  * @brief Start capturing video data stream.
  *
@@ -623,6 +889,30 @@ esp_err_t esp_video_start_capture(struct esp_video *video, uint32_t type)
             stream->param.skip_count = 0;
         }
 
+        /* Like V4L2, the frame and drop counters start from 0 at VIDIOC_STREAMON */
+        stream->sequence = 0;
+        stream->dropped = 0;
+        stream->rx_error = 0;
+        memset(&stream->counters, 0, sizeof(stream->counters));
+
+        /* Settings written while stopped are in effect from the first frame */
+        portENTER_CRITICAL_SAFE(&video->stream_lock);
+        if (stream->sensor.pending_num) {
+            stream->sensor.current = stream->sensor.pending[stream->sensor.pending_num - 1].settings;
+            stream->sensor.pending_num = 0;
+        }
+        stream->sensor.trigger_us = 0;
+        stream->sensor.frame_end_us = 0;
+        stream->sensor.lens_start_us = 0;
+        portEXIT_CRITICAL_SAFE(&video->stream_lock);
+
+        /* The sensor starts from its default exposure, the image algorithms converge again */
+        if (stream->convergence != ESP_VIDEO_CONVERGENCE_OFF) {
+            stream->convergence = ESP_VIDEO_CONVERGENCE_PENDING;
+        }
+
+        ESP_VIDEO_TRACE_NAME_MARKERS();
+
         ret = video->ops->start(video, type);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "video->ops->start=%x", ret);
@@ -633,7 +923,21 @@ esp_err_t esp_video_start_capture(struct esp_video *video, uint32_t type)
         return ESP_ERR_NOT_SUPPORTED;
     }
 
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+    /* One worker serves both streams of the device */
+    if ((video->device_caps & V4L2_CAP_VIDEO_M2M) && !video->m2m_worker) {
+        ret = esp_video_m2m_worker_start(video);
+        if (ret != ESP_OK) {
+            video->ops->stop(video, type);
+            return ret;
+        }
+    }
+#endif
+
     stream->started = true;
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+    esp_video_pm_stream_start();
+#endif
 
     return ESP_OK;
 }
@@ -665,6 +969,11 @@ esp_err_t esp_video_stop_capture(struct esp_video *video, uint32_t type)
     }
 
     if (video->ops->stop) {
+#if CONFIG_ESP_VIDEO_ENABLE_M2M_WORKER
+        /* Stopping resets the rings of both streams, no pair may be in process */
+        esp_video_m2m_worker_stop(video);
+#endif
+
         ret = video->ops->stop(video, type);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "video->ops->stop=%x", ret);
@@ -679,8 +988,8 @@ esp_err_t esp_video_stop_capture(struct esp_video *video, uint32_t type)
                     ret = xSemaphoreTake(stream->ready_sem, 0);
                 } while (ret == pdTRUE);
 
-                TAILQ_INIT(&stream->queued_list);
-                TAILQ_INIT(&stream->done_list);
+                esp_video_buffer_ring_reset(&stream->queued_ring);
+                esp_video_buffer_ring_reset(&stream->done_ring);
 
                 esp_video_buffer_reset(stream->buffer);
             }
@@ -691,6 +1000,9 @@ esp_err_t esp_video_stop_capture(struct esp_video *video, uint32_t type)
     }
 
     stream->started = false;
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+    esp_video_pm_stream_stop();
+#endif
 
     return ESP_OK;
 }
@@ -826,6 +1138,18 @@ esp_err_t esp_video_setup_buffer(struct esp_video *video, uint32_t type, uint32_
 
     /* buffer_size is configured when setting format */
 
+    /* Linked streams share their elements by index */
+    if (stream->link) {
+        ESP_LOGE(TAG, "Stream is linked");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* Every element of the stream must fit in its queued and done rings */
+    if (count > ESP_VIDEO_BUFFER_RING_SIZE) {
+        ESP_LOGE(TAG, "Buffer count %" PRIu32 " exceeds %d", count, ESP_VIDEO_BUFFER_RING_SIZE);
+        return ESP_ERR_INVALID_ARG;
+    }
+
     info = &stream->buf_info;
     if (!info->size || !info->align_size || !info->caps) {
         ESP_LOGE(TAG, "Failed to check buffer information: size=%" PRIu32 " align=%" PRIu32 " cap=%" PRIx32,
@@ -835,16 +1159,26 @@ esp_err_t esp_video_setup_buffer(struct esp_video *video, uint32_t type, uint32_
 
     info->count = count;
     info->memory_type = memory_type;
+    if (type == V4L2_BUF_TYPE_META_CAPTURE) {
+        info->owner = ESP_VIDEO_MEM_OWNER_META;
+    } else if (video->caps & V4L2_CAP_VIDEO_M2M) {
+        info->owner = ESP_VIDEO_MEM_OWNER_M2M;
+    } else {
+        info->owner = ESP_VIDEO_MEM_OWNER_CAPTURE;
+    }
 
     if (stream->ready_sem) {
         vSemaphoreDelete(stream->ready_sem);
         stream->ready_sem = NULL;
     }
 
-    if (stream->buffer) {
+    /* A format switch that still fits the allocation keeps the elements, and their payloads */
+    if (stream->buffer && esp_video_buffer_reconfigure(stream->buffer, info) != ESP_OK) {
         esp_video_buffer_destroy(stream->buffer);
         stream->buffer = NULL;
     }
+    esp_video_buffer_ring_reset(&stream->queued_ring);
+    esp_video_buffer_ring_reset(&stream->done_ring);
 
     stream->ready_sem = xSemaphoreCreateCounting(info->count, 0);
     if (!stream->ready_sem) {
@@ -852,6 +1186,10 @@ esp_err_t esp_video_setup_buffer(struct esp_video *video, uint32_t type, uint32_
         return ESP_ERR_NO_MEM;
     }
 
+    if (stream->buffer) {
+        return ESP_OK;
+    }
+
     stream->buffer = esp_video_buffer_create(info);
     if (!stream->buffer) {
         vSemaphoreDelete(stream->ready_sem);
@@ -863,6 +1201,84 @@ esp_err_t esp_video_setup_buffer(struct esp_video *video, uint32_t type, uint32_
     return ESP_OK;
 }
 
+/**
+ * @brief Add buffers to a video stream.
+ *
+ * @param video       Video object
+ * @param type        Video stream type
+ * @param memory_type Video buffer memory type, refer to v4l2_memory in videodev2.h
+ * @param count       Number of buffers to add
+ * @param index       Returned index of the first added buffer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_add_buffer(struct esp_video *video, uint32_t type, uint32_t memory_type, uint32_t count,
+                               uint32_t *index)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_buffer_info *info;
+    struct esp_video_buffer *buffer;
+    SemaphoreHandle_t ready_sem;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!stream->buffer) {
+        *index = 0;
+        return esp_video_setup_buffer(video, type, memory_type, count);
+    }
+
+    info = &stream->buf_info;
+    if (memory_type != info->memory_type) {
+        ESP_LOGE(TAG, "Memory type %" PRIu32 " differs from %" PRIu32, memory_type, info->memory_type);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Elements move when the object grows, no DMA or linked stream may hold one */
+    if (stream->started || stream->link) {
+        ESP_LOGE(TAG, "Stream is started or linked");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (ESP_VIDEO_ALIGN(info->size, info->align_size) > stream->buffer->alloc_size) {
+        ESP_LOGE(TAG, "Format does not fit the allocated buffers");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (info->count + count > ESP_VIDEO_BUFFER_RING_SIZE) {
+        ESP_LOGE(TAG, "Buffer count %" PRIu32 " exceeds %d", info->count + count, ESP_VIDEO_BUFFER_RING_SIZE);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The stream is stopped, so its done ring is empty and the semaphore has no token to carry over */
+    ready_sem = xSemaphoreCreateCounting(info->count + count, 0);
+    if (!ready_sem) {
+        ESP_LOGE(TAG, "Failed to create done_sem for video stream");
+        return ESP_ERR_NO_MEM;
+    }
+
+    buffer = esp_video_buffer_grow(stream->buffer, info->count + count);
+    if (!buffer) {
+        vSemaphoreDelete(ready_sem);
+        ESP_LOGE(TAG, "Failed to add buffers");
+        return ESP_ERR_NO_MEM;
+    }
+
+    vSemaphoreDelete(stream->ready_sem);
+    stream->ready_sem = ready_sem;
+    stream->buffer = buffer;
+    *index = info->count;
+    info->count += count;
+
+    return ESP_OK;
+}
+
 /**
  * @brief Get video buffer count.
  *
@@ -890,6 +1306,45 @@ esp_err_t esp_video_get_buffer_info(struct esp_video *video, uint32_t type, stru
     return ESP_OK;
 }
 
+/**
+ * @brief Take back the oldest done element nobody dequeued, its frame is dropped.
+ *
+ * The ready semaphore token is taken first, so a DQBUF that already holds
+ * the token always finds its element in the done ring.
+ *
+ * @param stream Video stream object
+ *
+ * @return
+ *      - Video buffer element object pointer on success
+ *      - NULL if no done element is left to recycle
+ */
+static struct esp_video_buffer_element *IRAM_ATTR esp_video_recycle_done_element(struct esp_video_stream *stream)
+{
+    uint32_t index;
+    BaseType_t taken;
+    struct esp_video_buffer_element *element;
+
+    if (xPortInIsrContext()) {
+        taken = xSemaphoreTakeFromISR(stream->ready_sem, NULL);
+    } else {
+        taken = xSemaphoreTake(stream->ready_sem, 0);
+    }
+    if (taken != pdTRUE) {
+        return NULL;
+    }
+
+    if (!esp_video_buffer_ring_pop(&stream->done_ring, &index)) {
+        return NULL;
+    }
+
+    element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
+    ELEMENT_SET_FREE(element);
+    stream->dropped++;
+    stream->counters.recycled++;
+
+    return element;
+}
+
 /**
  * @brief Get buffer element from buffer queued list.
  *
@@ -902,6 +1357,7 @@ esp_err_t esp_video_get_buffer_info(struct esp_video *video, uint32_t type, stru
  */
 struct esp_video_buffer_element *IRAM_ATTR esp_video_get_queued_element(struct esp_video *video, uint32_t type)
 {
+    uint32_t index;
     struct esp_video_stream *stream;
     struct esp_video_buffer_element *element = NULL;
 
@@ -910,13 +1366,15 @@ struct esp_video_buffer_element *IRAM_ATTR esp_video_get_queued_element(struct e
         return NULL;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (!TAILQ_EMPTY(&stream->queued_list)) {
-        element = TAILQ_FIRST(&stream->queued_list);
-        TAILQ_REMOVE(&stream->queued_list, element, node);
+    if (esp_video_buffer_ring_pop(&stream->queued_ring, &index)) {
+        element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
         ELEMENT_SET_FREE(element);
+    } else {
+        stream->counters.no_buffer++;
+        if (stream->drop_policy == ESP_VIDEO_DROP_OLDEST) {
+            element = esp_video_recycle_done_element(stream);
+        }
     }
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
 
     return element;
 }
@@ -955,6 +1413,7 @@ uint8_t *IRAM_ATTR esp_video_get_queued_buffer(struct esp_video *video, uint32_t
  */
 struct esp_video_buffer_element *esp_video_get_done_element(struct esp_video *video, uint32_t type)
 {
+    uint32_t index;
     struct esp_video_stream *stream;
     struct esp_video_buffer_element *element = NULL;
 
@@ -963,47 +1422,50 @@ struct esp_video_buffer_element *esp_video_get_done_element(struct esp_video *vi
         return NULL;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (!TAILQ_EMPTY(&stream->done_list)) {
-        element = TAILQ_FIRST(&stream->done_list);
-        TAILQ_REMOVE(&stream->done_list, element, node);
+    if (esp_video_buffer_ring_pop(&stream->done_ring, &index)) {
+        element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
         ELEMENT_SET_FREE(element);
     }
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
 
     return element;
 }
 
 /**
- * @brief Put element into done lost and give semaphore.
+ * @brief Get buffer element at the head of buffer done list without removing it.
  *
- * @param video   Video object
- * @param type    Video stream type
- * @param element Video buffer element object get by "esp_video_get_queued_element"
+ * @param video Video object
+ * @param type  Video stream type
  *
  * @return
- *      - ESP_OK on success
- *      - Others if failed
+ *      - Video buffer element object pointer on success
+ *      - NULL if failed
  */
-esp_err_t IRAM_ATTR esp_video_done_element(struct esp_video *video, uint32_t type, struct esp_video_buffer_element *element)
+struct esp_video_buffer_element *esp_video_peek_done_element(struct esp_video *video, uint32_t type)
 {
+    uint32_t index;
     struct esp_video_stream *stream;
 
     stream = esp_video_get_stream(video, type);
-    if (!stream) {
-        return ESP_ERR_INVALID_ARG;
+    if (!stream || !esp_video_buffer_ring_peek(&stream->done_ring, &index)) {
+        return NULL;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (!ELEMENT_IS_FREE(element)) {
-        portEXIT_CRITICAL_SAFE(&video->stream_lock);
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    ELEMENT_SET_ALLOCATED(element);
-    TAILQ_INSERT_TAIL(&stream->done_list, element, node);
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+    return ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
+}
 
+/**
+ * @brief Put element into done lost and give semaphore.
+ *
+ * @param video   Video object
+ * @param type    Video stream type
+ * @param element Video buffer element object get by "esp_video_get_queued_element"
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+static void IRAM_ATTR esp_video_give_ready_sem(struct esp_video_stream *stream)
+{
     if (xPortInIsrContext()) {
         BaseType_t wakeup = pdFALSE;
 
@@ -1014,6 +1476,109 @@ esp_err_t IRAM_ATTR esp_video_done_element(struct esp_video *video, uint32_t typ
     } else {
         xSemaphoreGive(stream->ready_sem);
     }
+}
+
+/**
+ * @brief Queue a done capture element to the output stream of the linked M2M device.
+ *
+ * The M2M output element of the same index borrows the payload, the capture
+ * element stays claimed until the M2M device gives it back.
+ *
+ * @param stream  Capture stream
+ * @param element Done capture element
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the M2M output element is still in use
+ */
+static esp_err_t IRAM_ATTR esp_video_link_element(struct esp_video_stream *stream, struct esp_video_buffer_element *element)
+{
+    struct esp_video *sink = stream->link;
+    struct esp_video_stream *sink_stream = esp_video_get_stream(sink, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    struct esp_video_buffer_element *sink_element = ESP_VIDEO_BUFFER_ELEMENT(sink_stream->buffer, element->index);
+
+    if (!esp_video_buffer_element_try_allocate(sink_element)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sink_element->buffer = element->buffer;
+    sink_element->valid_size = element->valid_size;
+    sink_element->bytesused = element->valid_size;
+    sink_element->flags = element->flags;
+    sink_element->timestamp_us = element->timestamp_us;
+    sink_element->sequence = element->sequence;
+    sink_element->dropped = element->dropped;
+    sink_element->sensor = element->sensor;
+    esp_video_buffer_ring_push(&sink_stream->queued_ring, sink_element->index);
+
+    /* A linked output stream has no done buffers, its semaphore counts the frames waiting for the M2M device */
+    esp_video_give_ready_sem(sink_stream);
+    esp_video_m2m_worker_notify(sink);
+    esp_video_vfs_notify(sink);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Give a consumed M2M output element back to the capture queue of the linked source.
+ *
+ * @param stream         M2M output stream
+ * @param output_element Consumed M2M output element
+ *
+ * @return None
+ */
+static void esp_video_unlink_element(struct esp_video_stream *stream, struct esp_video_buffer_element *output_element)
+{
+    struct esp_video *source = stream->link;
+    struct esp_video_stream *source_stream = esp_video_get_stream(source, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    struct esp_video_buffer_element *element = ESP_VIDEO_BUFFER_ELEMENT(source_stream->buffer, output_element->index);
+
+    /* STREAMOFF of the source already took all its elements back */
+    if (source_stream->started) {
+        ELEMENT_SET_FREE(element);
+        esp_video_queue_element(source, V4L2_BUF_TYPE_VIDEO_CAPTURE, element);
+    }
+}
+
+esp_err_t IRAM_ATTR esp_video_done_element(struct esp_video *video, uint32_t type, struct esp_video_buffer_element *element)
+{
+    struct esp_video_stream *stream;
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!esp_video_buffer_element_try_allocate(element)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_VIDEO_TRACE_MARK(ESP_VIDEO_TRACE_DONE_BUFFER);
+
+    if (stream->link) {
+        if (esp_video_link_element(stream, element) != ESP_OK) {
+            /* The M2M device fell behind, the frame is dropped and the element captures the next one */
+            stream->dropped++;
+            esp_video_buffer_ring_push(&stream->queued_ring, element->index);
+        } else {
+            stream->counters.delivered++;
+        }
+
+        return ESP_OK;
+    }
+
+    /* The ring holds every element of the stream, so it is never full */
+    esp_video_buffer_ring_push(&stream->done_ring, element->index);
+
+    uint32_t depth = esp_video_buffer_ring_count(&stream->done_ring);
+    if (depth > stream->counters.max_done_depth) {
+        stream->counters.max_done_depth = depth;
+    }
+    stream->counters.delivered++;
+
+    esp_video_give_ready_sem(stream);
+
+    esp_video_vfs_notify(video);
 
     return ESP_OK;
 }
@@ -1031,8 +1596,27 @@ esp_err_t IRAM_ATTR esp_video_done_element(struct esp_video *video, uint32_t typ
  *      - Others if failed
  */
 esp_err_t IRAM_ATTR esp_video_done_buffer(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t n)
+{
+    return esp_video_done_buffer_timestamp(video, type, buffer, n, esp_timer_get_time());
+}
+
+/**
+ * @brief Process a video buffer element's payload which receives data done at a given time.
+ *
+ * @param video        Video object
+ * @param type         Video stream type
+ * @param buffer       Video buffer element's payload
+ * @param n            Video buffer element's payload valid data size
+ * @param timestamp_us esp_timer time at which the hardware finished the frame
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t IRAM_ATTR esp_video_done_buffer_timestamp(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t n, int64_t timestamp_us)
 {
     esp_err_t ret;
+    uint32_t sequence;
     struct esp_video_stream *stream;
     struct esp_video_buffer_element *element;
 
@@ -1040,20 +1624,252 @@ esp_err_t IRAM_ATTR esp_video_done_buffer(struct esp_video *video, uint32_t type
     if (!stream) {
         return ESP_ERR_INVALID_ARG;
     }
+    sequence = stream->sequence++;
 
     element = esp_video_buffer_get_element_by_buffer(stream->buffer, buffer);
     if (element) {
+        if (stream->convergence == ESP_VIDEO_CONVERGENCE_PENDING && stream->convergence_hold) {
+            /* Frames taken while the image algorithms converge are not worth delivering */
+            stream->rx_error = 0;
+            esp_video_skip_buffer(video, type, buffer);
+            return ESP_OK;
+        }
+
+        element->flags &= ~V4L2_BUF_FLAG_ESP_CONVERGED;
+        if (stream->convergence == ESP_VIDEO_CONVERGENCE_DONE) {
+            element->flags |= V4L2_BUF_FLAG_ESP_CONVERGED;
+        }
         element->valid_size = n;
+        element->timestamp_us = timestamp_us;
+        element->sequence = sequence;
+        element->dropped = stream->dropped;
+        esp_video_sensor_settings_at(video, stream, sequence, timestamp_us, &element->sensor);
+        element->flags &= ~(V4L2_BUF_FLAG_ESP_TRIGGERED | V4L2_BUF_FLAG_ESP_LENS_MOVING | V4L2_BUF_FLAG_ESP_REQUEST);
+        if (element->sensor.flags & ESP_VIDEO_FRAME_META_TRIGGER) {
+            element->flags |= V4L2_BUF_FLAG_ESP_TRIGGERED;
+        }
+        if (element->sensor.flags & ESP_VIDEO_FRAME_META_LENS_MOVING) {
+            element->flags |= V4L2_BUF_FLAG_ESP_LENS_MOVING;
+        }
+        if (element->sensor.flags & ESP_VIDEO_FRAME_META_REQUEST) {
+            element->flags |= V4L2_BUF_FLAG_ESP_REQUEST;
+        }
+        element->flags &= ~V4L2_BUF_FLAG_ERROR;
+        if (stream->rx_error) {
+            element->flags |= V4L2_BUF_FLAG_ERROR;
+            stream->rx_error = 0;
+        }
         ret = esp_video_done_element(video, type, element);
         if (ret != ESP_OK) {
             return ret;
         }
     } else {
+        stream->rx_error = 0;
+        stream->dropped++;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Count a frame the hardware finished without a free element to return it in.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ *
+ * @return None
+ */
+void IRAM_ATTR esp_video_drop_frame(struct esp_video *video, uint32_t type)
+{
+    struct esp_video_stream *stream;
+
+    stream = esp_video_get_stream(video, type);
+    if (stream) {
+        stream->sequence++;
+        stream->dropped++;
+        stream->rx_error = 0;
+    }
+}
+
+/**
+ * @brief Count the receiver errors of the frame being received.
+ *
+ * @param video      Video object
+ * @param type       Video stream type
+ * @param errors     ESP_VIDEO_RX_ERROR_XXX
+ * @param flag_frame Flag the element the frame is done in with V4L2_BUF_FLAG_ERROR
+ *
+ * @return None
+ */
+void IRAM_ATTR esp_video_rx_error(struct esp_video *video, uint32_t type, uint32_t errors, bool flag_frame)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_stream_counters *counters;
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream || !errors) {
+        return;
+    }
+    counters = &stream->counters;
+
+    if (errors & ESP_VIDEO_RX_ERROR_CRC) {
+        counters->rx_crc_errors++;
+    }
+    if (errors & ESP_VIDEO_RX_ERROR_ECC) {
+        counters->rx_ecc_errors++;
+    }
+    if (errors & ESP_VIDEO_RX_ERROR_PHY) {
+        counters->rx_phy_errors++;
+    }
+    if (errors & ESP_VIDEO_RX_ERROR_FRAME) {
+        counters->rx_frame_errors++;
+    }
+    if (errors & ESP_VIDEO_RX_ERROR_OVERFLOW) {
+        counters->rx_overflows++;
+    }
+
+    if (flag_frame) {
+        stream->rx_error |= errors;
+    }
+}
+
+/**
+ * @brief Count a restart of a stalled stream by the device, without VIDIOC_STREAMOFF.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ *
+ * @return None
+ */
+void esp_video_stream_recovered(struct esp_video *video, uint32_t type)
+{
+    struct esp_video_stream *stream;
+
+    stream = esp_video_get_stream(video, type);
+    if (stream) {
+        /* Errors of the lost frame do not flag the next one */
+        stream->rx_error = 0;
+        stream->counters.recoveries++;
+    }
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+/**
+ * @brief Report a done slice of the frame being received into a buffer element.
+ *
+ * @param video  Video object
+ * @param type   Video stream type
+ * @param buffer Video buffer element's payload
+ * @param slice  Done slice, from 0
+ * @param slices Slices per frame
+ * @param size   Bytes received from the start of the frame
+ *
+ * @return None
+ */
+void IRAM_ATTR esp_video_done_slice(struct esp_video *video, uint32_t type, uint8_t *buffer, uint32_t slice, uint32_t slices,
+                                    uint32_t size)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_buffer_element *element;
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
+        return;
+    }
+
+    element = esp_video_buffer_get_element_by_buffer(stream->buffer, buffer);
+    if (!element) {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    stream->slice.index = element->index;
+    stream->slice.sequence = stream->sequence;
+    stream->slice.slice = slice;
+    stream->slice.slices = slices;
+    stream->slice.size = size;
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+
+    /* Nobody waits for slices until the first consumer created the semaphore */
+    if (stream->slice.sem) {
+        if (xPortInIsrContext()) {
+            BaseType_t wakeup = pdFALSE;
+
+            xSemaphoreGiveFromISR(stream->slice.sem, &wakeup);
+            if (wakeup == pdTRUE) {
+                portYIELD_FROM_ISR();
+            }
+        } else {
+            xSemaphoreGive(stream->slice.sem);
+        }
+    }
+}
+
+/**
+ * @brief Wait for a slice of the frame being received.
+ *
+ * @param video Video object
+ * @param type  Video stream type
+ * @param ticks Ticks to wait
+ * @param slice Returned slice
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ *      - ESP_ERR_NO_MEM if the slice semaphore could not be created
+ *      - ESP_ERR_TIMEOUT if no slice was done in time
+ */
+esp_err_t esp_video_wait_slice(struct esp_video *video, uint32_t type, uint32_t ticks, esp_video_slice_t *slice)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_slice_state state;
+    uint32_t synced_size;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    if (!stream->slice.sem) {
+        xSemaphoreTake(video->mutex, portMAX_DELAY);
+        if (!stream->slice.sem) {
+            stream->slice.sem = xSemaphoreCreateBinary();
+        }
+        xSemaphoreGive(video->mutex);
+        if (!stream->slice.sem) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (xSemaphoreTake(stream->slice.sem, (TickType_t)ticks) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    memcpy(&state, &stream->slice, sizeof(state));
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+
+    slice->index = state.index;
+    slice->buffer = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, state.index)->buffer;
+    slice->size = state.size;
+    slice->slice = state.slice;
+    slice->slices = state.slices;
+    slice->sequence = state.sequence;
+
+    /* Only the bytes received since the last call of the same frame may still be stale in the cache */
+    synced_size = state.synced_sequence == state.sequence ? state.synced_size : 0;
+    if (state.size > synced_size) {
+        esp_cache_msync(slice->buffer + synced_size, state.size - synced_size, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+    }
+    stream->slice.synced_sequence = state.sequence;
+    stream->slice.synced_size = state.size;
+
     return ESP_OK;
 }
+#endif
 
 /**
  * @brief Put buffer element into queued list.
@@ -1076,20 +1892,61 @@ esp_err_t esp_video_queue_element(struct esp_video *video, uint32_t type, struct
         return ESP_ERR_INVALID_ARG;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (!ELEMENT_IS_FREE(element)) {
-        portEXIT_CRITICAL_SAFE(&video->stream_lock);
+    if (!esp_video_buffer_element_try_allocate(element)) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    ELEMENT_SET_ALLOCATED(element);
-    TAILQ_INSERT_TAIL(&stream->queued_list, element, node);
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+    /* The device takes back what it lent the element while it was dequeued */
+    if (video->ops->notify) {
+        video->ops->notify(video, ESP_VIDEO_BUFFER_QUEUED, element);
+    }
+
+    esp_video_buffer_ring_push(&stream->queued_ring, element->index);
 
     if (video->ops->notify) {
         video->ops->notify(video, ESP_VIDEO_BUFFER_VALID, &val);
     }
 
+    /* A queued pair makes the M2M capture stream readable, or is processed by the worker */
+    if (video->caps & V4L2_CAP_VIDEO_M2M) {
+        esp_video_m2m_worker_notify(video);
+        esp_video_vfs_notify(video);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the QBUF attributes of a buffer element index, before it is queued.
+ *
+ * @param video     Video object
+ * @param type      Video stream type
+ * @param index     Video buffer element index
+ * @param bytesused Valid data size of an output buffer, 0 for the whole buffer
+ * @param flags     V4L2_BUF_FLAG_NO_CACHE_INVALIDATE and V4L2_BUF_FLAG_NO_CACHE_CLEAN hints
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_prepare_element_index(struct esp_video *video, uint32_t type, int index, uint32_t bytesused, uint32_t flags)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_buffer_element *element;
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream || !stream->buffer || index >= stream->buffer->info.count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
+    if (!ELEMENT_IS_FREE(element)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    element->flags = flags & (V4L2_BUF_FLAG_NO_CACHE_INVALIDATE | V4L2_BUF_FLAG_NO_CACHE_CLEAN);
+    element->bytesused = bytesused < ELEMENT_SIZE(element) ? bytesused : 0;
+
     return ESP_OK;
 }
 
@@ -1150,7 +2007,7 @@ esp_err_t esp_video_queue_element_index_buffer(struct esp_video *video, uint32_t
     element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index);
     info = &stream->buffer->info;
 
-    if ((info->memory_type != V4L2_MEMORY_USERPTR) ||
+    if (((info->memory_type != V4L2_MEMORY_USERPTR) && (info->memory_type != V4L2_MEMORY_DMABUF)) ||
             (((uintptr_t)buffer) % info->align_size) ||
             (size < info->size)) {
         return ESP_ERR_INVALID_ARG;
@@ -1174,6 +2031,32 @@ esp_err_t esp_video_queue_element_index_buffer(struct esp_video *video, uint32_t
     return ret;
 }
 
+/**
+ * @brief Export buffer element index as a DMABUF handle.
+ *
+ * @param video   Video object
+ * @param type    Video stream type
+ * @param index   Video buffer element index
+ * @param fd      Returned DMABUF handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_export_element_index(struct esp_video *video, uint32_t type, int index, int *fd)
+{
+    struct esp_video_stream *stream;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream || !stream->buffer || (index >= stream->buffer->info.count)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp_video_buffer_export_element(ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, index), fd);
+}
+
 /**
  * @brief Get buffer element payload.
  *
@@ -1200,6 +2083,29 @@ uint8_t *esp_video_get_element_index_payload(struct esp_video *video, uint32_t t
     return element->buffer;
 }
 
+/**
+ * @brief Count the time a dequeued element waited in the done ring.
+ *
+ * @param stream  Video stream object
+ * @param element Dequeued video buffer element
+ *
+ * @return None
+ */
+static void esp_video_count_latency(struct esp_video_stream *stream, const struct esp_video_buffer_element *element)
+{
+    struct esp_video_stream_counters *counters = &stream->counters;
+    uint32_t latency_us = (uint32_t)(esp_timer_get_time() - element->timestamp_us);
+
+    if (!counters->latency_count || latency_us < counters->latency_min_us) {
+        counters->latency_min_us = latency_us;
+    }
+    if (latency_us > counters->latency_max_us) {
+        counters->latency_max_us = latency_us;
+    }
+    counters->latency_total_us += latency_us;
+    counters->latency_count++;
+}
+
 /**
  * @brief Receive buffer element from video device.
  *
@@ -1223,7 +2129,21 @@ struct esp_video_buffer_element *esp_video_recv_element(struct esp_video *video,
         return NULL;
     }
 
-    if (video->device_caps & V4L2_CAP_VIDEO_M2M) {
+    /* With a worker, pairs are processed as they are queued and DQBUF only waits for the result */
+    if ((video->device_caps & V4L2_CAP_VIDEO_M2M) && !M2M_WORKER_RUNNING(video)) {
+        struct esp_video_stream *link_stream = NULL;
+
+        /* The output of a linked device is queued by the done path of its source, wait for a frame to process */
+        if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            link_stream = esp_video_get_stream(video, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+            if (link_stream && !link_stream->link) {
+                link_stream = NULL;
+            }
+        }
+        if (link_stream && xSemaphoreTake(link_stream->ready_sem, (TickType_t)ticks) != pdTRUE) {
+            return NULL;
+        }
+
         /**
          * Software M2M device: this callback call can do real codec process.
          * Hardware M2M device: this callback call can start hardware if necessary.
@@ -1231,11 +2151,17 @@ struct esp_video_buffer_element *esp_video_recv_element(struct esp_video *video,
 
         ret = video->ops->notify(video, ESP_VIDEO_M2M_TRIGGER, &val);
         if (ret != ESP_OK) {
+            /* The frame stays queued, e.g. no capture buffer was queued for its result */
+            if (link_stream) {
+                xSemaphoreGive(link_stream->ready_sem);
+            }
             return NULL;
         }
     }
 
+    ESP_VIDEO_TRACE_START(ESP_VIDEO_TRACE_DQBUF);
     ret = xSemaphoreTake(stream->ready_sem, (TickType_t)ticks);
+    ESP_VIDEO_TRACE_STOP(ESP_VIDEO_TRACE_DQBUF);
     if (ret != pdTRUE) {
         return NULL;
     }
@@ -1248,6 +2174,14 @@ struct esp_video_buffer_element *esp_video_recv_element(struct esp_video *video,
 #endif
 
     element = esp_video_get_done_element(video, type);
+    if (element && element->timestamp_us) {
+        esp_video_count_latency(stream, element);
+    }
+
+    /* A dequeued result makes room in the worker queue */
+    if (element && (video->device_caps & V4L2_CAP_VIDEO_M2M)) {
+        esp_video_m2m_worker_notify(video);
+    }
 
     return element;
 }
@@ -1284,19 +2218,17 @@ esp_err_t esp_video_queue_m2m_elements(struct esp_video *video,
         return ESP_ERR_INVALID_ARG;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (ELEMENT_IS_FREE(src_element) && ELEMENT_IS_FREE(dst_element)) {
-        ELEMENT_SET_ALLOCATED(src_element);
-        TAILQ_INSERT_TAIL(&stream[0]->queued_list, src_element, node);
-
-        ELEMENT_SET_ALLOCATED(dst_element);
-        TAILQ_INSERT_TAIL(&stream[1]->queued_list, dst_element, node);
-
-        ret = ESP_OK;
-    } else {
-        ret = ESP_ERR_INVALID_STATE;
+    if (!esp_video_buffer_element_try_allocate(src_element)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!esp_video_buffer_element_try_allocate(dst_element)) {
+        ELEMENT_SET_FREE(src_element);
+        return ESP_ERR_INVALID_STATE;
     }
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+
+    esp_video_buffer_ring_push(&stream[0]->queued_ring, src_element->index);
+    esp_video_buffer_ring_push(&stream[1]->queued_ring, dst_element->index);
+    ret = ESP_OK;
 
     return ret;
 }
@@ -1334,37 +2266,33 @@ esp_err_t esp_video_done_m2m_elements(struct esp_video *video,
         return ESP_ERR_INVALID_ARG;
     }
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (ELEMENT_IS_FREE(src_element) && ELEMENT_IS_FREE(dst_element)) {
-        ELEMENT_SET_ALLOCATED(src_element);
-        TAILQ_INSERT_TAIL(&stream[0]->done_list, src_element, node);
-
-        ELEMENT_SET_ALLOCATED(dst_element);
-        TAILQ_INSERT_TAIL(&stream[1]->done_list, dst_element, node);
-
-        ret = ESP_OK;
-    } else {
+    if (stream[0]->link) {
+        /* A linked source element is not returned to the application but to its capture queue */
+        if (!esp_video_buffer_element_try_allocate(dst_element)) {
+            ret = ESP_ERR_INVALID_STATE;
+        } else {
+            esp_video_buffer_ring_push(&stream[1]->done_ring, dst_element->index);
+            ret = ESP_OK;
+        }
+        esp_video_unlink_element(stream[0], src_element);
+    } else if (!esp_video_buffer_element_try_allocate(src_element)) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (!esp_video_buffer_element_try_allocate(dst_element)) {
+        ELEMENT_SET_FREE(src_element);
         ret = ESP_ERR_INVALID_STATE;
+    } else {
+        esp_video_buffer_ring_push(&stream[0]->done_ring, src_element->index);
+        esp_video_buffer_ring_push(&stream[1]->done_ring, dst_element->index);
+        ret = ESP_OK;
     }
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
-
-    if (ret == ESP_OK && user_node) {
-        if (xPortInIsrContext()) {
-            BaseType_t wakeup = pdFALSE;
-
-            xSemaphoreGiveFromISR(stream[0]->ready_sem, &wakeup);
-            if (wakeup == pdTRUE) {
-                portYIELD_FROM_ISR();
-            }
 
-            xSemaphoreGiveFromISR(stream[1]->ready_sem, &wakeup);
-            if (wakeup == pdTRUE) {
-                portYIELD_FROM_ISR();
-            }
-        } else {
-            xSemaphoreGive(stream[0]->ready_sem);
-            xSemaphoreGive(stream[1]->ready_sem);
+    if (ret == ESP_OK && user_node) {
+        if (!stream[0]->link) {
+            esp_video_give_ready_sem(stream[0]);
         }
+        esp_video_give_ready_sem(stream[1]);
+
+        esp_video_vfs_notify(video);
     }
 
     return ret;
@@ -1402,14 +2330,22 @@ esp_err_t esp_video_get_m2m_queued_elements(struct esp_video *video,
         return ESP_ERR_INVALID_ARG;
     }
 
+    /**
+     * Both elements are taken or none. Only consumers are serialized here, producers
+     * only add elements, so two heads seen by peek are still there for pop.
+     */
+    uint32_t src_index;
+    uint32_t dst_index;
+
     portENTER_CRITICAL_SAFE(&video->stream_lock);
-    if (!TAILQ_EMPTY(&stream[0]->queued_list) && !TAILQ_EMPTY(&stream[1]->queued_list)) {
-        *src_element = TAILQ_FIRST(&stream[0]->queued_list);
-        TAILQ_REMOVE(&stream[0]->queued_list, *src_element, node);
+    if (esp_video_buffer_ring_peek(&stream[0]->queued_ring, &src_index) &&
+            esp_video_buffer_ring_peek(&stream[1]->queued_ring, &dst_index)) {
+        esp_video_buffer_ring_pop(&stream[0]->queued_ring, &src_index);
+        *src_element = ESP_VIDEO_BUFFER_ELEMENT(stream[0]->buffer, src_index);
         ELEMENT_SET_FREE(*src_element);
 
-        *dst_element = TAILQ_FIRST(&stream[1]->queued_list);
-        TAILQ_REMOVE(&stream[1]->queued_list, *dst_element, node);
+        esp_video_buffer_ring_pop(&stream[1]->queued_ring, &dst_index);
+        *dst_element = ESP_VIDEO_BUFFER_ELEMENT(stream[1]->buffer, dst_index);
         ELEMENT_SET_FREE(*dst_element);
 
         ret = ESP_OK;
@@ -1608,13 +2544,23 @@ esp_err_t esp_video_m2m_process(struct esp_video *video, uint32_t src_type, uint
         return ret;
     }
 
-    ret = proc(video, ELEMENT_BUFFER(src_element), ELEMENT_SIZE(src_element),
+    /* Only the queued data of the source is given, so the driver cleans no more of the cache than that */
+    ESP_VIDEO_TRACE_START(ESP_VIDEO_TRACE_M2M_PROCESS);
+    ret = proc(video, ELEMENT_BUFFER(src_element), src_element->bytesused ? src_element->bytesused : ELEMENT_SIZE(src_element),
                ELEMENT_BUFFER(dst_element), ELEMENT_SIZE(dst_element), &dst_out_size);
+    ESP_VIDEO_TRACE_STOP(ESP_VIDEO_TRACE_M2M_PROCESS);
     if (ret != ESP_OK) {
         dst_element->valid_size = 0;
     } else {
         dst_element->valid_size = dst_out_size;
     }
+    if (esp_video_get_stream(video, src_type)->link) {
+        /* The frame comes from a linked capture stream, its result keeps the capture time and sequence */
+        dst_element->timestamp_us = src_element->timestamp_us;
+        dst_element->sequence = src_element->sequence;
+        dst_element->dropped = src_element->dropped;
+        dst_element->sensor = src_element->sensor;
+    }
     ret = esp_video_done_m2m_elements(video, src_type, src_element, dst_type, dst_element);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "failed to put elements back into done list");
@@ -1624,6 +2570,92 @@ esp_err_t esp_video_m2m_process(struct esp_video *video, uint32_t src_type, uint
     return ESP_OK;
 }
 
+/**
+ * @brief Link the capture stream of a video device to the output stream of an M2M device.
+ *
+ * Both streams must be stopped and have the same number of buffers, the M2M
+ * output buffers are USERPTR ones, as they borrow the capture payloads.
+ *
+ * @param source Capture video object
+ * @param sink   M2M video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_link(struct esp_video *source, struct esp_video *sink)
+{
+    struct esp_video_stream *source_stream;
+    struct esp_video_stream *sink_stream;
+
+    CHECK_VIDEO_OBJ(source);
+    CHECK_VIDEO_OBJ(sink);
+
+#if CONFIG_ESP_VIDEO_ENABLE_DATA_PREPROCESSING
+    /* Preprocessing runs when the application dequeues a capture buffer, which a linked stream never does */
+    ESP_LOGE(TAG, "Links do not support data preprocessing");
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+
+    if ((source->device_caps & V4L2_CAP_VIDEO_M2M) || !(sink->device_caps & V4L2_CAP_VIDEO_M2M)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    source_stream = esp_video_get_stream(source, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    sink_stream = esp_video_get_stream(sink, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    if (!source_stream || !sink_stream) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (source_stream->link || sink_stream->link || source_stream->started || sink_stream->started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!source_stream->buffer || !sink_stream->buffer ||
+            (sink_stream->buf_info.memory_type != V4L2_MEMORY_USERPTR) ||
+            (sink_stream->buf_info.count != source_stream->buf_info.count)) {
+        ESP_LOGE(TAG, "M2M output needs %" PRIu32 " USERPTR buffers", source_stream->buf_info.count);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    source_stream->link = sink;
+    sink_stream->link = source;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Remove the link of a capture video device.
+ *
+ * @param source Capture video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_unlink(struct esp_video *source)
+{
+    struct esp_video_stream *source_stream;
+    struct esp_video_stream *sink_stream;
+
+    CHECK_VIDEO_OBJ(source);
+
+    source_stream = esp_video_get_stream(source, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    if (!source_stream || !source_stream->link) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sink_stream = esp_video_get_stream(source_stream->link, V4L2_BUF_TYPE_VIDEO_OUTPUT);
+    if (source_stream->started || sink_stream->started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    source_stream->link = NULL;
+    sink_stream->link = NULL;
+
+    return ESP_OK;
+}
+
 /**
  * @brief Set format to sensor
  *
@@ -1634,54 +2666,343 @@ esp_err_t esp_video_m2m_process(struct esp_video *video, uint32_t src_type, uint
  *      - ESP_OK on success
  *      - Others if failed
  */
-esp_err_t esp_video_set_sensor_format(struct esp_video *video, const esp_cam_sensor_format_t *format)
+esp_err_t esp_video_set_sensor_format(struct esp_video *video, const esp_cam_sensor_format_t *format)
+{
+    esp_err_t ret;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (video->ops->set_sensor_format) {
+        ret = video->ops->set_sensor_format(video, format);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "video->ops->set_sensor_format=%x", ret);
+            return ret;
+        }
+    } else {
+        ESP_LOGD(TAG, "video->ops->set_sensor_format=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get format from sensor
+ *
+ * @param video  Video object
+ * @param format Sensor format pointer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_get_sensor_format(struct esp_video *video, esp_cam_sensor_format_t *format)
+{
+    esp_err_t ret;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (video->ops->get_sensor_format) {
+        ret = video->ops->get_sensor_format(video, format);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "video->ops->get_sensor_format=%x", ret);
+            return ret;
+        }
+    } else {
+        ESP_LOGD(TAG, "video->ops->get_sensor_format=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get exposure and gain delay of sensor
+ *
+ * @param video  Video object
+ * @param frames Returned frames between a write and the first frame captured with it
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the sensor does not report it
+ *      - Others if failed
+ */
+esp_err_t esp_video_get_sensor_ctrl_delay(struct esp_video *video, uint32_t *frames)
+{
+    CHECK_VIDEO_OBJ(video);
+
+    if (!video->ops->get_sensor_ctrl_delay) {
+        ESP_LOGD(TAG, "video->ops->get_sensor_ctrl_delay=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return video->ops->get_sensor_ctrl_delay(video, frames);
+}
+
+/**
+ * @brief Queue sensor settings for one frame of a capture device
+ *
+ * @param video   Video object
+ * @param request Capture request
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device does not take capture requests
+ *      - ESP_ERR_NOT_FINISHED if the request queue is full
+ *      - Others if failed
+ */
+esp_err_t esp_video_queue_capture_request(struct esp_video *video, const struct esp_video_capture_request *request)
+{
+    CHECK_VIDEO_OBJ(video);
+
+    if (!video->ops->queue_capture_request) {
+        ESP_LOGD(TAG, "video->ops->queue_capture_request=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return video->ops->queue_capture_request(video, request);
+}
+
+/* Whether an encoder device takes a pixel format on its input queue */
+static bool esp_video_encoder_takes_format(uint8_t id, uint32_t pixel_format)
+{
+    uint32_t format;
+    struct esp_video *encoder = esp_video_device_get_object_by_id(id);
+
+    if (!encoder || !encoder->ops->enum_format) {
+        return false;
+    }
+
+    for (uint32_t i = 0; encoder->ops->enum_format(encoder, V4L2_BUF_TYPE_VIDEO_OUTPUT, i, &format) == ESP_OK; i++) {
+        if (format == pixel_format) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Enumerate valid combinations of sensor mode and capture format
+ *
+ * @param video Video object
+ * @param cap   Format capability, index given by the caller
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device has no format capabilities
+ *      - ESP_ERR_INVALID_ARG if the index is past the last entry
+ */
+esp_err_t esp_video_enum_format_cap(struct esp_video *video, struct esp_video_format_cap *cap)
+{
+    esp_err_t ret;
+
+    CHECK_VIDEO_OBJ(video);
+    CHECK_PARAM(cap, ESP_ERR_INVALID_ARG, TAG, "cap=NULL");
+
+    if (!video->ops->enum_format_cap) {
+        ESP_LOGD(TAG, "video->ops->enum_format_cap=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /* Past the last entry is how the list ends, it is not logged */
+    ret = video->ops->enum_format_cap(video, cap);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* The encoders are created after the capture devices, they are looked up on every call */
+    if (esp_video_encoder_takes_format(ESP_VIDEO_JPEG_DEVICE_ID, cap->pixelformat)) {
+        cap->flags |= ESP_VIDEO_FORMAT_CAP_JPEG;
+    }
+    if (esp_video_encoder_takes_format(ESP_VIDEO_H264_DEVICE_ID, cap->pixelformat)) {
+        cap->flags |= ESP_VIDEO_FORMAT_CAP_H264;
+    }
+
+    return ESP_OK;
+}
+
+/* Whether format capability a is a better choice than b */
+static bool esp_video_format_cap_is_better(const struct esp_video_format_cap *a, const struct esp_video_format_cap *b)
+{
+    uint32_t a_pixels = a->width * a->height;
+    uint32_t b_pixels = b->width * b->height;
+
+    if (a_pixels != b_pixels) {
+        return a_pixels > b_pixels;
+    }
+    if (a->fps != b->fps) {
+        return a->fps > b->fps;
+    }
+    if (a->mem_kbps != b->mem_kbps) {
+        return a->mem_kbps < b->mem_kbps;
+    }
+
+    return (a->flags & ESP_VIDEO_FORMAT_CAP_CURRENT) && !(b->flags & ESP_VIDEO_FORMAT_CAP_CURRENT);
+}
+
+/**
+ * @brief Find the best format capability for the requirements
+ *
+ * @param video Video object
+ * @param query Requirements, the entry found is returned in it
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if no entry meets the requirements
+ */
+esp_err_t esp_video_query_best_format(struct esp_video *video, struct esp_video_format_query *query)
+{
+    bool found = false;
+    struct esp_video_format_cap cap;
+
+    CHECK_VIDEO_OBJ(video);
+    CHECK_PARAM(query, ESP_ERR_INVALID_ARG, TAG, "query=NULL");
+
+    if (!video->ops->enum_format_cap) {
+        ESP_LOGD(TAG, "video->ops->enum_format_cap=NULL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    for (cap.index = 0; esp_video_enum_format_cap(video, &cap) == ESP_OK; cap.index++) {
+        if ((query->pixelformat && cap.pixelformat != query->pixelformat) ||
+                cap.fps < query->min_fps ||
+                (query->max_mem_kbps && cap.mem_kbps > query->max_mem_kbps) ||
+                (cap.flags & query->flags) != query->flags) {
+            continue;
+        }
+
+        if (!found || esp_video_format_cap_is_better(&cap, &query->cap)) {
+            query->cap = cap;
+            found = true;
+        }
+    }
+
+    return found ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+/**
+ * @brief Record camera sensor settings that apply to the frames from a delay on
+ *
+ * @param video    Video object
+ * @param type     Video stream type
+ * @param settings Settings just written to the sensor
+ * @param delay    Frames between the frame being captured and the first frame with the settings
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_set_sensor_settings(struct esp_video *video, uint32_t type,
+                                        const struct esp_video_sensor_settings *settings, uint32_t delay)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_sensor_track *track;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    track = &stream->sensor;
+
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    if (track->pending_num == ESP_VIDEO_SENSOR_PENDING_NUM) {
+        /* Written more often than frames are captured, the oldest write is surely in effect */
+        track->current = track->pending[0].settings;
+        for (int i = 1; i < track->pending_num; i++) {
+            track->pending[i - 1] = track->pending[i];
+        }
+        track->pending_num--;
+    }
+    /* stream->sequence is the number the frame being captured gets */
+    track->pending[track->pending_num].sequence = stream->sequence + delay;
+    track->pending[track->pending_num].settings = *settings;
+    track->pending_num++;
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the sensor settings of the frame in a buffer
+ *
+ * @param video Video object
+ * @param meta  Frame metadata, the type and index are given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the index is invalid
+ */
+esp_err_t esp_video_get_frame_meta(struct esp_video *video, struct esp_video_frame_meta *meta)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_buffer_element *element;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, meta->type);
+    if (!stream || !stream->buffer || meta->index >= stream->buffer->info.count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    element = ESP_VIDEO_BUFFER_ELEMENT(stream->buffer, meta->index);
+
+    meta->sequence = element->sequence;
+    meta->flags = element->sensor.flags;
+    meta->exposure = element->sensor.exposure;
+    meta->gain = element->sensor.gain;
+    meta->trigger_us = element->sensor.trigger_us;
+    meta->request_id = element->sensor.request_id;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Record the frame start trigger edge of the frame being captured, called from an ISR
+ *
+ * @param video        Video object
+ * @param type         Video stream type
+ * @param timestamp_us esp_timer time of the edge
+ *
+ * @return None
+ */
+void IRAM_ATTR esp_video_set_frame_trigger(struct esp_video *video, uint32_t type, int64_t timestamp_us)
 {
-    esp_err_t ret;
-
-    CHECK_VIDEO_OBJ(video);
+    struct esp_video_stream *stream = esp_video_get_stream(video, type);
 
-    if (video->ops->set_sensor_format) {
-        ret = video->ops->set_sensor_format(video, format);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "video->ops->set_sensor_format=%x", ret);
-            return ret;
-        }
-    } else {
-        ESP_LOGD(TAG, "video->ops->set_sensor_format=NULL");
-        return ESP_ERR_NOT_SUPPORTED;
+    if (!stream) {
+        return;
     }
 
-    return ESP_OK;
+    /* The frame done next is the one started at the edge, a later edge replaces a missed one */
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    stream->sensor.trigger_us = timestamp_us;
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
 }
 
 /**
- * @brief Get format from sensor
+ * @brief Record a lens move, the frames read out while the lens moves are flagged
  *
- * @param video  Video object
- * @param format Sensor format pointer
+ * @param video    Video object
+ * @param type     Video stream type
+ * @param start_us esp_timer time the move started
+ * @param end_us   esp_timer time the lens settles
  *
- * @return
- *      - ESP_OK on success
- *      - Others if failed
+ * @return None
  */
-esp_err_t esp_video_get_sensor_format(struct esp_video *video, esp_cam_sensor_format_t *format)
+void esp_video_set_lens_move(struct esp_video *video, uint32_t type, int64_t start_us, int64_t end_us)
 {
-    esp_err_t ret;
+    struct esp_video_stream *stream = esp_video_get_stream(video, type);
 
-    CHECK_VIDEO_OBJ(video);
-
-    if (video->ops->get_sensor_format) {
-        ret = video->ops->get_sensor_format(video, format);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "video->ops->get_sensor_format=%x", ret);
-            return ret;
-        }
-    } else {
-        ESP_LOGD(TAG, "video->ops->get_sensor_format=NULL");
-        return ESP_ERR_NOT_SUPPORTED;
+    if (!stream) {
+        return;
     }
 
-    return ESP_OK;
+    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    stream->sensor.lens_start_us = start_us;
+    stream->sensor.lens_end_us = end_us;
+    portEXIT_CRITICAL_SAFE(&video->stream_lock);
 }
 
 /**
@@ -1919,6 +3240,174 @@ esp_err_t esp_video_set_parm(struct esp_video *video, struct v4l2_streamparm *st
     return ESP_OK;
 }
 
+/**
+ * @brief Set the drop policy of a capture stream
+ *
+ * @param video  Video object
+ * @param policy Drop policy
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the policy is invalid
+ */
+esp_err_t esp_video_set_drop_policy(struct esp_video *video, const struct esp_video_drop_policy *policy)
+{
+    struct esp_video_stream *stream;
+
+    CHECK_VIDEO_OBJ(video);
+
+    /* Recycling a done output element would hand consumed data back to the hardware */
+    if (policy->type != V4L2_BUF_TYPE_VIDEO_CAPTURE ||
+            (policy->policy != ESP_VIDEO_DROP_NEWEST && policy->policy != ESP_VIDEO_DROP_OLDEST)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stream = esp_video_get_stream(video, policy->type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stream->drop_policy = policy->policy;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the drop policy of a capture stream
+ *
+ * @param video  Video object
+ * @param policy Drop policy, the type is given and the policy is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_drop_policy(struct esp_video *video, struct esp_video_drop_policy *policy)
+{
+    struct esp_video_stream *stream;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (policy->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stream = esp_video_get_stream(video, policy->type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    policy->policy = stream->drop_policy;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the convergence state of a capture stream
+ *
+ * @param video       Video object
+ * @param convergence Convergence state
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type or the state is invalid
+ */
+esp_err_t esp_video_set_convergence(struct esp_video *video, const struct esp_video_convergence *convergence)
+{
+    struct esp_video_stream *stream;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (convergence->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || convergence->state > ESP_VIDEO_CONVERGENCE_DONE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stream = esp_video_get_stream(video, convergence->type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Read in the ISR, the hold is set first so that a pending state never delivers a frame */
+    stream->convergence_hold = convergence->hold ? 1 : 0;
+    stream->convergence = convergence->state;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the convergence state of a capture stream
+ *
+ * @param video       Video object
+ * @param convergence Convergence state, the type is given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_convergence(struct esp_video *video, struct esp_video_convergence *convergence)
+{
+    struct esp_video_stream *stream;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (convergence->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stream = esp_video_get_stream(video, convergence->type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    convergence->state = stream->convergence;
+    convergence->hold = stream->convergence_hold;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the statistics of a video stream
+ *
+ * @param video Video object
+ * @param stats Statistics, the type is given and the rest is returned
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the stream type is invalid
+ */
+esp_err_t esp_video_get_stream_stats(struct esp_video *video, struct esp_video_stream_stats *stats)
+{
+    struct esp_video_stream *stream;
+    struct esp_video_stream_counters *counters;
+
+    CHECK_VIDEO_OBJ(video);
+
+    stream = esp_video_get_stream(video, stats->type);
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    counters = &stream->counters;
+
+    stats->sequence = stream->sequence;
+    stats->delivered = counters->delivered;
+    stats->dropped = stream->dropped;
+    stats->skipped = counters->skipped;
+    stats->no_buffer = counters->no_buffer;
+    stats->recycled = counters->recycled;
+    stats->max_done_depth = counters->max_done_depth;
+    stats->latency_min_us = counters->latency_min_us;
+    stats->latency_avg_us = counters->latency_count ? (uint32_t)(counters->latency_total_us / counters->latency_count) : 0;
+    stats->latency_max_us = counters->latency_max_us;
+    stats->rx_crc_errors = counters->rx_crc_errors;
+    stats->rx_ecc_errors = counters->rx_ecc_errors;
+    stats->rx_phy_errors = counters->rx_phy_errors;
+    stats->rx_frame_errors = counters->rx_frame_errors;
+    stats->rx_overflows = counters->rx_overflows;
+    stats->recoveries = counters->recoveries;
+
+    return ESP_OK;
+}
+
 /**
  * @brief Get V4L2 stream parameters
  *
@@ -1973,10 +3462,10 @@ void IRAM_ATTR esp_video_skip_buffer(struct esp_video *video, uint32_t type, uin
 
     element = esp_video_buffer_get_element_by_buffer(stream->buffer, buffer);
 
-    portENTER_CRITICAL_SAFE(&video->stream_lock);
+    /* The ring has no head insertion, the skipped element is used again after the ones queued before it */
     ELEMENT_SET_ALLOCATED(element);
-    TAILQ_INSERT_HEAD(&stream->queued_list, element, node);
-    portEXIT_CRITICAL_SAFE(&video->stream_lock);
+    esp_video_buffer_ring_push(&stream->queued_ring, element->index);
+    stream->counters.skipped++;
 }
 
 /**
@@ -2048,3 +3537,162 @@ esp_err_t esp_video_enum_frameintervals(struct esp_video *video, struct v4l2_frm
 
     return ESP_OK;
 }
+
+/**
+ * @brief Set up the buffers of read() and start capturing.
+ *
+ * @param video  Video object
+ * @param stream Capture stream
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+static esp_err_t esp_video_read_start(struct esp_video *video, struct esp_video_stream *stream)
+{
+    esp_err_t ret;
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    ret = esp_video_setup_buffer(video, type, V4L2_MEMORY_MMAP, READ_BUFFER_COUNT);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (int i = 0; i < READ_BUFFER_COUNT; i++) {
+        ret = esp_video_prepare_element_index(video, type, i, 0, 0);
+        if (ret == ESP_OK) {
+            ret = esp_video_queue_element_index(video, type, i);
+        }
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    /* A reader that falls behind gets the latest frames rather than the ones it missed */
+    stream->drop_policy = ESP_VIDEO_DROP_OLDEST;
+
+    ret = esp_video_start_capture(video, type);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    video->read_io = 1;
+    video->read_held = 0;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the latest frame of a capture device for read() and VIDIOC_READ_FRAME.
+ *
+ * The first call sets up the device's own MMAP buffers and starts capturing. Every call gives
+ * the buffer of the previous one back, queues all but the newest done buffer again without
+ * preprocessing them and lends the newest one to the caller.
+ *
+ * @param video Video object
+ * @param ticks Wait OS tick
+ * @param frame Returned frame, valid until the next call, esp_video_read_release or close
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the device is no capture device
+ *      - ESP_ERR_INVALID_STATE if the application streams with its own buffers
+ *      - ESP_ERR_TIMEOUT if ticks is 0 and no frame is done
+ *      - Others if failed
+ */
+esp_err_t esp_video_read_frame(struct esp_video *video, uint32_t ticks, struct esp_video_read_frame *frame)
+{
+    esp_err_t ret;
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    struct esp_video_stream *stream;
+    struct esp_video_buffer_element *element;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if ((video->device_caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_M2M)) != V4L2_CAP_VIDEO_CAPTURE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    stream = esp_video_get_stream(video, type);
+    if (!stream) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /* VIDIOC_STREAMOFF of the application ends the read I/O as well */
+    if (video->read_io && !stream->started) {
+        video->read_io = 0;
+        video->read_held = 0;
+    }
+
+    if (!video->read_io) {
+        if (stream->started) {
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        ret = esp_video_read_start(video, stream);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    ret = esp_video_read_release(video);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    while (uxSemaphoreGetCount(stream->ready_sem) > 1 && xSemaphoreTake(stream->ready_sem, 0) == pdTRUE) {
+        element = esp_video_get_done_element(video, type);
+        if (element) {
+            esp_video_prepare_element_index(video, type, element->index, 0, 0);
+            esp_video_queue_element(video, type, element);
+        }
+    }
+
+    element = esp_video_recv_element(video, type, ticks);
+    if (!element) {
+        return ticks ? ESP_FAIL : ESP_ERR_TIMEOUT;
+    }
+
+    video->read_index = element->index;
+    video->read_held = 1;
+
+    frame->data = element->buffer;
+    frame->size = element->valid_size;
+    frame->index = element->index;
+    frame->sequence = element->sequence;
+    frame->flags = element->flags | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    frame->flags |= element->valid_size ? V4L2_BUF_FLAG_DONE : V4L2_BUF_FLAG_ERROR;
+    frame->timestamp.tv_sec = element->timestamp_us / 1000000;
+    frame->timestamp.tv_usec = element->timestamp_us % 1000000;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Queue the capture buffer of the last esp_video_read_frame call again.
+ *
+ * @param video Video object
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t esp_video_read_release(struct esp_video *video)
+{
+    esp_err_t ret;
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    CHECK_VIDEO_OBJ(video);
+
+    if (!video->read_held) {
+        return ESP_OK;
+    }
+    video->read_held = 0;
+
+    ret = esp_video_prepare_element_index(video, type, video->read_index, 0, 0);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    return esp_video_queue_element_index(video, type, video->read_index);
+}
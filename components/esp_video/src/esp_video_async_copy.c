@@ -0,0 +1,165 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_cache.h"
+#include "esp_memory_utils.h"
+#include "esp_async_memcpy.h"
+#include "soc/soc_caps.h"
+#include "esp_video_async_copy.h"
+
+#define ASYNC_COPY_DEFAULT_BACKLOG  1
+
+/**
+ * @brief Copy in flight, copies on one channel complete in the order they were started
+ */
+struct async_copy_trans {
+    void *dst;
+    size_t size;
+    esp_video_async_copy_done_cb_t done_cb;
+    void *arg;
+};
+
+struct esp_video_async_copy {
+    async_memcpy_handle_t mcp;
+    portMUX_TYPE lock;
+    uint32_t backlog;
+    uint32_t head;                              /*!< Next free transaction */
+    uint32_t tail;                              /*!< Oldest transaction in flight */
+    uint32_t pending;                           /*!< Transactions in flight */
+    struct async_copy_trans trans[];
+};
+
+static const char *TAG = "video_async_copy";
+
+static size_t async_copy_get_alignment(const void *ptr)
+{
+    size_t alignment = 0;
+
+    esp_cache_get_alignment(esp_ptr_external_ram(ptr) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL, &alignment);
+    return alignment ? alignment : 4;
+}
+
+static bool IRAM_ATTR async_copy_done(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *cb_args)
+{
+    esp_video_async_copy_handle_t handle = (esp_video_async_copy_handle_t)cb_args;
+    struct async_copy_trans *trans;
+
+    portENTER_CRITICAL_ISR(&handle->lock);
+    trans = &handle->trans[handle->tail];
+    handle->tail = (handle->tail + 1) % handle->backlog;
+    portEXIT_CRITICAL_ISR(&handle->lock);
+
+    /* Drop anything the CPU may have fetched from the destination while the DMA was writing it */
+    esp_cache_msync(trans->dst, trans->size, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+
+    bool woken = trans->done_cb(trans->dst, trans->size, trans->arg);
+
+    portENTER_CRITICAL_ISR(&handle->lock);
+    handle->pending--;
+    portEXIT_CRITICAL_ISR(&handle->lock);
+
+    return woken;
+}
+
+esp_err_t esp_video_async_copy_create(const esp_video_async_copy_config_t *config,
+                                      esp_video_async_copy_handle_t *ret_handle)
+{
+    esp_err_t ret;
+    esp_video_async_copy_handle_t handle;
+    uint32_t backlog = config && config->backlog ? config->backlog : ASYNC_COPY_DEFAULT_BACKLOG;
+    async_memcpy_config_t mcp_config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+
+    ESP_RETURN_ON_FALSE(ret_handle, ESP_ERR_INVALID_ARG, TAG, "ret_handle is NULL");
+
+    handle = heap_caps_calloc(1, sizeof(struct esp_video_async_copy) + backlog * sizeof(struct async_copy_trans),
+                              MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_NO_MEM, TAG, "failed to allocate async copy");
+
+    handle->lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    handle->backlog = backlog;
+
+    mcp_config.backlog = backlog;
+#if SOC_AXI_GDMA_SUPPORTED
+    /* Only the AXI GDMA reaches PSRAM, where the frame buffers are */
+    ret = esp_async_memcpy_install_gdma_axi(&mcp_config, &handle->mcp);
+#else
+    ret = esp_async_memcpy_install(&mcp_config, &handle->mcp);
+#endif
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to install async memcpy: %s", esp_err_to_name(ret));
+        heap_caps_free(handle);
+        return ret;
+    }
+
+    *ret_handle = handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_video_async_copy_start(esp_video_async_copy_handle_t handle, void *dst, const void *src, size_t size,
+                                     uint32_t flags, esp_video_async_copy_done_cb_t done_cb, void *arg)
+{
+    esp_err_t ret;
+    struct async_copy_trans *trans;
+    uint32_t index;
+
+    ESP_RETURN_ON_FALSE(handle && dst && src && size && done_cb, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(((uintptr_t)dst | size) % async_copy_get_alignment(dst) == 0 &&
+                        ((uintptr_t)src | size) % async_copy_get_alignment(src) == 0,
+                        ESP_ERR_INVALID_ARG, TAG, "buffers must be cache line aligned");
+
+    portENTER_CRITICAL(&handle->lock);
+    if (handle->pending >= handle->backlog) {
+        portEXIT_CRITICAL(&handle->lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    index = handle->head;
+    handle->head = (handle->head + 1) % handle->backlog;
+    handle->pending++;
+    portEXIT_CRITICAL(&handle->lock);
+
+    trans = &handle->trans[index];
+    trans->dst = dst;
+    trans->size = size;
+    trans->done_cb = done_cb;
+    trans->arg = arg;
+
+    /* The DMA reads memory, not the cache, and no dirty line may be evicted over its result */
+    if (!(flags & ESP_VIDEO_ASYNC_COPY_FLAG_NO_SRC_CLEAN)) {
+        ESP_GOTO_ON_ERROR(esp_cache_msync((void *)src, size, ESP_CACHE_MSYNC_FLAG_DIR_C2M), fail, TAG, "failed to sync source");
+    }
+    ESP_GOTO_ON_ERROR(esp_cache_msync(dst, size, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE),
+                      fail, TAG, "failed to sync destination");
+
+    ESP_GOTO_ON_ERROR(esp_async_memcpy(handle->mcp, dst, (void *)src, size, async_copy_done, handle), fail,
+                      TAG, "failed to start copy");
+
+    return ESP_OK;
+
+fail:
+    /* Nothing is in flight behind this transaction, the copy was started from a single task */
+    portENTER_CRITICAL(&handle->lock);
+    handle->head = index;
+    handle->pending--;
+    portEXIT_CRITICAL(&handle->lock);
+    return ret;
+}
+
+esp_err_t esp_video_async_copy_delete(esp_video_async_copy_handle_t handle)
+{
+    ESP_RETURN_ON_FALSE(handle, ESP_ERR_INVALID_ARG, TAG, "handle is NULL");
+    ESP_RETURN_ON_FALSE(!handle->pending, ESP_ERR_INVALID_STATE, TAG, "copy in flight");
+
+    ESP_RETURN_ON_ERROR(esp_async_memcpy_uninstall(handle->mcp), TAG, "failed to uninstall async memcpy");
+    heap_caps_free(handle);
+
+    return ESP_OK;
+}
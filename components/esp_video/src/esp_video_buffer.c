@@ -7,14 +7,105 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/lock.h>
+#include <sys/param.h>
 #include "linux/videodev2.h"
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_private/esp_cache_private.h"
 #include "esp_video_buffer.h"
 #include "esp_video_internal.h"
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+#include "esp_video_mem_pool.h"
+#endif
+
+#define ESP_VIDEO_DMABUF_FD_BASE    0x4000  /*!< First DMABUF handle, far above the VFS file descriptors */
+#define ESP_VIDEO_DMABUF_MAX        32      /*!< Maximum number of exported buffer elements */
+
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+#define ELEMENT_BUFFER_ALLOC(a, s, c)   esp_video_mem_pool_alloc(a, s, c)
+#define ELEMENT_BUFFER_FREE(p)          esp_video_mem_pool_free(p)
+#else
+#define ELEMENT_BUFFER_ALLOC(a, s, c)   heap_caps_aligned_alloc(a, s, c)
+#define ELEMENT_BUFFER_FREE(p)          heap_caps_free(p)
+#endif
+
+/* The CPU walks the element table on every QBUF and DQBUF, it never goes to PSRAM with the payloads */
+#define ELEMENT_TABLE_CAPS          (MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL)
+
+#if CONFIG_ESP_VIDEO_BUFFER_STAGGER
+#define ELEMENT_STAGGER_SLOTS       4       /*!< Consecutive elements start at this many different offsets */
+#endif
 
 static const char *TAG = "esp_video_buffer";
 
+/* Exported elements, the DMABUF handle is the table index plus ESP_VIDEO_DMABUF_FD_BASE */
+static struct esp_video_buffer_element *s_dmabuf[ESP_VIDEO_DMABUF_MAX];
+static _lock_t s_dmabuf_lock;
+
+/**
+ * @brief Alignment of the element payloads
+ *
+ * Payloads a DMA reaches through the cache are rounded up to whole cache
+ * lines, so no line is shared with other data and none has to be written
+ * back around a transfer.
+ */
+static uint32_t buffer_payload_align(const struct esp_video_buffer_info *info)
+{
+    size_t cache_align = 0;
+
+    if ((info->caps & (MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA)) &&
+            esp_cache_get_alignment(info->caps, &cache_align) == ESP_OK) {
+        return MAX(info->align_size, cache_align);
+    }
+
+    return info->align_size;
+}
+
+/**
+ * @brief Allocate the payload of an MMAP element
+ *
+ * Small metadata payloads, e.g. ISP statistics, are only read by the CPU
+ * and go to internal RAM. Frame payloads in PSRAM are staggered by element
+ * index, so frames the CPU reads side by side, e.g. when merging or
+ * stacking them, do not evict each other from the same cache sets.
+ */
+static uint8_t *buffer_alloc_payload(const struct esp_video_buffer_info *info, uint32_t index, uint32_t align,
+                                     uint32_t size, uint8_t **payload)
+{
+    uint32_t offset = 0;
+
+#if CONFIG_ESP_VIDEO_BUFFER_META_INTERNAL
+    if (info->owner == ESP_VIDEO_MEM_OWNER_META && size <= CONFIG_ESP_VIDEO_BUFFER_META_INTERNAL_MAX_SIZE) {
+        *payload = heap_caps_aligned_alloc(align, size, (info->caps & ~MALLOC_CAP_SPIRAM) | MALLOC_CAP_INTERNAL);
+        if (*payload) {
+            return *payload;
+        }
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_BUFFER_STAGGER
+    if (info->caps & MALLOC_CAP_SPIRAM) {
+        offset = (index % ELEMENT_STAGGER_SLOTS) * ESP_VIDEO_ALIGN(CONFIG_ESP_VIDEO_BUFFER_STAGGER_SIZE, align);
+    }
+#endif
+
+    *payload = ELEMENT_BUFFER_ALLOC(align, size + offset, info->caps);
+
+    return *payload ? *payload + offset : NULL;
+}
+
+/**
+ * @brief Free the payload of an MMAP element, the pool also frees heap blocks
+ */
+static void buffer_free_payload(const struct esp_video_buffer_info *info, struct esp_video_buffer_element *element,
+                                uint32_t size)
+{
+    VIDEO_MEM_REMOVE(info->owner, element->payload, size + (element->buffer - element->payload));
+    ELEMENT_BUFFER_FREE(element->payload);
+    element->payload = NULL;
+    element->buffer = NULL;
+}
+
 /**
  * @brief Create video buffer object.
  *
@@ -31,10 +122,11 @@ struct esp_video_buffer *esp_video_buffer_create(const struct esp_video_buffer_i
 {
     uint32_t size;
     struct esp_video_buffer *buffer;
-    uint32_t align_size = ESP_VIDEO_ALIGN(info->size, info->align_size);
+    uint32_t payload_align = buffer_payload_align(info);
+    uint32_t align_size = ESP_VIDEO_ALIGN(info->size, payload_align);
 
     size = sizeof(struct esp_video_buffer) + sizeof(struct esp_video_buffer_element) * info->count;
-    buffer = heap_caps_calloc(1, size, info->caps);
+    buffer = heap_caps_calloc(1, size, ELEMENT_TABLE_CAPS);
     if (!buffer) {
         ESP_LOGE(TAG, "Failed to malloc for video buffer");
         return NULL;
@@ -44,12 +136,16 @@ struct esp_video_buffer *esp_video_buffer_create(const struct esp_video_buffer_i
         struct esp_video_buffer_element *element = &buffer->element[i];
 
         if (info->memory_type == V4L2_MEMORY_MMAP) {
-            element->buffer = heap_caps_aligned_alloc(info->align_size, align_size, info->caps);
+            element->buffer = buffer_alloc_payload(info, i, payload_align, align_size, &element->payload);
             if (element->buffer) {
+                VIDEO_MEM_ADD(info->owner, element->payload, align_size + (element->buffer - element->payload));
                 element->index = i;
                 element->video_buffer = buffer;
                 ELEMENT_SET_FREE(element);
             } else {
+                VIDEO_MEM_FAIL(info->owner, align_size);
+                ESP_LOGE(TAG, "Failed to malloc %" PRIu32 " bytes for video buffer element %d, caps=%" PRIx32 " largest free block=%zu",
+                         align_size, i, info->caps, heap_caps_get_largest_free_block(info->caps & ~MALLOC_CAP_CACHE_ALIGNED));
                 goto exit_0;
             }
         } else {
@@ -62,6 +158,8 @@ struct esp_video_buffer *esp_video_buffer_create(const struct esp_video_buffer_i
 
     memcpy(&buffer->info, info, sizeof(struct esp_video_buffer_info));
     buffer->info.size = align_size;
+    buffer->alloc_count = info->count;
+    buffer->alloc_size = align_size;
 
     return buffer;
 
@@ -69,8 +167,8 @@ exit_0:
     for (int i = 0; i < info->count; i++) {
         struct esp_video_buffer_element *element = &buffer->element[i];
 
-        if (element->buffer) {
-            heap_caps_free(element->buffer);
+        if (element->payload) {
+            buffer_free_payload(info, element, align_size);
         }
     }
 
@@ -108,8 +206,17 @@ struct esp_video_buffer *esp_video_buffer_clone(const struct esp_video_buffer *b
 esp_err_t esp_video_buffer_destroy(struct esp_video_buffer *buffer)
 {
     if (buffer->info.memory_type == V4L2_MEMORY_MMAP) {
-        for (int i = 0; i < buffer->info.count; i++) {
-            heap_caps_free(buffer->element[i].buffer);
+        /* Handles of the freed elements are invalid from now on, importers fail on their next QBUF */
+        _lock_acquire(&s_dmabuf_lock);
+        for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+            if (s_dmabuf[i] && s_dmabuf[i]->video_buffer == buffer) {
+                s_dmabuf[i] = NULL;
+            }
+        }
+        _lock_release(&s_dmabuf_lock);
+
+        for (int i = 0; i < buffer->alloc_count; i++) {
+            buffer_free_payload(&buffer->info, &buffer->element[i], buffer->alloc_size);
         }
     }
 
@@ -118,6 +225,142 @@ esp_err_t esp_video_buffer_destroy(struct esp_video_buffer *buffer)
     return ESP_OK;
 }
 
+/**
+ * @brief Reuse a video buffer object for new buffer information
+ *
+ * @param buffer Video buffer object
+ * @param info   New buffer information
+ *
+ * @return
+ *      - ESP_OK if the buffer object is reused
+ *      - ESP_ERR_INVALID_SIZE if the new buffers do not fit, the object is not changed
+ */
+esp_err_t esp_video_buffer_reconfigure(struct esp_video_buffer *buffer, const struct esp_video_buffer_info *info)
+{
+    uint32_t align_size = ESP_VIDEO_ALIGN(info->size, buffer_payload_align(info));
+
+    if ((info->memory_type != buffer->info.memory_type) ||
+            (info->caps != buffer->info.caps) ||
+            (info->align_size != buffer->info.align_size) ||
+            (info->count > buffer->alloc_count) ||
+            ((info->memory_type == V4L2_MEMORY_MMAP) && (align_size > buffer->alloc_size))) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (info->memory_type == V4L2_MEMORY_MMAP) {
+        /* Spare elements stay allocated for a later grow, but they are not exported any more */
+        _lock_acquire(&s_dmabuf_lock);
+        for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+            if (s_dmabuf[i] && s_dmabuf[i]->video_buffer == buffer && s_dmabuf[i]->index >= info->count) {
+                s_dmabuf[i] = NULL;
+            }
+        }
+        _lock_release(&s_dmabuf_lock);
+    }
+
+    buffer->info.count = info->count;
+    buffer->info.size = align_size;
+    esp_video_buffer_reset(buffer);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Add elements to a video buffer object
+ *
+ * @param buffer Video buffer object
+ * @param count  New element count, not less than the current one
+ *
+ * @return
+ *      - Video buffer object pointer on success
+ *      - NULL if failed, the original object is not changed
+ */
+struct esp_video_buffer *esp_video_buffer_grow(struct esp_video_buffer *buffer, uint32_t count)
+{
+    struct esp_video_buffer *new_buffer;
+    uint8_t *payload[ESP_VIDEO_BUFFER_RING_SIZE] = {0};
+    uint8_t *data[ESP_VIDEO_BUFFER_RING_SIZE] = {0};
+    int32_t exported[ESP_VIDEO_DMABUF_MAX];
+    uint32_t alloc_count = buffer->alloc_count;
+    bool mmap = buffer->info.memory_type == V4L2_MEMORY_MMAP;
+
+    if (count < buffer->info.count || count > ESP_VIDEO_BUFFER_RING_SIZE) {
+        return NULL;
+    }
+
+    if (count <= alloc_count) {
+        for (int i = buffer->info.count; i < count; i++) {
+            ELEMENT_SET_FREE(&buffer->element[i]);
+            buffer->element[i].valid_size = 0;
+        }
+        buffer->info.count = count;
+        return buffer;
+    }
+
+    /* Payloads first, so that a failure leaves the object as it was */
+    if (mmap) {
+        for (int i = alloc_count; i < count; i++) {
+            data[i] = buffer_alloc_payload(&buffer->info, i, buffer_payload_align(&buffer->info), buffer->alloc_size,
+                                           &payload[i]);
+            if (!data[i]) {
+                VIDEO_MEM_FAIL(buffer->info.owner, buffer->alloc_size);
+                ESP_LOGE(TAG, "Failed to malloc for video buffer element");
+                goto exit_0;
+            }
+        }
+    }
+
+    /* Exported elements are referenced by pointer, they are rebased under the lock if the object moves */
+    _lock_acquire(&s_dmabuf_lock);
+    for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+        exported[i] = s_dmabuf[i] && s_dmabuf[i]->video_buffer == buffer ? (int32_t)s_dmabuf[i]->index : -1;
+    }
+
+    new_buffer = heap_caps_realloc(buffer, sizeof(struct esp_video_buffer) +
+                                   sizeof(struct esp_video_buffer_element) * count, ELEMENT_TABLE_CAPS);
+    if (!new_buffer) {
+        _lock_release(&s_dmabuf_lock);
+        ESP_LOGE(TAG, "Failed to realloc for video buffer");
+        goto exit_0;
+    }
+
+    for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+        if (exported[i] >= 0) {
+            s_dmabuf[i] = &new_buffer->element[exported[i]];
+        }
+    }
+    _lock_release(&s_dmabuf_lock);
+
+    for (int i = 0; i < count; i++) {
+        struct esp_video_buffer_element *element = &new_buffer->element[i];
+
+        if (i >= alloc_count) {
+            memset(element, 0, sizeof(struct esp_video_buffer_element));
+            element->index = i;
+            element->buffer = data[i];
+            element->payload = payload[i];
+            VIDEO_MEM_ADD(new_buffer->info.owner, payload[i], new_buffer->alloc_size + (data[i] - payload[i]));
+        }
+        if (i >= new_buffer->info.count) {
+            ELEMENT_SET_FREE(element);
+        }
+        element->video_buffer = new_buffer;
+    }
+
+    new_buffer->info.count = count;
+    new_buffer->alloc_count = count;
+
+    return new_buffer;
+
+exit_0:
+    for (int i = alloc_count; i < count; i++) {
+        if (payload[i]) {
+            ELEMENT_BUFFER_FREE(payload[i]);
+        }
+    }
+    return NULL;
+}
+
 /**
  * @brief Get element object pointer by buffer
  *
@@ -154,3 +397,99 @@ void esp_video_buffer_reset(struct esp_video_buffer *buffer)
         buffer->element[i].valid_size = 0;
     }
 }
+
+/**
+ * @brief Export a buffer element as a DMABUF handle
+ *
+ * @param element Video buffer element object, of an MMAP buffer
+ * @param fd      Returned DMABUF handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the element is not driver allocated
+ *      - ESP_ERR_NO_MEM if the export table is full
+ */
+esp_err_t esp_video_buffer_export_element(struct esp_video_buffer_element *element, int *fd)
+{
+    int free_slot = -1;
+    esp_err_t ret = ESP_OK;
+
+    if (element->video_buffer->info.memory_type != V4L2_MEMORY_MMAP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _lock_acquire(&s_dmabuf_lock);
+    for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+        if (s_dmabuf[i] == element) {
+            free_slot = i;
+            break;
+        } else if (!s_dmabuf[i] && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot >= 0) {
+        s_dmabuf[free_slot] = element;
+        *fd = ESP_VIDEO_DMABUF_FD_BASE + free_slot;
+    } else {
+        ESP_LOGE(TAG, "No free DMABUF handle");
+        ret = ESP_ERR_NO_MEM;
+    }
+    _lock_release(&s_dmabuf_lock);
+
+    return ret;
+}
+
+/**
+ * @brief Get the buffer behind a DMABUF handle
+ *
+ * @param fd     DMABUF handle
+ * @param buffer Returned buffer pointer
+ * @param size   Returned buffer size
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the handle is unknown or its buffer was freed
+ */
+esp_err_t esp_video_buffer_import(int fd, uint8_t **buffer, uint32_t *size)
+{
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    int slot = fd - ESP_VIDEO_DMABUF_FD_BASE;
+
+    if (slot < 0 || slot >= ESP_VIDEO_DMABUF_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _lock_acquire(&s_dmabuf_lock);
+    if (s_dmabuf[slot]) {
+        *buffer = ELEMENT_BUFFER(s_dmabuf[slot]);
+        *size = ELEMENT_SIZE(s_dmabuf[slot]);
+        ret = ESP_OK;
+    }
+    _lock_release(&s_dmabuf_lock);
+
+    return ret;
+}
+
+/**
+ * @brief Get the DMABUF handle of an exported buffer
+ *
+ * @param buffer Buffer pointer
+ *
+ * @return DMABUF handle, or -1 if the buffer is not exported
+ */
+int esp_video_buffer_get_dmabuf_fd(const uint8_t *buffer)
+{
+    int fd = -1;
+
+    _lock_acquire(&s_dmabuf_lock);
+    for (int i = 0; i < ESP_VIDEO_DMABUF_MAX; i++) {
+        if (s_dmabuf[i] && ELEMENT_BUFFER(s_dmabuf[i]) == buffer) {
+            fd = ESP_VIDEO_DMABUF_FD_BASE + i;
+            break;
+        }
+    }
+    _lock_release(&s_dmabuf_lock);
+
+    return fd;
+}
@@ -5,6 +5,8 @@
  */
 
 #include "esp_log.h"
+#include "esp_assert.h"
+#include "esp_bit_defs.h"
 #include "esp_cam_sensor.h"
 #if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
 #include "esp_cam_motor.h"
@@ -13,8 +15,10 @@
 #include "esp_video_cam.h"
 
 struct control_map {
-    uint32_t esp_cam_priv_id;
     uint32_t v4l2_id;
+    uint32_t esp_cam_priv_id;
+    uint8_t dev_type;                   /*!< cam_dev_type_t */
+    bool ioctl;                         /*!< esp_cam_priv_id is a sensor ioctl command instead of a parameter ID */
 };
 
 typedef enum cam_dev_type {
@@ -27,120 +31,126 @@ typedef enum cam_dev_type {
 static const char *TAG = "esp_video_cam";
 
 /**
- * Todo: AEG-1094
- *
- * @note The order of the control map table is important, because the control map table is used to
- *       get the control ID map pointer based on V4L2 control ID. Put the control ID that is most
- *       frequently used at the beginning of the table which can improve the performance of the
- *       control ID map pointer lookup.
+ * @note The table is sorted by V4L2 control ID for the binary search in get_v4l2_ext_control_map(),
+ *       the order is checked at compile time below. Insert a new control at its place in the ID order.
  */
-static const struct control_map s_sensor_control_map_table[] = {
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_GAIN,
-        .v4l2_id = V4L2_CID_GAIN,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_EXPOSURE_VAL,
-        .v4l2_id = V4L2_CID_EXPOSURE,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_STATS,
-        .v4l2_id = V4L2_CID_CAMERA_STATS
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_AE_LEVEL,
-        .v4l2_id = V4L2_CID_CAMERA_AE_LEVEL
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_GROUP_EXP_GAIN,
-        .v4l2_id = V4L2_CID_CAMERA_GROUP
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_EXPOSURE_US,
-        .v4l2_id = V4L2_CID_EXPOSURE_ABSOLUTE,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_JPEG_QUALITY,
-        .v4l2_id = V4L2_CID_JPEG_COMPRESSION_QUALITY,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_3A_LOCK,
-        .v4l2_id = V4L2_CID_3A_LOCK,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_FLASH_LED,
-        .v4l2_id = V4L2_CID_FLASH_LED_MODE,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_VFLIP,
-        .v4l2_id = V4L2_CID_VFLIP,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_HMIRROR,
-        .v4l2_id = V4L2_CID_HFLIP,
-    },
-};
-
-static const struct control_map s_sensor_control_ioctl_table[] = {
-    {
-        .esp_cam_priv_id = ESP_CAM_SENSOR_IOC_S_TEST_PATTERN,
-        .v4l2_id = V4L2_CID_TEST_PATTERN,
-    },
-};
-
+static const struct control_map s_control_map_table[] = {
+    { V4L2_CID_EXPOSURE,                    ESP_CAM_SENSOR_EXPOSURE_VAL,        CAM_DEV_SENSOR, false },
+    { V4L2_CID_GAIN,                        ESP_CAM_SENSOR_GAIN,                CAM_DEV_SENSOR, false },
+    { V4L2_CID_HFLIP,                       ESP_CAM_SENSOR_HMIRROR,             CAM_DEV_SENSOR, false },
+    { V4L2_CID_VFLIP,                       ESP_CAM_SENSOR_VFLIP,               CAM_DEV_SENSOR, false },
+    { V4L2_CID_EXPOSURE_ABSOLUTE,           ESP_CAM_SENSOR_EXPOSURE_US,         CAM_DEV_SENSOR, false },
 #if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
-static const struct control_map s_motor_control_map_table[] = {
-    {
-        .esp_cam_priv_id = ESP_CAM_MOTOR_POSITION_CODE,
-        .v4l2_id = V4L2_CID_FOCUS_ABSOLUTE,
-    },
-    {
-        .esp_cam_priv_id = ESP_CAM_MOTOR_MOVING_START_TIME,
-        .v4l2_id = V4L2_CID_MOTOR_START_TIME,
-    }
-};
+    { V4L2_CID_FOCUS_ABSOLUTE,              ESP_CAM_MOTOR_POSITION_CODE,        CAM_DEV_MOTOR,  false },
+#endif
+    { V4L2_CID_3A_LOCK,                     ESP_CAM_SENSOR_3A_LOCK,             CAM_DEV_SENSOR, false },
+    { V4L2_CID_CAMERA_AE_LEVEL,             ESP_CAM_SENSOR_AE_LEVEL,            CAM_DEV_SENSOR, false },
+    { V4L2_CID_CAMERA_STATS,                ESP_CAM_SENSOR_STATS,               CAM_DEV_SENSOR, false },
+    { V4L2_CID_CAMERA_GROUP,                ESP_CAM_SENSOR_GROUP_EXP_GAIN,      CAM_DEV_SENSOR, false },
+#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
+    { V4L2_CID_MOTOR_START_TIME,            ESP_CAM_MOTOR_MOVING_START_TIME,    CAM_DEV_MOTOR,  false },
 #endif
+    { V4L2_CID_FLASH_LED_MODE,              ESP_CAM_SENSOR_FLASH_LED,           CAM_DEV_SENSOR, false },
+    { V4L2_CID_JPEG_COMPRESSION_QUALITY,    ESP_CAM_SENSOR_JPEG_QUALITY,        CAM_DEV_SENSOR, false },
+    { V4L2_CID_TEST_PATTERN,                ESP_CAM_SENSOR_IOC_S_TEST_PATTERN,  CAM_DEV_SENSOR, true  },
+};
+
+ESP_STATIC_ASSERT(V4L2_CID_EXPOSURE < V4L2_CID_GAIN &&
+                  V4L2_CID_GAIN < V4L2_CID_HFLIP &&
+                  V4L2_CID_HFLIP < V4L2_CID_VFLIP &&
+                  V4L2_CID_VFLIP < V4L2_CID_EXPOSURE_ABSOLUTE &&
+                  V4L2_CID_EXPOSURE_ABSOLUTE < V4L2_CID_FOCUS_ABSOLUTE &&
+                  V4L2_CID_FOCUS_ABSOLUTE < V4L2_CID_3A_LOCK &&
+                  V4L2_CID_3A_LOCK < V4L2_CID_CAMERA_AE_LEVEL &&
+                  V4L2_CID_CAMERA_AE_LEVEL < V4L2_CID_CAMERA_STATS &&
+                  V4L2_CID_CAMERA_STATS < V4L2_CID_CAMERA_GROUP &&
+                  V4L2_CID_CAMERA_GROUP < V4L2_CID_MOTOR_START_TIME &&
+                  V4L2_CID_MOTOR_START_TIME < V4L2_CID_FLASH_LED_MODE &&
+                  V4L2_CID_FLASH_LED_MODE < V4L2_CID_JPEG_COMPRESSION_QUALITY &&
+                  V4L2_CID_JPEG_COMPRESSION_QUALITY < V4L2_CID_TEST_PATTERN,
+                  "s_control_map_table must be sorted by V4L2 control ID");
+ESP_STATIC_ASSERT(ARRAY_SIZE(s_control_map_table) <= ESP_VIDEO_CAM_DESC_CACHE_SIZE,
+                  "ESP_VIDEO_CAM_DESC_CACHE_SIZE is too small for s_control_map_table");
 
 /**
  * @brief Get control ID map pointer based on V4L2 control ID
  *
  * @param v4l2_id V4L2 control ID
- * @param ioctl   Camera device command type pointe, true: it is sensor ioctl command; false: it is sensor parameter ID command
- * @param type    Camera device type pointer
  *
  * @return
  *      - Control ID map pointer on success
  *      - NULL if failed
  */
-static const struct control_map *get_v4l2_ext_control_map(uint32_t v4l2_id, bool *ioctl, cam_dev_type_t *type)
+static const struct control_map *get_v4l2_ext_control_map(uint32_t v4l2_id)
 {
-    for (int i = 0; i < ARRAY_SIZE(s_sensor_control_map_table); i++) {
-        if (s_sensor_control_map_table[i].v4l2_id == v4l2_id) {
-            *ioctl = false;
-            *type = CAM_DEV_SENSOR;
-            return &s_sensor_control_map_table[i];
+    int left = 0;
+    int right = ARRAY_SIZE(s_control_map_table) - 1;
+
+    while (left <= right) {
+        int mid = (left + right) / 2;
+        const struct control_map *map = &s_control_map_table[mid];
+
+        if (map->v4l2_id < v4l2_id) {
+            left = mid + 1;
+        } else if (map->v4l2_id > v4l2_id) {
+            right = mid - 1;
+        } else {
+            return map;
         }
     }
 
-#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
-    for (int i = 0; i < ARRAY_SIZE(s_motor_control_map_table); i++) {
-        if (s_motor_control_map_table[i].v4l2_id == v4l2_id) {
-            *ioctl = false;
-            *type = CAM_DEV_MOTOR;
-            return &s_motor_control_map_table[i];
-        }
+    return NULL;
+}
+
+/**
+ * @brief Get the description of a mapped parameter, from the cache if it was queried before
+ *
+ * A camera device that can't describe the parameter gives ESP_ERR_NOT_SUPPORTED, this
+ * is cached as well, as qdesc->type UINT32_MAX.
+ *
+ * @param cam         Camera device pointer
+ * @param control_map Control ID map pointer, not an ioctl command
+ * @param qdesc       Returned description
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the camera device can't describe the parameter
+ *      - Others if failed
+ */
+static esp_err_t get_control_desc(esp_video_cam_t *cam, const struct control_map *control_map,
+                                  esp_cam_sensor_param_desc_t *qdesc)
+{
+    esp_err_t ret;
+    uint32_t index = control_map - s_control_map_table;
+
+    if (cam->desc_valid & BIT(index)) {
+        *qdesc = cam->desc[index];
+        return qdesc->type == UINT32_MAX ? ESP_ERR_NOT_SUPPORTED : ESP_OK;
     }
+
+    qdesc->id = control_map->esp_cam_priv_id;
+    if (control_map->dev_type == CAM_DEV_SENSOR) {
+        ret = esp_cam_sensor_query_para_desc(cam->sensor, qdesc);
+    } else {
+#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
+        ret = esp_cam_motor_query_para_desc(cam->motor, qdesc);
+#else
+        ret = ESP_ERR_NOT_SUPPORTED;
 #endif
+    }
 
-    for (int i = 0; i < ARRAY_SIZE(s_sensor_control_ioctl_table); i++) {
-        if (s_sensor_control_ioctl_table[i].v4l2_id == v4l2_id) {
-            *ioctl = true;
-            *type = CAM_DEV_SENSOR;
-            return &s_sensor_control_ioctl_table[i];
-        }
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        qdesc->id = control_map->esp_cam_priv_id;
+        qdesc->type = UINT32_MAX;
+    } else if (ret != ESP_OK) {
+        return ret;
     }
 
-    return NULL;
+    /* The description is complete before it is marked valid */
+    cam->desc[index] = *qdesc;
+    cam->desc_valid |= BIT(index);
+
+    return ret;
 }
 
 /**
@@ -176,25 +186,19 @@ static esp_err_t get_opt_value_desc(esp_video_cam_t *cam, const struct v4l2_ext_
 
         return ESP_OK;
     } else {
-        control_map = get_v4l2_ext_control_map(ctrl->id, ioctl, dev_type);
+        control_map = get_v4l2_ext_control_map(ctrl->id);
         if (!control_map) {
             ESP_LOGE(TAG, "ctrl id=%" PRIx32 " is not supported", ctrl->id);
             return ESP_ERR_NOT_SUPPORTED;
         }
 
+        *ioctl = control_map->ioctl;
+        *dev_type = control_map->dev_type;
         qdesc->id = control_map->esp_cam_priv_id;
     }
 
     if (*ioctl == false) {
-        if (*dev_type == CAM_DEV_SENSOR) {
-            ret = esp_cam_sensor_query_para_desc(cam->sensor, qdesc);
-        } else {
-#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
-            ret = esp_cam_motor_query_para_desc(cam->motor, qdesc);
-#else
-            ret = ESP_ERR_NOT_SUPPORTED;
-#endif
-        }
+        ret = get_control_desc(cam, control_map, qdesc);
         if (ret == ESP_ERR_NOT_SUPPORTED) {
 #if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
             const char *name = *dev_type == CAM_DEV_SENSOR ? cam->sensor->name : cam->motor->name;
@@ -285,6 +289,9 @@ esp_err_t esp_video_cam_set_ext_ctrls(esp_video_cam_t *cam, const struct v4l2_ex
                 ESP_LOGE(TAG, "failed to set ioctl id=%" PRIx32, ctrl->id);
                 break;
             }
+
+            /* A sensor command may change the mode, and so the control ranges */
+            esp_video_cam_flush_desc(cam);
         } else {
             int32_t value_buf = ctrl->value;
 
@@ -419,28 +426,17 @@ esp_err_t esp_video_cam_get_ext_ctrls(esp_video_cam_t *cam, struct v4l2_ext_cont
  */
 esp_err_t esp_video_cam_query_ext_ctrls(esp_video_cam_t *cam, struct v4l2_query_ext_ctrl *qctrl)
 {
-    bool ioctl;
     esp_err_t ret;
-    cam_dev_type_t dev_type;
     const struct control_map *control_map;
     esp_cam_sensor_param_desc_t qdesc;
 
-    control_map = get_v4l2_ext_control_map(qctrl->id, &ioctl, &dev_type);
+    control_map = get_v4l2_ext_control_map(qctrl->id);
     if (!control_map) {
         ESP_LOGE(TAG, "ctrl id=%" PRIx32 " is not supported", qctrl->id);
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    qdesc.id = control_map->esp_cam_priv_id;
-    if (dev_type == CAM_DEV_SENSOR) {
-        ret = esp_cam_sensor_query_para_desc(cam->sensor, &qdesc);
-    } else {
-#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
-        ret = esp_cam_motor_query_para_desc(cam->motor, &qdesc);
-#else
-        ret = ESP_ERR_NOT_SUPPORTED;
-#endif
-    }
+    ret = get_control_desc(cam, control_map, &qdesc);
     if (ret != ESP_OK) {
         ESP_LOGD(TAG, "failed to query sensor id=%" PRIx32, qdesc.id);
         return ret;
@@ -510,33 +506,22 @@ esp_err_t esp_video_cam_query_ext_ctrls(esp_video_cam_t *cam, struct v4l2_query_
  */
 esp_err_t esp_video_cam_query_menu(esp_video_cam_t *cam, struct v4l2_querymenu *qmenu)
 {
-    bool ioctl;
     esp_err_t ret;
-    cam_dev_type_t dev_type;
     const struct control_map *control_map;
     esp_cam_sensor_param_desc_t qdesc;
 
-    control_map = get_v4l2_ext_control_map(qmenu->id, &ioctl, &dev_type);
+    control_map = get_v4l2_ext_control_map(qmenu->id);
     if (!control_map) {
         ESP_LOGE(TAG, "ctrl id=%" PRIx32 " is not supported", qmenu->id);
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    if (ioctl) {
+    if (control_map->ioctl) {
         ESP_LOGE(TAG, "ctrl id=%" PRIx32 " is ioctl type", qmenu->id);
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    qdesc.id = control_map->esp_cam_priv_id;
-    if (dev_type == CAM_DEV_SENSOR) {
-        ret = esp_cam_sensor_query_para_desc(cam->sensor, &qdesc);
-    } else {
-#if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
-        ret = esp_cam_motor_query_para_desc(cam->motor, &qdesc);
-#else
-        ret = ESP_ERR_NOT_SUPPORTED;
-#endif
-    }
+    ret = get_control_desc(cam, control_map, &qdesc);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "failed to query sensor id=%" PRIx32, qdesc.id);
         return ret;
@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_video.h"
+#include "esp_video_handle.h"
+
+static const char *TAG = "video_handle";
+
+esp_err_t esp_video_handle_dqbuf(esp_video_handle_t handle, uint32_t type, TickType_t ticks, esp_video_frame_t *frame)
+{
+    struct esp_video_buffer_info info;
+    struct esp_video_buffer_element *element;
+
+    ESP_RETURN_ON_FALSE(handle && frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_ERROR(esp_video_get_buffer_info(handle, type, &info), TAG, "invalid buffer type");
+
+    element = esp_video_recv_element(handle, type, ticks);
+    if (!element) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    frame->index        = element->index;
+    frame->buffer       = element->buffer;
+    frame->length       = info.memory_type == V4L2_MEMORY_MMAP ? info.size : element->valid_size;
+    frame->bytesused    = element->valid_size;
+    frame->sequence     = element->sequence;
+    frame->dropped      = element->dropped;
+    frame->timestamp_us = element->timestamp_us;
+    frame->flags        = element->flags | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC |
+                          (element->valid_size ? V4L2_BUF_FLAG_DONE : V4L2_BUF_FLAG_ERROR);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_handle_qbuf(esp_video_handle_t handle, uint32_t type, const esp_video_frame_t *frame)
+{
+    struct esp_video_buffer_info info;
+
+    ESP_RETURN_ON_FALSE(handle && frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_ERROR(esp_video_get_buffer_info(handle, type, &info), TAG, "invalid buffer type");
+    ESP_RETURN_ON_FALSE(info.memory_type != V4L2_MEMORY_DMABUF, ESP_ERR_NOT_SUPPORTED, TAG, "DMABUF buffers need VIDIOC_QBUF");
+    ESP_RETURN_ON_FALSE(frame->index < info.count, ESP_ERR_INVALID_ARG, TAG, "invalid index %" PRIu32, frame->index);
+    ESP_RETURN_ON_FALSE(info.memory_type != V4L2_MEMORY_USERPTR || frame->buffer, ESP_ERR_INVALID_ARG, TAG, "buffer is NULL");
+
+    /* bytesused is only meaningful for buffers the application filled */
+    ESP_RETURN_ON_ERROR(esp_video_prepare_element_index(handle, type, frame->index,
+                                                        type == V4L2_BUF_TYPE_VIDEO_OUTPUT ? frame->bytesused : 0,
+                                                        frame->flags), TAG, "failed to prepare buffer");
+
+    if (info.memory_type == V4L2_MEMORY_MMAP) {
+        return esp_video_queue_element_index(handle, type, frame->index);
+    }
+
+    return esp_video_queue_element_index_buffer(handle, type, frame->index, frame->buffer, frame->length);
+}
+
+esp_err_t esp_video_handle_wait_slice(esp_video_handle_t handle, TickType_t ticks, esp_video_slice_t *slice)
+{
+    ESP_RETURN_ON_FALSE(handle && slice, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+#if CONFIG_ESP_VIDEO_ENABLE_SLICE
+    return esp_video_wait_slice(handle, V4L2_BUF_TYPE_VIDEO_CAPTURE, ticks, slice);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_video_handle_link(esp_video_handle_t source, esp_video_handle_t sink)
+{
+    ESP_RETURN_ON_FALSE(source && sink && source != sink, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    return esp_video_link(source, sink);
+}
+
+esp_err_t esp_video_handle_unlink(esp_video_handle_t source)
+{
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "source is NULL");
+
+    return esp_video_unlink(source);
+}
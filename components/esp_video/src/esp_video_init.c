@@ -26,6 +26,9 @@
 #include "esp_cam_sensor_xclk.h"
 
 #include "esp_video_init.h"
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+#include "esp_video_mem_pool.h"
+#endif
 #include "esp_video_device_internal.h"
 #if CONFIG_ESP_VIDEO_ENABLE_DVP_VIDEO_DEVICE
 #include "esp_private/esp_cam_dvp.h"
@@ -33,6 +36,9 @@
 #if CONFIG_ESP_VIDEO_ENABLE_ISP_PIPELINE_CONTROLLER
 #include "esp_video_pipeline_isp.h"
 #endif
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+#include "nvs.h"
+#endif
 
 #if ESP_VIDEO_ENABLE_SCCB_DEVICE
 #define SCCB_NUM_MAX                I2C_NUM_MAX
@@ -84,6 +90,24 @@ static esp_cam_sensor_xclk_handle_t s_spi_xclk_handle[ESP_VIDEO_SPI_XCLK_NUM]; /
 #endif /* CONFIG_ESP_VIDEO_ENABLE_SPI_VIDEO_DEVICE */
 static const char *TAG = "esp_video_init";
 
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+#define SENSOR_CACHE_NVS_NAMESPACE  "esp_video"
+#define SENSOR_CACHE_NVS_KEY        "csi_sensor"
+
+/**
+ * @brief MIPI-CSI sensor found by the last esp_video_init, kept in NVS
+ */
+typedef struct sensor_detect_cache {
+    uint16_t index;                             /*!< Position in the sensor detect function array */
+    uint8_t sccb_addr;                          /*!< Sensor SCCB address */
+    uint8_t init_sccb;                          /*!< Bus configuration the sensor was found on */
+    uint8_t i2c_port;
+    int8_t scl_pin;
+    int8_t sda_pin;
+    uint32_t freq;
+} sensor_detect_cache_t;
+#endif /* CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION */
+
 #if CONFIG_ESP_VIDEO_ENABLE_USB_UVC_VIDEO_DEVICE
 static void usb_lib_task(void *arg)
 {
@@ -316,6 +340,127 @@ static bool sensor_is_detected(esp_cam_sensor_detect_fn_t *p, esp_cam_sensor_dev
 }
 #endif
 
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+static void sensor_detect_cache_fill(sensor_detect_cache_t *cache, const esp_video_init_sccb_config_t *sccb_config,
+                                     const esp_cam_sensor_detect_fn_t *p)
+{
+    memset(cache, 0, sizeof(sensor_detect_cache_t));
+    cache->index = p - &__esp_cam_sensor_detect_fn_array_start;
+    cache->sccb_addr = p->sccb_addr;
+    cache->init_sccb = sccb_config->init_sccb;
+    if (sccb_config->init_sccb) {
+        cache->i2c_port = sccb_config->i2c_config.port;
+        cache->scl_pin = sccb_config->i2c_config.scl_pin;
+        cache->sda_pin = sccb_config->i2c_config.sda_pin;
+    }
+    cache->freq = sccb_config->freq;
+}
+
+/**
+ * @brief Get the detect function that found the MIPI-CSI sensor last time
+ *
+ * @param sccb_config Camera sensor SCCB configuration
+ *
+ * @return
+ *      - Detect function pointer if it is still valid for this firmware and bus configuration
+ *      - NULL if there is none
+ */
+static esp_cam_sensor_detect_fn_t *sensor_detect_cache_load(const esp_video_init_sccb_config_t *sccb_config)
+{
+    nvs_handle_t handle;
+    sensor_detect_cache_t cache;
+    sensor_detect_cache_t expected;
+    size_t size = sizeof(cache);
+    esp_cam_sensor_detect_fn_t *p;
+
+    if (nvs_open(SENSOR_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return NULL;
+    }
+    memset(&cache, 0, sizeof(cache));
+    esp_err_t ret = nvs_get_blob(handle, SENSOR_CACHE_NVS_KEY, &cache, &size);
+    nvs_close(handle);
+    if (ret != ESP_OK || size != sizeof(cache)) {
+        return NULL;
+    }
+
+    /* The detect function array changes with the firmware, the entry has to match the address as well */
+    p = &__esp_cam_sensor_detect_fn_array_start + cache.index;
+    if (p >= &__esp_cam_sensor_detect_fn_array_end || p->port != ESP_CAM_SENSOR_MIPI_CSI) {
+        return NULL;
+    }
+
+    sensor_detect_cache_fill(&expected, sccb_config, p);
+    if (memcmp(&cache, &expected, sizeof(cache))) {
+        return NULL;
+    }
+
+    return p;
+}
+
+/**
+ * @brief Store or clear the detect function that found the MIPI-CSI sensor
+ *
+ * @param sccb_config Camera sensor SCCB configuration
+ * @param p           Detect function, NULL to clear
+ */
+static void sensor_detect_cache_store(const esp_video_init_sccb_config_t *sccb_config, const esp_cam_sensor_detect_fn_t *p)
+{
+    nvs_handle_t handle;
+    esp_err_t ret;
+
+    if (nvs_open(SENSOR_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+
+    if (p) {
+        sensor_detect_cache_t cache;
+
+        sensor_detect_cache_fill(&cache, sccb_config, p);
+        ret = nvs_set_blob(handle, SENSOR_CACHE_NVS_KEY, &cache, sizeof(cache));
+    } else {
+        ret = nvs_erase_key(handle, SENSOR_CACHE_NVS_KEY);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "failed to update sensor detection cache: %s", esp_err_to_name(ret));
+    }
+}
+#endif /* CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION */
+
+/**
+ * @brief Next camera sensor detect function, the array in link order with first moved to the front
+ *
+ * @param first Detect function to try first, NULL for link order
+ * @param p     Current detect function, NULL to start
+ *
+ * @return
+ *      - Next detect function pointer
+ *      - NULL if all have been returned
+ */
+static esp_cam_sensor_detect_fn_t *sensor_detect_next(esp_cam_sensor_detect_fn_t *first, esp_cam_sensor_detect_fn_t *p)
+{
+    if (!p) {
+        if (first) {
+            return first;
+        }
+        p = &__esp_cam_sensor_detect_fn_array_start;
+    } else if (p == first) {
+        p = &__esp_cam_sensor_detect_fn_array_start;
+    } else {
+        p++;
+    }
+
+    if (p == first) {
+        p++;
+    }
+
+    return p < &__esp_cam_sensor_detect_fn_array_end ? p : NULL;
+}
+
 /**
  * @brief Initialize video hardware and software, including I2C, MIPI CSI and so on.
  *
@@ -340,12 +485,22 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
 #if ESP_VIDEO_ENABLE_SCCB_DEVICE
     esp_video_init_sccb_mark_t sccb_mark[SCCB_NUM_MAX] = {0};
 #endif /* ESP_VIDEO_ENABLE_SCCB_DEVICE */
+    esp_cam_sensor_detect_fn_t *detect_first = NULL;
 
     if (config == NULL) {
         ESP_LOGW(TAG, "Please validate camera config");
         return ESP_ERR_INVALID_ARG;
     }
 
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+    if (config->csi) {
+        detect_first = sensor_detect_cache_load(&config->csi->sccb_config);
+        if (detect_first) {
+            ESP_LOGI(TAG, "trying cached MIPI-CSI camera sensor with address=%x first", detect_first->sccb_addr);
+        }
+    }
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_ISP_VIDEO_DEVICE
     ret = esp_video_create_isp_video_device();
     if (ret != ESP_OK) {
@@ -397,7 +552,7 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
     }
 #endif
 
-    for (esp_cam_sensor_detect_fn_t *p = &__esp_cam_sensor_detect_fn_array_start; p < &__esp_cam_sensor_detect_fn_array_end; ++p) {
+    for (esp_cam_sensor_detect_fn_t *p = sensor_detect_next(detect_first, NULL); p; p = sensor_detect_next(detect_first, p)) {
 #if CONFIG_ESP_VIDEO_ENABLE_MIPI_CSI_VIDEO_DEVICE
         if (!csi_inited && p->port == ESP_CAM_SENSOR_MIPI_CSI && config->csi != NULL) {
             esp_cam_sensor_config_t cfg;
@@ -414,6 +569,11 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
             if (!cam_dev) {
                 destroy_sccb_device(cfg.sccb_handle, sccb_mark, &config->csi->sccb_config);
                 ESP_LOGE(TAG, "failed to detect MIPI-CSI camera sensor with address=%x", p->sccb_addr);
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+                if (p == detect_first) {
+                    sensor_detect_cache_store(&config->csi->sccb_config, NULL);
+                }
+#endif
                 continue;
             }
 
@@ -423,6 +583,12 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
                 return ret;
             }
 
+#if CONFIG_ESP_VIDEO_CACHE_SENSOR_DETECTION
+            if (p != detect_first) {
+                sensor_detect_cache_store(&config->csi->sccb_config, p);
+            }
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_CAMERA_MOTOR_CONTROLLER
             if (config->cam_motor) {
                 for (esp_cam_motor_detect_fn_t *p = &__esp_cam_motor_detect_fn_array_start; p < &__esp_cam_motor_detect_fn_array_end; p++) {
@@ -619,6 +785,12 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
         ESP_LOGE(TAG, "failed to create hardware H.264 video device");
         return ret;
     }
+#elif CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+    ret = esp_video_create_h264_video_device(false);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create software H.264 video device");
+        return ret;
+    }
 #endif
 
 #if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
@@ -635,6 +807,48 @@ esp_err_t esp_video_init(const esp_video_init_config_t *config)
     }
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    ret = esp_video_create_raw_codec_video_device();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create RAW codec video device");
+        return ret;
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_HDR_MERGE_VIDEO_DEVICE
+    ret = esp_video_create_hdr_merge_video_device();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create HDR merge video device");
+        return ret;
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_NDVI_VIDEO_DEVICE
+    ret = esp_video_create_ndvi_video_device();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create NDVI video device");
+        return ret;
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_PPA_VIDEO_DEVICE
+    ret = esp_video_create_ppa_video_device();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create PPA video device");
+        return ret;
+    }
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+    if (config->virtual_cam) {
+        ret = esp_video_create_virtual_video_device(config->virtual_cam);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "failed to create virtual video device");
+            return ret;
+        }
+    }
+#endif
+
     return ret;
 }
 
@@ -659,12 +873,35 @@ esp_err_t esp_video_deinit(void)
     bool spi_deinited[ESP_VIDEO_SPI_DEVICE_NUM] = {false};
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+    esp_err_t ret = esp_video_destroy_virtual_video_device();
+    ESP_RETURN_ON_FALSE(ret == ESP_OK || ret == ESP_ERR_NOT_FOUND, ret, TAG, "Failed to destroy virtual video device");
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_PPA_VIDEO_DEVICE
+    ESP_RETURN_ON_ERROR(esp_video_destroy_ppa_video_device(), TAG, "Failed to destroy PPA video device");
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_NDVI_VIDEO_DEVICE
+    ESP_RETURN_ON_ERROR(esp_video_destroy_ndvi_video_device(), TAG, "Failed to destroy NDVI video device");
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_HDR_MERGE_VIDEO_DEVICE
+    ESP_RETURN_ON_ERROR(esp_video_destroy_hdr_merge_video_device(), TAG, "Failed to destroy HDR merge video device");
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    ESP_RETURN_ON_ERROR(esp_video_destroy_raw_codec_video_device(), TAG, "Failed to destroy RAW codec video device");
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
     ESP_RETURN_ON_ERROR(esp_video_destroy_jpeg_video_device(), TAG, "Failed to destroy JPEG video device");
 #endif
 
 #if CONFIG_ESP_VIDEO_ENABLE_HW_H264_VIDEO_DEVICE
     ESP_RETURN_ON_ERROR(esp_video_destroy_h264_video_device(true), TAG, "Failed to destroy H.264 video device");
+#elif CONFIG_ESP_VIDEO_ENABLE_SW_H264_VIDEO_DEVICE
+    ESP_RETURN_ON_ERROR(esp_video_destroy_h264_video_device(false), TAG, "Failed to destroy H.264 video device");
 #endif
 
     for (esp_cam_sensor_detect_fn_t *p = &__esp_cam_sensor_detect_fn_array_start; p < &__esp_cam_sensor_detect_fn_array_end; ++p) {
@@ -779,5 +1016,12 @@ esp_err_t esp_video_deinit(void)
     ESP_RETURN_ON_ERROR(esp_video_destroy_isp_video_device(), TAG, "Failed to destroy ISP video device");
 #endif
 
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+    /* Devices not created by esp_video_init may still hold blocks, the arena then stays */
+    if (esp_video_mem_pool_release() != ESP_OK) {
+        ESP_LOGW(TAG, "Video memory pool still in use");
+    }
+#endif
+
     return ESP_OK;
 }
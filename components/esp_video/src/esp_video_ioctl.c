@@ -7,15 +7,34 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/lock.h>
+#include <sys/param.h>
 #include "esp_heap_caps.h"
 #include "esp_video.h"
 #include "esp_video_vfs.h"
+#include "esp_video_handle.h"
 #include "esp_video_ioctl_internal.h"
 
 #define BUF_OFF(type, element_index)        (((uint32_t)type << 24) + element_index)
-#define BUF_OFF_2_INDEX(buf_off)            ((buf_off) & 0x00ffffff)
+#define BUF_OFF_PLANE(buf_off, plane)       ((buf_off) | ((uint32_t)(plane) << 16))
+#define BUF_OFF_2_INDEX(buf_off)            ((buf_off) & 0x0000ffff)
+#define BUF_OFF_2_PLANE(buf_off)            (((buf_off) >> 16) & 0xff)
 #define BUF_OFF_2_TYPE(buf_off)             ((buf_off) >> 24)
 
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+/**
+ * @brief Planes of a frame, they follow each other in the buffer element, as the DMA writes them
+ */
+struct esp_video_plane_layout {
+    uint8_t num_planes;
+    uint32_t offset[VIDEO_MAX_PLANES];
+    uint32_t size[VIDEO_MAX_PLANES];
+    uint32_t bytesperline[VIDEO_MAX_PLANES];
+};
+
+static esp_err_t esp_video_ioctl_get_plane_layout(struct esp_video *video, uint32_t type, uint32_t buf_size,
+                                                  struct esp_video_plane_layout *layout);
+#endif
+
 static esp_err_t esp_video_ioctl_querycap(struct esp_video *video, struct v4l2_capability *cap)
 {
     memset(cap, 0, sizeof(struct v4l2_capability));
@@ -29,6 +48,32 @@ static esp_err_t esp_video_ioctl_querycap(struct esp_video *video, struct v4l2_c
         cap->device_caps = video->device_caps;
     }
 
+    /* Capture devices also return their latest frame with read(), see VIDIOC_READ_FRAME */
+    if ((video->device_caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_M2M)) == V4L2_CAP_VIDEO_CAPTURE) {
+        cap->capabilities |= V4L2_CAP_READWRITE;
+        if (video->caps & V4L2_CAP_DEVICE_CAPS) {
+            cap->device_caps |= V4L2_CAP_READWRITE;
+        }
+    }
+
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+    /* Every single-planar stream is also reachable through the multi-planar API */
+    const uint32_t mplane_caps[][2] = {
+        {V4L2_CAP_VIDEO_CAPTURE, V4L2_CAP_VIDEO_CAPTURE_MPLANE},
+        {V4L2_CAP_VIDEO_OUTPUT, V4L2_CAP_VIDEO_OUTPUT_MPLANE},
+        {V4L2_CAP_VIDEO_M2M, V4L2_CAP_VIDEO_M2M_MPLANE},
+    };
+
+    for (int i = 0; i < sizeof(mplane_caps) / sizeof(mplane_caps[0]); i++) {
+        if (cap->capabilities & mplane_caps[i][0]) {
+            cap->capabilities |= mplane_caps[i][1];
+        }
+        if (cap->device_caps & mplane_caps[i][0]) {
+            cap->device_caps |= mplane_caps[i][1];
+        }
+    }
+#endif
+
     return ESP_OK;
 }
 
@@ -83,7 +128,8 @@ static esp_err_t esp_video_ioctl_reqbufs(struct esp_video *video, struct v4l2_re
     esp_err_t ret;
 
     if ((req_bufs->memory != V4L2_MEMORY_MMAP) &&
-            (req_bufs->memory != V4L2_MEMORY_USERPTR) ) {
+            (req_bufs->memory != V4L2_MEMORY_USERPTR) &&
+            (req_bufs->memory != V4L2_MEMORY_DMABUF)) {
         return ESP_ERR_INVALID_ARG;
     }
 
@@ -96,6 +142,33 @@ static esp_err_t esp_video_ioctl_reqbufs(struct esp_video *video, struct v4l2_re
     return ret;
 }
 
+static esp_err_t esp_video_ioctl_create_bufs(struct esp_video *video, struct v4l2_create_buffers *create_bufs)
+{
+    esp_err_t ret;
+    struct esp_video_buffer_info info;
+
+    if ((create_bufs->memory != V4L2_MEMORY_MMAP) &&
+            (create_bufs->memory != V4L2_MEMORY_USERPTR) &&
+            (create_bufs->memory != V4L2_MEMORY_DMABUF)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* A count of 0 only reports where the next buffer would go */
+    if (create_bufs->count == 0) {
+        ret = esp_video_get_buffer_info(video, create_bufs->format.type, &info);
+        if (ret == ESP_OK) {
+            create_bufs->index = info.count;
+        }
+        return ret;
+    }
+
+    /* The buffers are sized for the current format, create_bufs->format is not applied */
+    ret = esp_video_add_buffer(video, create_bufs->format.type, create_bufs->memory, create_bufs->count,
+                               &create_bufs->index);
+
+    return ret;
+}
+
 static esp_err_t esp_video_ioctl_querybuf(struct esp_video *video, struct v4l2_buffer *vbuf)
 {
     esp_err_t ret;
@@ -140,9 +213,47 @@ static esp_err_t esp_video_ioctl_mmap(struct esp_video *video, struct esp_video_
 
     ioctl_mmap->mapped_ptr = esp_video_get_element_index_payload(video, type, index);
 
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+    /* A multi-planar offset maps one plane of the element */
+    uint8_t plane = BUF_OFF_2_PLANE(ioctl_mmap->offset);
+    if (plane) {
+        struct esp_video_plane_layout layout;
+
+        ret = esp_video_ioctl_get_plane_layout(video, type, info.size, &layout);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if ((plane >= layout.num_planes) || (ioctl_mmap->length > layout.size[plane])) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        ioctl_mmap->mapped_ptr = (uint8_t *)ioctl_mmap->mapped_ptr + layout.offset[plane];
+    }
+#endif
+
     return ESP_OK;
 }
 
+static esp_err_t esp_video_ioctl_expbuf(struct esp_video *video, struct v4l2_exportbuffer *expbuf)
+{
+    esp_err_t ret;
+    struct esp_video_buffer_info info;
+
+    ret = esp_video_get_buffer_info(video, expbuf->type, &info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Only driver allocated buffers are exported, single plane */
+    if ((info.memory_type != V4L2_MEMORY_MMAP) ||
+            (expbuf->index >= info.count) ||
+            expbuf->plane) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp_video_export_element_index(video, expbuf->type, expbuf->index, &expbuf->fd);
+}
+
 static esp_err_t esp_video_ioctl_qbuf(struct esp_video *video, struct v4l2_buffer *vbuf)
 {
     esp_err_t ret;
@@ -163,8 +274,29 @@ static esp_err_t esp_video_ioctl_qbuf(struct esp_video *video, struct v4l2_buffe
         }
     }
 
+    /* bytesused is only meaningful for buffers the application filled */
+    ret = esp_video_prepare_element_index(video, vbuf->type, vbuf->index,
+                                          vbuf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT ? vbuf->bytesused : 0,
+                                          vbuf->flags);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
     if (info.memory_type == V4L2_MEMORY_MMAP) {
         ret = esp_video_queue_element_index(video, vbuf->type, vbuf->index);
+    } else if (info.memory_type == V4L2_MEMORY_DMABUF) {
+        uint8_t *buffer;
+        uint32_t size;
+
+        /* The handle is resolved on every QBUF, so a freed exporter buffer is never queued */
+        ret = esp_video_buffer_import(vbuf->m.fd, &buffer, &size);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (vbuf->length && (vbuf->length < size)) {
+            size = vbuf->length;
+        }
+        ret = esp_video_queue_element_index_buffer(video, vbuf->type, vbuf->index, buffer, size);
     } else {
         ret = esp_video_queue_element_index_buffer(video, vbuf->type, vbuf->index, (uint8_t *)vbuf->m.userptr, vbuf->length);
     }
@@ -172,10 +304,9 @@ static esp_err_t esp_video_ioctl_qbuf(struct esp_video *video, struct v4l2_buffe
     return ret;
 }
 
-static esp_err_t esp_video_ioctl_dqbuf(struct esp_video *video, struct v4l2_buffer *vbuf)
+static esp_err_t esp_video_ioctl_dqbuf(struct esp_video *video, struct v4l2_buffer *vbuf, uint32_t ticks)
 {
     esp_err_t ret;
-    uint32_t ticks = portMAX_DELAY;
     struct esp_video_buffer_info info;
     struct esp_video_buffer_element *element;
 
@@ -190,25 +321,515 @@ static esp_err_t esp_video_ioctl_dqbuf(struct esp_video *video, struct v4l2_buff
 
     element = esp_video_recv_element(video, vbuf->type, ticks);
     if (!element) {
-        return ESP_FAIL;
+        /* Reported as EAGAIN by the VFS layer */
+        return ticks ? ESP_FAIL : ESP_ERR_TIMEOUT;
     }
 
     vbuf->flags     = 0;
     vbuf->index     = element->index;
     vbuf->bytesused = element->valid_size;
+    vbuf->sequence  = element->sequence;
+    vbuf->reserved2 = element->dropped;
+    vbuf->timestamp.tv_sec  = element->timestamp_us / 1000000;
+    vbuf->timestamp.tv_usec = element->timestamp_us % 1000000;
+    vbuf->flags |= V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    vbuf->flags |= element->flags;
     if (!vbuf->bytesused) {
         vbuf->flags |= V4L2_BUF_FLAG_ERROR;
     } else {
         vbuf->flags |= V4L2_BUF_FLAG_DONE;
     }
-    if (vbuf->memory != V4L2_MEMORY_USERPTR) {
+    if (vbuf->memory == V4L2_MEMORY_DMABUF) {
+        vbuf->m.fd = esp_video_buffer_get_dmabuf_fd(element->buffer);
+    } else {
         vbuf->m.userptr = (unsigned long)element->buffer;
-        vbuf->flags |= V4L2_BUF_FLAG_MAPPED;
+        if (vbuf->memory == V4L2_MEMORY_MMAP) {
+            vbuf->flags |= V4L2_BUF_FLAG_MAPPED;
+        }
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+/* Semi-planar formats of the devices and their multi-planar names */
+static const uint32_t s_mplane_pixel_formats[][2] = {
+    {V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV12M},
+    {V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_NV21M},
+    {V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV16M},
+    {V4L2_PIX_FMT_NV61, V4L2_PIX_FMT_NV61M},
+};
+
+static uint32_t esp_video_ioctl_single_plane_type(uint32_t type)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        return V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+        return V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    }
+
+    return type;
+}
+
+static uint32_t esp_video_ioctl_mplane_pixel_format(uint32_t pixel_format, bool to_mplane)
+{
+    for (int i = 0; i < sizeof(s_mplane_pixel_formats) / sizeof(s_mplane_pixel_formats[0]); i++) {
+        if (s_mplane_pixel_formats[i][!to_mplane] == pixel_format) {
+            return s_mplane_pixel_formats[i][to_mplane];
+        }
+    }
+
+    return pixel_format;
+}
+
+static esp_err_t esp_video_ioctl_get_plane_layout(struct esp_video *video, uint32_t type, uint32_t buf_size,
+                                                  struct esp_video_plane_layout *layout)
+{
+    esp_err_t ret;
+    uint32_t luma_size;
+    uint32_t chroma_size;
+    struct v4l2_format format = {
+        .type = type,
+    };
+
+    ret = esp_video_get_format(video, &format);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    luma_size = format.fmt.pix.width * format.fmt.pix.height;
+    switch (format.fmt.pix.pixelformat) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV21:
+        chroma_size = luma_size / 2;
+        break;
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_NV61:
+        chroma_size = luma_size;
+        break;
+    default:
+        chroma_size = 0;
+        break;
+    }
+
+    memset(layout, 0, sizeof(struct esp_video_plane_layout));
+    if (chroma_size && (buf_size >= luma_size + chroma_size)) {
+        /* Y plane followed by the interleaved CbCr plane, the last plane owns the rest of the buffer */
+        layout->num_planes = 2;
+        layout->size[0] = luma_size;
+        layout->bytesperline[0] = format.fmt.pix.width;
+        layout->offset[1] = luma_size;
+        layout->size[1] = buf_size - luma_size;
+        layout->bytesperline[1] = format.fmt.pix.width;
+    } else {
+        layout->num_planes = 1;
+        layout->size[0] = buf_size;
+        layout->bytesperline[0] = format.fmt.pix.bytesperline;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t esp_video_ioctl_g_fmt_mplane(struct esp_video *video, struct v4l2_format *fmt)
+{
+    esp_err_t ret;
+    uint32_t type = esp_video_ioctl_single_plane_type(fmt->type);
+    struct esp_video_buffer_info info;
+    struct esp_video_plane_layout layout;
+    struct v4l2_pix_format_mplane *pix_mp = &fmt->fmt.pix_mp;
+    struct v4l2_format format = {
+        .type = type,
+    };
+
+    ret = esp_video_get_format(video, &format);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = esp_video_get_buffer_info(video, type, &info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = esp_video_ioctl_get_plane_layout(video, type, info.size, &layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    memset(pix_mp, 0, sizeof(struct v4l2_pix_format_mplane));
+    pix_mp->width = format.fmt.pix.width;
+    pix_mp->height = format.fmt.pix.height;
+    pix_mp->field = format.fmt.pix.field;
+    pix_mp->colorspace = format.fmt.pix.colorspace;
+    pix_mp->quantization = format.fmt.pix.quantization;
+    pix_mp->xfer_func = format.fmt.pix.xfer_func;
+    pix_mp->ycbcr_enc = format.fmt.pix.ycbcr_enc;
+    pix_mp->num_planes = layout.num_planes;
+    pix_mp->pixelformat = layout.num_planes > 1 ?
+                          esp_video_ioctl_mplane_pixel_format(format.fmt.pix.pixelformat, true) :
+                          format.fmt.pix.pixelformat;
+    for (int i = 0; i < layout.num_planes; i++) {
+        pix_mp->plane_fmt[i].sizeimage = layout.size[i];
+        pix_mp->plane_fmt[i].bytesperline = layout.bytesperline[i];
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t esp_video_ioctl_s_fmt_mplane(struct esp_video *video, struct v4l2_format *fmt)
+{
+    esp_err_t ret;
+    const struct v4l2_pix_format_mplane *pix_mp = &fmt->fmt.pix_mp;
+    struct v4l2_format format = {
+        .type = esp_video_ioctl_single_plane_type(fmt->type),
+        .fmt.pix = {
+            .width = pix_mp->width,
+            .height = pix_mp->height,
+            .pixelformat = esp_video_ioctl_mplane_pixel_format(pix_mp->pixelformat, false),
+            .field = pix_mp->field,
+            .colorspace = pix_mp->colorspace,
+            .quantization = pix_mp->quantization,
+            .xfer_func = pix_mp->xfer_func,
+            .ycbcr_enc = pix_mp->ycbcr_enc,
+        },
+    };
+
+    ret = esp_video_ioctl_s_fmt(video, &format);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Report the planes of the format that was set, as the single-planar S_FMT does */
+    return esp_video_ioctl_g_fmt_mplane(video, fmt);
+}
+
+static esp_err_t esp_video_ioctl_enum_fmt_mplane(struct esp_video *video, struct v4l2_fmtdesc *fmt)
+{
+    esp_err_t ret;
+    uint32_t type = fmt->type;
+
+    fmt->type = esp_video_ioctl_single_plane_type(type);
+    ret = esp_video_ioctl_enum_fmt(video, fmt);
+    fmt->type = type;
+    if (ret == ESP_OK) {
+        fmt->pixelformat = esp_video_ioctl_mplane_pixel_format(fmt->pixelformat, true);
+    }
+
+    return ret;
+}
+
+static esp_err_t esp_video_ioctl_reqbufs_mplane(struct esp_video *video, struct v4l2_requestbuffers *req_bufs)
+{
+    esp_err_t ret;
+    uint32_t type = req_bufs->type;
+
+    req_bufs->type = esp_video_ioctl_single_plane_type(type);
+    ret = esp_video_ioctl_reqbufs(video, req_bufs);
+    req_bufs->type = type;
+
+    return ret;
+}
+
+static esp_err_t esp_video_ioctl_stream_mplane(struct esp_video *video, int *arg, bool on)
+{
+    int type = esp_video_ioctl_single_plane_type(*arg);
+
+    return on ? esp_video_ioctl_streamon(video, &type) : esp_video_ioctl_streamoff(video, &type);
+}
+
+static esp_err_t esp_video_ioctl_expbuf_mplane(struct esp_video *video, struct v4l2_exportbuffer *expbuf)
+{
+    esp_err_t ret;
+    struct v4l2_exportbuffer single_expbuf = *expbuf;
+
+    /* All planes live in one element, so every plane shares the element's descriptor */
+    single_expbuf.type = esp_video_ioctl_single_plane_type(expbuf->type);
+    single_expbuf.plane = 0;
+    ret = esp_video_ioctl_expbuf(video, &single_expbuf);
+    if (ret == ESP_OK) {
+        expbuf->fd = single_expbuf.fd;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Fill the planes of a multi-planar buffer from its single-planar description
+ */
+static void esp_video_ioctl_fill_planes(struct v4l2_buffer *vbuf, const struct v4l2_buffer *single_vbuf,
+                                        const struct esp_video_plane_layout *layout)
+{
+    vbuf->length = layout->num_planes;
+    for (int i = 0; i < layout->num_planes; i++) {
+        struct v4l2_plane *plane = &vbuf->m.planes[i];
+        uint32_t plane_used = single_vbuf->bytesused > layout->offset[i] ? single_vbuf->bytesused - layout->offset[i] : 0;
+
+        plane->bytesused = MIN(plane_used, layout->size[i]);
+        plane->length = layout->size[i];
+        plane->data_offset = 0;
+        if (vbuf->memory == V4L2_MEMORY_MMAP) {
+            plane->m.mem_offset = BUF_OFF_PLANE(BUF_OFF(single_vbuf->type, single_vbuf->index), i);
+        } else if (vbuf->memory == V4L2_MEMORY_DMABUF) {
+            plane->m.fd = single_vbuf->m.fd;
+        } else {
+            plane->m.userptr = single_vbuf->m.userptr ? single_vbuf->m.userptr + layout->offset[i] : 0;
+        }
+    }
+}
+
+/**
+ * @brief Get the buffer information and plane layout of a multi-planar buffer
+ */
+static esp_err_t esp_video_ioctl_prepare_mplane(struct esp_video *video, const struct v4l2_buffer *vbuf,
+                                                struct esp_video_plane_layout *layout)
+{
+    esp_err_t ret;
+    struct esp_video_buffer_info info;
+    uint32_t type = esp_video_ioctl_single_plane_type(vbuf->type);
+
+    if (!vbuf->m.planes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ret = esp_video_get_buffer_info(video, type, &info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = esp_video_ioctl_get_plane_layout(video, type, info.size, layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (vbuf->length < layout->num_planes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t esp_video_ioctl_querybuf_mplane(struct esp_video *video, struct v4l2_buffer *vbuf)
+{
+    esp_err_t ret;
+    struct esp_video_plane_layout layout;
+    struct v4l2_buffer single_vbuf = *vbuf;
+
+    ret = esp_video_ioctl_prepare_mplane(video, vbuf, &layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    single_vbuf.type = esp_video_ioctl_single_plane_type(vbuf->type);
+    single_vbuf.bytesused = 0;
+    single_vbuf.m.userptr = 0;
+    ret = esp_video_ioctl_querybuf(video, &single_vbuf);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
+    esp_video_ioctl_fill_planes(vbuf, &single_vbuf, &layout);
+
     return ESP_OK;
 }
 
+static esp_err_t esp_video_ioctl_qbuf_mplane(struct esp_video *video, struct v4l2_buffer *vbuf)
+{
+    esp_err_t ret;
+    const struct v4l2_plane *planes = vbuf->m.planes;
+    struct esp_video_plane_layout layout;
+    struct v4l2_buffer single_vbuf = *vbuf;
+    int last;
+
+    ret = esp_video_ioctl_prepare_mplane(video, vbuf, &layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (vbuf->length != layout.num_planes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The DMA writes a frame in one go, so the planes must be the regions of a single buffer */
+    single_vbuf.bytesused = planes[0].bytesused;
+    for (int i = 1; i < layout.num_planes; i++) {
+        if (((vbuf->memory == V4L2_MEMORY_USERPTR) && (planes[i].m.userptr != planes[0].m.userptr + layout.offset[i])) ||
+                ((vbuf->memory == V4L2_MEMORY_DMABUF) && (planes[i].m.fd != planes[0].m.fd))) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (planes[i].bytesused) {
+            single_vbuf.bytesused = layout.offset[i] + planes[i].bytesused;
+        }
+    }
+
+    last = layout.num_planes - 1;
+    single_vbuf.type = esp_video_ioctl_single_plane_type(vbuf->type);
+    single_vbuf.length = planes[last].length ? layout.offset[last] + planes[last].length : 0;
+    if (vbuf->memory == V4L2_MEMORY_DMABUF) {
+        single_vbuf.m.fd = planes[0].m.fd;
+    } else {
+        single_vbuf.m.userptr = planes[0].m.userptr;
+    }
+
+    return esp_video_ioctl_qbuf(video, &single_vbuf);
+}
+
+static esp_err_t esp_video_ioctl_dqbuf_mplane(struct esp_video *video, struct v4l2_buffer *vbuf, uint32_t ticks)
+{
+    esp_err_t ret;
+    struct esp_video_plane_layout layout;
+    struct v4l2_buffer single_vbuf = *vbuf;
+
+    /* Checked before dequeuing, a frame is never taken from the stream and then refused */
+    ret = esp_video_ioctl_prepare_mplane(video, vbuf, &layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    single_vbuf.type = esp_video_ioctl_single_plane_type(vbuf->type);
+    ret = esp_video_ioctl_dqbuf(video, &single_vbuf, ticks);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    vbuf->index     = single_vbuf.index;
+    vbuf->flags     = single_vbuf.flags;
+    vbuf->bytesused = 0;
+    vbuf->sequence  = single_vbuf.sequence;
+    vbuf->reserved2 = single_vbuf.reserved2;
+    vbuf->timestamp = single_vbuf.timestamp;
+    esp_video_ioctl_fill_planes(vbuf, &single_vbuf, &layout);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Serve a multi-planar request through the single-planar path of its stream
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the request is not multi-planar
+ *      - Others if the request failed
+ */
+static esp_err_t esp_video_ioctl_mplane(struct esp_video *video, int cmd, void *arg_ptr)
+{
+    switch (cmd) {
+    case VIDIOC_QBUF:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_buffer *)arg_ptr)->type)) {
+            return esp_video_ioctl_qbuf_mplane(video, (struct v4l2_buffer *)arg_ptr);
+        }
+        break;
+    case VIDIOC_DQBUF:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_buffer *)arg_ptr)->type)) {
+            return esp_video_ioctl_dqbuf_mplane(video, (struct v4l2_buffer *)arg_ptr, video->nonblock ? 0 : portMAX_DELAY);
+        }
+        break;
+    case VIDIOC_QUERYBUF:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_buffer *)arg_ptr)->type)) {
+            return esp_video_ioctl_querybuf_mplane(video, (struct v4l2_buffer *)arg_ptr);
+        }
+        break;
+    case VIDIOC_ENUM_FMT:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_fmtdesc *)arg_ptr)->type)) {
+            return esp_video_ioctl_enum_fmt_mplane(video, (struct v4l2_fmtdesc *)arg_ptr);
+        }
+        break;
+    case VIDIOC_G_FMT:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_format *)arg_ptr)->type)) {
+            return esp_video_ioctl_g_fmt_mplane(video, (struct v4l2_format *)arg_ptr);
+        }
+        break;
+    case VIDIOC_S_FMT:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_format *)arg_ptr)->type)) {
+            return esp_video_ioctl_s_fmt_mplane(video, (struct v4l2_format *)arg_ptr);
+        }
+        break;
+    case VIDIOC_STREAMON:
+    case VIDIOC_STREAMOFF:
+        if (V4L2_TYPE_IS_MULTIPLANAR(*(int *)arg_ptr)) {
+            return esp_video_ioctl_stream_mplane(video, (int *)arg_ptr, cmd == VIDIOC_STREAMON);
+        }
+        break;
+    case VIDIOC_REQBUFS:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_requestbuffers *)arg_ptr)->type)) {
+            return esp_video_ioctl_reqbufs_mplane(video, (struct v4l2_requestbuffers *)arg_ptr);
+        }
+        break;
+    case VIDIOC_EXPBUF:
+        if (V4L2_TYPE_IS_MULTIPLANAR(((struct v4l2_exportbuffer *)arg_ptr)->type)) {
+            return esp_video_ioctl_expbuf_mplane(video, (struct v4l2_exportbuffer *)arg_ptr);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
+
+static esp_err_t esp_video_ioctl_qbuf_batch(struct esp_video *video, struct esp_video_buffer_batch *batch)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (!batch->buffers && batch->count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    batch->done = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        struct v4l2_buffer *vbuf = &batch->buffers[i];
+
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+        if (V4L2_TYPE_IS_MULTIPLANAR(vbuf->type)) {
+            ret = esp_video_ioctl_qbuf_mplane(video, vbuf);
+        } else
+#endif
+        {
+            ret = esp_video_ioctl_qbuf(video, vbuf);
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+
+        batch->done++;
+    }
+
+    return ret;
+}
+
+static esp_err_t esp_video_ioctl_dqbuf_batch(struct esp_video *video, struct esp_video_buffer_batch *batch)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (!batch->buffers || !batch->count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    batch->done = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        struct v4l2_buffer *vbuf = &batch->buffers[i];
+        /* Only the first buffer is waited for, the rest of the batch is what is already done */
+        uint32_t ticks = (i || video->nonblock) ? 0 : portMAX_DELAY;
+
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+        if (V4L2_TYPE_IS_MULTIPLANAR(vbuf->type)) {
+            ret = esp_video_ioctl_dqbuf_mplane(video, vbuf, ticks);
+        } else
+#endif
+        {
+            ret = esp_video_ioctl_dqbuf(video, vbuf, ticks);
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+
+        batch->done++;
+    }
+
+    /* Dequeued buffers belong to the application now, a later error is reported by the next call */
+    return batch->done ? ESP_OK : ret;
+}
+
 static inline esp_err_t esp_video_ioctl_set_ext_ctrls(struct esp_video *video, const struct v4l2_ext_controls *controls)
 {
     return esp_video_set_ext_controls(video, controls);
@@ -298,12 +919,25 @@ esp_err_t esp_video_ioctl(struct esp_video *video, int cmd, va_list args)
         return ESP_ERR_INVALID_ARG;
     }
 
+#if CONFIG_ESP_VIDEO_ENABLE_MPLANE_API
+    ret = esp_video_ioctl_mplane(video, cmd, arg_ptr);
+    if (ret != ESP_ERR_NOT_SUPPORTED) {
+        return ret;
+    }
+#endif
+
     switch (cmd) {
     case VIDIOC_QBUF:
         ret = esp_video_ioctl_qbuf(video, (struct v4l2_buffer *)arg_ptr);
         break;
     case VIDIOC_DQBUF:
-        ret = esp_video_ioctl_dqbuf(video, (struct v4l2_buffer *)arg_ptr);
+        ret = esp_video_ioctl_dqbuf(video, (struct v4l2_buffer *)arg_ptr, video->nonblock ? 0 : portMAX_DELAY);
+        break;
+    case VIDIOC_QBUF_BATCH:
+        ret = esp_video_ioctl_qbuf_batch(video, (struct esp_video_buffer_batch *)arg_ptr);
+        break;
+    case VIDIOC_DQBUF_BATCH:
+        ret = esp_video_ioctl_dqbuf_batch(video, (struct esp_video_buffer_batch *)arg_ptr);
         break;
     case VIDIOC_QUERYCAP:
         ret = esp_video_ioctl_querycap(video, (struct v4l2_capability *)arg_ptr);
@@ -326,12 +960,18 @@ esp_err_t esp_video_ioctl(struct esp_video *video, int cmd, va_list args)
     case VIDIOC_REQBUFS:
         ret = esp_video_ioctl_reqbufs(video, (struct v4l2_requestbuffers *)arg_ptr);
         break;
+    case VIDIOC_CREATE_BUFS:
+        ret = esp_video_ioctl_create_bufs(video, (struct v4l2_create_buffers *)arg_ptr);
+        break;
     case VIDIOC_QUERYBUF:
         ret = esp_video_ioctl_querybuf(video, (struct v4l2_buffer *)arg_ptr);
         break;
     case VIDIOC_MMAP:
         ret = esp_video_ioctl_mmap(video, (struct esp_video_ioctl_mmap *)arg_ptr);
         break;
+    case VIDIOC_EXPBUF:
+        ret = esp_video_ioctl_expbuf(video, (struct v4l2_exportbuffer *)arg_ptr);
+        break;
     case VIDIOC_G_EXT_CTRLS:
         ret = esp_video_ioctl_get_ext_ctrls(video, (struct v4l2_ext_controls *)arg_ptr);
         break;
@@ -347,6 +987,21 @@ esp_err_t esp_video_ioctl(struct esp_video *video, int cmd, va_list args)
     case VIDIOC_G_SENSOR_FMT:
         ret = esp_video_ioctl_get_sensor_format(video, (esp_cam_sensor_format_t *)arg_ptr);
         break;
+    case VIDIOC_G_SENSOR_CTRL_DELAY:
+        ret = esp_video_get_sensor_ctrl_delay(video, (uint32_t *)arg_ptr);
+        break;
+    case VIDIOC_G_FRAME_META:
+        ret = esp_video_get_frame_meta(video, (struct esp_video_frame_meta *)arg_ptr);
+        break;
+    case VIDIOC_QUEUE_REQUEST:
+        ret = esp_video_queue_capture_request(video, (const struct esp_video_capture_request *)arg_ptr);
+        break;
+    case VIDIOC_ENUM_FORMAT_CAPS:
+        ret = esp_video_enum_format_cap(video, (struct esp_video_format_cap *)arg_ptr);
+        break;
+    case VIDIOC_QUERY_BEST_FORMAT:
+        ret = esp_video_query_best_format(video, (struct esp_video_format_query *)arg_ptr);
+        break;
     case VIDIOC_QUERYMENU:
         ret = esp_video_ioctl_query_menu(video, (struct v4l2_querymenu *)arg_ptr);
         break;
@@ -379,6 +1034,27 @@ esp_err_t esp_video_ioctl(struct esp_video *video, int cmd, va_list args)
     case VIDIOC_ENUM_FRAMEINTERVALS:
         ret = esp_video_ioctl_enum_frameintervals(video, (struct v4l2_frmivalenum *)arg_ptr);
         break;
+    case VIDIOC_S_DROP_POLICY:
+        ret = esp_video_set_drop_policy(video, (const struct esp_video_drop_policy *)arg_ptr);
+        break;
+    case VIDIOC_G_DROP_POLICY:
+        ret = esp_video_get_drop_policy(video, (struct esp_video_drop_policy *)arg_ptr);
+        break;
+    case VIDIOC_S_CONVERGENCE:
+        ret = esp_video_set_convergence(video, (const struct esp_video_convergence *)arg_ptr);
+        break;
+    case VIDIOC_G_CONVERGENCE:
+        ret = esp_video_get_convergence(video, (struct esp_video_convergence *)arg_ptr);
+        break;
+    case VIDIOC_G_STREAM_STATS:
+        ret = esp_video_get_stream_stats(video, (struct esp_video_stream_stats *)arg_ptr);
+        break;
+    case VIDIOC_READ_FRAME:
+        ret = esp_video_read_frame(video, video->nonblock ? 0 : portMAX_DELAY, (struct esp_video_read_frame *)arg_ptr);
+        break;
+    case VIDIOC_G_VIDEO_HANDLE:
+        *(esp_video_handle_t *)arg_ptr = video;
+        break;
     default:
         ret = ESP_ERR_INVALID_ARG;
         break;
@@ -15,30 +15,146 @@
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/errno.h>
+#include <sys/lock.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 
 #include "linux/videodev2.h"
 #include "esp_video_pipeline_isp.h"
 #include "esp_video_ioctl.h"
 #include "esp_video_isp_ioctl.h"
+#include "esp_video_isp_stats.h"
 #include "esp_video_device_internal.h"
+#include "esp_video_internal.h"
+#include "esp_video_trace.h"
 #include "esp_ipa.h"
 #include "esp_cam_sensor.h"
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+#include "nvs.h"
+#endif
 
 #define ISP_METADATA_BUFFER_COUNT   2
-#define ISP_TASK_PRIORITY           11
+#define ISP_TASK_PRIORITY           CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROLLER_TASK_PRIORITY
 #define ISP_TASK_STACK_SIZE         4096
+#if defined(CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROLLER_TASK_CORE) && CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROLLER_TASK_CORE >= 0
+#define ISP_TASK_CORE               CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROLLER_TASK_CORE
+#else
+#define ISP_TASK_CORE               tskNO_AFFINITY
+#endif
 #define ISP_TASK_NAME               "isp_task"
 
 #define UNUSED(x)                   (void)(x)
 
+#define ISP_RUN_BUDGET_US           CONFIG_ESP_VIDEO_ISP_PIPELINE_RUN_BUDGET_US
+#define ISP_RUN_MAX_DEBT_FRAMES     4       /* Frames an overrun may make the algorithms skip */
+
 #define TLINE_NS_UNIT               1000
 #define REG_TO_US(reg, isp)         ((reg) * (isp)->sensor_tline_ns / TLINE_NS_UNIT)
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+#define WB_DEADBAND                 (CONFIG_ESP_VIDEO_ISP_PIPELINE_WB_DEADBAND_PERMILLE / 1000.0f)
+#define CCM_DEADBAND                (CONFIG_ESP_VIDEO_ISP_PIPELINE_CCM_DEADBAND_PERMILLE / 1000.0f)
+#define AE_DEADBAND                 (CONFIG_ESP_VIDEO_ISP_PIPELINE_AE_DEADBAND_PERMILLE / 1000.0f)
+
+/* Parameters applied through config_isp_and_camera() that have a copy in esp_video_isp_t::applied */
+#define SHADOW_FLAGS                (IPA_METADATA_FLAGS_RG | IPA_METADATA_FLAGS_BG | IPA_METADATA_FLAGS_BF | \
+                                     IPA_METADATA_FLAGS_DM | IPA_METADATA_FLAGS_SH | IPA_METADATA_FLAGS_GAMMA | \
+                                     IPA_METADATA_FLAGS_CCM | IPA_METADATA_FLAGS_BR | IPA_METADATA_FLAGS_CN | \
+                                     IPA_METADATA_FLAGS_ST | IPA_METADATA_FLAGS_HUE | IPA_METADATA_FLAGS_AWB | \
+                                     IPA_METADATA_FLAGS_SR | IPA_METADATA_FLAGS_AF | IPA_METADATA_FLAGS_AETL)
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+#define IPA_SCHED_COUNT             4
+#define IPA_SCHED_FLAGS             (IPA_STATS_FLAGS_AE | IPA_STATS_FLAGS_AWB | IPA_STATS_FLAGS_HIST | IPA_STATS_FLAGS_SHARPEN)
+#define IPA_SCHED_AWB_SCALE         1024    /* Fixed point scale of the AWB channel ratios */
+#define IPA_SCHED_MIN_CHANGE        2       /* Changes this small are noise, whatever the relative change */
+
+/**
+ * @brief Run schedule of the image algorithms fed by one statistics type
+ */
+typedef struct {
+    uint32_t flag;                  /*!< IPA_STATS_FLAGS_XXX of the statistics */
+    uint16_t monitor_interval;      /*!< Frames between two runs once converged */
+    uint16_t countdown;             /*!< Frames to skip before the next run */
+    uint16_t stable;                /*!< Runs in a row with a small statistics change */
+    uint32_t signature[2];          /*!< Statistics summary at the last run */
+} ipa_sched_t;
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+#define STARTUP_BOOST               CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_BOOST
+#define STARTUP_TOLERANCE           (CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_TOLERANCE_PERCENT / 100.0f)
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_HOLD_FRAMES
+#define STARTUP_HOLD                1
+#else
+#define STARTUP_HOLD                0
+#endif
+
+/**
+ * @brief Fast convergence state, from VIDIOC_STREAMON of the capture stream to the first converged frame
+ */
+typedef struct {
+    bool supported;                 /*!< The capture device accepted VIDIOC_S_CONVERGENCE */
+    bool active;
+    uint8_t frames;                 /*!< Frames processed since the stream started */
+    uint8_t settled;                /*!< Frames in a row within the tolerance */
+    uint8_t wait;                   /*!< Frames whose statistics predate the last exposure write */
+    float red_gain;                 /*!< Last white balance gains asked by the IPA, 0 if none */
+    float blue_gain;
+} isp_startup_t;
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+#define WARM_START_NVS_NAMESPACE    "esp_video"
+#define WARM_START_NVS_KEY          "isp_warm"
+
+/**
+ * @brief Sensor exposure and white balance of the last converged stream, kept in NVS
+ */
+typedef struct {
+    uint32_t width;                 /*!< Capture format the state was converged in */
+    uint32_t height;
+    uint32_t tline_ns;              /*!< Sensor line time, changes with the sensor mode */
+    uint32_t exposure_val;          /*!< V4L2_CID_EXPOSURE value */
+    int32_t gain_val;               /*!< V4L2_CID_GAIN value, a menu index for an integer menu */
+    float red_gain;                 /*!< ISP white balance gains, 0 if the sensor does white balance */
+    float blue_gain;
+} isp_warm_start_t;
+#endif
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT
+/* Initial parameters the first frames do without, applied once their statistics came */
+#define ISP_DEFERRED_FLAGS          (IPA_METADATA_FLAGS_LSC | IPA_METADATA_FLAGS_AF | IPA_METADATA_FLAGS_FP)
+#endif
+
+#define ISP_CTRL_BATCH_SIZE         16
+
+/**
+ * @brief ISP controls produced by one IPA run, with the data of the compound ones
+ */
+typedef struct {
+    uint32_t count;
+    struct v4l2_ext_control control[ISP_CTRL_BATCH_SIZE];
+    const char *name[ISP_CTRL_BATCH_SIZE];  /*!< Control names for the error log */
+
+    esp_video_isp_wb_t wb;
+    esp_video_isp_bf_t bf;
+    esp_video_isp_demosaic_t demosaic;
+    esp_video_isp_sharpen_t sharpen;
+    esp_video_isp_gamma_t gamma;
+    esp_video_isp_ccm_t ccm;
+#if ESP_VIDEO_ISP_DEVICE_LSC
+    esp_video_isp_lsc_t lsc;
+#endif
+    esp_video_isp_awb_t awb;
+    esp_video_isp_af_t af;
+} isp_ctrl_batch_t;
+
 typedef struct esp_video_isp {
     int isp_fd;
     esp_video_isp_stats_t *isp_stats[ISP_METADATA_BUFFER_COUNT];
@@ -62,6 +178,14 @@ typedef struct esp_video_isp {
     uint32_t prev_exposure_val;
     uint32_t sensor_tline_ns;
 
+    isp_ctrl_batch_t ctrl_batch;
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+    esp_ipa_metadata_t applied;     /* Last written value of the parameters in applied_flags */
+    uint32_t applied_flags;
+    float applied_gain;             /* Gain requested when prev_gain_index was written, 0 if none */
+#endif
+
     struct {
         uint8_t gain        : 1;
         uint8_t exposure    : 1;
@@ -72,6 +196,28 @@ typedef struct esp_video_isp {
         uint8_t af_stime    : 1;
     } sensor_attr;
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+    ipa_sched_t ipa_sched[IPA_SCHED_COUNT];
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+    isp_startup_t startup;
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+    isp_warm_start_t warm_start;    /* State in NVS, width is 0 if there is none */
+#endif
+#endif
+
+    portMUX_TYPE run_stats_lock;
+    esp_video_isp_run_stats_t run_stats;
+    esp_video_isp_init_times_t init_times;
+    int64_t task_start_us;          /* Start of the ISP controller task, 0 once the first statistics came */
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT
+    esp_ipa_metadata_t deferred;    /* Initial parameters in ISP_DEFERRED_FLAGS, not applied yet */
+#endif
+#if ISP_RUN_BUDGET_US > 0
+    uint32_t run_debt_us;           /* Time over the budget still to be paid back by skipping runs */
+#endif
+
     TaskHandle_t task_handler;
 #if CONFIG_ISP_PIPELINE_CONTROLLER_TASK_STACK_USE_PSRAM
     StaticTask_t *task_ptr;
@@ -82,6 +228,22 @@ typedef struct esp_video_isp {
 static const char *TAG = "ISP";
 static esp_video_isp_t *s_esp_video_isp;
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS > 0
+/**
+ * @brief ISP statistics subscriber, a free slot has no callback
+ */
+typedef struct {
+    esp_video_isp_stats_cb_t cb;
+    void *arg;
+} isp_stats_subscriber_t;
+
+/* Held while the callbacks run, so that an unsubscribed callback is not running anymore */
+static _lock_t s_stats_lock;
+static isp_stats_subscriber_t s_stats_subscriber[CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS];
+static volatile uint32_t s_stats_subscriber_count;
+static esp_video_isp_frame_stats_t s_frame_stats;
+#endif
+
 /**
  * @brief Print ISP statistics data
  *
@@ -215,221 +377,181 @@ static void print_dev_info(int fd)
 #endif
 }
 
-static void config_white_balance(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
+/**
+ * @brief Append a value control to the ISP control batch
+ */
+static void isp_ctrl_batch_add_value(esp_video_isp_t *isp, uint32_t id, int32_t value, const char *name)
+{
+    isp_ctrl_batch_t *batch = &isp->ctrl_batch;
+
+    assert(batch->count < ISP_CTRL_BATCH_SIZE);
+    batch->control[batch->count].id = id;
+    batch->control[batch->count].value = value;
+    batch->name[batch->count++] = name;
+}
+
+/**
+ * @brief Append a compound control to the ISP control batch, data must live in the batch
+ */
+static void isp_ctrl_batch_add_data(esp_video_isp_t *isp, uint32_t id, void *data, uint32_t size, const char *name)
+{
+    isp_ctrl_batch_t *batch = &isp->ctrl_batch;
+
+    assert(batch->count < ISP_CTRL_BATCH_SIZE);
+    batch->control[batch->count].id = id;
+    batch->control[batch->count].p_u8 = (uint8_t *)data;
+    batch->control[batch->count].size = size;
+    batch->name[batch->count++] = name;
+}
+
+/**
+ * @brief Write the ISP control batch in one VIDIOC_S_EXT_CTRLS
+ *
+ * The ISP device stops at a failing control, so a failed transaction is
+ * written again control by control to apply the rest and name the bad one.
+ */
+static void isp_ctrl_batch_commit(esp_video_isp_t *isp)
 {
+    isp_ctrl_batch_t *batch = &isp->ctrl_batch;
     struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
+
+    if (!batch->count) {
+        return;
+    }
+
+    controls.ctrl_class = V4L2_CID_USER_CLASS;
+    controls.count      = batch->count;
+    controls.controls   = batch->control;
+    if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
+        controls.count = 1;
+        for (uint32_t i = 0; i < batch->count; i++) {
+            controls.controls = &batch->control[i];
+            if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
+                ESP_LOGE(TAG, "failed to set %s", batch->name[i]);
+            }
+        }
+    }
+
+    batch->count = 0;
+}
+
+static void config_white_balance(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
+{
     bool rc = metadata->flags & IPA_METADATA_FLAGS_RG;
     bool bg = metadata->flags & IPA_METADATA_FLAGS_BG;
 
     if (rc && bg) {
-        esp_video_isp_wb_t wb = {
-            .enable = true,
-            .red_gain = metadata->red_gain,
-            .blue_gain = metadata->blue_gain
-        };
+        esp_video_isp_wb_t *wb = &isp->ctrl_batch.wb;
 
-        controls.ctrl_class = V4L2_CTRL_CLASS_USER;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_WB;
-        control[0].p_u8     = (uint8_t *)&wb;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set white balance");
-        }
+        wb->enable = true;
+        wb->red_gain = metadata->red_gain;
+        wb->blue_gain = metadata->blue_gain;
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_WB, wb, sizeof(*wb), "white balance");
     } else if (rc) {
-        controls.ctrl_class = V4L2_CTRL_CLASS_USER;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_RED_BALANCE;
-        control[0].value    = metadata->red_gain * V4L2_CID_RED_BALANCE_DEN;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set red balance");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_RED_BALANCE, metadata->red_gain * V4L2_CID_RED_BALANCE_DEN,
+                                 "red balance");
     } else if (bg) {
-        controls.ctrl_class = V4L2_CTRL_CLASS_USER;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_BLUE_BALANCE;
-        control[0].value    = metadata->blue_gain * V4L2_CID_BLUE_BALANCE_DEN;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set blue balance");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_BLUE_BALANCE, metadata->blue_gain * V4L2_CID_BLUE_BALANCE_DEN,
+                                 "blue balance");
     }
 }
 
 static void config_bayer_filter(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_bf_t bf;
+    esp_video_isp_bf_t *bf = &isp->ctrl_batch.bf;
 
     if (metadata->flags & IPA_METADATA_FLAGS_BF) {
-        bf.enable = true;
-        bf.level = metadata->bf.level;
+        bf->enable = true;
+        bf->level = metadata->bf.level;
         for (int i = 0; i < ISP_BF_TEMPLATE_X_NUMS; i++) {
             for (int j = 0; j < ISP_BF_TEMPLATE_Y_NUMS; j++) {
-                bf.matrix[i][j] = metadata->bf.matrix[i][j];
+                bf->matrix[i][j] = metadata->bf.matrix[i][j];
             }
         }
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_BF;
-        control[0].p_u8     = (uint8_t *)&bf;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set bayer filter");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_BF, bf, sizeof(*bf), "bayer filter");
     }
 }
 
 static void config_demosaic(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_demosaic_t demosaic;
+    esp_video_isp_demosaic_t *demosaic = &isp->ctrl_batch.demosaic;
 
     if (metadata->flags & IPA_METADATA_FLAGS_DM) {
-        demosaic.enable = true;
-        demosaic.gradient_ratio = metadata->demosaic.gradient_ratio;
+        demosaic->enable = true;
+        demosaic->gradient_ratio = metadata->demosaic.gradient_ratio;
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_DEMOSAIC;
-        control[0].p_u8     = (uint8_t *)&demosaic;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set demosaic");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_DEMOSAIC, demosaic, sizeof(*demosaic), "demosaic");
     }
 }
 
 static void config_sharpen(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_sharpen_t sharpen;
+    esp_video_isp_sharpen_t *sharpen = &isp->ctrl_batch.sharpen;
 
     if (metadata->flags & IPA_METADATA_FLAGS_SH) {
-        sharpen.enable = true;
-        sharpen.h_thresh = metadata->sharpen.h_thresh;
-        sharpen.l_thresh = metadata->sharpen.l_thresh;
-        sharpen.h_coeff = metadata->sharpen.h_coeff;
-        sharpen.m_coeff = metadata->sharpen.m_coeff;
+        sharpen->enable = true;
+        sharpen->h_thresh = metadata->sharpen.h_thresh;
+        sharpen->l_thresh = metadata->sharpen.l_thresh;
+        sharpen->h_coeff = metadata->sharpen.h_coeff;
+        sharpen->m_coeff = metadata->sharpen.m_coeff;
         for (int i = 0; i < ISP_SHARPEN_TEMPLATE_X_NUMS; i++) {
             for (int j = 0; j < ISP_SHARPEN_TEMPLATE_Y_NUMS; j++) {
-                sharpen.matrix[i][j] = metadata->sharpen.matrix[i][j];
+                sharpen->matrix[i][j] = metadata->sharpen.matrix[i][j];
             }
         }
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_SHARPEN;
-        control[0].p_u8     = (uint8_t *)&sharpen;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set sharpen");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_SHARPEN, sharpen, sizeof(*sharpen), "sharpen");
     }
 }
 
 static void config_gamma(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_gamma_t gamma;
+    esp_video_isp_gamma_t *gamma = &isp->ctrl_batch.gamma;
 
     if (metadata->flags & IPA_METADATA_FLAGS_GAMMA) {
-        gamma.enable = true;
+        gamma->enable = true;
         for (int i = 0; i < ISP_GAMMA_CURVE_POINTS_NUM; i++) {
-            gamma.points[i].x = metadata->gamma.x[i];
-            gamma.points[i].y = metadata->gamma.y[i];
+            gamma->points[i].x = metadata->gamma.x[i];
+            gamma->points[i].y = metadata->gamma.y[i];
         }
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_GAMMA;
-        control[0].p_u8     = (uint8_t *)&gamma;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set GAMMA");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_GAMMA, gamma, sizeof(*gamma), "GAMMA");
     }
 }
 
 static void config_ccm(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_ccm_t ccm;
+    esp_video_isp_ccm_t *ccm = &isp->ctrl_batch.ccm;
 
     if (metadata->flags & IPA_METADATA_FLAGS_CCM) {
-        ccm.enable = true;
+        ccm->enable = true;
         for (int i = 0; i < ISP_CCM_DIMENSION; i++) {
             for (int j = 0; j < ISP_CCM_DIMENSION; j++) {
-                ccm.matrix[i][j] = metadata->ccm.matrix[i][j];
+                ccm->matrix[i][j] = metadata->ccm.matrix[i][j];
             }
         }
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_CCM;
-        control[0].p_u8     = (uint8_t *)&ccm;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set CCM");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_CCM, ccm, sizeof(*ccm), "CCM");
     }
 }
 
 static void config_color(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-
     if (metadata->flags & IPA_METADATA_FLAGS_BR) {
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_BRIGHTNESS;
-        control[0].value    = metadata->brightness;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set brightness");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_BRIGHTNESS, metadata->brightness, "brightness");
     }
 
     if (metadata->flags & IPA_METADATA_FLAGS_CN) {
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_CONTRAST;
-        control[0].value    = metadata->contrast;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set contrast");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_CONTRAST, metadata->contrast, "contrast");
     }
 
     if (metadata->flags & IPA_METADATA_FLAGS_ST) {
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_SATURATION;
-        control[0].value    = metadata->saturation;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set saturation");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_SATURATION, metadata->saturation, "saturation");
     }
 
     if (metadata->flags & IPA_METADATA_FLAGS_HUE) {
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_HUE;
-        control[0].value    = metadata->hue;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set hue");
-        }
+        isp_ctrl_batch_add_value(isp, V4L2_CID_HUE, metadata->hue, "hue");
     }
 }
 
@@ -440,6 +562,14 @@ static void config_exposure_and_gain(esp_video_isp_t *isp, esp_ipa_metadata_t *m
     struct v4l2_ext_controls controls;
     struct v4l2_ext_control control[1];
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+    /* Nearly the same request maps to the same gain step, skip the gain menu search */
+    if ((metadata->flags & IPA_METADATA_FLAGS_GN) && isp->applied_gain > 0 &&
+            fabsf(metadata->gain - isp->applied_gain) <= isp->applied_gain * AE_DEADBAND) {
+        metadata->flags &= ~IPA_METADATA_FLAGS_GN;
+    }
+#endif
+
     if (metadata->flags & IPA_METADATA_FLAGS_GN) {
         int ret;
         int32_t base_gain;
@@ -569,7 +699,14 @@ static void config_exposure_and_gain(esp_video_isp_t *isp, esp_ipa_metadata_t *m
             exposure_val = MAX(exposure_val, qctrl.minimum);
             exposure_val = MIN(exposure_val, qctrl.maximum);
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+            uint32_t exposure_diff = exposure_val > isp->prev_exposure_val ? exposure_val - isp->prev_exposure_val :
+                                     isp->prev_exposure_val - exposure_val;
+
+            if (exposure_diff <= isp->prev_exposure_val * AE_DEADBAND) {
+#else
             if (exposure_val == isp->prev_exposure_val) {
+#endif
                 metadata->flags &= ~IPA_METADATA_FLAGS_ET;
             } else {
                 ESP_LOGD(TAG, "Exposure time: %"PRIu32 " value: %"PRIi32, metadata->exposure, exposure_val);
@@ -599,6 +736,9 @@ static void config_exposure_and_gain(esp_video_isp_t *isp, esp_ipa_metadata_t *m
             isp->prev_exposure_val = exposure_val;
             isp->sensor.cur_gain = target_gain;
             isp->prev_gain_index = gain_index;
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+            isp->applied_gain = metadata->gain;
+#endif
         }
     } else {
         if ((metadata->flags & IPA_METADATA_FLAGS_ET) &&
@@ -628,6 +768,9 @@ static void config_exposure_and_gain(esp_video_isp_t *isp, esp_ipa_metadata_t *m
             } else {
                 isp->sensor.cur_gain = target_gain;
                 isp->prev_gain_index = gain_index;
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+                isp->applied_gain = metadata->gain;
+#endif
             }
         }
     }
@@ -636,26 +779,17 @@ static void config_exposure_and_gain(esp_video_isp_t *isp, esp_ipa_metadata_t *m
 #if ESP_VIDEO_ISP_DEVICE_LSC
 static void config_lsc(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_lsc_t lsc;
+    esp_video_isp_lsc_t *lsc = &isp->ctrl_batch.lsc;
 
     if (metadata->flags & IPA_METADATA_FLAGS_LSC) {
-        lsc.enable = true;
-        lsc.gain_r = metadata->lsc.gain_r;
-        lsc.gain_gr = metadata->lsc.gain_gr;
-        lsc.gain_gb = metadata->lsc.gain_gb;
-        lsc.gain_b = metadata->lsc.gain_b;
-        lsc.lsc_gain_size = metadata->lsc.lsc_gain_array_size;
-
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_LSC;
-        control[0].p_u8     = (uint8_t *)&lsc;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set LSC");
-        }
+        lsc->enable = true;
+        lsc->gain_r = metadata->lsc.gain_r;
+        lsc->gain_gr = metadata->lsc.gain_gr;
+        lsc->gain_gb = metadata->lsc.gain_gb;
+        lsc->gain_b = metadata->lsc.gain_b;
+        lsc->lsc_gain_size = metadata->lsc.lsc_gain_array_size;
+
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_LSC, lsc, sizeof(*lsc), "LSC");
     }
 }
 #endif
@@ -682,29 +816,20 @@ static void config_sensor_ae_target_level(esp_video_isp_t *isp, esp_ipa_metadata
 
 static void config_awb(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_awb_t awb;
+    esp_video_isp_awb_t *awb = &isp->ctrl_batch.awb;
 
     if (metadata->flags & IPA_METADATA_FLAGS_AWB) {
         esp_ipa_awb_range_t *range = &metadata->awb;
 
-        awb.enable = true;
-        awb.green_max = range->green_max;
-        awb.green_min = range->green_min;
-        awb.rg_max = range->rg_max;
-        awb.rg_min = range->rg_min;
-        awb.bg_max = range->bg_max;
-        awb.bg_min = range->bg_min;
+        awb->enable = true;
+        awb->green_max = range->green_max;
+        awb->green_min = range->green_min;
+        awb->rg_max = range->rg_max;
+        awb->rg_min = range->rg_min;
+        awb->bg_max = range->bg_max;
+        awb->bg_min = range->bg_min;
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_AWB;
-        control[0].p_u8     = (uint8_t *)&awb;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set AWB");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_AWB, awb, sizeof(*awb), "AWB");
     }
 }
 
@@ -728,25 +853,16 @@ static void config_statistics_region(esp_video_isp_t *isp, esp_ipa_metadata_t *m
 
 static void config_af(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
-    struct v4l2_ext_controls controls;
-    struct v4l2_ext_control control[1];
-    esp_video_isp_af_t af;
+    esp_video_isp_af_t *af = &isp->ctrl_batch.af;
 
     if (metadata->flags & IPA_METADATA_FLAGS_AF) {
         esp_ipa_af_t *ipa_af = &metadata->af;
 
-        af.enable = true;
-        af.edge_thresh = ipa_af->edge_thresh;
-        memcpy(af.windows, ipa_af->windows, sizeof(isp_window_t) * ISP_AF_WINDOW_NUM);
+        af->enable = true;
+        af->edge_thresh = ipa_af->edge_thresh;
+        memcpy(af->windows, ipa_af->windows, sizeof(isp_window_t) * ISP_AF_WINDOW_NUM);
 
-        controls.ctrl_class = V4L2_CID_USER_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_USER_ESP_ISP_AF;
-        control[0].p_u8     = (uint8_t *)&af;
-        if (ioctl(isp->isp_fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
-            ESP_LOGE(TAG, "failed to set AF");
-        }
+        isp_ctrl_batch_add_data(isp, V4L2_CID_USER_ESP_ISP_AF, af, sizeof(*af), "AF");
     }
 }
 
@@ -786,8 +902,150 @@ static void config_motor_position(esp_video_isp_t *isp, esp_ipa_metadata_t *meta
 }
 #endif
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+#define METADATA_IS_SAME(a, b, field)   (!memcmp(&(a)->field, &(b)->field, sizeof((a)->field)))
+
+static bool is_value_changed(float value, float applied, float deadband)
+{
+    return fabsf(value - applied) > deadband;
+}
+
+/*
+ * Clear the flags of the parameters that are the same as, or within the dead
+ * band of, the value last written. The dead band is measured from the written
+ * value, so a parameter dithering around it is not written at all.
+ */
+static void skip_unchanged_metadata(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
+{
+    const esp_ipa_metadata_t *applied = &isp->applied;
+    uint32_t flags = metadata->flags & isp->applied_flags;
+    uint32_t same = 0;
+
+    if ((flags & IPA_METADATA_FLAGS_RG) &&
+            !is_value_changed(metadata->red_gain, applied->red_gain, applied->red_gain * WB_DEADBAND)) {
+        same |= IPA_METADATA_FLAGS_RG;
+    }
+    if ((flags & IPA_METADATA_FLAGS_BG) &&
+            !is_value_changed(metadata->blue_gain, applied->blue_gain, applied->blue_gain * WB_DEADBAND)) {
+        same |= IPA_METADATA_FLAGS_BG;
+    }
+
+    if (flags & IPA_METADATA_FLAGS_CCM) {
+        bool changed = false;
+
+        for (int i = 0; i < ISP_CCM_DIMENSION && !changed; i++) {
+            for (int j = 0; j < ISP_CCM_DIMENSION && !changed; j++) {
+                changed = is_value_changed(metadata->ccm.matrix[i][j], applied->ccm.matrix[i][j], CCM_DEADBAND);
+            }
+        }
+        if (!changed) {
+            same |= IPA_METADATA_FLAGS_CCM;
+        }
+    }
+
+    if ((flags & IPA_METADATA_FLAGS_BF) && METADATA_IS_SAME(metadata, applied, bf)) {
+        same |= IPA_METADATA_FLAGS_BF;
+    }
+    if ((flags & IPA_METADATA_FLAGS_DM) && METADATA_IS_SAME(metadata, applied, demosaic)) {
+        same |= IPA_METADATA_FLAGS_DM;
+    }
+    if ((flags & IPA_METADATA_FLAGS_SH) && METADATA_IS_SAME(metadata, applied, sharpen)) {
+        same |= IPA_METADATA_FLAGS_SH;
+    }
+    if ((flags & IPA_METADATA_FLAGS_GAMMA) && METADATA_IS_SAME(metadata, applied, gamma)) {
+        same |= IPA_METADATA_FLAGS_GAMMA;
+    }
+    if ((flags & IPA_METADATA_FLAGS_AWB) && METADATA_IS_SAME(metadata, applied, awb)) {
+        same |= IPA_METADATA_FLAGS_AWB;
+    }
+    if ((flags & IPA_METADATA_FLAGS_SR) && METADATA_IS_SAME(metadata, applied, stats_region)) {
+        same |= IPA_METADATA_FLAGS_SR;
+    }
+    if ((flags & IPA_METADATA_FLAGS_AF) && METADATA_IS_SAME(metadata, applied, af)) {
+        same |= IPA_METADATA_FLAGS_AF;
+    }
+    if ((flags & IPA_METADATA_FLAGS_BR) && metadata->brightness == applied->brightness) {
+        same |= IPA_METADATA_FLAGS_BR;
+    }
+    if ((flags & IPA_METADATA_FLAGS_CN) && metadata->contrast == applied->contrast) {
+        same |= IPA_METADATA_FLAGS_CN;
+    }
+    if ((flags & IPA_METADATA_FLAGS_ST) && metadata->saturation == applied->saturation) {
+        same |= IPA_METADATA_FLAGS_ST;
+    }
+    if ((flags & IPA_METADATA_FLAGS_HUE) && metadata->hue == applied->hue) {
+        same |= IPA_METADATA_FLAGS_HUE;
+    }
+    if ((flags & IPA_METADATA_FLAGS_AETL) && metadata->ae_target_level == applied->ae_target_level) {
+        same |= IPA_METADATA_FLAGS_AETL;
+    }
+
+    metadata->flags &= ~same;
+}
+
+/* Record the parameters about to be written, the ones left in metadata->flags */
+static void save_applied_metadata(esp_video_isp_t *isp, const esp_ipa_metadata_t *metadata)
+{
+    esp_ipa_metadata_t *applied = &isp->applied;
+    uint32_t flags = metadata->flags & SHADOW_FLAGS;
+
+    if (flags & IPA_METADATA_FLAGS_RG) {
+        applied->red_gain = metadata->red_gain;
+    }
+    if (flags & IPA_METADATA_FLAGS_BG) {
+        applied->blue_gain = metadata->blue_gain;
+    }
+    if (flags & IPA_METADATA_FLAGS_CCM) {
+        applied->ccm = metadata->ccm;
+    }
+    if (flags & IPA_METADATA_FLAGS_BF) {
+        applied->bf = metadata->bf;
+    }
+    if (flags & IPA_METADATA_FLAGS_DM) {
+        applied->demosaic = metadata->demosaic;
+    }
+    if (flags & IPA_METADATA_FLAGS_SH) {
+        applied->sharpen = metadata->sharpen;
+    }
+    if (flags & IPA_METADATA_FLAGS_GAMMA) {
+        applied->gamma = metadata->gamma;
+    }
+    if (flags & IPA_METADATA_FLAGS_AWB) {
+        applied->awb = metadata->awb;
+    }
+    if (flags & IPA_METADATA_FLAGS_SR) {
+        applied->stats_region = metadata->stats_region;
+    }
+    if (flags & IPA_METADATA_FLAGS_AF) {
+        applied->af = metadata->af;
+    }
+    if (flags & IPA_METADATA_FLAGS_BR) {
+        applied->brightness = metadata->brightness;
+    }
+    if (flags & IPA_METADATA_FLAGS_CN) {
+        applied->contrast = metadata->contrast;
+    }
+    if (flags & IPA_METADATA_FLAGS_ST) {
+        applied->saturation = metadata->saturation;
+    }
+    if (flags & IPA_METADATA_FLAGS_HUE) {
+        applied->hue = metadata->hue;
+    }
+    if (flags & IPA_METADATA_FLAGS_AETL) {
+        applied->ae_target_level = metadata->ae_target_level;
+    }
+
+    isp->applied_flags |= flags;
+}
+#endif
+
 static void config_isp_and_camera(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
 {
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_SKIP_UNCHANGED
+    skip_unchanged_metadata(isp, metadata);
+    save_applied_metadata(isp, metadata);
+#endif
+
     config_statistics_region(isp, metadata);
 
     if (!isp->sensor_attr.awb) {
@@ -806,9 +1064,16 @@ static void config_isp_and_camera(esp_video_isp_t *isp, esp_ipa_metadata_t *meta
     config_awb(isp, metadata);
     config_af(isp, metadata);
 
+    /*
+     * The sensor latches its values at the next frame start, exposure and gain
+     * together if it has group hold. The ISP modules follow right after in one
+     * transaction, while the frame the statistics came from is in blanking.
+     */
     config_sensor_ae_target_level(isp, metadata);
     config_exposure_and_gain(isp, metadata);
+    isp_ctrl_batch_commit(isp);
 #if CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROL_CAMERA_MOTOR
+    /* Last, the MIPI-CSI device may hold the lens move until the next vertical blank */
     config_motor_position(isp, metadata);
 #endif
 }
@@ -871,33 +1136,440 @@ static void isp_stats_to_ipa_stats(esp_video_isp_stats_t *isp_stat, esp_ipa_stat
     }
 }
 
-static void get_sensor_state(esp_video_isp_t *isp, int index)
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+static void ipa_sched_init(esp_video_isp_t *isp)
 {
-    int ret;
-    struct v4l2_format format;
-
-    if (isp->sensor_attr.awb) {
-        isp->isp_stats[index]->flags &= ~ESP_VIDEO_ISP_STATS_FLAG_AWB;
+    static const struct {
+        uint32_t flag;
+        uint16_t interval;
+    } sched_info[IPA_SCHED_COUNT] = {
+        {IPA_STATS_FLAGS_AE,      CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_AE_INTERVAL},
+        {IPA_STATS_FLAGS_AWB,     CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_AWB_INTERVAL},
+        {IPA_STATS_FLAGS_HIST,    CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_AE_INTERVAL},
+        {IPA_STATS_FLAGS_SHARPEN, CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_AE_INTERVAL},
+    };
+
+    memset(isp->ipa_sched, 0, sizeof(isp->ipa_sched));
+    for (int i = 0; i < IPA_SCHED_COUNT; i++) {
+        isp->ipa_sched[i].flag = sched_info[i].flag;
+        isp->ipa_sched[i].monitor_interval = sched_info[i].interval;
     }
+}
 
-    memset(&format, 0, sizeof(struct v4l2_format));
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(isp->cam_fd, VIDIOC_G_FMT, &format);
-    if (ret == 0) {
-        isp->sensor.width = format.fmt.pix.width;
-        isp->sensor.height = format.fmt.pix.height;
-    }
+/* Summary of one statistics type, cheap enough to compute on every frame */
+static void ipa_sched_get_signature(const esp_ipa_stats_t *stats, uint32_t flag, uint32_t *signature)
+{
+    uint64_t sum = 0;
+    uint64_t weight = 0;
 
-    if (isp->sensor_attr.stats) {
-        struct v4l2_ext_controls controls;
-        struct v4l2_ext_control control[1];
-        esp_cam_sensor_stats_t sensor_stats;
+    signature[0] = 0;
+    signature[1] = 0;
 
-        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_CAMERA_STATS;
-        control[0].p_u8     = (uint8_t *)&sensor_stats;
+    switch (flag) {
+    case IPA_STATS_FLAGS_AE:
+        for (int i = 0; i < ISP_AE_BLOCK_X_NUM * ISP_AE_BLOCK_Y_NUM; i++) {
+            sum += stats->ae_stats[i].luminance;
+        }
+        signature[0] = sum / (ISP_AE_BLOCK_X_NUM * ISP_AE_BLOCK_Y_NUM);
+        break;
+    case IPA_STATS_FLAGS_AWB:
+        if (stats->awb_stats[0].counted && stats->awb_stats[0].sum_g) {
+            signature[0] = (uint64_t)stats->awb_stats[0].sum_r * IPA_SCHED_AWB_SCALE / stats->awb_stats[0].sum_g;
+            signature[1] = (uint64_t)stats->awb_stats[0].sum_b * IPA_SCHED_AWB_SCALE / stats->awb_stats[0].sum_g;
+        }
+        break;
+    case IPA_STATS_FLAGS_HIST:
+        /* Mean segment, 1/256 steps */
+        for (int i = 0; i < ISP_HIST_SEGMENT_NUMS; i++) {
+            sum += (uint64_t)stats->hist_stats[i].value * i * 256;
+            weight += stats->hist_stats[i].value;
+        }
+        signature[0] = weight ? sum / weight : 0;
+        break;
+    case IPA_STATS_FLAGS_SHARPEN:
+        signature[0] = stats->sharpen_stats.value;
+        break;
+    default:
+        break;
+    }
+}
+
+static bool ipa_sched_is_changed(uint32_t a, uint32_t b)
+{
+    uint32_t diff = a > b ? a - b : b - a;
+
+    return diff >= IPA_SCHED_MIN_CHANGE &&
+           (uint64_t)diff * 100 > (uint64_t)MAX(a, b) * CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_CHANGE_PERCENT;
+}
+
+/*
+ * Clear the statistics flags of the algorithms that are not due on this frame.
+ * An algorithm runs on every frame until its statistics have been stable for
+ * CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_CONVERGED_RUNS runs, then only every
+ * monitor_interval frames. Statistics are still summarized on skipped frames,
+ * a change since the last run makes the algorithm due at once.
+ */
+static void ipa_sched_update(esp_video_isp_t *isp, esp_ipa_stats_t *stats)
+{
+    uint32_t flags = stats->flags & ~IPA_SCHED_FLAGS;
+
+    for (int i = 0; i < IPA_SCHED_COUNT; i++) {
+        ipa_sched_t *sched = &isp->ipa_sched[i];
+        uint32_t signature[2];
+        bool changed;
+
+        if (!(stats->flags & sched->flag)) {
+            continue;
+        }
+
+        ipa_sched_get_signature(stats, sched->flag, signature);
+        changed = ipa_sched_is_changed(signature[0], sched->signature[0]) ||
+                  ipa_sched_is_changed(signature[1], sched->signature[1]);
+        if (changed) {
+            sched->stable = 0;
+            sched->countdown = 0;
+        }
+
+        if (sched->countdown) {
+            sched->countdown--;
+            continue;
+        }
+
+        if (!changed && sched->stable < CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_CONVERGED_RUNS) {
+            sched->stable++;
+        }
+        if (sched->stable >= CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_CONVERGED_RUNS) {
+            sched->countdown = sched->monitor_interval - 1;
+        }
+
+        sched->signature[0] = signature[0];
+        sched->signature[1] = signature[1];
+        flags |= sched->flag;
+    }
+
+    stats->flags = flags;
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+static bool startup_is_close(float value, float target)
+{
+    return target > 0 && fabsf(value - target) <= target * STARTUP_TOLERANCE;
+}
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+/**
+ * @brief Write the exposure and gain of the last converged stream to the sensor
+ *
+ * The AE algorithm starts from the current sensor state, so it only has to
+ * follow the scene change since then. The values are dropped if the sensor
+ * mode or the capture format changed.
+ */
+static void warm_start_load(esp_video_isp_t *isp)
+{
+    nvs_handle_t handle;
+    isp_warm_start_t state;
+    size_t size = sizeof(state);
+    struct v4l2_query_ext_ctrl qctrl;
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+
+    if (nvs_open(WARM_START_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    esp_err_t ret = nvs_get_blob(handle, WARM_START_NVS_KEY, &state, &size);
+    nvs_close(handle);
+    if (ret != ESP_OK || size != sizeof(state)) {
+        return;
+    }
+
+    isp->warm_start = state;
+    if (state.width != isp->sensor.width || state.height != isp->sensor.height ||
+            state.tline_ns != isp->sensor_tline_ns) {
+        ESP_LOGD(TAG, "Warm start state is for another sensor mode");
+        return;
+    }
+
+    qctrl.id = V4L2_CID_EXPOSURE;
+    if (isp->sensor_attr.exposure && ioctl(isp->cam_fd, VIDIOC_QUERY_EXT_CTRL, &qctrl) == 0 &&
+            state.exposure_val >= qctrl.minimum && state.exposure_val <= qctrl.maximum) {
+        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+        controls.count      = 1;
+        controls.controls   = control;
+        control[0].id       = V4L2_CID_EXPOSURE;
+        control[0].value    = state.exposure_val;
+        if (ioctl(isp->cam_fd, VIDIOC_S_EXT_CTRLS, &controls) == 0) {
+            isp->prev_exposure_val = state.exposure_val;
+            isp->sensor.cur_exposure = REG_TO_US(state.exposure_val, isp);
+        }
+    }
+
+    qctrl.id = V4L2_CID_GAIN;
+    if (isp->sensor_attr.gain && ioctl(isp->cam_fd, VIDIOC_QUERY_EXT_CTRL, &qctrl) == 0 &&
+            state.gain_val >= qctrl.minimum && state.gain_val <= qctrl.maximum) {
+        float gain = 0.0;
+
+        if (qctrl.type == V4L2_CTRL_TYPE_INTEGER) {
+            gain = (float)state.gain_val / qctrl.minimum;
+        } else if (qctrl.type == V4L2_CTRL_TYPE_INTEGER_MENU) {
+            struct v4l2_querymenu qmenu;
+            int64_t min;
+
+            qmenu.id = V4L2_CID_GAIN;
+            qmenu.index = qctrl.minimum;
+            if (ioctl(isp->cam_fd, VIDIOC_QUERYMENU, &qmenu) == 0) {
+                min = qmenu.value;
+                qmenu.index = state.gain_val;
+                if (ioctl(isp->cam_fd, VIDIOC_QUERYMENU, &qmenu) == 0) {
+                    gain = (float)qmenu.value / min;
+                }
+            }
+        }
+
+        controls.ctrl_class = V4L2_CID_USER_CLASS;
+        controls.count      = 1;
+        controls.controls   = control;
+        control[0].id       = V4L2_CID_GAIN;
+        control[0].value    = state.gain_val;
+        if (gain > 0 && ioctl(isp->cam_fd, VIDIOC_S_EXT_CTRLS, &controls) == 0) {
+            isp->prev_gain_index = state.gain_val;
+            isp->sensor.cur_gain = gain;
+        }
+    }
+
+    ESP_LOGI(TAG, "Warm start from exposure=%"PRIu32"us gain=%0.4f", (uint32_t)isp->sensor.cur_exposure,
+             isp->sensor.cur_gain);
+}
+
+/**
+ * @brief Replace the initial white balance of the IPA by the one of the last converged stream
+ */
+static void warm_start_update_metadata(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
+{
+    const isp_warm_start_t *state = &isp->warm_start;
+
+    if (isp->sensor_attr.awb || state->red_gain <= 0 || state->blue_gain <= 0 ||
+            state->width != isp->sensor.width || state->height != isp->sensor.height ||
+            state->tline_ns != isp->sensor_tline_ns) {
+        return;
+    }
+
+    metadata->red_gain = state->red_gain;
+    metadata->blue_gain = state->blue_gain;
+    metadata->flags |= IPA_METADATA_FLAGS_RG | IPA_METADATA_FLAGS_BG;
+}
+
+/**
+ * @brief Save the converged state, unless the one in NVS is within the convergence tolerance
+ *
+ * Streams mostly converge to the same state, which then costs no flash write.
+ */
+static void warm_start_store(esp_video_isp_t *isp)
+{
+    nvs_handle_t handle;
+    esp_err_t ret;
+    isp_warm_start_t *saved = &isp->warm_start;
+    isp_warm_start_t state = {
+        .width = isp->sensor.width,
+        .height = isp->sensor.height,
+        .tline_ns = isp->sensor_tline_ns,
+        .exposure_val = isp->prev_exposure_val,
+        .gain_val = isp->prev_gain_index,
+    };
+
+    if (!isp->sensor_attr.awb) {
+        state.red_gain = isp->startup.red_gain;
+        state.blue_gain = isp->startup.blue_gain;
+    }
+
+    if (saved->width == state.width && saved->height == state.height && saved->tline_ns == state.tline_ns &&
+            saved->gain_val == state.gain_val && startup_is_close(state.exposure_val, saved->exposure_val) &&
+            (state.red_gain <= 0 || startup_is_close(state.red_gain, saved->red_gain)) &&
+            (state.blue_gain <= 0 || startup_is_close(state.blue_gain, saved->blue_gain))) {
+        return;
+    }
+
+    ret = nvs_open(WARM_START_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(handle, WARM_START_NVS_KEY, &state, sizeof(state));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    if (ret == ESP_OK) {
+        *saved = state;
+    } else {
+        ESP_LOGW(TAG, "failed to save warm start state: %s", esp_err_to_name(ret));
+    }
+}
+#endif
+
+static esp_err_t startup_set_state(esp_video_isp_t *isp, uint32_t state)
+{
+    struct esp_video_convergence convergence = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .state = state,
+        .hold = STARTUP_HOLD,
+    };
+
+    return ioctl(isp->cam_fd, VIDIOC_S_CONVERGENCE, &convergence) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Follow the convergence state of the capture stream, it becomes pending at every VIDIOC_STREAMON
+ */
+static void startup_check_stream(esp_video_isp_t *isp)
+{
+    struct esp_video_convergence convergence = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+    };
+
+    if (!isp->startup.supported || ioctl(isp->cam_fd, VIDIOC_G_CONVERGENCE, &convergence) != 0) {
+        return;
+    }
+
+    if (convergence.state == ESP_VIDEO_CONVERGENCE_PENDING && !isp->startup.active) {
+        memset(&isp->startup, 0, sizeof(isp->startup));
+        isp->startup.supported = true;
+        isp->startup.active = true;
+        ESP_LOGD(TAG, "Fast convergence started");
+    } else if (convergence.state != ESP_VIDEO_CONVERGENCE_PENDING) {
+        /* Done by this task, or turned off by the application */
+        isp->startup.active = false;
+    }
+}
+
+/**
+ * @brief Check the IPA result against the current state and boost it, while the stream converges
+ *
+ * The AE algorithm moves the sensor a fraction of the way to its target on
+ * every run, its step is raised to the power of the boost relative to the
+ * current exposure and gain. The AWB algorithm smooths its gains internally,
+ * its step is extrapolated linearly instead. The sensor is not written again
+ * until its statistics reflect the last exposure write.
+ */
+static void startup_update_metadata(esp_video_isp_t *isp, esp_ipa_metadata_t *metadata)
+{
+    isp_startup_t *startup = &isp->startup;
+    esp_ipa_sensor_t *sensor = &isp->sensor;
+    bool converged = !startup->wait;
+
+    if (metadata->flags & (IPA_METADATA_FLAGS_ET | IPA_METADATA_FLAGS_GN)) {
+        float exposure = (metadata->flags & IPA_METADATA_FLAGS_ET) ? metadata->exposure : sensor->cur_exposure;
+        float gain = (metadata->flags & IPA_METADATA_FLAGS_GN) ? metadata->gain : sensor->cur_gain;
+        float cur_total = (float)sensor->cur_exposure * sensor->cur_gain;
+
+        if (startup->wait) {
+            /* The request comes from statistics of the old exposure */
+            metadata->flags &= ~(IPA_METADATA_FLAGS_ET | IPA_METADATA_FLAGS_GN);
+        } else if (cur_total > 0 && sensor->cur_exposure > 0 && !startup_is_close(exposure * gain, cur_total)) {
+            float total = cur_total * powf(exposure * gain / cur_total, STARTUP_BOOST);
+            float boost_exposure = sensor->cur_exposure * powf(exposure / sensor->cur_exposure, STARTUP_BOOST);
+
+            boost_exposure = MIN(MAX(boost_exposure, sensor->min_exposure), sensor->max_exposure);
+            gain = MIN(MAX(total / boost_exposure, sensor->min_gain), sensor->max_gain);
+
+            metadata->exposure = (uint32_t)boost_exposure;
+            metadata->gain = gain;
+            metadata->flags |= IPA_METADATA_FLAGS_ET | IPA_METADATA_FLAGS_GN;
+            converged = false;
+        }
+    }
+
+    if ((metadata->flags & (IPA_METADATA_FLAGS_RG | IPA_METADATA_FLAGS_BG)) && !isp->sensor_attr.awb) {
+        float red_gain = metadata->red_gain;
+        float blue_gain = metadata->blue_gain;
+
+        if ((metadata->flags & IPA_METADATA_FLAGS_RG) && startup->red_gain > 0) {
+            converged = converged && startup_is_close(red_gain, startup->red_gain);
+            metadata->red_gain = MAX(red_gain + (red_gain - startup->red_gain) * (STARTUP_BOOST - 1), 0.0f);
+        }
+        if ((metadata->flags & IPA_METADATA_FLAGS_BG) && startup->blue_gain > 0) {
+            converged = converged && startup_is_close(blue_gain, startup->blue_gain);
+            metadata->blue_gain = MAX(blue_gain + (blue_gain - startup->blue_gain) * (STARTUP_BOOST - 1), 0.0f);
+        }
+        if (metadata->flags & IPA_METADATA_FLAGS_RG) {
+            converged = converged && startup->red_gain > 0;
+            startup->red_gain = red_gain;
+        }
+        if (metadata->flags & IPA_METADATA_FLAGS_BG) {
+            converged = converged && startup->blue_gain > 0;
+            startup->blue_gain = blue_gain;
+        }
+    }
+
+    if (startup->wait) {
+        startup->wait--;
+    }
+
+    startup->settled = converged ? startup->settled + 1 : 0;
+}
+
+/**
+ * @brief Account the frame, and mark the stream converged once the frames settled
+ */
+static void startup_end_frame(esp_video_isp_t *isp, uint32_t prev_exposure_val, int32_t prev_gain_index)
+{
+    isp_startup_t *startup = &isp->startup;
+
+    if (isp->prev_exposure_val != prev_exposure_val || isp->prev_gain_index != prev_gain_index) {
+        startup->wait = CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_SENSOR_LATENCY;
+    }
+    startup->frames++;
+
+    if (startup->settled < CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_SETTLE_FRAMES &&
+            startup->frames < CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_MAX_FRAMES) {
+        return;
+    }
+
+    if (startup_set_state(isp, ESP_VIDEO_CONVERGENCE_DONE) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to set convergence done");
+    } else if (startup->settled < CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_SETTLE_FRAMES) {
+        ESP_LOGW(TAG, "AE/AWB not converged after %d frames", startup->frames);
+    } else {
+        ESP_LOGI(TAG, "AE/AWB converged in %d frames", startup->frames);
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+        warm_start_store(isp);
+#endif
+    }
+    startup->active = false;
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+    /* Normal smoothing from here, the algorithms slow down once they are stable again */
+    ipa_sched_init(isp);
+#endif
+}
+#endif
+
+static void get_sensor_state(esp_video_isp_t *isp, int index)
+{
+    int ret;
+    struct v4l2_format format;
+
+    if (isp->sensor_attr.awb) {
+        isp->isp_stats[index]->flags &= ~ESP_VIDEO_ISP_STATS_FLAG_AWB;
+    }
+
+    memset(&format, 0, sizeof(struct v4l2_format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(isp->cam_fd, VIDIOC_G_FMT, &format);
+    if (ret == 0) {
+        isp->sensor.width = format.fmt.pix.width;
+        isp->sensor.height = format.fmt.pix.height;
+    }
+
+    if (isp->sensor_attr.stats) {
+        struct v4l2_ext_controls controls;
+        struct v4l2_ext_control control[1];
+        esp_cam_sensor_stats_t sensor_stats;
+
+        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+        controls.count      = 1;
+        controls.controls   = control;
+        control[0].id       = V4L2_CID_CAMERA_STATS;
+        control[0].p_u8     = (uint8_t *)&sensor_stats;
         control[0].size     = sizeof(sensor_stats);
         ret = ioctl(isp->cam_fd, VIDIOC_G_EXT_CTRLS, &controls);
         if (ret == 0) {
@@ -926,6 +1598,239 @@ static void get_sensor_state(esp_video_isp_t *isp, int index)
     }
 }
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS > 0
+esp_err_t esp_video_isp_stats_subscribe(esp_video_isp_stats_cb_t cb, void *arg)
+{
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    isp_stats_subscriber_t *free_slot = NULL;
+
+    ESP_RETURN_ON_FALSE(cb, ESP_ERR_INVALID_ARG, TAG, "cb is NULL");
+
+    _lock_acquire(&s_stats_lock);
+    for (int i = 0; i < CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS; i++) {
+        isp_stats_subscriber_t *subscriber = &s_stats_subscriber[i];
+
+        if (subscriber->cb == cb && subscriber->arg == arg) {
+            free_slot = NULL;
+            ret = ESP_ERR_INVALID_STATE;
+            break;
+        } else if (!subscriber->cb && !free_slot) {
+            free_slot = subscriber;
+        }
+    }
+    if (free_slot) {
+        free_slot->cb = cb;
+        free_slot->arg = arg;
+        s_stats_subscriber_count++;
+        ret = ESP_OK;
+    }
+    _lock_release(&s_stats_lock);
+
+    return ret;
+}
+
+esp_err_t esp_video_isp_stats_unsubscribe(esp_video_isp_stats_cb_t cb, void *arg)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    _lock_acquire(&s_stats_lock);
+    for (int i = 0; i < CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS; i++) {
+        isp_stats_subscriber_t *subscriber = &s_stats_subscriber[i];
+
+        if (subscriber->cb && subscriber->cb == cb && subscriber->arg == arg) {
+            subscriber->cb = NULL;
+            subscriber->arg = NULL;
+            s_stats_subscriber_count--;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    _lock_release(&s_stats_lock);
+
+    return ret;
+}
+
+/**
+ * @brief Get the capture sequence number of the last frame done
+ *
+ * The statistics of a frame are complete when its last line went through the
+ * ISP, at the same time the capture buffer of the frame is done, so the last
+ * frame done is the one the statistics were taken from unless the ISP
+ * controller task was delayed by a whole frame.
+ */
+static uint32_t get_frame_sequence(esp_video_isp_t *isp)
+{
+    struct esp_video_stream_stats stream_stats = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+    };
+
+    if (ioctl(isp->cam_fd, VIDIOC_G_STREAM_STATS, &stream_stats) != 0 || !stream_stats.sequence) {
+        return 0;
+    }
+
+    return stream_stats.sequence - 1;
+}
+
+/**
+ * @brief Take a copy of a statistics buffer for the subscribers, before it is queued again
+ */
+static bool copy_frame_stats(esp_video_isp_t *isp, int index)
+{
+    esp_video_isp_frame_stats_t *frame_stats = &s_frame_stats;
+
+    /* Read without the lock, a subscriber coming in now gets the next frame */
+    if (!s_stats_subscriber_count) {
+        return false;
+    }
+
+    frame_stats->frame_sequence = get_frame_sequence(isp);
+    frame_stats->timestamp_us = esp_timer_get_time();
+    frame_stats->exposure_us = isp->sensor.cur_exposure;
+    frame_stats->gain = isp->sensor.cur_gain;
+    frame_stats->stats = *isp->isp_stats[index];
+
+    return true;
+}
+
+static void deliver_frame_stats(void)
+{
+    _lock_acquire(&s_stats_lock);
+    for (int i = 0; i < CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS; i++) {
+        isp_stats_subscriber_t *subscriber = &s_stats_subscriber[i];
+
+        if (subscriber->cb) {
+            subscriber->cb(&s_frame_stats, subscriber->arg);
+        }
+    }
+    _lock_release(&s_stats_lock);
+}
+#endif
+
+/**
+ * @brief Account one run of the image algorithms that started at start_us
+ */
+static void isp_run_done(esp_video_isp_t *isp, int64_t start_us)
+{
+    uint32_t run_us = (uint32_t)(esp_timer_get_time() - start_us);
+    esp_video_isp_run_stats_t *stats = &isp->run_stats;
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    stats->runs++;
+    stats->last_run_us = run_us;
+    stats->max_run_us = MAX(stats->max_run_us, run_us);
+    stats->total_run_us += run_us;
+#if ISP_RUN_BUDGET_US > 0
+    if (run_us > ISP_RUN_BUDGET_US) {
+        stats->overruns++;
+        isp->run_debt_us = MIN(isp->run_debt_us + run_us - ISP_RUN_BUDGET_US,
+                               ISP_RUN_BUDGET_US * ISP_RUN_MAX_DEBT_FRAMES);
+    }
+#endif
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+}
+
+#if ISP_RUN_BUDGET_US > 0
+/**
+ * @brief Check if the algorithms skip this frame, each skipped frame pays back one budget
+ */
+static bool isp_run_is_throttled(esp_video_isp_t *isp)
+{
+    bool throttled = false;
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+    /* The startup convergence needs every frame, and is over in a few frames */
+    if (isp->startup.active) {
+        return false;
+    }
+#endif
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    if (isp->run_debt_us) {
+        isp->run_debt_us -= MIN(isp->run_debt_us, ISP_RUN_BUDGET_US);
+        isp->run_stats.throttled++;
+        throttled = true;
+    }
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+
+    return throttled;
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROL_CAMERA_MOTOR
+/**
+ * @brief Read the lens position and step timing of the camera motor, these are I2C transfers to the motor
+ *
+ * @param isp ISP controller
+ * @param fd  Camera device
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the lens position cannot be read
+ */
+static esp_err_t init_cam_motor(esp_video_isp_t *isp, int fd)
+{
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+    esp_cam_motor_format_t motor_format;
+
+    if (isp->sensor.focus_info) {
+        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+        controls.count      = 1;
+        controls.controls   = control;
+        control[0].id       = V4L2_CID_FOCUS_ABSOLUTE;
+        control[0].value    = 0;
+        ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_G_EXT_CTRLS, &controls) == 0, ESP_ERR_NOT_SUPPORTED, TAG,
+                            "failed to get AF absolute position code");
+
+        isp->focus_info.cur_pos = control[0].value;
+        ESP_LOGD(TAG, "AF absolute position code: %"PRIi32, control[0].value);
+    }
+
+    if (ioctl(fd, VIDIOC_G_MOTOR_FMT, &motor_format) == 0) {
+        isp->focus_info.period_in_us = motor_format.step_period.period_in_us;
+        isp->focus_info.codes_per_step = motor_format.step_period.codes_per_step;
+    } else {
+        ESP_LOGE(TAG, "VIDIOC_G_MOTOR_FMT is not supported");
+    }
+
+    return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Time the first statistics and run the set-up deferred until then
+ *
+ * @param isp ISP controller
+ */
+static void isp_first_stats(esp_video_isp_t *isp)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint32_t first_stats_us = (uint32_t)(now_us - isp->task_start_us);
+    uint32_t deferred_us = 0;
+
+    isp->task_start_us = 0;
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROL_CAMERA_MOTOR
+    if (init_cam_motor(isp, isp->cam_fd) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to set up camera motor");
+    }
+#endif
+    if (isp->deferred.flags) {
+        config_isp_and_camera(isp, &isp->deferred);
+        isp->deferred.flags = 0;
+    }
+    deferred_us = (uint32_t)(esp_timer_get_time() - now_us);
+#endif
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    isp->init_times.first_stats_us = first_stats_us;
+    isp->init_times.deferred_us = deferred_us;
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+
+    ESP_LOGI(TAG, "first statistics after %"PRIu32" us, deferred set-up took %"PRIu32" us", first_stats_us, deferred_us);
+}
+
 static void isp_task(void *p)
 {
     esp_err_t ret;
@@ -944,19 +1849,77 @@ static void isp_task(void *p)
         get_sensor_state(isp, buf.index);
 
         isp_stats_to_ipa_stats(isp->isp_stats[buf.index], &isp->ipa_stats);
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS > 0
+        bool deliver = copy_frame_stats(isp, buf.index);
+#endif
         if (ioctl(isp->isp_fd, VIDIOC_QBUF, &buf) != 0) {
             ESP_LOGE(TAG, "failed to queue video frame");
         }
         print_stats_info(&isp->ipa_stats);
+        if (isp->task_start_us) {
+            isp_first_stats(isp);
+        }
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_STATS_SUBSCRIBERS > 0
+        /* Every frame is delivered, whether the image algorithms run on it or not */
+        if (deliver) {
+            deliver_frame_stats();
+        }
+#endif
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+        startup_check_stream(isp);
+#endif
+
+        portENTER_CRITICAL(&isp->run_stats_lock);
+        isp->run_stats.frames++;
+        portEXIT_CRITICAL(&isp->run_stats_lock);
+#if ISP_RUN_BUDGET_US > 0
+        if (isp_run_is_throttled(isp)) {
+            continue;
+        }
+#endif
+        int64_t start_us = esp_timer_get_time();
+
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+        /* Every algorithm runs on every frame until the stream converged */
+        if (isp->ipa_stats.flags && !isp->startup.active) {
+#else
+        if (isp->ipa_stats.flags) {
+#endif
+            ipa_sched_update(isp, &isp->ipa_stats);
+
+            /* Nothing is due, the ISP and sensor keep the settings of the last run */
+            if (!isp->ipa_stats.flags) {
+                continue;
+            }
+        }
+#endif
 
         isp->metadata.flags = 0;
+        ESP_VIDEO_TRACE_START(ESP_VIDEO_TRACE_ISP_IPA);
         ret = esp_ipa_pipeline_process(isp->ipa_pipeline, &isp->ipa_stats, &isp->sensor, &isp->metadata);
+        ESP_VIDEO_TRACE_STOP(ESP_VIDEO_TRACE_ISP_IPA);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "failed to process image algorithm");
             continue;
         }
 
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+        if (isp->startup.active) {
+            uint32_t prev_exposure_val = isp->prev_exposure_val;
+            int32_t prev_gain_index = isp->prev_gain_index;
+
+            startup_update_metadata(isp, &isp->metadata);
+            config_isp_and_camera(isp, &isp->metadata);
+            startup_end_frame(isp, prev_exposure_val, prev_gain_index);
+            isp_run_done(isp, start_us);
+            continue;
+        }
+#endif
+
         config_isp_and_camera(isp, &isp->metadata);
+        isp_run_done(isp, start_us);
     }
 
     vTaskDelete(NULL);
@@ -971,9 +1934,6 @@ static esp_err_t init_cam_dev(const esp_video_isp_config_t *config, esp_video_is
     struct v4l2_query_ext_ctrl qctrl;
     struct v4l2_ext_controls controls;
     struct v4l2_ext_control control[1];
-#if CONFIG_ESP_VIDEO_ISP_PIPELINE_CONTROL_CAMERA_MOTOR
-    esp_cam_motor_format_t motor_format;
-#endif
 
     fd = open(config->cam_dev, O_RDWR);
     ESP_RETURN_ON_FALSE(fd > 0, ESP_ERR_INVALID_ARG, TAG, "failed to open %s", config->cam_dev);
@@ -1137,37 +2097,25 @@ static esp_err_t init_cam_dev(const esp_video_isp_config_t *config, esp_video_is
     qctrl.id = V4L2_CID_FOCUS_ABSOLUTE;
     ret = ioctl(fd, VIDIOC_QUERY_EXT_CTRL, &qctrl);
     if (ret == 0) {
-        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
-        controls.count      = 1;
-        controls.controls   = control;
-        control[0].id       = V4L2_CID_FOCUS_ABSOLUTE;
-        control[0].value    = 0;
-        ret = ioctl(fd, VIDIOC_G_EXT_CTRLS, &controls);
-        ESP_GOTO_ON_FALSE(ret == 0, ESP_ERR_NOT_SUPPORTED, fail_0, TAG, "failed to get AF absolute position code");
-
         isp->sensor.focus_info = &isp->focus_info;
 
+        /* The lens is taken at its default position until init_cam_motor() read it */
         isp->focus_info.min_pos = qctrl.minimum;
         isp->focus_info.max_pos = qctrl.maximum;
         isp->focus_info.step_pos = qctrl.step;
-        isp->focus_info.cur_pos = control[0].value;
+        isp->focus_info.cur_pos = qctrl.default_value;
 
         ESP_LOGD(TAG, "AF absolute position code:");
         ESP_LOGD(TAG, "  min:     %"PRIi64, qctrl.minimum);
         ESP_LOGD(TAG, "  max:     %"PRIi64, qctrl.maximum);
         ESP_LOGD(TAG, "  step:    %"PRIu64, qctrl.step);
-        ESP_LOGD(TAG, "  current: %"PRIi32, control[0].value);
     } else {
         ESP_LOGD(TAG, "V4L2_CID_FOCUS_ABSOLUTE is not supported");
     }
 
-    ret = ioctl(fd, VIDIOC_G_MOTOR_FMT, &motor_format);
-    if (ret == 0) {
-        isp->focus_info.period_in_us = motor_format.step_period.period_in_us;
-        isp->focus_info.codes_per_step = motor_format.step_period.codes_per_step;
-    } else {
-        ESP_LOGE(TAG, "VIDIOC_G_MOTOR_FMT is not supported");
-    }
+#if !CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT
+    ESP_GOTO_ON_ERROR(init_cam_motor(isp, fd), fail_0, TAG, "failed to set up camera motor");
+#endif
 #elif CONFIG_ESP_IPA_AF_ALGORITHM
     isp->sensor.focus_info = &isp->focus_info;
 
@@ -1194,6 +2142,22 @@ fail_0:
     return ret;
 }
 
+/**
+ * @brief Get the time of a start-up step, step_us moves to the end of the step
+ *
+ * @param step_us Start of the step
+ *
+ * @return Step duration
+ */
+static uint32_t init_step_time(int64_t *step_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    uint32_t time_us = (uint32_t)(now_us - *step_us);
+
+    *step_us = now_us;
+    return time_us;
+}
+
 static esp_err_t init_isp_dev(const esp_video_isp_config_t *config, esp_video_isp_t *isp)
 {
     int fd;
@@ -1256,6 +2220,8 @@ esp_err_t esp_video_isp_pipeline_init(const esp_video_isp_config_t *config)
     esp_err_t ret;
     esp_video_isp_t *isp;
     esp_ipa_metadata_t metadata;
+    int64_t start_us = esp_timer_get_time();
+    int64_t step_us = start_us;
 
 #if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
     esp_log_level_set(TAG, ESP_LOG_DEBUG);
@@ -1269,17 +2235,46 @@ esp_err_t esp_video_isp_pipeline_init(const esp_video_isp_config_t *config)
 
     isp = calloc(1, sizeof(esp_video_isp_t));
     ESP_RETURN_ON_FALSE(isp, ESP_ERR_NO_MEM, TAG, "failed to malloc isp");
+    isp->run_stats_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
 
     ESP_GOTO_ON_ERROR(esp_ipa_pipeline_create(config->ipa_config, &isp->ipa_pipeline),
                       fail_0, TAG, "failed to create IPA pipeline");
+    isp->init_times.ipa_create_us = init_step_time(&step_us);
 
     ESP_GOTO_ON_ERROR(init_cam_dev(config, isp), fail_1, TAG, "failed to initialize camera device");
+    isp->init_times.cam_dev_us = init_step_time(&step_us);
     ESP_GOTO_ON_ERROR(init_isp_dev(config, isp), fail_2, TAG, "failed to initialize ISP device");
+    isp->init_times.isp_dev_us = init_step_time(&step_us);
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+    warm_start_load(isp);
+#endif
 
     metadata.flags = 0;
     ESP_GOTO_ON_ERROR(esp_ipa_pipeline_init(isp->ipa_pipeline, &isp->sensor, &metadata),
                       fail_3, TAG, "failed to initialize IPA pipeline");
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP_WARM_START
+    warm_start_update_metadata(isp, &metadata);
+#endif
+    isp->init_times.ipa_init_us = init_step_time(&step_us);
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_DEFER_INIT
+    /* The first frames do without these, they are applied when the statistics of the first one come */
+    isp->deferred = metadata;
+    isp->deferred.flags &= ISP_DEFERRED_FLAGS;
+    metadata.flags &= ~ISP_DEFERRED_FLAGS;
+#endif
     config_isp_and_camera(isp, &metadata);
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_IPA_SCHEDULE
+    ipa_sched_init(isp);
+#endif
+#if CONFIG_ESP_VIDEO_ISP_PIPELINE_FAST_STARTUP
+    if (startup_set_state(isp, ESP_VIDEO_CONVERGENCE_PENDING) == ESP_OK) {
+        isp->startup.supported = true;
+    } else {
+        ESP_LOGW(TAG, "%s does not support fast convergence", config->cam_dev);
+    }
+#endif
+    isp->init_times.config_us = init_step_time(&step_us);
+    isp->task_start_us = step_us;
 
     /**
      * If CONFIG_ISP_PIPELINE_CONTROLLER_TASK_STACK_USE_PSRAM is enabled, the ISP controller task stack
@@ -1293,18 +2288,31 @@ esp_err_t esp_video_isp_pipeline_init(const esp_video_isp_config_t *config)
     StackType_t *task_stack_ptr = heap_caps_malloc(ISP_TASK_STACK_SIZE * sizeof(StackType_t), MALLOC_CAP_SPIRAM);
     ESP_GOTO_ON_FALSE(task_stack_ptr, ESP_ERR_NO_MEM, fail_4, TAG, "failed to malloc task stack");
 
-    isp->task_handler = xTaskCreateStatic(isp_task, ISP_TASK_NAME, ISP_TASK_STACK_SIZE,
-                                          isp, ISP_TASK_PRIORITY, task_stack_ptr, task_ptr);
+    isp->task_handler = xTaskCreateStaticPinnedToCore(isp_task, ISP_TASK_NAME, ISP_TASK_STACK_SIZE,
+                                                      isp, ISP_TASK_PRIORITY, task_stack_ptr, task_ptr, ISP_TASK_CORE);
     ESP_GOTO_ON_FALSE(isp->task_handler != NULL, ESP_ERR_NO_MEM,
                       fail_5, TAG, "failed to create ISP static task");
 
     isp->task_ptr = task_ptr;
     isp->task_stack_ptr = task_stack_ptr;
 #else
-    ESP_GOTO_ON_FALSE(xTaskCreate(isp_task, ISP_TASK_NAME, ISP_TASK_STACK_SIZE, isp, ISP_TASK_PRIORITY, &isp->task_handler) == pdPASS,
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(isp_task, ISP_TASK_NAME, ISP_TASK_STACK_SIZE, isp, ISP_TASK_PRIORITY,
+                                              &isp->task_handler, ISP_TASK_CORE) == pdPASS,
                       ESP_ERR_NO_MEM, fail_3, TAG, "failed to create ISP task");
 #endif
 
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_ISP_PIPELINE, isp, sizeof(esp_video_isp_t));
+    VIDEO_MEM_ADD(ESP_VIDEO_MEM_OWNER_ISP_PIPELINE, pxTaskGetStackStart(isp->task_handler), ISP_TASK_STACK_SIZE);
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    isp->init_times.task_us = init_step_time(&step_us);
+    isp->init_times.init_us = (uint32_t)(step_us - start_us);
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+    ESP_LOGI(TAG, "started in %"PRIu32" us: IPA create %"PRIu32", camera %"PRIu32", ISP %"PRIu32", IPA init %"PRIu32
+             ", config %"PRIu32", task %"PRIu32, isp->init_times.init_us, isp->init_times.ipa_create_us,
+             isp->init_times.cam_dev_us, isp->init_times.isp_dev_us, isp->init_times.ipa_init_us,
+             isp->init_times.config_us, isp->init_times.task_us);
+
     s_esp_video_isp = isp;
     return ESP_OK;
 
@@ -1346,6 +2354,7 @@ esp_err_t esp_video_isp_pipeline_deinit(void)
     ESP_RETURN_ON_FALSE(ret == 0, ESP_FAIL, TAG, "failed to stop stream");
     vTaskDelay(ISP_METADATA_BUFFER_COUNT * 50 / portTICK_PERIOD_MS);
 
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_ISP_PIPELINE, pxTaskGetStackStart(isp->task_handler), ISP_TASK_STACK_SIZE);
     vTaskDelete(isp->task_handler);
     vTaskDelay(1);
 #if CONFIG_ISP_PIPELINE_CONTROLLER_TASK_STACK_USE_PSRAM
@@ -1356,6 +2365,7 @@ esp_err_t esp_video_isp_pipeline_deinit(void)
     ESP_RETURN_ON_FALSE(close(isp->isp_fd) == 0, ESP_FAIL, TAG, "failed to close ISP");
     ESP_RETURN_ON_FALSE(close(isp->cam_fd) == 0, ESP_FAIL, TAG, "failed to close camera sensor");
     ESP_RETURN_ON_ERROR(esp_ipa_pipeline_destroy(isp->ipa_pipeline), TAG, "failed to destroy pipeline");
+    VIDEO_MEM_REMOVE(ESP_VIDEO_MEM_OWNER_ISP_PIPELINE, isp, sizeof(esp_video_isp_t));
     free(isp);
     s_esp_video_isp = NULL;
 
@@ -1373,3 +2383,31 @@ bool esp_video_isp_pipeline_is_initialized(void)
 {
     return s_esp_video_isp != NULL;
 }
+
+esp_err_t esp_video_isp_pipeline_get_run_stats(esp_video_isp_run_stats_t *stats)
+{
+    esp_video_isp_t *isp = s_esp_video_isp;
+
+    ESP_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG, "stats is NULL");
+    ESP_RETURN_ON_FALSE(isp, ESP_ERR_INVALID_STATE, TAG, "ISP controller is not running");
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    *stats = isp->run_stats;
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_isp_pipeline_get_init_times(esp_video_isp_init_times_t *times)
+{
+    esp_video_isp_t *isp = s_esp_video_isp;
+
+    ESP_RETURN_ON_FALSE(times, ESP_ERR_INVALID_ARG, TAG, "times is NULL");
+    ESP_RETURN_ON_FALSE(isp, ESP_ERR_INVALID_STATE, TAG, "ISP controller is not running");
+
+    portENTER_CRITICAL(&isp->run_stats_lock);
+    *times = isp->init_times;
+    portEXIT_CRITICAL(&isp->run_stats_lock);
+
+    return ESP_OK;
+}
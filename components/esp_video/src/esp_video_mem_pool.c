@@ -0,0 +1,209 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <sys/lock.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_video_mem_pool.h"
+
+#define MEM_POOL_ARENA_SIZE         (CONFIG_ESP_VIDEO_MEM_POOL_SIZE_KB * 1024)
+#define MEM_POOL_ARENA_CAPS         (MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM)
+#define MEM_POOL_GRANULE            4096    /*!< Smallest size class and block alignment */
+#define MEM_POOL_CLASS_STEPS        8       /*!< Size classes per octave, a block wastes at most 1/8 of its size */
+#define MEM_POOL_MAX_BLOCKS         64
+
+/* Capabilities an arena block satisfies, it is 8-bit accessible PSRAM aligned to the granule */
+#define MEM_POOL_SUPPORTED_CAPS     (MEM_POOL_ARENA_CAPS | MALLOC_CAP_CACHE_ALIGNED)
+
+/**
+ * @brief Arena block, blocks keep their size for the whole life of the arena
+ */
+struct mem_pool_block {
+    uint8_t *ptr;
+    size_t size;
+    bool used;
+};
+
+struct mem_pool {
+    uint8_t *arena;
+    size_t carved_size;
+    size_t used_size;
+    size_t peak_used_size;
+    uint32_t block_count;
+    uint32_t used_block_count;
+    uint32_t heap_fallback_count;
+    struct mem_pool_block block[MEM_POOL_MAX_BLOCKS];
+};
+
+static const char *TAG = "video_mem_pool";
+
+static struct mem_pool s_pool;
+static _lock_t s_pool_lock;
+
+/**
+ * @brief Round a size up to its size class
+ *
+ * Classes are multiples of the granule up to 8 granules and then 8 steps
+ * per power of two, so similar frame sizes share blocks.
+ */
+static size_t mem_pool_class_size(size_t size)
+{
+    size_t units = (size + MEM_POOL_GRANULE - 1) / MEM_POOL_GRANULE;
+    size_t step = 1;
+
+    while (units > step * MEM_POOL_CLASS_STEPS * 2) {
+        step <<= 1;
+    }
+
+    return (units + step - 1) / step * step * MEM_POOL_GRANULE;
+}
+
+static bool mem_pool_is_arena(const void *ptr)
+{
+    return s_pool.arena && (const uint8_t *)ptr >= s_pool.arena && (const uint8_t *)ptr < s_pool.arena + MEM_POOL_ARENA_SIZE;
+}
+
+static struct mem_pool_block *mem_pool_take_block(size_t size)
+{
+    struct mem_pool_block *best = NULL;
+
+    /* Reuse the smallest free block that is at most one octave larger */
+    for (uint32_t i = 0; i < s_pool.block_count; i++) {
+        struct mem_pool_block *block = &s_pool.block[i];
+
+        if (!block->used && block->size >= size && block->size <= size * 2 && (!best || block->size < best->size)) {
+            best = block;
+        }
+    }
+
+    if (!best && s_pool.block_count < MEM_POOL_MAX_BLOCKS && s_pool.carved_size + size <= MEM_POOL_ARENA_SIZE) {
+        best = &s_pool.block[s_pool.block_count++];
+        best->ptr = s_pool.arena + s_pool.carved_size;
+        best->size = size;
+        s_pool.carved_size += size;
+    }
+
+    if (best) {
+        best->used = true;
+        s_pool.used_block_count++;
+        s_pool.used_size += best->size;
+        if (s_pool.used_size > s_pool.peak_used_size) {
+            s_pool.peak_used_size = s_pool.used_size;
+        }
+    }
+
+    return best;
+}
+
+void *esp_video_mem_pool_alloc(size_t align, size_t size, uint32_t caps)
+{
+    void *ptr = NULL;
+
+    if (!size) {
+        return NULL;
+    }
+
+    if ((caps & MALLOC_CAP_SPIRAM) && !(caps & ~MEM_POOL_SUPPORTED_CAPS) && align <= MEM_POOL_GRANULE) {
+        struct mem_pool_block *block = NULL;
+
+        _lock_acquire(&s_pool_lock);
+        if (!s_pool.arena) {
+            /* The arena is taken on first use, before PSRAM is split by other allocations */
+            s_pool.arena = heap_caps_aligned_alloc(MEM_POOL_GRANULE, MEM_POOL_ARENA_SIZE, MEM_POOL_ARENA_CAPS);
+            if (s_pool.arena) {
+                ESP_LOGI(TAG, "Arena of %d KB at %p", CONFIG_ESP_VIDEO_MEM_POOL_SIZE_KB, s_pool.arena);
+            } else {
+                ESP_LOGW(TAG, "Failed to allocate arena of %d KB", CONFIG_ESP_VIDEO_MEM_POOL_SIZE_KB);
+            }
+        }
+
+        if (s_pool.arena) {
+            block = mem_pool_take_block(mem_pool_class_size(size));
+        }
+        if (block) {
+            ptr = block->ptr;
+        } else {
+            s_pool.heap_fallback_count++;
+        }
+        _lock_release(&s_pool_lock);
+
+        if (ptr) {
+            return ptr;
+        }
+
+        ESP_LOGW(TAG, "%zu bytes do not fit the arena, falling back to heap", size);
+    }
+
+    return heap_caps_aligned_alloc(align, size, caps);
+}
+
+void esp_video_mem_pool_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    _lock_acquire(&s_pool_lock);
+    if (mem_pool_is_arena(ptr)) {
+        for (uint32_t i = 0; i < s_pool.block_count; i++) {
+            struct mem_pool_block *block = &s_pool.block[i];
+
+            if (block->ptr == ptr) {
+                assert(block->used);
+                block->used = false;
+                s_pool.used_block_count--;
+                s_pool.used_size -= block->size;
+                break;
+            }
+        }
+        _lock_release(&s_pool_lock);
+        return;
+    }
+    _lock_release(&s_pool_lock);
+
+    heap_caps_free(ptr);
+}
+
+esp_err_t esp_video_mem_pool_get_stats(esp_video_mem_pool_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG, "stats is NULL");
+
+    _lock_acquire(&s_pool_lock);
+    stats->arena_size = s_pool.arena ? MEM_POOL_ARENA_SIZE : 0;
+    stats->carved_size = s_pool.carved_size;
+    stats->used_size = s_pool.used_size;
+    stats->peak_used_size = s_pool.peak_used_size;
+    stats->block_count = s_pool.block_count;
+    stats->used_block_count = s_pool.used_block_count;
+    stats->heap_fallback_count = s_pool.heap_fallback_count;
+    _lock_release(&s_pool_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_video_mem_pool_release(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    _lock_acquire(&s_pool_lock);
+    if (s_pool.used_block_count) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (s_pool.arena) {
+        heap_caps_free(s_pool.arena);
+        /* The high-water mark stays, it describes the whole run */
+        s_pool.arena = NULL;
+        s_pool.carved_size = 0;
+        s_pool.block_count = 0;
+    }
+    _lock_release(&s_pool_lock);
+
+    return ret;
+}
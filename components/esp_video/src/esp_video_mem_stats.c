@@ -0,0 +1,190 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <string.h>
+#include <sys/lock.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "esp_video_mem_stats.h"
+
+static const char *const s_owner_name[ESP_VIDEO_MEM_OWNER_MAX] = {
+    [ESP_VIDEO_MEM_OWNER_CAPTURE]       = "capture",
+    [ESP_VIDEO_MEM_OWNER_M2M]           = "m2m",
+    [ESP_VIDEO_MEM_OWNER_META]          = "meta",
+    [ESP_VIDEO_MEM_OWNER_DEVICE]        = "device",
+    [ESP_VIDEO_MEM_OWNER_REPROCESSING]  = "reprocessing",
+    [ESP_VIDEO_MEM_OWNER_ISP_PIPELINE]  = "isp_pipeline",
+    [ESP_VIDEO_MEM_OWNER_APP]           = "app",
+};
+
+static esp_video_mem_usage_t s_usage[ESP_VIDEO_MEM_OWNER_MAX];
+static _lock_t s_usage_lock;
+
+/**
+ * @brief Get the memory usage of an owner
+ *
+ * @param owner Memory owner
+ * @param usage Returned memory usage
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the owner is invalid or usage is NULL
+ */
+esp_err_t esp_video_mem_stats_get(esp_video_mem_owner_t owner, esp_video_mem_usage_t *usage)
+{
+    if (owner >= ESP_VIDEO_MEM_OWNER_MAX || !usage) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _lock_acquire(&s_usage_lock);
+    *usage = s_usage[owner];
+    _lock_release(&s_usage_lock);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the high-water marks of all owners to the current usage
+ *
+ * @return
+ *      - ESP_OK on success
+ */
+esp_err_t esp_video_mem_stats_reset_peak(void)
+{
+    _lock_acquire(&s_usage_lock);
+    for (int i = 0; i < ESP_VIDEO_MEM_OWNER_MAX; i++) {
+        s_usage[i].internal_peak_size = s_usage[i].internal_size;
+        s_usage[i].psram_peak_size = s_usage[i].psram_size;
+    }
+    _lock_release(&s_usage_lock);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the name of an owner, e.g. for a report
+ *
+ * @param owner Memory owner
+ *
+ * @return Owner name, "unknown" if the owner is invalid
+ */
+const char *esp_video_mem_owner_name(esp_video_mem_owner_t owner)
+{
+    return owner < ESP_VIDEO_MEM_OWNER_MAX ? s_owner_name[owner] : "unknown";
+}
+
+/**
+ * @brief Account allocated memory to an owner
+ *
+ * @param owner Memory owner
+ * @param ptr   Allocated memory, NULL is ignored
+ * @param size  Allocated size in bytes
+ *
+ * @return None
+ */
+void esp_video_mem_stats_add(esp_video_mem_owner_t owner, const void *ptr, size_t size)
+{
+    esp_video_mem_usage_t *usage;
+
+    if (owner >= ESP_VIDEO_MEM_OWNER_MAX || !ptr) {
+        return;
+    }
+
+    usage = &s_usage[owner];
+    _lock_acquire(&s_usage_lock);
+    if (esp_ptr_external_ram(ptr)) {
+        usage->psram_size += size;
+        usage->psram_peak_size = MAX(usage->psram_peak_size, usage->psram_size);
+    } else {
+        usage->internal_size += size;
+        usage->internal_peak_size = MAX(usage->internal_peak_size, usage->internal_size);
+    }
+    usage->block_count++;
+    _lock_release(&s_usage_lock);
+}
+
+/**
+ * @brief Remove memory accounted by esp_video_mem_stats_add before it is freed
+ *
+ * @param owner Memory owner given to esp_video_mem_stats_add
+ * @param ptr   Allocated memory, NULL is ignored
+ * @param size  Size given to esp_video_mem_stats_add
+ *
+ * @return None
+ */
+void esp_video_mem_stats_remove(esp_video_mem_owner_t owner, const void *ptr, size_t size)
+{
+    esp_video_mem_usage_t *usage;
+
+    if (owner >= ESP_VIDEO_MEM_OWNER_MAX || !ptr) {
+        return;
+    }
+
+    usage = &s_usage[owner];
+    _lock_acquire(&s_usage_lock);
+    if (esp_ptr_external_ram(ptr)) {
+        usage->psram_size -= MIN(usage->psram_size, size);
+    } else {
+        usage->internal_size -= MIN(usage->internal_size, size);
+    }
+    if (usage->block_count) {
+        usage->block_count--;
+    }
+    _lock_release(&s_usage_lock);
+}
+
+/**
+ * @brief Count an allocation of an owner that failed
+ *
+ * @param owner Memory owner
+ * @param size  Requested size in bytes
+ *
+ * @return None
+ */
+void esp_video_mem_stats_fail(esp_video_mem_owner_t owner, size_t size)
+{
+    if (owner >= ESP_VIDEO_MEM_OWNER_MAX) {
+        return;
+    }
+
+    _lock_acquire(&s_usage_lock);
+    s_usage[owner].fail_count++;
+    s_usage[owner].fail_size = size;
+    _lock_release(&s_usage_lock);
+}
+
+/**
+ * @brief Check if buffers fit the free heap before they are requested
+ *
+ * @param size  Buffer size in bytes
+ * @param count Buffer count
+ * @param caps  Memory capabilities, refer to esp_heap_caps.h MALLOC_CAP_XXX
+ *
+ * @return
+ *      - ESP_OK if the buffers fit
+ *      - ESP_ERR_INVALID_ARG if size or count is 0
+ *      - ESP_ERR_NO_MEM if the buffers do not fit
+ */
+esp_err_t esp_video_mem_stats_check_fit(size_t size, uint32_t count, uint32_t caps)
+{
+    if (!size || !count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Cache alignment is a request to the allocator, not a capability of a heap */
+    caps &= ~MALLOC_CAP_CACHE_ALIGNED;
+
+    if (heap_caps_get_largest_free_block(caps) < size) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (heap_caps_get_free_size(caps) / count < size) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
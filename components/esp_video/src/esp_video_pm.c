@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <sys/lock.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_video_pm.h"
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+#include "esp_pm.h"
+#include "esp_video.h"
+
+#if CONFIG_ESP_VIDEO_STREAM_PM_POLICY_NO_SLEEP
+#define STREAM_PM_DEFAULT_POLICY    ESP_VIDEO_PM_POLICY_NO_SLEEP
+#elif CONFIG_ESP_VIDEO_STREAM_PM_POLICY_BALANCED
+#define STREAM_PM_DEFAULT_POLICY    ESP_VIDEO_PM_POLICY_BALANCED
+#else
+#define STREAM_PM_DEFAULT_POLICY    ESP_VIDEO_PM_POLICY_PERFORMANCE
+#endif
+
+#define STREAM_PM_LOCK_NUM          3
+
+static const char *TAG = "esp_video_pm";
+
+/* A policy holds as many locks of the table as its value, from the first one */
+static const esp_pm_lock_type_t s_lock_type[STREAM_PM_LOCK_NUM] = {
+    ESP_PM_NO_LIGHT_SLEEP,
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_CPU_FREQ_MAX,
+};
+
+static const char *const s_lock_name[STREAM_PM_LOCK_NUM] = {
+    "video_no_sleep",
+    "video_apb_max",
+    "video_cpu_max",
+};
+
+static esp_pm_lock_handle_t s_lock[STREAM_PM_LOCK_NUM];
+static esp_video_pm_policy_t s_policy = STREAM_PM_DEFAULT_POLICY;
+static esp_video_pm_policy_t s_held_policy = ESP_VIDEO_PM_POLICY_NONE;
+static uint32_t s_stream_count;
+static _lock_t s_pm_lock;
+
+static esp_err_t stream_pm_create_locks(esp_video_pm_policy_t policy)
+{
+    for (int i = 0; i < policy; i++) {
+        if (!s_lock[i]) {
+            esp_err_t ret = esp_pm_lock_create(s_lock_type[i], 0, s_lock_name[i], &s_lock[i]);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "failed to create %s lock", s_lock_name[i]);
+                return ret;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static void stream_pm_acquire(esp_video_pm_policy_t policy)
+{
+    if (stream_pm_create_locks(policy) != ESP_OK) {
+        return;
+    }
+
+    for (int i = 0; i < policy; i++) {
+        esp_pm_lock_acquire(s_lock[i]);
+    }
+    s_held_policy = policy;
+}
+
+static void stream_pm_release(void)
+{
+    for (int i = 0; i < s_held_policy; i++) {
+        esp_pm_lock_release(s_lock[i]);
+    }
+    s_held_policy = ESP_VIDEO_PM_POLICY_NONE;
+}
+
+/**
+ * @brief Count a started video stream, the first one acquires the locks of the policy.
+ *
+ * @return None
+ */
+void esp_video_pm_stream_start(void)
+{
+    _lock_acquire(&s_pm_lock);
+    if (!s_stream_count++) {
+        stream_pm_acquire(s_policy);
+    }
+    _lock_release(&s_pm_lock);
+}
+
+/**
+ * @brief Count a stopped video stream, the last one releases the locks.
+ *
+ * @return None
+ */
+void esp_video_pm_stream_stop(void)
+{
+    _lock_acquire(&s_pm_lock);
+    if (s_stream_count && !--s_stream_count) {
+        stream_pm_release();
+    }
+    _lock_release(&s_pm_lock);
+}
+#endif
+
+/**
+ * @brief Set the power management policy of video streaming
+ *
+ * @param policy Power management policy
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the policy is invalid
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM is disabled
+ *      - Others if a lock can not be created
+ */
+esp_err_t esp_video_pm_set_policy(esp_video_pm_policy_t policy)
+{
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+    esp_err_t ret;
+
+    if (policy > ESP_VIDEO_PM_POLICY_PERFORMANCE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    _lock_acquire(&s_pm_lock);
+    ret = stream_pm_create_locks(policy);
+    if (ret == ESP_OK) {
+        s_policy = policy;
+
+        /* Acquire before releasing, so the clocks do not dip between the policies */
+        if (s_stream_count) {
+            esp_video_pm_policy_t held_policy = s_held_policy;
+
+            for (int i = 0; i < policy; i++) {
+                esp_pm_lock_acquire(s_lock[i]);
+            }
+            for (int i = 0; i < held_policy; i++) {
+                esp_pm_lock_release(s_lock[i]);
+            }
+            s_held_policy = policy;
+        }
+    }
+    _lock_release(&s_pm_lock);
+
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Get the power management policy of video streaming
+ *
+ * @return Power management policy, ESP_VIDEO_PM_POLICY_NONE if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM is disabled
+ */
+esp_video_pm_policy_t esp_video_pm_get_policy(void)
+{
+#if CONFIG_ESP_VIDEO_ENABLE_STREAM_PM
+    return s_policy;
+#else
+    return ESP_VIDEO_PM_POLICY_NONE;
+#endif
+}
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/lock.h>
@@ -15,11 +16,33 @@
 #include <sys/param.h>
 #include "linux/videodev2.h"
 #include "esp_log.h"
+#include "esp_attr.h"
 #include "esp_vfs.h"
 #include "esp_vfs_dev.h"
 #include "esp_video_vfs.h"
 #include "esp_video_ioctl_internal.h"
 
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+#define ESP_VIDEO_VFS_SELECT_MAX    8   /*!< Maximum number of select calls waiting at the same time */
+
+/**
+ * @brief Select call waiting on video devices
+ */
+struct esp_video_vfs_select {
+    bool used;
+    int nfds;
+    esp_vfs_select_sem_t sem;
+    fd_set *readfds;                    /*!< Returned readable devices */
+    fd_set *writefds;                   /*!< Returned writable devices */
+    fd_set readfds_orig;                /*!< Devices to wait for readable */
+    fd_set writefds_orig;               /*!< Devices to wait for writable */
+};
+
+static struct esp_video_vfs_select s_select[ESP_VIDEO_VFS_SELECT_MAX];
+static uint32_t s_select_count;
+static portMUX_TYPE s_select_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
 static int esp_err_to_errno(esp_err_t err)
 {
     switch (err) {
@@ -63,6 +86,9 @@ static int esp_video_vfs_open(void *ctx, const char *path, int flags, int mode)
         return esp_err_to_errno(ret);
     }
 
+    /* The mode is shared by all file descriptors of the device, the last open or F_SETFL wins */
+    video->nonblock = (flags & O_NONBLOCK) ? 1 : 0;
+
     return video->id;
 }
 
@@ -80,14 +106,38 @@ static ssize_t esp_video_vfs_write(void *ctx, int fd, const void *data, size_t s
 
 static ssize_t esp_video_vfs_read(void *ctx, int fd, void *data, size_t size)
 {
+    esp_err_t ret;
+    struct esp_video_read_frame frame;
     struct esp_video *video = (struct esp_video *)ctx;
 
     assert(fd >= 0 && data && size);
     assert(video);
 
-    errno = EPERM;
+    ret = esp_video_read_frame(video, video->nonblock ? 0 : portMAX_DELAY, &frame);
+    if (ret == ESP_ERR_TIMEOUT) {
+        errno = EAGAIN;
+        return -1;
+    } else if (ret != ESP_OK) {
+        return esp_err_to_errno(ret);
+    }
 
-    return -1;
+    if (!frame.size) {
+        esp_video_read_release(video);
+        errno = EIO;
+        return -1;
+    }
+
+    /* Like V4L2 read(), the rest of a frame that does not fit is discarded */
+    size = MIN(size, frame.size);
+    memcpy(data, frame.data, size);
+
+    /* The copy is done, the buffer can receive again at once */
+    ret = esp_video_read_release(video);
+    if (ret != ESP_OK) {
+        return esp_err_to_errno(ret);
+    }
+
+    return size;
 }
 
 static int esp_video_vfs_fstat(void *ctx, int fd, struct stat *st)
@@ -125,7 +175,11 @@ static int esp_video_vfs_fcntl(void *ctx, int fd, int cmd, int arg)
 
     switch (cmd) {
     case F_GETFL:
-        ret = O_RDONLY;
+        ret = O_RDONLY | (video->nonblock ? O_NONBLOCK : 0);
+        break;
+    case F_SETFL:
+        video->nonblock = (arg & O_NONBLOCK) ? 1 : 0;
+        ret = 0;
         break;
     default:
         ret = -1;
@@ -155,10 +209,150 @@ static int esp_video_vfs_ioctl(void *ctx, int fd, int cmd, va_list args)
     assert(video);
 
     ret = esp_video_ioctl(video, cmd, args);
+    if (ret == ESP_ERR_TIMEOUT && (cmd == VIDIOC_DQBUF || cmd == VIDIOC_DQBUF_BATCH || cmd == VIDIOC_READ_FRAME) &&
+            video->nonblock) {
+        errno = EAGAIN;
+        return -1;
+    }
 
     return esp_err_to_errno(ret);
 }
 
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+/**
+ * @brief Report the ready devices of a select call, called with s_select_lock taken
+ *
+ * @return true if a device is ready
+ */
+static bool IRAM_ATTR esp_video_vfs_select_update(struct esp_video_vfs_select *sel, struct esp_video *video)
+{
+    bool ready = false;
+    uint32_t events = esp_video_get_poll_events(video);
+
+    if ((events & ESP_VIDEO_POLL_IN) && FD_ISSET(video->id, &sel->readfds_orig)) {
+        FD_SET(video->id, sel->readfds);
+        ready = true;
+    }
+    if ((events & ESP_VIDEO_POLL_OUT) && FD_ISSET(video->id, &sel->writefds_orig)) {
+        FD_SET(video->id, sel->writefds);
+        ready = true;
+    }
+
+    return ready;
+}
+
+static esp_err_t esp_video_vfs_start_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+                                            esp_vfs_select_sem_t sem, void **end_select_args)
+{
+    bool ready = false;
+    struct esp_video_vfs_select *sel = NULL;
+
+    portENTER_CRITICAL(&s_select_lock);
+    for (int i = 0; i < ESP_VIDEO_VFS_SELECT_MAX; i++) {
+        if (!s_select[i].used) {
+            sel = &s_select[i];
+            sel->nfds = nfds;
+            sel->sem = sem;
+            sel->readfds = readfds;
+            sel->writefds = writefds;
+            sel->readfds_orig = *readfds;
+            sel->writefds_orig = *writefds;
+            FD_ZERO(readfds);
+            FD_ZERO(writefds);
+            sel->used = true;
+            s_select_count++;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_select_lock);
+
+    if (!sel) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* No exceptional condition is reported */
+    FD_ZERO(exceptfds);
+
+    for (int fd = 0; fd < nfds; fd++) {
+        if (!FD_ISSET(fd, &sel->readfds_orig) && !FD_ISSET(fd, &sel->writefds_orig)) {
+            continue;
+        }
+
+        struct esp_video *video = esp_video_device_get_object_by_id(fd);
+        if (video) {
+            portENTER_CRITICAL(&s_select_lock);
+            ready |= esp_video_vfs_select_update(sel, video);
+            portEXIT_CRITICAL(&s_select_lock);
+        }
+    }
+
+    if (ready) {
+        esp_vfs_select_triggered(sem);
+    }
+
+    *end_select_args = sel;
+    return ESP_OK;
+}
+
+static esp_err_t esp_video_vfs_end_select(void *end_select_args)
+{
+    struct esp_video_vfs_select *sel = (struct esp_video_vfs_select *)end_select_args;
+
+    portENTER_CRITICAL(&s_select_lock);
+    sel->used = false;
+    s_select_count--;
+    portEXIT_CRITICAL(&s_select_lock);
+
+    return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Wake up the select calls waiting on a video device, safe in ISR.
+ *
+ * @param video Video object whose poll events may have changed
+ *
+ * @return None
+ */
+void IRAM_ATTR esp_video_vfs_notify(struct esp_video *video)
+{
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+    int count = 0;
+    esp_vfs_select_sem_t sems[ESP_VIDEO_VFS_SELECT_MAX];
+
+    /* Most frames are done while nobody selects, skip the lock then */
+    if (!__atomic_load_n(&s_select_count, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&s_select_lock);
+    for (int i = 0; i < ESP_VIDEO_VFS_SELECT_MAX; i++) {
+        struct esp_video_vfs_select *sel = &s_select[i];
+
+        if (sel->used && video->id < sel->nfds && esp_video_vfs_select_update(sel, video)) {
+            sems[count++] = sel->sem;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&s_select_lock);
+
+    /* The semaphores are given out of the critical section */
+    if (xPortInIsrContext()) {
+        BaseType_t woken = pdFALSE;
+
+        for (int i = 0; i < count; i++) {
+            esp_vfs_select_triggered_isr(sems[i], &woken);
+        }
+        if (woken == pdTRUE) {
+            portYIELD_FROM_ISR();
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            esp_vfs_select_triggered(sems[i]);
+        }
+    }
+#endif
+}
+
 static const esp_vfs_t s_esp_video_vfs = {
     .flags   = ESP_VFS_FLAG_CONTEXT_PTR,
     .open_p  = esp_video_vfs_open,
@@ -168,7 +362,11 @@ static const esp_vfs_t s_esp_video_vfs = {
     .fcntl_p = esp_video_vfs_fcntl,
     .fsync_p = esp_video_vfs_fsync,
     .fstat_p = esp_video_vfs_fstat,
-    .ioctl_p = esp_video_vfs_ioctl
+    .ioctl_p = esp_video_vfs_ioctl,
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+    .start_select = esp_video_vfs_start_select,
+    .end_select = esp_video_vfs_end_select,
+#endif
 };
 
 /**
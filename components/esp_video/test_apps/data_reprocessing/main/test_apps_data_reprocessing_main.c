@@ -0,0 +1,456 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "unity.h"
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK
+#include "esp_video_raw_unpack.h"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT
+#include "esp_video_color_convert.h"
+#endif
+
+#define BENCH_MIN_TIME_US           (50 * 1000)
+#define BENCH_MIN_RUNS              4
+#define BENCH_BUFFER_ALIGN          128     /* Largest cache line, L2 of the ESP32-P4 */
+#define BENCH_ROW_PIXELS            320     /* Row width of the kernels that work on whole rows */
+#define BENCH_BLACK_LEVEL           64
+
+#define BENCH_ALIGN_UP(x, a)        (((x) + (a) - 1) / (a) * (a))
+
+typedef esp_err_t (*bench_setup_t)(size_t size);
+typedef esp_err_t (*bench_run_t)(void *src, size_t size, void *dst, size_t dst_size);
+typedef void (*bench_teardown_t)(void);
+
+/**
+ * @brief One backend of a reprocessing kernel
+ */
+typedef struct bench_kernel {
+    const char *name;
+    const char *backend;
+    size_t align;                   /* Alignment of source and destination the backend needs */
+    size_t granule;                 /* The source size is a multiple of it */
+    uint8_t out_num;                /* Destination size is out_num / out_den of the source size */
+    uint8_t out_den;
+    bench_setup_t setup;            /* Called for each source size, NULL for none */
+    bench_run_t run;
+    bench_teardown_t teardown;
+    bench_run_t ref;                /* Output reference, NULL if the output is not checked */
+    bool in_place;                  /* The backend may run with the destination being the source */
+} bench_kernel_t;
+
+typedef struct bench_mem {
+    const char *name;
+    uint32_t caps;
+} bench_mem_t;
+
+static const bench_mem_t s_bench_mem[] = {
+    {"PSRAM", MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT},
+    {"SRAM", MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT},
+};
+
+static const size_t s_bench_size[] = {4 * 1024, 32 * 1024, 128 * 1024, 512 * 1024};
+
+/* Cache line aligned, PIE aligned and word aligned */
+static const size_t s_bench_offset[] = {0, 16, 4};
+
+/* Swap short */
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
+extern void esp_video_swap_short_riscv(void *src, size_t src_size, void *dst, size_t dst_size);
+extern void esp_video_swap_short_pie(void *src, size_t src_size, void *dst, size_t dst_size);
+
+static esp_err_t swap_short_c(void *src, size_t size, void *dst, size_t dst_size)
+{
+    const uint32_t *s = src;
+    uint32_t *d = dst;
+
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        d[i] = (s[i] << 16) | (s[i] >> 16);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t swap_short_riscv(void *src, size_t size, void *dst, size_t dst_size)
+{
+    esp_video_swap_short_riscv(src, size, dst, dst_size);
+    return ESP_OK;
+}
+
+static esp_err_t swap_short_pie(void *src, size_t size, void *dst, size_t dst_size)
+{
+    esp_video_swap_short_pie(src, size, dst, dst_size);
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT_BITSCRAMBLER
+/* The swap short object is private to esp_video, only its functions are used */
+typedef struct esp_video_swap_short esp_video_swap_short_t;
+
+extern esp_video_swap_short_t *esp_video_swap_short_create(size_t max_size);
+extern esp_err_t esp_video_swap_short_process(esp_video_swap_short_t *swap_short,  void *src, size_t src_size,
+                                              void *dst, size_t dst_size, size_t *ret_size);
+extern void esp_video_swap_short_free(esp_video_swap_short_t *swap_short);
+
+static esp_video_swap_short_t *s_swap_short;
+
+static esp_err_t swap_short_bs_setup(size_t size)
+{
+    s_swap_short = esp_video_swap_short_create(size);
+    return s_swap_short ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t swap_short_bs(void *src, size_t size, void *dst, size_t dst_size)
+{
+    size_t ret_size;
+
+    return esp_video_swap_short_process(s_swap_short, src, size, dst, size, &ret_size);
+}
+
+static void swap_short_bs_teardown(void)
+{
+    esp_video_swap_short_free(s_swap_short);
+    s_swap_short = NULL;
+}
+#endif
+#endif /* CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT */
+
+/* Swap byte */
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_BYTE
+extern void esp_video_swap_byte_riscv(void *src, void *dst, uint32_t size);
+
+static esp_err_t swap_byte_c(void *src, size_t size, void *dst, size_t dst_size)
+{
+    const uint16_t *s = src;
+    uint16_t *d = dst;
+
+    for (size_t i = 0; i < size / sizeof(uint16_t); i++) {
+        d[i] = (s[i] << 8) | (s[i] >> 8);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t swap_byte_riscv(void *src, size_t size, void *dst, size_t dst_size)
+{
+    esp_video_swap_byte_riscv(src, dst, size);
+    return ESP_OK;
+}
+#endif
+
+/* RAW10 unpack */
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BITSCRAMBLER
+#define RAW_UNPACK_BACKEND          "BitScrambler"
+#define RAW_UNPACK_ALIGN            BENCH_BUFFER_ALIGN
+#else
+#define RAW_UNPACK_BACKEND          "CPU"
+#define RAW_UNPACK_ALIGN            1
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK_BLACK_LEVEL_PIE
+#define RAW_UNPACK_BL_BACKEND       RAW_UNPACK_BACKEND "+PIE"
+#else
+#define RAW_UNPACK_BL_BACKEND       RAW_UNPACK_BACKEND
+#endif
+#define RAW10_ROW_SIZE              (BENCH_ROW_PIXELS * 5 / 4)
+
+static esp_video_raw_unpack_handle_t s_raw_unpack;
+
+static esp_err_t raw10_unpack_c(void *src, size_t size, void *dst, size_t dst_size)
+{
+    const uint8_t *s = src;
+    uint16_t *d = dst;
+
+    for (const uint8_t *end = s + size; s < end; s += 5, d += 4) {
+        for (int i = 0; i < 4; i++) {
+            d[i] = (s[i] << 2) | ((s[4] >> (i * 2)) & 0x03);
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw10_unpack_bl_c(void *src, size_t size, void *dst, size_t dst_size)
+{
+    uint16_t *d = dst;
+
+    raw10_unpack_c(src, size, dst, dst_size);
+    for (size_t i = 0; i < size / 5 * 4; i++) {
+        d[i] = d[i] > BENCH_BLACK_LEVEL ? d[i] - BENCH_BLACK_LEVEL : 0;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t raw10_unpack_setup(size_t size)
+{
+    return esp_video_raw_unpack_create(ESP_VIDEO_RAW_UNPACK_RAW10, size, &s_raw_unpack);
+}
+
+static esp_err_t raw10_unpack_bl_setup(size_t size)
+{
+    static const uint16_t black_level[4] = {BENCH_BLACK_LEVEL, BENCH_BLACK_LEVEL, BENCH_BLACK_LEVEL, BENCH_BLACK_LEVEL};
+
+    ESP_ERROR_CHECK(raw10_unpack_setup(size));
+    return esp_video_raw_unpack_set_black_level(s_raw_unpack, BENCH_ROW_PIXELS, black_level);
+}
+
+static esp_err_t raw10_unpack(void *src, size_t size, void *dst, size_t dst_size)
+{
+    size_t ret_size;
+
+    return esp_video_raw_unpack_process(s_raw_unpack, src, size, dst, dst_size, &ret_size);
+}
+
+static void raw10_unpack_teardown(void)
+{
+    esp_video_raw_unpack_delete(s_raw_unpack);
+    s_raw_unpack = NULL;
+}
+#endif /* CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK */
+
+/* Color conversion */
+
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT_PPA
+#define COLOR_CONVERT_BACKEND       "PPA"
+#define COLOR_CONVERT_ALIGN         BENCH_BUFFER_ALIGN
+#else
+#define COLOR_CONVERT_BACKEND       "CPU"
+#define COLOR_CONVERT_ALIGN         1
+#endif
+#define RGB888_ROW_PAIR_SIZE        (BENCH_ROW_PIXELS * 3 * 2)
+#define RAW8_ROW_PAIR_SIZE          (BENCH_ROW_PIXELS * 2)
+
+static esp_video_color_convert_handle_t s_color_convert;
+
+static esp_err_t color_convert_setup(esp_video_color_convert_type_t type, uint32_t height)
+{
+    esp_video_color_convert_config_t config = {
+        .type = type,
+        .width = BENCH_ROW_PIXELS,
+        .height = height,
+        .bayer = ESP_VIDEO_COLOR_CONVERT_BAYER_RGGB,
+    };
+
+    return esp_video_color_convert_create(&config, &s_color_convert);
+}
+
+static esp_err_t rgb888_to_rgb565_setup(size_t size)
+{
+    return color_convert_setup(ESP_VIDEO_COLOR_CONVERT_RGB888_TO_RGB565, size / (BENCH_ROW_PIXELS * 3));
+}
+
+static esp_err_t rgb888_to_yuv420_setup(size_t size)
+{
+    return color_convert_setup(ESP_VIDEO_COLOR_CONVERT_RGB888_TO_YUV420, size / (BENCH_ROW_PIXELS * 3));
+}
+
+static esp_err_t raw8_to_rgb888_setup(size_t size)
+{
+    return color_convert_setup(ESP_VIDEO_COLOR_CONVERT_RAW8_TO_RGB888, size / BENCH_ROW_PIXELS);
+}
+
+static esp_err_t color_convert(void *src, size_t size, void *dst, size_t dst_size)
+{
+    size_t ret_size;
+
+    return esp_video_color_convert_process(s_color_convert, src, size, dst, dst_size, &ret_size);
+}
+
+static void color_convert_teardown(void)
+{
+    esp_video_color_convert_delete(s_color_convert);
+    s_color_convert = NULL;
+}
+#endif /* CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT */
+
+static void bench_measure(const bench_kernel_t *kernel, const bench_mem_t *mem, size_t size, size_t offset,
+                          uint8_t *src, uint8_t *dst, size_t dst_size, uint8_t *ref)
+{
+    uint32_t runs = 0;
+    uint64_t cycles = 0;
+    int64_t time_us = 0;
+
+    memset(dst, 0, dst_size);
+    TEST_ESP_OK(kernel->run(src, size, dst, dst_size));
+    if (kernel->ref) {
+        TEST_ESP_OK(kernel->ref(src, size, ref, dst_size));
+        TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, dst, (size_t)size * kernel->out_num / kernel->out_den, kernel->backend);
+    }
+
+    while (runs < BENCH_MIN_RUNS || time_us < BENCH_MIN_TIME_US) {
+        uint32_t start_cycles = esp_cpu_get_cycle_count();
+        int64_t start_us = esp_timer_get_time();
+
+        TEST_ESP_OK(kernel->run(src, size, dst, dst_size));
+
+        cycles += esp_cpu_get_cycle_count() - start_cycles;
+        time_us += esp_timer_get_time() - start_us;
+        runs++;
+    }
+
+    printf("%-18s %-16s %-6s %7zu %3zu %9.2f %8.3f\n", kernel->name, kernel->backend, mem->name, size, offset,
+           (double)size * runs / time_us, (double)cycles / ((uint64_t)size * runs));
+}
+
+/* The drivers swap the captured frame in place, the result must be that of separate buffers */
+static void bench_check_in_place(const bench_kernel_t *kernel, size_t size, uint8_t *src, uint8_t *dst,
+                                 size_t dst_size, uint8_t *ref)
+{
+    memcpy(dst, src, size);
+    TEST_ESP_OK(kernel->run(dst, size, dst, dst_size));
+    TEST_ESP_OK(kernel->ref(src, size, ref, dst_size));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, dst, size, kernel->backend);
+}
+
+static void bench_kernel(const bench_kernel_t *kernel)
+{
+    for (size_t m = 0; m < sizeof(s_bench_mem) / sizeof(s_bench_mem[0]); m++) {
+        const bench_mem_t *mem = &s_bench_mem[m];
+
+        for (size_t s = 0; s < sizeof(s_bench_size) / sizeof(s_bench_size[0]); s++) {
+            size_t size = s_bench_size[s] / kernel->granule * kernel->granule;
+            /* The PPA and the BitScrambler write whole cache lines */
+            size_t dst_size = BENCH_ALIGN_UP(size * kernel->out_num / kernel->out_den, BENCH_BUFFER_ALIGN);
+            uint8_t *src = heap_caps_aligned_alloc(BENCH_BUFFER_ALIGN, size + BENCH_BUFFER_ALIGN, mem->caps);
+            uint8_t *dst = heap_caps_aligned_alloc(BENCH_BUFFER_ALIGN, dst_size + BENCH_BUFFER_ALIGN, mem->caps);
+            uint8_t *ref = kernel->ref ? heap_caps_malloc(dst_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : NULL;
+
+            if (!size || !src || !dst || (kernel->ref && !ref)) {
+                printf("%-18s %-16s %-6s %7zu skipped, not enough memory\n", kernel->name, kernel->backend,
+                       mem->name, size);
+            } else {
+                for (size_t i = 0; i < size + BENCH_BUFFER_ALIGN; i++) {
+                    src[i] = rand();
+                }
+
+                if (kernel->setup) {
+                    TEST_ESP_OK(kernel->setup(size));
+                }
+                for (size_t o = 0; o < sizeof(s_bench_offset) / sizeof(s_bench_offset[0]); o++) {
+                    size_t offset = s_bench_offset[o];
+
+                    if (offset % kernel->align) {
+                        continue;
+                    }
+                    bench_measure(kernel, mem, size, offset, src + offset, dst + offset, dst_size, ref);
+                }
+                if (kernel->in_place && kernel->ref) {
+                    bench_check_in_place(kernel, size, src, dst, dst_size, ref);
+                }
+                if (kernel->teardown) {
+                    kernel->teardown();
+                }
+            }
+
+            heap_caps_free(src);
+            heap_caps_free(dst);
+            heap_caps_free(ref);
+        }
+    }
+}
+
+static void bench_kernels(const bench_kernel_t *kernels, size_t count)
+{
+    printf("%-18s %-16s %-6s %7s %3s %9s %8s\n", "kernel", "backend", "memory", "bytes", "off", "MB/s", "cyc/B");
+    for (size_t i = 0; i < count; i++) {
+        bench_kernel(&kernels[i]);
+    }
+}
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT
+TEST_CASE("swap short benchmark", "[benchmark]")
+{
+    static const bench_kernel_t kernels[] = {
+        {"swap_short", "C", 4, 32, 1, 1, NULL, swap_short_c, NULL, NULL},
+        {"swap_short", "RISC-V", 4, 32, 1, 1, NULL, swap_short_riscv, NULL, swap_short_c, true},
+        {"swap_short", "PIE", 16, 32, 1, 1, NULL, swap_short_pie, NULL, swap_short_c, true},
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_SHORT_BITSCRAMBLER
+        {"swap_short", "BitScrambler", BENCH_BUFFER_ALIGN, BENCH_BUFFER_ALIGN, 1, 1,
+         swap_short_bs_setup, swap_short_bs, swap_short_bs_teardown, swap_short_c, true},
+#endif
+    };
+
+    bench_kernels(kernels, sizeof(kernels) / sizeof(kernels[0]));
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_SWAP_BYTE
+TEST_CASE("swap byte benchmark", "[benchmark]")
+{
+    /* The BitScrambler backend swaps inline on the LCD_CAM DMA, it can not run on its own */
+    static const bench_kernel_t kernels[] = {
+        {"swap_byte", "C", 2, 32, 1, 1, NULL, swap_byte_c, NULL, NULL},
+        {"swap_byte", "RISC-V", 4, 32, 1, 1, NULL, swap_byte_riscv, NULL, swap_byte_c, true},
+    };
+
+    bench_kernels(kernels, sizeof(kernels) / sizeof(kernels[0]));
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_UNPACK
+TEST_CASE("RAW10 unpack benchmark", "[benchmark]")
+{
+    static const bench_kernel_t kernels[] = {
+        {"raw10_unpack", "C", 1, 5, 8, 5, NULL, raw10_unpack_c, NULL, NULL},
+        {"raw10_unpack", RAW_UNPACK_BACKEND, RAW_UNPACK_ALIGN, 5, 8, 5,
+         raw10_unpack_setup, raw10_unpack, raw10_unpack_teardown, raw10_unpack_c},
+        {"raw10_unpack_bl", RAW_UNPACK_BL_BACKEND, RAW_UNPACK_ALIGN, RAW10_ROW_SIZE, 8, 5,
+         raw10_unpack_bl_setup, raw10_unpack, raw10_unpack_teardown, raw10_unpack_bl_c},
+    };
+
+    bench_kernels(kernels, sizeof(kernels) / sizeof(kernels[0]));
+}
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_COLOR_CONVERT
+TEST_CASE("color convert benchmark", "[benchmark]")
+{
+    static const bench_kernel_t kernels[] = {
+        {"rgb888_to_rgb565", COLOR_CONVERT_BACKEND, COLOR_CONVERT_ALIGN, RGB888_ROW_PAIR_SIZE, 2, 3,
+         rgb888_to_rgb565_setup, color_convert, color_convert_teardown, NULL},
+        {"rgb888_to_yuv420", COLOR_CONVERT_BACKEND, COLOR_CONVERT_ALIGN, RGB888_ROW_PAIR_SIZE, 1, 2,
+         rgb888_to_yuv420_setup, color_convert, color_convert_teardown, NULL},
+        {"raw8_to_rgb888", "CPU", 1, RAW8_ROW_PAIR_SIZE, 3, 4,
+         raw8_to_rgb888_setup, color_convert, color_convert_teardown, NULL},
+    };
+
+    bench_kernels(kernels, sizeof(kernels) / sizeof(kernels[0]));
+}
+#endif
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+    /* No leak check, the PPA and BitScrambler drivers keep their platform objects once used */
+}
+
+void app_main(void)
+{
+    printf("\r\nData reprocessing benchmark, CPU at %d MHz\r\n", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    printf("MB/s and cycles per byte are those of the source data, sizes that fit the cache run hot\r\n");
+
+    unity_run_menu();
+}
@@ -24,6 +24,9 @@
 #include "esp_log_buffer.h"
 
 #include "example_video_common.h"
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+#include "esp_video_device_internal.h"
+#endif
 
 #define TEST_MEMORY_LEAK_THRESHOLD (-512)
 
@@ -194,6 +197,107 @@ TEST_CASE("V4L2 Video Buffer Sequence", "[video]")
     TEST_ESP_OK(example_video_deinit());
 }
 
+#if CONFIG_ESP_VIDEO_ENABLE_VIRTUAL_VIDEO_DEVICE
+TEST_CASE("V4L2 virtual device", "[video]")
+{
+    int fd;
+    int ret;
+    int val;
+    struct v4l2_buffer buf;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+    uint16_t *buffer[VIDEO_BUFFER_NUM];
+    int64_t last_timestamp_us = 0;
+    uint32_t last_sequence = 0;
+    const esp_video_init_virtual_config_t config = {
+        .pixel_format = V4L2_PIX_FMT_RGB565,
+        .width = 64,
+        .height = 32,
+        .fps = 100,
+        .pattern = ESP_VIDEO_VIRTUAL_PATTERN_COLOR_BARS,
+        .task_affinity = -1,
+    };
+
+    setUp();
+
+    TEST_ESP_OK(esp_video_create_virtual_video_device(&config));
+
+    fd = open(ESP_VIDEO_VIRTUAL_DEVICE_NAME, O_RDWR);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(fd, VIDIOC_G_FMT, &format);
+    TEST_ESP_OK(ret);
+    TEST_ASSERT_EQUAL_UINT32(config.width, format.fmt.pix.width);
+    TEST_ASSERT_EQUAL_UINT32(config.height, format.fmt.pix.height);
+    TEST_ASSERT_EQUAL_UINT32(config.pixel_format, format.fmt.pix.pixelformat);
+
+    memset(&req, 0, sizeof(req));
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    req.count  = VIDEO_BUFFER_NUM;
+    ret = ioctl(fd, VIDIOC_REQBUFS, &req);
+    TEST_ESP_OK(ret);
+
+    for (int i = 0; i < VIDEO_BUFFER_NUM; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        ret = ioctl(fd, VIDIOC_QUERYBUF, &buf);
+        TEST_ESP_OK(ret);
+
+        buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        TEST_ASSERT_NOT_NULL(buffer[i]);
+
+        ret = ioctl(fd, VIDIOC_QBUF, &buf);
+        TEST_ESP_OK(ret);
+    }
+
+    val = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(fd, VIDIOC_STREAMON, &val);
+    TEST_ESP_OK(ret);
+
+    for (int i = 0; i < 20; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        ret = ioctl(fd, VIDIOC_DQBUF, &buf);
+        TEST_ESP_OK(ret);
+
+        TEST_ASSERT_EQUAL_UINT32(config.width * config.height * 2, buf.bytesused);
+
+        /* The left bar is 75% white, or white under the moving bar, the right bar is black */
+        uint16_t *line = buffer[buf.index];
+        TEST_ASSERT_TRUE(line[0] == 0xbdf7 || line[0] == 0xffff);
+        TEST_ASSERT_EQUAL_HEX16(0x0000, line[config.width - 1]);
+
+        /* Frames are timestamped with their period, one period apart */
+        int64_t timestamp_us = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+        if (i) {
+            uint32_t periods = buf.sequence - last_sequence;
+
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, periods);
+            TEST_ASSERT_INT32_WITHIN(2000, periods * 1000000 / config.fps, (int32_t)(timestamp_us - last_timestamp_us));
+        }
+        last_timestamp_us = timestamp_us;
+        last_sequence = buf.sequence;
+
+        ret = ioctl(fd, VIDIOC_QBUF, &buf);
+        TEST_ESP_OK(ret);
+    }
+
+    val = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(fd, VIDIOC_STREAMOFF, &val);
+    TEST_ESP_OK(ret);
+
+    close(fd);
+
+    TEST_ESP_OK(esp_video_destroy_virtual_video_device());
+}
+#endif
+
 #if CONFIG_ESP_VIDEO_ENABLE_JPEG_VIDEO_DEVICE
 TEST_CASE("V4L2 M2M device", "[video]")
 {
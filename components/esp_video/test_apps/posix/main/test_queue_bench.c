@@ -0,0 +1,734 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "unity.h"
+
+#include "esp_video.h"
+#include "esp_video_handle.h"
+
+/**
+ * Queue benchmark, run with "[bench]".
+ *
+ * Two synthetic devices take the place of the hardware so that only the
+ * buffer queues, the locking and the VFS layer are measured:
+ *
+ * - BENCH_CAP, a capture device whose esp_timer "interrupt" finishes one
+ *   queued buffer per period, as a camera controller would
+ * - BENCH_M2M, an M2M device that copies the output buffer to the capture
+ *   buffer
+ *
+ * The latency of a captured frame runs from its done time to the dequeue,
+ * that of an M2M frame from queuing the output buffer to dequeuing the
+ * result. "allocs" are the heap blocks allocated while streaming, any
+ * non-zero value is an allocation in the frame path.
+ *
+ * The cache thrash case counts the CPU cycles of one QBUF and one DQBUF of a
+ * frame that is already done, with and without copying a PSRAM block through
+ * the cache before each DQBUF, as a frame copy would. Build it with and without
+ * CONFIG_ESP_VIDEO_FRAME_PATH_IN_IRAM to compare the cost of the cache misses
+ * of the frame path in flash, on targets whose cache holds both code and data.
+ */
+
+#define BENCH_CAP_NAME              "BENCH_CAP"
+#define BENCH_CAP_DEVICE_ID         30
+#define BENCH_CAP_DEV_PATH          "/dev/video30"
+#define BENCH_M2M_NAME              "BENCH_M2M"
+#define BENCH_M2M_DEVICE_ID         31
+#define BENCH_M2M_DEV_PATH          "/dev/video31"
+
+#define BENCH_TIME_US               (1000 * 1000)
+#define BENCH_BUFFER_NUM            4
+#define BENCH_BUFFER_ALIGN          64
+#define BENCH_MEM_CAPS              MALLOC_CAP_8BIT
+#define BENCH_LINE_SIZE             256
+#define BENCH_SAMPLE_NUM            4096
+#define BENCH_CONSUMER_NUM_MAX      4
+#define BENCH_CONSUMER_STACK_SIZE   4096
+#define BENCH_DQBUF_TICKS           pdMS_TO_TICKS(100)
+#define BENCH_THRASH_SIZE           (1024 * 1024)
+#define BENCH_THRASH_FRAME_SIZE     (16 * 1024)
+#define BENCH_THRASH_RATE           1000
+
+#if CONFIG_ESP_VIDEO_FRAME_PATH_IN_IRAM
+#define BENCH_FRAME_PATH_MEM        "IRAM"
+#else
+#define BENCH_FRAME_PATH_MEM        "flash"
+#endif
+
+static const size_t s_bench_size[] = {1024, 16 * 1024, 128 * 1024};
+
+/* Frames per second the capture device produces */
+static const uint32_t s_bench_rate[] = {100, 1000, 5000};
+
+/* Tasks dequeuing the capture stream at once */
+static const uint8_t s_bench_consumer_num[] = {2, BENCH_CONSUMER_NUM_MAX};
+
+typedef enum bench_api {
+    BENCH_API_VFS,                  /* VIDIOC_DQBUF and VIDIOC_QBUF */
+    BENCH_API_HANDLE,               /* esp_video_handle_dqbuf and esp_video_handle_qbuf */
+} bench_api_t;
+
+typedef struct bench_capture {
+    esp_timer_handle_t timer;
+    SemaphoreHandle_t lock;         /* Keeps the stream from stopping while the timer finishes a buffer */
+    uint32_t period_us;
+    uint32_t missed;                /* Periods without a queued buffer */
+} bench_capture_t;
+
+typedef struct bench_result {
+    uint32_t frames;
+    uint32_t missed;
+    uint32_t errors;                /* Failed QBUF in a consumer task */
+    int64_t time_us;
+    int allocs;
+    uint32_t sample_num;
+    uint32_t sample[BENCH_SAMPLE_NUM];
+} bench_result_t;
+
+typedef struct bench_consumer {
+    int fd;
+    esp_video_handle_t handle;
+    bench_api_t api;
+    int64_t end_us;
+    bench_result_t *result;
+    SemaphoreHandle_t done;
+    TaskHandle_t task;
+} bench_consumer_t;
+
+typedef struct bench_cycles {
+    uint32_t sample_num;
+    uint32_t dqbuf[BENCH_SAMPLE_NUM];
+    uint32_t qbuf[BENCH_SAMPLE_NUM];
+} bench_cycles_t;
+
+static bench_result_t *s_result;
+
+/* Synthetic capture device */
+
+static void bench_capture_timer(void *arg)
+{
+    struct esp_video *video = (struct esp_video *)arg;
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+    struct esp_video_buffer_element *element;
+
+    xSemaphoreTake(capture->lock, portMAX_DELAY);
+
+    element = CAPTURE_VIDEO_GET_QUEUED_ELEMENT(video);
+    if (element) {
+        CAPTURE_VIDEO_DONE_BUF(video, element->buffer, ELEMENT_SIZE(element));
+    } else {
+        capture->missed++;
+    }
+
+    xSemaphoreGive(capture->lock);
+}
+
+static esp_err_t bench_capture_start(struct esp_video *video, uint32_t type)
+{
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+
+    capture->missed = 0;
+
+    return esp_timer_start_periodic(capture->timer, capture->period_us);
+}
+
+static esp_err_t bench_capture_stop(struct esp_video *video, uint32_t type)
+{
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+
+    xSemaphoreTake(capture->lock, portMAX_DELAY);
+    esp_timer_stop(capture->timer);
+    xSemaphoreGive(capture->lock);
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_enum_format(struct esp_video *video, uint32_t type, uint32_t index, uint32_t *pixel_format)
+{
+    if (index > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *pixel_format = V4L2_PIX_FMT_GREY;
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_capture_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+
+    if (format->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || pix->pixelformat != V4L2_PIX_FMT_GREY ||
+            !pix->width || !pix->height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    CAPTURE_VIDEO_SET_BUF_INFO(video, pix->width * pix->height, BENCH_BUFFER_ALIGN, BENCH_MEM_CAPS);
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    return ESP_OK;
+}
+
+static const struct esp_video_ops s_bench_capture_ops = {
+    .start          = bench_capture_start,
+    .stop           = bench_capture_stop,
+    .enum_format    = bench_enum_format,
+    .set_format     = bench_capture_set_format,
+    .notify         = bench_notify,
+};
+
+/* Synthetic M2M device */
+
+static esp_err_t bench_m2m_copy(struct esp_video *video, uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size, uint32_t *dst_out_size)
+{
+    *dst_out_size = MIN(src_size, dst_size);
+    memcpy(dst, src, *dst_out_size);
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_m2m_set_format(struct esp_video *video, const struct v4l2_format *format)
+{
+    const struct v4l2_pix_format *pix = &format->fmt.pix;
+    uint32_t size = pix->width * pix->height;
+
+    if (pix->pixelformat != V4L2_PIX_FMT_GREY || !size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        M2M_VIDEO_SET_CAPTURE_BUF_INFO(video, size, BENCH_BUFFER_ALIGN, BENCH_MEM_CAPS);
+    } else if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+        M2M_VIDEO_SET_OUTPUT_BUF_INFO(video, size, BENCH_BUFFER_ALIGN, BENCH_MEM_CAPS);
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_m2m_notify(struct esp_video *video, enum esp_video_event event, void *arg)
+{
+    if (event == ESP_VIDEO_M2M_TRIGGER && *(uint32_t *)arg == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        return esp_video_m2m_process(video, V4L2_BUF_TYPE_VIDEO_OUTPUT, V4L2_BUF_TYPE_VIDEO_CAPTURE, bench_m2m_copy);
+    }
+
+    return ESP_OK;
+}
+
+static const struct esp_video_ops s_bench_m2m_ops = {
+    .enum_format    = bench_enum_format,
+    .set_format     = bench_m2m_set_format,
+    .notify         = bench_m2m_notify,
+};
+
+static struct esp_video *bench_create_capture(void)
+{
+    struct esp_video *video;
+    bench_capture_t *capture;
+    uint32_t device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+
+    capture = heap_caps_calloc(1, sizeof(bench_capture_t), MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    TEST_ASSERT_NOT_NULL(capture);
+    capture->lock = xSemaphoreCreateMutex();
+    TEST_ASSERT_NOT_NULL(capture->lock);
+
+    video = esp_video_create(BENCH_CAP_NAME, BENCH_CAP_DEVICE_ID, &s_bench_capture_ops, capture,
+                             device_caps | V4L2_CAP_DEVICE_CAPS, device_caps);
+    TEST_ASSERT_NOT_NULL(video);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = bench_capture_timer,
+        .arg = video,
+        .name = "bench_cap",
+    };
+    TEST_ESP_OK(esp_timer_create(&timer_args, &capture->timer));
+
+    return video;
+}
+
+static void bench_destroy_capture(struct esp_video *video)
+{
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+
+    TEST_ESP_OK(esp_video_destroy(video));
+    TEST_ESP_OK(esp_timer_delete(capture->timer));
+    vSemaphoreDelete(capture->lock);
+    heap_caps_free(capture);
+}
+
+/* Measurement */
+
+static int bench_allocated_blocks(void)
+{
+    multi_heap_info_t info;
+
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+
+    return info.allocated_blocks;
+}
+
+static void bench_add_sample(bench_result_t *result, uint32_t latency_us)
+{
+    uint32_t n = __atomic_fetch_add(&result->sample_num, 1, __ATOMIC_RELAXED);
+
+    if (n < BENCH_SAMPLE_NUM) {
+        result->sample[n] = latency_us;
+    }
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench_print_header(void)
+{
+    printf("%-8s %-6s %7s %6s %3s %9s %6s %6s %6s %6s %6s %6s\n",
+           "path", "api", "bytes", "rate", "con", "ops/s", "p50us", "p90us", "p99us", "maxus", "missed", "allocs");
+}
+
+static void bench_print_result(const char *path, bench_api_t api, size_t size, uint32_t rate, int consumers, bench_result_t *result)
+{
+    uint32_t n = MIN(result->sample_num, BENCH_SAMPLE_NUM);
+    char rate_str[8] = "-";
+
+    TEST_ASSERT_GREATER_THAN_UINT32(0, n);
+    qsort(result->sample, n, sizeof(uint32_t), bench_cmp_u32);
+
+    if (rate) {
+        snprintf(rate_str, sizeof(rate_str), "%" PRIu32, rate);
+    }
+
+    printf("%-8s %-6s %7zu %6s %3d %9.1f %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6d\n",
+           path, api == BENCH_API_VFS ? "vfs" : "handle", size, rate_str, consumers,
+           (double)result->frames * 1000000 / result->time_us,
+           result->sample[n * 50 / 100], result->sample[n * 90 / 100], result->sample[n * 99 / 100], result->sample[n - 1],
+           result->missed, result->allocs);
+}
+
+static esp_err_t bench_dqbuf(bench_consumer_t *consumer, uint32_t type, esp_video_frame_t *frame)
+{
+    if (consumer->api == BENCH_API_HANDLE) {
+        return esp_video_handle_dqbuf(consumer->handle, type, BENCH_DQBUF_TICKS, frame);
+    }
+
+    struct v4l2_buffer buf = {
+        .type = type,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+
+    if (ioctl(consumer->fd, VIDIOC_DQBUF, &buf) != 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    frame->index = buf.index;
+    frame->bytesused = buf.bytesused;
+    frame->flags = 0;
+    frame->timestamp_us = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+
+    return ESP_OK;
+}
+
+static esp_err_t bench_qbuf(bench_consumer_t *consumer, uint32_t type, esp_video_frame_t *frame)
+{
+    if (consumer->api == BENCH_API_HANDLE) {
+        return esp_video_handle_qbuf(consumer->handle, type, frame);
+    }
+
+    struct v4l2_buffer buf = {
+        .type = type,
+        .memory = V4L2_MEMORY_MMAP,
+        .index = frame->index,
+        .bytesused = frame->bytesused,
+    };
+
+    return ioctl(consumer->fd, VIDIOC_QBUF, &buf) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static void bench_consumer_task(void *arg)
+{
+    bench_consumer_t *consumer = (bench_consumer_t *)arg;
+    esp_video_frame_t frame;
+
+    /* Wait for the stream to start and end_us to be set */
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (esp_timer_get_time() < consumer->end_us) {
+        if (bench_dqbuf(consumer, V4L2_BUF_TYPE_VIDEO_CAPTURE, &frame) != ESP_OK) {
+            continue;
+        }
+
+        bench_add_sample(consumer->result, (uint32_t)(esp_timer_get_time() - frame.timestamp_us));
+        __atomic_fetch_add(&consumer->result->frames, 1, __ATOMIC_RELAXED);
+
+        if (bench_qbuf(consumer, V4L2_BUF_TYPE_VIDEO_CAPTURE, &frame) != ESP_OK) {
+            __atomic_fetch_add(&consumer->result->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Deleted by the test task, the heap is counted before the task is freed */
+    xSemaphoreGive(consumer->done);
+    vTaskSuspend(NULL);
+}
+
+static int bench_open(const char *path, uint32_t type, size_t size)
+{
+    int fd = open(path, O_RDWR);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+
+    struct v4l2_format format = {
+        .type = type,
+        .fmt.pix.width = BENCH_LINE_SIZE,
+        .fmt.pix.height = size / BENCH_LINE_SIZE,
+        .fmt.pix.pixelformat = V4L2_PIX_FMT_GREY,
+    };
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_S_FMT, &format));
+
+    return fd;
+}
+
+static bool bench_request_buffers(int fd, uint32_t type)
+{
+    struct v4l2_requestbuffers req = {
+        .count = BENCH_BUFFER_NUM,
+        .type = type,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+
+    return ioctl(fd, VIDIOC_REQBUFS, &req) == 0;
+}
+
+/**
+ * Run the capture stream of BENCH_CAP for BENCH_TIME_US with "consumers"
+ * tasks dequeuing and queuing buffers, the device finishes a buffer every
+ * 1/rate second.
+ */
+static void bench_capture_run(struct esp_video *video, bench_api_t api, size_t size, uint32_t rate, int consumers)
+{
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bench_consumer_t consumer[BENCH_CONSUMER_NUM_MAX];
+    esp_video_handle_t handle;
+    int fd;
+
+    fd = bench_open(BENCH_CAP_DEV_PATH, type, size);
+    if (!bench_request_buffers(fd, type)) {
+        printf("%-8s %7zu skipped, not enough memory\n", "capture", size);
+        close(fd);
+        return;
+    }
+
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_G_VIDEO_HANDLE, &handle));
+    for (int i = 0; i < BENCH_BUFFER_NUM; i++) {
+        esp_video_frame_t frame = {
+            .index = i,
+        };
+        TEST_ESP_OK(esp_video_handle_qbuf(handle, type, &frame));
+    }
+
+    memset(s_result, 0, sizeof(bench_result_t));
+    capture->period_us = 1000000 / rate;
+
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(consumers, 0);
+    TEST_ASSERT_NOT_NULL(done);
+
+    for (int i = 0; i < consumers; i++) {
+        consumer[i] = (bench_consumer_t) {
+            .fd = fd,
+            .handle = handle,
+            .api = api,
+            .result = s_result,
+            .done = done,
+        };
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(bench_consumer_task, "bench_con", BENCH_CONSUMER_STACK_SIZE,
+                                              &consumer[i], uxTaskPriorityGet(NULL) + 1, &consumer[i].task));
+    }
+
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_STREAMON, &type));
+
+    int blocks = bench_allocated_blocks();
+    int64_t start_us = esp_timer_get_time();
+
+    for (int i = 0; i < consumers; i++) {
+        consumer[i].end_us = start_us + BENCH_TIME_US;
+        xTaskNotifyGive(consumer[i].task);
+    }
+    for (int i = 0; i < consumers; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+
+    s_result->time_us = esp_timer_get_time() - start_us;
+    s_result->missed = capture->missed;
+    s_result->allocs = bench_allocated_blocks() - blocks;
+
+    for (int i = 0; i < consumers; i++) {
+        vTaskDelete(consumer[i].task);
+    }
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_STREAMOFF, &type));
+    vSemaphoreDelete(done);
+    close(fd);
+
+    TEST_ASSERT_EQUAL_UINT32(0, s_result->errors);
+    bench_print_result("capture", api, size, rate, consumers, s_result);
+}
+
+/**
+ * Feed BENCH_M2M as fast as one task can, one frame in flight.
+ */
+static void bench_m2m_run(bench_api_t api, size_t size)
+{
+    uint32_t capture_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    uint32_t output_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    bench_consumer_t consumer = {
+        .api = api,
+    };
+
+    consumer.fd = bench_open(BENCH_M2M_DEV_PATH, output_type, size);
+    struct v4l2_format format = {
+        .type = capture_type,
+        .fmt.pix.width = BENCH_LINE_SIZE,
+        .fmt.pix.height = size / BENCH_LINE_SIZE,
+        .fmt.pix.pixelformat = V4L2_PIX_FMT_GREY,
+    };
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_S_FMT, &format));
+    if (!bench_request_buffers(consumer.fd, output_type) || !bench_request_buffers(consumer.fd, capture_type)) {
+        printf("%-8s %7zu skipped, not enough memory\n", "m2m", size);
+        close(consumer.fd);
+        return;
+    }
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_G_VIDEO_HANDLE, &consumer.handle));
+
+    memset(s_result, 0, sizeof(bench_result_t));
+
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_STREAMON, &output_type));
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_STREAMON, &capture_type));
+
+    int blocks = bench_allocated_blocks();
+    int64_t start_us = esp_timer_get_time();
+    uint32_t index = 0;
+
+    while (esp_timer_get_time() - start_us < BENCH_TIME_US) {
+        esp_video_frame_t frame = {
+            .index = index,
+            .bytesused = size,
+        };
+        int64_t queue_us = esp_timer_get_time();
+
+        TEST_ESP_OK(bench_qbuf(&consumer, capture_type, &frame));
+        TEST_ESP_OK(bench_qbuf(&consumer, output_type, &frame));
+        TEST_ESP_OK(bench_dqbuf(&consumer, capture_type, &frame));
+        bench_add_sample(s_result, (uint32_t)(esp_timer_get_time() - queue_us));
+        TEST_ESP_OK(bench_dqbuf(&consumer, output_type, &frame));
+
+        s_result->frames++;
+        index = (index + 1) % BENCH_BUFFER_NUM;
+    }
+
+    s_result->time_us = esp_timer_get_time() - start_us;
+    s_result->allocs = bench_allocated_blocks() - blocks;
+
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_STREAMOFF, &capture_type));
+    TEST_ASSERT_EQUAL(0, ioctl(consumer.fd, VIDIOC_STREAMOFF, &output_type));
+    close(consumer.fd);
+
+    bench_print_result("m2m", api, size, 0, 1, s_result);
+}
+
+/**
+ * Count the cycles of DQBUF and QBUF of BENCH_CAP frames that are already
+ * done, copying "thrash" through the cache before every DQBUF if it is set.
+ */
+static void bench_thrash_run(bench_api_t api, uint8_t *thrash, bench_cycles_t *cycles)
+{
+    uint32_t type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    esp_video_handle_t handle;
+    int64_t start_us;
+    int fd;
+
+    fd = bench_open(BENCH_CAP_DEV_PATH, type, BENCH_THRASH_FRAME_SIZE);
+    TEST_ASSERT_TRUE(bench_request_buffers(fd, type));
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_G_VIDEO_HANDLE, &handle));
+    for (int i = 0; i < BENCH_BUFFER_NUM; i++) {
+        esp_video_frame_t frame = {
+            .index = i,
+        };
+        TEST_ESP_OK(esp_video_handle_qbuf(handle, type, &frame));
+    }
+
+    /* A DQBUF without a done frame returns at once instead of waiting */
+    TEST_ASSERT_EQUAL(0, fcntl(fd, F_SETFL, O_NONBLOCK));
+    memset(cycles, 0, sizeof(bench_cycles_t));
+
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_STREAMON, &type));
+
+    start_us = esp_timer_get_time();
+    while (esp_timer_get_time() - start_us < BENCH_TIME_US && cycles->sample_num < BENCH_SAMPLE_NUM) {
+        struct v4l2_buffer buf = {
+            .type = type,
+            .memory = V4L2_MEMORY_MMAP,
+        };
+        esp_video_frame_t frame;
+        uint32_t start;
+        esp_err_t ret;
+
+        if (thrash) {
+            memcpy(thrash + BENCH_THRASH_SIZE / 2, thrash, BENCH_THRASH_SIZE / 2);
+        }
+
+        start = esp_cpu_get_cycle_count();
+        if (api == BENCH_API_HANDLE) {
+            ret = esp_video_handle_dqbuf(handle, type, 0, &frame);
+        } else {
+            ret = ioctl(fd, VIDIOC_DQBUF, &buf) == 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+            frame.index = buf.index;
+        }
+        if (ret != ESP_OK) {
+            /* Let the capture timer finish a buffer */
+            vTaskDelay(1);
+            continue;
+        }
+        cycles->dqbuf[cycles->sample_num] = esp_cpu_get_cycle_count() - start;
+
+        start = esp_cpu_get_cycle_count();
+        if (api == BENCH_API_HANDLE) {
+            frame.bytesused = 0;
+            frame.flags = 0;
+            ret = esp_video_handle_qbuf(handle, type, &frame);
+        } else {
+            buf.bytesused = 0;
+            buf.flags = 0;
+            ret = ioctl(fd, VIDIOC_QBUF, &buf) == 0 ? ESP_OK : ESP_FAIL;
+        }
+        cycles->qbuf[cycles->sample_num] = esp_cpu_get_cycle_count() - start;
+        TEST_ESP_OK(ret);
+
+        cycles->sample_num++;
+    }
+
+    TEST_ASSERT_EQUAL(0, ioctl(fd, VIDIOC_STREAMOFF, &type));
+    close(fd);
+
+    uint32_t n = cycles->sample_num;
+
+    TEST_ASSERT_GREATER_THAN_UINT32(0, n);
+    qsort(cycles->dqbuf, n, sizeof(uint32_t), bench_cmp_u32);
+    qsort(cycles->qbuf, n, sizeof(uint32_t), bench_cmp_u32);
+
+    printf("%-6s %-6s %6" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+           api == BENCH_API_VFS ? "vfs" : "handle", thrash ? "yes" : "no", n,
+           cycles->dqbuf[n * 50 / 100], cycles->dqbuf[n * 99 / 100],
+           cycles->qbuf[n * 50 / 100], cycles->qbuf[n * 99 / 100]);
+}
+
+TEST_CASE("Queue benchmark capture QBUF/DQBUF", "[bench]")
+{
+    struct esp_video *video = bench_create_capture();
+
+    s_result = heap_caps_calloc(1, sizeof(bench_result_t), MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(s_result);
+
+    bench_print_header();
+    for (int api = BENCH_API_VFS; api <= BENCH_API_HANDLE; api++) {
+        for (int i = 0; i < sizeof(s_bench_size) / sizeof(s_bench_size[0]); i++) {
+            for (int j = 0; j < sizeof(s_bench_rate) / sizeof(s_bench_rate[0]); j++) {
+                bench_capture_run(video, api, s_bench_size[i], s_bench_rate[j], 1);
+            }
+        }
+    }
+
+    heap_caps_free(s_result);
+    bench_destroy_capture(video);
+}
+
+TEST_CASE("Queue benchmark capture fan-out", "[bench]")
+{
+    struct esp_video *video = bench_create_capture();
+
+    s_result = heap_caps_calloc(1, sizeof(bench_result_t), MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(s_result);
+
+    bench_print_header();
+    for (int i = 0; i < sizeof(s_bench_consumer_num) / sizeof(s_bench_consumer_num[0]); i++) {
+        for (int j = 0; j < sizeof(s_bench_rate) / sizeof(s_bench_rate[0]); j++) {
+            bench_capture_run(video, BENCH_API_HANDLE, s_bench_size[0], s_bench_rate[j], s_bench_consumer_num[i]);
+        }
+    }
+
+    heap_caps_free(s_result);
+    bench_destroy_capture(video);
+}
+
+TEST_CASE("Queue benchmark M2M", "[bench]")
+{
+    uint32_t device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_STREAMING;
+    struct esp_video *video = esp_video_create(BENCH_M2M_NAME, BENCH_M2M_DEVICE_ID, &s_bench_m2m_ops, NULL,
+                                               device_caps | V4L2_CAP_DEVICE_CAPS, device_caps);
+    TEST_ASSERT_NOT_NULL(video);
+
+    s_result = heap_caps_calloc(1, sizeof(bench_result_t), MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(s_result);
+
+    bench_print_header();
+    for (int api = BENCH_API_VFS; api <= BENCH_API_HANDLE; api++) {
+        for (int i = 0; i < sizeof(s_bench_size) / sizeof(s_bench_size[0]); i++) {
+            bench_m2m_run(api, s_bench_size[i]);
+        }
+    }
+
+    heap_caps_free(s_result);
+    TEST_ESP_OK(esp_video_destroy(video));
+}
+
+TEST_CASE("Queue benchmark cache thrash", "[bench]")
+{
+    struct esp_video *video = bench_create_capture();
+    bench_capture_t *capture = VIDEO_PRIV_DATA(bench_capture_t *, video);
+    uint8_t *thrash = heap_caps_malloc(BENCH_THRASH_SIZE, MALLOC_CAP_SPIRAM);
+    bench_cycles_t *cycles = heap_caps_calloc(1, sizeof(bench_cycles_t), MALLOC_CAP_8BIT);
+
+    TEST_ASSERT_NOT_NULL(cycles);
+    if (!thrash) {
+        heap_caps_free(cycles);
+        bench_destroy_capture(video);
+        TEST_IGNORE_MESSAGE("no PSRAM to thrash the cache with");
+    }
+    memset(thrash, 0x5a, BENCH_THRASH_SIZE);
+    capture->period_us = 1000000 / BENCH_THRASH_RATE;
+
+    printf("frame path in %s, CPU cycles per call\n", BENCH_FRAME_PATH_MEM);
+    printf("%-6s %-6s %6s %8s %8s %8s %8s\n", "api", "thrash", "calls", "dq_p50", "dq_p99", "q_p50", "q_p99");
+    for (int api = BENCH_API_VFS; api <= BENCH_API_HANDLE; api++) {
+        bench_thrash_run(api, NULL, cycles);
+        bench_thrash_run(api, thrash, cycles);
+    }
+
+    heap_caps_free(thrash);
+    heap_caps_free(cycles);
+    bench_destroy_capture(video);
+}
@@ -0,0 +1,215 @@
+#!/usr/bin/env python
+#
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+#
+# SPDX-License-Identifier: ESPRESSIF MIT
+#
+# Compile the CCM, gamma and LSC parts of a sensor tuning JSON into const C
+# tables, so that the ISP video device starts from them without building
+# anything at runtime.
+
+import argparse
+import json
+import sys
+
+CCM_DIMENSION = 3
+CCM_DEFAULT_COLOR_TEMP = 5000           # Daylight, the CCM used before AWB has an estimate
+
+GAMMA_POINTS = 16                       # ISP_GAMMA_CURVE_POINTS_NUM
+GAMMA_X_STEP = 256 // GAMMA_POINTS
+
+LSC_GRID_SIZE = 32                      # ISP_LL_LSC_GRID_HEIGHT, a grid cell covers 2x2 of them
+LSC_GAIN_FRAC_BITS = 8                  # isp_lsc_gain_t is 2.8 fixed point
+LSC_GAIN_MAX = (1 << (LSC_GAIN_FRAC_BITS + 2)) - 1
+LSC_CHANNELS = ('gain_r', 'gain_gr', 'gain_gb', 'gain_b')
+
+
+def lsc_grids(resolution):
+    """Same as ISP_LSC_GET_GRIDS()"""
+    return (resolution - 1) // 2 // LSC_GRID_SIZE + 2
+
+
+def find_section(node, name):
+    """Return the first dictionary value named name, searched depth first"""
+    if isinstance(node, dict):
+        if isinstance(node.get(name), dict):
+            return node[name]
+        for value in node.values():
+            found = find_section(value, name)
+            if found is not None:
+                return found
+    elif isinstance(node, list):
+        for value in node:
+            found = find_section(value, name)
+            if found is not None:
+                return found
+    return None
+
+
+def parse_resolution(text):
+    width, height = text.lower().split('x')
+    return int(width), int(height)
+
+
+def select_ccm(ccm):
+    table = ccm.get('table', []) if ccm else []
+    if not table:
+        return None
+
+    entry = min(table, key=lambda e: abs(e.get('color_temp', 0) - CCM_DEFAULT_COLOR_TEMP)
+                if e.get('color_temp', 0) else 0)
+    matrix = entry['matrix']
+    if len(matrix) != CCM_DIMENSION * CCM_DIMENSION:
+        raise ValueError('CCM matrix must have %d coefficients' % (CCM_DIMENSION * CCM_DIMENSION))
+    return matrix
+
+
+def gamma_curve(gamma):
+    table = gamma.get('table', []) if gamma else []
+    if not table:
+        return None
+
+    # The first entry is the curve of the darkest scene the IPA starts from
+    entry = min(table, key=lambda e: e.get('luma', 0))
+    xs = [min((i + 1) * GAMMA_X_STEP, 255) for i in range(GAMMA_POINTS)]
+    if gamma.get('use_gamma_param', True) and 'gamma_param' in entry:
+        param = float(entry['gamma_param'])
+        ys = [min(int(round(256.0 * (x / 256.0) ** param)), 255) for x in xs]
+    else:
+        ys = entry['y']
+        if len(ys) != GAMMA_POINTS:
+            raise ValueError('gamma curve must have %d points' % GAMMA_POINTS)
+    return list(zip(xs, ys))
+
+
+def resample_grid(grid, src_w, src_h, dst_w, dst_h):
+    """Bilinear resampling of a row-major grid, both grids span the whole image"""
+    out = []
+    for j in range(dst_h):
+        v = j * (src_h - 1) / float(dst_h - 1) if dst_h > 1 else 0.0
+        j0 = min(int(v), src_h - 1)
+        j1 = min(j0 + 1, src_h - 1)
+        fv = v - j0
+        for i in range(dst_w):
+            u = i * (src_w - 1) / float(dst_w - 1) if dst_w > 1 else 0.0
+            i0 = min(int(u), src_w - 1)
+            i1 = min(i0 + 1, src_w - 1)
+            fu = u - i0
+            top = grid[j0 * src_w + i0] * (1 - fu) + grid[j0 * src_w + i1] * fu
+            bottom = grid[j1 * src_w + i0] * (1 - fu) + grid[j1 * src_w + i1] * fu
+            out.append(top * (1 - fv) + bottom * fv)
+    return out
+
+
+def lsc_tables(lsc, resolutions):
+    table = lsc.get('table', []) if lsc else []
+    if not table or not resolutions:
+        return []
+
+    tables = []
+    for width, height in resolutions:
+        # Resample from the calibration closest in aspect ratio, then in size
+        src = min(table, key=lambda e: (abs(e['width'] * height - e['height'] * width), abs(e['width'] - width)))
+        src_w = lsc_grids(src['width'])
+        src_h = lsc_grids(src['height'])
+        dst_w = lsc_grids(width)
+        dst_h = lsc_grids(height)
+        gains = {}
+        for channel in LSC_CHANNELS:
+            grid = src[channel]
+            if len(grid) != src_w * src_h:
+                raise ValueError('LSC %s of %dx%d must have %d gains' %
+                                 (channel, src['width'], src['height'], src_w * src_h))
+            gains[channel] = [min(max(int(round(g * (1 << LSC_GAIN_FRAC_BITS))), 0), LSC_GAIN_MAX)
+                              for g in resample_grid(grid, src_w, src_h, dst_w, dst_h)]
+        tables.append((width, height, dst_w * dst_h, gains))
+    return tables
+
+
+def emit_lsc_gains(out, name, gains):
+    out.append('static const isp_lsc_gain_t %s[] = {' % name)
+    for start in range(0, len(gains), 12):
+        out.append('    ' + ' '.join('{.val = %d},' % g for g in gains[start:start + 12]))
+    out.append('};')
+    out.append('')
+
+
+def generate(config, resolutions, source):
+    sensor = next((v for v in config.values() if isinstance(v, dict)), {})
+    ccm = select_ccm(find_section(sensor, 'ccm'))
+    gamma = gamma_curve(find_section(sensor, 'gamma'))
+    lsc = lsc_tables(find_section(sensor, 'lsc'), resolutions)
+
+    out = [
+        '/*',
+        ' * Generated by gen_isp_tuning_tables.py from %s, do not edit' % source,
+        ' */',
+        '',
+        '#pragma once',
+        '',
+    ]
+
+    if ccm:
+        out.append('#define ISP_TUNING_CCM              1')
+        out.append('')
+        out.append('static const float s_isp_tuning_ccm[ISP_CCM_DIMENSION][ISP_CCM_DIMENSION] = {')
+        for row in range(CCM_DIMENSION):
+            coeffs = ccm[row * CCM_DIMENSION:(row + 1) * CCM_DIMENSION]
+            out.append('    {%s},' % ', '.join('%.6ff' % c for c in coeffs))
+        out.append('};')
+        out.append('')
+
+    if gamma:
+        out.append('#define ISP_TUNING_GAMMA            1')
+        out.append('')
+        out.append('static const esp_video_isp_gamma_point_t s_isp_tuning_gamma[ISP_GAMMA_CURVE_POINTS_NUM] = {')
+        out.append('    ' + ' '.join('{%d, %d},' % p for p in gamma))
+        out.append('};')
+        out.append('')
+
+    if lsc:
+        for width, height, _, gains in lsc:
+            for channel in LSC_CHANNELS:
+                emit_lsc_gains(out, 's_isp_tuning_lsc_%dx%d_%s' % (width, height, channel[5:]), gains[channel])
+
+        out.append('#define ISP_TUNING_LSC              1')
+        out.append('')
+        out.append('static const struct isp_tuning_lsc {')
+        out.append('    uint16_t width;')
+        out.append('    uint16_t height;')
+        out.append('    size_t gain_size;')
+        out.append('    const isp_lsc_gain_t *gain[4];         /*!< R, Gr, Gb and B */')
+        out.append('} s_isp_tuning_lsc[] = {')
+        for width, height, size, _ in lsc:
+            names = ', '.join('s_isp_tuning_lsc_%dx%d_%s' % (width, height, c[5:]) for c in LSC_CHANNELS)
+            out.append('    {%d, %d, %d, {%s}},' % (width, height, size, names))
+        out.append('};')
+        out.append('')
+
+    return '\n'.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compile a sensor tuning JSON into ISP tables')
+    parser.add_argument('--lsc-resolutions', default='',
+                        help='Space separated WIDTHxHEIGHT list the LSC grids are resampled for')
+    parser.add_argument('input', help='Sensor tuning JSON')
+    parser.add_argument('output', help='Generated C header')
+    args = parser.parse_args()
+
+    resolutions = [parse_resolution(r) for r in args.lsc_resolutions.replace(',', ' ').split()]
+
+    with open(args.input, 'r') as f:
+        config = json.load(f)
+
+    try:
+        header = generate(config, resolutions, args.input.replace('\\', '/').split('/')[-1])
+    except (KeyError, ValueError) as e:
+        sys.exit('%s: %s' % (args.input, e))
+
+    with open(args.output, 'w') as f:
+        f.write(header)
+
+
+if __name__ == '__main__':
+    main()
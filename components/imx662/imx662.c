@@ -8,6 +8,8 @@
  */
 
 #include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "driver/gpio.h"
@@ -17,6 +19,7 @@
 
 #include "esp_cam_sensor.h"
 #include "esp_cam_sensor_detect.h"
+#include "esp_video_ioctl.h"
 #include "imx662_settings.h"
 #include "imx662.h"
 
@@ -25,16 +28,59 @@
 #endif
 #define delay_ms(ms)  vTaskDelay((ms > portTICK_PERIOD_MS ? ms / portTICK_PERIOD_MS : 1))
 
+#define IMX662_SCCB_BURST_MAX   32      /* Data bytes of one burst write */
+
+#define IMX662_SHR0_MIN         11      /* Shortest SHR0, the longest exposure is VMAX - 11 lines */
+#define IMX662_VMAX_MAX         0xFFFFF /* VMAX is 20 bits */
+#define IMX662_GAIN_MAX         240     /* 72dB of analog gain in 0.3dB steps */
+#define IMX662_DOL_SHR_MIN      5       /* Shortest SHR1, and of SHR0 past RHS1 in DOL-HDR */
+#define IMX662_DOL_SHORT_MIN    2       /* Shortest DOL-HDR short exposure in lines */
+
 static const char *TAG = "imx662";
 
+/*
+ * Registers only the driver writes once the tables are applied, AE touches
+ * them every frame. Their last written or read value is kept so that
+ * unchanged writes are skipped and reads do not go to the bus.
+ */
+static const uint16_t s_imx662_shadow_regs[] = {
+    IMX662_REG_VMAX_L, IMX662_REG_VMAX_M, IMX662_REG_VMAX_H,
+    IMX662_REG_SHR0_L, IMX662_REG_SHR0_M, IMX662_REG_SHR0_H,
+    IMX662_REG_SHR1_L, IMX662_REG_SHR1_M, IMX662_REG_SHR1_H,
+    IMX662_REG_GAIN_L, IMX662_REG_GAIN_H,
+    IMX662_REG_HREVERSE, IMX662_REG_VREVERSE,
+};
+
+#define IMX662_SHADOW_NUM   (sizeof(s_imx662_shadow_regs) / sizeof(s_imx662_shadow_regs[0]))
+
+/*
+ * Driver state kept across format changes. Once the common registers are
+ * written, a format change only writes the registers whose value differs,
+ * so preview and still modes switch without a full rewrite.
+ */
+typedef struct {
+    bool initialized;   /*!< Common registers and dev->cur_format registers are applied */
+    bool windowed;      /*!< A crop window is programmed */
+    bool streaming;     /*!< Out of standby */
+    bool verified;      /*!< Registers of dev->cur_format were read back at a stream start */
+    uint32_t vmax;      /*!< Frame length of the format or crop window, a long exposure stretches it */
+    uint32_t lane_mbps; /*!< Lane rate dev->cur_format runs at */
+    uint32_t sync_mode; /*!< ESP_VIDEO_SENSOR_SYNC_XXX of the next stream start */
+    uint32_t shadow_valid;                  /*!< Bit i set if shadow[i] holds the sensor value */
+    uint8_t shadow[IMX662_SHADOW_NUM];      /*!< Values of s_imx662_shadow_regs */
+} imx662_priv_t;
+
+#define IMX662_PRIV(dev)  ((imx662_priv_t *)(dev)->priv)
+
 /*
  * Format definitions - RAW10 output only (no ISP)
  * IMX662 Bayer pattern: RGGB
  * Post-processing (demosaicing) will be done in software
  *
  * MIPI configuration:
- * - DATARATE_SEL=0x06: 720 Mbps per lane
- * - 2 lanes × 720 Mbps = 1440 Mbps total bandwidth
+ * - 2 lanes
+ * - mipi_clk is the highest lane rate the format may use, the driver runs
+ *   it at the lowest rate of s_imx662_lane_rates that sustains its lines
  */
 
 /*
@@ -121,10 +167,124 @@ static const esp_cam_sensor_format_t imx662_format_info[] = {
         },
         .reserved = NULL,
     },
+    /*
+     * FORMAT 2: 2x2 binning preview, RAW12 at 60fps
+     *
+     * Same clock and lane rate as the 30fps formats, so switching between
+     * them only rewrites a few registers and the PLL setting stays.
+     */
+    {
+        .name = "MIPI_2lane_RAW12_BIN2x2_968x550_60fps",
+        .format = ESP_CAM_SENSOR_PIXFORMAT_RAW12,
+        .port = ESP_CAM_SENSOR_MIPI_CSI,
+        .xclk = 74250000,
+        .width = 968,
+        .height = 550,
+        .regs = imx662_968x550_60fps_2lane_bin2x2,
+        .regs_size = sizeof(imx662_968x550_60fps_2lane_bin2x2) / sizeof(imx662_reginfo_t),
+        .fps = 60,
+        .isp_info = NULL,
+        .mipi_info = {
+            .mipi_clk = 720000000,
+            .lane_num = 2,
+            .line_sync_en = false,
+        },
+        .reserved = NULL,
+    },
+    /*
+     * FORMAT 3: RAW10 full resolution at 60fps
+     *
+     * Half the line period of the 30fps formats, which needs a faster lane
+     * rate than they run at.
+     */
+    {
+        .name = "MIPI_2lane_RAW10_1936x1100_60fps",
+        .format = ESP_CAM_SENSOR_PIXFORMAT_RAW10,
+        .port = ESP_CAM_SENSOR_MIPI_CSI,
+        .xclk = 74250000,
+        .width = 1936,
+        .height = 1100,
+        .regs = imx662_1936x1100_60fps_2lane_raw10,
+        .regs_size = sizeof(imx662_1936x1100_60fps_2lane_raw10) / sizeof(imx662_reginfo_t),
+        .fps = 60,
+        .isp_info = NULL,
+        .mipi_info = {
+            .mipi_clk = 1440000000,
+            .lane_num = 2,
+            .line_sync_en = false,
+        },
+        .reserved = NULL,
+    },
+    /*
+     * FORMAT 4: 2x2 binning, RAW12 at 90fps
+     *
+     * A quarter of the pixels of a full frame, for motion-heavy scenes.
+     * Same clock and lane rate as the 30fps formats.
+     */
+    {
+        .name = "MIPI_2lane_RAW12_BIN2x2_968x550_90fps",
+        .format = ESP_CAM_SENSOR_PIXFORMAT_RAW12,
+        .port = ESP_CAM_SENSOR_MIPI_CSI,
+        .xclk = 74250000,
+        .width = 968,
+        .height = 550,
+        .regs = imx662_968x550_90fps_2lane_bin2x2,
+        .regs_size = sizeof(imx662_968x550_90fps_2lane_bin2x2) / sizeof(imx662_reginfo_t),
+        .fps = 90,
+        .isp_info = NULL,
+        .mipi_info = {
+            .mipi_clk = 720000000,
+            .lane_num = 2,
+            .line_sync_en = false,
+        },
+        .reserved = NULL,
+    },    /*
+     * FORMAT 5: DOL-HDR, RAW10 long and short exposure at 30fps
+     *
+     * Rows alternate long and short exposure, long first, so the frame is
+     * twice the sensor height. Not for the ISP, the HDR merge video device
+     * turns it into one 16-bit linear 1936x1100 frame.
+     */
+    {
+        .name = "MIPI_2lane_RAW10_DOL2_1936x1100_30fps",
+        .format = ESP_CAM_SENSOR_PIXFORMAT_RAW10,
+        .port = ESP_CAM_SENSOR_MIPI_CSI,
+        .xclk = 74250000,
+        .width = 1936,
+        .height = 2200,
+        .regs = imx662_1936x1100_30fps_2lane_dol2,
+        .regs_size = sizeof(imx662_1936x1100_30fps_2lane_dol2) / sizeof(imx662_reginfo_t),
+        .fps = 30,
+        .isp_info = NULL,
+        .mipi_info = {
+            .mipi_clk = 1440000000,
+            .lane_num = 2,
+            .line_sync_en = false,
+        },
+        .reserved = NULL,
+    },
 };
 
 #define IMX662_FORMAT_COUNT (sizeof(imx662_format_info) / sizeof(esp_cam_sensor_format_t))
 
+/*
+ * Lane rates of DATARATE_SEL, lowest first. 1440 Mbps is the highest the
+ * ESP32-P4 CSI receiver takes.
+ */
+static const struct {
+    uint32_t mbps;
+    uint8_t datarate_sel;
+} s_imx662_lane_rates[] = {
+    {594,  IMX662_DATARATE_594MBPS},
+    {720,  IMX662_DATARATE_720MBPS},
+    {891,  IMX662_DATARATE_891MBPS},
+    {1188, IMX662_DATARATE_1188MBPS},
+    {1440, IMX662_DATARATE_1440MBPS},
+};
+
+#define IMX662_LANE_RATE_NUM    (sizeof(s_imx662_lane_rates) / sizeof(s_imx662_lane_rates[0]))
+#define IMX662_LINE_LOAD_PCT    80  /* Share of a line period the pixels of a line may take on a lane */
+
 /* Read register (16-bit address, 8-bit value) */
 static esp_err_t imx662_read(esp_sccb_io_handle_t sccb_handle, uint16_t reg, uint8_t *read_buf)
 {
@@ -137,21 +297,271 @@ static esp_err_t imx662_write(esp_sccb_io_handle_t sccb_handle, uint16_t reg, ui
     return esp_sccb_transmit_reg_a16v8(sccb_handle, reg, data);
 }
 
+/* Index of reg in the shadow, -1 if the driver does not own it */
+static int imx662_shadow_index(uint16_t reg)
+{
+    for (int i = 0; i < IMX662_SHADOW_NUM; i++) {
+        if (s_imx662_shadow_regs[i] == reg) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Forget the shadow, the tables or a reset changed the registers behind it */
+static void imx662_shadow_invalidate(esp_cam_sensor_device_t *dev)
+{
+    if (dev->priv) {
+        IMX662_PRIV(dev)->shadow_valid = 0;
+    }
+}
+
+/* Read a register, served from the shadow when it holds the value */
+static esp_err_t imx662_read_cached(esp_cam_sensor_device_t *dev, uint16_t reg, uint8_t *read_buf)
+{
+    imx662_priv_t *priv = IMX662_PRIV(dev);
+    int index = imx662_shadow_index(reg);
+    esp_err_t ret;
+
+    if (index >= 0 && (priv->shadow_valid & (1U << index))) {
+        *read_buf = priv->shadow[index];
+        return ESP_OK;
+    }
+
+    ret = imx662_read(dev->sccb_handle, reg, read_buf);
+    if (ret == ESP_OK && index >= 0) {
+        priv->shadow[index] = *read_buf;
+        priv->shadow_valid |= 1U << index;
+    }
+
+    return ret;
+}
+
+/* Write a register, skipped when the shadow holds the same value */
+static esp_err_t imx662_write_cached(esp_cam_sensor_device_t *dev, uint16_t reg, uint8_t data)
+{
+    imx662_priv_t *priv = IMX662_PRIV(dev);
+    int index = imx662_shadow_index(reg);
+    esp_err_t ret;
+
+    if (index < 0) {
+        return imx662_write(dev->sccb_handle, reg, data);
+    }
+
+    if ((priv->shadow_valid & (1U << index)) && priv->shadow[index] == data) {
+        return ESP_OK;
+    }
+
+    /* A failed write leaves the sensor value unknown */
+    ret = imx662_write(dev->sccb_handle, reg, data);
+    if (ret == ESP_OK) {
+        priv->shadow[index] = data;
+        priv->shadow_valid |= 1U << index;
+    } else {
+        priv->shadow_valid &= ~(1U << index);
+    }
+
+    return ret;
+}
+
+#if CONFIG_CAMERA_IMX662_SCCB_BURST_WRITE
+/*
+ * Write a run of registers at consecutive addresses in one transaction,
+ * the sensor increments the address after each data byte. Returns the
+ * number of registers written.
+ */
+static int imx662_write_burst(esp_sccb_io_handle_t sccb_handle, const imx662_reginfo_t *regarray, esp_err_t *ret)
+{
+    uint8_t buf[2 + IMX662_SCCB_BURST_MAX];
+    int n = 0;
+
+    buf[0] = regarray[0].reg >> 8;
+    buf[1] = regarray[0].reg & 0xff;
+    do {
+        buf[2 + n] = regarray[n].val;
+        n++;
+    } while (n < IMX662_SCCB_BURST_MAX && regarray[n].reg == regarray[0].reg + n);
+
+    *ret = n == 1 ? imx662_write(sccb_handle, regarray[0].reg, regarray[0].val) :
+           esp_sccb_transmit_v(sccb_handle, buf, 2 + n);
+    return n;
+}
+#endif
+
 /* Write array of registers */
 static esp_err_t imx662_write_array(esp_sccb_io_handle_t sccb_handle, const imx662_reginfo_t *regarray)
 {
     int i = 0;
+    int transactions = 0;
     esp_err_t ret = ESP_OK;
 
     while ((ret == ESP_OK) && regarray[i].reg != IMX662_REG_END) {
         if (regarray[i].reg != IMX662_REG_DELAY) {
+#if CONFIG_CAMERA_IMX662_SCCB_BURST_WRITE
+            /* IMX662_REG_END and IMX662_REG_DELAY never continue a run of addresses */
+            i += imx662_write_burst(sccb_handle, &regarray[i], &ret);
+#else
             ret = imx662_write(sccb_handle, regarray[i].reg, regarray[i].val);
+            i++;
+#endif
+            transactions++;
         } else {
             delay_ms(regarray[i].val);
+            i++;
         }
-        i++;
     }
-    ESP_LOGD(TAG, "Wrote %d registers", i);
+    ESP_LOGD(TAG, "Wrote %d registers in %d transactions", i, transactions);
+    return ret;
+}
+
+/* Find a register in an array, NULL if it is not written by the array */
+static const imx662_reginfo_t *imx662_find_reg(const imx662_reginfo_t *regarray, uint16_t reg)
+{
+    for (int i = 0; regarray[i].reg != IMX662_REG_END; i++) {
+        if (regarray[i].reg == reg) {
+            return &regarray[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Value a register has once the array is applied on top of the common registers */
+static const imx662_reginfo_t *imx662_applied_reg(const imx662_reginfo_t *regarray, uint16_t reg)
+{
+    const imx662_reginfo_t *info = imx662_find_reg(regarray, reg);
+
+    return info ? info : imx662_find_reg(imx662_common_init_regs, reg);
+}
+
+/* DOL-HDR formats send the long and the short exposure line of a row per line period */
+static bool imx662_format_is_dol(const esp_cam_sensor_format_t *format)
+{
+    const imx662_reginfo_t *regs = (const imx662_reginfo_t *)format->regs;
+    const imx662_reginfo_t *wdmode = regs ? imx662_applied_reg(regs, IMX662_REG_WDMODE) : NULL;
+
+    return wdmode && wdmode->val == IMX662_WDMODE_DOL;
+}
+
+/* Bits per pixel of a format on the MIPI lanes */
+static uint32_t imx662_format_bpp(const esp_cam_sensor_format_t *format)
+{
+    switch (format->format) {
+    case ESP_CAM_SENSOR_PIXFORMAT_RAW8:
+        return 8;
+    case ESP_CAM_SENSOR_PIXFORMAT_RAW10:
+        return 10;
+    case ESP_CAM_SENSOR_PIXFORMAT_RAW12:
+        return 12;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Index in s_imx662_lane_rates of the lowest rate that sends a line of the
+ * format within IMX662_LINE_LOAD_PCT of its HMAX period, and is not above
+ * format->mipi_info.mipi_clk. -1 if no rate does.
+ */
+static int imx662_lane_rate_index(const esp_cam_sensor_format_t *format)
+{
+    const imx662_reginfo_t *regs = (const imx662_reginfo_t *)format->regs;
+    const imx662_reginfo_t *hmax_l = regs ? imx662_applied_reg(regs, IMX662_REG_HMAX_L) : NULL;
+    const imx662_reginfo_t *hmax_h = regs ? imx662_applied_reg(regs, IMX662_REG_HMAX_H) : NULL;
+    uint32_t bpp = imx662_format_bpp(format);
+    uint64_t line_ns;
+    uint64_t lane_bits;
+
+    if (!hmax_l || !hmax_h || !bpp || !format->mipi_info.lane_num) {
+        return -1;
+    }
+
+    line_ns = (uint64_t)(hmax_l->val | (hmax_h->val << 8)) * 1000000000ULL / IMX662_PIXEL_RATE;
+    lane_bits = (uint64_t)format->width * bpp / format->mipi_info.lane_num;
+    if (imx662_format_is_dol(format)) {
+        lane_bits *= 2;
+    }
+
+    for (int i = 0; i < IMX662_LANE_RATE_NUM; i++) {
+        uint32_t mbps = s_imx662_lane_rates[i].mbps;
+
+        if ((uint64_t)mbps * 1000000 > format->mipi_info.mipi_clk) {
+            break;
+        }
+        /* lane_bits / mbps us <= line_ns * IMX662_LINE_LOAD_PCT / 100 ns */
+        if (lane_bits * 1000 * 100 <= line_ns * IMX662_LINE_LOAD_PCT * mbps) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Switch from one format register array to another. Only registers whose
+ * value changes are written, registers of the old array the new one does
+ * not set go back to their common value. A crop window is dropped as well,
+ * along with the VMAX it set.
+ * The writes are grouped under REGHOLD so they take effect together.
+ */
+static esp_err_t imx662_write_delta(esp_cam_sensor_device_t *dev, const imx662_reginfo_t *from,
+                                    const imx662_reginfo_t *to)
+{
+    static const uint16_t window_regs[] = {
+        IMX662_REG_VMAX_L, IMX662_REG_VMAX_M, IMX662_REG_VMAX_H,
+        IMX662_REG_WINMODE,
+        IMX662_REG_PIX_HST_L, IMX662_REG_PIX_HST_H, IMX662_REG_PIX_HWIDTH_L, IMX662_REG_PIX_HWIDTH_H,
+        IMX662_REG_PIX_VST_L, IMX662_REG_PIX_VST_H, IMX662_REG_PIX_VWIDTH_L, IMX662_REG_PIX_VWIDTH_H,
+    };
+    esp_err_t ret;
+    int count = 0;
+
+    ret = imx662_write(dev->sccb_handle, IMX662_REG_REGHOLD, 0x01);
+
+    for (int i = 0; ret == ESP_OK && to[i].reg != IMX662_REG_END; i++) {
+        const imx662_reginfo_t *old;
+
+        if (to[i].reg == IMX662_REG_DELAY) {
+            delay_ms(to[i].val);
+            continue;
+        }
+
+        old = imx662_applied_reg(from, to[i].reg);
+        if (!old || old->val != to[i].val) {
+            ret = imx662_write(dev->sccb_handle, to[i].reg, to[i].val);
+            count++;
+        }
+    }
+
+    for (int i = 0; ret == ESP_OK && from[i].reg != IMX662_REG_END; i++) {
+        const imx662_reginfo_t *common;
+
+        if (from[i].reg == IMX662_REG_DELAY || imx662_find_reg(to, from[i].reg)) {
+            continue;
+        }
+
+        common = imx662_find_reg(imx662_common_init_regs, from[i].reg);
+        if (common && common->val != from[i].val) {
+            ret = imx662_write(dev->sccb_handle, common->reg, common->val);
+            count++;
+        }
+    }
+
+    for (int i = 0; ret == ESP_OK && IMX662_PRIV(dev)->windowed && i < sizeof(window_regs) / sizeof(window_regs[0]); i++) {
+        const imx662_reginfo_t *info = imx662_applied_reg(to, window_regs[i]);
+
+        if (info) {
+            ret = imx662_write(dev->sccb_handle, info->reg, info->val);
+            count++;
+        }
+    }
+
+    if (ret == ESP_OK) {
+        ret = imx662_write(dev->sccb_handle, IMX662_REG_REGHOLD, 0x00);
+    }
+
+    ESP_LOGD(TAG, "Wrote %d changed registers", count);
     return ret;
 }
 
@@ -164,6 +574,15 @@ static esp_err_t imx662_hw_reset(esp_cam_sensor_device_t *dev)
         gpio_set_level(dev->reset_pin, 1);
         delay_ms(10);
     }
+
+    /* The sensor is back to its power-on registers */
+    if (dev->priv) {
+        IMX662_PRIV(dev)->initialized = false;
+        IMX662_PRIV(dev)->windowed = false;
+        IMX662_PRIV(dev)->streaming = false;
+        IMX662_PRIV(dev)->verified = false;
+    }
+    imx662_shadow_invalidate(dev);
     return ESP_OK;
 }
 
@@ -199,52 +618,183 @@ static esp_err_t imx662_get_sensor_id(esp_cam_sensor_device_t *dev, esp_cam_sens
 /* Set horizontal mirror */
 static esp_err_t imx662_set_mirror(esp_cam_sensor_device_t *dev, int enable)
 {
-    return imx662_write(dev->sccb_handle, IMX662_REG_HREVERSE, enable ? 0x01 : 0x00);
+    return imx662_write_cached(dev, IMX662_REG_HREVERSE, enable ? 0x01 : 0x00);
 }
 
 /* Set vertical flip */
 static esp_err_t imx662_set_vflip(esp_cam_sensor_device_t *dev, int enable)
 {
-    return imx662_write(dev->sccb_handle, IMX662_REG_VREVERSE, enable ? 0x01 : 0x00);
+    return imx662_write_cached(dev, IMX662_REG_VREVERSE, enable ? 0x01 : 0x00);
 }
 
-/* Set analog gain (0-240, 0.3dB steps) */
-static esp_err_t imx662_set_gain(esp_cam_sensor_device_t *dev, uint32_t gain)
+/* 20-bit value at reg_l, reg_l + 1 and reg_l + 2 once a format is applied, 0 if no table sets it */
+static uint32_t imx662_format_reg20(const esp_cam_sensor_format_t *format, uint16_t reg_l)
 {
-    if (gain > 240) gain = 240;
+    const imx662_reginfo_t *regs = (const imx662_reginfo_t *)format->regs;
+    const imx662_reginfo_t *val_l, *val_m, *val_h;
 
-    esp_err_t ret = imx662_write(dev->sccb_handle, IMX662_REG_GAIN_L, gain & 0xFF);
-    if (ret == ESP_OK) {
-        ret = imx662_write(dev->sccb_handle, IMX662_REG_GAIN_H, 0x00);
+    if (!regs || !(val_l = imx662_applied_reg(regs, reg_l))) {
+        return 0;
     }
+    val_m = imx662_applied_reg(regs, reg_l + 1);
+    val_h = imx662_applied_reg(regs, reg_l + 2);
 
-    return ret;
+    return val_l->val | (val_m ? val_m->val << 8 : 0) | (val_h ? (val_h->val & 0x0F) << 16 : 0);
 }
 
-/* Set exposure (in lines) */
-static esp_err_t imx662_set_exposure(esp_cam_sensor_device_t *dev, uint32_t exposure)
+/* VMAX set by the register table of a format, 0 if the table leaves it */
+static uint32_t imx662_format_vmax(const esp_cam_sensor_format_t *format)
 {
-    esp_err_t ret;
+    return imx662_format_reg20(format, IMX662_REG_VMAX_L);
+}
 
-    /* Read VMAX */
-    uint8_t vmax_l, vmax_m, vmax_h;
-    ret = imx662_read(dev->sccb_handle, IMX662_REG_VMAX_L, &vmax_l);
-    ret |= imx662_read(dev->sccb_handle, IMX662_REG_VMAX_M, &vmax_m);
-    ret |= imx662_read(dev->sccb_handle, IMX662_REG_VMAX_H, &vmax_h);
+/*
+ * Registers of an exposure (in lines) and an analog gain (0-240, 0.3dB
+ * steps), NULL keeps the current value. The frame is stretched by VMAX when
+ * the exposure does not fit in the frame length of the format or crop
+ * window. In DOL-HDR the frame is 2 * VMAX lines, the exposure is the long
+ * one and the short one (RHS1 - SHR1) follows it at IMX662_DOL_EXPOSURE_RATIO.
+ * Returns the number of registers, 0 on error.
+ */
+static int imx662_exp_gain_regs(esp_cam_sensor_device_t *dev, const uint32_t *exposure, const uint32_t *gain,
+                                imx662_reginfo_t *regs)
+{
+    int n = 0;
+
+    if (exposure) {
+        uint32_t lines = *exposure;
+        uint32_t vmax = IMX662_PRIV(dev)->vmax;
+        bool dol = imx662_format_is_dol(dev->cur_format);
+        uint32_t rhs1 = dol ? imx662_format_reg20(dev->cur_format, IMX662_REG_RHS1_L) : 0;
+        uint32_t shr0_min = dol ? rhs1 + IMX662_DOL_SHR_MIN : IMX662_SHR0_MIN;
+        uint32_t frame;
+        uint32_t shr0;
+
+        if (dol && rhs1 < IMX662_DOL_SHR_MIN + IMX662_DOL_SHORT_MIN) {
+            return 0;
+        }
 
-    if (ret != ESP_OK) return ret;
+        if (vmax) {
+            /* Frame length of the format or window, only ever stretched */
+            vmax = MAX(vmax, dol ? (lines + shr0_min + 1) / 2 : lines + shr0_min);
+            vmax = MIN(vmax, IMX662_VMAX_MAX);
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_VMAX_L, vmax & 0xFF};
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_VMAX_M, (vmax >> 8) & 0xFF};
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_VMAX_H, (vmax >> 16) & 0x0F};
+        } else {
+            uint8_t vmax_l, vmax_m, vmax_h;
 
-    uint32_t vmax = vmax_l | (vmax_m << 8) | (vmax_h << 16);
+            if (imx662_read_cached(dev, IMX662_REG_VMAX_L, &vmax_l) != ESP_OK ||
+                    imx662_read_cached(dev, IMX662_REG_VMAX_M, &vmax_m) != ESP_OK ||
+                    imx662_read_cached(dev, IMX662_REG_VMAX_H, &vmax_h) != ESP_OK) {
+                return 0;
+            }
+            vmax = vmax_l | (vmax_m << 8) | (vmax_h << 16);
+        }
 
-    /* SHR0 = VMAX - exposure */
-    uint32_t shr0 = vmax - exposure;
-    if (shr0 < 11) shr0 = 11;  /* Minimum SHR */
+        /* SHR0 = frame - exposure */
+        frame = dol ? vmax * 2 : vmax;
+        lines = MIN(lines, frame - shr0_min);
+        shr0 = frame - lines;
+        if (dol) {
+            uint32_t short_lines;
+            uint32_t shr1;
+
+            /* The DOL-HDR long shutter moves in steps of 2 lines */
+            shr0 = MIN((shr0 + 1) & ~1U, frame);
+            short_lines = MAX((frame - shr0) / IMX662_DOL_EXPOSURE_RATIO, IMX662_DOL_SHORT_MIN);
+            short_lines = MIN(short_lines, rhs1 - IMX662_DOL_SHR_MIN);
+            shr1 = rhs1 - short_lines;
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR1_L, shr1 & 0xFF};
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR1_M, (shr1 >> 8) & 0xFF};
+            regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR1_H, (shr1 >> 16) & 0x0F};
+        }
+        regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR0_L, shr0 & 0xFF};
+        regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR0_M, (shr0 >> 8) & 0xFF};
+        regs[n++] = (imx662_reginfo_t) {IMX662_REG_SHR0_H, (shr0 >> 16) & 0x0F};
+    }
 
-    ret = imx662_write(dev->sccb_handle, IMX662_REG_SHR0_L, shr0 & 0xFF);
-    ret |= imx662_write(dev->sccb_handle, IMX662_REG_SHR0_M, (shr0 >> 8) & 0xFF);
-    ret |= imx662_write(dev->sccb_handle, IMX662_REG_SHR0_H, (shr0 >> 16) & 0x0F);
+    if (gain) {
+        regs[n++] = (imx662_reginfo_t) {IMX662_REG_GAIN_L, MIN(*gain, IMX662_GAIN_MAX)};
+        regs[n++] = (imx662_reginfo_t) {IMX662_REG_GAIN_H, 0x00};
+    }
 
-    return ret;
+    return n;
+}
+
+/*
+ * Set exposure and gain, NULL keeps the current value. REGHOLD makes the
+ * sensor latch VMAX, SHR0, SHR1 and GAIN at the same frame start, the first frame
+ * captured with them is IMX662_CTRL_DELAY_FRAMES after the one being output.
+ * Nothing is written if the shadow holds all the values already.
+ */
+static esp_err_t imx662_set_exp_gain(esp_cam_sensor_device_t *dev, const uint32_t *exposure, const uint32_t *gain)
+{
+    imx662_priv_t *priv = IMX662_PRIV(dev);
+    imx662_reginfo_t regs[11];
+    esp_err_t ret = ESP_OK;
+    esp_err_t hold_ret;
+    int changed = 0;
+    int n;
+
+    if (!dev->cur_format || !dev->cur_format->regs) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    n = imx662_exp_gain_regs(dev, exposure, gain, regs);
+    if (!n) {
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int index = imx662_shadow_index(regs[i].reg);
+
+        if (!(priv->shadow_valid & (1U << index)) || priv->shadow[index] != regs[i].val) {
+            regs[changed++] = regs[i];
+        }
+    }
+    if (!changed) {
+        return ESP_OK;
+    }
+
+    ret = imx662_write(dev->sccb_handle, IMX662_REG_REGHOLD, 0x01);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (int i = 0; ret == ESP_OK && i < changed; i++) {
+        ret = imx662_write_cached(dev, regs[i].reg, regs[i].val);
+    }
+
+    /* Always release the hold, the held writes never take effect otherwise */
+    hold_ret = imx662_write(dev->sccb_handle, IMX662_REG_REGHOLD, 0x00);
+
+    return ret != ESP_OK ? ret : hold_ret;
+}
+
+/* Set analog gain (0-240, 0.3dB steps) */
+static esp_err_t imx662_set_gain(esp_cam_sensor_device_t *dev, uint32_t gain)
+{
+    return imx662_set_exp_gain(dev, NULL, &gain);
+}
+
+/* Set exposure (in lines) */
+static esp_err_t imx662_set_exposure(esp_cam_sensor_device_t *dev, uint32_t exposure)
+{
+    return imx662_set_exp_gain(dev, &exposure, NULL);
+}
+
+/* Set exposure (in lines) and gain together, see imx662_set_exp_gain() */
+static esp_err_t imx662_set_exp_gain_group(esp_cam_sensor_device_t *dev, const esp_cam_sensor_gh_exp_gain_t *group)
+{
+    uint32_t gain = group->gain_index;
+
+    /* Only the line count is supported, the ISP controller always sends it */
+    if (group->exposure_us && !group->exposure_val) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    return imx662_set_exp_gain(dev, &group->exposure_val, &gain);
 }
 
 /* Query supported formats */
@@ -280,12 +830,56 @@ static int imx662_query_para_desc(esp_cam_sensor_device_t *dev, esp_cam_sensor_p
         qdesc->number.step = 1;
         qdesc->default_value = 0;
         break;
+    case ESP_CAM_SENSOR_GROUP_EXP_GAIN:
+        qdesc->type = ESP_CAM_SENSOR_PARAM_TYPE_U8;
+        qdesc->u8.size = sizeof(esp_cam_sensor_gh_exp_gain_t);
+        break;
     default:
         return ESP_ERR_INVALID_ARG;
     }
     return 0;
 }
 
+/* Get analog gain, read back from the sensor or its shadow */
+static esp_err_t imx662_get_gain(esp_cam_sensor_device_t *dev, uint32_t *gain)
+{
+    uint8_t gain_l;
+
+    esp_err_t ret = imx662_read_cached(dev, IMX662_REG_GAIN_L, &gain_l);
+    if (ret == ESP_OK) {
+        *gain = gain_l;
+    }
+
+    return ret;
+}
+
+/* Get exposure (in lines), read back from the sensor or its shadow */
+static esp_err_t imx662_get_exposure(esp_cam_sensor_device_t *dev, uint32_t *exposure)
+{
+    esp_err_t ret;
+    uint8_t vmax_l, vmax_m, vmax_h;
+    uint8_t shr0_l, shr0_m, shr0_h;
+
+    ret = imx662_read_cached(dev, IMX662_REG_VMAX_L, &vmax_l);
+    ret |= imx662_read_cached(dev, IMX662_REG_VMAX_M, &vmax_m);
+    ret |= imx662_read_cached(dev, IMX662_REG_VMAX_H, &vmax_h);
+    ret |= imx662_read_cached(dev, IMX662_REG_SHR0_L, &shr0_l);
+    ret |= imx662_read_cached(dev, IMX662_REG_SHR0_M, &shr0_m);
+    ret |= imx662_read_cached(dev, IMX662_REG_SHR0_H, &shr0_h);
+
+    if (ret != ESP_OK) return ret;
+
+    uint32_t vmax = vmax_l | (vmax_m << 8) | (vmax_h << 16);
+    uint32_t shr0 = shr0_l | (shr0_m << 8) | ((shr0_h & 0x0F) << 16);
+
+    /* exposure = frame - SHR0, see imx662_exp_gain_regs() */
+    if (dev->cur_format && imx662_format_is_dol(dev->cur_format)) {
+        vmax *= 2;
+    }
+    *exposure = vmax > shr0 ? vmax - shr0 : 0;
+    return ESP_OK;
+}
+
 /* Get parameter */
 static int imx662_get_para_value(esp_cam_sensor_device_t *dev, uint32_t id, void *arg, size_t size)
 {
@@ -293,9 +887,19 @@ static int imx662_get_para_value(esp_cam_sensor_device_t *dev, uint32_t id, void
      * NOTE: ESP_CAM_SENSOR_DATA_SEQ_SHORT_SWAPPED causes crashes with RAW10
      * because RAW10 is packed (5 bytes per 4 pixels) and doesn't align to 16-bit.
      *
-     * For now, return NOT_SUPPORTED and handle byte order in post-processing.
+     * For now, DATA_SEQ returns NOT_SUPPORTED and byte order is handled in
+     * post-processing.
      */
-    return ESP_ERR_NOT_SUPPORTED;
+    switch (id) {
+    case ESP_CAM_SENSOR_EXPOSURE_VAL:
+        if (size < sizeof(uint32_t)) return ESP_ERR_INVALID_SIZE;
+        return imx662_get_exposure(dev, (uint32_t *)arg);
+    case ESP_CAM_SENSOR_GAIN:
+        if (size < sizeof(uint32_t)) return ESP_ERR_INVALID_SIZE;
+        return imx662_get_gain(dev, (uint32_t *)arg);
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
 }
 
 /* Set parameter */
@@ -310,6 +914,12 @@ static int imx662_set_para_value(esp_cam_sensor_device_t *dev, uint32_t id, cons
     case ESP_CAM_SENSOR_GAIN:
         ret = imx662_set_gain(dev, *(uint32_t *)arg);
         break;
+    case ESP_CAM_SENSOR_GROUP_EXP_GAIN:
+        if (size < sizeof(esp_cam_sensor_gh_exp_gain_t)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ret = imx662_set_exp_gain_group(dev, (const esp_cam_sensor_gh_exp_gain_t *)arg);
+        break;
     case ESP_CAM_SENSOR_HMIRROR:
         ret = imx662_set_mirror(dev, *(int *)arg);
         break;
@@ -327,6 +937,8 @@ static int imx662_set_para_value(esp_cam_sensor_device_t *dev, uint32_t id, cons
 static int imx662_set_format(esp_cam_sensor_device_t *dev, const esp_cam_sensor_format_t *format)
 {
     esp_err_t ret = ESP_OK;
+    imx662_priv_t *priv;
+    int rate_index;
 
     /* Validate parameters */
     if (!dev) {
@@ -338,6 +950,7 @@ static int imx662_set_format(esp_cam_sensor_device_t *dev, const esp_cam_sensor_
         ESP_LOGE(TAG, "set_format: sccb_handle is NULL");
         return ESP_ERR_INVALID_STATE;
     }
+    priv = IMX662_PRIV(dev);
 
     /* If format is NULL, use the current format or default */
     if (!format) {
@@ -352,6 +965,23 @@ static int imx662_set_format(esp_cam_sensor_device_t *dev, const esp_cam_sensor_
 
     ESP_LOGI(TAG, "set_format called: %s", format->name ? format->name : "unknown");
 
+    /*
+     * The sensor is ready for this format already, a stream restart only
+     * toggles standby. Exposure and gain are kept. A crop window is left by
+     * the full rewrite below.
+     */
+    if (priv->initialized && format == dev->cur_format && !priv->windowed) {
+        ESP_LOGI(TAG, "Format already applied");
+        return 0;
+    }
+
+    rate_index = imx662_lane_rate_index(format);
+    if (rate_index < 0) {
+        ESP_LOGE(TAG, "No lane rate up to %" PRIu32 " Mbps sustains the format",
+                 format->mipi_info.mipi_clk / 1000000);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
     /* Stop streaming first */
     ret = imx662_write(dev->sccb_handle, IMX662_REG_MODE_SELECT, IMX662_MODE_STANDBY);
     if (ret != ESP_OK) {
@@ -359,40 +989,167 @@ static int imx662_set_format(esp_cam_sensor_device_t *dev, const esp_cam_sensor_
         return ret;
     }
 
-    delay_ms(10);
-
-    /* Write common init registers */
-    ret = imx662_write_array(dev->sccb_handle, imx662_common_init_regs);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to write common init registers");
-        return ret;
+    /* Streaming is stopped with a wait already, standby is immediate then */
+    if (priv->streaming) {
+        delay_ms(10);
+        priv->streaming = false;
     }
 
-    /* Write format-specific registers */
-    if (format->regs) {
-        ret = imx662_write_array(dev->sccb_handle, (const imx662_reginfo_t *)format->regs);
+    /* The tables below may write any of the shadowed registers */
+    imx662_shadow_invalidate(dev);
+    priv->verified = false;
+
+    if (priv->initialized && dev->cur_format && dev->cur_format->regs && format->regs) {
+        /* Mode switch, the common registers are in place */
+        ret = imx662_write_delta(dev, (const imx662_reginfo_t *)dev->cur_format->regs,
+                                 (const imx662_reginfo_t *)format->regs);
         if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write format registers");
+            ESP_LOGE(TAG, "Failed to switch format registers");
+            priv->initialized = false;
             return ret;
         }
+    } else {
+        priv->initialized = false;
+
+        /* Write common init registers */
+        ret = imx662_write_array(dev->sccb_handle, imx662_common_init_regs);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write common init registers");
+            return ret;
+        }
+
+        /* Write format-specific registers */
+        if (format->regs) {
+            ret = imx662_write_array(dev->sccb_handle, (const imx662_reginfo_t *)format->regs);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write format registers");
+                return ret;
+            }
+        }
+        priv->initialized = true;
+    }
+    /* The format tables leave the lane rate to the driver */
+    ret = imx662_write(dev->sccb_handle, IMX662_REG_DATARATE_SEL, s_imx662_lane_rates[rate_index].datarate_sel);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set lane rate");
+        priv->initialized = false;
+        return ret;
     }
+    priv->lane_mbps = s_imx662_lane_rates[rate_index].mbps;
+    priv->windowed = false;
+    priv->vmax = imx662_format_vmax(format);
 
     dev->cur_format = format;
-    ESP_LOGI(TAG, "Set format: %s", format->name ? format->name : "unknown");
+    ESP_LOGI(TAG, "Set format: %s, %" PRIu32 " Mbps/lane", format->name ? format->name : "unknown", priv->lane_mbps);
 
     return 0;
 }
 
-/* Get current format */
+/* Get current format, the frame rate of a crop window scales with its VMAX */
 static int imx662_get_format(esp_cam_sensor_device_t *dev, esp_cam_sensor_format_t *format)
 {
     if (dev->cur_format) {
+        imx662_priv_t *priv = IMX662_PRIV(dev);
+        uint32_t format_vmax = imx662_format_vmax(dev->cur_format);
+
         memcpy(format, dev->cur_format, sizeof(esp_cam_sensor_format_t));
+        if (priv->lane_mbps) {
+            format->mipi_info.mipi_clk = priv->lane_mbps * 1000000;
+        }
+        if (priv->windowed && format_vmax && priv->vmax) {
+            format->fps = format->fps * format_vmax / priv->vmax;
+        }
         return 0;
     }
     return ESP_ERR_INVALID_STATE;
 }
 
+/*
+ * Window cropping readout: only the selected rectangle is sent over MIPI.
+ * VMAX drops by the rows cut from the format, keeping its vertical blanking,
+ * so smaller windows run at a higher frame rate. The exposure in lines is
+ * kept as far as the new frame allows. Must be called in standby, the full
+ * format restores all-pixel mode and its VMAX.
+ */
+static esp_err_t imx662_set_window(esp_cam_sensor_device_t *dev, const struct v4l2_rect *rect)
+{
+    imx662_priv_t *priv = IMX662_PRIV(dev);
+    uint32_t format_vmax;
+    uint32_t exposure;
+    esp_err_t ret;
+    bool full = rect->left == 0 && rect->top == 0 &&
+                rect->width == dev->cur_format->width && rect->height == dev->cur_format->height;
+    const imx662_reginfo_t window_regs[] = {
+        {IMX662_REG_REGHOLD,      0x01},
+        {IMX662_REG_WINMODE,      full ? IMX662_WINMODE_ALL_PIXEL : IMX662_WINMODE_CROP},
+        {IMX662_REG_PIX_HST_L,    rect->left & 0xFF},
+        {IMX662_REG_PIX_HST_H,    (rect->left >> 8) & 0x1F},
+        {IMX662_REG_PIX_HWIDTH_L, rect->width & 0xFF},
+        {IMX662_REG_PIX_HWIDTH_H, (rect->width >> 8) & 0x1F},
+        {IMX662_REG_PIX_VST_L,    rect->top & 0xFF},
+        {IMX662_REG_PIX_VST_H,    (rect->top >> 8) & 0x0F},
+        {IMX662_REG_PIX_VWIDTH_L, rect->height & 0xFF},
+        {IMX662_REG_PIX_VWIDTH_H, (rect->height >> 8) & 0x0F},
+        {IMX662_REG_REGHOLD,      0x00},
+        {IMX662_REG_END,          0x00},
+    };
+
+    /* The short exposure readout of DOL-HDR is placed for the full frame */
+    if (dev->cur_format && imx662_format_is_dol(dev->cur_format)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (!dev->cur_format || rect->left < 0 || rect->top < 0 ||
+            rect->left + rect->width > dev->cur_format->width ||
+            rect->top + rect->height > dev->cur_format->height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Read before VMAX moves, SHR0 is relative to it */
+    ret = imx662_get_exposure(dev, &exposure);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = imx662_write_array(dev->sccb_handle, window_regs);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    priv->windowed = !full;
+
+    format_vmax = imx662_format_vmax(dev->cur_format);
+    if (format_vmax) {
+        priv->vmax = format_vmax - (dev->cur_format->height - rect->height);
+        ret = imx662_set_exposure(dev, exposure);
+    }
+
+    ESP_LOGI(TAG, "Window: (%ld,%ld) %lux%lu%s, VMAX %lu", (long)rect->left, (long)rect->top,
+             (unsigned long)rect->width, (unsigned long)rect->height, full ? " (all-pixel)" : "",
+             (unsigned long)priv->vmax);
+
+    return ret;
+}
+
+/*
+ * Start frame timing out of standby. A leader drives XVS/XHS for the
+ * followers, a follower keeps them as inputs and leaves master operation
+ * stopped so that its frames start at the external XVS.
+ */
+static esp_err_t imx662_start_sync(esp_cam_sensor_device_t *dev)
+{
+    uint32_t mode = IMX662_PRIV(dev)->sync_mode;
+    esp_err_t ret;
+
+    ret = imx662_write(dev->sccb_handle, IMX662_REG_XXS_DRV,
+                       mode == ESP_VIDEO_SENSOR_SYNC_LEADER ? IMX662_XXS_DRV_OUTPUT : IMX662_XXS_DRV_HIZ);
+    if (mode != ESP_VIDEO_SENSOR_SYNC_FOLLOWER) {
+        /* XMSTA = 0x00 starts master operation */
+        ret |= imx662_write(dev->sccb_handle, IMX662_REG_XMASTER, 0x00);
+    }
+
+    return ret;
+}
+
 /* Private ioctl - handles streaming control */
 static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *arg)
 {
@@ -404,12 +1161,46 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
         return ESP_ERR_INVALID_ARG;
     }
 
+    /* esp_video command, not encoded like the esp_cam_sensor ones */
+    if (cmd == ESP_VIDEO_SENSOR_IOC_S_WINDOW) {
+        return arg ? imx662_set_window(dev, (const struct v4l2_rect *)arg) : ESP_ERR_INVALID_ARG;
+    }
+    if (cmd == ESP_VIDEO_SENSOR_IOC_S_SYNC_MODE) {
+        if (!arg || *(uint32_t *)arg > ESP_VIDEO_SENSOR_SYNC_FOLLOWER) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (IMX662_PRIV(dev)->streaming) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        IMX662_PRIV(dev)->sync_mode = *(uint32_t *)arg;
+        return ESP_OK;
+    }
+    if (cmd == ESP_VIDEO_SENSOR_IOC_G_CTRL_DELAY) {
+        if (!arg) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        *(uint32_t *)arg = IMX662_CTRL_DELAY_FRAMES;
+        return ESP_OK;
+    }
+
     switch (ESP_CAM_SENSOR_IOC_GET_ID(cmd)) {
     case ESP_CAM_SENSOR_IOC_GET_ID(ESP_CAM_SENSOR_IOC_S_STREAM): {
         int enable = arg ? *(int *)arg : 0;
         ESP_LOGI(TAG, "Stream control: %s", enable ? "START" : "STOP");
 
-        if (enable) {
+        if (enable && IMX662_PRIV(dev)->verified) {
+            /* Registers are unchanged since the last start, only leave standby */
+            ret = imx662_write(dev->sccb_handle, IMX662_REG_REGHOLD, 0x00);
+            ret |= imx662_write(dev->sccb_handle, IMX662_REG_MODE_SELECT, IMX662_MODE_STREAMING);
+            delay_ms(30);
+            ret |= imx662_start_sync(dev);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to resume streaming");
+                break;
+            }
+            IMX662_PRIV(dev)->streaming = true;
+            ESP_LOGI(TAG, "IMX662 streaming resumed");
+        } else if (enable) {
             /* === DIAGNOSTIC: Read key registers before streaming === */
             ESP_LOGI(TAG, "=== IMX662 Pre-Stream Diagnostics ===");
             ESP_LOGI(TAG, "MIPI Config: bit_rate=%lu Mbps/lane, lanes=%d",
@@ -489,13 +1280,13 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
             /* Wait for PLL to stabilize - RPi uses 30ms */
             delay_ms(30);
 
-            /* Start master mode - XMSTA = 0x00 means START */
-            ret = imx662_write(dev->sccb_handle, IMX662_REG_XMASTER, 0x00);
+            /* Start master mode - XMSTA = 0x00 means START, unless XVS comes from a leader */
+            ret = imx662_start_sync(dev);
             if (ret != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to start XMASTER");
                 break;
             }
-            ESP_LOGI(TAG, "XMASTER started (0x00 = master mode ON)");
+            ESP_LOGI(TAG, "Frame timing started (sync mode %" PRIu32 ")", IMX662_PRIV(dev)->sync_mode);
 
             /* Verify streaming started */
             imx662_read(dev->sccb_handle, 0x3000, &reg_val);
@@ -504,6 +1295,8 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
             imx662_read(dev->sccb_handle, 0x3002, &reg_val);
             ESP_LOGI(TAG, "XMASTER after start = 0x%02X (expect 0x00)", reg_val);
 
+            IMX662_PRIV(dev)->streaming = true;
+            IMX662_PRIV(dev)->verified = true;
             ESP_LOGI(TAG, "IMX662 streaming started - sensor should now output MIPI data");
         } else {
             /* Stop streaming (from RPi driver):
@@ -514,6 +1307,7 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
             ret = imx662_write(dev->sccb_handle, IMX662_REG_MODE_SELECT, IMX662_MODE_STANDBY);
             delay_ms(30);
             ret |= imx662_write(dev->sccb_handle, IMX662_REG_XMASTER, 0x01);  /* 0x01 = STOP */
+            IMX662_PRIV(dev)->streaming = false;
             ESP_LOGI(TAG, "IMX662 streaming stopped");
         }
         break;
@@ -526,6 +1320,8 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
         ESP_LOGI(TAG, "Software reset requested");
         ret = imx662_write(dev->sccb_handle, IMX662_REG_MODE_SELECT, IMX662_MODE_STANDBY);
         delay_ms(10);
+        IMX662_PRIV(dev)->streaming = false;
+        imx662_shadow_invalidate(dev);
         break;
     default:
         ESP_LOGW(TAG, "Unknown ioctl cmd: 0x%lx", (unsigned long)cmd);
@@ -540,6 +1336,7 @@ static int imx662_priv_ioctl(esp_cam_sensor_device_t *dev, uint32_t cmd, void *a
 static int imx662_del(esp_cam_sensor_device_t *dev)
 {
     ESP_LOGD(TAG, "Deleting IMX662 device");
+    free(dev->priv);
     free(dev);
     return 0;
 }
@@ -585,6 +1382,13 @@ esp_cam_sensor_device_t *imx662_detect(esp_cam_sensor_config_t *config)
     dev->xclk_pin = config->xclk_pin;
     dev->sensor_port = config->sensor_port;
 
+    dev->priv = heap_caps_calloc(1, sizeof(imx662_priv_t), MALLOC_CAP_DEFAULT);
+    if (!dev->priv) {
+        ESP_LOGE(TAG, "Failed to allocate memory for driver state");
+        free(dev);
+        return NULL;
+    }
+
     /* Hardware reset if pin configured */
     ESP_LOGI(TAG, "Performing hardware reset (pin=%d)", dev->reset_pin);
     imx662_hw_reset(dev);
@@ -593,6 +1397,7 @@ esp_cam_sensor_device_t *imx662_detect(esp_cam_sensor_config_t *config)
     esp_cam_sensor_id_t sensor_id = {0};
     if (imx662_get_sensor_id(dev, &sensor_id) != ESP_OK) {
         ESP_LOGE(TAG, "IMX662 not detected - I2C communication failed");
+        free(dev->priv);
         free(dev);
         return NULL;
     }
@@ -606,6 +1411,7 @@ esp_cam_sensor_device_t *imx662_detect(esp_cam_sensor_config_t *config)
     ESP_LOGI(TAG, "Setting default format...");
     if (imx662_set_format(dev, &imx662_format_info[0]) != 0) {
         ESP_LOGE(TAG, "Failed to set default format");
+        free(dev->priv);
         free(dev);
         return NULL;
     }
@@ -29,6 +29,24 @@ extern "C" {
  */
 #define IMX662_SENSOR_NAME  "IMX662"
 
+/**
+ * @brief Frames between the frame being output when exposure or gain is
+ *        written and the first frame captured with the new values
+ *
+ * VMAX, SHR0 and GAIN are written under REGHOLD and latched together at the
+ * next frame start.
+ */
+#define IMX662_CTRL_DELAY_FRAMES    1
+
+/**
+ * @brief Long to short exposure ratio of the DOL-HDR format
+ *
+ * The driver keeps the short exposure at this fraction of the long one. Pass
+ * IMX662_DOL_EXPOSURE_RATIO * 16 as V4L2_CID_ESP_HDR_RATIO of the HDR merge
+ * device.
+ */
+#define IMX662_DOL_EXPOSURE_RATIO   16
+
 /**
  * @brief Detect and initialize IMX662 sensor
  *
@@ -29,6 +29,12 @@ extern "C" {
 #define IMX662_REG_MASTER_MODE          0x3002
 #define IMX662_REG_XMASTER              0x3002
 
+/* XVS/XHS pins: output selection and drive, Hi-Z makes them inputs */
+#define IMX662_REG_XVSOUTSEL            0x30A4
+#define IMX662_REG_XXS_DRV              0x30A6
+#define IMX662_XXS_DRV_OUTPUT           0x00
+#define IMX662_XXS_DRV_HIZ              0x0F
+
 /* Input clock selection */
 #define IMX662_REG_INCK_SEL             0x3014
 
@@ -37,9 +43,13 @@ extern "C" {
 
 /* Window mode */
 #define IMX662_REG_WINMODE              0x3018
+#define IMX662_WINMODE_ALL_PIXEL        0x00
+#define IMX662_WINMODE_CROP             0x04
 
 /* WD mode (HDR) */
 #define IMX662_REG_WDMODE               0x301A
+#define IMX662_WDMODE_NORMAL            0x00
+#define IMX662_WDMODE_DOL               0x01
 
 /* Binning mode */
 #define IMX662_REG_ADDMODE              0x301B
@@ -94,6 +104,14 @@ extern "C" {
 #define IMX662_REG_SHR0_M               0x3051
 #define IMX662_REG_SHR0_H               0x3052
 
+/* Short exposure shutter and readout start of DOL-HDR */
+#define IMX662_REG_SHR1_L               0x3054
+#define IMX662_REG_SHR1_M               0x3055
+#define IMX662_REG_SHR1_H               0x3056
+#define IMX662_REG_RHS1_L               0x3060
+#define IMX662_REG_RHS1_M               0x3061
+#define IMX662_REG_RHS1_H               0x3062
+
 /* Analog gain */
 #define IMX662_REG_GAIN_L               0x3070
 #define IMX662_REG_GAIN_H               0x3071
@@ -276,12 +276,11 @@ static const imx662_reginfo_t imx662_common_init_regs[] = {
 /*
  * 1920x1080 @ 30fps RAW12 - 2 lanes MIPI
  * Configuration that works with ESP32-P4:
- * - DATARATE_SEL = 0x06 (720 Mbps/lane)
+ * - DATARATE_SEL is set by the driver from the line period
  * - HMAX = 1980 (1H period), VMAX = 1250
  */
 static const imx662_reginfo_t imx662_1920x1080_30fps_2lane_raw12[] = {
     /* Mode specific settings */
-    {0x3015, IMX662_DATARATE_720MBPS},  /* 720 Mbps/lane - works with ESP32 */
     {0x301A, 0x00},  /* WDMODE = Normal (HDR mode select) */
     {0x301B, 0x00},  /* ADDMODE = Non-binning (Normal/binning) */
     {0x3022, 0x00},  /* ADBIT = 10bit (testing RAW10) */
@@ -343,6 +342,39 @@ static const imx662_reginfo_t imx662_1920x1080_60fps_2lane_raw12[] = {
     {IMX662_REG_END, 0x00},
 };
 
+/*
+ * 1936x1100 @ 60fps RAW10 - 2 lanes MIPI
+ * imx662_1920x1080_30fps_2lane_raw12 with half the line period. A 10-bit
+ * line takes 8.1us at 1188 Mbps/lane of the 13.3us line, the driver picks
+ * the lane rate.
+ * - HMAX = 990, VMAX = 1250
+ */
+static const imx662_reginfo_t imx662_1936x1100_60fps_2lane_raw10[] = {
+    {0x301A, 0x00},  /* WDMODE = Normal */
+    {0x301B, 0x00},  /* ADDMODE = Non-binning */
+    {0x3022, 0x00},  /* ADBIT = 10bit */
+    {0x3023, 0x00},  /* MDBIT = 10bit */
+
+    /* HMAX = 990 (0x03DE) */
+    {0x302C, 0xDE},  /* HMAX_L */
+    {0x302D, 0x03},  /* HMAX_H */
+
+    /* VMAX = 1250 (0x04E2) */
+    {0x3028, 0xE2},  /* VMAX_L */
+    {0x3029, 0x04},  /* VMAX_M */
+    {0x302A, 0x00},  /* VMAX_H */
+
+    /* Lane mode = 2 */
+    {0x3040, 0x01},
+
+    /* 10-bit AD conversion */
+    {0x3A50, 0x62},
+    {0x3A51, 0x01},
+    {0x3A52, 0x19},
+
+    {IMX662_REG_END, 0x00},
+};
+
 /*
  * 960x540 @ 90fps RAW12 - 2x2 Binning
  * From Linux driver mode_540_regs
@@ -373,6 +405,112 @@ static const imx662_reginfo_t imx662_960x540_90fps_2lane_raw12[] = {
     {IMX662_REG_END, 0x00},
 };
 
+/*
+ * 968x550 @ 60fps - 2x2 Binning, 2 lanes MIPI
+ * Binning settings of mode_540_regs above, the driver picks the lane rate.
+ * Binning output is 12-bit.
+ * - HMAX = 990, VMAX = 1250
+ */
+static const imx662_reginfo_t imx662_968x550_60fps_2lane_bin2x2[] = {
+    {0x301A, 0x00},  /* WDMODE = Normal */
+    {0x301B, 0x01},  /* ADDMODE = 2x2 Binning */
+    {0x3022, 0x00},  /* ADBIT = 10bit (for binning) */
+    {0x3023, 0x01},  /* MDBIT = 12bit */
+
+    /* HMAX = 990 (0x03DE) */
+    {0x302C, 0xDE},  /* HMAX_L */
+    {0x302D, 0x03},  /* HMAX_H */
+
+    /* VMAX = 1250 (0x04E2) */
+    {0x3028, 0xE2},  /* VMAX_L */
+    {0x3029, 0x04},  /* VMAX_M */
+    {0x302A, 0x00},  /* VMAX_H */
+
+    /* Lane mode = 2 */
+    {0x3040, 0x01},
+
+    /* AD conversion */
+    {0x3A50, 0x62},
+    {0x3A51, 0x01},
+    {0x3A52, 0x19},
+
+    {IMX662_REG_END, 0x00},
+};
+
+/*
+ * 968x550 @ 90fps - 2x2 Binning, 2 lanes MIPI
+ * imx662_968x550_60fps_2lane_bin2x2 with the frame shortened to 2/3. The
+ * line period of HMAX = 990 stays, so does the lane rate.
+ * - HMAX = 990, VMAX = 833
+ */
+static const imx662_reginfo_t imx662_968x550_90fps_2lane_bin2x2[] = {
+    {0x301A, 0x00},  /* WDMODE = Normal */
+    {0x301B, 0x01},  /* ADDMODE = 2x2 Binning */
+    {0x3022, 0x00},  /* ADBIT = 10bit (for binning) */
+    {0x3023, 0x01},  /* MDBIT = 12bit */
+
+    /* HMAX = 990 (0x03DE) */
+    {0x302C, 0xDE},  /* HMAX_L */
+    {0x302D, 0x03},  /* HMAX_H */
+
+    /* VMAX = 833 (0x0341) */
+    {0x3028, 0x41},  /* VMAX_L */
+    {0x3029, 0x03},  /* VMAX_M */
+    {0x302A, 0x00},  /* VMAX_H */
+
+    /* Lane mode = 2 */
+    {0x3040, 0x01},
+
+    /* AD conversion */
+    {0x3A50, 0x62},
+    {0x3A51, 0x01},
+    {0x3A52, 0x19},
+
+    {IMX662_REG_END, 0x00},
+};
+
+/*
+ * 1936x1100 @ 30fps DOL-HDR, 2 exposures - 2 lanes MIPI
+ * The long and the short exposure of each row are sent line interleaved on
+ * one virtual channel, so a frame has 2200 lines. The line period is that of
+ * the 30fps formats, the driver picks a lane rate for two lines per period.
+ * - HMAX = 1980, VMAX = 1250 (a DOL frame is 2 * VMAX lines)
+ * - RHS1 = 157, the short exposure is at most RHS1 - SHR1 = 152 lines
+ */
+static const imx662_reginfo_t imx662_1936x1100_30fps_2lane_dol2[] = {
+    {0x301A, 0x01},  /* WDMODE = DOL-HDR */
+    {0x301B, 0x00},  /* ADDMODE = Non-binning */
+    {0x3022, 0x00},  /* ADBIT = 10bit */
+    {0x3023, 0x00},  /* MDBIT = 10bit */
+
+    /* HMAX = 1980 (0x07BC) */
+    {0x302C, 0xBC},  /* HMAX_L */
+    {0x302D, 0x07},  /* HMAX_H */
+
+    /* VMAX = 1250 (0x04E2) */
+    {0x3028, 0xE2},  /* VMAX_L */
+    {0x3029, 0x04},  /* VMAX_M */
+    {0x302A, 0x00},  /* VMAX_H */
+
+    /* Lane mode = 2 */
+    {0x3040, 0x01},
+
+    /* SHR1 = 5, RHS1 = 157 (0x9D), the driver sets both exposures */
+    {0x3054, 0x05},  /* SHR1_L */
+    {0x3055, 0x00},  /* SHR1_M */
+    {0x3056, 0x00},  /* SHR1_H */
+    {0x3060, 0x9D},  /* RHS1_L */
+    {0x3061, 0x00},  /* RHS1_M */
+    {0x3062, 0x00},  /* RHS1_H */
+
+    /* 10-bit AD conversion */
+    {0x3A50, 0x62},
+    {0x3A51, 0x01},
+    {0x3A52, 0x19},
+
+    {IMX662_REG_END, 0x00},
+};
+
 #ifdef __cplusplus
 }
 #endif
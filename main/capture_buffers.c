@@ -0,0 +1,257 @@
+/*
+ * V4L2 capture buffer set
+ *
+ * MMAP buffers come from the video driver's own allocation. USERPTR buffers
+ * are allocated here with heap_caps_aligned_alloc(), the driver checks on
+ * QBUF that they are aligned to its cache line size and that they live in
+ * the memory its DMA writes to, a placement it cannot use is reported as
+ * ESP_ERR_NOT_SUPPORTED instead of failing on the first frame.
+ *
+ * MMAP buffers are also exported with VIDIOC_EXPBUF, so a downstream M2M
+ * device can import them as DMABUF output buffers without another copy.
+ */
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/errno.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_cache.h"
+#include "linux/videodev2.h"
+#include "esp_video_ioctl.h"
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+#include "esp_video_mem_pool.h"
+#endif
+#include "capture_buffers.h"
+
+#define CAPTURE_BUFFERS_PSRAM_CAPS      (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define CAPTURE_BUFFERS_INTERNAL_CAPS   (MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT)
+#define CAPTURE_BUFFERS_ALIGN(size, align)  (((size) + (align) - 1) & ~((align) - 1))
+
+/* Same placement as the MIPI-CSI driver's MMAP buffers */
+#if CONFIG_SPIRAM
+#define CAPTURE_BUFFERS_MMAP_CAPS       CAPTURE_BUFFERS_PSRAM_CAPS
+#else
+#define CAPTURE_BUFFERS_MMAP_CAPS       CAPTURE_BUFFERS_INTERNAL_CAPS
+#endif
+
+static const char *TAG = "capture_bufs";
+
+static const char *s_mem_names[] = {
+    [CAPTURE_BUFFERS_MEM_MMAP] = "mmap",
+    [CAPTURE_BUFFERS_MEM_PSRAM] = "psram",
+    [CAPTURE_BUFFERS_MEM_INTERNAL] = "internal",
+};
+
+static uint32_t capture_buffers_get_caps(capture_buffers_mem_t mem)
+{
+    switch (mem) {
+    case CAPTURE_BUFFERS_MEM_PSRAM:
+        return CAPTURE_BUFFERS_PSRAM_CAPS;
+    case CAPTURE_BUFFERS_MEM_INTERNAL:
+        return CAPTURE_BUFFERS_INTERNAL_CAPS;
+    default:
+        return CAPTURE_BUFFERS_MMAP_CAPS;
+    }
+}
+
+/* Start address alignment of USERPTR buffers, never below the cache line size */
+static esp_err_t capture_buffers_get_alignment(const capture_buffers_config_t *config, size_t *alignment)
+{
+    uint32_t caps = capture_buffers_get_caps(config->mem);
+
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(caps & ~MALLOC_CAP_8BIT, alignment), TAG, "failed to get cache alignment");
+    *alignment = MAX(*alignment, MAX(config->alignment, sizeof(uint32_t)));
+
+    return ESP_OK;
+}
+
+esp_err_t capture_buffers_alloc(int fd, const capture_buffers_config_t *config, capture_buffers_t *bufs)
+{
+    esp_err_t ret = ESP_OK;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    struct v4l2_exportbuffer expbuf;
+    size_t alignment = 0;
+
+    ESP_RETURN_ON_FALSE(fd >= 0 && config && bufs, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->count >= 1 && config->count <= CAPTURE_BUFFERS_MAX, ESP_ERR_INVALID_ARG,
+                        TAG, "buffer count must be 1 to %d", CAPTURE_BUFFERS_MAX);
+    ESP_RETURN_ON_FALSE(config->mem <= CAPTURE_BUFFERS_MEM_INTERNAL, ESP_ERR_INVALID_ARG, TAG, "invalid buffer memory");
+    ESP_RETURN_ON_FALSE(!(config->alignment & (config->alignment - 1)), ESP_ERR_INVALID_ARG,
+                        TAG, "alignment must be a power of two");
+
+    memset(bufs, 0, sizeof(capture_buffers_t));
+    memset(bufs->dmabuf, 0xff, sizeof(bufs->dmabuf));
+    bufs->fd = fd;
+    bufs->config = *config;
+    bufs->memory = config->mem == CAPTURE_BUFFERS_MEM_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+    if (bufs->memory == V4L2_MEMORY_USERPTR) {
+        ESP_RETURN_ON_ERROR(capture_buffers_get_alignment(config, &alignment), TAG, "failed to get alignment");
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.count = config->count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = bufs->memory;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, TAG, "REQBUFS failed");
+
+    for (uint32_t i = 0; i < config->count; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = bufs->memory;
+        buf.index = i;
+        ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, fail, TAG, "QUERYBUF failed");
+
+        if (bufs->memory == V4L2_MEMORY_MMAP) {
+            bufs->data[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+            ESP_GOTO_ON_FALSE(bufs->data[i] != MAP_FAILED, ESP_ERR_NO_MEM, fail, TAG, "mmap failed");
+            bufs->size = buf.length;
+
+            /* Not fatal, consumers fall back to passing the mapped pointer */
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            expbuf.index = i;
+            bufs->dmabuf[i] = ioctl(fd, VIDIOC_EXPBUF, &expbuf) == 0 ? expbuf.fd : -1;
+        } else {
+            bufs->size = CAPTURE_BUFFERS_ALIGN(buf.length, alignment);
+            bufs->data[i] = heap_caps_aligned_alloc(alignment, bufs->size, capture_buffers_get_caps(config->mem));
+            ESP_GOTO_ON_FALSE(bufs->data[i], ESP_ERR_NO_MEM, fail, TAG, "failed to allocate %"PRIu32" byte buffer in %s",
+                              bufs->size, capture_buffers_mem_to_str(config->mem));
+        }
+        bufs->count++;
+    }
+
+    ret = capture_buffers_queue_all(bufs);
+    if (ret != ESP_OK) {
+        /* The driver only accepts USERPTR buffers in the memory it allocates its own from */
+        if (bufs->memory == V4L2_MEMORY_USERPTR) {
+            ESP_LOGE(TAG, "%s buffers rejected by the driver", capture_buffers_mem_to_str(config->mem));
+            ret = ESP_ERR_NOT_SUPPORTED;
+        }
+        goto fail;
+    }
+
+    ESP_LOGI(TAG, "%"PRIu32" x %"PRIu32" byte buffers in %s", bufs->count, bufs->size,
+             capture_buffers_mem_to_str(config->mem));
+#if CONFIG_ESP_VIDEO_ENABLE_MEM_POOL
+    esp_video_mem_pool_stats_t stats;
+    if (bufs->memory == V4L2_MEMORY_MMAP && esp_video_mem_pool_get_stats(&stats) == ESP_OK) {
+        ESP_LOGI(TAG, "Video memory pool: %zu of %zu KB used, peak %zu KB, %"PRIu32" heap fallbacks",
+                 stats.used_size / 1024, stats.arena_size / 1024, stats.peak_used_size / 1024,
+                 stats.heap_fallback_count);
+    }
+#endif
+    return ESP_OK;
+
+fail:
+    capture_buffers_free(bufs);
+    return ret;
+}
+
+void capture_buffers_free(capture_buffers_t *bufs)
+{
+    if (bufs->memory == V4L2_MEMORY_USERPTR) {
+        for (uint32_t i = 0; i < bufs->count; i++) {
+            heap_caps_free(bufs->data[i]);
+        }
+    }
+
+    memset(bufs->data, 0, sizeof(bufs->data));
+    memset(bufs->dmabuf, 0xff, sizeof(bufs->dmabuf));
+    bufs->count = 0;
+}
+
+static void capture_buffers_fill(const capture_buffers_t *bufs, uint32_t index, struct v4l2_buffer *buf)
+{
+    memset(buf, 0, sizeof(struct v4l2_buffer));
+    buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf->memory = bufs->memory;
+    buf->index = index;
+    /* The application only reads capture buffers, a copy out of them needs no cache write back */
+    buf->flags = V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+    if (bufs->memory == V4L2_MEMORY_USERPTR) {
+        buf->m.userptr = (unsigned long)bufs->data[index];
+        buf->length = bufs->size;
+    }
+}
+
+esp_err_t capture_buffers_queue(const capture_buffers_t *bufs, uint32_t index)
+{
+    struct v4l2_buffer buf;
+
+    capture_buffers_fill(bufs, index, &buf);
+    if (ioctl(bufs->fd, VIDIOC_QBUF, &buf) != 0) {
+        ESP_LOGE(TAG, "QBUF %"PRIu32" failed (errno=%d)", index, errno);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t capture_buffers_queue_all(const capture_buffers_t *bufs)
+{
+    struct v4l2_buffer buf[CAPTURE_BUFFERS_MAX];
+    struct esp_video_buffer_batch batch = {
+        .buffers = buf,
+        .count = bufs->count,
+    };
+
+    for (uint32_t i = 0; i < bufs->count; i++) {
+        capture_buffers_fill(bufs, i, &buf[i]);
+    }
+    /* One call for the whole set instead of a VFS round trip per buffer */
+    if (ioctl(bufs->fd, VIDIOC_QBUF_BATCH, &batch) != 0) {
+        ESP_LOGE(TAG, "QBUF %"PRIu32" of %"PRIu32" failed (errno=%d)", batch.done, bufs->count, errno);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void capture_buffers_get_budget(const capture_buffers_t *bufs, const capture_buffers_config_t *config,
+                                capture_buffers_budget_t *budget)
+{
+    size_t alignment = 0;
+
+    memset(budget, 0, sizeof(capture_buffers_budget_t));
+    budget->caps = capture_buffers_get_caps(config->mem);
+    budget->buffer_size = bufs->size;
+    if (config->mem != CAPTURE_BUFFERS_MEM_MMAP && capture_buffers_get_alignment(config, &alignment) == ESP_OK) {
+        budget->buffer_size = CAPTURE_BUFFERS_ALIGN(bufs->size, alignment);
+    }
+    budget->required = budget->buffer_size * config->count;
+    if (capture_buffers_get_caps(bufs->config.mem) == budget->caps) {
+        budget->in_use = (size_t)bufs->size * bufs->count;
+    }
+    budget->free = heap_caps_get_free_size(budget->caps);
+    budget->largest_block = heap_caps_get_largest_free_block(budget->caps);
+
+    /* Every buffer freed first leaves a block of at least its own size */
+    budget->fits = budget->free + budget->in_use >= budget->required &&
+                   (budget->largest_block >= budget->buffer_size || budget->in_use >= budget->buffer_size);
+}
+
+esp_err_t capture_buffers_mem_from_str(const char *str, capture_buffers_mem_t *mem)
+{
+    for (int i = 0; i < sizeof(s_mem_names) / sizeof(s_mem_names[0]); i++) {
+        if (!strcmp(str, s_mem_names[i])) {
+            *mem = (capture_buffers_mem_t)i;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+const char *capture_buffers_mem_to_str(capture_buffers_mem_t mem)
+{
+    if (mem >= sizeof(s_mem_names) / sizeof(s_mem_names[0])) {
+        return "unknown";
+    }
+
+    return s_mem_names[mem];
+}
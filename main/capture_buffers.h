@@ -0,0 +1,176 @@
+/*
+ * V4L2 capture buffer set
+ *
+ * Requests, maps or allocates and queues the capture buffers of a video
+ * device. The count, the memory the buffers live in and their alignment are
+ * plain runtime values, so they can be tuned without a rebuild: driver
+ * allocated MMAP buffers, or USERPTR buffers allocated here from PSRAM or
+ * internal RAM.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Maximum number of capture buffers
+ */
+#define CAPTURE_BUFFERS_MAX     16
+
+/**
+ * @brief Where the capture buffers are allocated
+ */
+typedef enum {
+    CAPTURE_BUFFERS_MEM_MMAP = 0,   /*!< Allocated by the video driver and mapped */
+    CAPTURE_BUFFERS_MEM_PSRAM,      /*!< USERPTR buffers in PSRAM */
+    CAPTURE_BUFFERS_MEM_INTERNAL,   /*!< USERPTR buffers in internal DMA capable RAM */
+} capture_buffers_mem_t;
+
+/**
+ * @brief Capture buffer configuration
+ */
+typedef struct {
+    uint32_t count;                 /*!< Number of buffers, 1 to CAPTURE_BUFFERS_MAX */
+    capture_buffers_mem_t mem;      /*!< Buffer memory */
+    uint32_t alignment;             /*!< Start address alignment of USERPTR buffers, a power of two,
+                                         0 for the cache line size. Ignored for MMAP buffers */
+} capture_buffers_config_t;
+
+/**
+ * @brief Default configuration from Kconfig
+ */
+#if CONFIG_EXAMPLE_CAMERA_BUFFER_MEM_PSRAM
+#define CAPTURE_BUFFERS_DEFAULT_MEM     CAPTURE_BUFFERS_MEM_PSRAM
+#elif CONFIG_EXAMPLE_CAMERA_BUFFER_MEM_INTERNAL
+#define CAPTURE_BUFFERS_DEFAULT_MEM     CAPTURE_BUFFERS_MEM_INTERNAL
+#else
+#define CAPTURE_BUFFERS_DEFAULT_MEM     CAPTURE_BUFFERS_MEM_MMAP
+#endif
+
+#define CAPTURE_BUFFERS_DEFAULT_CONFIG()                    \
+    {                                                       \
+        .count = CONFIG_EXAMPLE_CAMERA_VIDEO_BUFFER_NUMBER, \
+        .mem = CAPTURE_BUFFERS_DEFAULT_MEM,                 \
+        .alignment = 0,                                     \
+    }
+
+/**
+ * @brief Capture buffer set
+ */
+typedef struct {
+    int fd;                                 /*!< Video device */
+    capture_buffers_config_t config;        /*!< Configuration the buffers were allocated with */
+    uint32_t memory;                        /*!< V4L2 memory type for QBUF and DQBUF */
+    uint32_t count;                         /*!< Number of buffers */
+    uint32_t size;                          /*!< Size of one buffer in bytes */
+    uint8_t *data[CAPTURE_BUFFERS_MAX];     /*!< Buffer pointers, indexed by V4L2 buffer index */
+    int dmabuf[CAPTURE_BUFFERS_MAX];        /*!< DMABUF handles of exported MMAP buffers, -1 if not exported */
+} capture_buffers_t;
+
+/**
+ * @brief Memory budget of a buffer configuration
+ */
+typedef struct {
+    uint32_t caps;          /*!< Heap capabilities the buffers are allocated with */
+    size_t buffer_size;     /*!< Size of one buffer */
+    size_t required;        /*!< Size of all buffers */
+    size_t in_use;          /*!< Size of the current buffers in the same heap, freed before allocating */
+    size_t free;            /*!< Free size of the heap */
+    size_t largest_block;   /*!< Largest free block of the heap */
+    bool fits;              /*!< The configuration is expected to fit */
+} capture_buffers_budget_t;
+
+/**
+ * @brief Request and allocate the capture buffers and queue all of them
+ *
+ * The size of the buffers follows the format currently set on the device.
+ * Streaming must be off, buffers of a previous call must have been freed
+ * with capture_buffers_free().
+ *
+ * @param fd     Video device file descriptor
+ * @param config Buffer configuration
+ * @param bufs   Returned buffer set
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_NO_MEM if the buffers could not be allocated
+ *      - ESP_ERR_NOT_SUPPORTED if the driver rejects the buffer memory
+ *      - Others if failed
+ */
+esp_err_t capture_buffers_alloc(int fd, const capture_buffers_config_t *config, capture_buffers_t *bufs);
+
+/**
+ * @brief Free USERPTR buffers, MMAP buffers are reused or released by the next REQBUFS
+ *
+ * Streaming must be off.
+ *
+ * @param bufs Buffer set
+ */
+void capture_buffers_free(capture_buffers_t *bufs);
+
+/**
+ * @brief Queue one buffer
+ *
+ * @param bufs  Buffer set
+ * @param index Buffer index
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if QBUF failed
+ */
+esp_err_t capture_buffers_queue(const capture_buffers_t *bufs, uint32_t index);
+
+/**
+ * @brief Queue all buffers of the set with one VIDIOC_QBUF_BATCH call
+ *
+ * @param bufs  Buffer set, every buffer must be dequeued
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if a buffer was refused, the buffers before it stay queued
+ */
+esp_err_t capture_buffers_queue_all(const capture_buffers_t *bufs);
+
+/**
+ * @brief Estimate whether a configuration fits in memory
+ *
+ * @param bufs   Current buffer set, its buffer size is used for the estimate
+ * @param config Configuration to check
+ * @param budget Returned budget
+ */
+void capture_buffers_get_budget(const capture_buffers_t *bufs, const capture_buffers_config_t *config,
+                                capture_buffers_budget_t *budget);
+
+/**
+ * @brief Parse a buffer memory name ("mmap", "psram" or "internal")
+ *
+ * @param str Memory name
+ * @param mem Returned memory
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the name is unknown
+ */
+esp_err_t capture_buffers_mem_from_str(const char *str, capture_buffers_mem_t *mem);
+
+/**
+ * @brief Get the name of a buffer memory
+ *
+ * @param mem Buffer memory
+ *
+ * @return Memory name
+ */
+const char *capture_buffers_mem_to_str(capture_buffers_mem_t mem);
+
+#ifdef __cplusplus
+}
+#endif
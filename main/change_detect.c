@@ -0,0 +1,234 @@
+/*
+ * Change detection for the HTTP streamer
+ *
+ * The thumbnail samples the luma of every CONFIG_EXAMPLE_CHANGE_DETECT_STEP-th
+ * pixel of every CONFIG_EXAMPLE_CHANGE_DETECT_STEP-th row, so only a fraction
+ * of the camera frame is read. Thumbnail rows are padded to 16 samples with
+ * zeros, which match in both thumbnails. The absolute differences of the rows
+ * of a block row are summed into a 16-bit accumulator, on the ESP32-P4 with
+ * the PIE kernel in change_detect_sad_pie.S, then every 16 accumulated columns
+ * give the sum of absolute differences of one block.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#include "change_detect.h"
+
+#define CHANGE_DETECT_STEP          CONFIG_EXAMPLE_CHANGE_DETECT_STEP
+#define CHANGE_DETECT_THRESHOLD     CONFIG_EXAMPLE_CHANGE_DETECT_THRESHOLD
+#define CHANGE_DETECT_MIN_BLOCKS    CONFIG_EXAMPLE_CHANGE_DETECT_MIN_BLOCKS
+#define CHANGE_DETECT_PIE_ALIGN     16      /* esp.vld.128 needs 16-byte aligned addresses */
+#define CHANGE_DETECT_ALIGN(size, align)    (((size) + (align) - 1) & ~((align) - 1))
+#define CHANGE_DETECT_DIV_ROUND_UP(n, d)    (((n) + (d) - 1) / (d))
+
+#if CONFIG_EXAMPLE_CHANGE_DETECT_PIE
+extern void change_detect_sad_pie(const uint8_t *a, const uint8_t *b, uint16_t *acc, uint32_t size);
+#endif
+
+static const char *TAG = "change_detect";
+
+struct change_detect {
+    uint32_t pixel_format;
+    uint32_t max_width;
+    uint32_t max_height;
+    uint32_t width;             /* Frame geometry of the thumbnails, 0 before the first frame */
+    uint32_t height;
+    uint32_t thumb_width;
+    uint32_t thumb_height;
+    uint32_t stride;            /* Thumbnail row size, a multiple of the block size */
+    uint8_t *thumb[2];          /* Thumbnails of the reference and of the last processed frame */
+    uint32_t ref;               /* Index of the reference thumbnail */
+    bool has_ref;
+    bool processed;             /* The other thumbnail holds a frame that can become the reference */
+    uint16_t *acc;              /* Column sums of one block row */
+    uint32_t *mask;
+};
+
+/* acc[i] += |a[i] - b[i]| for one thumbnail row, size is a multiple of 16 */
+static void change_detect_sad_row(const uint8_t *a, const uint8_t *b, uint16_t *acc, uint32_t size)
+{
+#if CONFIG_EXAMPLE_CHANGE_DETECT_PIE
+    change_detect_sad_pie(a, b, acc, size);
+#else
+    for (uint32_t i = 0; i < size; i++) {
+        acc[i] += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+#endif
+}
+
+static void change_detect_sample(const change_detect_t *cd, const frame_t *frame, uint8_t *thumb)
+{
+    for (uint32_t y = 0; y < cd->thumb_height; y++) {
+        uint8_t *dst = thumb + y * cd->stride;
+
+        if (cd->pixel_format == V4L2_PIX_FMT_RGB24) {
+            const uint8_t *src = frame->data + y * CHANGE_DETECT_STEP * frame->width * 3;
+
+            for (uint32_t x = 0; x < cd->thumb_width; x++) {
+                dst[x] = (77 * src[0] + 150 * src[1] + 29 * src[2]) >> 8;
+                src += CHANGE_DETECT_STEP * 3;
+            }
+        } else {
+            /* Planar YUV, the luma plane comes first */
+            const uint8_t *src = frame->data + y * CHANGE_DETECT_STEP * frame->width;
+
+            for (uint32_t x = 0; x < cd->thumb_width; x++) {
+                dst[x] = src[x * CHANGE_DETECT_STEP];
+            }
+        }
+    }
+}
+
+/* Start over without a reference for frames of a new geometry */
+static void change_detect_set_geometry(change_detect_t *cd, uint32_t width, uint32_t height)
+{
+    cd->width = width;
+    cd->height = height;
+    cd->thumb_width = width / CHANGE_DETECT_STEP;
+    cd->thumb_height = height / CHANGE_DETECT_STEP;
+    cd->stride = CHANGE_DETECT_ALIGN(cd->thumb_width, CHANGE_DETECT_BLOCK_SIZE);
+    cd->has_ref = false;
+    cd->processed = false;
+
+    /* The padding of every row must read as zero in both thumbnails */
+    for (int i = 0; i < 2; i++) {
+        memset(cd->thumb[i], 0, cd->stride * cd->thumb_height);
+    }
+}
+
+esp_err_t change_detect_create(uint32_t max_width, uint32_t max_height, uint32_t pixel_format, change_detect_t **ret_cd)
+{
+    esp_err_t ret = ESP_OK;
+    change_detect_t *cd;
+    uint32_t stride = CHANGE_DETECT_ALIGN(max_width / CHANGE_DETECT_STEP, CHANGE_DETECT_BLOCK_SIZE);
+    uint32_t thumb_height = max_height / CHANGE_DETECT_STEP;
+    uint32_t blocks = (stride / CHANGE_DETECT_BLOCK_SIZE) * CHANGE_DETECT_DIV_ROUND_UP(thumb_height, CHANGE_DETECT_BLOCK_SIZE);
+
+    ESP_RETURN_ON_FALSE(ret_cd && stride && thumb_height, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(pixel_format == V4L2_PIX_FMT_RGB24 || pixel_format == V4L2_PIX_FMT_YUV422P ||
+                        pixel_format == V4L2_PIX_FMT_YUV420, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "change detection needs RGB888 or planar YUV frames");
+
+    cd = calloc(1, sizeof(change_detect_t));
+    ESP_RETURN_ON_FALSE(cd, ESP_ERR_NO_MEM, TAG, "failed to allocate detector");
+
+    /* Thumbnails and the accumulator are walked for every frame, keep them in internal RAM */
+    for (int i = 0; i < 2; i++) {
+        cd->thumb[i] = heap_caps_aligned_alloc(CHANGE_DETECT_PIE_ALIGN, stride * thumb_height,
+                                               MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        ESP_GOTO_ON_FALSE(cd->thumb[i], ESP_ERR_NO_MEM, fail, TAG, "failed to allocate thumbnail");
+    }
+    cd->acc = heap_caps_aligned_alloc(CHANGE_DETECT_PIE_ALIGN, stride * sizeof(uint16_t),
+                                      MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(cd->acc, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate accumulator");
+    cd->mask = calloc(CHANGE_DETECT_DIV_ROUND_UP(blocks, 32), sizeof(uint32_t));
+    ESP_GOTO_ON_FALSE(cd->mask, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate block mask");
+
+    cd->pixel_format = pixel_format;
+    cd->max_width = max_width;
+    cd->max_height = max_height;
+    *ret_cd = cd;
+    return ESP_OK;
+
+fail:
+    change_detect_delete(cd);
+    return ret;
+}
+
+esp_err_t change_detect_process(change_detect_t *cd, const frame_t *frame, change_detect_result_t *result)
+{
+    uint32_t bytes_per_pixel = cd->pixel_format == V4L2_PIX_FMT_RGB24 ? 3 : 1;
+    uint8_t *cur;
+    const uint8_t *ref;
+
+    if (frame->width > cd->max_width || frame->height > cd->max_height ||
+            frame->size < frame->width * frame->height * bytes_per_pixel) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (frame->width != cd->width || frame->height != cd->height) {
+        change_detect_set_geometry(cd, frame->width, frame->height);
+    }
+
+    cur = cd->thumb[cd->ref ^ 1];
+    ref = cd->thumb[cd->ref];
+    change_detect_sample(cd, frame, cur);
+    cd->processed = true;
+
+    result->cols = cd->stride / CHANGE_DETECT_BLOCK_SIZE;
+    result->rows = CHANGE_DETECT_DIV_ROUND_UP(cd->thumb_height, CHANGE_DETECT_BLOCK_SIZE);
+    result->mask = cd->mask;
+    memset(cd->mask, 0, CHANGE_DETECT_DIV_ROUND_UP(result->cols * result->rows, 32) * sizeof(uint32_t));
+
+    /* Frames smaller than one sample have nothing to compare */
+    if (!cd->has_ref || !cd->thumb_width || !cd->thumb_height) {
+        for (uint32_t i = 0; i < result->cols * result->rows; i++) {
+            cd->mask[i / 32] |= 1u << (i % 32);
+        }
+        result->changed_blocks = result->cols * result->rows;
+        result->changed = true;
+        return ESP_OK;
+    }
+
+    result->changed_blocks = 0;
+    for (uint32_t by = 0; by < result->rows; by++) {
+        uint32_t y = by * CHANGE_DETECT_BLOCK_SIZE;
+        uint32_t rows = MIN(CHANGE_DETECT_BLOCK_SIZE, cd->thumb_height - y);
+        const uint16_t *acc = cd->acc;
+
+        memset(cd->acc, 0, cd->stride * sizeof(uint16_t));
+        for (uint32_t row = 0; row < rows; row++) {
+            change_detect_sad_row(cur + (y + row) * cd->stride, ref + (y + row) * cd->stride, cd->acc, cd->stride);
+        }
+
+        for (uint32_t bx = 0; bx < result->cols; bx++) {
+            uint32_t x = bx * CHANGE_DETECT_BLOCK_SIZE;
+            uint32_t samples = rows * MIN(CHANGE_DETECT_BLOCK_SIZE, cd->thumb_width - x);
+            uint32_t sad = 0;
+
+            for (uint32_t i = 0; i < CHANGE_DETECT_BLOCK_SIZE; i++) {
+                sad += acc[i];
+            }
+            acc += CHANGE_DETECT_BLOCK_SIZE;
+
+            /* The threshold is a mean difference per sample, edge blocks have fewer samples */
+            if (sad > CHANGE_DETECT_THRESHOLD * samples) {
+                uint32_t i = by * result->cols + bx;
+
+                cd->mask[i / 32] |= 1u << (i % 32);
+                result->changed_blocks++;
+            }
+        }
+    }
+    result->changed = result->changed_blocks >= CHANGE_DETECT_MIN_BLOCKS;
+
+    return ESP_OK;
+}
+
+void change_detect_update_reference(change_detect_t *cd)
+{
+    if (cd->processed) {
+        cd->ref ^= 1;
+        cd->has_ref = true;
+        cd->processed = false;
+    }
+}
+
+void change_detect_delete(change_detect_t *cd)
+{
+    if (!cd) {
+        return;
+    }
+
+    heap_caps_free(cd->thumb[0]);
+    heap_caps_free(cd->thumb[1]);
+    heap_caps_free(cd->acc);
+    free(cd->mask);
+    free(cd);
+}
@@ -0,0 +1,90 @@
+/*
+ * Change detection for the HTTP streamer
+ *
+ * A detector keeps a luma thumbnail of the last frame its client was sent,
+ * one sample every CONFIG_EXAMPLE_CHANGE_DETECT_STEP pixels in both directions.
+ * Each new frame is sampled the same way and compared block by block with the
+ * sum of absolute differences, so a stream can skip frames of a static scene
+ * and tell the client which blocks of a sent frame changed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHANGE_DETECT_BLOCK_SIZE    16      /* Thumbnail samples per block side */
+
+/**
+ * @brief Change detector handle
+ */
+typedef struct change_detect change_detect_t;
+
+/**
+ * @brief Result of one frame
+ */
+typedef struct {
+    bool changed;               /*!< The frame differs from the reference, always true without one */
+    uint32_t changed_blocks;    /*!< Blocks over the threshold */
+    uint32_t cols;              /*!< Blocks per row */
+    uint32_t rows;              /*!< Block rows */
+    const uint32_t *mask;       /*!< One bit per block in row-major order, valid until the next change_detect_process() */
+} change_detect_result_t;
+
+/**
+ * @brief Create a change detector
+ *
+ * @param max_width    Largest frame width, used to size the thumbnails
+ * @param max_height   Largest frame height, used to size the thumbnails
+ * @param pixel_format Frame pixel format, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUV422P or V4L2_PIX_FMT_YUV420
+ * @param ret_cd       Returned detector
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format has no luma to sample
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+esp_err_t change_detect_create(uint32_t max_width, uint32_t max_height, uint32_t pixel_format, change_detect_t **ret_cd);
+
+/**
+ * @brief Compare a frame with the reference
+ *
+ * A frame of other geometry than the reference, e.g. after the capture
+ * window changed, has no reference and counts as changed.
+ *
+ * @param cd     Detector
+ * @param frame  Frame to compare
+ * @param result Returned result
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the frame is larger than the detector was created for
+ */
+esp_err_t change_detect_process(change_detect_t *cd, const frame_t *frame, change_detect_result_t *result);
+
+/**
+ * @brief Make the frame of the last change_detect_process() the reference
+ *
+ * Called once the frame was sent, so slow changes add up against the frame
+ * the client shows until they cross the threshold.
+ *
+ * @param cd Detector
+ */
+void change_detect_update_reference(change_detect_t *cd);
+
+/**
+ * @brief Delete a change detector
+ *
+ * @param cd Detector, can be NULL
+ */
+void change_detect_delete(change_detect_t *cd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,345 @@
+/*
+ * DNG writer for RAW10 Bayer frames
+ *
+ * The file is a little endian TIFF with the raw image in IFD0: the tags
+ * first, then the tag values that do not fit in an entry, then the preview
+ * SubIFD laid out the same way followed by its JPEG data, if there is a
+ * preview, and last the image strip. Values that need a calibration this
+ * example does not have (the color matrix) are written as neutral defaults.
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sys/param.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "linux/videodev2.h"
+#include "dng_writer.h"
+
+#define DNG_MAX_ENTRIES         32
+#define DNG_MAX_EXTRA           512
+#define DNG_STRIP_ALIGN         16
+#define DNG_CHUNK_SIZE          (16 * 1024)     /* Converted bytes per write */
+
+#define TIFF_BYTE               1
+#define TIFF_ASCII              2
+#define TIFF_SHORT              3
+#define TIFF_LONG               4
+#define TIFF_RATIONAL           5
+#define TIFF_SRATIONAL          10
+
+#define TAG_NEW_SUBFILE_TYPE    254
+#define TAG_IMAGE_WIDTH         256
+#define TAG_IMAGE_LENGTH        257
+#define TAG_BITS_PER_SAMPLE     258
+#define TAG_COMPRESSION         259
+#define TAG_PHOTOMETRIC         262
+#define TAG_MAKE                271
+#define TAG_MODEL               272
+#define TAG_STRIP_OFFSETS       273
+#define TAG_ORIENTATION         274
+#define TAG_SAMPLES_PER_PIXEL   277
+#define TAG_ROWS_PER_STRIP      278
+#define TAG_STRIP_BYTE_COUNTS   279
+#define TAG_PLANAR_CONFIG       284
+#define TAG_SUB_IFDS            330
+#define TAG_YCBCR_SUBSAMPLING   530
+#define TAG_CFA_REPEAT_DIM      33421
+#define TAG_CFA_PATTERN         33422
+#define TAG_EXPOSURE_TIME       33434
+#define TAG_ISO_SPEED           34855
+#define TAG_DNG_VERSION         50706
+#define TAG_DNG_BACKWARD        50707
+#define TAG_UNIQUE_MODEL        50708
+#define TAG_BLACK_LEVEL         50714
+#define TAG_WHITE_LEVEL         50717
+#define TAG_COLOR_MATRIX1       50721
+#define TAG_ILLUMINANT1         50778
+#define TAG_PREVIEW_COLOR_SPACE 50970
+
+#define SUBFILE_REDUCED         1
+#define COMPRESSION_JPEG        7
+#define PHOTOMETRIC_YCBCR       6
+#define PHOTOMETRIC_CFA         32803
+#define PREVIEW_COLOR_SPACE_SRGB    2
+#define ILLUMINANT_D65          21
+
+typedef struct __attribute__((packed)) {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    uint32_t value;         /* Value if it fits in 4 bytes, or else its offset in the extra area */
+} dng_entry_t;
+
+typedef struct {
+    dng_entry_t entries[DNG_MAX_ENTRIES];
+    bool in_extra[DNG_MAX_ENTRIES];
+    uint16_t count;
+    uint8_t extra[DNG_MAX_EXTRA];
+    uint32_t extra_size;
+} dng_ifd_t;
+
+static const char *TAG = "dng_writer";
+
+static const uint8_t s_type_size[] = {
+    [TIFF_BYTE] = 1, [TIFF_ASCII] = 1, [TIFF_SHORT] = 2, [TIFF_LONG] = 4, [TIFF_RATIONAL] = 8, [TIFF_SRATIONAL] = 8,
+};
+
+/* Entries must be added in ascending tag order */
+static void dng_add(dng_ifd_t *ifd, uint16_t tag, uint16_t type, uint32_t count, const void *value)
+{
+    dng_entry_t *entry = &ifd->entries[ifd->count];
+    uint32_t size = s_type_size[type] * count;
+
+    entry->tag = tag;
+    entry->type = type;
+    entry->count = count;
+    entry->value = 0;
+    if (size <= sizeof(entry->value)) {
+        memcpy(&entry->value, value, size);
+        ifd->in_extra[ifd->count] = false;
+    } else {
+        assert(ifd->extra_size + size <= DNG_MAX_EXTRA);
+        entry->value = ifd->extra_size;
+        memcpy(ifd->extra + ifd->extra_size, value, size);
+        ifd->extra_size += (size + 1) & ~1;     /* Values start on a word boundary */
+        ifd->in_extra[ifd->count] = true;
+    }
+    ifd->count++;
+}
+
+static void dng_add_short(dng_ifd_t *ifd, uint16_t tag, uint16_t value)
+{
+    dng_add(ifd, tag, TIFF_SHORT, 1, &value);
+}
+
+static void dng_add_long(dng_ifd_t *ifd, uint16_t tag, uint32_t value)
+{
+    dng_add(ifd, tag, TIFF_LONG, 1, &value);
+}
+
+static void dng_add_string(dng_ifd_t *ifd, uint16_t tag, const char *value)
+{
+    dng_add(ifd, tag, TIFF_ASCII, strlen(value) + 1, value);
+}
+
+/* Offsets are known once every IFD is laid out, SubIFDs and strip offsets were added as 0 */
+static void dng_place(dng_ifd_t *ifd, uint32_t extra_offset, uint32_t strip_offset, uint32_t sub_ifd_offset)
+{
+    for (uint16_t i = 0; i < ifd->count; i++) {
+        if (ifd->in_extra[i]) {
+            ifd->entries[i].value += extra_offset;
+        } else if (ifd->entries[i].tag == TAG_STRIP_OFFSETS) {
+            ifd->entries[i].value = strip_offset;
+        } else if (ifd->entries[i].tag == TAG_SUB_IFDS) {
+            ifd->entries[i].value = sub_ifd_offset;
+        }
+    }
+}
+
+static uint32_t dng_ifd_size(const dng_ifd_t *ifd)
+{
+    /* Entry count, entries, next IFD offset */
+    return 2 + ifd->count * sizeof(dng_entry_t) + 4;
+}
+
+static bool dng_write_ifd(FILE *file, const dng_ifd_t *ifd)
+{
+    const uint32_t next_ifd = 0;
+
+    return fwrite(&ifd->count, 1, sizeof(ifd->count), file) == sizeof(ifd->count) &&
+           fwrite(ifd->entries, sizeof(dng_entry_t), ifd->count, file) == ifd->count &&
+           fwrite(&next_ifd, 1, sizeof(next_ifd), file) == sizeof(next_ifd) &&
+           fwrite(ifd->extra, 1, ifd->extra_size, file) == ifd->extra_size;
+}
+
+static esp_err_t dng_get_cfa_pattern(uint32_t pixel_format, uint8_t pattern[4])
+{
+    /* 0 = red, 1 = green, 2 = blue, top left first */
+    static const uint8_t rggb[4] = {0, 1, 1, 2};
+    static const uint8_t bggr[4] = {2, 1, 1, 0};
+    static const uint8_t gbrg[4] = {1, 2, 0, 1};
+    static const uint8_t grbg[4] = {1, 0, 2, 1};
+
+    switch (pixel_format) {
+    case V4L2_PIX_FMT_SRGGB10:
+        memcpy(pattern, rggb, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SBGGR10:
+        memcpy(pattern, bggr, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SGBRG10:
+        memcpy(pattern, gbrg, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SGRBG10:
+        memcpy(pattern, grbg, 4);
+        return ESP_OK;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+/* MIPI RAW10 packs four high bytes and a byte with the four pairs of low bits */
+static void dng_convert_line(const uint8_t *in, uint8_t *out, uint32_t width, dng_writer_layout_t layout)
+{
+    uint16_t *out16 = (uint16_t *)out;
+
+    for (uint32_t x = 0; x < width; x += 4, in += 5) {
+        uint16_t p0 = (in[0] << 2) | (in[4] & 0x03);
+        uint16_t p1 = (in[1] << 2) | ((in[4] >> 2) & 0x03);
+        uint16_t p2 = (in[2] << 2) | ((in[4] >> 4) & 0x03);
+        uint16_t p3 = (in[3] << 2) | ((in[4] >> 6) & 0x03);
+
+        if (layout == DNG_WRITER_LAYOUT_UNPACKED16) {
+            *out16++ = p0;
+            *out16++ = p1;
+            *out16++ = p2;
+            *out16++ = p3;
+        } else {
+            /* TIFF packs the samples MSB first without gaps */
+            *out++ = p0 >> 2;
+            *out++ = (p0 << 6) | (p1 >> 4);
+            *out++ = (p1 << 4) | (p2 >> 6);
+            *out++ = (p2 << 2) | (p3 >> 8);
+            *out++ = p3;
+        }
+    }
+}
+
+esp_err_t dng_writer_write(FILE *file, const dng_writer_config_t *config, const uint8_t *data, size_t *size)
+{
+    esp_err_t ret = ESP_OK;
+    dng_ifd_t *ifd = NULL;
+    uint8_t *chunk = NULL;
+    uint8_t cfa_pattern[4];
+
+    ESP_RETURN_ON_FALSE(file && config && data, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->width && config->height && !(config->width % 4), ESP_ERR_INVALID_ARG,
+                        TAG, "width must be a multiple of 4");
+    ESP_RETURN_ON_ERROR(dng_get_cfa_pattern(config->pixel_format, cfa_pattern), TAG, "pixel format 0x%08"PRIx32" is not RAW10 Bayer",
+                        config->pixel_format);
+    ESP_RETURN_ON_FALSE(!config->preview || (config->preview_size && config->preview_width && config->preview_height),
+                        ESP_ERR_INVALID_ARG, TAG, "invalid preview");
+
+    uint32_t in_stride = config->bytesperline ? config->bytesperline : config->width * 5 / 4;
+    uint32_t out_stride = config->layout == DNG_WRITER_LAYOUT_UNPACKED16 ? config->width * 2 : config->width * 5 / 4;
+    uint32_t strip_size = out_stride * config->height;
+    uint32_t chunk_lines = MAX(1, DNG_CHUNK_SIZE / out_stride);
+
+    /* IFD0 and the preview SubIFD */
+    ifd = heap_caps_calloc(config->preview ? 2 : 1, sizeof(dng_ifd_t), MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(ifd, ESP_ERR_NO_MEM, exit, TAG, "failed to allocate IFD");
+    dng_ifd_t *preview = config->preview ? &ifd[1] : NULL;
+    /* The card DMA reads straight from internal RAM, PSRAM goes through a bounce buffer */
+    chunk = heap_caps_malloc(out_stride * chunk_lines, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (chunk == NULL) {
+        chunk = heap_caps_malloc(out_stride * chunk_lines, MALLOC_CAP_8BIT);
+    }
+    ESP_GOTO_ON_FALSE(chunk, ESP_ERR_NO_MEM, exit, TAG, "failed to allocate line buffer");
+
+    const uint8_t dng_version[4] = {1, 4, 0, 0};
+    const uint8_t dng_backward[4] = {1, 1, 0, 0};
+    const uint16_t cfa_dim[2] = {2, 2};
+    const uint32_t exposure[2] = {config->exposure_us, 1000000};
+    /* Identity, the sensor has no color calibration */
+    const int32_t color_matrix[18] = {1, 1, 0, 1, 0, 1, 0, 1, 1, 1, 0, 1, 0, 1, 0, 1, 1, 1};
+    const char *model = config->model ? config->model : "RAW10 camera";
+
+    dng_add_long(ifd, TAG_NEW_SUBFILE_TYPE, 0);
+    dng_add_long(ifd, TAG_IMAGE_WIDTH, config->width);
+    dng_add_long(ifd, TAG_IMAGE_LENGTH, config->height);
+    dng_add_short(ifd, TAG_BITS_PER_SAMPLE, config->layout == DNG_WRITER_LAYOUT_UNPACKED16 ? 16 : 10);
+    dng_add_short(ifd, TAG_COMPRESSION, 1);
+    dng_add_short(ifd, TAG_PHOTOMETRIC, PHOTOMETRIC_CFA);
+    dng_add_string(ifd, TAG_MAKE, "Espressif");
+    dng_add_string(ifd, TAG_MODEL, model);
+    dng_add_long(ifd, TAG_STRIP_OFFSETS, 0);    /* Set once the header size is known */
+    dng_add_short(ifd, TAG_ORIENTATION, 1);
+    dng_add_short(ifd, TAG_SAMPLES_PER_PIXEL, 1);
+    dng_add_long(ifd, TAG_ROWS_PER_STRIP, config->height);
+    dng_add_long(ifd, TAG_STRIP_BYTE_COUNTS, strip_size);
+    dng_add_short(ifd, TAG_PLANAR_CONFIG, 1);
+    if (preview) {
+        dng_add_long(ifd, TAG_SUB_IFDS, 0);     /* Set once the header size is known */
+    }
+    dng_add(ifd, TAG_CFA_REPEAT_DIM, TIFF_SHORT, 2, cfa_dim);
+    dng_add(ifd, TAG_CFA_PATTERN, TIFF_BYTE, 4, cfa_pattern);
+    if (config->exposure_us) {
+        dng_add(ifd, TAG_EXPOSURE_TIME, TIFF_RATIONAL, 1, exposure);
+    }
+    if (config->iso) {
+        dng_add_short(ifd, TAG_ISO_SPEED, config->iso);
+    }
+    dng_add(ifd, TAG_DNG_VERSION, TIFF_BYTE, 4, dng_version);
+    dng_add(ifd, TAG_DNG_BACKWARD, TIFF_BYTE, 4, dng_backward);
+    dng_add_string(ifd, TAG_UNIQUE_MODEL, model);
+    dng_add_long(ifd, TAG_BLACK_LEVEL, config->black_level);
+    dng_add_long(ifd, TAG_WHITE_LEVEL, config->white_level);
+    dng_add(ifd, TAG_COLOR_MATRIX1, TIFF_SRATIONAL, 9, color_matrix);
+    dng_add_short(ifd, TAG_ILLUMINANT1, ILLUMINANT_D65);
+
+    if (preview) {
+        const uint16_t rgb_bits[3] = {8, 8, 8};
+        const uint16_t subsampling[2] = {1, 1};
+
+        dng_add_long(preview, TAG_NEW_SUBFILE_TYPE, SUBFILE_REDUCED);
+        dng_add_long(preview, TAG_IMAGE_WIDTH, config->preview_width);
+        dng_add_long(preview, TAG_IMAGE_LENGTH, config->preview_height);
+        dng_add(preview, TAG_BITS_PER_SAMPLE, TIFF_SHORT, 3, rgb_bits);
+        dng_add_short(preview, TAG_COMPRESSION, COMPRESSION_JPEG);
+        dng_add_short(preview, TAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR);
+        dng_add_long(preview, TAG_STRIP_OFFSETS, 0);
+        dng_add_short(preview, TAG_SAMPLES_PER_PIXEL, 3);
+        dng_add_long(preview, TAG_ROWS_PER_STRIP, config->preview_height);
+        dng_add_long(preview, TAG_STRIP_BYTE_COUNTS, config->preview_size);
+        dng_add_short(preview, TAG_PLANAR_CONFIG, 1);
+        dng_add(preview, TAG_YCBCR_SUBSAMPLING, TIFF_SHORT, 2, subsampling);
+        dng_add_long(preview, TAG_PREVIEW_COLOR_SPACE, PREVIEW_COLOR_SPACE_SRGB);
+    }
+
+    /* Header, IFD0 and its extra values, preview SubIFD, its extra values and JPEG data, strip */
+    static const uint8_t padding[DNG_STRIP_ALIGN];
+    const uint8_t tiff_header[8] = {'I', 'I', 42, 0, 8, 0, 0, 0};
+    uint32_t extra_offset = sizeof(tiff_header) + dng_ifd_size(ifd);
+    uint32_t header_end = extra_offset + ifd->extra_size;
+    uint32_t preview_offset = header_end;
+
+    if (preview) {
+        uint32_t preview_extra_offset = preview_offset + dng_ifd_size(preview);
+        uint32_t preview_data_offset = preview_extra_offset + preview->extra_size;
+
+        dng_place(preview, preview_extra_offset, preview_data_offset, 0);
+        header_end = preview_data_offset + config->preview_size;
+    }
+    uint32_t strip_offset = (header_end + DNG_STRIP_ALIGN - 1) & ~(DNG_STRIP_ALIGN - 1);
+    dng_place(ifd, extra_offset, strip_offset, preview_offset);
+
+    bool ok = fwrite(tiff_header, 1, sizeof(tiff_header), file) == sizeof(tiff_header) && dng_write_ifd(file, ifd);
+    if (preview) {
+        ok = ok && dng_write_ifd(file, preview) &&
+             fwrite(config->preview, 1, config->preview_size, file) == config->preview_size;
+    }
+    ok = ok && fwrite(padding, 1, strip_offset - header_end, file) == strip_offset - header_end;
+    ESP_GOTO_ON_FALSE(ok, ESP_FAIL, exit, TAG, "failed to write header");
+
+    for (uint32_t y = 0; y < config->height; y += chunk_lines) {
+        uint32_t lines = MIN(chunk_lines, config->height - y);
+
+        for (uint32_t i = 0; i < lines; i++) {
+            dng_convert_line(data + (y + i) * in_stride, chunk + i * out_stride, config->width, config->layout);
+        }
+        ESP_GOTO_ON_FALSE(fwrite(chunk, 1, lines * out_stride, file) == lines * out_stride, ESP_FAIL, exit,
+                          TAG, "failed to write lines %"PRIu32"-%"PRIu32, y, y + lines - 1);
+    }
+
+    if (size) {
+        *size = strip_offset + strip_size;
+    }
+
+exit:
+    heap_caps_free(chunk);
+    heap_caps_free(ifd);
+    return ret;
+}
@@ -0,0 +1,71 @@
+/*
+ * DNG writer for RAW10 Bayer frames
+ *
+ * Writes a single strip, uncompressed CFA DNG straight from a MIPI packed
+ * RAW10 frame. The frame is converted a few lines at a time while it is
+ * written, either into the TIFF 10-bit packing (MSB first, same size as the
+ * MIPI frame) or into 16-bit little endian samples that every raw tool
+ * reads. Width, CFA pattern, black and white level, exposure and gain are
+ * in the file, so no out-of-band frame description is needed. A JPEG
+ * preview, e.g. a thumbnail, can go with the frame as a reduced resolution
+ * SubIFD, which file browsers show instead of decoding the raw data.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Strip layout of the DNG image data
+ */
+typedef enum {
+    DNG_WRITER_LAYOUT_PACKED10 = 0, /*!< 10 bits per sample, TIFF bit order */
+    DNG_WRITER_LAYOUT_UNPACKED16,   /*!< 16 bits per sample, value in the low 10 bits */
+} dng_writer_layout_t;
+
+/**
+ * @brief DNG frame description
+ */
+typedef struct {
+    uint32_t width;                 /*!< Frame width in pixels, a multiple of 4 */
+    uint32_t height;                /*!< Frame height in pixels */
+    uint32_t pixel_format;          /*!< V4L2_PIX_FMT_S{RGGB,BGGR,GBRG,GRBG}10 */
+    uint32_t bytesperline;          /*!< Line stride of the RAW10 frame, 0 for width * 5 / 4 */
+    dng_writer_layout_t layout;     /*!< Strip layout */
+    uint16_t black_level;           /*!< Sensor black level in 10-bit LSB */
+    uint16_t white_level;           /*!< Saturation level in 10-bit LSB */
+    uint32_t exposure_us;           /*!< Exposure time in microseconds, 0 if unknown */
+    uint16_t iso;                   /*!< ISO speed from the sensor gain, 0 if unknown */
+    const char *model;              /*!< Camera model name */
+    const uint8_t *preview;         /*!< Baseline sRGB JPEG preview without chroma subsampling, NULL for none */
+    size_t preview_size;            /*!< Preview size in bytes */
+    uint32_t preview_width;         /*!< Preview width in pixels */
+    uint32_t preview_height;        /*!< Preview height in pixels */
+} dng_writer_config_t;
+
+/**
+ * @brief Write one frame as a DNG file
+ *
+ * @param file   File opened for writing, positioned at the start
+ * @param config Frame description
+ * @param data   MIPI packed RAW10 frame
+ * @param size   Returned number of bytes written, can be NULL
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the frame description is invalid
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format is not a RAW10 Bayer format
+ *      - ESP_ERR_NO_MEM if the line buffer could not be allocated
+ *      - ESP_FAIL if a write failed
+ */
+esp_err_t dng_writer_write(FILE *file, const dng_writer_config_t *config, const uint8_t *data, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,683 @@
+/*
+ * Fragmented MP4 writer for H.264 recordings
+ *
+ * A fragment buffer is laid out so that the whole fragment goes out in one
+ * write from the start of the buffer, which is DMA capable and cache aligned:
+ *
+ *   0                              leading free box
+ *   FMP4_HEADROOM - 8 - moof_size  moof, built when the fragment is closed
+ *   FMP4_HEADROOM - 8              mdat header
+ *   FMP4_HEADROOM                  samples, 4-byte length prefixed NAL units
+ *   ...                            trailing free box up to the allocation unit
+ *
+ * The headroom holds the largest moof, so the samples are copied once, when
+ * they are added. Sample durations come from the capture timestamps; the
+ * last sample of a fragment gets its duration from the first one of the next.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "fmp4_writer.h"
+#include "task_topology.h"
+
+#define FMP4_TIMESCALE          90000
+#define FMP4_TRACK_ID           1
+#define FMP4_MAX_SAMPLES        512     /* Per fragment, a GOP longer than this is split */
+#define FMP4_MOOF_SIZE(n)       (88 + 12 * (n))
+#define FMP4_HEADROOM           (FMP4_MOOF_SIZE(FMP4_MAX_SAMPLES) + 8 + 8)
+#define FMP4_FREE_BOX_MIN       8
+#define FMP4_BUFFER_COUNT       2
+#define FMP4_WRITER_STACK       3072
+#define FMP4_WRITER_PRIORITY    (TASK_CAPTURE_PRIORITY > 1 ? TASK_CAPTURE_PRIORITY - 1 : 1)
+#define FMP4_WRITER_CORE        TASK_CAPTURE_CORE
+
+#define FMP4_SAMPLE_FLAGS_SYNC      0x02000000  /* Depends on no other sample */
+#define FMP4_SAMPLE_FLAGS_NON_SYNC  0x01010000  /* Depends on others, not a sync sample */
+
+#define H264_NAL_TYPE(b)        ((b) & 0x1f)
+#define H264_NAL_IDR            5
+#define H264_NAL_SPS            7
+#define H264_NAL_PPS            8
+#define H264_NAL_AUD            9
+
+static const char *TAG = "fmp4_writer";
+
+typedef struct {
+    uint8_t *data;
+    uint32_t len;                   /* Bytes to write, 0 to stop the writer task */
+} fmp4_job_t;
+
+/* Samples of the fragment being built */
+typedef struct {
+    uint32_t count;
+    uint32_t size[FMP4_MAX_SAMPLES];
+    int64_t timestamp_us[FMP4_MAX_SAMPLES];
+    bool sync[FMP4_MAX_SAMPLES];
+} fmp4_fragment_t;
+
+struct fmp4_writer {
+    int fd;
+    uint32_t buffer_size;
+    uint32_t unit_size;
+    uint8_t *buffers[FMP4_BUFFER_COUNT];
+    uint8_t *buffer;                /* Buffer of the fragment being built */
+    uint32_t used;                  /* Sample bytes in it */
+    fmp4_fragment_t fragment;
+    uint32_t sequence;
+    int64_t first_us;               /* Timestamp of the first sample in the file */
+    int64_t last_us;
+    bool started;                   /* An IDR frame was added */
+    QueueHandle_t job_q;
+    QueueHandle_t free_q;
+    volatile esp_err_t error;
+};
+
+/* ========== Box helpers ========== */
+
+static uint8_t *put_u8(uint8_t *p, uint8_t v)
+{
+    *p++ = v;
+    return p;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    *p++ = v >> 24;
+    *p++ = v >> 16;
+    *p++ = v >> 8;
+    *p++ = v;
+    return p;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    p = put_u32(p, v >> 32);
+    return put_u32(p, v);
+}
+
+static uint8_t *put_zero(uint8_t *p, size_t n)
+{
+    memset(p, 0, n);
+    return p + n;
+}
+
+static uint8_t *put_data(uint8_t *p, const void *data, size_t n)
+{
+    memcpy(p, data, n);
+    return p + n;
+}
+
+/* Start a box, its size is filled in by box_end() */
+static uint8_t *box_start(uint8_t *p, const char *type)
+{
+    p = put_u32(p, 0);
+    return put_data(p, type, 4);
+}
+
+static uint8_t *full_box_start(uint8_t *p, const char *type, uint8_t version, uint32_t flags)
+{
+    p = box_start(p, type);
+    return put_u32(p, (version << 24) | flags);
+}
+
+static void box_end(uint8_t *box, uint8_t *p)
+{
+    put_u32(box, p - box);
+}
+
+static uint8_t *put_free_box(uint8_t *p, uint32_t size)
+{
+    p = put_u32(p, size);
+    p = put_data(p, "free", 4);
+    return put_zero(p, size - 8);
+}
+
+static uint8_t *put_matrix(uint8_t *p)
+{
+    static const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+    for (int i = 0; i < 9; i++) {
+        p = put_u32(p, unity[i]);
+    }
+    return p;
+}
+
+/* ========== H.264 ========== */
+
+/* Find the next Annex-B start code, returns the NAL start or NULL */
+static const uint8_t *h264_next_nal(const uint8_t *p, const uint8_t *end)
+{
+    while (p + 3 <= end) {
+        if (p[0] == 0 && p[1] == 0) {
+            if (p[2] == 1) {
+                return p + 3;
+            } else if (p[2] == 0 && p + 4 <= end && p[3] == 1) {
+                return p + 4;
+            }
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/* End of the NAL unit at nal, next is the following one or NULL */
+static const uint8_t *h264_nal_end(const uint8_t *nal, const uint8_t *next, const uint8_t *end)
+{
+    const uint8_t *nal_end = end;
+
+    if (next) {
+        /* Back up over the start code and any trailing zero byte */
+        nal_end = next - 3;
+        while (nal_end > nal && nal_end[-1] == 0) {
+            nal_end--;
+        }
+    }
+
+    return nal_end;
+}
+
+/* NAL units that go into the samples, the parameter sets live in avcC */
+static bool h264_nal_is_sample_data(uint8_t header)
+{
+    uint8_t type = H264_NAL_TYPE(header);
+
+    return type != H264_NAL_SPS && type != H264_NAL_PPS && type != H264_NAL_AUD;
+}
+
+bool fmp4_writer_is_key_frame(const uint8_t *data, size_t size)
+{
+    const uint8_t *end = data + size;
+
+    for (const uint8_t *nal = h264_next_nal(data, end); nal && nal < end; nal = h264_next_nal(nal, end)) {
+        if (H264_NAL_TYPE(nal[0]) == H264_NAL_IDR) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Size of an access unit as length prefixed NAL units */
+static size_t h264_sample_size(const uint8_t *data, size_t size)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *nal = h264_next_nal(data, end);
+    size_t total = 0;
+
+    while (nal) {
+        const uint8_t *next = h264_next_nal(nal, end);
+        const uint8_t *nal_end = h264_nal_end(nal, next, end);
+
+        if (nal_end > nal && h264_nal_is_sample_data(nal[0])) {
+            total += 4 + (nal_end - nal);
+        }
+        nal = next;
+    }
+
+    return total;
+}
+
+static uint8_t *h264_put_sample(uint8_t *p, const uint8_t *data, size_t size)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *nal = h264_next_nal(data, end);
+
+    while (nal) {
+        const uint8_t *next = h264_next_nal(nal, end);
+        const uint8_t *nal_end = h264_nal_end(nal, next, end);
+
+        if (nal_end > nal && h264_nal_is_sample_data(nal[0])) {
+            p = put_u32(p, nal_end - nal);
+            p = put_data(p, nal, nal_end - nal);
+        }
+        nal = next;
+    }
+
+    return p;
+}
+
+/* First SPS and PPS of an Annex-B buffer */
+static esp_err_t h264_find_param_sets(const uint8_t *data, size_t size, const uint8_t **sps, size_t *sps_len,
+                                      const uint8_t **pps, size_t *pps_len)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *nal = h264_next_nal(data, end);
+
+    *sps = NULL;
+    *pps = NULL;
+    while (nal) {
+        const uint8_t *next = h264_next_nal(nal, end);
+        const uint8_t *nal_end = h264_nal_end(nal, next, end);
+
+        if (H264_NAL_TYPE(nal[0]) == H264_NAL_SPS && !*sps && nal_end - nal >= 4) {
+            *sps = nal;
+            *sps_len = nal_end - nal;
+        } else if (H264_NAL_TYPE(nal[0]) == H264_NAL_PPS && !*pps && nal_end > nal) {
+            *pps = nal;
+            *pps_len = nal_end - nal;
+        }
+        nal = next;
+    }
+
+    return *sps && *pps ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/* ========== Header and fragments ========== */
+
+static uint8_t *put_avc1(uint8_t *p, const fmp4_writer_config_t *config, const uint8_t *sps, size_t sps_len,
+                         const uint8_t *pps, size_t pps_len)
+{
+    uint8_t *avc1 = p;
+    uint8_t *avcc;
+    char compressor[32] = {0};
+
+    p = box_start(p, "avc1");
+    p = put_zero(p, 6);
+    p = put_u16(p, 1);                  /* Data reference index */
+    p = put_zero(p, 16);
+    p = put_u16(p, config->width);
+    p = put_u16(p, config->height);
+    p = put_u32(p, 0x00480000);         /* 72 dpi */
+    p = put_u32(p, 0x00480000);
+    p = put_u32(p, 0);
+    p = put_u16(p, 1);                  /* Frames per sample */
+    p = put_data(p, compressor, sizeof(compressor));
+    p = put_u16(p, 0x0018);             /* Depth */
+    p = put_u16(p, 0xffff);
+
+    avcc = p;
+    p = box_start(p, "avcC");
+    p = put_u8(p, 1);
+    p = put_u8(p, sps[1]);              /* Profile, compatibility and level from the SPS */
+    p = put_u8(p, sps[2]);
+    p = put_u8(p, sps[3]);
+    p = put_u8(p, 0xff);                /* 4-byte NAL unit lengths */
+    p = put_u8(p, 0xe1);                /* One SPS */
+    p = put_u16(p, sps_len);
+    p = put_data(p, sps, sps_len);
+    p = put_u8(p, 1);                   /* One PPS */
+    p = put_u16(p, pps_len);
+    p = put_data(p, pps, pps_len);
+    box_end(avcc, p);
+
+    box_end(avc1, p);
+    return p;
+}
+
+/* ftyp and an empty moov, the samples are all in fragments */
+static uint8_t *put_header(uint8_t *p, const fmp4_writer_config_t *config, const uint8_t *sps, size_t sps_len,
+                           const uint8_t *pps, size_t pps_len)
+{
+    uint8_t *box[8];
+
+    box[0] = p;
+    p = box_start(p, "ftyp");
+    p = put_data(p, "isom", 4);
+    p = put_u32(p, 0x200);
+    p = put_data(p, "isomiso6avc1mp41", 16);
+    box_end(box[0], p);
+
+    box[0] = p;
+    p = box_start(p, "moov");
+
+    box[1] = p;
+    p = full_box_start(p, "mvhd", 0, 0);
+    p = put_zero(p, 8);                 /* Creation and modification time */
+    p = put_u32(p, 1000);
+    p = put_u32(p, 0);                  /* Duration comes from the fragments */
+    p = put_u32(p, 0x00010000);         /* Rate */
+    p = put_u16(p, 0x0100);             /* Volume */
+    p = put_zero(p, 10);
+    p = put_matrix(p);
+    p = put_zero(p, 24);
+    p = put_u32(p, FMP4_TRACK_ID + 1);
+    box_end(box[1], p);
+
+    box[1] = p;
+    p = box_start(p, "trak");
+    box[2] = p;
+    p = full_box_start(p, "tkhd", 0, 3);   /* Enabled, in movie */
+    p = put_zero(p, 8);
+    p = put_u32(p, FMP4_TRACK_ID);
+    p = put_zero(p, 4 + 4 + 8);         /* Reserved, duration, reserved */
+    p = put_zero(p, 8);                 /* Layer, alternate group, volume, reserved */
+    p = put_matrix(p);
+    p = put_u32(p, config->width << 16);
+    p = put_u32(p, config->height << 16);
+    box_end(box[2], p);
+
+    box[2] = p;
+    p = box_start(p, "mdia");
+    box[3] = p;
+    p = full_box_start(p, "mdhd", 0, 0);
+    p = put_zero(p, 8);
+    p = put_u32(p, FMP4_TIMESCALE);
+    p = put_u32(p, 0);
+    p = put_u16(p, 0x55c4);             /* "und" */
+    p = put_u16(p, 0);
+    box_end(box[3], p);
+
+    box[3] = p;
+    p = full_box_start(p, "hdlr", 0, 0);
+    p = put_u32(p, 0);
+    p = put_data(p, "vide", 4);
+    p = put_zero(p, 12);
+    p = put_data(p, "VideoHandler", 13);
+    box_end(box[3], p);
+
+    box[3] = p;
+    p = box_start(p, "minf");
+    box[4] = p;
+    p = full_box_start(p, "vmhd", 0, 1);
+    p = put_zero(p, 8);
+    box_end(box[4], p);
+
+    box[4] = p;
+    p = box_start(p, "dinf");
+    box[5] = p;
+    p = full_box_start(p, "dref", 0, 0);
+    p = put_u32(p, 1);
+    box[6] = p;
+    p = full_box_start(p, "url ", 0, 1);   /* Samples are in this file */
+    box_end(box[6], p);
+    box_end(box[5], p);
+    box_end(box[4], p);
+
+    box[4] = p;
+    p = box_start(p, "stbl");
+    box[5] = p;
+    p = full_box_start(p, "stsd", 0, 0);
+    p = put_u32(p, 1);
+    p = put_avc1(p, config, sps, sps_len, pps, pps_len);
+    box_end(box[5], p);
+    static const char *const empty_tables[] = {"stts", "stsc", "stco"};
+    for (int i = 0; i < 3; i++) {
+        box[5] = p;
+        p = full_box_start(p, empty_tables[i], 0, 0);
+        p = put_u32(p, 0);
+        box_end(box[5], p);
+    }
+    box[5] = p;
+    p = full_box_start(p, "stsz", 0, 0);
+    p = put_zero(p, 8);
+    box_end(box[5], p);
+    box_end(box[4], p);                 /* stbl */
+    box_end(box[3], p);                 /* minf */
+    box_end(box[2], p);                 /* mdia */
+    box_end(box[1], p);                 /* trak */
+
+    box[1] = p;
+    p = box_start(p, "mvex");
+    box[2] = p;
+    p = full_box_start(p, "trex", 0, 0);
+    p = put_u32(p, FMP4_TRACK_ID);
+    p = put_u32(p, 1);                  /* Sample description */
+    p = put_zero(p, 12);                /* Every sample has its own duration, size and flags */
+    box_end(box[2], p);
+    box_end(box[1], p);
+
+    box_end(box[0], p);                 /* moov */
+    return p;
+}
+
+/* Pad with a free box from p to the next allocation unit after base */
+static uint32_t pad_to_unit(uint8_t *base, uint8_t *p, uint32_t unit_size)
+{
+    uint32_t len = p - base;
+    uint32_t padded = (len + unit_size - 1) / unit_size * unit_size;
+
+    if (padded > len && padded - len < FMP4_FREE_BOX_MIN) {
+        padded += unit_size;
+    }
+    if (padded > len) {
+        put_free_box(p, padded - len);
+    }
+
+    return padded;
+}
+
+/* Close the fragment, next_us is the timestamp of the sample after it */
+static esp_err_t fmp4_flush(fmp4_writer_t *writer, int64_t next_us)
+{
+    fmp4_fragment_t *frag = &writer->fragment;
+    uint32_t moof_size = FMP4_MOOF_SIZE(frag->count);
+    uint8_t *moof = writer->buffer + FMP4_HEADROOM - 8 - moof_size;
+    uint8_t *p = moof;
+    uint8_t *box[3];
+    uint64_t decode_time;
+    fmp4_job_t job;
+
+    if (!frag->count) {
+        return ESP_OK;
+    }
+    decode_time = (frag->timestamp_us[0] - writer->first_us) * FMP4_TIMESCALE / 1000000;
+
+    put_free_box(writer->buffer, moof - writer->buffer);
+
+    p = box_start(p, "moof");
+    box[0] = p;
+    p = full_box_start(p, "mfhd", 0, 0);
+    p = put_u32(p, ++writer->sequence);
+    box_end(box[0], p);
+
+    box[0] = p;
+    p = box_start(p, "traf");
+    box[1] = p;
+    p = full_box_start(p, "tfhd", 0, 0x020000);    /* Default base is moof */
+    p = put_u32(p, FMP4_TRACK_ID);
+    box_end(box[1], p);
+
+    box[1] = p;
+    p = full_box_start(p, "tfdt", 1, 0);
+    p = put_u64(p, decode_time);
+    box_end(box[1], p);
+
+    box[1] = p;
+    p = full_box_start(p, "trun", 0, 0x000701);    /* Data offset, per sample duration, size and flags */
+    p = put_u32(p, frag->count);
+    p = put_u32(p, moof_size + 8);
+    for (uint32_t i = 0; i < frag->count; i++) {
+        int64_t end_us = i + 1 < frag->count ? frag->timestamp_us[i + 1] : next_us;
+        int64_t start = (frag->timestamp_us[i] - writer->first_us) * FMP4_TIMESCALE / 1000000;
+        int64_t end = (end_us - writer->first_us) * FMP4_TIMESCALE / 1000000;
+
+        p = put_u32(p, MAX(end - start, 1));
+        p = put_u32(p, frag->size[i]);
+        p = put_u32(p, frag->sync[i] ? FMP4_SAMPLE_FLAGS_SYNC : FMP4_SAMPLE_FLAGS_NON_SYNC);
+    }
+    box_end(box[1], p);
+    box_end(box[0], p);                 /* traf */
+    box_end(moof, p);
+
+    p = put_u32(p, 8 + writer->used);
+    put_data(p, "mdat", 4);
+
+    job.data = writer->buffer;
+    job.len = pad_to_unit(writer->buffer, writer->buffer + FMP4_HEADROOM + writer->used, writer->unit_size);
+    xQueueSend(writer->job_q, &job, portMAX_DELAY);
+
+    /* Only waits when the card is slower than the stream */
+    xQueueReceive(writer->free_q, &writer->buffer, portMAX_DELAY);
+    writer->used = 0;
+    frag->count = 0;
+
+    return writer->error;
+}
+
+static void fmp4_writer_task(void *arg)
+{
+    fmp4_writer_t *writer = (fmp4_writer_t *)arg;
+    fmp4_job_t job;
+
+    while (xQueueReceive(writer->job_q, &job, portMAX_DELAY) == pdTRUE && job.len) {
+        /* fsync() commits the directory entry, the file is valid up to this fragment */
+        if (writer->error == ESP_OK && (write(writer->fd, job.data, job.len) != job.len || fsync(writer->fd) != 0)) {
+            ESP_LOGE(TAG, "fragment %"PRIu32" bytes write failed", job.len);
+            writer->error = ESP_FAIL;
+        }
+        xQueueSend(writer->free_q, &job.data, portMAX_DELAY);
+    }
+
+    /* NULL after the last buffer tells fmp4_writer_close() that the task is done */
+    job.data = NULL;
+    xQueueSend(writer->free_q, &job.data, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static void fmp4_writer_free(fmp4_writer_t *writer)
+{
+    for (int i = 0; i < FMP4_BUFFER_COUNT; i++) {
+        heap_caps_free(writer->buffers[i]);
+    }
+    if (writer->job_q) {
+        vQueueDelete(writer->job_q);
+    }
+    if (writer->free_q) {
+        vQueueDelete(writer->free_q);
+    }
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+    heap_caps_free(writer);
+}
+
+esp_err_t fmp4_writer_create(const char *path, const fmp4_writer_config_t *config, fmp4_writer_t **ret_writer)
+{
+    esp_err_t ret = ESP_OK;
+    fmp4_writer_t *writer;
+    const uint8_t *sps;
+    const uint8_t *pps;
+    size_t sps_len;
+    size_t pps_len;
+
+    ESP_RETURN_ON_FALSE(path && config && ret_writer && config->unit_size && config->width <= 0xffff &&
+                        config->height <= 0xffff, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->buffer_size >= FMP4_HEADROOM + 2 * config->unit_size, ESP_ERR_INVALID_ARG, TAG,
+                        "buffer too small");
+    ESP_RETURN_ON_ERROR(h264_find_param_sets(config->param_sets, config->param_sets_size, &sps, &sps_len, &pps,
+                                             &pps_len), TAG, "no SPS and PPS");
+
+    /* The sample table is large, keep it out of internal RAM */
+    writer = heap_caps_calloc(1, sizeof(fmp4_writer_t), MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(writer, ESP_ERR_NO_MEM, TAG, "no memory for writer");
+    writer->fd = -1;
+    writer->buffer_size = config->buffer_size;
+    writer->unit_size = config->unit_size;
+    writer->error = ESP_OK;
+
+    for (int i = 0; i < FMP4_BUFFER_COUNT; i++) {
+        writer->buffers[i] = heap_caps_calloc(1, config->buffer_size,
+                                              MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA | MALLOC_CAP_CACHE_ALIGNED);
+        ESP_GOTO_ON_FALSE(writer->buffers[i], ESP_ERR_NO_MEM, fail, TAG, "no memory for fragment buffer");
+    }
+    writer->job_q = xQueueCreate(FMP4_BUFFER_COUNT, sizeof(fmp4_job_t));
+    writer->free_q = xQueueCreate(FMP4_BUFFER_COUNT, sizeof(uint8_t *));
+    ESP_GOTO_ON_FALSE(writer->job_q && writer->free_q, ESP_ERR_NO_MEM, fail, TAG, "no memory for queues");
+
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ESP_GOTO_ON_FALSE(writer->fd >= 0, ESP_FAIL, fail, TAG, "failed to create %s", path);
+
+    uint8_t *p = put_header(writer->buffers[0], config, sps, sps_len, pps, pps_len);
+    uint32_t len = pad_to_unit(writer->buffers[0], p, config->unit_size);
+    ESP_GOTO_ON_FALSE(write(writer->fd, writer->buffers[0], len) == len && fsync(writer->fd) == 0, ESP_FAIL, fail,
+                      TAG, "failed to write header");
+
+    writer->buffer = writer->buffers[0];
+    xQueueSend(writer->free_q, &writer->buffers[1], 0);
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(fmp4_writer_task, "fmp4_write", FMP4_WRITER_STACK, writer,
+                                              FMP4_WRITER_PRIORITY, NULL, FMP4_WRITER_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, fail, TAG, "failed to create writer task");
+
+    *ret_writer = writer;
+    return ESP_OK;
+
+fail:
+    fmp4_writer_free(writer);
+    return ret;
+}
+
+esp_err_t fmp4_writer_add(fmp4_writer_t *writer, const uint8_t *data, size_t size, int64_t timestamp_us,
+                          bool key_frame)
+{
+    fmp4_fragment_t *frag = &writer->fragment;
+    size_t sample_size;
+
+    ESP_RETURN_ON_FALSE(writer->error == ESP_OK, writer->error, TAG, "writer failed");
+
+    /* Decoding starts at an IDR frame */
+    if (!writer->started) {
+        if (!key_frame) {
+            return ESP_OK;
+        }
+        writer->started = true;
+        writer->first_us = timestamp_us;
+    }
+
+    sample_size = h264_sample_size(data, size);
+    ESP_RETURN_ON_FALSE(FMP4_HEADROOM + sample_size + 2 * writer->unit_size <= writer->buffer_size,
+                        ESP_ERR_INVALID_SIZE, TAG, "access unit of %zu bytes does not fit a fragment", size);
+
+    /* A fragment per GOP, longer GOPs and full buffers start a fragment on a non-IDR frame */
+    if (key_frame || frag->count == FMP4_MAX_SAMPLES ||
+            FMP4_HEADROOM + writer->used + sample_size + 2 * writer->unit_size > writer->buffer_size) {
+        ESP_RETURN_ON_ERROR(fmp4_flush(writer, timestamp_us), TAG, "fragment write failed");
+    }
+
+    h264_put_sample(writer->buffer + FMP4_HEADROOM + writer->used, data, size);
+    writer->used += sample_size;
+    frag->size[frag->count] = sample_size;
+    frag->timestamp_us[frag->count] = timestamp_us;
+    frag->sync[frag->count] = key_frame;
+    frag->count++;
+    writer->last_us = timestamp_us;
+
+    return ESP_OK;
+}
+
+esp_err_t fmp4_writer_close(fmp4_writer_t *writer)
+{
+    fmp4_fragment_t *frag = &writer->fragment;
+    fmp4_job_t stop = {0};
+    esp_err_t ret;
+    int64_t last_duration_us = frag->count > 1 ? frag->timestamp_us[frag->count - 1] -
+                               frag->timestamp_us[frag->count - 2] : 0;
+
+    /* The last sample lasts as long as the one before it */
+    ret = fmp4_flush(writer, writer->last_us + last_duration_us);
+
+    /* Fragments still queued are written before the task stops */
+    xQueueSend(writer->job_q, &stop, portMAX_DELAY);
+    for (uint8_t *buffer = writer->buffer; buffer; ) {
+        xQueueReceive(writer->free_q, &buffer, portMAX_DELAY);
+    }
+    if (ret == ESP_OK) {
+        ret = writer->error;
+    }
+
+    ESP_LOGI(TAG, "Closed after %"PRIu32" fragments, %.1f s", writer->sequence,
+             fmp4_writer_get_duration_us(writer) / 1e6);
+    fmp4_writer_free(writer);
+    return ret;
+}
+
+int64_t fmp4_writer_get_duration_us(const fmp4_writer_t *writer)
+{
+    return writer->started ? writer->last_us - writer->first_us : 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Fragmented MP4 writer for H.264 recordings
+ *
+ * The file starts with ftyp and an empty moov, every fragment after it is a
+ * moof with the sample table of its access units followed by their mdat. A
+ * fragment starts with each IDR frame, so a fragment is one GOP:
+ *
+ *   [ftyp][moov][free]  [free][moof][mdat][free]  [free][moof][mdat][free] ...
+ *
+ * Every piece is padded with free boxes to the filesystem allocation unit and
+ * written with one aligned write followed by fsync(). A file cut off by a
+ * power loss is a valid fragmented MP4 up to the last complete fragment.
+ *
+ * Fragments are built in one of two PSRAM buffers while a writer task writes
+ * the other one, so a slow card write does not hold up the encoder.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Writer configuration
+ */
+typedef struct {
+    uint32_t width;                 /*!< Frame width in pixels */
+    uint32_t height;                /*!< Frame height in pixels */
+    const uint8_t *param_sets;      /*!< Annex-B SPS and PPS of the stream */
+    size_t param_sets_size;         /*!< Size of param_sets */
+    uint32_t buffer_size;           /*!< Size of each fragment buffer, the largest fragment */
+    uint32_t unit_size;             /*!< Filesystem allocation unit, writes are aligned to it */
+} fmp4_writer_config_t;
+
+typedef struct fmp4_writer fmp4_writer_t;
+
+/**
+ * @brief Create a fragmented MP4 file and write its header
+ *
+ * @param path       File path
+ * @param config     Writer configuration
+ * @param ret_writer Returned writer
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration or the parameter sets are invalid
+ *      - ESP_ERR_NO_MEM if the buffers could not be allocated
+ *      - ESP_FAIL if the file could not be created or written
+ */
+esp_err_t fmp4_writer_create(const char *path, const fmp4_writer_config_t *config, fmp4_writer_t **ret_writer);
+
+/**
+ * @brief Add one H.264 access unit
+ *
+ * Access units before the first IDR frame are skipped. SPS, PPS and access
+ * unit delimiters are dropped, the parameter sets are in the header. The
+ * data is copied, the caller may release it when this returns.
+ *
+ * @param writer       Writer handle
+ * @param data         Annex-B access unit
+ * @param size         Size of data
+ * @param timestamp_us Capture time, esp_timer clock
+ * @param key_frame    The access unit is an IDR frame
+ *
+ * @return
+ *      - ESP_OK on success, also if the access unit was skipped
+ *      - ESP_ERR_INVALID_SIZE if the access unit does not fit a fragment buffer
+ *      - ESP_FAIL if a previous fragment could not be written
+ */
+esp_err_t fmp4_writer_add(fmp4_writer_t *writer, const uint8_t *data, size_t size, int64_t timestamp_us,
+                          bool key_frame);
+
+/**
+ * @brief Write the last fragment and close the file
+ *
+ * @param writer Writer handle, freed
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if a fragment could not be written
+ */
+esp_err_t fmp4_writer_close(fmp4_writer_t *writer);
+
+/**
+ * @brief Get the duration of the added access units
+ *
+ * @param writer Writer handle
+ *
+ * @return Time from the first to the last access unit in microseconds
+ */
+int64_t fmp4_writer_get_duration_us(const fmp4_writer_t *writer);
+
+/**
+ * @brief Check whether an Annex-B access unit holds an IDR slice
+ *
+ * @param data Annex-B access unit
+ * @param size Size of data
+ *
+ * @return true for an IDR frame
+ */
+bool fmp4_writer_is_key_frame(const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
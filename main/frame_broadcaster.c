@@ -0,0 +1,992 @@
+/*
+ * Frame broadcaster for the RAW/RGB HTTP streamer
+ *
+ * A broadcaster fans the frames of one producer out to all subscribers. Every
+ * delivered frame is a reference-counted lease on its buffer: the buffer is
+ * handed back to the producer when the last subscriber releases it, while the
+ * producer keeps filling the other buffers. A slow sender therefore only pins
+ * the buffers it holds, not the sensor.
+ *
+ * Each subscriber picks what happens when it falls behind: latest-only and
+ * drop-oldest subscribers skip frames (and count them), lossless ones apply
+ * back-pressure to the producer through a bounded queue. A subscriber may also
+ * cap its rate, frames between its due times are skipped without a lease, so a
+ * slow archival sink and a full rate viewer can share one capture.
+ *
+ * Subscribers only read the shared buffers. One that needs to modify a frame
+ * asks for a writable frame: a buffer nobody else holds is handed over as is,
+ * a shared one is copied first (copy-on-write), the copy is freed on release.
+ *
+ * frame_broadcaster_start_capture() provides the V4L2 capture producer: one
+ * task owns DQBUF and buffers are re-queued with QBUF on release. The same task
+ * runs reconfiguration requests (STREAMOFF, callback, STREAMON) between frames,
+ * so the V4L2 queue is never touched by two tasks at once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/errno.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_bit_defs.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "linux/videodev2.h"
+#include "esp_video_ioctl.h"
+#include "frame_broadcaster.h"
+#include "capture_buffers.h"
+#include "trace_ring.h"
+#include "stream_metrics.h"
+#include "task_topology.h"
+
+#define CAPTURE_TASK_STACK_SIZE     4096
+#define CAPTURE_TASK_PRIORITY       TASK_CAPTURE_PRIORITY
+#define CAPTURE_TASK_CORE           TASK_CAPTURE_CORE
+#define FRAME_BROADCASTER_MAX_BUFS  32      /* Limited by the per-subscriber lease mask */
+#define LOSSLESS_RETRY_MS           10
+#define CAPTURE_RESIZE_POLL_MS      10
+
+static const char *TAG = "frame_bcast";
+
+/* One lease slot per buffer, the buffer is owned by the producer while refcount is 0 */
+typedef struct {
+    frame_t frame;
+    uint32_t refcount;
+} frame_slot_t;
+
+struct frame_subscriber {
+    SLIST_ENTRY(frame_subscriber) node;
+    struct frame_broadcaster *bcast;
+    QueueHandle_t queue;            /* Delivered frame pointers, bounded by the queue depth */
+    uint32_t leases;                /* Bitmask of buffer indices this subscriber holds a reference on */
+
+    uint32_t id;
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+    frame_delivery_policy_t policy;
+    uint32_t handled;               /* Sequence + 1 of the last frame delivered or dropped */
+    uint32_t delivered;
+    uint32_t dropped;
+
+    uint32_t max_fps;
+    int64_t interval_us;            /* Delivery period for max_fps, 0 for every frame */
+    int64_t due_us;                 /* Timestamp of the next frame to deliver, 0 before the first one */
+    uint32_t decimated;
+    uint32_t copied;
+};
+
+struct frame_broadcaster {
+    const char *name;
+    uint32_t buffer_count;
+    uint32_t width;                 /* Geometry stamped on published frames, only written by the producer */
+    uint32_t height;
+    struct capture_source *capture; /* V4L2 producer, NULL for other producers */
+    frame_broadcaster_release_cb_t release_cb;
+    void *release_arg;
+
+    SemaphoreHandle_t lock;         /* Protects the subscriber list and the lease slots */
+    SLIST_HEAD(frame_subscriber_list, frame_subscriber) subs;
+    uint32_t sub_count;
+    uint32_t next_id;
+    uint32_t sequence;
+    int64_t last_timestamp_us;      /* Timestamp and period of the producer, only written by the producer */
+    int64_t frame_interval_us;
+    bool retain_latest;             /* Only read and written under lock */
+    int32_t retained;               /* Slot of the latest frame while retain_latest is set, -1 if none */
+
+    TaskHandle_t publisher;         /* Task blocked in frame_broadcaster_publish() on a lossless subscriber */
+    frame_slot_t slots[0];
+};
+
+/* V4L2 capture producer */
+typedef struct capture_source {
+    int fd;
+    capture_buffers_t *bufs;        /* Owned by the caller of frame_broadcaster_start_capture() */
+    frame_broadcaster_handle_t bcast;
+    TaskHandle_t task;
+
+    SemaphoreHandle_t queue_lock;   /* Protects stopped and idle against buffers released by subscribers */
+    bool stopped;                   /* Streaming is off, released buffers are kept in idle */
+    uint32_t idle;                  /* Bitmask of buffers to queue again on STREAMON */
+
+    SemaphoreHandle_t request_lock; /* One reconfiguration request at a time */
+    SemaphoreHandle_t request_done;
+    volatile frame_capture_reconfig_cb_t request_cb;   /* Pending request, polled by the capture task */
+    void *request_arg;
+    esp_err_t request_ret;
+} capture_source_t;
+
+static void release_buffers(frame_broadcaster_handle_t bcast, uint32_t mask)
+{
+    for (uint32_t i = 0; i < bcast->buffer_count; i++) {
+        if (mask & BIT(i)) {
+            bcast->release_cb(i, bcast->release_arg);
+        }
+    }
+}
+
+/* Drop one reference, must be called with the lock held, returns true if the buffer must be given back */
+static bool slot_unref_locked(frame_broadcaster_handle_t bcast, uint32_t index)
+{
+    frame_slot_t *slot = &bcast->slots[index];
+
+    assert(slot->refcount > 0);
+    return --slot->refcount == 0;
+}
+
+/*
+ * Try to hand the frame to one subscriber, must be called with the lock held. Frames
+ * dropped to make room are collected in release. Returns false if a lossless subscriber
+ * has no room yet.
+ */
+static bool deliver_locked(struct frame_subscriber *sub, frame_slot_t *slot, uint32_t *release)
+{
+    const frame_t *frame = &slot->frame;
+    const frame_t *old;
+
+    if (!uxQueueSpacesAvailable(sub->queue)) {
+        if (sub->policy == FRAME_DELIVERY_LOSSLESS) {
+            return false;
+        }
+
+        if (xQueueReceive(sub->queue, &old, 0) == pdTRUE) {
+            sub->leases &= ~BIT(old->index);
+            sub->dropped++;
+            TRACE_RING_RECORD(TRACE_EVENT_FRAME_DROP, sub->id);
+            stream_metrics_record_drop();
+            if (slot_unref_locked(sub->bcast, old->index)) {
+                *release |= BIT(old->index);
+            }
+        }
+    }
+
+    if (xQueueSend(sub->queue, &frame, 0) == pdTRUE) {
+        sub->leases |= BIT(frame->index);
+        sub->delivered++;
+        slot->refcount++;
+    } else {
+        sub->dropped++;
+        TRACE_RING_RECORD(TRACE_EVENT_FRAME_DROP, sub->id);
+        stream_metrics_record_drop();
+    }
+
+    return true;
+}
+
+/*
+ * Check whether a rate-limited subscriber skips this frame, must be called with the
+ * lock held. The frame closest to each due time is taken, up to half a producer
+ * period early. A due time further away than one interval, e.g. after the timestamps
+ * restarted, does not hold the subscriber back.
+ */
+static bool decimate_locked(struct frame_subscriber *sub, const frame_t *frame)
+{
+    int64_t early = sub->bcast->frame_interval_us / 2;
+    int64_t ahead = sub->due_us - (frame->timestamp_us + early);
+
+    if (!sub->interval_us || !sub->due_us || ahead <= 0 || ahead > sub->interval_us) {
+        return false;
+    }
+
+    sub->decimated++;
+    return true;
+}
+
+/*
+ * Schedule the next delivery one interval after the due time, not after the frame,
+ * so the average rate does not drift. After a gap longer than the interval the
+ * schedule restarts at this frame.
+ */
+static void decimate_advance_locked(struct frame_subscriber *sub, const frame_t *frame)
+{
+    int64_t early = sub->bcast->frame_interval_us / 2;
+
+    if (!sub->interval_us) {
+        return;
+    }
+
+    sub->due_us += sub->interval_us;
+    if (sub->due_us <= frame->timestamp_us + early || sub->due_us > frame->timestamp_us + sub->interval_us + early) {
+        sub->due_us = frame->timestamp_us + sub->interval_us;
+    }
+}
+
+static void notify_publisher(frame_broadcaster_handle_t bcast)
+{
+    TaskHandle_t publisher = bcast->publisher;
+
+    if (publisher) {
+        xTaskNotifyGive(publisher);
+    }
+}
+
+/* slot_count is the highest buffer count the producer may switch to later */
+static esp_err_t broadcaster_create(const frame_broadcaster_config_t *config, uint32_t slot_count,
+                                    frame_broadcaster_handle_t *ret_handle)
+{
+    frame_broadcaster_handle_t bcast;
+
+    ESP_RETURN_ON_FALSE(config && ret_handle, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->buffers && config->buffer_count && config->release_cb, ESP_ERR_INVALID_ARG,
+                        TAG, "invalid buffer configuration");
+    ESP_RETURN_ON_FALSE(config->buffer_count <= slot_count && slot_count <= FRAME_BROADCASTER_MAX_BUFS,
+                        ESP_ERR_INVALID_ARG, TAG, "too many buffers");
+
+    bcast = calloc(1, sizeof(struct frame_broadcaster) + slot_count * sizeof(frame_slot_t));
+    ESP_RETURN_ON_FALSE(bcast, ESP_ERR_NO_MEM, TAG, "failed to allocate broadcaster");
+
+    bcast->lock = xSemaphoreCreateMutex();
+    if (!bcast->lock) {
+        ESP_LOGE(TAG, "failed to create lock");
+        free(bcast);
+        return ESP_ERR_NO_MEM;
+    }
+
+    bcast->name = config->name ? config->name : "frames";
+    bcast->retained = -1;
+    bcast->buffer_count = config->buffer_count;
+    bcast->release_cb = config->release_cb;
+    bcast->release_arg = config->release_arg;
+    bcast->width = config->width;
+    bcast->height = config->height;
+    SLIST_INIT(&bcast->subs);
+
+    for (uint32_t i = 0; i < config->buffer_count; i++) {
+        bcast->slots[i].frame.index = i;
+        bcast->slots[i].frame.data = config->buffers[i];
+        bcast->slots[i].frame.dmabuf_fd = config->dmabufs ? config->dmabufs[i] : -1;
+    }
+
+    *ret_handle = bcast;
+    return ESP_OK;
+}
+
+esp_err_t frame_broadcaster_create(const frame_broadcaster_config_t *config, frame_broadcaster_handle_t *ret_handle)
+{
+    return broadcaster_create(config, config ? config->buffer_count : 0, ret_handle);
+}
+
+bool frame_broadcaster_publish(frame_broadcaster_handle_t bcast, uint32_t index, uint32_t size, int64_t timestamp_us)
+{
+    struct frame_subscriber *sub;
+    frame_slot_t *slot = &bcast->slots[index];
+    uint32_t handled;
+    bool waiting;
+    bool taken;
+
+    assert(index < bcast->buffer_count);
+
+    slot->frame.size = size;
+    slot->frame.width = bcast->width;
+    slot->frame.height = bcast->height;
+    slot->frame.sequence = bcast->sequence++;
+    slot->frame.timestamp_us = timestamp_us;
+    slot->refcount = 0;
+    if (bcast->last_timestamp_us && timestamp_us > bcast->last_timestamp_us) {
+        bcast->frame_interval_us = timestamp_us - bcast->last_timestamp_us;
+    }
+    bcast->last_timestamp_us = timestamp_us;
+    handled = slot->frame.sequence + 1;
+    TRACE_RING_RECORD(TRACE_EVENT_FRAME_PUBLISH, slot->frame.sequence);
+    if (!slot->frame.sequence) {
+        /* Time to first frame, next to the boot phase logs */
+        ESP_LOGI(TAG, "First frame at %lld ms", (long long)(esp_timer_get_time() / 1000));
+    }
+
+    /* The retained lease moves to the new frame, the previous one may go back to the producer */
+    {
+        int32_t previous = -1;
+        bool release = false;
+
+        xSemaphoreTake(bcast->lock, portMAX_DELAY);
+        if (bcast->retain_latest) {
+            slot->refcount++;
+            previous = bcast->retained;
+            bcast->retained = index;
+            release = previous >= 0 && slot_unref_locked(bcast, previous);
+        }
+        xSemaphoreGive(bcast->lock);
+
+        if (release) {
+            bcast->release_cb(previous, bcast->release_arg);
+        }
+    }
+
+    do {
+        uint32_t release = 0;
+
+        waiting = false;
+        xSemaphoreTake(bcast->lock, portMAX_DELAY);
+        SLIST_FOREACH(sub, &bcast->subs, node) {
+            if (sub->handled == handled) {
+                continue;
+            }
+
+            /* A skipped frame is never leased, its buffer is not touched for this subscriber */
+            if (decimate_locked(sub, &slot->frame)) {
+                sub->handled = handled;
+                continue;
+            }
+
+            if (deliver_locked(sub, slot, &release)) {
+                decimate_advance_locked(sub, &slot->frame);
+                sub->handled = handled;
+            } else {
+                waiting = true;
+            }
+        }
+        taken = slot->refcount > 0;
+        bcast->publisher = waiting ? xTaskGetCurrentTaskHandle() : NULL;
+        xSemaphoreGive(bcast->lock);
+
+        release_buffers(bcast, release);
+
+        /* Lossless subscribers are full, wait until one of them releases a frame */
+        if (waiting) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOSSLESS_RETRY_MS));
+        }
+    } while (waiting);
+
+    return taken;
+}
+
+/* Drop the retained lease, the frame stays with the subscribers still holding it */
+static void drop_retained(frame_broadcaster_handle_t bcast)
+{
+    int32_t retained;
+    bool release;
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    retained = bcast->retained;
+    bcast->retained = -1;
+    release = retained >= 0 && slot_unref_locked(bcast, retained);
+    xSemaphoreGive(bcast->lock);
+
+    if (release) {
+        bcast->release_cb(retained, bcast->release_arg);
+    }
+}
+
+void frame_broadcaster_set_retain_latest(frame_broadcaster_handle_t bcast, bool enable)
+{
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    bcast->retain_latest = enable;
+    xSemaphoreGive(bcast->lock);
+
+    /* A frame published in between is retained under the lock as well, it is dropped here too */
+    if (!enable) {
+        drop_retained(bcast);
+    }
+}
+
+esp_err_t frame_broadcaster_get_latest(frame_broadcaster_handle_t bcast, const frame_t **frame)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    ESP_RETURN_ON_FALSE(bcast && frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    if (!bcast->retain_latest) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (bcast->retained >= 0) {
+        frame_slot_t *slot = &bcast->slots[bcast->retained];
+
+        slot->refcount++;
+        *frame = &slot->frame;
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(bcast->lock);
+
+    if (ret == ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "%s: latest frame is not retained", bcast->name);
+    }
+    return ret;
+}
+
+void frame_broadcaster_put_latest(frame_broadcaster_handle_t bcast, const frame_t *frame)
+{
+    bool release;
+    uint32_t index = frame->index;
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    release = slot_unref_locked(bcast, index);
+    xSemaphoreGive(bcast->lock);
+
+    if (release) {
+        bcast->release_cb(index, bcast->release_arg);
+    }
+}
+
+void frame_broadcaster_set_geometry(frame_broadcaster_handle_t bcast, uint32_t width, uint32_t height)
+{
+    bcast->width = width;
+    bcast->height = height;
+}
+
+frame_subscriber_t *frame_broadcaster_subscribe(frame_broadcaster_handle_t bcast, const frame_subscriber_config_t *config)
+{
+    struct frame_subscriber *sub;
+    uint32_t depth;
+    const frame_subscriber_config_t default_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    ESP_RETURN_ON_FALSE(bcast, NULL, TAG, "broadcaster is not started");
+
+    if (!config) {
+        config = &default_config;
+    }
+    ESP_RETURN_ON_FALSE(config->policy <= FRAME_DELIVERY_LOSSLESS, NULL, TAG, "invalid policy");
+
+    if (config->policy == FRAME_DELIVERY_LATEST_ONLY) {
+        depth = 1;
+    } else {
+        depth = MIN(MAX(config->queue_depth, 1), bcast->buffer_count);
+    }
+
+    sub = calloc(1, sizeof(struct frame_subscriber));
+    ESP_RETURN_ON_FALSE(sub, NULL, TAG, "failed to allocate subscriber");
+
+    sub->bcast = bcast;
+    sub->policy = config->policy;
+    sub->max_fps = config->max_fps;
+    sub->interval_us = config->max_fps ? 1000000 / config->max_fps : 0;
+    if (config->name) {
+        strlcpy(sub->name, config->name, sizeof(sub->name));
+    }
+
+    sub->queue = xQueueCreate(depth, sizeof(const frame_t *));
+    if (!sub->queue) {
+        ESP_LOGE(TAG, "failed to create subscriber queue");
+        free(sub);
+        return NULL;
+    }
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    sub->id = bcast->next_id++;
+    SLIST_INSERT_HEAD(&bcast->subs, sub, node);
+    bcast->sub_count++;
+    xSemaphoreGive(bcast->lock);
+
+    ESP_LOGI(TAG, "%s: subscriber %"PRIu32" (%s) added, policy=%s depth=%"PRIu32" max_fps=%"PRIu32", total=%"PRIu32,
+             bcast->name, sub->id, sub->name, frame_delivery_policy_to_str(sub->policy), depth, sub->max_fps,
+             bcast->sub_count);
+    return sub;
+}
+
+void frame_broadcaster_unsubscribe(frame_subscriber_t *sub)
+{
+    uint32_t release = 0;
+    frame_broadcaster_handle_t bcast;
+
+    if (!sub) {
+        return;
+    }
+
+    bcast = sub->bcast;
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    SLIST_REMOVE(&bcast->subs, sub, frame_subscriber, node);
+    bcast->sub_count--;
+    for (uint32_t i = 0; i < bcast->buffer_count; i++) {
+        if ((sub->leases & BIT(i)) && slot_unref_locked(bcast, i)) {
+            release |= BIT(i);
+        }
+    }
+    sub->leases = 0;
+    notify_publisher(bcast);
+    xSemaphoreGive(bcast->lock);
+
+    release_buffers(bcast, release);
+
+    ESP_LOGI(TAG, "%s: subscriber %"PRIu32" removed, delivered=%"PRIu32" dropped=%"PRIu32" decimated=%"PRIu32", total=%"PRIu32,
+             bcast->name, sub->id, sub->delivered, sub->dropped, sub->decimated, bcast->sub_count);
+
+    vQueueDelete(sub->queue);
+    free(sub);
+}
+
+esp_err_t frame_subscriber_wait(frame_subscriber_t *sub, const frame_t **frame, TickType_t timeout)
+{
+    if (xQueueReceive(sub->queue, frame, timeout) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+/* A frame outside the lease slots is a private copy from frame_subscriber_make_writable() */
+static bool frame_is_copy(frame_broadcaster_handle_t bcast, const frame_t *frame)
+{
+    return frame->index >= bcast->buffer_count || frame != &bcast->slots[frame->index].frame;
+}
+
+esp_err_t frame_subscriber_make_writable(frame_subscriber_t *sub, const frame_t *frame, frame_t **ret_frame)
+{
+    bool shared;
+    frame_t *copy;
+    uint32_t index;
+    frame_broadcaster_handle_t bcast;
+
+    ESP_RETURN_ON_FALSE(sub && frame && ret_frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    bcast = sub->bcast;
+    if (frame_is_copy(bcast, frame)) {
+        *ret_frame = (frame_t *)frame;
+        return ESP_OK;
+    }
+
+    /*
+     * New leases are only taken on the frame being published and on the retained
+     * frame, which holds a lease of its own, so a sole lease stays sole.
+     */
+    index = frame->index;
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    if (!(sub->leases & BIT(index))) {
+        xSemaphoreGive(bcast->lock);
+        ESP_LOGE(TAG, "%s: subscriber %"PRIu32" does not hold buffer %"PRIu32, bcast->name, sub->id, index);
+        return ESP_ERR_INVALID_ARG;
+    }
+    shared = bcast->slots[index].refcount > 1;
+    xSemaphoreGive(bcast->lock);
+
+    if (!shared) {
+        *ret_frame = (frame_t *)frame;
+        return ESP_OK;
+    }
+
+    /* The copy takes the place of the frame in PSRAM, where the buffers usually are */
+    copy = heap_caps_malloc(sizeof(frame_t) + frame->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!copy) {
+        copy = heap_caps_malloc(sizeof(frame_t) + frame->size, MALLOC_CAP_8BIT);
+    }
+    ESP_RETURN_ON_FALSE(copy, ESP_ERR_NO_MEM, TAG, "%s: no memory to copy a %"PRIu32" byte frame", bcast->name, frame->size);
+
+    *copy = *frame;
+    copy->data = (uint8_t *)(copy + 1);
+    copy->dmabuf_fd = -1;
+    memcpy(copy->data, frame->data, frame->size);
+
+    frame_subscriber_release(sub, frame);
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    sub->copied++;
+    xSemaphoreGive(bcast->lock);
+
+    *ret_frame = copy;
+    return ESP_OK;
+}
+
+void frame_subscriber_release(frame_subscriber_t *sub, const frame_t *frame)
+{
+    bool release = false;
+    uint32_t index = frame->index;
+    frame_broadcaster_handle_t bcast = sub->bcast;
+
+    if (frame_is_copy(bcast, frame)) {
+        heap_caps_free((void *)frame);
+        return;
+    }
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    if (sub->leases & BIT(index)) {
+        sub->leases &= ~BIT(index);
+        release = slot_unref_locked(bcast, index);
+    }
+    if (sub->policy == FRAME_DELIVERY_LOSSLESS) {
+        notify_publisher(bcast);
+    }
+    xSemaphoreGive(bcast->lock);
+
+    if (release) {
+        bcast->release_cb(index, bcast->release_arg);
+    }
+}
+
+uint32_t frame_broadcaster_subscriber_count(frame_broadcaster_handle_t bcast)
+{
+    return bcast ? bcast->sub_count : 0;
+}
+
+uint32_t frame_broadcaster_get_stats(frame_broadcaster_handle_t bcast, frame_subscriber_stats_t *stats, uint32_t max)
+{
+    uint32_t n = 0;
+    struct frame_subscriber *sub;
+
+    if (!bcast) {
+        return 0;
+    }
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    SLIST_FOREACH(sub, &bcast->subs, node) {
+        if (n >= max) {
+            break;
+        }
+
+        stats[n].id = sub->id;
+        strlcpy(stats[n].name, sub->name, sizeof(stats[n].name));
+        stats[n].policy = sub->policy;
+        stats[n].delivered = sub->delivered;
+        stats[n].dropped = sub->dropped;
+        stats[n].decimated = sub->decimated;
+        stats[n].copied = sub->copied;
+        stats[n].max_fps = sub->max_fps;
+        n++;
+    }
+    xSemaphoreGive(bcast->lock);
+
+    return n;
+}
+
+esp_err_t frame_subscriber_get_stats(frame_subscriber_t *sub, frame_subscriber_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(sub && stats, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    xSemaphoreTake(sub->bcast->lock, portMAX_DELAY);
+    stats->id = sub->id;
+    strlcpy(stats->name, sub->name, sizeof(stats->name));
+    stats->policy = sub->policy;
+    stats->delivered = sub->delivered;
+    stats->dropped = sub->dropped;
+    stats->decimated = sub->decimated;
+    stats->copied = sub->copied;
+    stats->max_fps = sub->max_fps;
+    xSemaphoreGive(sub->bcast->lock);
+
+    return ESP_OK;
+}
+
+static const char *const s_policy_names[] = {
+    [FRAME_DELIVERY_LATEST_ONLY] = "latest",
+    [FRAME_DELIVERY_DROP_OLDEST] = "drop_oldest",
+    [FRAME_DELIVERY_LOSSLESS] = "lossless",
+};
+
+esp_err_t frame_delivery_policy_from_str(const char *name, frame_delivery_policy_t *policy)
+{
+    for (int i = 0; i < sizeof(s_policy_names) / sizeof(s_policy_names[0]); i++) {
+        if (!strcmp(name, s_policy_names[i])) {
+            *policy = (frame_delivery_policy_t)i;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+const char *frame_delivery_policy_to_str(frame_delivery_policy_t policy)
+{
+    if (policy > FRAME_DELIVERY_LOSSLESS) {
+        return "unknown";
+    }
+
+    return s_policy_names[policy];
+}
+
+/* ========== V4L2 capture producer ========== */
+
+static void capture_qbuf(capture_source_t *source, uint32_t index)
+{
+    TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_QBUF, index);
+    capture_buffers_queue(source->bufs, index);
+}
+
+static void capture_queue_buffer(uint32_t index, void *arg)
+{
+    capture_source_t *source = (capture_source_t *)arg;
+
+    xSemaphoreTake(source->queue_lock, portMAX_DELAY);
+    if (source->stopped) {
+        source->idle |= BIT(index);
+    } else {
+        capture_qbuf(source, index);
+    }
+    xSemaphoreGive(source->queue_lock);
+}
+
+/* Bitmask of the buffers no subscriber holds a lease on */
+static uint32_t capture_unleased_buffers(frame_broadcaster_handle_t bcast)
+{
+    uint32_t mask = 0;
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < bcast->buffer_count; i++) {
+        if (!bcast->slots[i].refcount) {
+            mask |= BIT(i);
+        }
+    }
+    xSemaphoreGive(bcast->lock);
+
+    return mask;
+}
+
+static void capture_update_geometry(capture_source_t *source)
+{
+    struct v4l2_format format;
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(source->fd, VIDIOC_G_FMT, &format) == 0) {
+        source->bcast->width = format.fmt.pix.width;
+        source->bcast->height = format.fmt.pix.height;
+    }
+}
+
+/*
+ * Run the pending reconfiguration request. STREAMOFF resets every buffer the driver
+ * held, those and the unpublished one are queued again before STREAMON, buffers still
+ * leased by subscribers are queued when they are released.
+ */
+static void capture_reconfigure(capture_source_t *source)
+{
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    xSemaphoreTake(source->queue_lock, portMAX_DELAY);
+    source->stopped = true;
+    if (ioctl(source->fd, VIDIOC_STREAMOFF, &type) != 0) {
+        ESP_LOGE(TAG, "STREAMOFF failed (errno=%d)", errno);
+    }
+    source->idle |= capture_unleased_buffers(source->bcast);
+    xSemaphoreGive(source->queue_lock);
+
+    source->request_ret = source->request_cb(source->fd, source->request_arg);
+    capture_update_geometry(source);
+
+    xSemaphoreTake(source->queue_lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < source->bcast->buffer_count; i++) {
+        if (source->idle & BIT(i)) {
+            capture_qbuf(source, i);
+        }
+    }
+    source->idle = 0;
+    source->stopped = false;
+    if (ioctl(source->fd, VIDIOC_STREAMON, &type) != 0) {
+        ESP_LOGE(TAG, "STREAMON failed (errno=%d)", errno);
+        if (source->request_ret == ESP_OK) {
+            source->request_ret = ESP_FAIL;
+        }
+    }
+    xSemaphoreGive(source->queue_lock);
+
+    ESP_LOGI(TAG, "Capture reconfigured, %"PRIu32"x%"PRIu32, source->bcast->width, source->bcast->height);
+
+    source->request_cb = NULL;
+    xSemaphoreGive(source->request_done);
+}
+
+typedef struct {
+    capture_source_t *source;
+    const capture_buffers_config_t *config;
+    uint32_t timeout_ms;
+} capture_resize_t;
+
+/*
+ * Runs in the capture task while streaming is off. The buffers can only be freed once
+ * every subscriber has released its leases, frames still queued for a subscriber
+ * count as leased until it has received and released them.
+ */
+static esp_err_t capture_resize(int fd, void *arg)
+{
+    esp_err_t ret;
+    capture_resize_t *resize = (capture_resize_t *)arg;
+    capture_source_t *source = resize->source;
+    frame_broadcaster_handle_t bcast = source->bcast;
+    capture_buffers_config_t old_config = source->bufs->config;
+    uint32_t all = (uint32_t)((1ULL << bcast->buffer_count) - 1);   /* BIT(32) would overflow */
+    int64_t deadline = esp_timer_get_time() + (int64_t)resize->timeout_ms * 1000;
+
+    /* Publishing retains the next frame again once streaming is back on */
+    drop_retained(bcast);
+    while (capture_unleased_buffers(bcast) != all) {
+        if (esp_timer_get_time() >= deadline) {
+            ESP_LOGW(TAG, "Buffers still leased after %"PRIu32" ms, keeping the current buffers", resize->timeout_ms);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CAPTURE_RESIZE_POLL_MS));
+    }
+
+    capture_buffers_free(source->bufs);
+    ret = capture_buffers_alloc(fd, resize->config, source->bufs);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to allocate the new buffers, restoring %"PRIu32" %s buffers",
+                 old_config.count, capture_buffers_mem_to_str(old_config.mem));
+        if (capture_buffers_alloc(fd, &old_config, source->bufs) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to restore the capture buffers");
+        }
+    }
+
+    xSemaphoreTake(bcast->lock, portMAX_DELAY);
+    bcast->buffer_count = source->bufs->count;
+    for (uint32_t i = 0; i < bcast->buffer_count; i++) {
+        bcast->slots[i].frame.index = i;
+        bcast->slots[i].frame.data = source->bufs->data[i];
+        bcast->slots[i].frame.dmabuf_fd = source->bufs->dmabuf[i];
+    }
+    xSemaphoreGive(bcast->lock);
+
+    /* capture_buffers_alloc() has queued every new buffer */
+    xSemaphoreTake(source->queue_lock, portMAX_DELAY);
+    source->idle = 0;
+    xSemaphoreGive(source->queue_lock);
+
+    return ret;
+}
+
+static void capture_task(void *arg)
+{
+    struct v4l2_buffer buf;
+    uint32_t dqbuf_errors = 0;
+    capture_source_t *source = (capture_source_t *)arg;
+
+    while (true) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = source->bufs->memory;
+
+        int64_t wait_start = esp_timer_get_time();
+        if (ioctl(source->fd, VIDIOC_DQBUF, &buf) != 0) {
+            dqbuf_errors++;
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
+            if (dqbuf_errors <= 5 || dqbuf_errors % 100 == 0) {
+                ESP_LOGE(TAG, "DQBUF failed (errno=%d), errors=%"PRIu32, errno, dqbuf_errors);
+            }
+            if (source->request_cb) {
+                capture_reconfigure(source);
+            }
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf.index);
+        stream_metrics_record_capture(now - wait_start, (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec,
+                                      now, buf.sequence);
+
+        /* The dequeued buffer is not leased, STREAMOFF hands it back with the others */
+        if (source->request_cb) {
+            capture_reconfigure(source);
+            continue;
+        }
+
+        /*
+         * Do not wait for subscribers here: the buffer goes back to the driver when the
+         * last lease is dropped, meanwhile the remaining buffers keep being filled.
+         */
+        if (!frame_broadcaster_publish(source->bcast, buf.index, buf.bytesused, now)) {
+            capture_queue_buffer(buf.index, source);
+        }
+    }
+}
+
+esp_err_t frame_broadcaster_start_capture(capture_buffers_t *bufs, frame_broadcaster_handle_t *ret_handle)
+{
+    esp_err_t ret = ESP_OK;
+    capture_source_t *source;
+    struct v4l2_format format;
+    int fd;
+
+    ESP_RETURN_ON_FALSE(bufs && bufs->fd >= 0 && ret_handle, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    fd = bufs->fd;
+
+    source = calloc(1, sizeof(capture_source_t));
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_NO_MEM, TAG, "failed to allocate capture source");
+    source->fd = fd;
+    source->bufs = bufs;
+
+    source->queue_lock = xSemaphoreCreateMutex();
+    source->request_lock = xSemaphoreCreateMutex();
+    source->request_done = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(source->queue_lock && source->request_lock && source->request_done,
+                      ESP_ERR_NO_MEM, fail_0, TAG, "failed to create capture locks");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_G_FMT, &format) == 0, ESP_FAIL, fail_0, TAG, "failed to get format");
+
+#if CONFIG_EXAMPLE_CAPTURE_DROP_OLDEST
+    struct esp_video_drop_policy drop_policy = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .policy = ESP_VIDEO_DROP_OLDEST,
+    };
+    if (ioctl(fd, VIDIOC_S_DROP_POLICY, &drop_policy) != 0) {
+        ESP_LOGW(TAG, "Drop policy not supported (errno=%d), stale frames may be dequeued", errno);
+    }
+#endif
+
+    frame_broadcaster_config_t config = {
+        .name = "capture",
+        .buffers = bufs->data,
+        .dmabufs = bufs->dmabuf,
+        .buffer_count = bufs->count,
+        .release_cb = capture_queue_buffer,
+        .release_arg = source,
+        .width = format.fmt.pix.width,
+        .height = format.fmt.pix.height,
+    };
+    ESP_GOTO_ON_ERROR(broadcaster_create(&config, CAPTURE_BUFFERS_MAX, &source->bcast), fail_0,
+                      TAG, "failed to create broadcaster");
+    source->bcast->capture = source;
+
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(capture_task, "capture", CAPTURE_TASK_STACK_SIZE, source,
+                                              CAPTURE_TASK_PRIORITY, &source->task, CAPTURE_TASK_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, fail_1, TAG, "failed to create capture task");
+
+    ESP_LOGI(TAG, "Capture task started, %"PRIu32" buffers", bufs->count);
+    *ret_handle = source->bcast;
+    return ESP_OK;
+
+fail_1:
+    vSemaphoreDelete(source->bcast->lock);
+    free(source->bcast);
+fail_0:
+    if (source->request_done) {
+        vSemaphoreDelete(source->request_done);
+    }
+    if (source->request_lock) {
+        vSemaphoreDelete(source->request_lock);
+    }
+    if (source->queue_lock) {
+        vSemaphoreDelete(source->queue_lock);
+    }
+    free(source);
+    return ret;
+}
+
+esp_err_t frame_broadcaster_reconfigure_capture(frame_broadcaster_handle_t bcast, frame_capture_reconfig_cb_t cb, void *arg)
+{
+    esp_err_t ret;
+    capture_source_t *source;
+
+    ESP_RETURN_ON_FALSE(bcast && bcast->capture && cb, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    source = bcast->capture;
+
+    xSemaphoreTake(source->request_lock, portMAX_DELAY);
+    source->request_arg = arg;
+    source->request_cb = cb;
+    xSemaphoreTake(source->request_done, portMAX_DELAY);
+    ret = source->request_ret;
+    xSemaphoreGive(source->request_lock);
+
+    return ret;
+}
+
+esp_err_t frame_broadcaster_resize_capture(frame_broadcaster_handle_t bcast, const capture_buffers_config_t *config,
+                                           uint32_t timeout_ms)
+{
+    ESP_RETURN_ON_FALSE(bcast && bcast->capture && config, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->count >= 1 && config->count <= CAPTURE_BUFFERS_MAX, ESP_ERR_INVALID_ARG,
+                        TAG, "buffer count must be 1 to %d", CAPTURE_BUFFERS_MAX);
+
+    capture_resize_t resize = {
+        .source = bcast->capture,
+        .config = config,
+        .timeout_ms = timeout_ms,
+    };
+
+    return frame_broadcaster_reconfigure_capture(bcast, capture_resize, &resize);
+}
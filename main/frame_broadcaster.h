@@ -0,0 +1,379 @@
+/*
+ * Frame broadcaster for the RAW/RGB HTTP streamer
+ *
+ * A single producer (the V4L2 capture task, or an encoder stage) publishes
+ * every frame to all registered subscribers. HTTP handlers never touch the
+ * V4L2 queue directly, so adding a viewer no longer splits the frame rate
+ * between clients or adds DQBUF contention.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "capture_buffers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Frame published by the broadcaster
+ */
+typedef struct {
+    uint32_t index;         /*!< V4L2 buffer index */
+    uint8_t *data;          /*!< Mapped frame data */
+    int dmabuf_fd;          /*!< DMABUF handle of the buffer, -1 if it is not exported */
+    uint32_t size;          /*!< Valid data size in bytes */
+    uint32_t width;         /*!< Frame width in pixels */
+    uint32_t height;        /*!< Frame height in pixels */
+    uint32_t sequence;      /*!< Frame sequence number, counted by the capture task */
+    int64_t timestamp_us;   /*!< esp_timer time at which the frame was dequeued */
+} frame_t;
+
+/**
+ * @brief Frame broadcaster handle
+ */
+typedef struct frame_broadcaster *frame_broadcaster_handle_t;
+
+/**
+ * @brief Give a buffer back to the producer once its last lease is released
+ *
+ * @param index Buffer index
+ * @param arg   User argument from frame_broadcaster_config_t
+ */
+typedef void (*frame_broadcaster_release_cb_t)(uint32_t index, void *arg);
+
+/**
+ * @brief Broadcaster configuration
+ */
+typedef struct {
+    const char *name;                           /*!< Name used in log messages */
+    uint8_t **buffers;                          /*!< Buffer pointers, indexed by buffer index */
+    const int *dmabufs;                         /*!< DMABUF handles, indexed by buffer index, can be NULL */
+    uint32_t buffer_count;                      /*!< Number of buffers, 32 at most */
+    frame_broadcaster_release_cb_t release_cb;  /*!< Called when a published buffer is no longer used */
+    void *release_arg;                          /*!< User argument of release_cb */
+    uint32_t width;                             /*!< Frame width stamped on published frames, can be 0 */
+    uint32_t height;                            /*!< Frame height stamped on published frames, can be 0 */
+} frame_broadcaster_config_t;
+
+/**
+ * @brief Reconfigure a stopped capture device
+ *
+ * Called from the capture task between STREAMOFF and STREAMON, e.g. to change
+ * the selection or the format. The frame geometry is read back with VIDIOC_G_FMT.
+ *
+ * @param fd  Video device file descriptor
+ * @param arg User argument of frame_broadcaster_reconfigure_capture()
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed, it is returned to the caller
+ */
+typedef esp_err_t (*frame_capture_reconfig_cb_t)(int fd, void *arg);
+
+/**
+ * @brief Frame subscriber handle
+ */
+typedef struct frame_subscriber frame_subscriber_t;
+
+/**
+ * @brief What happens when a frame is published to a subscriber whose queue is full
+ */
+typedef enum {
+    FRAME_DELIVERY_LATEST_ONLY = 0,     /*!< Keep only the newest frame, the queued one is dropped */
+    FRAME_DELIVERY_DROP_OLDEST,         /*!< Bounded queue, the oldest queued frame is dropped */
+    FRAME_DELIVERY_LOSSLESS,            /*!< Bounded queue, the capture task waits for room */
+} frame_delivery_policy_t;
+
+#define FRAME_SUBSCRIBER_NAME_LEN       32
+
+/**
+ * @brief Subscriber configuration
+ */
+typedef struct {
+    frame_delivery_policy_t policy;     /*!< Delivery policy */
+    uint32_t queue_depth;               /*!< Queue depth, forced to 1 for FRAME_DELIVERY_LATEST_ONLY and capped to the buffer count */
+    const char *name;                   /*!< Name reported in statistics, can be NULL */
+    uint32_t max_fps;                   /*!< Highest delivery rate paced on the frame timestamps, 0 for every frame */
+} frame_subscriber_config_t;
+
+#define FRAME_SUBSCRIBER_DEFAULT_CONFIG() {     \
+    .policy = FRAME_DELIVERY_LATEST_ONLY,       \
+    .queue_depth = 1,                           \
+    .name = NULL,                               \
+    .max_fps = 0,                               \
+}
+
+/**
+ * @brief Subscriber statistics
+ */
+typedef struct {
+    uint32_t id;                                /*!< Subscriber ID, unique for the broadcaster lifetime */
+    char name[FRAME_SUBSCRIBER_NAME_LEN];       /*!< Subscriber name */
+    frame_delivery_policy_t policy;             /*!< Delivery policy */
+    uint32_t delivered;                         /*!< Frames queued to the subscriber */
+    uint32_t dropped;                           /*!< Frames skipped because the subscriber fell behind */
+    uint32_t decimated;                         /*!< Frames skipped to hold max_fps */
+    uint32_t copied;                            /*!< Shared frames copied by frame_subscriber_make_writable() */
+    uint32_t max_fps;                           /*!< Configured rate limit, 0 if none */
+} frame_subscriber_stats_t;
+
+/**
+ * @brief Create a broadcaster for a producer-owned buffer set
+ *
+ * @param config     Broadcaster configuration
+ * @param ret_handle Returned broadcaster handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t frame_broadcaster_create(const frame_broadcaster_config_t *config, frame_broadcaster_handle_t *ret_handle);
+
+/**
+ * @brief Publish a filled buffer to all subscribers
+ *
+ * Blocks while a lossless subscriber has no room in its queue.
+ *
+ * @param bcast        Broadcaster handle
+ * @param index        Buffer index
+ * @param size         Valid data size in bytes
+ * @param timestamp_us Capture timestamp
+ *
+ * @return
+ *      - true if at least one subscriber took the frame, release_cb is called later
+ *      - false if nobody took it, the buffer still belongs to the caller
+ */
+bool frame_broadcaster_publish(frame_broadcaster_handle_t bcast, uint32_t index, uint32_t size, int64_t timestamp_us);
+
+/**
+ * @brief Set the geometry stamped on the next published frames
+ *
+ * Only the producer may call this, between two frame_broadcaster_publish() calls.
+ *
+ * @param bcast  Broadcaster handle
+ * @param width  Frame width in pixels
+ * @param height Frame height in pixels
+ */
+void frame_broadcaster_set_geometry(frame_broadcaster_handle_t bcast, uint32_t width, uint32_t height);
+
+/**
+ * @brief Keep a lease on the latest published frame
+ *
+ * The retained frame can be read with frame_broadcaster_get_latest() without waiting
+ * for the next one, at the cost of one buffer that is not available to the producer.
+ * The lease moves to every new frame.
+ *
+ * @param bcast  Broadcaster handle
+ * @param enable Retain the latest frame, false releases the retained one
+ */
+void frame_broadcaster_set_retain_latest(frame_broadcaster_handle_t bcast, bool enable);
+
+/**
+ * @brief Take a lease on the latest published frame
+ *
+ * @param bcast Broadcaster with frame retention enabled
+ * @param frame Returned frame, give it back with frame_broadcaster_put_latest()
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the broadcaster does not retain frames
+ *      - ESP_ERR_NOT_FOUND if no frame was published yet
+ */
+esp_err_t frame_broadcaster_get_latest(frame_broadcaster_handle_t bcast, const frame_t **frame);
+
+/**
+ * @brief Give back a frame returned by frame_broadcaster_get_latest()
+ *
+ * @param bcast Broadcaster handle
+ * @param frame Frame to release
+ */
+void frame_broadcaster_put_latest(frame_broadcaster_handle_t bcast, const frame_t *frame);
+
+/**
+ * @brief Start the V4L2 capture task and its broadcaster
+ *
+ * The video device must already be streaming and all buffers must be queued.
+ *
+ * @param bufs       Buffers from capture_buffers_alloc(), must stay valid while capturing,
+ *                   frame_broadcaster_resize_capture() updates them in place
+ * @param ret_handle Returned broadcaster handle
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t frame_broadcaster_start_capture(capture_buffers_t *bufs, frame_broadcaster_handle_t *ret_handle);
+
+/**
+ * @brief Stop the capture device, run a reconfiguration callback and restart it
+ *
+ * Blocks until the capture task has handled the request. Frames already delivered
+ * keep their lease and their geometry, the buffers are queued again on release.
+ *
+ * @param bcast Broadcaster returned by frame_broadcaster_start_capture()
+ * @param cb    Reconfiguration callback
+ * @param arg   User argument of cb
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the broadcaster has no capture task
+ *      - Others returned by cb
+ */
+esp_err_t frame_broadcaster_reconfigure_capture(frame_broadcaster_handle_t bcast, frame_capture_reconfig_cb_t cb, void *arg);
+
+/**
+ * @brief Replace the capture buffers with a new count or memory placement
+ *
+ * Streaming is stopped until every subscriber has released its leases, then the
+ * buffers are freed and allocated again. If the new buffers cannot be allocated the
+ * previous configuration is restored.
+ *
+ * @param bcast      Broadcaster returned by frame_broadcaster_start_capture()
+ * @param config     New buffer configuration
+ * @param timeout_ms How long to wait for subscribers to release their leases
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the broadcaster has no capture task or the configuration is invalid
+ *      - ESP_ERR_TIMEOUT if frames were still leased after timeout_ms, the buffers are unchanged
+ *      - Others from capture_buffers_alloc(), the previous buffers are restored
+ */
+esp_err_t frame_broadcaster_resize_capture(frame_broadcaster_handle_t bcast, const capture_buffers_config_t *config,
+                                           uint32_t timeout_ms);
+
+/**
+ * @brief Register a new subscriber, it receives frames dequeued after this call
+ *
+ * @note A lossless subscriber that stops reading stalls the capture task, and
+ *       therefore every other subscriber, until it catches up or unsubscribes.
+ *
+ * @note With max_fps set, the frames between two due times are skipped before they
+ *       are queued, so they take no lease and never stall the producer. Due times
+ *       follow the frame timestamps, the average rate does not drift with the
+ *       sensor rate.
+ *
+ * @param bcast  Broadcaster handle
+ * @param config Subscriber configuration, NULL for FRAME_SUBSCRIBER_DEFAULT_CONFIG()
+ *
+ * @return
+ *      - Subscriber handle on success
+ *      - NULL if failed
+ */
+frame_subscriber_t *frame_broadcaster_subscribe(frame_broadcaster_handle_t bcast, const frame_subscriber_config_t *config);
+
+/**
+ * @brief Remove a subscriber, any frame it still holds or has not yet received is released
+ *
+ * @param sub Subscriber handle
+ */
+void frame_broadcaster_unsubscribe(frame_subscriber_t *sub);
+
+/**
+ * @brief Wait for the next frame
+ *
+ * The returned frame is a lease on one mmap buffer, the data stays valid until
+ * frame_subscriber_release() is called. A subscriber may hold several frames at
+ * once, the buffer is given back to the driver when its last lease is released.
+ *
+ * @param sub     Subscriber handle
+ * @param frame   Returned frame pointer
+ * @param timeout Wait timeout in OS ticks
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_TIMEOUT if no frame arrived in time
+ */
+esp_err_t frame_subscriber_wait(frame_subscriber_t *sub, const frame_t **frame, TickType_t timeout);
+
+/**
+ * @brief Give a frame back to the broadcaster
+ *
+ * @param sub   Subscriber handle
+ * @param frame Frame returned by frame_subscriber_wait() or frame_subscriber_make_writable()
+ */
+void frame_subscriber_release(frame_subscriber_t *sub, const frame_t *frame);
+
+/**
+ * @brief Get a frame the subscriber may write to, copy-on-write
+ *
+ * A frame whose lease no other subscriber or the retained latest frame shares is
+ * returned as is, it is written in place. Otherwise the frame is copied into a
+ * private buffer and its lease is released, so the other holders keep reading the
+ * original data. Readers never pay for the copy, only a writer of a shared frame.
+ *
+ * The returned frame replaces the one passed in, release it with
+ * frame_subscriber_release() before the subscriber is removed.
+ *
+ * @param sub       Subscriber handle
+ * @param frame     Frame returned by frame_subscriber_wait()
+ * @param ret_frame Returned writable frame
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the subscriber does not hold the frame
+ *      - ESP_ERR_NO_MEM if the frame is shared and there is no memory for the copy,
+ *        the subscriber still holds the frame
+ */
+esp_err_t frame_subscriber_make_writable(frame_subscriber_t *sub, const frame_t *frame, frame_t **ret_frame);
+
+/**
+ * @brief Get the number of active subscribers
+ *
+ * @param bcast Broadcaster handle
+ *
+ * @return Subscriber count
+ */
+uint32_t frame_broadcaster_subscriber_count(frame_broadcaster_handle_t bcast);
+
+/**
+ * @brief Get statistics of the active subscribers
+ *
+ * @param bcast Broadcaster handle
+ * @param stats Statistics array to fill
+ * @param max   Number of entries in stats
+ *
+ * @return Number of entries filled
+ */
+uint32_t frame_broadcaster_get_stats(frame_broadcaster_handle_t bcast, frame_subscriber_stats_t *stats, uint32_t max);
+
+/**
+ * @brief Get the statistics of one subscriber
+ *
+ * @param sub   Subscriber handle
+ * @param stats Returned statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is NULL
+ */
+esp_err_t frame_subscriber_get_stats(frame_subscriber_t *sub, frame_subscriber_stats_t *stats);
+
+/**
+ * @brief Parse a delivery policy name ("latest", "drop_oldest" or "lossless")
+ *
+ * @param name   Policy name
+ * @param policy Returned policy
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if the name is unknown
+ */
+esp_err_t frame_delivery_policy_from_str(const char *name, frame_delivery_policy_t *policy);
+
+/**
+ * @brief Get the name of a delivery policy
+ *
+ * @param policy Delivery policy
+ *
+ * @return Policy name
+ */
+const char *frame_delivery_policy_to_str(frame_delivery_policy_t policy);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Wall clock frame times
+ *
+ * The offset from the esp_timer clock to the system wall clock is sampled
+ * at most once per FRAME_CLOCK_SAMPLE_US and low-pass filtered, so the read
+ * jitter of one sample does not show in the frame times and SNTP slewing
+ * the system clock moves them smoothly. A larger change, like the first
+ * SNTP sync after boot, is taken at once.
+ *
+ * Between SNTP syncs the system clock runs on the local crystal, its drift
+ * against other boards grows with CONFIG_LWIP_SNTP_UPDATE_DELAY.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_EXAMPLE_FRAME_CLOCK_SNTP
+#include "esp_netif_sntp.h"
+#endif
+#include "frame_clock.h"
+
+#define FRAME_CLOCK_SAMPLE_US       1000000     /* Offset sampling period */
+#define FRAME_CLOCK_STEP_US         100000      /* Offset change taken at once instead of filtered */
+#define FRAME_CLOCK_FILTER_SHIFT    2           /* A sample moves the offset by 1/4 of its difference */
+#define FRAME_CLOCK_SAMPLE_TRIES    3           /* Clock reads per sample, the tightest pair is kept */
+#define FRAME_CLOCK_VALID_SEC       1577836800  /* 2020-01-01, an earlier system time was never set */
+
+static const char *TAG = "frame_clock";
+
+static struct {
+    portMUX_TYPE lock;
+    bool valid;                 /* offset_us is known */
+    int64_t offset_us;          /* Wall clock minus esp_timer clock */
+    int64_t sampled_us;         /* esp_timer time of the last sample */
+} s_clock = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/* Read both clocks, the pair read closest together is the least disturbed by preemption */
+static bool frame_clock_sample(int64_t *offset_us, int64_t *now_us)
+{
+    int64_t best = INT64_MAX;
+    struct timeval tv;
+
+    for (int i = 0; i < FRAME_CLOCK_SAMPLE_TRIES; i++) {
+        int64_t before = esp_timer_get_time();
+        gettimeofday(&tv, NULL);
+        int64_t after = esp_timer_get_time();
+
+        if (after - before < best) {
+            best = after - before;
+            *now_us = before + best / 2;
+            *offset_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - *now_us;
+        }
+    }
+
+    return tv.tv_sec >= FRAME_CLOCK_VALID_SEC;
+}
+
+static void frame_clock_update(bool step)
+{
+    int64_t offset_us;
+    int64_t now_us;
+
+    if (!frame_clock_sample(&offset_us, &now_us)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_clock.lock);
+    int64_t diff = offset_us - s_clock.offset_us;
+    if (!s_clock.valid || step || llabs(diff) > FRAME_CLOCK_STEP_US) {
+        s_clock.offset_us = offset_us;
+    } else {
+        s_clock.offset_us += diff / (1 << FRAME_CLOCK_FILTER_SHIFT);
+    }
+    s_clock.valid = true;
+    s_clock.sampled_us = now_us;
+    portEXIT_CRITICAL(&s_clock.lock);
+}
+
+#if CONFIG_EXAMPLE_FRAME_CLOCK_SNTP
+/* The system time was just set or slewed from a server, take the new offset as is */
+static void frame_clock_on_sync(struct timeval *tv)
+{
+    frame_clock_update(true);
+    ESP_LOGI(TAG, "SNTP sync, wall clock offset %lld us", s_clock.offset_us);
+}
+#endif
+
+esp_err_t frame_clock_start(void)
+{
+#if CONFIG_EXAMPLE_FRAME_CLOCK_SNTP
+    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_EXAMPLE_FRAME_CLOCK_SNTP_SERVER);
+
+    /* Slewing keeps consecutive frame times monotonic after the first sync */
+    config.smooth_sync = true;
+    config.sync_cb = frame_clock_on_sync;
+    ESP_RETURN_ON_ERROR(esp_netif_sntp_init(&config), TAG, "failed to start SNTP");
+
+    ESP_LOGI(TAG, "Frame times follow SNTP server %s", CONFIG_EXAMPLE_FRAME_CLOCK_SNTP_SERVER);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+int64_t frame_clock_to_wall_us(int64_t timestamp_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t offset_us;
+    bool valid;
+
+    portENTER_CRITICAL(&s_clock.lock);
+    bool stale = !s_clock.valid || now_us - s_clock.sampled_us >= FRAME_CLOCK_SAMPLE_US;
+    portEXIT_CRITICAL(&s_clock.lock);
+
+    if (stale) {
+        frame_clock_update(false);
+    }
+
+    portENTER_CRITICAL(&s_clock.lock);
+    valid = s_clock.valid;
+    offset_us = s_clock.offset_us;
+    portEXIT_CRITICAL(&s_clock.lock);
+
+    return valid ? timestamp_us + offset_us : 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * Wall clock frame times
+ *
+ * Frame timestamps are esp_timer times, which start at boot and cannot be
+ * compared between boards. The system wall clock, disciplined by SNTP, is
+ * the common time base: a frame time converted here is in microseconds
+ * since the UNIX epoch, so the frames of several boards can be aligned by
+ * their times alone.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start disciplining the system wall clock with SNTP
+ *
+ * The network must be up. Without CONFIG_EXAMPLE_FRAME_CLOCK_SNTP the wall
+ * clock is only valid when the application sets the system time itself.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if SNTP is not enabled
+ *      - Others if SNTP could not be started
+ */
+esp_err_t frame_clock_start(void);
+
+/**
+ * @brief Convert an esp_timer frame timestamp to wall clock time
+ *
+ * Safe to call from any task.
+ *
+ * @param timestamp_us esp_timer time of the frame
+ *
+ * @return Microseconds since the UNIX epoch, 0 while the system time is not set
+ */
+int64_t frame_clock_to_wall_us(int64_t timestamp_us);
+
+#ifdef __cplusplus
+}
+#endif
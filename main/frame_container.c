@@ -0,0 +1,161 @@
+/*
+ * Indexed multi-frame container file
+ *
+ * The index is kept in PSRAM while recording and written behind the last
+ * slot when the container is closed, the header is rewritten last with the
+ * final frame count so a file that was never closed reads as empty.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/errno.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_fat.h"
+#include "frame_container.h"
+
+#define FRAME_CONTAINER_ALIGN(size, align)  (((size) + (align) - 1) / (align) * (align))
+
+struct frame_container {
+    FILE *file;
+    frame_container_header_t header;
+    frame_container_entry_t *index;
+};
+
+static const char *TAG = "frame_container";
+
+static esp_err_t frame_container_write_at(frame_container_t *container, uint64_t offset, const void *data, size_t size)
+{
+    ESP_RETURN_ON_FALSE(fseek(container->file, offset, SEEK_SET) == 0, ESP_FAIL, TAG, "seek failed (errno=%d)", errno);
+    ESP_RETURN_ON_FALSE(fwrite(data, 1, size, container->file) == size, ESP_FAIL, TAG, "write failed (errno=%d)", errno);
+
+    return ESP_OK;
+}
+
+/* Allocate the whole file up front, contiguous clusters when the card has them */
+static FILE *frame_container_allocate(const char *base_path, const char *path, uint64_t size)
+{
+    FILE *file;
+
+    if (esp_vfs_fat_create_contiguous_file(base_path, path, size, true) == ESP_OK) {
+        return fopen(path, "r+b");
+    }
+
+    ESP_LOGW(TAG, "no contiguous space for %s, extending it instead", path);
+    file = fopen(path, "w+b");
+    if (file && (fseek(file, size - 1, SEEK_SET) != 0 || fputc(0, file) == EOF)) {
+        fclose(file);
+        remove(path);
+        return NULL;
+    }
+
+    return file;
+}
+
+esp_err_t frame_container_create(const char *base_path, const char *path, const frame_container_config_t *config,
+                                 frame_container_t **ret_container)
+{
+    esp_err_t ret = ESP_OK;
+    frame_container_t *container;
+    frame_container_header_t *header;
+    uint8_t *header_unit = NULL;
+    uint64_t file_size;
+
+    ESP_RETURN_ON_FALSE(base_path && path && config && ret_container, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->frame_size && config->capacity && config->unit_size, ESP_ERR_INVALID_ARG,
+                        TAG, "frame size, capacity and unit size must not be 0");
+
+    container = heap_caps_calloc(1, sizeof(frame_container_t), MALLOC_CAP_8BIT);
+    ESP_RETURN_ON_FALSE(container, ESP_ERR_NO_MEM, TAG, "failed to allocate container");
+
+    header = &container->header;
+    memcpy(header->magic, FRAME_CONTAINER_MAGIC, sizeof(header->magic));
+    header->version = FRAME_CONTAINER_VERSION;
+    header->header_size = sizeof(frame_container_header_t);
+    header->width = config->width;
+    header->height = config->height;
+    header->pixel_format = config->pixel_format;
+    header->bytesperline = config->bytesperline;
+    header->unit_size = config->unit_size;
+    header->slot_offset = FRAME_CONTAINER_ALIGN(sizeof(frame_container_header_t), config->unit_size);
+    header->slot_size = FRAME_CONTAINER_ALIGN(config->frame_size, config->unit_size);
+    header->capacity = config->capacity;
+    header->index_entry_size = sizeof(frame_container_entry_t);
+    header->index_offset = header->slot_offset + (uint64_t)header->slot_size * header->capacity;
+    file_size = header->index_offset + (uint64_t)header->index_entry_size * header->capacity;
+
+    container->index = heap_caps_calloc(config->capacity, sizeof(frame_container_entry_t), MALLOC_CAP_SPIRAM);
+    ESP_GOTO_ON_FALSE(container->index, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate index of %"PRIu32" frames",
+                      config->capacity);
+
+    container->file = frame_container_allocate(base_path, path, file_size);
+    ESP_GOTO_ON_FALSE(container->file, ESP_FAIL, fail, TAG, "failed to allocate %llu bytes for %s",
+                      (unsigned long long)file_size, path);
+    /* Frames are written in one piece, straight into FATFS without the stdio copy */
+    setvbuf(container->file, NULL, _IONBF, 0);
+
+    /* The first slot starts on the next allocation unit, write the whole unit once */
+    header_unit = heap_caps_calloc(1, header->slot_offset, MALLOC_CAP_SPIRAM);
+    ESP_GOTO_ON_FALSE(header_unit, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate header");
+    memcpy(header_unit, header, sizeof(frame_container_header_t));
+    ESP_GOTO_ON_ERROR(frame_container_write_at(container, 0, header_unit, header->slot_offset), fail,
+                      TAG, "failed to write header");
+    heap_caps_free(header_unit);
+
+    ESP_LOGI(TAG, "%s: %"PRIu32" slots of %"PRIu32" bytes, %llu bytes preallocated", path, header->capacity,
+             header->slot_size, (unsigned long long)file_size);
+    *ret_container = container;
+    return ESP_OK;
+
+fail:
+    heap_caps_free(header_unit);
+    if (container->file) {
+        fclose(container->file);
+        remove(path);
+    }
+    heap_caps_free(container->index);
+    heap_caps_free(container);
+    return ret;
+}
+
+esp_err_t frame_container_append(frame_container_t *container, const void *data, const frame_container_entry_t *entry)
+{
+    frame_container_header_t *header = &container->header;
+
+    ESP_RETURN_ON_FALSE(entry->size <= header->slot_size, ESP_ERR_INVALID_SIZE, TAG, "frame of %"PRIu32" bytes too large",
+                        entry->size);
+    if (header->frame_count >= header->capacity) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    ESP_RETURN_ON_ERROR(frame_container_write_at(container, header->slot_offset + (uint64_t)header->slot_size * header->frame_count,
+                                                 data, entry->size), TAG, "failed to write frame");
+    container->index[header->frame_count++] = *entry;
+
+    return ESP_OK;
+}
+
+uint32_t frame_container_get_count(const frame_container_t *container)
+{
+    return container->header.frame_count;
+}
+
+esp_err_t frame_container_close(frame_container_t *container)
+{
+    esp_err_t ret;
+    frame_container_header_t *header = &container->header;
+
+    ret = frame_container_write_at(container, header->index_offset, container->index,
+                                   (size_t)header->index_entry_size * header->frame_count);
+    if (ret == ESP_OK) {
+        ret = frame_container_write_at(container, 0, header, sizeof(frame_container_header_t));
+    }
+    if (fclose(container->file) != 0) {
+        ret = ESP_FAIL;
+    }
+
+    heap_caps_free(container->index);
+    heap_caps_free(container);
+    return ret;
+}
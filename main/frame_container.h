@@ -0,0 +1,133 @@
+/*
+ * Indexed multi-frame container file
+ *
+ * A recording is one preallocated file instead of one file per frame:
+ *
+ *   offset 0                       header, padded to the allocation unit
+ *   slot_offset + n * slot_size    frame n, every slot starts on an allocation unit
+ *   index_offset                   capacity index entries, frame_count of them valid
+ *
+ * All fields are little endian. The file is allocated once when it is
+ * created, appending a frame is a single aligned write without any FAT
+ * directory or cluster chain update. The header and the index are written
+ * when the container is closed, so any frame can be found by its slot
+ * number or by its timestamp.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CONTAINER_MAGIC       "RAWC"
+#define FRAME_CONTAINER_VERSION     2
+
+/**
+ * @brief Container header, at offset 0 of the file
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];                  /*!< FRAME_CONTAINER_MAGIC */
+    uint16_t version;               /*!< FRAME_CONTAINER_VERSION */
+    uint16_t header_size;           /*!< Size of this structure */
+    uint32_t width;                 /*!< Frame width in pixels */
+    uint32_t height;                /*!< Frame height in pixels */
+    uint32_t pixel_format;          /*!< V4L2 pixel format */
+    uint32_t bytesperline;          /*!< Line stride in bytes */
+    uint32_t unit_size;             /*!< Allocation unit the slots are aligned to */
+    uint32_t slot_offset;           /*!< Offset of the first slot */
+    uint32_t slot_size;             /*!< Size of one slot, a multiple of unit_size */
+    uint32_t capacity;              /*!< Number of slots */
+    uint32_t frame_count;           /*!< Number of frames recorded */
+    uint32_t index_entry_size;      /*!< Size of one index entry */
+    uint64_t index_offset;          /*!< Offset of the index */
+} frame_container_header_t;
+
+/**
+ * @brief Index entry of one frame
+ */
+typedef struct __attribute__((packed)) {
+    uint64_t timestamp_us;          /*!< Capture time in microseconds */
+    uint32_t sequence;              /*!< V4L2 frame sequence number */
+    uint32_t size;                  /*!< Bytes used in the slot */
+    uint32_t exposure;              /*!< Sensor exposure when the frame was captured */
+    uint32_t gain;                  /*!< Sensor gain when the frame was captured */
+    int64_t wall_time_us;           /*!< Capture time since the UNIX epoch, 0 if the system time was not set */
+} frame_container_entry_t;
+
+/**
+ * @brief Container configuration
+ */
+typedef struct {
+    uint32_t width;                 /*!< Frame width in pixels */
+    uint32_t height;                /*!< Frame height in pixels */
+    uint32_t pixel_format;          /*!< V4L2 pixel format */
+    uint32_t bytesperline;          /*!< Line stride in bytes */
+    uint32_t frame_size;            /*!< Largest frame in bytes */
+    uint32_t capacity;              /*!< Number of frame slots */
+    uint32_t unit_size;             /*!< Filesystem allocation unit, slots and writes are aligned to it */
+} frame_container_config_t;
+
+typedef struct frame_container frame_container_t;
+
+/**
+ * @brief Create and preallocate a container file
+ *
+ * The file is allocated contiguously when the filesystem has the space in
+ * one piece, or else by extending it to its full size.
+ *
+ * @param base_path Mount point of the FAT filesystem
+ * @param path      Full path of the file
+ * @param config    Container configuration
+ * @param ret_container Returned container
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_NO_MEM if there is not enough memory for the index
+ *      - ESP_FAIL if the file could not be created
+ */
+esp_err_t frame_container_create(const char *base_path, const char *path, const frame_container_config_t *config,
+                                 frame_container_t **ret_container);
+
+/**
+ * @brief Write a frame into the next slot
+ *
+ * @param container Container
+ * @param data      Frame data
+ * @param entry     Frame index entry, its size is the number of bytes written
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the frame is larger than a slot
+ *      - ESP_ERR_NOT_FINISHED if every slot is used
+ *      - ESP_FAIL if the write failed
+ */
+esp_err_t frame_container_append(frame_container_t *container, const void *data, const frame_container_entry_t *entry);
+
+/**
+ * @brief Number of frames written
+ *
+ * @param container Container
+ *
+ * @return Number of frames
+ */
+uint32_t frame_container_get_count(const frame_container_t *container);
+
+/**
+ * @brief Write the index and the header, close the file and free the container
+ *
+ * @param container Container
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the index or the header could not be written
+ */
+esp_err_t frame_container_close(frame_container_t *container);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Multi-frame stacking of RAW10 snapshots
+ *
+ * A frame is unpacked one row at a time into internal RAM, optionally
+ * clipped against the running mean, then added to its accumulator row, on
+ * the ESP32-P4 with the PIE kernel in frame_stack_add_pie.S. Accumulator
+ * rows are padded to a whole number of 8-lane vectors, the padding of the
+ * unpacked row stays zero so the padding of the accumulator does too.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "frame_stack.h"
+
+#define FRAME_STACK_CLIP_LSB        CONFIG_EXAMPLE_SD_STACK_CLIP_LSB
+#define FRAME_STACK_CLIP_MIN_FRAMES 2       /* Frames added unclipped to build the running mean */
+#define FRAME_STACK_PIE_ALIGN       16      /* esp.vld.128 needs 16-byte aligned addresses */
+#define FRAME_STACK_LANES           8       /* 16-bit lanes of a PIE register */
+#define FRAME_STACK_ALIGN(size, align)      (((size) + (align) - 1) & ~((align) - 1))
+
+#if CONFIG_EXAMPLE_SD_STACK_PIE
+extern void frame_stack_add_pie(const uint16_t *row, uint16_t *acc, uint32_t size);
+#endif
+
+static const char *TAG = "frame_stack";
+
+struct frame_stack {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesperline;
+    uint32_t stride;            /* Accumulator row size in samples, a multiple of FRAME_STACK_LANES */
+    uint16_t *acc;              /* Sum of the stacked frames, in PSRAM */
+    uint16_t *row;              /* Unpacked row of the frame being added */
+    uint32_t count;
+    uint32_t clipped;
+};
+
+static void frame_stack_unpack_row(const uint8_t *src, uint16_t *row, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, src += 5) {
+        uint8_t lsb = src[4];
+
+        row[x + 0] = (src[0] << 2) | ((lsb >> 0) & 0x3);
+        row[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+        row[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+        row[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+    }
+}
+
+static void frame_stack_pack_row(const uint16_t *row, uint8_t *dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, dst += 5) {
+        dst[0] = row[x + 0] >> 2;
+        dst[1] = row[x + 1] >> 2;
+        dst[2] = row[x + 2] >> 2;
+        dst[3] = row[x + 3] >> 2;
+        dst[4] = (row[x + 0] & 0x3) | ((row[x + 1] & 0x3) << 2) |
+                 ((row[x + 2] & 0x3) << 4) | ((row[x + 3] & 0x3) << 6);
+    }
+}
+
+#if FRAME_STACK_CLIP_LSB
+/*
+ * Replace the samples further than the threshold from the running mean
+ * acc / count by the mean. |v - acc / count| > limit is compared as
+ * |v * count - acc| > limit * count, so only the outliers need a division.
+ */
+static uint32_t frame_stack_clip_row(uint16_t *row, const uint16_t *acc, uint32_t width, uint32_t count)
+{
+    int32_t limit = FRAME_STACK_CLIP_LSB * count;
+    uint32_t clipped = 0;
+
+    for (uint32_t x = 0; x < width; x++) {
+        int32_t diff = (int32_t)(row[x] * count) - acc[x];
+
+        if (diff > limit || diff < -limit) {
+            row[x] = (acc[x] + count / 2) / count;
+            clipped++;
+        }
+    }
+
+    return clipped;
+}
+#endif
+
+/* acc[i] += row[i], size is a multiple of FRAME_STACK_LANES */
+static void frame_stack_add_row(const uint16_t *row, uint16_t *acc, uint32_t size)
+{
+#if CONFIG_EXAMPLE_SD_STACK_PIE
+    frame_stack_add_pie(row, acc, size);
+#else
+    for (uint32_t i = 0; i < size; i++) {
+        acc[i] += row[i];
+    }
+#endif
+}
+
+esp_err_t frame_stack_create(uint32_t width, uint32_t height, uint32_t bytesperline, frame_stack_t **ret_stack)
+{
+    esp_err_t ret = ESP_OK;
+    frame_stack_t *stack;
+    uint32_t stride = FRAME_STACK_ALIGN(width, FRAME_STACK_LANES);
+
+    ESP_RETURN_ON_FALSE(ret_stack && width && height && width % 4 == 0 && bytesperline >= width * 5 / 4,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    stack = calloc(1, sizeof(frame_stack_t));
+    ESP_RETURN_ON_FALSE(stack, ESP_ERR_NO_MEM, TAG, "failed to allocate stack");
+
+    /* A full frame of accumulators only fits in PSRAM, the row is read right after it is unpacked */
+    stack->acc = heap_caps_aligned_alloc(FRAME_STACK_PIE_ALIGN, stride * height * sizeof(uint16_t),
+                                         MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(stack->acc, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate accumulator");
+    stack->row = heap_caps_aligned_calloc(FRAME_STACK_PIE_ALIGN, stride, sizeof(uint16_t),
+                                          MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(stack->row, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate row buffer");
+
+    stack->width = width;
+    stack->height = height;
+    stack->bytesperline = bytesperline;
+    stack->stride = stride;
+    frame_stack_reset(stack);
+
+    ESP_LOGI(TAG, "%"PRIu32"x%"PRIu32" accumulator, %zu bytes in PSRAM", width, height,
+             (size_t)stride * height * sizeof(uint16_t));
+    *ret_stack = stack;
+    return ESP_OK;
+
+fail:
+    frame_stack_delete(stack);
+    return ret;
+}
+
+void frame_stack_reset(frame_stack_t *stack)
+{
+    memset(stack->acc, 0, stack->stride * stack->height * sizeof(uint16_t));
+    stack->count = 0;
+    stack->clipped = 0;
+}
+
+esp_err_t frame_stack_add(frame_stack_t *stack, const uint8_t *frame)
+{
+    ESP_RETURN_ON_FALSE(stack->count < FRAME_STACK_MAX_FRAMES, ESP_ERR_INVALID_STATE, TAG, "stack is full");
+
+#if FRAME_STACK_CLIP_LSB
+    bool clip = stack->count >= FRAME_STACK_CLIP_MIN_FRAMES;
+#endif
+
+    for (uint32_t y = 0; y < stack->height; y++) {
+        uint16_t *acc = stack->acc + y * stack->stride;
+
+        frame_stack_unpack_row(frame + y * stack->bytesperline, stack->row, stack->width);
+#if FRAME_STACK_CLIP_LSB
+        if (clip) {
+            stack->clipped += frame_stack_clip_row(stack->row, acc, stack->width, stack->count);
+        }
+#endif
+        frame_stack_add_row(stack->row, acc, stack->stride);
+    }
+    stack->count++;
+
+    return ESP_OK;
+}
+
+uint32_t frame_stack_count(const frame_stack_t *stack)
+{
+    return stack->count;
+}
+
+uint32_t frame_stack_clipped(const frame_stack_t *stack)
+{
+    return stack->clipped;
+}
+
+esp_err_t frame_stack_get_mean(const frame_stack_t *stack, uint8_t *dst)
+{
+    uint32_t count = stack->count;
+
+    ESP_RETURN_ON_FALSE(count, ESP_ERR_INVALID_STATE, TAG, "no frame stacked");
+
+    for (uint32_t y = 0; y < stack->height; y++) {
+        const uint16_t *acc = stack->acc + y * stack->stride;
+
+        /* Once per snapshot, a plain division is fast enough */
+        for (uint32_t x = 0; x < stack->width; x++) {
+            stack->row[x] = (acc[x] + count / 2) / count;
+        }
+        frame_stack_pack_row(stack->row, dst + y * stack->bytesperline, stack->width);
+    }
+
+    return ESP_OK;
+}
+
+void frame_stack_delete(frame_stack_t *stack)
+{
+    if (!stack) {
+        return;
+    }
+
+    heap_caps_free(stack->acc);
+    heap_caps_free(stack->row);
+    free(stack);
+}
@@ -0,0 +1,108 @@
+/*
+ * Multi-frame stacking of RAW10 snapshots
+ *
+ * In low light one snapshot is the mean of several consecutive frames
+ * instead of a single frame, the noise drops with the square root of the
+ * frame count. Every frame is unpacked row by row and added to a 16-bit
+ * per pixel accumulator in PSRAM, which holds the sum of up to
+ * FRAME_STACK_MAX_FRAMES 10-bit frames without overflow.
+ *
+ * With CONFIG_EXAMPLE_SD_STACK_CLIP_LSB set, a pixel that deviates from the
+ * running mean of the frames stacked so far by more than the threshold is
+ * an outlier, e.g. a hot pixel flash or a passing light, and the running
+ * mean is added in its place so it does not move the result.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_STACK_MAX_FRAMES      64      /* 64 x 1023 still fits the 16-bit accumulator */
+
+/**
+ * @brief Frame stack handle
+ */
+typedef struct frame_stack frame_stack_t;
+
+/**
+ * @brief Create a frame stack
+ *
+ * @param width        Frame width in pixels, a multiple of 4
+ * @param height       Frame height
+ * @param bytesperline Packed RAW10 line size, at least width * 5 / 4
+ * @param ret_stack    Returned stack
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the geometry is not RAW10
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+esp_err_t frame_stack_create(uint32_t width, uint32_t height, uint32_t bytesperline, frame_stack_t **ret_stack);
+
+/**
+ * @brief Empty the stack for the next snapshot
+ *
+ * @param stack Stack
+ */
+void frame_stack_reset(frame_stack_t *stack);
+
+/**
+ * @brief Add a frame
+ *
+ * @param stack Stack
+ * @param frame Packed RAW10 frame
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the stack already holds FRAME_STACK_MAX_FRAMES frames
+ */
+esp_err_t frame_stack_add(frame_stack_t *stack, const uint8_t *frame);
+
+/**
+ * @brief Get the number of frames added since the last reset
+ *
+ * @param stack Stack
+ *
+ * @return Frame count
+ */
+uint32_t frame_stack_count(const frame_stack_t *stack);
+
+/**
+ * @brief Get the number of pixels replaced by the running mean since the last reset
+ *
+ * @param stack Stack
+ *
+ * @return Clipped pixel count, 0 without clipping
+ */
+uint32_t frame_stack_clipped(const frame_stack_t *stack);
+
+/**
+ * @brief Write the mean of the stacked frames
+ *
+ * The mean is rounded to 10 bits and packed the same way as the captured
+ * frames, so it is saved like any single frame.
+ *
+ * @param stack Stack
+ * @param dst   Packed RAW10 frame, bytesperline * height bytes
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if no frame was added
+ */
+esp_err_t frame_stack_get_mean(const frame_stack_t *stack, uint8_t *dst);
+
+/**
+ * @brief Delete a frame stack
+ *
+ * @param stack Stack, can be NULL
+ */
+void frame_stack_delete(frame_stack_t *stack);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,385 @@
+/*
+ * Inference tap for the HTTP streamer
+ *
+ * Level 0 is scaled from the camera frame, every further level from the level
+ * before it, so each pass reads a quarter of the data of the one before. With
+ * the PPA the scale-rotate-mirror engine does every pass by DMA, otherwise
+ * the CPU box-filters them the same way as the preview stage. The INT8 layout
+ * is the RGB888 one with the sign bit flipped, done in one pass over the whole
+ * pyramid once all levels are scaled.
+ *
+ * A pyramid buffer holds all levels back to back, each level starts on a cache
+ * line so the PPA never writes into its neighbour:
+ *
+ *   [level 0 ....... pad][level 1 ... pad][level 2 . pad]
+ */
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+#include "esp_cache.h"
+#include "driver/ppa.h"
+#endif
+#include "inference_tap.h"
+#include "trace_ring.h"
+#include "task_topology.h"
+
+#define TAP_BUFFER_COUNT            2
+#define TAP_DECIMATION              CONFIG_EXAMPLE_INFERENCE_TAP_DECIMATION
+#define TAP_LEVELS                  CONFIG_EXAMPLE_INFERENCE_TAP_LEVELS
+#define TAP_MAX_FPS                 CONFIG_EXAMPLE_INFERENCE_TAP_FPS
+#define TAP_BYTES_PER_PIXEL         3
+#define TAP_TASK_STACK_SIZE         4096
+#define TAP_TASK_PRIORITY           TASK_PREVIEW_PRIORITY
+#define TAP_TASK_CORE               TASK_ENCODE_CORE
+#define TAP_SOURCE_TIMEOUT_MS       1000
+#define TAP_WORD_ALIGN              4
+#define TAP_ALIGN(size, align)      (((size) + (align) - 1) & ~((align) - 1))
+
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+#define TAP_ENGINE                  "PPA"
+#else
+#define TAP_ENGINE                  "CPU"
+#endif
+
+#if CONFIG_EXAMPLE_INFERENCE_TAP_INT8
+#define TAP_LAYOUT                  "INT8"
+#else
+#define TAP_LAYOUT                  "RGB888"
+#endif
+
+_Static_assert(TAP_LEVELS <= INFERENCE_TAP_MAX_LEVELS, "too many pyramid levels");
+
+static const char *TAG = "inference_tap";
+
+typedef struct {
+    frame_broadcaster_handle_t source;
+    frame_broadcaster_handle_t frames;
+    uint8_t *buffer[TAP_BUFFER_COUNT];
+    QueueHandle_t free_queue;       /* Indices of the buffers no subscriber holds */
+    uint32_t offset[TAP_LEVELS + 1];/* Start of each level in a buffer, the last entry is the buffer size */
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+    ppa_client_handle_t ppa;
+#else
+    uint16_t *acc;                  /* Column sums of one block row */
+#endif
+    uint32_t max_width;             /* Largest camera frame the buffers are sized for */
+    uint32_t max_height;
+    uint32_t count;
+    TaskHandle_t task;
+} inference_tap_t;
+
+static inference_tap_t s_tap;
+
+static void tap_queue_buffer(uint32_t index, void *arg)
+{
+    xQueueSend(s_tap.free_queue, &index, 0);
+}
+
+/* Level geometry of a camera frame */
+static void tap_get_level_size(uint32_t width, uint32_t height, uint32_t level, uint32_t *ret_width, uint32_t *ret_height)
+{
+    *ret_width = (width / TAP_DECIMATION) >> level;
+    *ret_height = (height / TAP_DECIMATION) >> level;
+}
+
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+static esp_err_t tap_scale(const uint8_t *src, uint32_t src_width, uint32_t src_height, uint8_t *dst, size_t dst_size,
+                           uint32_t out_width, uint32_t out_height, uint32_t factor)
+{
+    /* The PPA syncs the caches of both buffers itself */
+    ppa_srm_oper_config_t srm_config = {
+        .in = {
+            .buffer = src,
+            .pic_w = src_width,
+            .pic_h = src_height,
+            .block_w = out_width * factor,
+            .block_h = out_height * factor,
+            .srm_cm = PPA_SRM_COLOR_MODE_RGB888,
+        },
+        .out = {
+            .buffer = dst,
+            .buffer_size = dst_size,
+            .pic_w = out_width,
+            .pic_h = out_height,
+            .srm_cm = PPA_SRM_COLOR_MODE_RGB888,
+        },
+        .rotation_angle = PPA_SRM_ROTATION_ANGLE_0,
+        .scale_x = 1.0f / factor,
+        .scale_y = 1.0f / factor,
+        .mode = PPA_TRANS_MODE_BLOCKING,
+    };
+
+    return ppa_do_scale_rotate_mirror(s_tap.ppa, &srm_config);
+}
+#else
+static esp_err_t tap_scale(const uint8_t *src, uint32_t src_width, uint32_t src_height, uint8_t *dst, size_t dst_size,
+                           uint32_t out_width, uint32_t out_height, uint32_t factor)
+{
+    const uint32_t area = factor * factor;
+    uint32_t stride = src_width * TAP_BYTES_PER_PIXEL;
+    uint32_t line_size = out_width * factor * TAP_BYTES_PER_PIXEL;
+
+    for (uint32_t y = 0; y < out_height; y++) {
+        const uint8_t *row = src + y * factor * stride;
+        const uint16_t *acc = s_tap.acc;
+
+        memset(s_tap.acc, 0, line_size * sizeof(uint16_t));
+        for (uint32_t i = 0; i < factor; i++) {
+            for (uint32_t j = 0; j < line_size; j++) {
+                s_tap.acc[j] += row[j];
+            }
+            row += stride;
+        }
+
+        for (uint32_t x = 0; x < out_width; x++) {
+            uint32_t r = 0;
+            uint32_t g = 0;
+            uint32_t b = 0;
+
+            for (uint32_t i = 0; i < factor; i++) {
+                r += acc[0];
+                g += acc[1];
+                b += acc[2];
+                acc += TAP_BYTES_PER_PIXEL;
+            }
+
+            dst[0] = (r + area / 2) / area;
+            dst[1] = (g + area / 2) / area;
+            dst[2] = (b + area / 2) / area;
+            dst += TAP_BYTES_PER_PIXEL;
+        }
+    }
+
+    return ESP_OK;
+}
+#endif
+
+static esp_err_t tap_build_pyramid(const frame_t *frame, uint8_t *buffer)
+{
+    const uint8_t *src = frame->data;
+    uint32_t src_width = frame->width;
+    uint32_t src_height = frame->height;
+    uint32_t factor = TAP_DECIMATION;
+
+    for (uint32_t level = 0; level < TAP_LEVELS; level++) {
+        uint8_t *dst = buffer + s_tap.offset[level];
+        uint32_t width;
+        uint32_t height;
+
+        tap_get_level_size(frame->width, frame->height, level, &width, &height);
+        ESP_RETURN_ON_ERROR(tap_scale(src, src_width, src_height, dst, s_tap.offset[level + 1] - s_tap.offset[level],
+                                      width, height, factor), TAG, "failed to scale level %"PRIu32, level);
+
+        src = dst;
+        src_width = width;
+        src_height = height;
+        factor = 2;
+    }
+
+#if CONFIG_EXAMPLE_INFERENCE_TAP_INT8
+    /* x - 128 in two's complement is x with the top bit flipped, the padding is flipped along */
+    uint32_t *word = (uint32_t *)buffer;
+
+    for (uint32_t i = 0; i < s_tap.offset[TAP_LEVELS] / sizeof(uint32_t); i++) {
+        word[i] ^= 0x80808080;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+static void inference_tap_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_t *source_sub = NULL;
+    frame_subscriber_config_t source_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    /* The broadcaster paces the tap, the streaming clients keep their own rate */
+    source_config.name = "inference";
+    source_config.max_fps = TAP_MAX_FPS;
+
+    while (true) {
+        uint32_t index;
+        uint32_t width;
+        uint32_t height;
+        int64_t timestamp_us;
+
+        /* Only keep the capture subscription while a model takes the pyramids */
+        if (!frame_broadcaster_subscriber_count(s_tap.frames)) {
+            if (source_sub) {
+                frame_broadcaster_unsubscribe(source_sub);
+                source_sub = NULL;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!source_sub) {
+            source_sub = frame_broadcaster_subscribe(s_tap.source, &source_config);
+            if (!source_sub) {
+                vTaskDelay(pdMS_TO_TICKS(100));
+                continue;
+            }
+        }
+
+        if (frame_subscriber_wait(source_sub, &frame, pdMS_TO_TICKS(TAP_SOURCE_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        /* Skip the frame if the model still holds every pyramid */
+        if (frame->width > s_tap.max_width || frame->height > s_tap.max_height ||
+                xQueueReceive(s_tap.free_queue, &index, 0) != pdTRUE) {
+            frame_subscriber_release(source_sub, frame);
+            continue;
+        }
+
+        tap_get_level_size(frame->width, frame->height, 0, &width, &height);
+        if (tap_build_pyramid(frame, s_tap.buffer[index]) != ESP_OK) {
+            frame_subscriber_release(source_sub, frame);
+            tap_queue_buffer(index, NULL);
+            continue;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_INFERENCE_TAP_DONE, frame->sequence);
+        timestamp_us = frame->timestamp_us;
+        frame_subscriber_release(source_sub, frame);
+
+        s_tap.count++;
+        frame_broadcaster_set_geometry(s_tap.frames, width, height);
+        if (!frame_broadcaster_publish(s_tap.frames, index, s_tap.offset[TAP_LEVELS], timestamp_us)) {
+            tap_queue_buffer(index, NULL);
+        }
+    }
+}
+
+esp_err_t inference_tap_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    esp_err_t ret = ESP_OK;
+    size_t align = TAP_WORD_ALIGN;
+    uint32_t out_width;
+    uint32_t out_height;
+    frame_broadcaster_config_t bcast_config;
+
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_tap.task, ESP_ERR_INVALID_STATE, TAG, "already started");
+    ESP_RETURN_ON_FALSE(pixel_format == V4L2_PIX_FMT_RGB24, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "inference tap needs RGB888 frames");
+
+    tap_get_level_size(width, height, TAP_LEVELS - 1, &out_width, &out_height);
+    ESP_RETURN_ON_FALSE(out_width && out_height, ESP_ERR_INVALID_ARG, TAG, "frame too small for %d levels", TAP_LEVELS);
+
+    s_tap.free_queue = xQueueCreate(TAP_BUFFER_COUNT, sizeof(uint32_t));
+    ESP_RETURN_ON_FALSE(s_tap.free_queue, ESP_ERR_NO_MEM, TAG, "failed to create queue");
+
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+    ppa_client_config_t ppa_config = {
+        .oper_type = PPA_OPERATION_SRM,
+        .max_pending_trans_num = 1,
+    };
+
+    /* The PPA writes whole cache lines, every level starts on its own */
+    ESP_GOTO_ON_ERROR(esp_cache_get_alignment(MALLOC_CAP_SPIRAM, &align), fail, TAG, "failed to get cache alignment");
+    ESP_GOTO_ON_ERROR(ppa_register_client(&ppa_config, &s_tap.ppa), fail, TAG, "failed to register PPA client");
+#else
+    /* The line accumulator is walked once per source row, keep it in internal RAM */
+    s_tap.acc = heap_caps_malloc(width * TAP_BYTES_PER_PIXEL * sizeof(uint16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(s_tap.acc, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate line accumulator");
+#endif
+
+    s_tap.offset[0] = 0;
+    for (uint32_t level = 0; level < TAP_LEVELS; level++) {
+        tap_get_level_size(width, height, level, &out_width, &out_height);
+        s_tap.offset[level + 1] = s_tap.offset[level] + TAP_ALIGN(out_width * out_height * TAP_BYTES_PER_PIXEL, align);
+    }
+
+    for (uint32_t i = 0; i < TAP_BUFFER_COUNT; i++) {
+        s_tap.buffer[i] = heap_caps_aligned_alloc(align, s_tap.offset[TAP_LEVELS], MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        ESP_GOTO_ON_FALSE(s_tap.buffer[i], ESP_ERR_NO_MEM, fail, TAG, "failed to allocate pyramid buffer");
+        tap_queue_buffer(i, NULL);
+    }
+
+    tap_get_level_size(width, height, 0, &out_width, &out_height);
+    bcast_config = (frame_broadcaster_config_t) {
+        .name = "inference",
+        .buffers = s_tap.buffer,
+        .buffer_count = TAP_BUFFER_COUNT,
+        .release_cb = tap_queue_buffer,
+        .width = out_width,
+        .height = out_height,
+    };
+    ESP_GOTO_ON_ERROR(frame_broadcaster_create(&bcast_config, &s_tap.frames), fail, TAG,
+                      "failed to create inference broadcaster");
+
+    s_tap.source = source;
+    s_tap.max_width = width;
+    s_tap.max_height = height;
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(inference_tap_task, "inference_tap", TAP_TASK_STACK_SIZE, NULL,
+                                              TAP_TASK_PRIORITY, &s_tap.task, TAP_TASK_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, fail, TAG, "failed to create inference tap task");
+
+    ESP_LOGI(TAG, "Inference tap started, %"PRIu32"x%"PRIu32" (1/%d), %d levels, %s, %d fps (%s)", out_width, out_height,
+             TAP_DECIMATION, TAP_LEVELS, TAP_LAYOUT, TAP_MAX_FPS, TAP_ENGINE);
+    return ESP_OK;
+
+fail:
+    /* The broadcaster has no destructor, it is unreachable without the task */
+    for (uint32_t i = 0; i < TAP_BUFFER_COUNT; i++) {
+        heap_caps_free(s_tap.buffer[i]);
+        s_tap.buffer[i] = NULL;
+    }
+#if CONFIG_EXAMPLE_INFERENCE_TAP_PPA
+    if (s_tap.ppa) {
+        ppa_unregister_client(s_tap.ppa);
+        s_tap.ppa = NULL;
+    }
+#else
+    heap_caps_free(s_tap.acc);
+    s_tap.acc = NULL;
+#endif
+    vQueueDelete(s_tap.free_queue);
+    s_tap.free_queue = NULL;
+    return ret;
+}
+
+frame_subscriber_t *inference_tap_subscribe(const frame_subscriber_config_t *config)
+{
+    frame_subscriber_t *sub;
+
+    ESP_RETURN_ON_FALSE(s_tap.task, NULL, TAG, "inference tap is not started");
+
+    sub = frame_broadcaster_subscribe(s_tap.frames, config);
+    if (sub) {
+        xTaskNotifyGive(s_tap.task);
+    }
+
+    return sub;
+}
+
+esp_err_t inference_tap_get_level(const frame_t *frame, uint32_t level, inference_tap_level_t *ret_level)
+{
+    ESP_RETURN_ON_FALSE(frame && ret_level && level < TAP_LEVELS, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    /* The frame geometry is that of level 0 */
+    ret_level->data = frame->data + s_tap.offset[level];
+    ret_level->width = frame->width >> level;
+    ret_level->height = frame->height >> level;
+
+    return ESP_OK;
+}
+
+uint32_t inference_tap_get_level_count(void)
+{
+    return TAP_LEVELS;
+}
+
+uint32_t inference_tap_get_frame_count(void)
+{
+    return s_tap.count;
+}
@@ -0,0 +1,95 @@
+/*
+ * Inference tap for the HTTP streamer
+ *
+ * The tap takes camera frames at its own rate, independent of the streaming
+ * clients, and scales each one into a pyramid of model inputs: level 0 is the
+ * frame decimated by the configured factor, every further level halves the one
+ * before. All levels of a frame are packed RGB888, or signed INT8 (value - 128),
+ * and live in one buffer that is published on the tap's broadcaster. A model
+ * holds that buffer with the usual frame lease, the camera frame is returned as
+ * soon as the pyramid is built, so inference never holds up the capture or the
+ * streaming copies.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INFERENCE_TAP_MAX_LEVELS    4   /*!< Largest number of pyramid levels */
+
+/**
+ * @brief One pyramid level of a tap frame
+ */
+typedef struct {
+    const void *data;       /*!< Packed pixels, 3 bytes each, uint8_t for RGB888 or int8_t for INT8 */
+    uint32_t width;         /*!< Level width in pixels */
+    uint32_t height;        /*!< Level height in pixels */
+} inference_tap_level_t;
+
+/**
+ * @brief Start the inference tap task
+ *
+ * @param source       Broadcaster of the camera frames
+ * @param width        Largest frame width, used to size the pyramid buffers
+ * @param height       Largest frame height, used to size the pyramid buffers
+ * @param pixel_format Camera pixel format, only V4L2_PIX_FMT_RGB24 is supported
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format is not supported
+ *      - ESP_ERR_INVALID_ARG if the frame is too small for the smallest level
+ *      - Others if failed
+ */
+esp_err_t inference_tap_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format);
+
+/**
+ * @brief Subscribe to the pyramid frames
+ *
+ * Pyramids are only built while the tap has subscribers. The frame size is
+ * that of all levels, its width and height are those of level 0. Release and
+ * unsubscribe with frame_subscriber_release() and frame_broadcaster_unsubscribe().
+ *
+ * @param config Subscriber configuration, NULL for FRAME_SUBSCRIBER_DEFAULT_CONFIG()
+ *
+ * @return
+ *      - Subscriber handle on success
+ *      - NULL if failed
+ */
+frame_subscriber_t *inference_tap_subscribe(const frame_subscriber_config_t *config);
+
+/**
+ * @brief Locate one pyramid level in a tap frame
+ *
+ * @param frame     Frame received from a tap subscriber
+ * @param level     Level index, 0 is the largest
+ * @param ret_level Returned level, valid until the frame is released
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the level does not exist
+ */
+esp_err_t inference_tap_get_level(const frame_t *frame, uint32_t level, inference_tap_level_t *ret_level);
+
+/**
+ * @brief Get the number of pyramid levels of every tap frame
+ *
+ * @return Level count
+ */
+uint32_t inference_tap_get_level_count(void);
+
+/**
+ * @brief Get the number of pyramids built since start
+ *
+ * @return Pyramid count
+ */
+uint32_t inference_tap_get_frame_count(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,240 @@
+/*
+ * ISP statistics feed for the HTTP streamer
+ *
+ * The ISP controller task copies every statistics set into the feed under a
+ * spinlock and gives the semaphore of each open reader. Readers copy the
+ * latest set out under the same spinlock, so neither side ever waits for the
+ * other for longer than one copy.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/lock.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "isp_stats_feed.h"
+
+#define ISP_STATS_MAX_READERS   4
+
+struct isp_stats_reader {
+    SemaphoreHandle_t ready;    /* Given once per statistics set */
+    uint32_t count;             /* Feed count of the set last read */
+    bool used;
+};
+
+typedef struct {
+    portMUX_TYPE lock;          /* Protects latest and count */
+    esp_video_isp_frame_stats_t latest;
+    uint32_t count;             /* Sets received */
+
+    _lock_t readers_lock;       /* Protects the reader slots */
+    isp_stats_reader_t readers[ISP_STATS_MAX_READERS];
+} isp_stats_feed_t;
+
+static const char *TAG = "isp_stats";
+
+static isp_stats_feed_t s_feed = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static void isp_stats_feed_cb(const esp_video_isp_frame_stats_t *stats, void *arg)
+{
+    portENTER_CRITICAL(&s_feed.lock);
+    s_feed.latest = *stats;
+    s_feed.count++;
+    portEXIT_CRITICAL(&s_feed.lock);
+
+    _lock_acquire(&s_feed.readers_lock);
+    for (int i = 0; i < ISP_STATS_MAX_READERS; i++) {
+        if (s_feed.readers[i].used) {
+            xSemaphoreGive(s_feed.readers[i].ready);
+        }
+    }
+    _lock_release(&s_feed.readers_lock);
+}
+
+esp_err_t isp_stats_feed_start(void)
+{
+    ESP_RETURN_ON_ERROR(esp_video_isp_stats_subscribe(isp_stats_feed_cb, NULL), TAG, "failed to subscribe to ISP statistics");
+    return ESP_OK;
+}
+
+esp_err_t isp_stats_feed_get_latest(esp_video_isp_frame_stats_t *stats)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&s_feed.lock);
+    if (s_feed.count) {
+        *stats = s_feed.latest;
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&s_feed.lock);
+
+    return ret;
+}
+
+esp_err_t isp_stats_reader_open(isp_stats_reader_t **ret_reader)
+{
+    isp_stats_reader_t *reader = NULL;
+
+    _lock_acquire(&s_feed.readers_lock);
+    for (int i = 0; i < ISP_STATS_MAX_READERS; i++) {
+        if (!s_feed.readers[i].used) {
+            reader = &s_feed.readers[i];
+            break;
+        }
+    }
+    if (reader) {
+        if (!reader->ready) {
+            /* Slots are reused, their semaphore is kept */
+            reader->ready = xSemaphoreCreateBinary();
+        }
+        if (reader->ready) {
+            xSemaphoreTake(reader->ready, 0);
+            portENTER_CRITICAL(&s_feed.lock);
+            reader->count = s_feed.count;
+            portEXIT_CRITICAL(&s_feed.lock);
+            reader->used = true;
+        } else {
+            reader = NULL;
+        }
+    }
+    _lock_release(&s_feed.readers_lock);
+
+    ESP_RETURN_ON_FALSE(reader, ESP_ERR_NO_MEM, TAG, "no free statistics reader");
+    *ret_reader = reader;
+    return ESP_OK;
+}
+
+esp_err_t isp_stats_reader_wait(isp_stats_reader_t *reader, esp_video_isp_frame_stats_t *stats, uint32_t *skipped,
+                                TickType_t timeout)
+{
+    uint32_t count;
+
+    if (xSemaphoreTake(reader->ready, timeout) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    portENTER_CRITICAL(&s_feed.lock);
+    *stats = s_feed.latest;
+    count = s_feed.count;
+    portEXIT_CRITICAL(&s_feed.lock);
+
+    if (skipped) {
+        *skipped = count - reader->count - 1;
+    }
+    reader->count = count;
+
+    return ESP_OK;
+}
+
+void isp_stats_reader_close(isp_stats_reader_t *reader)
+{
+    if (!reader) {
+        return;
+    }
+
+    _lock_acquire(&s_feed.readers_lock);
+    reader->used = false;
+    _lock_release(&s_feed.readers_lock);
+}
+
+/* Append formatted text, a text that does not fit sets the length past the buffer */
+static size_t json_append(char *buf, size_t size, size_t len, const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    if (len >= size) {
+        return len;
+    }
+
+    va_start(args, fmt);
+    ret = vsnprintf(buf + len, size - len, fmt, args);
+    va_end(args);
+
+    return ret < 0 ? size : len + ret;
+}
+
+static size_t json_append_array(char *buf, size_t size, size_t len, const char *name, const uint32_t *values, int count)
+{
+    len = json_append(buf, size, len, ",\"%s\":[", name);
+    for (int i = 0; i < count; i++) {
+        len = json_append(buf, size, len, i ? ",%"PRIu32 : "%"PRIu32, values[i]);
+    }
+    return json_append(buf, size, len, "]");
+}
+
+size_t isp_stats_format_json(const esp_video_isp_frame_stats_t *stats, char *buf, size_t size)
+{
+    const esp_video_isp_stats_t *isp = &stats->stats;
+    size_t len = 0;
+
+    len = json_append(buf, size, len,
+                      "{\"frame_sequence\":%"PRIu32",\"stats_sequence\":%"PRIu64",\"timestamp_us\":%"PRId64
+                      ",\"exposure_us\":%"PRIu32",\"gain\":%.3f",
+                      stats->frame_sequence, isp->seq, stats->timestamp_us, stats->exposure_us, stats->gain);
+
+    if (isp->flags & ESP_VIDEO_ISP_STATS_FLAG_AE) {
+        uint32_t luminance[ISP_AE_BLOCK_X_NUM * ISP_AE_BLOCK_Y_NUM];
+
+        for (int i = 0; i < ISP_AE_BLOCK_X_NUM; i++) {
+            for (int j = 0; j < ISP_AE_BLOCK_Y_NUM; j++) {
+                luminance[i * ISP_AE_BLOCK_Y_NUM + j] = isp->ae.ae_result.luminance[i][j];
+            }
+        }
+        /* Row major, ISP_AE_BLOCK_Y_NUM blocks per row */
+        len = json_append_array(buf, size, len, "ae_luminance", luminance, ISP_AE_BLOCK_X_NUM * ISP_AE_BLOCK_Y_NUM);
+    }
+
+    if (isp->flags & ESP_VIDEO_ISP_STATS_FLAG_AWB) {
+        const isp_awb_stat_result_t *awb = &isp->awb.awb_result;
+
+        len = json_append(buf, size, len,
+                          ",\"awb\":{\"white_patch_num\":%"PRIu32",\"sum_r\":%"PRIu32",\"sum_g\":%"PRIu32",\"sum_b\":%"PRIu32"}",
+                          (uint32_t)awb->white_patch_num, (uint32_t)awb->sum_r, (uint32_t)awb->sum_g, (uint32_t)awb->sum_b);
+    }
+
+    if (isp->flags & ESP_VIDEO_ISP_STATS_FLAG_HIST) {
+        uint32_t hist[ISP_HIST_SEGMENT_NUMS];
+
+        for (int i = 0; i < ISP_HIST_SEGMENT_NUMS; i++) {
+            hist[i] = isp->hist.hist_result.hist_value[i];
+        }
+        len = json_append_array(buf, size, len, "hist", hist, ISP_HIST_SEGMENT_NUMS);
+    }
+
+    if (isp->flags & ESP_VIDEO_ISP_STATS_FLAG_SHARPEN) {
+        len = json_append(buf, size, len, ",\"sharpen_max\":%u", (unsigned int)isp->sharpen.high_freq_pixel_max);
+    }
+
+    if (isp->flags & ESP_VIDEO_ISP_STATS_FLAG_AF) {
+        uint32_t definition[ISP_AF_WINDOW_NUM];
+        uint32_t luminance[ISP_AF_WINDOW_NUM];
+
+        for (int i = 0; i < ISP_AF_WINDOW_NUM; i++) {
+            definition[i] = isp->af.af_result.definition[i];
+            luminance[i] = isp->af.af_result.luminance[i];
+        }
+        len = json_append_array(buf, size, len, "af_definition", definition, ISP_AF_WINDOW_NUM);
+        len = json_append_array(buf, size, len, "af_luminance", luminance, ISP_AF_WINDOW_NUM);
+    }
+
+    esp_video_isp_run_stats_t run;
+
+    if (esp_video_isp_pipeline_get_run_stats(&run) == ESP_OK) {
+        len = json_append(buf, size, len,
+                          ",\"controller\":{\"frames\":%"PRIu32",\"runs\":%"PRIu32",\"overruns\":%"PRIu32
+                          ",\"throttled\":%"PRIu32",\"last_run_us\":%"PRIu32",\"max_run_us\":%"PRIu32"}",
+                          run.frames, run.runs, run.overruns, run.throttled, run.last_run_us, run.max_run_us);
+    }
+
+    len = json_append(buf, size, len, "}");
+
+    return len < size ? len : 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * ISP statistics feed for the HTTP streamer
+ *
+ * The ISP controller delivers the AE, AWB, histogram, sharpen and AF
+ * statistics of every frame. The feed keeps the latest set, paired with the
+ * capture sequence number of its frame, and wakes the readers that wait for
+ * the next one. /isp_stats returns the latest set as JSON, /ws/isp_stats
+ * sends every set as a JSON text message.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_video_isp_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_EXAMPLE_ISP_STATS
+
+#define ISP_STATS_JSON_SIZE     1536    /* Fits the JSON text of a full statistics set */
+
+/**
+ * @brief Reader of the statistics feed
+ */
+typedef struct isp_stats_reader isp_stats_reader_t;
+
+/**
+ * @brief Subscribe the feed to the ISP controller statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if the subscription failed
+ */
+esp_err_t isp_stats_feed_start(void);
+
+/**
+ * @brief Get the latest statistics
+ *
+ * @param stats Returned statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if no statistics were received yet
+ */
+esp_err_t isp_stats_feed_get_latest(esp_video_isp_frame_stats_t *stats);
+
+/**
+ * @brief Open a reader, it waits for statistics received after this call
+ *
+ * @param ret_reader Returned reader
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NO_MEM if all readers are in use
+ */
+esp_err_t isp_stats_reader_open(isp_stats_reader_t **ret_reader);
+
+/**
+ * @brief Wait for statistics newer than the ones last read
+ *
+ * Readers slower than the frame rate get the latest set, the sets in
+ * between are counted in skipped.
+ *
+ * @param reader    Reader
+ * @param stats     Returned statistics
+ * @param skipped   Returned number of sets skipped since the last read, may be NULL
+ * @param timeout   Ticks to wait
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_TIMEOUT if no new statistics came in time
+ */
+esp_err_t isp_stats_reader_wait(isp_stats_reader_t *reader, esp_video_isp_frame_stats_t *stats, uint32_t *skipped,
+                                TickType_t timeout);
+
+/**
+ * @brief Close a reader
+ *
+ * @param reader Reader, NULL is ignored
+ */
+void isp_stats_reader_close(isp_stats_reader_t *reader);
+
+/**
+ * @brief Format statistics as one line of JSON
+ *
+ * Only the statistics flagged valid are included.
+ *
+ * @param stats Statistics
+ * @param buf   Text buffer, ISP_STATS_JSON_SIZE fits any set
+ * @param size  Buffer size
+ *
+ * @return Text length, without the terminating null, 0 if it does not fit
+ */
+size_t isp_stats_format_json(const esp_video_isp_frame_stats_t *stats, char *buf, size_t size);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
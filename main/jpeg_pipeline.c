@@ -0,0 +1,695 @@
+/*
+ * Hardware JPEG encoding stage for the HTTP streamer
+ *
+ * Camera frames are queued to the JPEG M2M device as DMABUF output buffers
+ * when the capture buffers are exported, or else as USERPTR output buffers,
+ * so the RGB or YUV data is read in place from the capture buffer and the capture
+ * lease is dropped as soon as the encoder is done with it. Encoded frames live
+ * in the device's MMAP capture buffers and are shared between all clients of
+ * the same quality through a broadcaster; a capture buffer is queued back to
+ * the device when its last lease is released.
+ *
+ * In strip mode the device is programmed for a band of whole MCU rows and a
+ * frame is encoded band by band, straight from the capture buffer. Each band
+ * is a complete JPEG image; the first one gives the headers with the frame
+ * height patched into SOF0 and a DRI segment whose restart interval is the
+ * MCU count of a band, the others only give their entropy coded data after
+ * an RSTn marker. A restart resets the DC predictors just like the start of
+ * a new image does, so the stitched frame is a plain baseline JPEG.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/errno.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "linux/videodev2.h"
+#include "esp_video_device.h"
+#include "jpeg_pipeline.h"
+#include "trace_ring.h"
+#include "task_topology.h"
+
+#define JPEG_MAX_QUALITIES          3
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+#define JPEG_BUFFER_COUNT           1       /* One strip is encoded at a time */
+#else
+#define JPEG_BUFFERS_IN_FLIGHT      3       /* One being encoded, one queued to a client and one being sent */
+#define JPEG_BUFFER_COUNT           (JPEG_MAX_QUALITIES + JPEG_BUFFERS_IN_FLIGHT)   /* Every quality may retain one */
+#endif
+#define JPEG_TASK_STACK_SIZE        4096
+#define JPEG_TASK_PRIORITY          TASK_ENCODE_PRIORITY
+#define JPEG_TASK_CORE              TASK_ENCODE_CORE
+#define JPEG_SOURCE_TIMEOUT_MS      1000
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+#define JPEG_STRIP_MAX_ROWS         CONFIG_EXAMPLE_JPEG_STRIP_ROWS
+#define JPEG_STRIP_MCU_HEIGHT       8       /* RGB888 is encoded as 4:4:4 and RGB565 as 4:2:2, both 8 lines high */
+#define JPEG_STRIP_ALIGN            128     /* Strips read in place must start on a cache line */
+
+#define JPEG_MARKER_SOF0            0xc0
+#define JPEG_MARKER_RST0            0xd0
+#define JPEG_MARKER_EOI             0xd9
+#define JPEG_MARKER_SOS             0xda
+#define JPEG_MARKER_DRI             0xdd
+#endif
+
+static const char *TAG = "jpeg_pipeline";
+
+/* Encoded frames of one quality level */
+typedef struct {
+    uint8_t quality;
+    frame_broadcaster_handle_t bcast;
+    bool retaining;                 /* The latest frame is kept for snapshots, only while subscribed */
+} jpeg_channel_t;
+
+typedef struct {
+    int fd;
+    frame_broadcaster_handle_t source;
+    uint8_t *buffer[JPEG_BUFFER_COUNT];
+    SemaphoreHandle_t free_sem;     /* Counts capture buffers queued to the device */
+    SemaphoreHandle_t lock;         /* Protects the channel table */
+    jpeg_channel_t channels[JPEG_MAX_QUALITIES];
+    uint32_t channel_count;
+    int quality;                    /* Quality currently programmed into the device */
+    uint32_t output_memory;         /* V4L2 memory type of the output queue */
+    uint32_t width;                 /* Input geometry programmed into the device */
+    uint32_t height;
+    uint32_t encoded;
+    TaskHandle_t task;
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+    uint32_t frame_height;          /* Frame height, the device is programmed for one strip */
+    uint32_t line_size;             /* Bytes per input line */
+    uint32_t strip_count;
+    uint32_t strip_interval;        /* MCUs per strip, read from the SOF0 of the first strip */
+    uint8_t *bounce;                /* Copy of a strip that cannot be read in place, NULL until needed */
+#endif
+} jpeg_pipeline_t;
+
+static jpeg_pipeline_t s_jpeg = {
+    .fd = -1,
+    .quality = -1,
+};
+
+static void jpeg_queue_capture_buffer(uint32_t index, void *arg)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(s_jpeg.fd, VIDIOC_QBUF, &buf) != 0) {
+        ESP_LOGE(TAG, "QBUF capture %"PRIu32" failed (errno=%d)", index, errno);
+        return;
+    }
+
+    xSemaphoreGive(s_jpeg.free_sem);
+}
+
+static esp_err_t jpeg_set_quality(uint8_t quality)
+{
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+
+    if (s_jpeg.quality == quality) {
+        return ESP_OK;
+    }
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_JPEG_CLASS;
+    controls.count = 1;
+    controls.controls = control;
+    control[0].id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    control[0].value = quality;
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_S_EXT_CTRLS, &controls) == 0, ESP_FAIL, TAG,
+                        "failed to set JPEG quality %u", quality);
+
+    s_jpeg.quality = quality;
+    return ESP_OK;
+}
+
+/* Exported capture buffers are imported by handle, the output queue is requested again when that changes */
+static esp_err_t jpeg_set_output_memory(uint32_t memory)
+{
+    struct v4l2_requestbuffers req;
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+
+    if (s_jpeg.output_memory == memory) {
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_STREAMOFF, &type) == 0, ESP_FAIL, TAG, "failed to stop output stream");
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = memory;
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, TAG, "failed to request output buffer");
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "failed to start output stream");
+
+    s_jpeg.output_memory = memory;
+    ESP_LOGI(TAG, "Output buffers passed as %s", memory == V4L2_MEMORY_DMABUF ? "DMABUF" : "USERPTR");
+    return ESP_OK;
+}
+
+/* Encode one camera frame, returns the capture buffer index holding the JPEG data */
+static esp_err_t jpeg_encode(const frame_t *frame, uint32_t *index, uint32_t *size)
+{
+    struct v4l2_buffer out_buf;
+    struct v4l2_buffer cap_buf;
+
+    ESP_RETURN_ON_ERROR(jpeg_set_output_memory(frame->dmabuf_fd >= 0 ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_USERPTR),
+                        TAG, "failed to switch output memory");
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.index = 0;
+    out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    out_buf.memory = s_jpeg.output_memory;
+    if (out_buf.memory == V4L2_MEMORY_DMABUF) {
+        out_buf.m.fd = frame->dmabuf_fd;
+    } else {
+        out_buf.m.userptr = (unsigned long)frame->data;
+    }
+    out_buf.length = frame->size;
+    /* Only the frame data is handed to the codec and cleaned from the cache */
+    out_buf.bytesused = frame->size;
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_QBUF, &out_buf) == 0, ESP_FAIL, TAG, "QBUF output failed");
+
+    /* The JPEG device encodes synchronously when the capture buffer is dequeued */
+    memset(&cap_buf, 0, sizeof(cap_buf));
+    cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cap_buf.memory = V4L2_MEMORY_MMAP;
+    esp_err_t ret = ioctl(s_jpeg.fd, VIDIOC_DQBUF, &cap_buf) == 0 ? ESP_OK : ESP_FAIL;
+
+    ESP_RETURN_ON_FALSE(ioctl(s_jpeg.fd, VIDIOC_DQBUF, &out_buf) == 0, ESP_FAIL, TAG, "DQBUF output failed");
+    ESP_RETURN_ON_ERROR(ret, TAG, "DQBUF capture failed");
+
+    *index = cap_buf.index;
+    *size = cap_buf.bytesused;
+    return ESP_OK;
+}
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+/*
+ * Strip height in lines: the largest number of MCU rows up to JPEG_STRIP_MAX_ROWS
+ * that divides the MCU rows of the frame. All restart intervals then hold the
+ * same MCU count, only the last MCU row of the last strip may be padded.
+ */
+static uint32_t jpeg_strip_rows(uint32_t height)
+{
+    uint32_t mcu_rows = (height + JPEG_STRIP_MCU_HEIGHT - 1) / JPEG_STRIP_MCU_HEIGHT;
+    uint32_t rows = MAX(JPEG_STRIP_MAX_ROWS / JPEG_STRIP_MCU_HEIGHT, 1);
+
+    while (mcu_rows % rows) {
+        rows--;
+    }
+
+    return rows * JPEG_STRIP_MCU_HEIGHT;
+}
+
+/* Copy a strip to the bounce buffer, the lines past the frame repeat its last line */
+static uint8_t *jpeg_strip_bounce(const uint8_t *src, uint32_t lines)
+{
+    uint32_t line_size = s_jpeg.line_size;
+
+    if (!s_jpeg.bounce) {
+        s_jpeg.bounce = heap_caps_calloc(1, line_size * s_jpeg.height,
+                                         MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA | MALLOC_CAP_CACHE_ALIGNED);
+        ESP_RETURN_ON_FALSE(s_jpeg.bounce, NULL, TAG, "failed to allocate strip buffer");
+    }
+
+    memcpy(s_jpeg.bounce, src, lines * line_size);
+    for (uint32_t i = lines; i < s_jpeg.height; i++) {
+        memcpy(s_jpeg.bounce + i * line_size, src + (lines - 1) * line_size, line_size);
+    }
+
+    return s_jpeg.bounce;
+}
+
+/* Restart interval of the stitched frame, from the sampling factors in SOF0 */
+static esp_err_t jpeg_strip_read_sof(const uint8_t *sof, uint32_t len)
+{
+    uint32_t max_h = 1;
+    uint32_t max_v = 1;
+    uint32_t components = sof[9];
+
+    /* Marker, length, precision, height, width and count, then 3 bytes per component */
+    ESP_RETURN_ON_FALSE(len >= 10 + components * 3, ESP_FAIL, TAG, "short SOF0 segment");
+    for (uint32_t i = 0; i < components; i++) {
+        max_h = MAX(max_h, (uint32_t)(sof[11 + i * 3] >> 4));
+        max_v = MAX(max_v, (uint32_t)(sof[11 + i * 3] & 0xf));
+    }
+    ESP_RETURN_ON_FALSE(max_v * 8 == JPEG_STRIP_MCU_HEIGHT, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "MCU height %"PRIu32" is not supported", max_v * 8);
+
+    s_jpeg.strip_interval = (s_jpeg.width + max_h * 8 - 1) / (max_h * 8) * (s_jpeg.height / JPEG_STRIP_MCU_HEIGHT);
+    ESP_RETURN_ON_FALSE(s_jpeg.strip_interval <= UINT16_MAX, ESP_ERR_NOT_SUPPORTED, TAG, "strip is too large");
+    return ESP_OK;
+}
+
+/* Hand the part of a strip JPEG that belongs to the stitched frame to the writer */
+static esp_err_t jpeg_strip_write(uint32_t strip, uint8_t *data, uint32_t size, jpeg_pipeline_write_cb_t write_cb,
+                                  void *arg)
+{
+    uint32_t pos = 2;
+    uint32_t sos = 0;
+    uint32_t scan = 0;
+    uint32_t end = size;
+    bool last = strip == s_jpeg.strip_count - 1;
+
+    /* Walk the marker segments up to the start of scan */
+    while (pos + 4 <= size && data[pos] == 0xff) {
+        uint8_t marker = data[pos + 1];
+        uint32_t len = (data[pos + 2] << 8) | data[pos + 3];
+
+        if (marker == JPEG_MARKER_SOS) {
+            sos = pos;
+            scan = pos + 2 + len;
+            break;
+        } else if (marker == JPEG_MARKER_SOF0 && !strip) {
+            ESP_RETURN_ON_ERROR(jpeg_strip_read_sof(data + pos, len + 2), TAG, "unexpected strip layout");
+            data[pos + 5] = s_jpeg.frame_height >> 8;
+            data[pos + 6] = s_jpeg.frame_height & 0xff;
+        }
+        pos += 2 + len;
+    }
+    ESP_RETURN_ON_FALSE(sos && scan < size, ESP_FAIL, TAG, "no scan in strip %"PRIu32, strip);
+    ESP_RETURN_ON_FALSE(s_jpeg.strip_interval, ESP_FAIL, TAG, "no SOF0 in the first strip");
+
+    /* The encoder writes nothing after EOI */
+    while (end >= scan + 2 && !(data[end - 2] == 0xff && data[end - 1] == JPEG_MARKER_EOI)) {
+        end--;
+    }
+    ESP_RETURN_ON_FALSE(end >= scan + 2, ESP_FAIL, TAG, "no EOI in strip %"PRIu32, strip);
+    if (!last) {
+        end -= 2;
+    }
+
+    if (!strip) {
+        uint8_t dri[6] = { 0xff, JPEG_MARKER_DRI, 0, 4, s_jpeg.strip_interval >> 8, s_jpeg.strip_interval & 0xff };
+
+        ESP_RETURN_ON_ERROR(write_cb(data, sos, arg), TAG, "write failed");
+        ESP_RETURN_ON_ERROR(write_cb(dri, sizeof(dri), arg), TAG, "write failed");
+        return write_cb(data + sos, end - sos, arg);
+    }
+
+    /* The marker takes the place of the last two bytes of the SOS segment, which is not sent */
+    data[scan - 2] = 0xff;
+    data[scan - 1] = JPEG_MARKER_RST0 + (strip - 1) % 8;
+    return write_cb(data + scan - 2, end - scan + 2, arg);
+}
+
+esp_err_t jpeg_pipeline_encode_strips(const frame_t *frame, uint8_t quality, jpeg_pipeline_write_cb_t write_cb,
+                                      void *arg)
+{
+    esp_err_t ret;
+    uint32_t encoded_size = 0;
+    uint32_t strip_size = s_jpeg.line_size * s_jpeg.height;
+
+    ESP_RETURN_ON_FALSE(frame && write_cb, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(s_jpeg.fd >= 0, ESP_ERR_INVALID_STATE, TAG, "JPEG pipeline is not started");
+    ESP_RETURN_ON_FALSE(quality >= 1 && quality <= 100, ESP_ERR_INVALID_ARG, TAG, "invalid quality %u", quality);
+    if (frame->width != s_jpeg.width || frame->height != s_jpeg.frame_height) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(s_jpeg.lock, portMAX_DELAY);
+    TRACE_RING_RECORD(TRACE_EVENT_JPEG_START, frame->sequence);
+    ret = jpeg_set_quality(quality);
+    for (uint32_t i = 0; ret == ESP_OK && i < s_jpeg.strip_count; i++) {
+        uint32_t index;
+        uint32_t size;
+        uint32_t lines = MIN(s_jpeg.height, frame->height - i * s_jpeg.height);
+        frame_t strip = {
+            .data = frame->data + i * strip_size,
+            .dmabuf_fd = -1,
+            .size = strip_size,
+        };
+
+        if (lines < s_jpeg.height || (uintptr_t)strip.data % JPEG_STRIP_ALIGN) {
+            strip.data = jpeg_strip_bounce(strip.data, lines);
+            if (!strip.data) {
+                ret = ESP_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        xSemaphoreTake(s_jpeg.free_sem, portMAX_DELAY);
+        ret = jpeg_encode(&strip, &index, &size);
+        if (ret != ESP_OK) {
+            xSemaphoreGive(s_jpeg.free_sem);
+            break;
+        }
+
+        ret = size ? jpeg_strip_write(i, s_jpeg.buffer[index], size, write_cb, arg) : ESP_FAIL;
+        encoded_size += size;
+        jpeg_queue_capture_buffer(index, NULL);
+    }
+    if (ret == ESP_OK) {
+        s_jpeg.encoded++;
+        TRACE_RING_RECORD(TRACE_EVENT_JPEG_DONE, encoded_size);
+    }
+    xSemaphoreGive(s_jpeg.lock);
+
+    return ret;
+}
+#endif
+
+#if !CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+/* Also gives back the frames retained by qualities nobody watches anymore */
+static bool jpeg_has_subscribers(void)
+{
+    bool active = false;
+
+    xSemaphoreTake(s_jpeg.lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < s_jpeg.channel_count; i++) {
+        jpeg_channel_t *channel = &s_jpeg.channels[i];
+
+        if (frame_broadcaster_subscriber_count(channel->bcast)) {
+            active = true;
+        } else if (channel->retaining) {
+            frame_broadcaster_set_retain_latest(channel->bcast, false);
+            channel->retaining = false;
+        }
+    }
+    xSemaphoreGive(s_jpeg.lock);
+
+    return active;
+}
+
+static void jpeg_encode_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_t *source_sub = NULL;
+    bool mismatched = false;
+    frame_subscriber_config_t source_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    source_config.name = "jpeg";
+
+    while (true) {
+        /* Only keep the capture subscription while someone watches the JPEG stream */
+        if (!jpeg_has_subscribers()) {
+            if (source_sub) {
+                frame_broadcaster_unsubscribe(source_sub);
+                source_sub = NULL;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!source_sub) {
+            source_sub = frame_broadcaster_subscribe(s_jpeg.source, &source_config);
+            if (!source_sub) {
+                vTaskDelay(pdMS_TO_TICKS(100));
+                continue;
+            }
+        }
+
+        if (frame_subscriber_wait(source_sub, &frame, pdMS_TO_TICKS(JPEG_SOURCE_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        /* The encoder is configured once, frames of a different capture window are skipped */
+        if (frame->width != s_jpeg.width || frame->height != s_jpeg.height) {
+            if (!mismatched) {
+                ESP_LOGW(TAG, "frame %"PRIu32"x%"PRIu32" does not match encoder %"PRIu32"x%"PRIu32", skipping",
+                         frame->width, frame->height, s_jpeg.width, s_jpeg.height);
+            }
+            mismatched = true;
+            frame_subscriber_release(source_sub, frame);
+            continue;
+        }
+        mismatched = false;
+
+        for (uint32_t i = 0; i < JPEG_MAX_QUALITIES; i++) {
+            uint32_t index;
+            uint32_t size;
+            jpeg_channel_t *channel = &s_jpeg.channels[i];
+
+            /* Channels are only ever appended, entries below channel_count are stable */
+            if (i >= s_jpeg.channel_count || !frame_broadcaster_subscriber_count(channel->bcast)) {
+                continue;
+            }
+
+            /* Never hold the camera frame for long, a quality whose clients are slow skips it */
+            if (xSemaphoreTake(s_jpeg.free_sem, pdMS_TO_TICKS(JPEG_SOURCE_TIMEOUT_MS)) != pdTRUE) {
+                ESP_LOGW(TAG, "no free JPEG buffer, quality %u skips frame %"PRIu32, channel->quality, frame->sequence);
+                continue;
+            }
+            TRACE_RING_RECORD(TRACE_EVENT_JPEG_START, frame->sequence);
+            if (jpeg_set_quality(channel->quality) != ESP_OK ||
+                    jpeg_encode(frame, &index, &size) != ESP_OK) {
+                xSemaphoreGive(s_jpeg.free_sem);
+                continue;
+            }
+
+            if (!size) {
+                ESP_LOGW(TAG, "JPEG encoding failed");
+                jpeg_queue_capture_buffer(index, NULL);
+                continue;
+            }
+            s_jpeg.encoded++;
+            TRACE_RING_RECORD(TRACE_EVENT_JPEG_DONE, size);
+
+            if (!frame_broadcaster_publish(channel->bcast, index, size, frame->timestamp_us)) {
+                jpeg_queue_capture_buffer(index, NULL);
+            }
+        }
+
+        frame_subscriber_release(source_sub, frame);
+    }
+}
+#endif
+
+static esp_err_t jpeg_init_device(uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    int fd;
+    esp_err_t ret = ESP_OK;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    int type;
+
+    fd = open(ESP_VIDEO_JPEG_DEVICE_NAME, O_RDONLY);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_FAIL, TAG, "failed to open %s", ESP_VIDEO_JPEG_DEVICE_NAME);
+
+    /* Output queue: camera frames, passed by pointer */
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.pixelformat = pixel_format;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG,
+                      "failed to set output format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request output buffer");
+
+    /* Capture queue: encoded JPEG frames */
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_JPEG;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG,
+                      "failed to set capture format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = JPEG_BUFFER_COUNT;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request capture buffers");
+
+    for (int i = 0; i < JPEG_BUFFER_COUNT; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, fail, TAG, "failed to query capture buffer");
+
+        s_jpeg.buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        ESP_GOTO_ON_FALSE(s_jpeg.buffer[i] != MAP_FAILED, ESP_ERR_NO_MEM, fail, TAG, "failed to map capture buffer");
+
+        ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QBUF, &buf) == 0, ESP_FAIL, fail, TAG, "failed to queue capture buffer");
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start capture stream");
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start output stream");
+
+    s_jpeg.fd = fd;
+    s_jpeg.output_memory = V4L2_MEMORY_USERPTR;
+    s_jpeg.width = width;
+    s_jpeg.height = height;
+    return ESP_OK;
+
+fail:
+    close(fd);
+    return ret;
+}
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+static esp_err_t jpeg_strip_start(uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    uint32_t rows = jpeg_strip_rows(height);
+
+    ESP_RETURN_ON_FALSE(pixel_format == V4L2_PIX_FMT_RGB24 || pixel_format == V4L2_PIX_FMT_RGB565,
+                        ESP_ERR_NOT_SUPPORTED, TAG, "strips need RGB888 or RGB565 frames");
+
+    ESP_RETURN_ON_ERROR(jpeg_init_device(width, rows, pixel_format), TAG, "failed to initialize JPEG device");
+
+    s_jpeg.frame_height = height;
+    s_jpeg.line_size = width * (pixel_format == V4L2_PIX_FMT_RGB24 ? 3 : 2);
+    s_jpeg.strip_count = (height + rows - 1) / rows;
+
+    ESP_LOGI(TAG, "JPEG strip encoder started, %"PRIu32"x%"PRIu32" in %"PRIu32" strips of %"PRIu32" lines",
+             width, height, s_jpeg.strip_count, rows);
+    return ESP_OK;
+}
+#endif
+
+/* Channel of a quality, called with the lock held */
+static jpeg_channel_t *jpeg_find_channel(uint8_t quality)
+{
+    for (uint32_t i = 0; i < s_jpeg.channel_count; i++) {
+        if (s_jpeg.channels[i].quality == quality) {
+            return &s_jpeg.channels[i];
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t jpeg_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_jpeg.task && s_jpeg.fd < 0, ESP_ERR_INVALID_STATE, TAG, "already started");
+
+    s_jpeg.lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(s_jpeg.lock, ESP_ERR_NO_MEM, TAG, "failed to create lock");
+
+    s_jpeg.free_sem = xSemaphoreCreateCounting(JPEG_BUFFER_COUNT, JPEG_BUFFER_COUNT);
+    ESP_RETURN_ON_FALSE(s_jpeg.free_sem, ESP_ERR_NO_MEM, TAG, "failed to create semaphore");
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+    /* Frames are encoded by the stream senders, there is no encoder task */
+    return jpeg_strip_start(width, height, pixel_format);
+#else
+    ESP_RETURN_ON_ERROR(jpeg_init_device(width, height, pixel_format), TAG, "failed to initialize JPEG device");
+
+    s_jpeg.source = source;
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(jpeg_encode_task, "jpeg_enc", JPEG_TASK_STACK_SIZE, NULL,
+                                                JPEG_TASK_PRIORITY, &s_jpeg.task, JPEG_TASK_CORE) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "failed to create encoder task");
+
+    ESP_LOGI(TAG, "JPEG pipeline started, %"PRIu32"x%"PRIu32, width, height);
+    return ESP_OK;
+#endif
+}
+
+frame_subscriber_t *jpeg_pipeline_subscribe(uint8_t quality, const frame_subscriber_config_t *config)
+{
+    jpeg_channel_t *channel;
+    frame_subscriber_t *sub = NULL;
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+    /* Strips are encoded and sent per client, there are no shared JPEG frames */
+    ESP_LOGD(TAG, "JPEG frames are encoded in strips, nothing to subscribe to");
+    return NULL;
+#endif
+
+    ESP_RETURN_ON_FALSE(s_jpeg.task, NULL, TAG, "JPEG pipeline is not started");
+    ESP_RETURN_ON_FALSE(quality >= 1 && quality <= 100, NULL, TAG, "invalid quality %u", quality);
+
+    xSemaphoreTake(s_jpeg.lock, portMAX_DELAY);
+    channel = jpeg_find_channel(quality);
+    if (!channel && s_jpeg.channel_count < JPEG_MAX_QUALITIES) {
+        jpeg_channel_t *new_channel = &s_jpeg.channels[s_jpeg.channel_count];
+        frame_broadcaster_config_t bcast_config = {
+            .name = "jpeg",
+            .buffers = s_jpeg.buffer,
+            .buffer_count = JPEG_BUFFER_COUNT,
+            .release_cb = jpeg_queue_capture_buffer,
+            .width = s_jpeg.width,
+            .height = s_jpeg.height,
+        };
+
+        if (frame_broadcaster_create(&bcast_config, &new_channel->bcast) == ESP_OK) {
+            new_channel->quality = quality;
+            new_channel->retaining = false;
+            s_jpeg.channel_count++;
+            channel = new_channel;
+        }
+    }
+
+    if (channel) {
+        sub = frame_broadcaster_subscribe(channel->bcast, config);
+#if CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST
+        /* The last JPEG of a watched quality answers snapshot requests without an encode */
+        if (sub && !channel->retaining) {
+            frame_broadcaster_set_retain_latest(channel->bcast, true);
+            channel->retaining = true;
+        }
+#endif
+    } else {
+        ESP_LOGW(TAG, "no free channel for quality %u", quality);
+    }
+    xSemaphoreGive(s_jpeg.lock);
+
+    if (sub) {
+        xTaskNotifyGive(s_jpeg.task);
+    }
+
+    return sub;
+}
+
+#if CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST && !CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+esp_err_t jpeg_pipeline_get_latest(uint8_t quality, const frame_t **frame)
+{
+    jpeg_channel_t *channel;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    ESP_RETURN_ON_FALSE(frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(s_jpeg.task, ESP_ERR_INVALID_STATE, TAG, "JPEG pipeline is not started");
+
+    xSemaphoreTake(s_jpeg.lock, portMAX_DELAY);
+    channel = jpeg_find_channel(quality);
+    if (channel && channel->retaining) {
+        ret = frame_broadcaster_get_latest(channel->bcast, frame);
+    }
+    xSemaphoreGive(s_jpeg.lock);
+
+    return ret;
+}
+
+void jpeg_pipeline_put_latest(uint8_t quality, const frame_t *frame)
+{
+    jpeg_channel_t *channel;
+
+    /* Channels are never removed, the one the frame came from is still there */
+    xSemaphoreTake(s_jpeg.lock, portMAX_DELAY);
+    channel = jpeg_find_channel(quality);
+    xSemaphoreGive(s_jpeg.lock);
+
+    if (channel) {
+        frame_broadcaster_put_latest(channel->bcast, frame);
+    }
+}
+#endif
+
+uint32_t jpeg_pipeline_get_encoded_count(void)
+{
+    return s_jpeg.encoded;
+}
@@ -0,0 +1,128 @@
+/*
+ * Hardware JPEG encoding stage for the HTTP streamer
+ *
+ * The encoder task takes the latest frame from the capture broadcaster, runs
+ * it through the JPEG M2M video device and publishes the compressed frame on a
+ * per-quality broadcaster. Capture, encoding and network sends run in
+ * different tasks, so they overlap instead of adding up.
+ *
+ * With CONFIG_EXAMPLE_JPEG_STRIP_ENCODE there is no encoder task: stream
+ * senders encode each frame in strips and send the JPEG data as it comes out,
+ * so the encoder only holds one strip instead of whole JPEG frames.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called with consecutive pieces of a strip encoded JPEG frame
+ *
+ * @param data JPEG data, only valid during the call
+ * @param size Data size in bytes
+ * @param arg  User argument of jpeg_pipeline_encode_strips()
+ *
+ * @return
+ *      - ESP_OK to go on with the frame
+ *      - Others to abort it
+ */
+typedef esp_err_t (*jpeg_pipeline_write_cb_t)(const uint8_t *data, size_t size, void *arg);
+
+/**
+ * @brief Start the JPEG encoder task
+ *
+ * @param source       Broadcaster of the camera frames
+ * @param width        Frame width
+ * @param height       Frame height
+ * @param pixel_format Camera pixel format, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_RGB565,
+ *                     V4L2_PIX_FMT_YUV422P or V4L2_PIX_FMT_YUV420
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t jpeg_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format);
+
+/**
+ * @brief Subscribe to the JPEG frames encoded with the given quality
+ *
+ * Frames are only encoded while a quality has subscribers. Release and
+ * unsubscribe with frame_subscriber_release() and frame_broadcaster_unsubscribe().
+ *
+ * @param quality JPEG quality, 1-100
+ * @param config  Subscriber configuration, NULL for FRAME_SUBSCRIBER_DEFAULT_CONFIG()
+ *
+ * @return
+ *      - Subscriber handle on success
+ *      - NULL if failed, e.g. too many different qualities are in use or frames are encoded in strips
+ */
+frame_subscriber_t *jpeg_pipeline_subscribe(uint8_t quality, const frame_subscriber_config_t *config);
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+/**
+ * @brief Encode a camera frame strip by strip
+ *
+ * The strips are read in place from the frame and stitched into one baseline
+ * JPEG with restart markers, which is handed to write_cb piece by piece. The
+ * encoder is shared, concurrent callers are served one frame at a time.
+ *
+ * @param frame    Camera frame, held by the caller until the call returns
+ * @param quality  JPEG quality, 1-100
+ * @param write_cb Called with the JPEG data, the first call starts the frame
+ * @param arg      User argument of write_cb
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the frame does not match the encoder geometry, write_cb was not called
+ *      - ESP_ERR_INVALID_STATE if the pipeline is not started
+ *      - Others if encoding failed or write_cb aborted the frame
+ */
+esp_err_t jpeg_pipeline_encode_strips(const frame_t *frame, uint8_t quality, jpeg_pipeline_write_cb_t write_cb,
+                                      void *arg);
+#endif
+
+#if CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST && !CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+/**
+ * @brief Take a lease on the latest JPEG frame encoded with the given quality
+ *
+ * A quality keeps its last frame only while it has subscribers, the frame is
+ * given back to the encoder once the last one is gone. Check
+ * frame->timestamp_us for its age.
+ *
+ * @param quality JPEG quality, 1-100
+ * @param frame   Returned frame, give it back with jpeg_pipeline_put_latest()
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the pipeline is not started
+ *      - ESP_ERR_NOT_FOUND if nothing was encoded with this quality yet or nobody watches it
+ */
+esp_err_t jpeg_pipeline_get_latest(uint8_t quality, const frame_t **frame);
+
+/**
+ * @brief Give back a frame returned by jpeg_pipeline_get_latest()
+ *
+ * @param quality Quality passed to jpeg_pipeline_get_latest()
+ * @param frame   Frame to release
+ */
+void jpeg_pipeline_put_latest(uint8_t quality, const frame_t *frame);
+#endif
+
+/**
+ * @brief Get the number of frames encoded since start
+ *
+ * @return Encoded frame count
+ */
+uint32_t jpeg_pipeline_get_encoded_count(void);
+
+#ifdef __cplusplus
+}
+#endif
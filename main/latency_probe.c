@@ -0,0 +1,342 @@
+/*
+ * Glass-to-glass latency probe for the HTTP streamer
+ *
+ * The LED is toggled from an esp_timer callback, which also latches the
+ * window level of the latest frame as the level before the edge. The probe
+ * task sees every frame through a small bounded queue, a frame dropped for
+ * it could be the first one showing the edge. The window is a few thousand
+ * pixels at most, a scalar sum takes a few microseconds per frame.
+ *
+ * Frames showing an edge are remembered by their timestamp, which the JPEG
+ * and preview frames derived from them keep, so sends and echoes of any
+ * stream can be matched to the edge.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "linux/videodev2.h"
+#include "frame_clock.h"
+#include "latency_probe.h"
+#include "task_topology.h"
+
+#define PROBE_GPIO              CONFIG_EXAMPLE_LATENCY_PROBE_GPIO
+#define PROBE_PERIOD_US         (CONFIG_EXAMPLE_LATENCY_PROBE_PERIOD_MS * 1000LL)
+#define PROBE_ROI_X             CONFIG_EXAMPLE_LATENCY_PROBE_ROI_X
+#define PROBE_ROI_Y             CONFIG_EXAMPLE_LATENCY_PROBE_ROI_Y
+#define PROBE_ROI_SIZE          CONFIG_EXAMPLE_LATENCY_PROBE_ROI_SIZE
+#define PROBE_THRESHOLD         CONFIG_EXAMPLE_LATENCY_PROBE_THRESHOLD
+#define PROBE_SAMPLES           CONFIG_EXAMPLE_LATENCY_PROBE_SAMPLES
+#define PROBE_EDGE_FRAMES       8       /* Frames showing an edge kept for sends and echoes */
+#define PROBE_QUEUE_DEPTH       2
+#define PROBE_WAIT_MS           1000
+#define PROBE_TASK_STACK_SIZE   3072
+#define PROBE_TASK_PRIORITY     TASK_PREVIEW_PRIORITY
+#define PROBE_TASK_CORE         TASK_ENCODE_CORE
+
+static const char *TAG = "latency_probe";
+
+/* Latest samples of one latency */
+typedef struct {
+    uint32_t samples[PROBE_SAMPLES];
+    uint32_t next;
+    uint32_t count;
+} probe_series_t;
+
+/* Frame that showed an edge */
+typedef struct {
+    int64_t timestamp_us;       /* Frame timestamp, 0 for an unused entry */
+    int64_t wall_time_us;       /* X-Frame-Time of the frame */
+    int64_t edge_us;            /* LED toggle time */
+    bool echoed;
+} probe_edge_frame_t;
+
+typedef struct {
+    frame_subscriber_t *sub;
+    esp_timer_handle_t timer;
+    uint32_t pixel_format;
+    portMUX_TYPE lock;          /* Guards everything below */
+    bool led_on;
+    bool pending;               /* The latest edge was not seen yet */
+    int64_t edge_us;
+    uint32_t before_level;      /* Window level when the LED was toggled */
+    uint32_t level;
+    uint32_t edges;
+    uint32_t detected;
+    uint32_t missed;
+    probe_edge_frame_t edge_frames[PROBE_EDGE_FRAMES];
+    uint32_t next_edge_frame;
+    probe_series_t led_to_dqbuf;
+    probe_series_t dqbuf_to_send;
+    probe_series_t glass_to_glass;
+} latency_probe_t;
+
+static latency_probe_t s_probe = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/* Must be called with the lock held */
+static void probe_series_add(probe_series_t *series, int64_t value_us)
+{
+    series->samples[series->next] = MAX(value_us, 0);
+    series->next = (series->next + 1) % PROBE_SAMPLES;
+    series->count = MIN(series->count + 1, PROBE_SAMPLES);
+}
+
+static int probe_compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts the samples of a copy of the series */
+static void probe_series_get_dist(probe_series_t *series, latency_probe_dist_t *dist)
+{
+    uint32_t n = series->count;
+    uint32_t *s = series->samples;
+
+    memset(dist, 0, sizeof(*dist));
+    if (!n) {
+        return;
+    }
+
+    qsort(s, n, sizeof(s[0]), probe_compare_u32);
+    dist->count = n;
+    dist->min_us = s[0];
+    dist->p50_us = s[n / 2];
+    dist->p90_us = s[n * 90 / 100];
+    dist->p99_us = s[n * 99 / 100];
+    dist->max_us = s[n - 1];
+}
+
+static void probe_timer_cb(void *arg)
+{
+    portENTER_CRITICAL(&s_probe.lock);
+    if (s_probe.pending) {
+        s_probe.missed++;
+    }
+    s_probe.led_on = !s_probe.led_on;
+    gpio_set_level(PROBE_GPIO, s_probe.led_on);
+    s_probe.edge_us = esp_timer_get_time();
+    s_probe.before_level = s_probe.level;
+    s_probe.pending = true;
+    s_probe.edges++;
+    portEXIT_CRITICAL(&s_probe.lock);
+}
+
+/* Mean luma of the window, the window is clipped to the frame */
+static uint32_t probe_window_level(const frame_t *frame)
+{
+    uint32_t x0 = MIN(PROBE_ROI_X, frame->width - 1);
+    uint32_t y0 = MIN(PROBE_ROI_Y, frame->height - 1);
+    uint32_t x1 = MIN(x0 + PROBE_ROI_SIZE, frame->width);
+    uint32_t y1 = MIN(y0 + PROBE_ROI_SIZE, frame->height);
+    uint32_t sum = 0;
+
+    for (uint32_t y = y0; y < y1; y++) {
+        switch (s_probe.pixel_format) {
+        case V4L2_PIX_FMT_RGB24: {
+            const uint8_t *src = frame->data + (y * frame->width + x0) * 3;
+
+            for (uint32_t x = x0; x < x1; x++, src += 3) {
+                sum += (77 * src[0] + 150 * src[1] + 29 * src[2]) >> 8;
+            }
+            break;
+        }
+        case V4L2_PIX_FMT_RGB565: {
+            const uint16_t *src = (const uint16_t *)frame->data + y * frame->width + x0;
+
+            /* Green carries most of the luma */
+            for (uint32_t x = x0; x < x1; x++) {
+                sum += ((src[x - x0] >> 5) & 0x3f) << 2;
+            }
+            break;
+        }
+        case V4L2_PIX_FMT_SRGGB10: {
+            /* Packed RAW10, four 8-bit MSBs then a byte of their LSBs */
+            const uint8_t *line = frame->data + y * (frame->width * 5 / 4);
+
+            for (uint32_t x = x0; x < x1; x++) {
+                sum += line[x / 4 * 5 + x % 4];
+            }
+            break;
+        }
+        default: {
+            /* Planar YUV, the luma plane comes first */
+            const uint8_t *src = frame->data + y * frame->width + x0;
+
+            for (uint32_t x = x0; x < x1; x++) {
+                sum += src[x - x0];
+            }
+            break;
+        }
+        }
+    }
+
+    return sum / ((x1 - x0) * (y1 - y0));
+}
+
+static void probe_process(const frame_t *frame)
+{
+    uint32_t level = probe_window_level(frame);
+    int64_t wall_time_us = frame_clock_to_wall_us(frame->timestamp_us);
+
+    portENTER_CRITICAL(&s_probe.lock);
+    s_probe.level = level;
+    if (s_probe.pending && frame->timestamp_us > s_probe.edge_us &&
+        abs((int)level - (int)s_probe.before_level) >= PROBE_THRESHOLD) {
+        probe_edge_frame_t *edge_frame = &s_probe.edge_frames[s_probe.next_edge_frame];
+
+        edge_frame->timestamp_us = frame->timestamp_us;
+        edge_frame->wall_time_us = wall_time_us;
+        edge_frame->edge_us = s_probe.edge_us;
+        edge_frame->echoed = false;
+        s_probe.next_edge_frame = (s_probe.next_edge_frame + 1) % PROBE_EDGE_FRAMES;
+
+        probe_series_add(&s_probe.led_to_dqbuf, frame->timestamp_us - s_probe.edge_us);
+        s_probe.pending = false;
+        s_probe.detected++;
+    }
+    portEXIT_CRITICAL(&s_probe.lock);
+}
+
+static void probe_task(void *arg)
+{
+    const frame_t *frame;
+
+    while (true) {
+        if (frame_subscriber_wait(s_probe.sub, &frame, pdMS_TO_TICKS(PROBE_WAIT_MS)) != ESP_OK) {
+            continue;
+        }
+        probe_process(frame);
+        frame_subscriber_release(s_probe.sub, frame);
+    }
+}
+
+esp_err_t latency_probe_start(frame_broadcaster_handle_t source, uint32_t pixel_format)
+{
+    esp_err_t ret;
+    frame_subscriber_config_t sub_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+    gpio_config_t led_config = {
+        .pin_bit_mask = 1ULL << PROBE_GPIO,
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    esp_timer_create_args_t timer_args = {
+        .callback = probe_timer_cb,
+        .name = "latency_led",
+    };
+
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_probe.sub, ESP_ERR_INVALID_STATE, TAG, "already started");
+    ESP_RETURN_ON_FALSE(pixel_format == V4L2_PIX_FMT_RGB24 || pixel_format == V4L2_PIX_FMT_RGB565 ||
+                        pixel_format == V4L2_PIX_FMT_YUV422P || pixel_format == V4L2_PIX_FMT_YUV420 ||
+                        pixel_format == V4L2_PIX_FMT_SRGGB10, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "pixel format not supported");
+    s_probe.pixel_format = pixel_format;
+
+    ESP_RETURN_ON_ERROR(gpio_config(&led_config), TAG, "Failed to configure LED GPIO");
+    gpio_set_level(PROBE_GPIO, 0);
+
+    sub_config.name = "latency_probe";
+    sub_config.policy = FRAME_DELIVERY_DROP_OLDEST;
+    sub_config.queue_depth = PROBE_QUEUE_DEPTH;
+    s_probe.sub = frame_broadcaster_subscribe(source, &sub_config);
+    ESP_RETURN_ON_FALSE(s_probe.sub, ESP_ERR_NO_MEM, TAG, "Failed to subscribe");
+
+    ESP_GOTO_ON_ERROR(esp_timer_create(&timer_args, &s_probe.timer), exit_0, TAG, "Failed to create LED timer");
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(probe_task, "latency_probe", PROBE_TASK_STACK_SIZE, NULL,
+                                              PROBE_TASK_PRIORITY, NULL, PROBE_TASK_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, exit_1, TAG, "Failed to create probe task");
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_probe.timer, PROBE_PERIOD_US));
+
+    ESP_LOGI(TAG, "LED on GPIO %d toggled every %d ms, window %dx%d at (%d,%d)", PROBE_GPIO,
+             CONFIG_EXAMPLE_LATENCY_PROBE_PERIOD_MS, PROBE_ROI_SIZE, PROBE_ROI_SIZE, PROBE_ROI_X, PROBE_ROI_Y);
+    return ESP_OK;
+
+exit_1:
+    esp_timer_delete(s_probe.timer);
+exit_0:
+    frame_broadcaster_unsubscribe(s_probe.sub);
+    s_probe.sub = NULL;
+    return ret;
+}
+
+void latency_probe_record_send(const frame_t *frame)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_probe.lock);
+    for (uint32_t i = 0; i < PROBE_EDGE_FRAMES; i++) {
+        if (s_probe.edge_frames[i].timestamp_us && s_probe.edge_frames[i].timestamp_us == frame->timestamp_us) {
+            probe_series_add(&s_probe.dqbuf_to_send, now - frame->timestamp_us);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_probe.lock);
+}
+
+esp_err_t latency_probe_echo(int64_t wall_time_us)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    int64_t now = esp_timer_get_time();
+
+    /* Frame times are 0 until the wall clock is set, those cannot be told apart */
+    if (!wall_time_us) {
+        return ret;
+    }
+
+    portENTER_CRITICAL(&s_probe.lock);
+    for (uint32_t i = 0; i < PROBE_EDGE_FRAMES; i++) {
+        probe_edge_frame_t *edge_frame = &s_probe.edge_frames[i];
+
+        if (edge_frame->timestamp_us && edge_frame->wall_time_us == wall_time_us) {
+            if (!edge_frame->echoed) {
+                probe_series_add(&s_probe.glass_to_glass, now - edge_frame->edge_us);
+                edge_frame->echoed = true;
+            }
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_probe.lock);
+
+    return ret;
+}
+
+void latency_probe_get_stats(latency_probe_stats_t *stats)
+{
+    /* Sorted outside the lock, the copies are a few hundred bytes each */
+    probe_series_t *series = malloc(3 * sizeof(probe_series_t));
+
+    portENTER_CRITICAL(&s_probe.lock);
+    stats->edges = s_probe.edges;
+    stats->detected = s_probe.detected;
+    stats->missed = s_probe.missed;
+    stats->level = s_probe.level;
+    if (series) {
+        series[0] = s_probe.led_to_dqbuf;
+        series[1] = s_probe.dqbuf_to_send;
+        series[2] = s_probe.glass_to_glass;
+    }
+    portEXIT_CRITICAL(&s_probe.lock);
+
+    if (!series) {
+        memset(&stats->led_to_dqbuf, 0, sizeof(stats->led_to_dqbuf));
+        memset(&stats->dqbuf_to_send, 0, sizeof(stats->dqbuf_to_send));
+        memset(&stats->glass_to_glass, 0, sizeof(stats->glass_to_glass));
+        return;
+    }
+
+    probe_series_get_dist(&series[0], &stats->led_to_dqbuf);
+    probe_series_get_dist(&series[1], &stats->dqbuf_to_send);
+    probe_series_get_dist(&series[2], &stats->glass_to_glass);
+    free(series);
+}
@@ -0,0 +1,104 @@
+/*
+ * Glass-to-glass latency probe for the HTTP streamer
+ *
+ * An LED driven by a GPIO is toggled at known esp_timer times in front of the
+ * lens. The probe watches the mean luma of a small window of every frame and
+ * takes the first frame whose level stepped after a toggle as the frame that
+ * shows the edge:
+ *
+ *   LED -> DQBUF             toggle until the capture task dequeued that frame
+ *   DQBUF -> send            dequeue until a sender starts on that frame
+ *   glass to glass           toggle until a client echoes that frame back
+ *
+ * A client echoes a frame with /latency?echo=<X-Frame-Time> once it has shown
+ * it, so the last figure includes the display and the return trip of the echo.
+ * Sensor -> DQBUF and the send times of all frames are in /metrics.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Distribution of the latest latency samples
+ */
+typedef struct {
+    uint32_t count;             /*!< Samples, at most the last CONFIG_EXAMPLE_LATENCY_PROBE_SAMPLES */
+    uint32_t min_us;            /*!< Lowest sample */
+    uint32_t p50_us;            /*!< Median */
+    uint32_t p90_us;            /*!< 90th percentile */
+    uint32_t p99_us;            /*!< 99th percentile */
+    uint32_t max_us;            /*!< Highest sample */
+} latency_probe_dist_t;
+
+/**
+ * @brief Probe statistics
+ */
+typedef struct {
+    uint32_t edges;                     /*!< LED toggles */
+    uint32_t detected;                  /*!< Toggles seen in a frame */
+    uint32_t missed;                    /*!< Toggles not seen before the next one */
+    uint32_t level;                     /*!< Mean luma of the window in the latest frame, 0 to 255 */
+    latency_probe_dist_t led_to_dqbuf;  /*!< LED toggle to the dequeue of the frame showing it */
+    latency_probe_dist_t dqbuf_to_send; /*!< Dequeue to a sender starting on that frame */
+    latency_probe_dist_t glass_to_glass;/*!< LED toggle to a client echo of that frame */
+} latency_probe_stats_t;
+
+#if CONFIG_EXAMPLE_LATENCY_PROBE
+
+/**
+ * @brief Start toggling the LED and watching the frames
+ *
+ * @param source       Broadcaster of the camera frames
+ * @param pixel_format Camera pixel format, RGB888, RGB565, planar YUV or packed RAW10
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format has no level to watch
+ *      - Others if the GPIO, the timer or the task could not be set up
+ */
+esp_err_t latency_probe_start(frame_broadcaster_handle_t source, uint32_t pixel_format);
+
+/**
+ * @brief Record a sender starting on a frame
+ *
+ * Only frames that show an LED toggle are recorded. Safe to call from any task.
+ *
+ * @param frame Frame about to be sent
+ */
+void latency_probe_record_send(const frame_t *frame);
+
+/**
+ * @brief Record a client echo of a frame
+ *
+ * @param wall_time_us X-Frame-Time of the frame the client has shown
+ *
+ * @return
+ *      - ESP_OK if the frame shows an LED toggle, the first echo is recorded
+ *      - ESP_ERR_NOT_FOUND if it is no recent frame showing a toggle
+ */
+esp_err_t latency_probe_echo(int64_t wall_time_us);
+
+/**
+ * @brief Get the probe statistics
+ *
+ * @param stats Returned statistics
+ */
+void latency_probe_get_stats(latency_probe_stats_t *stats);
+
+#else
+
+static inline void latency_probe_record_send(const frame_t *frame) {}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,337 @@
+/*
+ * Decimated preview stage for the HTTP streamer
+ *
+ * Every preview pixel is the rounded mean of a factor x factor block of camera
+ * pixels. Rows of a block are first summed into a 16-bit line accumulator, on
+ * the ESP32-P4 with the PIE kernel in preview_downscale_pie.S, then every group
+ * of factor accumulated pixels is reduced to one output pixel. With the PPA the
+ * scale-rotate-mirror engine does the whole downscale by DMA instead. The
+ * preview owns its buffers, so the camera lease is dropped as soon as a frame
+ * is scaled.
+ */
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+#include "esp_cache.h"
+#include "driver/ppa.h"
+#endif
+#include "preview_pipeline.h"
+#include "trace_ring.h"
+#include "task_topology.h"
+
+#define PREVIEW_BUFFER_COUNT        3
+#define PREVIEW_DECIMATION          CONFIG_EXAMPLE_PREVIEW_DECIMATION
+#define PREVIEW_BYTES_PER_PIXEL     3
+#define PREVIEW_TASK_STACK_SIZE     4096
+#define PREVIEW_TASK_PRIORITY       TASK_PREVIEW_PRIORITY
+#define PREVIEW_TASK_CORE           TASK_ENCODE_CORE
+#define PREVIEW_SOURCE_TIMEOUT_MS   1000
+#define PREVIEW_PIE_ALIGN           16      /* esp.vld.128 needs 16-byte aligned addresses */
+#define PREVIEW_ALIGN(size, align)  (((size) + (align) - 1) & ~((align) - 1))
+
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+#define PREVIEW_ENGINE              "PPA"
+#else
+#define PREVIEW_ENGINE              "CPU"
+#endif
+
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PIE
+extern void preview_accumulate_pie(const uint8_t *src, uint16_t *acc, uint32_t size);
+#endif
+
+static const char *TAG = "preview";
+
+typedef struct {
+    frame_broadcaster_handle_t source;
+    frame_broadcaster_handle_t frames;
+    uint8_t *buffer[PREVIEW_BUFFER_COUNT];
+    QueueHandle_t free_queue;       /* Indices of the buffers no subscriber holds */
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+    ppa_client_handle_t ppa;
+    size_t buffer_size;             /* Preview buffer size, a multiple of the cache line */
+#else
+    uint16_t *acc;                  /* Column sums of one block row */
+#endif
+    uint32_t max_width;             /* Largest camera frame the buffers are sized for */
+    uint32_t max_height;
+    uint32_t count;
+    TaskHandle_t task;
+} preview_pipeline_t;
+
+static preview_pipeline_t s_preview;
+
+static void preview_queue_buffer(uint32_t index, void *arg)
+{
+    xQueueSend(s_preview.free_queue, &index, 0);
+}
+
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+static esp_err_t preview_downscale(const frame_t *frame, uint8_t *dst, uint32_t out_width, uint32_t out_height)
+{
+    /* The PPA syncs the caches of both buffers itself */
+    ppa_srm_oper_config_t srm_config = {
+        .in = {
+            .buffer = frame->data,
+            .pic_w = frame->width,
+            .pic_h = frame->height,
+            .block_w = out_width * PREVIEW_DECIMATION,
+            .block_h = out_height * PREVIEW_DECIMATION,
+            .srm_cm = PPA_SRM_COLOR_MODE_RGB888,
+        },
+        .out = {
+            .buffer = dst,
+            .buffer_size = s_preview.buffer_size,
+            .pic_w = out_width,
+            .pic_h = out_height,
+            .srm_cm = PPA_SRM_COLOR_MODE_RGB888,
+        },
+        .rotation_angle = PPA_SRM_ROTATION_ANGLE_0,
+        .scale_x = 1.0f / PREVIEW_DECIMATION,
+        .scale_y = 1.0f / PREVIEW_DECIMATION,
+        .mode = PPA_TRANS_MODE_BLOCKING,
+    };
+
+    return ppa_do_scale_rotate_mirror(s_preview.ppa, &srm_config);
+}
+#else
+/* acc[i] += src[i] for one camera row */
+static void preview_accumulate_row(const uint8_t *src, uint16_t *acc, uint32_t size)
+{
+    uint32_t done = 0;
+
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PIE
+    /* Rows of a capture window may start unaligned, those stay on the scalar path */
+    if (!((uintptr_t)src & (PREVIEW_PIE_ALIGN - 1))) {
+        done = size & ~(PREVIEW_PIE_ALIGN - 1);
+        if (done) {
+            preview_accumulate_pie(src, acc, done);
+        }
+    }
+#endif
+
+    for (uint32_t i = done; i < size; i++) {
+        acc[i] += src[i];
+    }
+}
+
+static esp_err_t preview_downscale(const frame_t *frame, uint8_t *dst, uint32_t out_width, uint32_t out_height)
+{
+    const uint32_t area = PREVIEW_DECIMATION * PREVIEW_DECIMATION;
+    uint32_t stride = frame->width * PREVIEW_BYTES_PER_PIXEL;
+    uint32_t line_size = out_width * PREVIEW_DECIMATION * PREVIEW_BYTES_PER_PIXEL;
+
+    for (uint32_t y = 0; y < out_height; y++) {
+        const uint8_t *src = frame->data + y * PREVIEW_DECIMATION * stride;
+        const uint16_t *acc = s_preview.acc;
+
+        memset(s_preview.acc, 0, line_size * sizeof(uint16_t));
+        for (uint32_t row = 0; row < PREVIEW_DECIMATION; row++) {
+            preview_accumulate_row(src + row * stride, s_preview.acc, line_size);
+        }
+
+        for (uint32_t x = 0; x < out_width; x++) {
+            uint32_t r = 0;
+            uint32_t g = 0;
+            uint32_t b = 0;
+
+            for (uint32_t i = 0; i < PREVIEW_DECIMATION; i++) {
+                r += acc[0];
+                g += acc[1];
+                b += acc[2];
+                acc += PREVIEW_BYTES_PER_PIXEL;
+            }
+
+            dst[0] = (r + area / 2) / area;
+            dst[1] = (g + area / 2) / area;
+            dst[2] = (b + area / 2) / area;
+            dst += PREVIEW_BYTES_PER_PIXEL;
+        }
+    }
+
+    return ESP_OK;
+}
+#endif
+
+static void preview_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_t *source_sub = NULL;
+    frame_subscriber_config_t source_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    source_config.name = "preview";
+
+    while (true) {
+        uint32_t index;
+        uint32_t width;
+        uint32_t height;
+        int64_t timestamp_us;
+
+        /* Only keep the capture subscription while someone watches the preview */
+        if (!frame_broadcaster_subscriber_count(s_preview.frames)) {
+            if (source_sub) {
+                frame_broadcaster_unsubscribe(source_sub);
+                source_sub = NULL;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!source_sub) {
+            source_sub = frame_broadcaster_subscribe(s_preview.source, &source_config);
+            if (!source_sub) {
+                vTaskDelay(pdMS_TO_TICKS(100));
+                continue;
+            }
+        }
+
+        if (frame_subscriber_wait(source_sub, &frame, pdMS_TO_TICKS(PREVIEW_SOURCE_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        /* Skip the frame if every preview buffer is still being sent */
+        if (frame->width > s_preview.max_width || frame->height > s_preview.max_height ||
+                xQueueReceive(s_preview.free_queue, &index, 0) != pdTRUE) {
+            frame_subscriber_release(source_sub, frame);
+            continue;
+        }
+
+        preview_pipeline_get_size(frame->width, frame->height, &width, &height);
+        if (preview_downscale(frame, s_preview.buffer[index], width, height) != ESP_OK) {
+            frame_subscriber_release(source_sub, frame);
+            preview_queue_buffer(index, NULL);
+            continue;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_PREVIEW_DONE, frame->sequence);
+        timestamp_us = frame->timestamp_us;
+        frame_subscriber_release(source_sub, frame);
+
+        s_preview.count++;
+        frame_broadcaster_set_geometry(s_preview.frames, width, height);
+        if (!frame_broadcaster_publish(s_preview.frames, index, width * height * PREVIEW_BYTES_PER_PIXEL, timestamp_us)) {
+            preview_queue_buffer(index, NULL);
+        }
+    }
+}
+
+esp_err_t preview_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t out_width;
+    uint32_t out_height;
+    frame_broadcaster_config_t bcast_config;
+
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_preview.task, ESP_ERR_INVALID_STATE, TAG, "already started");
+    ESP_RETURN_ON_FALSE(pixel_format == V4L2_PIX_FMT_RGB24, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "preview needs RGB888 frames");
+
+    preview_pipeline_get_size(width, height, &out_width, &out_height);
+    ESP_RETURN_ON_FALSE(out_width && out_height, ESP_ERR_INVALID_ARG, TAG, "frame too small");
+
+    s_preview.free_queue = xQueueCreate(PREVIEW_BUFFER_COUNT, sizeof(uint32_t));
+    ESP_RETURN_ON_FALSE(s_preview.free_queue, ESP_ERR_NO_MEM, TAG, "failed to create queue");
+
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+    size_t cache_align;
+    ppa_client_config_t ppa_config = {
+        .oper_type = PPA_OPERATION_SRM,
+        .max_pending_trans_num = 1,
+    };
+
+    ESP_GOTO_ON_ERROR(esp_cache_get_alignment(MALLOC_CAP_SPIRAM, &cache_align), fail, TAG,
+                      "failed to get cache alignment");
+    ESP_GOTO_ON_ERROR(ppa_register_client(&ppa_config, &s_preview.ppa), fail, TAG, "failed to register PPA client");
+
+    /* The PPA writes whole cache lines, the buffers must not share one with other data */
+    s_preview.buffer_size = PREVIEW_ALIGN(out_width * out_height * PREVIEW_BYTES_PER_PIXEL, cache_align);
+    for (uint32_t i = 0; i < PREVIEW_BUFFER_COUNT; i++) {
+        s_preview.buffer[i] = heap_caps_aligned_alloc(cache_align, s_preview.buffer_size,
+                                                      MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+    /* The line accumulator is walked once per camera row, keep it in internal RAM */
+    s_preview.acc = heap_caps_aligned_alloc(PREVIEW_PIE_ALIGN, width * PREVIEW_BYTES_PER_PIXEL * sizeof(uint16_t),
+                                            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(s_preview.acc, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate line accumulator");
+
+    for (uint32_t i = 0; i < PREVIEW_BUFFER_COUNT; i++) {
+        s_preview.buffer[i] = heap_caps_malloc(out_width * out_height * PREVIEW_BYTES_PER_PIXEL,
+                                               MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+        ESP_GOTO_ON_FALSE(s_preview.buffer[i], ESP_ERR_NO_MEM, fail, TAG, "failed to allocate preview buffer");
+        preview_queue_buffer(i, NULL);
+    }
+
+    bcast_config = (frame_broadcaster_config_t) {
+        .name = "preview",
+        .buffers = s_preview.buffer,
+        .buffer_count = PREVIEW_BUFFER_COUNT,
+        .release_cb = preview_queue_buffer,
+        .width = out_width,
+        .height = out_height,
+    };
+    ESP_GOTO_ON_ERROR(frame_broadcaster_create(&bcast_config, &s_preview.frames), fail, TAG,
+                      "failed to create preview broadcaster");
+
+    s_preview.source = source;
+    s_preview.max_width = width;
+    s_preview.max_height = height;
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(preview_task, "preview", PREVIEW_TASK_STACK_SIZE, NULL,
+                                              PREVIEW_TASK_PRIORITY, &s_preview.task, PREVIEW_TASK_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, fail, TAG, "failed to create preview task");
+
+    ESP_LOGI(TAG, "Preview pipeline started, %"PRIu32"x%"PRIu32" (1/%d, %s)", out_width, out_height, PREVIEW_DECIMATION,
+             PREVIEW_ENGINE);
+    return ESP_OK;
+
+fail:
+    /* The broadcaster has no destructor, it is unreachable without the task */
+    for (uint32_t i = 0; i < PREVIEW_BUFFER_COUNT; i++) {
+        heap_caps_free(s_preview.buffer[i]);
+        s_preview.buffer[i] = NULL;
+    }
+#if CONFIG_EXAMPLE_PREVIEW_DOWNSCALE_PPA
+    if (s_preview.ppa) {
+        ppa_unregister_client(s_preview.ppa);
+        s_preview.ppa = NULL;
+    }
+#else
+    heap_caps_free(s_preview.acc);
+    s_preview.acc = NULL;
+#endif
+    vQueueDelete(s_preview.free_queue);
+    s_preview.free_queue = NULL;
+    return ret;
+}
+
+frame_subscriber_t *preview_pipeline_subscribe(const frame_subscriber_config_t *config)
+{
+    frame_subscriber_t *sub;
+
+    ESP_RETURN_ON_FALSE(s_preview.task, NULL, TAG, "preview pipeline is not started");
+
+    sub = frame_broadcaster_subscribe(s_preview.frames, config);
+    if (sub) {
+        xTaskNotifyGive(s_preview.task);
+    }
+
+    return sub;
+}
+
+void preview_pipeline_get_size(uint32_t width, uint32_t height, uint32_t *ret_width, uint32_t *ret_height)
+{
+    *ret_width = width / PREVIEW_DECIMATION;
+    *ret_height = height / PREVIEW_DECIMATION;
+}
+
+uint32_t preview_pipeline_get_frame_count(void)
+{
+    return s_preview.count;
+}
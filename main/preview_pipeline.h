@@ -0,0 +1,68 @@
+/*
+ * Decimated preview stage for the HTTP streamer
+ *
+ * The preview task takes the latest camera frame, box-filters it down by the
+ * configured decimation factor and publishes the result on its own broadcaster.
+ * Preview clients only move the small frames, full resolution frames are still
+ * available to /capture and /stream.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the preview task
+ *
+ * @param source       Broadcaster of the camera frames
+ * @param width        Largest frame width, used to size the preview buffers
+ * @param height       Largest frame height, used to size the preview buffers
+ * @param pixel_format Camera pixel format, only V4L2_PIX_FMT_RGB24 is supported
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format is not supported
+ *      - Others if failed
+ */
+esp_err_t preview_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format);
+
+/**
+ * @brief Subscribe to the preview frames
+ *
+ * Frames are only downscaled while the preview has subscribers. Release and
+ * unsubscribe with frame_subscriber_release() and frame_broadcaster_unsubscribe().
+ *
+ * @param config Subscriber configuration, NULL for FRAME_SUBSCRIBER_DEFAULT_CONFIG()
+ *
+ * @return
+ *      - Subscriber handle on success
+ *      - NULL if failed
+ */
+frame_subscriber_t *preview_pipeline_subscribe(const frame_subscriber_config_t *config);
+
+/**
+ * @brief Get the preview geometry of a camera frame
+ *
+ * @param width      Camera frame width
+ * @param height     Camera frame height
+ * @param ret_width  Returned preview width
+ * @param ret_height Returned preview height
+ */
+void preview_pipeline_get_size(uint32_t width, uint32_t height, uint32_t *ret_width, uint32_t *ret_height);
+
+/**
+ * @brief Get the number of preview frames produced since start
+ *
+ * @return Preview frame count
+ */
+uint32_t preview_pipeline_get_frame_count(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,291 @@
+/*
+ * Dark-frame and flat-field correction of RAW10 frames
+ *
+ * A frame is corrected one row at a time: the row is unpacked into internal
+ * RAM, corrected against its dark and gain map rows, on the ESP32-P4 with
+ * the PIE kernel in raw_calib_apply_pie.S, and packed back in place. Map
+ * rows are padded to a whole number of 8-lane vectors.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "raw_calib.h"
+
+#define RAW_CALIB_MAX_VALUE         1023
+#define RAW_CALIB_UNITY_GAIN        (1 << RAW_CALIB_GAIN_SHIFT)
+#define RAW_CALIB_MAX_GAIN          INT16_MAX
+#define RAW_CALIB_PIE_ALIGN         16      /* esp.vld.128 needs 16-byte aligned addresses */
+#define RAW_CALIB_LANES             8       /* 16-bit lanes of a PIE register */
+#define RAW_CALIB_ALIGN(size, align)        (((size) + (align) - 1) & ~((align) - 1))
+
+#if CONFIG_EXAMPLE_SD_CALIB_PIE
+extern void raw_calib_apply_pie(int16_t *row, const int16_t *dark, const int16_t *gain, uint32_t size,
+                                const int16_t *limits);
+#endif
+
+static const char *TAG = "raw_calib";
+
+struct raw_calib {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesperline;
+    uint32_t stride;            /* Map row size in entries, a multiple of RAW_CALIB_LANES */
+    uint16_t pedestal;
+    uint32_t flags;
+    int16_t *dark;              /* Master dark frame, in PSRAM */
+    int16_t *gain;              /* Gain map, in PSRAM */
+    int16_t *row;               /* Unpacked row being corrected */
+    int16_t *limits;            /* Pedestal and RAW_CALIB_MAX_VALUE in all lanes, after the row */
+};
+
+static void raw_calib_unpack_row(const uint8_t *src, int16_t *row, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, src += 5) {
+        uint8_t lsb = src[4];
+
+        row[x + 0] = (src[0] << 2) | ((lsb >> 0) & 0x3);
+        row[x + 1] = (src[1] << 2) | ((lsb >> 2) & 0x3);
+        row[x + 2] = (src[2] << 2) | ((lsb >> 4) & 0x3);
+        row[x + 3] = (src[3] << 2) | ((lsb >> 6) & 0x3);
+    }
+}
+
+static void raw_calib_pack_row(const int16_t *row, uint8_t *dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x += 4, dst += 5) {
+        dst[0] = row[x + 0] >> 2;
+        dst[1] = row[x + 1] >> 2;
+        dst[2] = row[x + 2] >> 2;
+        dst[3] = row[x + 3] >> 2;
+        dst[4] = (row[x + 0] & 0x3) | ((row[x + 1] & 0x3) << 2) |
+                 ((row[x + 2] & 0x3) << 4) | ((row[x + 3] & 0x3) << 6);
+    }
+}
+
+/* Correct one unpacked row, size is a multiple of RAW_CALIB_LANES, the C loop gives the same result as the PIE one */
+static void raw_calib_apply_row(const raw_calib_t *calib, const int16_t *dark, const int16_t *gain, uint32_t size)
+{
+#if CONFIG_EXAMPLE_SD_CALIB_PIE
+    raw_calib_apply_pie(calib->row, dark, gain, size, calib->limits);
+#else
+    int16_t *row = calib->row;
+
+    for (uint32_t i = 0; i < size; i++) {
+        int32_t value = (((row[i] - dark[i]) * gain[i]) >> RAW_CALIB_GAIN_SHIFT) + calib->pedestal;
+
+        row[i] = value < 0 ? 0 : value > RAW_CALIB_MAX_VALUE ? RAW_CALIB_MAX_VALUE : value;
+    }
+#endif
+}
+
+static void raw_calib_fill(int16_t *map, uint32_t count, int16_t value)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        map[i] = value;
+    }
+}
+
+/* Subtracting the pedestal and adding it back leaves the frame as it is */
+static void raw_calib_reset(raw_calib_t *calib)
+{
+    raw_calib_fill(calib->dark, calib->stride * calib->height, calib->pedestal);
+    raw_calib_fill(calib->gain, calib->stride * calib->height, RAW_CALIB_UNITY_GAIN);
+    calib->flags = 0;
+}
+
+esp_err_t raw_calib_create(uint32_t width, uint32_t height, uint32_t bytesperline, uint16_t pedestal,
+                           raw_calib_t **ret_calib)
+{
+    esp_err_t ret = ESP_OK;
+    raw_calib_t *calib;
+    uint32_t stride = RAW_CALIB_ALIGN(width, RAW_CALIB_LANES);
+    size_t map_size = stride * height * sizeof(int16_t);
+
+    ESP_RETURN_ON_FALSE(ret_calib && width && height && width % 4 == 0 && bytesperline >= width * 5 / 4 &&
+                        pedestal <= RAW_CALIB_MAX_VALUE, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    calib = calloc(1, sizeof(raw_calib_t));
+    ESP_RETURN_ON_FALSE(calib, ESP_ERR_NO_MEM, TAG, "failed to allocate calibration");
+
+    /* Both maps of a full frame only fit in PSRAM, the row is walked by every step of the correction */
+    calib->dark = heap_caps_aligned_alloc(RAW_CALIB_PIE_ALIGN, map_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(calib->dark, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate dark frame");
+    calib->gain = heap_caps_aligned_alloc(RAW_CALIB_PIE_ALIGN, map_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(calib->gain, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate gain map");
+    calib->row = heap_caps_aligned_calloc(RAW_CALIB_PIE_ALIGN, stride + 2 * RAW_CALIB_LANES, sizeof(int16_t),
+                                          MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(calib->row, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate row buffer");
+
+    calib->limits = calib->row + stride;
+    raw_calib_fill(calib->limits, RAW_CALIB_LANES, pedestal);
+    raw_calib_fill(calib->limits + RAW_CALIB_LANES, RAW_CALIB_LANES, RAW_CALIB_MAX_VALUE);
+
+    calib->width = width;
+    calib->height = height;
+    calib->bytesperline = bytesperline;
+    calib->stride = stride;
+    calib->pedestal = pedestal;
+    raw_calib_reset(calib);
+    *ret_calib = calib;
+    return ESP_OK;
+
+fail:
+    raw_calib_delete(calib);
+    return ret;
+}
+
+void raw_calib_set_dark(raw_calib_t *calib, const uint8_t *frame)
+{
+    for (uint32_t y = 0; y < calib->height; y++) {
+        raw_calib_unpack_row(frame + y * calib->bytesperline, calib->dark + y * calib->stride, calib->width);
+    }
+    calib->flags |= RAW_CALIB_FLAG_DARK;
+}
+
+esp_err_t raw_calib_set_flat(raw_calib_t *calib, const uint8_t *frame)
+{
+    uint64_t sum[4] = {0};
+    uint32_t count[4] = {0};
+    uint32_t mean[4];
+
+    /* The mean signal of every Bayer channel, CFA position (y & 1) * 2 + (x & 1) */
+    for (uint32_t y = 0; y < calib->height; y++) {
+        const int16_t *dark = calib->dark + y * calib->stride;
+
+        raw_calib_unpack_row(frame + y * calib->bytesperline, calib->row, calib->width);
+        for (uint32_t x = 0; x < calib->width; x++) {
+            int32_t signal = calib->row[x] - dark[x];
+
+            if (signal > 0) {
+                sum[(y & 1) * 2 + (x & 1)] += signal;
+                count[(y & 1) * 2 + (x & 1)]++;
+            }
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        ESP_RETURN_ON_FALSE(count[i], ESP_ERR_INVALID_ARG, TAG, "flat frame has no signal in channel %d", i);
+        mean[i] = (sum[i] * RAW_CALIB_UNITY_GAIN + count[i] / 2) / count[i];
+    }
+
+    /* Once per calibration, a plain division is fast enough */
+    for (uint32_t y = 0; y < calib->height; y++) {
+        const int16_t *dark = calib->dark + y * calib->stride;
+        int16_t *gain = calib->gain + y * calib->stride;
+
+        raw_calib_unpack_row(frame + y * calib->bytesperline, calib->row, calib->width);
+        for (uint32_t x = 0; x < calib->width; x++) {
+            int32_t signal = calib->row[x] - dark[x];
+
+            if (signal > 0) {
+                uint32_t value = (mean[(y & 1) * 2 + (x & 1)] + signal / 2) / signal;
+
+                gain[x] = value > RAW_CALIB_MAX_GAIN ? RAW_CALIB_MAX_GAIN : value;
+            } else {
+                gain[x] = RAW_CALIB_UNITY_GAIN;
+            }
+        }
+    }
+    calib->flags |= RAW_CALIB_FLAG_FLAT;
+
+    ESP_LOGI(TAG, "Flat field channel means %"PRIu32"/%"PRIu32"/%"PRIu32"/%"PRIu32" LSB",
+             mean[0] >> RAW_CALIB_GAIN_SHIFT, mean[1] >> RAW_CALIB_GAIN_SHIFT,
+             mean[2] >> RAW_CALIB_GAIN_SHIFT, mean[3] >> RAW_CALIB_GAIN_SHIFT);
+    return ESP_OK;
+}
+
+uint32_t raw_calib_get_flags(const raw_calib_t *calib)
+{
+    return calib->flags;
+}
+
+void raw_calib_apply(raw_calib_t *calib, uint8_t *frame)
+{
+    for (uint32_t y = 0; y < calib->height; y++) {
+        uint8_t *line = frame + y * calib->bytesperline;
+
+        raw_calib_unpack_row(line, calib->row, calib->width);
+        raw_calib_apply_row(calib, calib->dark + y * calib->stride, calib->gain + y * calib->stride, calib->stride);
+        raw_calib_pack_row(calib->row, line, calib->width);
+    }
+}
+
+esp_err_t raw_calib_save(const raw_calib_t *calib, const char *path)
+{
+    esp_err_t ret = ESP_OK;
+    size_t map_size = calib->stride * calib->height * sizeof(int16_t);
+    raw_calib_header_t header = {
+        .magic = RAW_CALIB_MAGIC,
+        .version = RAW_CALIB_VERSION,
+        .flags = calib->flags,
+        .width = calib->width,
+        .height = calib->height,
+        .stride = calib->stride,
+        .pedestal = calib->pedestal,
+    };
+    FILE *file = fopen(path, "wb");
+
+    ESP_RETURN_ON_FALSE(file, ESP_FAIL, TAG, "failed to create %s (errno=%d)", path, errno);
+    ESP_GOTO_ON_FALSE(fwrite(&header, 1, sizeof(header), file) == sizeof(header) &&
+                      fwrite(calib->dark, 1, map_size, file) == map_size &&
+                      fwrite(calib->gain, 1, map_size, file) == map_size,
+                      ESP_FAIL, out, TAG, "write failed (errno=%d)", errno);
+
+out:
+    if (fclose(file) != 0 && ret == ESP_OK) {
+        ret = ESP_FAIL;
+    }
+    return ret;
+}
+
+esp_err_t raw_calib_load(raw_calib_t *calib, const char *path)
+{
+    esp_err_t ret = ESP_OK;
+    size_t map_size = calib->stride * calib->height * sizeof(int16_t);
+    raw_calib_header_t header;
+    FILE *file = fopen(path, "rb");
+
+    if (!file) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_GOTO_ON_FALSE(fread(&header, 1, sizeof(header), file) == sizeof(header), ESP_FAIL, out, TAG,
+                      "failed to read header");
+    ESP_GOTO_ON_FALSE(!memcmp(header.magic, RAW_CALIB_MAGIC, sizeof(header.magic)) &&
+                      header.version == RAW_CALIB_VERSION, ESP_ERR_INVALID_VERSION, out, TAG,
+                      "%s is no calibration of version %d", path, RAW_CALIB_VERSION);
+    ESP_GOTO_ON_FALSE(header.width == calib->width && header.height == calib->height &&
+                      header.stride == calib->stride && header.pedestal == calib->pedestal,
+                      ESP_ERR_INVALID_SIZE, out, TAG, "calibration of %"PRIu32"x%"PRIu32", pedestal %u does not match",
+                      header.width, header.height, header.pedestal);
+    if (fread(calib->dark, 1, map_size, file) != map_size || fread(calib->gain, 1, map_size, file) != map_size) {
+        /* Do not correct with half a calibration */
+        ESP_LOGE(TAG, "failed to read the masters");
+        raw_calib_reset(calib);
+        ret = ESP_FAIL;
+        goto out;
+    }
+    calib->flags = header.flags & (RAW_CALIB_FLAG_DARK | RAW_CALIB_FLAG_FLAT);
+
+out:
+    fclose(file);
+    return ret;
+}
+
+void raw_calib_delete(raw_calib_t *calib)
+{
+    if (!calib) {
+        return;
+    }
+
+    heap_caps_free(calib->dark);
+    heap_caps_free(calib->gain);
+    heap_caps_free(calib->row);
+    free(calib);
+}
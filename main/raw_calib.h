@@ -0,0 +1,156 @@
+/*
+ * Dark-frame and flat-field correction of RAW10 frames
+ *
+ * A calibration holds a master dark frame and a gain map derived from a
+ * master flat frame, one entry per pixel in PSRAM. Every corrected pixel is
+ *
+ *   out = ((raw - dark) * gain >> RAW_CALIB_GAIN_SHIFT) + pedestal
+ *
+ * clamped to 10 bits. The pedestal keeps the noise of the dark regions
+ * above zero, so the black level of the corrected frame is the pedestal.
+ * Without a dark master the dark frame is the pedestal, without a flat
+ * master the gain is 1, so a fresh calibration leaves frames unchanged.
+ *
+ * The masters are the means of many frames, see frame_stack.h, captured
+ * with the lens covered for the dark and of a uniform light source for the
+ * flat. raw_calib_save() and raw_calib_load() keep them in one file:
+ *
+ *   raw_calib_header_t
+ *   dark      stride * height int16_t, 10-bit LSB
+ *   gain      stride * height int16_t, RAW_CALIB_GAIN_SHIFT fractional bits
+ *
+ * All fields are little endian.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_CALIB_MAGIC             "RCAL"
+#define RAW_CALIB_VERSION           1
+#define RAW_CALIB_GAIN_SHIFT        12      /* Gain map fractional bits, gains below 8 fit a signed 16-bit lane */
+
+/**
+ * @brief Calibration file header
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];              /*!< RAW_CALIB_MAGIC */
+    uint16_t version;           /*!< RAW_CALIB_VERSION */
+    uint16_t flags;             /*!< RAW_CALIB_FLAG_* of the masters that were set */
+    uint32_t width;             /*!< Frame width in pixels */
+    uint32_t height;            /*!< Frame height */
+    uint32_t stride;            /*!< Entries per map row, width padded to the SIMD lanes */
+    uint16_t pedestal;          /*!< Pedestal the dark frame was taken against */
+    uint16_t reserved;
+} raw_calib_header_t;
+
+#define RAW_CALIB_FLAG_DARK         (1 << 0)
+#define RAW_CALIB_FLAG_FLAT         (1 << 1)
+
+/**
+ * @brief Calibration handle
+ */
+typedef struct raw_calib raw_calib_t;
+
+/**
+ * @brief Create a calibration that leaves frames unchanged
+ *
+ * @param width        Frame width in pixels, a multiple of 4
+ * @param height       Frame height
+ * @param bytesperline Packed RAW10 line size, at least width * 5 / 4
+ * @param pedestal     Black level of the corrected frames, 10-bit LSB
+ * @param ret_calib    Returned calibration
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the geometry is not RAW10
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ */
+esp_err_t raw_calib_create(uint32_t width, uint32_t height, uint32_t bytesperline, uint16_t pedestal,
+                           raw_calib_t **ret_calib);
+
+/**
+ * @brief Set the master dark frame
+ *
+ * @param calib Calibration
+ * @param frame Packed RAW10 master dark frame
+ */
+void raw_calib_set_dark(raw_calib_t *calib, const uint8_t *frame);
+
+/**
+ * @brief Derive the gain map from a master flat frame
+ *
+ * The dark frame is subtracted first, so the dark master must be set
+ * before. Every pixel gets the gain that brings it to the mean of its
+ * Bayer channel, the colour balance of the light source is kept. Pixels
+ * without signal in the flat, e.g. dead pixels, keep a gain of 1.
+ *
+ * @param calib Calibration
+ * @param frame Packed RAW10 master flat frame
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the flat frame has no signal above the dark frame
+ */
+esp_err_t raw_calib_set_flat(raw_calib_t *calib, const uint8_t *frame);
+
+/**
+ * @brief Get the masters that were set or loaded
+ *
+ * @param calib Calibration
+ *
+ * @return RAW_CALIB_FLAG_* bits
+ */
+uint32_t raw_calib_get_flags(const raw_calib_t *calib);
+
+/**
+ * @brief Correct a frame in place
+ *
+ * @param calib Calibration
+ * @param frame Packed RAW10 frame
+ */
+void raw_calib_apply(raw_calib_t *calib, uint8_t *frame);
+
+/**
+ * @brief Write the calibration to a file
+ *
+ * @param calib Calibration
+ * @param path  File path
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the file could not be written
+ */
+esp_err_t raw_calib_save(const raw_calib_t *calib, const char *path);
+
+/**
+ * @brief Read the calibration from a file
+ *
+ * @param calib Calibration
+ * @param path  File path
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if the file does not exist
+ *      - ESP_ERR_INVALID_VERSION if the file is no calibration of this version
+ *      - ESP_ERR_INVALID_SIZE if it was taken for another frame geometry or pedestal
+ *      - ESP_FAIL if the file could not be read
+ */
+esp_err_t raw_calib_load(raw_calib_t *calib, const char *path);
+
+/**
+ * @brief Delete a calibration
+ *
+ * @param calib Calibration, can be NULL
+ */
+void raw_calib_delete(raw_calib_t *calib);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,293 @@
+/*
+ * Lossless RAW10 compression stage for the HTTP streamer
+ *
+ * Camera frames are queued to the RAW codec M2M device as USERPTR output
+ * buffers, so the packed RAW10 data is read in place from the capture buffer
+ * and the capture lease is dropped as soon as the frame is coded. Compressed
+ * frames live in the device's MMAP capture buffers and are shared between all
+ * clients through a broadcaster; a capture buffer is queued back to the device
+ * when its last lease is released.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/errno.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#include "esp_video_device.h"
+#include "esp_video_ioctl.h"
+#include "raw_codec_pipeline.h"
+#include "trace_ring.h"
+#include "task_topology.h"
+
+#define RAW_CODEC_BUFFER_COUNT      3
+#define RAW_CODEC_TASK_STACK_SIZE   4096
+#define RAW_CODEC_TASK_PRIORITY     TASK_ENCODE_PRIORITY
+#define RAW_CODEC_TASK_CORE         TASK_ENCODE_CORE
+#define RAW_CODEC_SOURCE_TIMEOUT_MS 1000
+
+static const char *TAG = "raw_codec_pipeline";
+
+typedef struct {
+    int fd;
+    frame_broadcaster_handle_t source;
+    frame_broadcaster_handle_t frames;
+    uint8_t *buffer[RAW_CODEC_BUFFER_COUNT];
+    SemaphoreHandle_t free_sem;     /* Counts capture buffers queued to the device */
+    uint32_t width;                 /* Input geometry programmed into the device */
+    uint32_t height;
+    raw_codec_pipeline_stats_t stats;
+    TaskHandle_t task;
+} raw_codec_pipeline_t;
+
+static raw_codec_pipeline_t s_raw_codec = {
+    .fd = -1,
+};
+
+static void raw_codec_queue_capture_buffer(uint32_t index, void *arg)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(s_raw_codec.fd, VIDIOC_QBUF, &buf) != 0) {
+        ESP_LOGE(TAG, "QBUF capture %"PRIu32" failed (errno=%d)", index, errno);
+        return;
+    }
+
+    xSemaphoreGive(s_raw_codec.free_sem);
+}
+
+/* Compress one camera frame, returns the capture buffer index holding the coded frame */
+static esp_err_t raw_codec_encode(const frame_t *frame, uint32_t *index, uint32_t *size)
+{
+    struct v4l2_buffer out_buf;
+    struct v4l2_buffer cap_buf;
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.index = 0;
+    out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    out_buf.memory = V4L2_MEMORY_USERPTR;
+    out_buf.m.userptr = (unsigned long)frame->data;
+    out_buf.length = frame->size;
+    /* Only the frame data is handed to the codec and cleaned from the cache */
+    out_buf.bytesused = frame->size;
+    ESP_RETURN_ON_FALSE(ioctl(s_raw_codec.fd, VIDIOC_QBUF, &out_buf) == 0, ESP_FAIL, TAG, "QBUF output failed");
+
+    /* The codec runs synchronously when the capture buffer is dequeued */
+    memset(&cap_buf, 0, sizeof(cap_buf));
+    cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cap_buf.memory = V4L2_MEMORY_MMAP;
+    esp_err_t ret = ioctl(s_raw_codec.fd, VIDIOC_DQBUF, &cap_buf) == 0 ? ESP_OK : ESP_FAIL;
+
+    ESP_RETURN_ON_FALSE(ioctl(s_raw_codec.fd, VIDIOC_DQBUF, &out_buf) == 0, ESP_FAIL, TAG, "DQBUF output failed");
+    ESP_RETURN_ON_ERROR(ret, TAG, "DQBUF capture failed");
+
+    *index = cap_buf.index;
+    *size = cap_buf.bytesused;
+    return ESP_OK;
+}
+
+static void raw_codec_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_t *source_sub = NULL;
+    bool mismatched = false;
+    frame_subscriber_config_t source_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    source_config.name = "raw_codec";
+
+    while (true) {
+        uint32_t index;
+        uint32_t size;
+
+        /* Only keep the capture subscription while someone reads the compressed stream */
+        if (!frame_broadcaster_subscriber_count(s_raw_codec.frames)) {
+            if (source_sub) {
+                frame_broadcaster_unsubscribe(source_sub);
+                source_sub = NULL;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!source_sub) {
+            source_sub = frame_broadcaster_subscribe(s_raw_codec.source, &source_config);
+            if (!source_sub) {
+                vTaskDelay(pdMS_TO_TICKS(100));
+                continue;
+            }
+        }
+
+        if (frame_subscriber_wait(source_sub, &frame, pdMS_TO_TICKS(RAW_CODEC_SOURCE_TIMEOUT_MS)) != ESP_OK) {
+            continue;
+        }
+
+        /* The codec is configured once, frames of a different capture window are skipped */
+        if (frame->width != s_raw_codec.width || frame->height != s_raw_codec.height) {
+            if (!mismatched) {
+                ESP_LOGW(TAG, "frame %"PRIu32"x%"PRIu32" does not match codec %"PRIu32"x%"PRIu32", skipping",
+                         frame->width, frame->height, s_raw_codec.width, s_raw_codec.height);
+            }
+            mismatched = true;
+            frame_subscriber_release(source_sub, frame);
+            continue;
+        }
+        mismatched = false;
+
+        xSemaphoreTake(s_raw_codec.free_sem, portMAX_DELAY);
+        TRACE_RING_RECORD(TRACE_EVENT_RAW_CODEC_START, frame->sequence);
+        if (raw_codec_encode(frame, &index, &size) != ESP_OK) {
+            xSemaphoreGive(s_raw_codec.free_sem);
+            frame_subscriber_release(source_sub, frame);
+            continue;
+        }
+
+        int64_t timestamp_us = frame->timestamp_us;
+        uint32_t in_size = frame->size;
+        frame_subscriber_release(source_sub, frame);
+
+        if (!size) {
+            ESP_LOGW(TAG, "RAW compression failed");
+            raw_codec_queue_capture_buffer(index, NULL);
+            continue;
+        }
+
+        TRACE_RING_RECORD(TRACE_EVENT_RAW_CODEC_DONE, size);
+        s_raw_codec.stats.frames++;
+        s_raw_codec.stats.in_bytes += in_size;
+        s_raw_codec.stats.out_bytes += size;
+
+        if (!frame_broadcaster_publish(s_raw_codec.frames, index, size, timestamp_us)) {
+            raw_codec_queue_capture_buffer(index, NULL);
+        }
+    }
+}
+
+static esp_err_t raw_codec_init_device(uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    int fd;
+    esp_err_t ret = ESP_OK;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    int type;
+
+    fd = open(ESP_VIDEO_RAW_CODEC_DEVICE_NAME, O_RDONLY);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_FAIL, TAG, "failed to open %s", ESP_VIDEO_RAW_CODEC_DEVICE_NAME);
+
+    /* Output queue: camera frames, passed by pointer */
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.pixelformat = pixel_format;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG,
+                      "failed to set output format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request output buffer");
+
+    /* Capture queue: compressed frames */
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = width;
+    format.fmt.pix.height = height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_ESP_RAW10_RICE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG,
+                      "failed to set capture format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = RAW_CODEC_BUFFER_COUNT;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request capture buffers");
+
+    for (int i = 0; i < RAW_CODEC_BUFFER_COUNT; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, fail, TAG, "failed to query capture buffer");
+
+        s_raw_codec.buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        ESP_GOTO_ON_FALSE(s_raw_codec.buffer[i] != MAP_FAILED, ESP_ERR_NO_MEM, fail, TAG, "failed to map capture buffer");
+
+        ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QBUF, &buf) == 0, ESP_FAIL, fail, TAG, "failed to queue capture buffer");
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start capture stream");
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start output stream");
+
+    s_raw_codec.fd = fd;
+    s_raw_codec.width = width;
+    s_raw_codec.height = height;
+    return ESP_OK;
+
+fail:
+    close(fd);
+    return ret;
+}
+
+esp_err_t raw_codec_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format)
+{
+    ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_raw_codec.task, ESP_ERR_INVALID_STATE, TAG, "already started");
+
+    s_raw_codec.free_sem = xSemaphoreCreateCounting(RAW_CODEC_BUFFER_COUNT, RAW_CODEC_BUFFER_COUNT);
+    ESP_RETURN_ON_FALSE(s_raw_codec.free_sem, ESP_ERR_NO_MEM, TAG, "failed to create semaphore");
+
+    ESP_RETURN_ON_ERROR(raw_codec_init_device(width, height, pixel_format), TAG, "failed to initialize RAW codec device");
+
+    frame_broadcaster_config_t bcast_config = {
+        .name = "raw_codec",
+        .buffers = s_raw_codec.buffer,
+        .buffer_count = RAW_CODEC_BUFFER_COUNT,
+        .release_cb = raw_codec_queue_capture_buffer,
+        .width = width,
+        .height = height,
+    };
+    ESP_RETURN_ON_ERROR(frame_broadcaster_create(&bcast_config, &s_raw_codec.frames), TAG,
+                        "failed to create broadcaster");
+
+    s_raw_codec.source = source;
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(raw_codec_task, "raw_codec", RAW_CODEC_TASK_STACK_SIZE, NULL,
+                                                RAW_CODEC_TASK_PRIORITY, &s_raw_codec.task, RAW_CODEC_TASK_CORE) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "failed to create codec task");
+
+    ESP_LOGI(TAG, "RAW codec pipeline started, %"PRIu32"x%"PRIu32, width, height);
+    return ESP_OK;
+}
+
+frame_subscriber_t *raw_codec_pipeline_subscribe(const frame_subscriber_config_t *config)
+{
+    frame_subscriber_t *sub;
+
+    ESP_RETURN_ON_FALSE(s_raw_codec.task, NULL, TAG, "RAW codec pipeline is not started");
+
+    sub = frame_broadcaster_subscribe(s_raw_codec.frames, config);
+    if (sub) {
+        xTaskNotifyGive(s_raw_codec.task);
+    }
+
+    return sub;
+}
+
+void raw_codec_pipeline_get_stats(raw_codec_pipeline_stats_t *stats)
+{
+    *stats = s_raw_codec.stats;
+}
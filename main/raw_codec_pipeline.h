@@ -0,0 +1,66 @@
+/*
+ * Lossless RAW10 compression stage for the HTTP streamer
+ *
+ * The codec task takes the latest RAW10 frame from the capture broadcaster,
+ * runs it through the lossless RAW codec M2M video device and publishes the
+ * V4L2_PIX_FMT_ESP_RAW10_RICE frame on its own broadcaster. The decoded frame
+ * is bit-exact, so the stream keeps the radiometric data JPEG would destroy.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Compression statistics
+ */
+typedef struct {
+    uint32_t frames;        /*!< Frames compressed since start */
+    uint64_t in_bytes;      /*!< Packed RAW10 bytes fed to the codec */
+    uint64_t out_bytes;     /*!< Compressed bytes produced */
+} raw_codec_pipeline_stats_t;
+
+/**
+ * @brief Start the RAW codec task
+ *
+ * @param source       Broadcaster of the camera frames
+ * @param width        Frame width, a multiple of 4
+ * @param height       Frame height
+ * @param pixel_format Camera pixel format, one of the 10-bit Bayer formats
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t raw_codec_pipeline_start(frame_broadcaster_handle_t source, uint32_t width, uint32_t height, uint32_t pixel_format);
+
+/**
+ * @brief Subscribe to the compressed frames
+ *
+ * Frames are only compressed while the stage has subscribers. Release and
+ * unsubscribe with frame_subscriber_release() and frame_broadcaster_unsubscribe().
+ *
+ * @param config Subscriber configuration, NULL for FRAME_SUBSCRIBER_DEFAULT_CONFIG()
+ *
+ * @return
+ *      - Subscriber handle on success
+ *      - NULL if failed
+ */
+frame_subscriber_t *raw_codec_pipeline_subscribe(const frame_subscriber_config_t *config);
+
+/**
+ * @brief Get the compression statistics
+ *
+ * @param stats Returned statistics
+ */
+void raw_codec_pipeline_get_stats(raw_codec_pipeline_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
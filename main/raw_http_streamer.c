@@ -13,55 +13,248 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/errno.h>
 #include <errno.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "nvs_flash.h"
 #include "esp_http_server.h"
+#if CONFIG_EXAMPLE_HTTPS_STREAM
+#include "esp_https_server.h"
+#endif
+#include "lwip/sockets.h"
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY || CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+#include "lwip/api.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/priv/sockets_priv.h"
+#endif
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#endif
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#endif
 #include "protocol_examples_common.h"
 #include "example_video_common.h"
+#include "esp_video_ioctl.h"
+#include "frame_broadcaster.h"
+#include "capture_buffers.h"
+#include "frame_clock.h"
+#include "preview_pipeline.h"
+#if CONFIG_EXAMPLE_INFERENCE_TAP
+#include "inference_tap.h"
+#endif
+#include "trace_ring.h"
+#include "stream_metrics.h"
+#include "isp_stats_feed.h"
+#include "latency_probe.h"
+#include "task_topology.h"
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+#include "change_detect.h"
+#endif
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+#include "sd_recorder.h"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+#include "jpeg_pipeline.h"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+#include "raw_codec_pipeline.h"
+#endif
 
 /* Configuration */
-#define VIDEO_BUFFER_COUNT      4  /* Increased from 2 for smoother streaming */
 #define FRAME_WIDTH             1936
 #define FRAME_HEIGHT            1100
 
+/* Stream clients each get their own worker task, httpd keeps sockets for the API on top */
+#define STREAM_MAX_CLIENTS      CONFIG_EXAMPLE_HTTP_MAX_STREAMS
+#define HTTP_API_SOCKETS        CONFIG_EXAMPLE_HTTP_API_SOCKETS
+#define HTTP_MAX_URI_HANDLERS   20
+#if CONFIG_EXAMPLE_HTTPS_STREAM
+#define HTTP_TASK_STACK_SIZE    10240   /* The TLS handshake runs in the server task */
+#else
+#define HTTP_TASK_STACK_SIZE    8192
+#endif
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+#define STREAM_TASK_STACK_SIZE  4608
+#else
+#define STREAM_TASK_STACK_SIZE  4096
+#endif
+#define STREAM_TASK_PRIORITY    TASK_NETWORK_PRIORITY
+#define STREAM_TASK_CORE        TASK_NETWORK_CORE
+#define STREAM_DEFAULT_QUEUE_DEPTH  2
+
+/* /capture.jpg serves the cached JPEG up to this age, then waits this long for a new one */
+#define CAPTURE_JPEG_MAX_AGE_MS     1000
+#define CAPTURE_JPEG_TIMEOUT_MS     2000
+#define CAPTURE_JPEG_CACHED         (CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST && CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE && \
+                                     !CONFIG_EXAMPLE_JPEG_STRIP_ENCODE)
+
+/* Part header room for the change detection headers, the mask of a full frame at the smallest step fits */
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+#define STREAM_CHANGE_HEADER_LEN    256
+#else
+#define STREAM_CHANGE_HEADER_LEN    0
+#endif
+
+/* WebSocket transport */
+#define WS_FRAME_MAGIC          v4l2_fourcc('E', 'S', 'P', 'F')
+#define WS_FRAME_VERSION        2
+#define WS_DEFAULT_CREDITS      2       /* Frames a client may receive before its first credit message */
+#define WS_MAX_CREDITS          32
+#define WS_CONTROL_MAX_LEN      16
+
+/* UDP transport */
+#define UDP_FRAGMENT_MAGIC      v4l2_fourcc('E', 'S', 'P', 'U')
+#define UDP_DATAGRAM_SIZE       1472    /* Fits a 1500 byte MTU without IP fragmentation */
+#define UDP_MAX_CLIENTS         2
+#define UDP_MAX_FEC_GROUP       64
+#define UDP_CLIENT_TIMEOUT_MS   3000
+#define UDP_SEND_RETRIES        20
+#define UDP_ZC_PBUFS            64      /* Payload references a client may have in lwIP and the driver */
+#define UDP_ZC_LEASES           2       /* Frames a client may have in flight */
+#define UDP_ZC_BATCH            16      /* Datagrams handed to the tcpip thread per call */
+#define UDP_ZC_PBUF_WAIT_MS     100
+
+/* Adaptive stream, rates are measured over windows of STREAM_ADAPT_WINDOW_US */
+#define STREAM_ADAPT_WINDOW_US      2000000
+#define STREAM_ADAPT_MISS_RATIO     0.9f    /* Below this fraction of the target the level is too heavy... */
+#define STREAM_ADAPT_BUSY_RATIO     0.8f    /* ...if the sender was busy for this fraction of the window */
+#define STREAM_ADAPT_HEADROOM       0.7f    /* Fraction of the measured link rate a higher level may use */
+
+/* /status is sent in chunks, the longest one is the camera object */
+#define STATUS_PART_SIZE            512
+
+/* Prometheus text, 4 histograms of 13 buckets and the counters */
+#define STREAM_METRICS_TEXT_SIZE    8192
+
+/* Raw TCP stream sink */
+#define TCP_REQUEST_MAX_LEN     256
+#define TCP_SEND_TIMEOUT_S      5
+#define TCP_BENCH_CHUNK_SIZE    (1024 * 1024)   /* /bench sends this buffer over and over */
+#define TCP_BENCH_MAX_MB        4096
+
+/* Capture buffer changes wait this long for stream senders to release their frames */
+#define BUFFERS_RESIZE_TIMEOUT_MS   2000
+
+/* Camera bring-up runs in its own task while WiFi associates */
+#define BOOT_CAMERA_TASK_STACK_SIZE 6144
+
+/* Sensor exposure and gain are read over SCCB, cache them for this long */
+#define CAMERA_EXPOSURE_REFRESH_US  200000
+
 /* Stream boundary for multipart */
 #define STREAM_BOUNDARY         "raw_frame_boundary"
 static const char *STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" STREAM_BOUNDARY;
-static const char *STREAM_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: application/octet-stream\r\nContent-Length: %u\r\n\r\n";
+static const char *STREAM_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: application/octet-stream\r\nContent-Length: %u\r\n"
+                                 "X-Frame-Width: %u\r\nX-Frame-Height: %u\r\nX-Frame-Time: %lld\r\n\r\n";
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+static const char *MJPEG_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                                "X-Frame-Width: %u\r\nX-Frame-Height: %u\r\nX-Frame-Time: %lld\r\n\r\n";
+#endif
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+/* Strips are sent as they are encoded, the JPEG size is not known up front */
+static const char *MJPEG_STRIP_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\n"
+                                      "X-Frame-Width: %u\r\nX-Frame-Height: %u\r\nX-Frame-Time: %lld\r\n\r\n";
+#endif
+#if CONFIG_EXAMPLE_HTTP_CAPTURE_RAW10
+/* Packed RAW10 lines are width * 5 / 4 bytes, the sensor format is set to SRGGB10 */
+static const char *RAW10_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: image/x-bayer-raw10\r\nContent-Length: %u\r\n"
+                                "X-Frame-Width: %u\r\nX-Frame-Height: %u\r\nX-Frame-Time: %lld\r\n"
+                                "X-Frame-Format: RAW10\r\nX-Bayer-Pattern: RGGB\r\n\r\n";
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+static const char *LOSSLESS_PART = "\r\n--" STREAM_BOUNDARY "\r\nContent-Type: application/x-esp-raw10-rice\r\nContent-Length: %u\r\n"
+                                   "X-Frame-Width: %u\r\nX-Frame-Height: %u\r\nX-Frame-Time: %lld\r\n\r\n";
+#endif
+
+/* Stream payload, selected by the URI handler's user context */
+typedef enum {
+    STREAM_KIND_RAW = 0,
+    STREAM_KIND_MJPEG,
+    STREAM_KIND_PREVIEW,
+    STREAM_KIND_LOSSLESS,
+    STREAM_KIND_ADAPTIVE,
+} stream_kind_t;
 
 static const char *TAG = "rgb_streamer";
 
 /* Camera state */
 typedef struct {
     int fd;
-    uint8_t *buffer[VIDEO_BUFFER_COUNT];
+    capture_buffers_t bufs;     /* Updated in place by frame_broadcaster_resize_capture() */
     uint32_t buffer_size;
     uint32_t width;
     uint32_t height;
     uint32_t pixel_format;
-    SemaphoreHandle_t sem;
+    uint32_t sensor_width;      /* Full frame, the capture window is a part of it */
+    uint32_t sensor_height;
+    struct v4l2_rect roi;       /* Current capture window */
+    frame_broadcaster_handle_t frames;
+    uint32_t exposure;          /* Last exposure and gain read back from the sensor */
+    uint32_t gain;
+    int64_t exposure_time_us;
 } camera_t;
 
 static camera_t s_camera = {.fd = -1};
+static _Atomic uint32_t s_stream_clients;
+
+/*
+ * Every socket that can be open at once: httpd with its listener and control
+ * sockets, the TCP sink listener with its clients plus one accepted only to be
+ * turned away, and the UDP socket.
+ */
+#define HTTPD_INTERNAL_SOCKETS  3
+#if CONFIG_EXAMPLE_TCP_STREAM
+#define TCP_STREAM_SOCKETS      (1 + STREAM_MAX_CLIENTS + 1)
+#else
+#define TCP_STREAM_SOCKETS      0
+#endif
+#if CONFIG_EXAMPLE_UDP_STREAM
+#define UDP_STREAM_SOCKETS      1
+#else
+#define UDP_STREAM_SOCKETS      0
+#endif
+
+_Static_assert(STREAM_MAX_CLIENTS + HTTP_API_SOCKETS + HTTPD_INTERNAL_SOCKETS + TCP_STREAM_SOCKETS +
+               UDP_STREAM_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS,
+               "HTTP, TCP and UDP stream sockets exceed LWIP_MAX_SOCKETS");
+
+/* Take a stream client slot, httpd, the TCP listener and the UDP task race for them */
+static bool stream_client_reserve(void)
+{
+    uint32_t count = s_stream_clients;
+
+    do {
+        if (count >= STREAM_MAX_CLIENTS) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&s_stream_clients, &count, count + 1));
+
+    return true;
+}
 
 /* ========== Camera Functions ========== */
 static esp_err_t init_camera(void)
 {
     int fd;
     struct v4l2_format format;
-    struct v4l2_requestbuffers req;
+    capture_buffers_config_t buffers_config = CAPTURE_BUFFERS_DEFAULT_CONFIG();
 
     ESP_LOGI(TAG, "Initializing camera...");
 
@@ -94,27 +287,58 @@ static esp_err_t init_camera(void)
     format.fmt.pix.height = FRAME_HEIGHT;
     format.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;  /* RGB888 - ISP full pipeline */
     format.fmt.pix.field = V4L2_FIELD_NONE;
+#if CONFIG_EXAMPLE_HTTP_CAPTURE_YUV422
+    /* The JPEG encoder reads the ISP's YUV output directly, without a second color conversion */
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV422P;
+#elif CONFIG_EXAMPLE_HTTP_CAPTURE_YUV420
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+#endif
 
-    if (ioctl(fd, VIDIOC_S_FMT, &format) != 0) {
-        ESP_LOGW(TAG, "Failed to set RGB888 format, trying RGB565...");
-        /* Fallback to RGB565 if RGB888 not supported */
-        format.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB565;
-        if (ioctl(fd, VIDIOC_S_FMT, &format) != 0) {
-            ESP_LOGW(TAG, "Failed to set RGB565, reading current...");
-            memset(&format, 0, sizeof(format));
-            format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            ioctl(fd, VIDIOC_G_FMT, &format);
-        } else {
-            ESP_LOGI(TAG, "RGB565 format set successfully!");
+#if CONFIG_EXAMPLE_HTTP_CAPTURE_RAW10
+    /* Bypass the ISP, the sensor data is streamed as is and compressed losslessly */
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_SRGGB10;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, TAG, "Failed to set RAW10 format");
+    ESP_LOGI(TAG, "RAW10 format set successfully!");
+#elif CONFIG_EXAMPLE_HTTP_CAPTURE_YUV422 || CONFIG_EXAMPLE_HTTP_CAPTURE_YUV420
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, TAG, "Failed to set YUV format");
+    ESP_LOGI(TAG, "YUV format set successfully!");
+#else
+    /* RGB888, else RGB565, of the current sensor mode, looked up in the driver's format capabilities */
+    static const uint32_t rgb_formats[] = { V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_RGB565 };
+    struct esp_video_format_query query;
+    int set = -1;
+
+    for (int i = 0; i < sizeof(rgb_formats) / sizeof(rgb_formats[0]) && set != 0; i++) {
+        memset(&query, 0, sizeof(query));
+        query.pixelformat = rgb_formats[i];
+        query.flags = ESP_VIDEO_FORMAT_CAP_CURRENT;
+        if (ioctl(fd, VIDIOC_QUERY_BEST_FORMAT, &query) == 0) {
+            format.fmt.pix.width = query.cap.width;
+            format.fmt.pix.height = query.cap.height;
+            format.fmt.pix.pixelformat = query.cap.pixelformat;
+            set = ioctl(fd, VIDIOC_S_FMT, &format);
         }
+    }
+    if (set != 0) {
+        ESP_LOGW(TAG, "No RGB format available, reading current...");
+        memset(&format, 0, sizeof(format));
+        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ioctl(fd, VIDIOC_G_FMT, &format);
     } else {
-        ESP_LOGI(TAG, "RGB888 format set successfully!");
+        ESP_LOGI(TAG, "%s format set successfully!", format.fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24 ? "RGB888" : "RGB565");
     }
+#endif
 
     s_camera.fd = fd;
     s_camera.width = format.fmt.pix.width;
     s_camera.height = format.fmt.pix.height;
     s_camera.pixel_format = format.fmt.pix.pixelformat;
+    s_camera.sensor_width = s_camera.width;
+    s_camera.sensor_height = s_camera.height;
+    s_camera.roi = (struct v4l2_rect) {
+        .width = s_camera.width,
+        .height = s_camera.height,
+    };
 
     /* Log format as 4-char code */
     char fmt_str[5] = {0};
@@ -126,254 +350,2996 @@ static esp_err_t init_camera(void)
     ESP_LOGI(TAG, "Camera: %"PRIu32"x%"PRIu32", format=%s (0x%08lx)",
              s_camera.width, s_camera.height, fmt_str, (unsigned long)s_camera.pixel_format);
 
-    /* Request buffers */
-    memset(&req, 0, sizeof(req));
-    req.count = VIDEO_BUFFER_COUNT;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, TAG, "REQBUFS failed");
+    /* Request, allocate and queue buffers */
+    ESP_RETURN_ON_ERROR(capture_buffers_alloc(fd, &buffers_config, &s_camera.bufs), TAG, "Failed to allocate buffers");
+    s_camera.buffer_size = s_camera.bufs.size;
+
+    /* Start streaming */
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "STREAMON failed");
 
-    /* Map buffers */
-    for (int i = 0; i < VIDEO_BUFFER_COUNT; i++) {
-        struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
+    /* The broadcaster's capture task owns the V4L2 queue from now on */
+    ESP_RETURN_ON_ERROR(frame_broadcaster_start_capture(&s_camera.bufs, &s_camera.frames),
+                        TAG, "Failed to start frame broadcaster");
+#if CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST
+    /* /capture answers from the latest frame instead of waiting for the next one */
+    frame_broadcaster_set_retain_latest(s_camera.frames, true);
+#endif
 
-        ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, TAG, "QUERYBUF failed");
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    /* JPEG streaming is optional, the raw endpoints keep working without it */
+    if (jpeg_pipeline_start(s_camera.frames, s_camera.width, s_camera.height, s_camera.pixel_format) != ESP_OK) {
+        ESP_LOGW(TAG, "JPEG pipeline not available, /stream.mjpeg disabled");
+    }
+#endif
 
-        s_camera.buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-        ESP_RETURN_ON_FALSE(s_camera.buffer[i] != MAP_FAILED, ESP_ERR_NO_MEM, TAG, "mmap failed");
-        s_camera.buffer_size = buf.length;
+    /* The preview is optional as well, it needs RGB888 frames */
+    if (preview_pipeline_start(s_camera.frames, s_camera.width, s_camera.height, s_camera.pixel_format) != ESP_OK) {
+        ESP_LOGW(TAG, "Preview pipeline not available, /stream.preview disabled");
+    }
 
-        ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_QBUF, &buf) == 0, ESP_FAIL, TAG, "QBUF failed");
+#if CONFIG_EXAMPLE_INFERENCE_TAP
+    /* The model input pyramid needs RGB888 frames too */
+    if (inference_tap_start(s_camera.frames, s_camera.width, s_camera.height, s_camera.pixel_format) != ESP_OK) {
+        ESP_LOGW(TAG, "Inference tap not available");
     }
+#endif
 
-    s_camera.sem = xSemaphoreCreateBinary();
-    ESP_RETURN_ON_FALSE(s_camera.sem, ESP_ERR_NO_MEM, TAG, "Failed to create semaphore");
-    xSemaphoreGive(s_camera.sem);
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    /* The lossless codec only takes 10-bit Bayer frames */
+    if (raw_codec_pipeline_start(s_camera.frames, s_camera.width, s_camera.height, s_camera.pixel_format) != ESP_OK) {
+        ESP_LOGW(TAG, "RAW codec pipeline not available, /stream.lossless disabled");
+    }
+#endif
 
-    /* Start streaming */
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "STREAMON failed");
+#if CONFIG_EXAMPLE_LATENCY_PROBE
+    if (latency_probe_start(s_camera.frames, s_camera.pixel_format) != ESP_OK) {
+        ESP_LOGW(TAG, "Latency probe not available");
+    }
+#endif
 
     ESP_LOGI(TAG, "Camera initialized, buffer_size=%"PRIu32, s_camera.buffer_size);
     return ESP_OK;
 }
 
+/* Runs in the capture task while streaming is off */
+static esp_err_t camera_apply_roi(int fd, void *arg)
+{
+    struct v4l2_rect *rect = (struct v4l2_rect *)arg;
+    struct v4l2_selection selection;
+    struct v4l2_format format;
+
+    memset(&selection, 0, sizeof(selection));
+    selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    selection.target = V4L2_SEL_TGT_CROP;
+    selection.r = *rect;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_SELECTION, &selection) == 0, ESP_ERR_INVALID_ARG, TAG, "S_SELECTION failed");
+
+    /* The driver aligns the window, report what is actually captured */
+    *rect = selection.r;
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = rect->width;
+    format.fmt.pix.height = rect->height;
+    format.fmt.pix.pixelformat = s_camera.pixel_format;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    if (ioctl(fd, VIDIOC_S_FMT, &format) != 0) {
+        ESP_LOGE(TAG, "S_FMT %"PRIu32"x%"PRIu32" failed, restoring full frame", rect->width, rect->height);
+        memset(&selection.r, 0, sizeof(selection.r));
+        ioctl(fd, VIDIOC_S_SELECTION, &selection);
+        *rect = selection.r;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/* Program the capture window, only the window is read out of the sensor and sent */
+static esp_err_t camera_set_roi(const struct v4l2_rect *roi)
+{
+    esp_err_t ret;
+    struct v4l2_rect rect = *roi;
+
+    if (!memcmp(&rect, &s_camera.roi, sizeof(rect))) {
+        return ESP_OK;
+    }
+
+    ret = frame_broadcaster_reconfigure_capture(s_camera.frames, camera_apply_roi, &rect);
+    if (rect.width && rect.height) {
+        s_camera.roi = rect;
+        s_camera.width = rect.width;
+        s_camera.height = rect.height;
+    }
+
+    ESP_LOGI(TAG, "ROI (%"PRIi32",%"PRIi32") %"PRIu32"x%"PRIu32"%s", s_camera.roi.left, s_camera.roi.top,
+             s_camera.roi.width, s_camera.roi.height, ret == ESP_OK ? "" : " (request failed)");
+    return ret;
+}
+
+/* Sensor exposure and gain, refreshed at most every CAMERA_EXPOSURE_REFRESH_US */
+static void camera_get_exposure(uint32_t *exposure, uint32_t *gain)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (now - s_camera.exposure_time_us >= CAMERA_EXPOSURE_REFRESH_US) {
+        struct v4l2_ext_controls controls;
+        struct v4l2_ext_control control[2];
+
+        memset(&controls, 0, sizeof(controls));
+        memset(control, 0, sizeof(control));
+        controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+        controls.count = 2;
+        controls.controls = control;
+        control[0].id = V4L2_CID_EXPOSURE;
+        control[1].id = V4L2_CID_GAIN;
+        if (ioctl(s_camera.fd, VIDIOC_G_EXT_CTRLS, &controls) == 0) {
+            s_camera.exposure = control[0].value;
+            s_camera.gain = control[1].value;
+        }
+        s_camera.exposure_time_us = now;
+    }
+
+    *exposure = s_camera.exposure;
+    *gain = s_camera.gain;
+}
+
+/* Capture format name for the X-Frame-Format header */
+static const char *camera_format_name(void)
+{
+    switch (s_camera.pixel_format) {
+    case V4L2_PIX_FMT_RGB565:
+        return "RGB565";
+    case V4L2_PIX_FMT_SRGGB10:
+        return "RAW10";
+    case V4L2_PIX_FMT_YUV422P:
+        return "YUV422";
+    case V4L2_PIX_FMT_YUV420:
+        return "YUV420";
+    default:
+        return "RGB888";
+    }
+}
+
 /* ========== HTTP Handlers ========== */
 
-/* Single frame capture - for Python viewer polling */
-static esp_err_t capture_handler(httpd_req_t *req)
+/* URL query of a request, an empty string if it has none */
+static void stream_get_query(httpd_req_t *req, char *query, size_t query_len)
 {
-    struct v4l2_buffer buf;
+    if (httpd_req_get_url_query_str(req, query, query_len) != ESP_OK) {
+        query[0] = '\0';
+    }
+}
 
-    if (xSemaphoreTake(s_camera.sem, pdMS_TO_TICKS(1000)) != pdTRUE) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Camera busy");
-        return ESP_FAIL;
+/* Wait for the next published frame, the subscriber must be released by the caller */
+static esp_err_t capture_wait_next(frame_subscriber_t **ret_sub, const frame_t **frame)
+{
+    frame_subscriber_config_t sub_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+    sub_config.name = "capture";
+    frame_subscriber_t *sub = frame_broadcaster_subscribe(s_camera.frames, &sub_config);
+
+    ESP_RETURN_ON_FALSE(sub, ESP_ERR_NO_MEM, TAG, "Failed to subscribe");
+    if (frame_subscriber_wait(sub, frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+        frame_broadcaster_unsubscribe(sub);
+        return ESP_ERR_TIMEOUT;
     }
 
-    /* Dequeue buffer */
-    memset(&buf, 0, sizeof(buf));
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    *ret_sub = sub;
+    return ESP_OK;
+}
+
+/*
+ * Single frame capture - for Python viewer polling. The latest published frame is
+ * sent right away, /capture?mode=next waits for the next one.
+ */
+static esp_err_t capture_handler(httpd_req_t *req)
+{
+    const frame_t *frame = NULL;
+    frame_subscriber_t *sub = NULL;
+    char query[32];
+    char mode[8];
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    stream_get_query(req, query, sizeof(query));
+    bool next = httpd_query_key_value(query, "mode", mode, sizeof(mode)) == ESP_OK && !strcmp(mode, "next");
 
-    if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
-        xSemaphoreGive(s_camera.sem);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Frame capture failed");
+#if CONFIG_EXAMPLE_HTTP_SNAPSHOT_LATEST
+    if (!next) {
+        ret = frame_broadcaster_get_latest(s_camera.frames, &frame);
+    }
+#endif
+    if (ret != ESP_OK) {
+        ret = capture_wait_next(&sub, &frame);
+    }
+    if (ret != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                            ret == ESP_ERR_TIMEOUT ? "Frame capture failed" : "Camera busy");
         return ESP_FAIL;
     }
 
     /* Send frame */
+    char width[12];
+    char height[12];
+    char sequence[12];
+    char wall_time[24];
+    snprintf(width, sizeof(width), "%"PRIu32, frame->width);
+    snprintf(height, sizeof(height), "%"PRIu32, frame->height);
+    snprintf(sequence, sizeof(sequence), "%"PRIu32, frame->sequence);
+    snprintf(wall_time, sizeof(wall_time), "%lld", frame_clock_to_wall_us(frame->timestamp_us));
     httpd_resp_set_type(req, "application/octet-stream");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "X-Frame-Width", "1936");
-    httpd_resp_set_hdr(req, "X-Frame-Height", "1100");
-    httpd_resp_set_hdr(req, "X-Frame-Format", "RGB888");
+    httpd_resp_set_hdr(req, "X-Frame-Width", width);
+    httpd_resp_set_hdr(req, "X-Frame-Height", height);
+    httpd_resp_set_hdr(req, "X-Frame-Format", camera_format_name());
+    httpd_resp_set_hdr(req, "X-Frame-Sequence", sequence);
+    httpd_resp_set_hdr(req, "X-Frame-Time", wall_time);
 
-    esp_err_t ret = httpd_resp_send(req, (char *)s_camera.buffer[buf.index], buf.bytesused);
+    ret = httpd_resp_send(req, (char *)frame->data, frame->size);
 
-    /* Re-queue buffer */
-    ioctl(s_camera.fd, VIDIOC_QBUF, &buf);
-    xSemaphoreGive(s_camera.sem);
+    if (sub) {
+        frame_subscriber_release(sub, frame);
+        frame_broadcaster_unsubscribe(sub);
+    } else {
+        frame_broadcaster_put_latest(s_camera.frames, frame);
+    }
 
     return ret;
 }
 
-/* Continuous stream handler - multipart RAW stream */
-static esp_err_t stream_handler(httpd_req_t *req)
+/*
+ * Delivery policy from the query string, e.g. policy=drop_oldest&depth=2&max_fps=2.
+ * Slow clients skip frames by default.
+ */
+static void stream_parse_delivery(const char *query, frame_subscriber_config_t *config)
 {
-    struct v4l2_buffer buf;
-    char part_header[128];
-    esp_err_t ret = ESP_OK;
-    int frame_count = 0;
-    int dqbuf_errors = 0;
+    char value[16];
 
-    ESP_LOGI(TAG, "Stream client connected");
+    *config = (frame_subscriber_config_t)FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+    config->queue_depth = STREAM_DEFAULT_QUEUE_DEPTH;
 
-    httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "X-Frame-Width", "1936");
-    httpd_resp_set_hdr(req, "X-Frame-Height", "1100");
+    if (httpd_query_key_value(query, "policy", value, sizeof(value)) == ESP_OK &&
+            frame_delivery_policy_from_str(value, &config->policy) != ESP_OK) {
+        ESP_LOGW(TAG, "Unknown delivery policy '%s', using latest", value);
+    }
+    if (httpd_query_key_value(query, "depth", value, sizeof(value)) == ESP_OK) {
+        config->queue_depth = strtoul(value, NULL, 10);
+    }
+    if (httpd_query_key_value(query, "max_fps", value, sizeof(value)) == ESP_OK) {
+        config->max_fps = strtoul(value, NULL, 10);
+    }
+}
 
-    while (true) {
-        if (xSemaphoreTake(s_camera.sem, pdMS_TO_TICKS(1000)) != pdTRUE) {
-            ESP_LOGW(TAG, "Semaphore timeout");
-            continue;
-        }
+/* Build the stream subscriber configuration of a request, e.g. /stream?policy=drop_oldest&depth=2 */
+static void stream_get_subscriber_config(httpd_req_t *req, frame_subscriber_config_t *config, char *name, size_t name_len)
+{
+    char query[64];
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
 
-        /* Dequeue buffer */
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
+    stream_get_query(req, query, sizeof(query));
+    stream_parse_delivery(query, config);
 
-        ESP_LOGI(TAG, ">>> DQBUF start (waiting for frame %d)...", frame_count + 1);
-        int64_t dqbuf_start = esp_timer_get_time();
-        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
-            int64_t elapsed_ms = (esp_timer_get_time() - dqbuf_start) / 1000;
-            ESP_LOGE(TAG, ">>> DQBUF failed after %lld ms", elapsed_ms);
-            dqbuf_errors++;
-            if (dqbuf_errors <= 5 || dqbuf_errors % 100 == 0) {
-                ESP_LOGE(TAG, "DQBUF failed (errno=%d), errors=%d", errno, dqbuf_errors);
-            }
-            xSemaphoreGive(s_camera.sem);
-            vTaskDelay(pdMS_TO_TICKS(10));
-            continue;
+    /* Name the subscriber after the peer address so /status can tell clients apart */
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &addr_len) == 0 &&
+            inet_ntop(AF_INET6, &addr.sin6_addr, name, name_len)) {
+        /* Strip the IPv4-mapped prefix */
+        if (!strncmp(name, "::ffff:", 7)) {
+            memmove(name, name + 7, strlen(name + 7) + 1);
         }
+    } else {
+        strlcpy(name, "stream", name_len);
+    }
+    config->name = name;
+}
 
-        frame_count++;
-        if (frame_count <= 3 || frame_count % 30 == 0) {
-            ESP_LOGI(TAG, "Frame %d: size=%"PRIu32" bytes", frame_count, buf.bytesused);
-        }
+/*
+ * Capture window from /stream?x=&y=&w=&h=, returns false if the query has none of them.
+ * Missing offsets default to 0 and missing sizes extend to the sensor edge, so
+ * /stream?x=0 selects the full frame again.
+ */
+static bool stream_get_roi(const char *query, struct v4l2_rect *rect)
+{
+    char value[8];
+    bool found = false;
+    long x = 0;
+    long y = 0;
+    long w = 0;
+    long h = 0;
 
-        /* Send part header */
-        int hlen = snprintf(part_header, sizeof(part_header), STREAM_PART, buf.bytesused);
-        ret = httpd_resp_send_chunk(req, part_header, hlen);
-        if (ret != ESP_OK) {
-            ioctl(s_camera.fd, VIDIOC_QBUF, &buf);
-            xSemaphoreGive(s_camera.sem);
-            break;
-        }
+    if (httpd_query_key_value(query, "x", value, sizeof(value)) == ESP_OK) {
+        x = strtol(value, NULL, 10);
+        found = true;
+    }
+    if (httpd_query_key_value(query, "y", value, sizeof(value)) == ESP_OK) {
+        y = strtol(value, NULL, 10);
+        found = true;
+    }
+    if (httpd_query_key_value(query, "w", value, sizeof(value)) == ESP_OK) {
+        w = strtol(value, NULL, 10);
+        found = true;
+    }
+    if (httpd_query_key_value(query, "h", value, sizeof(value)) == ESP_OK) {
+        h = strtol(value, NULL, 10);
+        found = true;
+    }
+    if (!found) {
+        return false;
+    }
 
-        /* Send frame data */
-        ret = httpd_resp_send_chunk(req, (char *)s_camera.buffer[buf.index], buf.bytesused);
+    x = MIN(MAX(x, 0), (long)s_camera.sensor_width - 1);
+    y = MIN(MAX(y, 0), (long)s_camera.sensor_height - 1);
+    if (w <= 0 || x + w > s_camera.sensor_width) {
+        w = s_camera.sensor_width - x;
+    }
+    if (h <= 0 || y + h > s_camera.sensor_height) {
+        h = s_camera.sensor_height - y;
+    }
 
-        /* Re-queue buffer */
-        int qbuf_ret = ioctl(s_camera.fd, VIDIOC_QBUF, &buf);
-        if (qbuf_ret != 0) {
-            ESP_LOGE(TAG, ">>> QBUF failed! errno=%d", errno);
-        } else {
-            ESP_LOGI(TAG, ">>> QBUF success, buffer %d re-queued", buf.index);
-        }
-        xSemaphoreGive(s_camera.sem);
+    rect->left = x;
+    rect->top = y;
+    rect->width = w;
+    rect->height = h;
+    return true;
+}
 
-        if (ret != ESP_OK) {
-            break;
-        }
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+/* JPEG quality from /stream.mjpeg?quality=N, defaults to the Kconfig value */
+static uint8_t stream_get_jpeg_quality(const char *query)
+{
+    char value[8];
+    int quality = CONFIG_EXAMPLE_JPEG_COMPRESSION_QUALITY;
+
+    if (httpd_query_key_value(query, "quality", value, sizeof(value)) == ESP_OK) {
+        quality = atoi(value);
     }
 
-    ESP_LOGI(TAG, "Stream client disconnected");
-    return ret;
+    return (uint8_t)MIN(MAX(quality, 1), 100);
 }
+#endif
 
-/* Status endpoint */
-static esp_err_t status_handler(httpd_req_t *req)
+/* Stream kind from stream=raw|preview|mjpeg|lossless, defaults to the raw camera frames */
+static stream_kind_t stream_get_kind(const char *query)
 {
-    char json[256];
-    snprintf(json, sizeof(json),
-             "{\"width\":%"PRIu32",\"height\":%"PRIu32",\"format\":\"RGB888\",\"buffer_size\":%"PRIu32"}",
-             s_camera.width, s_camera.height, s_camera.buffer_size);
+    char value[16];
 
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_sendstr(req, json);
+    if (httpd_query_key_value(query, "stream", value, sizeof(value)) != ESP_OK) {
+        return STREAM_KIND_RAW;
+    }
+
+    if (!strcmp(value, "preview")) {
+        return STREAM_KIND_PREVIEW;
+    } else if (!strcmp(value, "mjpeg")) {
+        return STREAM_KIND_MJPEG;
+    } else if (!strcmp(value, "lossless")) {
+        return STREAM_KIND_LOSSLESS;
+    }
+
+    return STREAM_KIND_RAW;
 }
 
-/* Index page */
-static esp_err_t index_handler(httpd_req_t *req)
+/* Fourcc of the frames a stream kind delivers */
+static uint32_t stream_get_fourcc(stream_kind_t kind)
 {
-    const char *html =
-        "<!DOCTYPE html><html><head><title>IMX662 RGB Streamer</title></head>"
-        "<body style='font-family:monospace;padding:20px'>"
-        "<h1>IMX662 RGB888 Streaming Server</h1>"
-        "<p>Resolution: 1936x1100, Format: RGB888 (ISP processed)</p>"
-        "<h2>Endpoints:</h2>"
-        "<ul>"
-        "<li><a href='/capture'>/capture</a> - Single RAW frame (for Python viewer)</li>"
-        "<li><a href='/stream'>/stream</a> - Continuous RAW stream</li>"
-        "<li><a href='/status'>/status</a> - Camera status (JSON)</li>"
-        "</ul>"
-        "<h2>Python Viewer:</h2>"
-        "<pre>python raw_stream_viewer.py --host [THIS_IP] --port 80</pre>"
-        "</body></html>";
+    switch (kind) {
+    case STREAM_KIND_PREVIEW:
+        return V4L2_PIX_FMT_RGB24;
+    case STREAM_KIND_MJPEG:
+        return V4L2_PIX_FMT_JPEG;
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    case STREAM_KIND_LOSSLESS:
+        return V4L2_PIX_FMT_ESP_RAW10_RICE;
+#endif
+    default:
+        return s_camera.pixel_format;
+    }
+}
 
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_sendstr(req, html);
+/*
+ * Subscribe to the frames of a stream kind, *sub is NULL if the stream is not available.
+ * Fails only if the capture window in the query cannot be applied.
+ */
+static esp_err_t stream_subscribe(const char *query, stream_kind_t kind, const frame_subscriber_config_t *config,
+                                  frame_subscriber_t **sub, uint32_t *width, uint32_t *height)
+{
+    struct v4l2_rect roi;
+
+    if (kind == STREAM_KIND_RAW || kind == STREAM_KIND_PREVIEW) {
+        /* The window is shared by every client, it applies to all raw and preview streams */
+        if (stream_get_roi(query, &roi) && camera_set_roi(&roi) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    *sub = NULL;
+    *width = s_camera.width;
+    *height = s_camera.height;
+    if (kind == STREAM_KIND_RAW) {
+        *sub = frame_broadcaster_subscribe(s_camera.frames, config);
+    } else if (kind == STREAM_KIND_PREVIEW) {
+        *sub = preview_pipeline_subscribe(config);
+        preview_pipeline_get_size(s_camera.width, s_camera.height, width, height);
+    }
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    else if (kind == STREAM_KIND_MJPEG) {
+        *sub = jpeg_pipeline_subscribe(stream_get_jpeg_quality(query), config);
+    }
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    else if (kind == STREAM_KIND_LOSSLESS) {
+        *sub = raw_codec_pipeline_subscribe(config);
+    }
+#endif
+
+    return ESP_OK;
 }
 
-/* API compatibility endpoint */
-static esp_err_t api_capture_handler(httpd_req_t *req)
+/* Multipart part header of a stream kind, formatted with the frame size, width and height */
+static const char *stream_get_part_format(stream_kind_t kind)
 {
-    return capture_handler(req);
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    if (kind == STREAM_KIND_MJPEG) {
+        return MJPEG_PART;
+    }
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    if (kind == STREAM_KIND_LOSSLESS) {
+        return LOSSLESS_PART;
+    }
+#endif
+#if CONFIG_EXAMPLE_HTTP_CAPTURE_RAW10
+    if (kind == STREAM_KIND_RAW) {
+        return RAW10_PART;
+    }
+#endif
+
+    return STREAM_PART;
 }
 
-static esp_err_t init_http_server(void)
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+/* ========== Adaptive Stream ========== */
+
+/*
+ * /stream.auto?fps=N walks a ladder from the full camera frames down to the
+ * preview and picks the best level that still holds the target rate on the
+ * client's link. Levels whose pipeline is not running are skipped.
+ */
+typedef struct {
+    stream_kind_t kind;
+    uint8_t quality;            /* JPEG quality, 0 for the other kinds */
+} stream_level_t;
+
+static const stream_level_t s_stream_levels[] = {
+    { STREAM_KIND_RAW, 0 },
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    { STREAM_KIND_LOSSLESS, 0 },
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    { STREAM_KIND_MJPEG, CONFIG_EXAMPLE_JPEG_COMPRESSION_QUALITY },
+    { STREAM_KIND_MJPEG, 50 },
+    { STREAM_KIND_MJPEG, 25 },
+#endif
+    { STREAM_KIND_PREVIEW, 0 },
+};
+
+#define STREAM_LEVEL_COUNT  (sizeof(s_stream_levels) / sizeof(s_stream_levels[0]))
+
+typedef struct {
+    int level;
+    uint32_t target_fps;
+    int64_t window_start;
+    uint32_t frames;
+    uint64_t bytes;
+    int64_t busy_us;                            /* Time spent sending in the window */
+    uint32_t frame_size[STREAM_LEVEL_COUNT];    /* Average frame size seen at each level, 0 if unknown */
+} stream_adapt_t;
+
+/* Target rate from /stream.auto?fps=N */
+static uint32_t stream_adapt_get_target_fps(const char *query)
 {
-    httpd_handle_t server = NULL;
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.stack_size = 8192;
-    config.max_uri_handlers = 8;
+    char value[8];
+    int fps = CONFIG_EXAMPLE_ADAPTIVE_TARGET_FPS;
 
-    ESP_RETURN_ON_ERROR(httpd_start(&server, &config), TAG, "Failed to start HTTP server");
+    if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK) {
+        fps = atoi(value);
+    }
 
-    /* Register handlers */
-    httpd_uri_t index_uri = { .uri = "/", .method = HTTP_GET, .handler = index_handler };
-    httpd_uri_t capture_uri = { .uri = "/capture", .method = HTTP_GET, .handler = capture_handler };
-    httpd_uri_t stream_uri = { .uri = "/stream", .method = HTTP_GET, .handler = stream_handler };
-    httpd_uri_t status_uri = { .uri = "/status", .method = HTTP_GET, .handler = status_handler };
-    httpd_uri_t api_uri = { .uri = "/api/capture_binary", .method = HTTP_GET, .handler = api_capture_handler };
+    return MIN(MAX(fps, 1), 60);
+}
 
-    httpd_register_uri_handler(server, &index_uri);
-    httpd_register_uri_handler(server, &capture_uri);
-    httpd_register_uri_handler(server, &stream_uri);
-    httpd_register_uri_handler(server, &status_uri);
-    httpd_register_uri_handler(server, &api_uri);
+static frame_subscriber_t *stream_adapt_subscribe(int level, const frame_subscriber_config_t *config)
+{
+    const stream_level_t *entry = &s_stream_levels[level];
+    frame_subscriber_t *sub = NULL;
+    uint32_t width;
+    uint32_t height;
 
-    ESP_LOGI(TAG, "HTTP server started on port %d", config.server_port);
-    return ESP_OK;
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    if (entry->kind == STREAM_KIND_MJPEG) {
+        return jpeg_pipeline_subscribe(entry->quality, config);
+    }
+#endif
+    stream_subscribe("", entry->kind, config, &sub, &width, &height);
+    return sub;
 }
 
-/* ========== Main ========== */
-void app_main(void)
+/* Subscribe to the nearest available level in the direction of step, NULL if there is none */
+static frame_subscriber_t *stream_adapt_switch(stream_adapt_t *adapt, int step, const frame_subscriber_config_t *config)
 {
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
-    ESP_LOGI(TAG, "║     IMX662 RGB888 HTTP Streaming Server            ║");
-    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
-    ESP_LOGI(TAG, "");
+    for (int level = adapt->level + step; level >= 0 && level < STREAM_LEVEL_COUNT; level += step) {
+        frame_subscriber_t *sub = stream_adapt_subscribe(level, config);
+        if (sub) {
+            adapt->level = level;
+            adapt->window_start = esp_timer_get_time();
+            adapt->frames = 0;
+            adapt->bytes = 0;
+            adapt->busy_us = 0;
+            return sub;
+        }
+    }
 
-    /* Initialize NVS */
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ESP_ERROR_CHECK(nvs_flash_init());
+    return NULL;
+}
+
+/*
+ * Account one sent frame. At the end of each window returns 1 to step down the
+ * ladder, -1 to step up or 0 to stay. The client is link bound when it misses
+ * the target while the sender is busy most of the time; it can step up when
+ * the rate measured while sending carries the next level with some headroom.
+ */
+static int stream_adapt_update(stream_adapt_t *adapt, uint32_t bytes, int64_t send_us, int64_t now)
+{
+    int64_t elapsed = now - adapt->window_start;
+
+    adapt->frames++;
+    adapt->bytes += bytes;
+    adapt->busy_us += send_us;
+    if (elapsed < STREAM_ADAPT_WINDOW_US) {
+        return 0;
     }
 
-    /* Initialize network (WiFi via protocol_examples_common) */
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    ESP_ERROR_CHECK(example_connect());
+    float fps = adapt->frames * 1000000.0f / elapsed;
+    float busy = (float)adapt->busy_us / elapsed;
+    float link_rate = adapt->busy_us ? adapt->bytes * 1000000.0f / adapt->busy_us : 0;
 
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "WiFi Connected! Starting camera...");
-    ESP_LOGI(TAG, "");
+    adapt->frame_size[adapt->level] = adapt->bytes / adapt->frames;
+    adapt->window_start = now;
+    adapt->frames = 0;
+    adapt->bytes = 0;
+    adapt->busy_us = 0;
 
-    /* Initialize Camera */
-    ESP_ERROR_CHECK(init_camera());
+    if (fps < adapt->target_fps * STREAM_ADAPT_MISS_RATIO && busy > STREAM_ADAPT_BUSY_RATIO) {
+        return adapt->level < STREAM_LEVEL_COUNT - 1 ? 1 : 0;
+    }
 
-    /* Start HTTP Server */
-    ESP_ERROR_CHECK(init_http_server());
+    if (adapt->level > 0) {
+        uint32_t next_size = adapt->frame_size[adapt->level - 1];
+
+        /* Never tried, assume twice the current size so the next window can tell */
+        if (!next_size) {
+            next_size = adapt->level == 1 ? s_camera.buffer_size : 2 * adapt->frame_size[adapt->level];
+        }
+        if (link_rate * STREAM_ADAPT_HEADROOM >= (float)next_size * adapt->target_fps) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+/* ========== Change Detection ========== */
+
+/*
+ * /stream?changes=1 and /stream.preview?changes=1 only send frames that differ
+ * from the last one sent, and one every CONFIG_EXAMPLE_CHANGE_DETECT_REFRESH_MS
+ * so clients can tell a static scene from a stalled stream. Returns NULL if
+ * the query does not ask for it or the stream carries no luma to compare.
+ */
+static change_detect_t *stream_change_detect_create(const char *query, stream_kind_t kind)
+{
+    char value[4];
+    uint32_t width = s_camera.sensor_width;
+    uint32_t height = s_camera.sensor_height;
+    uint32_t pixel_format = s_camera.pixel_format;
+    change_detect_t *cd = NULL;
+
+    if (httpd_query_key_value(query, "changes", value, sizeof(value)) != ESP_OK || strcmp(value, "1")) {
+        return NULL;
+    }
+
+    if (kind == STREAM_KIND_PREVIEW) {
+        preview_pipeline_get_size(s_camera.sensor_width, s_camera.sensor_height, &width, &height);
+        pixel_format = V4L2_PIX_FMT_RGB24;
+    } else if (kind != STREAM_KIND_RAW) {
+        ESP_LOGW(TAG, "Change detection needs uncompressed frames, sending every frame");
+        return NULL;
+    }
+
+    if (change_detect_create(width, height, pixel_format, &cd) != ESP_OK) {
+        ESP_LOGW(TAG, "Change detection not available, sending every frame");
+        return NULL;
+    }
+
+    return cd;
+}
+
+/*
+ * Append the change headers to a formatted part header, in place of its blank
+ * line. The mask is the hex of 32-bit words, block i is bit i % 32 of word
+ * i / 32, blocks run row by row over the X-Change-Grid columns.
+ */
+static int stream_change_headers(char *buf, int len, size_t size, const change_detect_result_t *result)
+{
+    uint32_t words = (result->cols * result->rows + 31) / 32;
+
+    len -= 2;
+    len += snprintf(buf + len, size - len, "X-Change-Grid: %"PRIu32"x%"PRIu32"\r\nX-Change-Blocks: %"PRIu32"\r\n",
+                    result->cols, result->rows, result->changed_blocks);
+    if ((size_t)len + 16 + words * 8 + 4 < size) {
+        len += snprintf(buf + len, size - len, "X-Change-Mask: ");
+        for (uint32_t i = 0; i < words; i++) {
+            len += snprintf(buf + len, size - len, "%08"PRIx32, result->mask[i]);
+        }
+        len += snprintf(buf + len, size - len, "\r\n");
+    }
+    len += snprintf(buf + len, size - len, "\r\n");
+
+    return len;
+}
+#endif
+
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+typedef struct {
+    httpd_req_t *req;
+    const frame_t *frame;
+    uint32_t sent;              /* Bytes of the part sent so far, 0 until the first strip is out */
+} stream_strip_t;
+
+/* Strip writer of /stream.mjpeg, the part header goes out with the first strip */
+static esp_err_t stream_strip_write(const uint8_t *data, size_t size, void *arg)
+{
+    stream_strip_t *strip = (stream_strip_t *)arg;
+
+    if (!strip->sent) {
+        char part_header[160];
+        int hlen = snprintf(part_header, sizeof(part_header), MJPEG_STRIP_PART, strip->frame->width,
+                            strip->frame->height, frame_clock_to_wall_us(strip->frame->timestamp_us));
+
+        ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(strip->req, part_header, hlen), TAG, "part header send failed");
+        strip->sent = hlen;
+    }
+
+    strip->sent += size;
+    return httpd_resp_send_chunk(strip->req, (const char *)data, size);
+}
+#endif
+
+/* Continuous stream worker - one task per client, fed by the frame broadcaster */
+static void stream_worker_task(void *arg)
+{
+    httpd_req_t *req = (httpd_req_t *)arg;
+    const frame_t *frame;
+    char part_header[160 + STREAM_CHANGE_HEADER_LEN];
+    char query[64];
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+    char width[12];
+    char height[12];
+    uint32_t stream_width;
+    uint32_t stream_height;
+    esp_err_t ret = ESP_OK;
+    uint32_t frame_count = 0;
+    frame_subscriber_config_t sub_config;
+
+    frame_subscriber_t *sub = NULL;
+    stream_kind_t kind = (stream_kind_t)(uintptr_t)req->user_ctx;
+    const char *part_fmt = stream_get_part_format(kind);
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+    uint8_t strip_quality = 0;
+#endif
+
+    stream_get_subscriber_config(req, &sub_config, name, sizeof(name));
+
+    stream_get_query(req, query, sizeof(query));
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+    stream_adapt_t adapt = {
+        .level = -1,
+        .target_fps = stream_adapt_get_target_fps(query),
+    };
+
+    /* Start at the top of the ladder, a link that cannot carry it steps down after one window */
+    if (kind == STREAM_KIND_ADAPTIVE) {
+        sub = stream_adapt_switch(&adapt, 1, &sub_config);
+        part_fmt = sub ? stream_get_part_format(s_stream_levels[adapt.level].kind) : part_fmt;
+        stream_width = s_camera.width;
+        stream_height = s_camera.height;
+    } else
+#endif
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+    /* Each client encodes its own JPEG frames from the camera frames */
+    if (kind == STREAM_KIND_MJPEG) {
+        strip_quality = stream_get_jpeg_quality(query);
+        sub = frame_broadcaster_subscribe(s_camera.frames, &sub_config);
+        stream_width = s_camera.width;
+        stream_height = s_camera.height;
+    } else
+#endif
+    if (stream_subscribe(query, kind, &sub_config, &sub, &stream_width, &stream_height) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid capture window");
+        goto exit;
+    }
+
+    if (!sub) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Camera busy");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Stream client connected (%"PRIu32" raw subscribers)", frame_broadcaster_subscriber_count(s_camera.frames));
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+    change_detect_t *cd = stream_change_detect_create(query, kind);
+    change_detect_result_t change = {0};
+    int64_t last_sent = 0;
+    uint32_t skipped = 0;
+#endif
+
+    /* Geometry at connection time, every part repeats the geometry of its own frame */
+    snprintf(width, sizeof(width), "%"PRIu32, stream_width);
+    snprintf(height, sizeof(height), "%"PRIu32, stream_height);
+    httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "X-Frame-Width", width);
+    httpd_resp_set_hdr(req, "X-Frame-Height", height);
+
+    while (true) {
+        if (frame_subscriber_wait(sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            ESP_LOGW(TAG, "Frame wait timeout");
+            continue;
+        }
+
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+        /* Frames the detector cannot compare are sent */
+        if (cd) {
+            if (change_detect_process(cd, frame, &change) != ESP_OK) {
+                change.changed = true;
+                change.cols = 0;
+                change.rows = 0;
+                change.changed_blocks = 0;
+            } else if (!change.changed && (!CONFIG_EXAMPLE_CHANGE_DETECT_REFRESH_MS ||
+                                           esp_timer_get_time() - last_sent < CONFIG_EXAMPLE_CHANGE_DETECT_REFRESH_MS * 1000LL)) {
+                frame_subscriber_release(sub, frame);
+                skipped++;
+                continue;
+            }
+        }
+#endif
+
+        /* Per-frame diagnostics go to the trace ring and /metrics */
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_START, frame->sequence);
+        int64_t send_start = stream_metrics_send_start(frame);
+        latency_probe_record_send(frame);
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+        int64_t send_time = esp_timer_get_time();
+#endif
+
+        uint32_t sent;
+#if CONFIG_EXAMPLE_JPEG_STRIP_ENCODE
+        if (strip_quality) {
+            stream_strip_t strip = {
+                .req = req,
+                .frame = frame,
+            };
+
+            ret = jpeg_pipeline_encode_strips(frame, strip_quality, stream_strip_write, &strip);
+            frame_subscriber_release(sub, frame);
+            sent = strip.sent;
+            /* Frames of another capture window are skipped, nothing was sent for them */
+            if (ret == ESP_ERR_INVALID_SIZE) {
+                continue;
+            }
+        } else
+#endif
+        {
+            /* Send part header */
+            int hlen = snprintf(part_header, sizeof(part_header), part_fmt, frame->size, frame->width, frame->height,
+                                frame_clock_to_wall_us(frame->timestamp_us));
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+            if (cd) {
+                hlen = stream_change_headers(part_header, hlen, sizeof(part_header), &change);
+            }
+#endif
+            sent = hlen + frame->size;
+            ret = httpd_resp_send_chunk(req, part_header, hlen);
+            if (ret == ESP_OK) {
+                /* Send frame data */
+                ret = httpd_resp_send_chunk(req, (char *)frame->data, frame->size);
+            }
+
+            frame_subscriber_release(sub, frame);
+        }
+
+        if (ret != ESP_OK) {
+            TRACE_RING_RECORD(TRACE_EVENT_SEND_ERROR, frame_count);
+            break;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_DONE, sent);
+        stream_metrics_send_done(send_start, sent);
+        frame_count++;
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+        if (cd) {
+            change_detect_update_reference(cd);
+            last_sent = esp_timer_get_time();
+        }
+#endif
+
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+        if (kind == STREAM_KIND_ADAPTIVE) {
+            int64_t now = esp_timer_get_time();
+            int step = stream_adapt_update(&adapt, sent, now - send_time, now);
+            int level = adapt.level;
+            frame_subscriber_t *next = step ? stream_adapt_switch(&adapt, step, &sub_config) : NULL;
+
+            /* Parts carry their own type and geometry, clients follow the switch */
+            if (next) {
+                frame_broadcaster_unsubscribe(sub);
+                sub = next;
+                part_fmt = stream_get_part_format(s_stream_levels[adapt.level].kind);
+                ESP_LOGI(TAG, "Adaptive stream %s: level %d -> %d", name, level, adapt.level);
+            }
+        }
+#endif
+    }
+
+    frame_broadcaster_unsubscribe(sub);
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+    if (cd) {
+        ESP_LOGI(TAG, "Change detection skipped %"PRIu32" static frames", skipped);
+        change_detect_delete(cd);
+    }
+#endif
+    ESP_LOGI(TAG, "Stream client disconnected after %"PRIu32" frames", frame_count);
+
+exit:
+    httpd_req_async_handler_complete(req);
+    s_stream_clients--;
+    vTaskDelete(NULL);
+}
+
+/* Continuous stream handler - hands the request over to a dedicated worker */
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    httpd_req_t *async_req;
+
+    if (!stream_client_reserve()) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        httpd_resp_sendstr(req, "Too many stream clients");
+        return ESP_OK;
+    }
+
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+        s_stream_clients--;
+        ESP_LOGE(TAG, "Failed to begin async request");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreatePinnedToCore(stream_worker_task, "stream", STREAM_TASK_STACK_SIZE, async_req,
+                                STREAM_TASK_PRIORITY, NULL, STREAM_TASK_CORE) != pdPASS) {
+        s_stream_clients--;
+        httpd_req_async_handler_complete(async_req);
+        ESP_LOGE(TAG, "Failed to create stream worker");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_HTTPD_WS_SUPPORT
+/* ========== WebSocket Transport ========== */
+
+/*
+ * /ws?stream=raw|preview|mjpeg|lossless sends every frame as one binary message:
+ * a ws_frame_header_t followed by the payload. The client grants frames with
+ * credit messages, a 4-byte little-endian count or the count as text, and the
+ * server only waits for a new frame while it holds a credit.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /* WS_FRAME_MAGIC */
+    uint16_t header_size;       /* sizeof(ws_frame_header_t), the payload follows */
+    uint16_t version;           /* WS_FRAME_VERSION */
+    uint32_t sequence;          /* Capture sequence number */
+    int64_t timestamp_us;       /* Capture time, esp_timer clock */
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;            /* Payload pixel format */
+    uint32_t exposure;          /* Sensor exposure in lines, 0 if unknown */
+    uint32_t gain;              /* Sensor analog gain code, 0 if unknown */
+    uint32_t payload_size;
+    int64_t wall_time_us;       /* Capture time since the UNIX epoch, 0 until the clock is set */
+} ws_frame_header_t;
+
+typedef struct {
+    httpd_handle_t hd;
+    int fd;
+    stream_kind_t kind;
+    frame_subscriber_t *sub;
+    SemaphoreHandle_t credits;  /* One count per frame the client may still receive */
+    _Atomic bool closed;        /* Set when httpd closes the session */
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+} ws_client_t;
+
+/* Initial credits from /ws?credits=N */
+static uint32_t ws_get_initial_credits(const char *query)
+{
+    char value[8];
+    uint32_t credits = WS_DEFAULT_CREDITS;
+
+    if (httpd_query_key_value(query, "credits", value, sizeof(value)) == ESP_OK) {
+        credits = strtoul(value, NULL, 10);
+    }
+
+    return MIN(credits, WS_MAX_CREDITS);
+}
+
+static void ws_grant_credits(ws_client_t *client, uint32_t count)
+{
+    /* Credits beyond WS_MAX_CREDITS are dropped, the semaphore saturates */
+    for (uint32_t i = 0; i < count && xSemaphoreGive(client->credits) == pdTRUE; i++) {
+    }
+}
+
+/* Called by httpd when the session is closed, the worker frees the client */
+static void ws_client_close(void *ctx)
+{
+    ws_client_t *client = (ws_client_t *)ctx;
+
+    client->closed = true;
+    xSemaphoreGive(client->credits);
+}
+
+/* Send one frame as a single binary message, fragmented into header and payload */
+static esp_err_t ws_send_frame(ws_client_t *client, const frame_t *frame)
+{
+    uint32_t exposure;
+    uint32_t gain;
+
+    camera_get_exposure(&exposure, &gain);
+
+    ws_frame_header_t header = {
+        .magic = WS_FRAME_MAGIC,
+        .header_size = sizeof(ws_frame_header_t),
+        .version = WS_FRAME_VERSION,
+        .sequence = frame->sequence,
+        .timestamp_us = frame->timestamp_us,
+        .width = frame->width,
+        .height = frame->height,
+        .fourcc = stream_get_fourcc(client->kind),
+        .exposure = exposure,
+        .gain = gain,
+        .payload_size = frame->size,
+        .wall_time_us = frame_clock_to_wall_us(frame->timestamp_us),
+    };
+    httpd_ws_frame_t ws_frame = {
+        .final = false,
+        .fragmented = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t *)&header,
+        .len = sizeof(header),
+    };
+
+    ESP_RETURN_ON_ERROR(httpd_ws_send_frame_async(client->hd, client->fd, &ws_frame), TAG, "header send failed");
+
+    ws_frame.final = true;
+    ws_frame.type = HTTPD_WS_TYPE_CONTINUE;
+    ws_frame.payload = frame->data;
+    ws_frame.len = frame->size;
+    return httpd_ws_send_frame_async(client->hd, client->fd, &ws_frame);
+}
+
+static void ws_worker_task(void *arg)
+{
+    ws_client_t *client = (ws_client_t *)arg;
+    const frame_t *frame;
+    uint32_t frame_count = 0;
+
+    while (!client->closed) {
+        /* No credit, no frame: the client sets the pace */
+        if (xSemaphoreTake(client->credits, portMAX_DELAY) != pdTRUE || client->closed) {
+            continue;
+        }
+
+        /* Frames published while the client had no credit were dropped, only the newest one is queued */
+        if (frame_subscriber_wait(client->sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            xSemaphoreGive(client->credits);
+            continue;
+        }
+
+        uint32_t size = frame->size;
+
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_START, frame->sequence);
+        int64_t send_start = stream_metrics_send_start(frame);
+        latency_probe_record_send(frame);
+        esp_err_t ret = ws_send_frame(client, frame);
+        frame_subscriber_release(client->sub, frame);
+        if (ret != ESP_OK) {
+            TRACE_RING_RECORD(TRACE_EVENT_SEND_ERROR, frame_count);
+            httpd_sess_trigger_close(client->hd, client->fd);
+            break;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_DONE, size);
+        stream_metrics_send_done(send_start, sizeof(ws_frame_header_t) + size);
+        frame_count++;
+    }
+
+    /* Wait for httpd to drop the session context before freeing it */
+    while (!client->closed) {
+        xSemaphoreTake(client->credits, portMAX_DELAY);
+    }
+
+    frame_broadcaster_unsubscribe(client->sub);
+    ESP_LOGI(TAG, "WebSocket client %s disconnected after %"PRIu32" frames", client->name, frame_count);
+    vSemaphoreDelete(client->credits);
+    free(client);
+    s_stream_clients--;
+    vTaskDelete(NULL);
+}
+
+/* Handshake: subscribe and start the worker */
+static esp_err_t ws_open(httpd_req_t *req)
+{
+    esp_err_t ret = ESP_OK;
+    char query[64];
+    uint32_t width;
+    uint32_t height;
+    ws_client_t *client;
+    frame_subscriber_config_t sub_config;
+
+    if (!stream_client_reserve()) {
+        ESP_LOGW(TAG, "Too many stream clients, closing WebSocket");
+        return ESP_FAIL;
+    }
+
+    client = calloc(1, sizeof(ws_client_t));
+    if (!client) {
+        s_stream_clients--;
+        ESP_LOGE(TAG, "no memory for WebSocket client");
+        return ESP_ERR_NO_MEM;
+    }
+
+    client->hd = req->handle;
+    client->fd = httpd_req_to_sockfd(req);
+    stream_get_query(req, query, sizeof(query));
+    client->kind = stream_get_kind(query);
+    client->credits = xSemaphoreCreateCounting(WS_MAX_CREDITS, 0);
+    ESP_GOTO_ON_FALSE(client->credits, ESP_ERR_NO_MEM, fail, TAG, "no memory for credits");
+
+    /* Credits replace the delivery policy, a client without credit must never stall the capture */
+    stream_get_subscriber_config(req, &sub_config, client->name, sizeof(client->name));
+    sub_config.policy = FRAME_DELIVERY_LATEST_ONLY;
+    ESP_GOTO_ON_ERROR(stream_subscribe(query, client->kind, &sub_config, &client->sub, &width, &height),
+                      fail, TAG, "invalid capture window");
+    ESP_GOTO_ON_FALSE(client->sub, ESP_ERR_NOT_FOUND, fail, TAG, "stream not available");
+
+    ws_grant_credits(client, ws_get_initial_credits(query));
+
+    if (xTaskCreatePinnedToCore(ws_worker_task, "ws_stream", STREAM_TASK_STACK_SIZE, client,
+                                STREAM_TASK_PRIORITY, NULL, STREAM_TASK_CORE) != pdPASS) {
+        frame_broadcaster_unsubscribe(client->sub);
+        ESP_GOTO_ON_FALSE(false, ESP_ERR_NO_MEM, fail, TAG, "failed to create WebSocket worker");
+    }
+
+    /* From now on the worker owns the client, httpd only signals the close */
+    req->sess_ctx = client;
+    req->free_ctx = ws_client_close;
+
+    ESP_LOGI(TAG, "WebSocket client %s connected, %"PRIu32"x%"PRIu32" fourcc=0x%08"PRIx32,
+             client->name, width, height, stream_get_fourcc(client->kind));
+    return ESP_OK;
+
+fail:
+    if (client->credits) {
+        vSemaphoreDelete(client->credits);
+    }
+    free(client);
+    s_stream_clients--;
+    return ret;
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    uint8_t buf[WS_CONTROL_MAX_LEN + 1];
+    httpd_ws_frame_t ws_frame;
+    ws_client_t *client = (ws_client_t *)req->sess_ctx;
+    uint32_t count;
+
+    if (req->method == HTTP_GET) {
+        return ws_open(req);
+    }
+
+    /* Read the length first, credit messages are tiny */
+    memset(&ws_frame, 0, sizeof(ws_frame));
+    ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(req, &ws_frame, 0), TAG, "failed to get WebSocket frame length");
+    ESP_RETURN_ON_FALSE(ws_frame.len <= WS_CONTROL_MAX_LEN, ESP_ERR_INVALID_SIZE, TAG,
+                        "WebSocket message too long (%zu bytes)", ws_frame.len);
+
+    ws_frame.payload = buf;
+    ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(req, &ws_frame, WS_CONTROL_MAX_LEN), TAG, "failed to receive WebSocket frame");
+    if (!client) {
+        return ESP_OK;
+    }
+
+    if (ws_frame.type == HTTPD_WS_TYPE_BINARY && ws_frame.len == sizeof(uint32_t)) {
+        memcpy(&count, buf, sizeof(count));
+    } else if (ws_frame.type == HTTPD_WS_TYPE_TEXT) {
+        buf[ws_frame.len] = '\0';
+        count = strtoul((char *)buf, NULL, 10);
+    } else {
+        ESP_LOGW(TAG, "Unknown WebSocket message type %d (%zu bytes)", ws_frame.type, ws_frame.len);
+        return ESP_OK;
+    }
+
+    ws_grant_credits(client, count);
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_EXAMPLE_UDP_STREAM
+/* ========== UDP Transport ========== */
+
+/*
+ * A client subscribes by sending a query string datagram such as
+ * "stream=raw&fec=8" to CONFIG_EXAMPLE_UDP_STREAM_PORT and repeats it at least
+ * every UDP_CLIENT_TIMEOUT_MS to stay subscribed, "bye" unsubscribes at once.
+ * Frames are sent back to the sender address, split into datagrams that each
+ * start with a udp_fragment_header_t. With fec=K every group of K fragments is
+ * followed by the XOR of their payloads, which restores one lost fragment of
+ * the group. The client drops a frame that cannot be completed.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             /* UDP_FRAGMENT_MAGIC */
+    uint32_t frame_id;          /* Capture sequence number */
+    uint16_t index;             /* Fragment index, or group index of a parity fragment */
+    uint16_t count;             /* Number of data fragments of the frame */
+    uint32_t frame_size;        /* Payload size of the whole frame */
+    uint16_t payload_size;      /* Payload bytes in this datagram */
+    uint8_t flags;              /* UDP_FRAGMENT_FLAG_* */
+    uint8_t fec_group;          /* Data fragments per parity fragment, 0 without FEC */
+    int64_t timestamp_us;       /* Capture time, esp_timer clock */
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;            /* Payload pixel format */
+} udp_fragment_header_t;
+
+#define UDP_FRAGMENT_FLAG_PARITY    (1 << 0)
+#define UDP_FRAGMENT_PAYLOAD_SIZE   (UDP_DATAGRAM_SIZE - sizeof(udp_fragment_header_t))
+
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+/*
+ * Zero-copy payloads: a datagram is a copied header pbuf chained to a custom
+ * PBUF_REF pbuf pointing into the frame buffer. A frame stays leased until
+ * lwIP and the network driver freed the last of its payload pbufs, the free
+ * callback hands each pbuf back to the sender and the sender releases the
+ * frame. Parity payloads are built per group and still go out copied.
+ */
+typedef struct {
+    const frame_t *frame;       /* NULL when the slot is free */
+    _Atomic uint32_t refs;      /* Payload pbufs in lwIP, plus one while the frame is being queued */
+} udp_zc_lease_t;
+
+typedef struct {
+    struct pbuf_custom pc;      /* First member, lwIP passes it to the free callback as a pbuf */
+    QueueHandle_t free_pbufs;   /* Free list of the owning client */
+    udp_zc_lease_t *lease;
+} udp_zc_pbuf_t;
+
+typedef struct {
+    struct tcpip_api_call_data call;    /* First member, see tcpip_api_call() */
+    struct udp_pcb *pcb;
+    ip_addr_t addr;
+    u16_t port;
+    uint32_t count;                     /* Datagrams queued */
+    uint32_t sent;                      /* Datagrams lwIP accepted */
+    struct pbuf *p[UDP_ZC_BATCH];
+} udp_zc_batch_t;
+#endif
+
+typedef struct {
+    _Atomic bool active;        /* Slot in use, cleared by the sender task when it exits */
+    _Atomic bool closed;        /* Set by the server task on "bye" or timeout */
+    struct sockaddr_in addr;
+    stream_kind_t kind;
+    uint8_t fec_group;
+    int64_t last_seen_us;
+    frame_subscriber_t *sub;
+    uint8_t parity[UDP_FRAGMENT_PAYLOAD_SIZE];
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+    QueueHandle_t free_pbufs;   /* udp_zc_pbuf_t not referenced by lwIP */
+    udp_zc_batch_t batch;
+    udp_zc_lease_t leases[UDP_ZC_LEASES];
+    udp_zc_pbuf_t pbufs[UDP_ZC_PBUFS];
+#endif
+} udp_client_t;
+
+typedef struct {
+    int sock;
+    udp_client_t clients[UDP_MAX_CLIENTS];
+    uint32_t frames;            /* Frames sent to any client */
+    uint32_t datagrams;
+    uint32_t send_errors;       /* Datagrams dropped because lwIP ran out of buffers */
+} udp_streamer_t;
+
+static udp_streamer_t s_udp = {.sock = -1};
+
+/* Send one datagram, waits briefly for lwIP buffers since a frame is sent back to back */
+static void udp_send_datagram(udp_client_t *client, udp_fragment_header_t *header, const uint8_t *payload)
+{
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = sizeof(*header) },
+        { .iov_base = (void *)payload, .iov_len = header->payload_size },
+    };
+    struct msghdr msg = {
+        .msg_name = &client->addr,
+        .msg_namelen = sizeof(client->addr),
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+    };
+
+    for (int retry = 0; retry < UDP_SEND_RETRIES; retry++) {
+        if (sendmsg(s_udp.sock, &msg, 0) >= 0) {
+            s_udp.datagrams++;
+            return;
+        }
+        if (errno != ENOMEM && errno != EAGAIN) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+
+    s_udp.send_errors++;
+}
+
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+/* Called by whoever drops the last reference, the tcpip thread or a network driver */
+static void udp_zc_pbuf_free(struct pbuf *p)
+{
+    udp_zc_pbuf_t *zp = (udp_zc_pbuf_t *)p;
+    BaseType_t woken = pdFALSE;
+
+    atomic_fetch_sub(&zp->lease->refs, 1);
+    if (xPortInIsrContext()) {
+        xQueueSendFromISR(zp->free_pbufs, &zp, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xQueueSend(zp->free_pbufs, &zp, 0);
+    }
+}
+
+static esp_err_t udp_zc_init(udp_client_t *client)
+{
+    struct lwip_sock *lsock = lwip_socket_dbg_get_socket(s_udp.sock);
+
+    ESP_RETURN_ON_FALSE(lsock && lsock->conn, ESP_FAIL, TAG, "socket %d has no netconn", s_udp.sock);
+    client->free_pbufs = xQueueCreate(UDP_ZC_PBUFS, sizeof(udp_zc_pbuf_t *));
+    ESP_RETURN_ON_FALSE(client->free_pbufs, ESP_ERR_NO_MEM, TAG, "no memory for pbuf list");
+
+    for (uint32_t i = 0; i < UDP_ZC_PBUFS; i++) {
+        udp_zc_pbuf_t *zp = &client->pbufs[i];
+
+        zp->pc.custom_free_function = udp_zc_pbuf_free;
+        zp->free_pbufs = client->free_pbufs;
+        xQueueSend(client->free_pbufs, &zp, 0);
+    }
+
+    /* Same pcb as the socket, clients see every datagram come from the subscription port */
+    client->batch.pcb = lsock->conn->pcb.udp;
+    ip_addr_set_ip4_u32(&client->batch.addr, client->addr.sin_addr.s_addr);
+    client->batch.port = ntohs(client->addr.sin_port);
+    return ESP_OK;
+}
+
+/* Release the frames lwIP is done with, returns a free lease slot or NULL */
+static udp_zc_lease_t *udp_zc_reap(udp_client_t *client)
+{
+    udp_zc_lease_t *free_lease = NULL;
+
+    for (uint32_t i = 0; i < UDP_ZC_LEASES; i++) {
+        udp_zc_lease_t *lease = &client->leases[i];
+
+        if (lease->frame && !lease->refs) {
+            frame_subscriber_release(client->sub, lease->frame);
+            lease->frame = NULL;
+        }
+        if (!lease->frame) {
+            free_lease = lease;
+        }
+    }
+
+    return free_lease;
+}
+
+static udp_zc_lease_t *udp_zc_lease(udp_client_t *client, const frame_t *frame)
+{
+    udp_zc_lease_t *lease;
+
+    while (!(lease = udp_zc_reap(client))) {
+        vTaskDelay(1);
+    }
+    lease->frame = frame;
+    lease->refs = 1;
+    return lease;
+}
+
+/* Runs in the tcpip thread, resumes after the datagrams a previous call already sent */
+static err_t udp_zc_send_batch(struct tcpip_api_call_data *call)
+{
+    udp_zc_batch_t *batch = (udp_zc_batch_t *)call;
+
+    while (batch->sent < batch->count) {
+        err_t err = udp_sendto(batch->pcb, batch->p[batch->sent], &batch->addr, batch->port);
+        if (err != ERR_OK) {
+            return err;
+        }
+        batch->sent++;
+    }
+
+    return ERR_OK;
+}
+
+/* Hand the queued datagrams to lwIP, waits briefly for buffers like udp_send_datagram() */
+static void udp_zc_flush(udp_client_t *client)
+{
+    udp_zc_batch_t *batch = &client->batch;
+
+    for (int retry = 0; batch->sent < batch->count && retry < UDP_SEND_RETRIES; retry++) {
+        if (retry) {
+            vTaskDelay(1);
+        }
+        if (tcpip_api_call(udp_zc_send_batch, &batch->call) != ERR_MEM) {
+            break;
+        }
+    }
+
+    s_udp.datagrams += batch->sent;
+    s_udp.send_errors += batch->count - batch->sent;
+
+    /* Drops the header, the payload lives on in the driver until it was sent */
+    for (uint32_t i = 0; i < batch->count; i++) {
+        pbuf_free(batch->p[i]);
+    }
+    batch->count = 0;
+    batch->sent = 0;
+}
+
+static void udp_zc_queue_datagram(udp_client_t *client, udp_zc_lease_t *lease, const udp_fragment_header_t *header,
+                                  const uint8_t *payload)
+{
+    udp_zc_pbuf_t *zp;
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(*header), PBUF_RAM);
+
+    if (!p || xQueueReceive(client->free_pbufs, &zp, pdMS_TO_TICKS(UDP_ZC_PBUF_WAIT_MS)) != pdTRUE) {
+        if (p) {
+            pbuf_free(p);
+        }
+        s_udp.send_errors++;
+        return;
+    }
+
+    memcpy(p->payload, header, sizeof(*header));
+    zp->lease = lease;
+    lease->refs++;
+    pbuf_cat(p, pbuf_alloced_custom(PBUF_RAW, header->payload_size, PBUF_REF, &zp->pc, (void *)payload,
+                                    header->payload_size));
+
+    client->batch.p[client->batch.count++] = p;
+    if (client->batch.count == UDP_ZC_BATCH) {
+        udp_zc_flush(client);
+    }
+}
+
+/* Wait for lwIP to free every payload pbuf, then release the frames still leased */
+static void udp_zc_deinit(udp_client_t *client)
+{
+    while (uxQueueMessagesWaiting(client->free_pbufs) < UDP_ZC_PBUFS) {
+        vTaskDelay(1);
+    }
+    udp_zc_reap(client);
+    vQueueDelete(client->free_pbufs);
+}
+#endif
+
+static void udp_xor(uint8_t *dst, const uint8_t *src, uint32_t size)
+{
+    uint32_t i = 0;
+
+    /* Fragments start at multiples of the payload size, only the frame base may be unaligned */
+    if (!((uintptr_t)src & 3)) {
+        for (; i + 4 <= size; i += 4) {
+            *(uint32_t *)(dst + i) ^= *(const uint32_t *)(src + i);
+        }
+    }
+    for (; i < size; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+static void udp_send_frame(udp_client_t *client, const frame_t *frame)
+{
+    uint32_t count = (frame->size + UDP_FRAGMENT_PAYLOAD_SIZE - 1) / UDP_FRAGMENT_PAYLOAD_SIZE;
+    uint32_t group_size = 0;
+    udp_fragment_header_t header = {
+        .magic = UDP_FRAGMENT_MAGIC,
+        .frame_id = frame->sequence,
+        .count = count,
+        .frame_size = frame->size,
+        .fec_group = client->fec_group,
+        .timestamp_us = frame->timestamp_us,
+        .width = frame->width,
+        .height = frame->height,
+        .fourcc = stream_get_fourcc(client->kind),
+    };
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+    udp_zc_lease_t *lease = udp_zc_lease(client, frame);
+#endif
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t offset = i * UDP_FRAGMENT_PAYLOAD_SIZE;
+        uint32_t size = MIN(UDP_FRAGMENT_PAYLOAD_SIZE, frame->size - offset);
+
+        header.index = i;
+        header.flags = 0;
+        header.payload_size = size;
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+        udp_zc_queue_datagram(client, lease, &header, frame->data + offset);
+#else
+        udp_send_datagram(client, &header, frame->data + offset);
+#endif
+
+        if (!client->fec_group) {
+            continue;
+        }
+
+        /* The short last fragment is zero padded in the parity */
+        if (!group_size) {
+            memset(client->parity, 0, sizeof(client->parity));
+        }
+        udp_xor(client->parity, frame->data + offset, size);
+        if (++group_size == client->fec_group || i == count - 1) {
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+            /* The parity follows its group on the wire */
+            udp_zc_flush(client);
+#endif
+            header.index = i / client->fec_group;
+            header.flags = UDP_FRAGMENT_FLAG_PARITY;
+            header.payload_size = UDP_FRAGMENT_PAYLOAD_SIZE;
+            udp_send_datagram(client, &header, client->parity);
+            group_size = 0;
+        }
+    }
+
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+    /* Drop the sender's reference, the frame is released once the driver is done with it */
+    udp_zc_flush(client);
+    atomic_fetch_sub(&lease->refs, 1);
+    udp_zc_reap(client);
+#endif
+    s_udp.frames++;
+}
+
+static void udp_sender_task(void *arg)
+{
+    udp_client_t *client = (udp_client_t *)arg;
+    const frame_t *frame;
+
+    while (!client->closed) {
+        if (frame_subscriber_wait(client->sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+            udp_zc_reap(client);
+#endif
+            continue;
+        }
+
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_START, frame->sequence);
+        int64_t send_start = stream_metrics_send_start(frame);
+        latency_probe_record_send(frame);
+        udp_send_frame(client, frame);
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_DONE, frame->size);
+        stream_metrics_send_done(send_start, frame->size);
+#if !CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+        frame_subscriber_release(client->sub, frame);
+#endif
+    }
+
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+    udp_zc_deinit(client);
+#endif
+    frame_broadcaster_unsubscribe(client->sub);
+    ESP_LOGI(TAG, "UDP client %s unsubscribed", client->name);
+    s_stream_clients--;
+    client->active = false;
+    vTaskDelete(NULL);
+}
+
+static udp_client_t *udp_find_client(const struct sockaddr_in *addr)
+{
+    for (uint32_t i = 0; i < UDP_MAX_CLIENTS; i++) {
+        udp_client_t *client = &s_udp.clients[i];
+
+        if (client->active && !client->closed && client->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+                client->addr.sin_port == addr->sin_port) {
+            return client;
+        }
+    }
+
+    return NULL;
+}
+
+/* Handle a subscribe, keepalive or bye datagram */
+static void udp_handle_request(const struct sockaddr_in *addr, const char *query)
+{
+    char value[8];
+    uint32_t width;
+    uint32_t height;
+    udp_client_t *client = udp_find_client(addr);
+    frame_subscriber_config_t sub_config;
+
+    if (!strcmp(query, "bye")) {
+        if (client) {
+            client->closed = true;
+        }
+        return;
+    }
+
+    if (client) {
+        client->last_seen_us = esp_timer_get_time();
+        return;
+    }
+
+    for (uint32_t i = 0; i < UDP_MAX_CLIENTS && !client; i++) {
+        if (!s_udp.clients[i].active) {
+            client = &s_udp.clients[i];
+        }
+    }
+    if (!client || !stream_client_reserve()) {
+        ESP_LOGW(TAG, "Too many stream clients, ignoring UDP subscription");
+        return;
+    }
+
+    memset(client, 0, sizeof(udp_client_t));
+    client->addr = *addr;
+    client->kind = stream_get_kind(query);
+    if (httpd_query_key_value(query, "fec", value, sizeof(value)) == ESP_OK) {
+        client->fec_group = MIN(strtoul(value, NULL, 10), UDP_MAX_FEC_GROUP);
+    }
+    inet_ntop(AF_INET, &addr->sin_addr, client->name, sizeof(client->name));
+    snprintf(client->name + strlen(client->name), sizeof(client->name) - strlen(client->name),
+             ":%u", ntohs(addr->sin_port));
+
+    /* Late frames are worthless here, always deliver the newest one */
+    stream_parse_delivery(query, &sub_config);
+    sub_config.policy = FRAME_DELIVERY_LATEST_ONLY;
+    sub_config.name = client->name;
+    if (stream_subscribe(query, client->kind, &sub_config, &client->sub, &width, &height) != ESP_OK || !client->sub) {
+        ESP_LOGW(TAG, "UDP client %s: stream not available", client->name);
+        s_stream_clients--;
+        return;
+    }
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+    if (udp_zc_init(client) != ESP_OK) {
+        frame_broadcaster_unsubscribe(client->sub);
+        s_stream_clients--;
+        return;
+    }
+#endif
+
+    client->last_seen_us = esp_timer_get_time();
+    client->active = true;
+    if (xTaskCreatePinnedToCore(udp_sender_task, "udp_stream", STREAM_TASK_STACK_SIZE, client,
+                                STREAM_TASK_PRIORITY, NULL, STREAM_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create UDP sender");
+#if CONFIG_EXAMPLE_UDP_STREAM_ZERO_COPY
+        vQueueDelete(client->free_pbufs);
+#endif
+        frame_broadcaster_unsubscribe(client->sub);
+        s_stream_clients--;
+        client->active = false;
+        return;
+    }
+
+    ESP_LOGI(TAG, "UDP client %s subscribed, %"PRIu32"x%"PRIu32" fec=%u", client->name, width, height, client->fec_group);
+}
+
+static void udp_server_task(void *arg)
+{
+    char query[64];
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+
+    while (true) {
+        addr_len = sizeof(addr);
+        int len = recvfrom(s_udp.sock, query, sizeof(query) - 1, 0, (struct sockaddr *)&addr, &addr_len);
+        if (len >= 0 && addr.sin_family == AF_INET) {
+            query[len] = '\0';
+            udp_handle_request(&addr, query);
+        }
+
+        /* Clients that stopped sending keepalives are gone */
+        int64_t now = esp_timer_get_time();
+        for (uint32_t i = 0; i < UDP_MAX_CLIENTS; i++) {
+            udp_client_t *client = &s_udp.clients[i];
+
+            if (client->active && !client->closed && now - client->last_seen_us > UDP_CLIENT_TIMEOUT_MS * 1000) {
+                ESP_LOGI(TAG, "UDP client %s timed out", client->name);
+                client->closed = true;
+            }
+        }
+    }
+}
+
+static esp_err_t init_udp_server(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_EXAMPLE_UDP_STREAM_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct timeval timeout = {
+        .tv_sec = 1,
+    };
+
+    s_udp.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ESP_RETURN_ON_FALSE(s_udp.sock >= 0, ESP_FAIL, TAG, "Failed to create UDP socket");
+
+    /* The receive timeout lets the server task check keepalives */
+    setsockopt(s_udp.sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(s_udp.sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            xTaskCreatePinnedToCore(udp_server_task, "udp_server", 4096, NULL, STREAM_TASK_PRIORITY, NULL,
+                                    STREAM_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start UDP server (errno=%d)", errno);
+        close(s_udp.sock);
+        s_udp.sock = -1;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "UDP stream server started on port %d", CONFIG_EXAMPLE_UDP_STREAM_PORT);
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_EXAMPLE_TCP_STREAM
+/* ========== Raw TCP Stream Sink ========== */
+
+/*
+ * Serves the multipart streams of the HTTP server on its own port without
+ * esp_http_server in the data path: no chunked encoding, and every part header
+ * and frame payload go to lwIP in a single sendmsg() straight from the buffer.
+ */
+typedef struct {
+    int sock;
+    stream_kind_t kind;
+    frame_subscriber_t *sub;
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+} tcp_client_t;
+
+/* Send all of an iovec array, lwIP may return after a part of it */
+static esp_err_t tcp_sendv(int sock, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = iovcnt,
+    };
+
+    while (msg.msg_iovlen) {
+        ssize_t sent = sendmsg(sock, &msg, 0);
+        if (sent < 0) {
+            return ESP_FAIL;
+        }
+
+        while (msg.msg_iovlen && sent >= (ssize_t)msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen) {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+/*
+ * Zero-copy payloads: lwIP segments reference the frame buffer instead of
+ * copying it into pbufs, so a frame stays leased until the peer acknowledged
+ * its last byte. The worker releases a frame once the next one is queued, by
+ * then its bytes are normally acknowledged and sending never stalls on the
+ * delayed ACK of a frame tail.
+ */
+typedef struct {
+    struct tcpip_api_call_data call;    /* First member, see tcpip_api_call() */
+    struct netconn *conn;
+    u32_t snd_lbb;                      /* Sequence number after the last queued byte */
+    u32_t lastack;                      /* Highest sequence number the peer acknowledged */
+} tcp_zc_t;
+
+/* Runs in the tcpip thread, where the pcb is not freed while it is read */
+static err_t tcp_zc_read_seq(struct tcpip_api_call_data *call)
+{
+    tcp_zc_t *zc = (tcp_zc_t *)call;
+    struct tcp_pcb *pcb = zc->conn->pcb.tcp;
+
+    if (!pcb) {
+        return ERR_CLSD;
+    }
+    zc->snd_lbb = pcb->snd_lbb;
+    zc->lastack = pcb->lastack;
+    return ERR_OK;
+}
+
+static esp_err_t tcp_zc_init(tcp_zc_t *zc, int sock)
+{
+    struct lwip_sock *lsock = lwip_socket_dbg_get_socket(sock);
+
+    ESP_RETURN_ON_FALSE(lsock && lsock->conn, ESP_FAIL, TAG, "socket %d has no netconn", sock);
+    memset(zc, 0, sizeof(*zc));
+    zc->conn = lsock->conn;
+    return ESP_OK;
+}
+
+/* Queue a part header, copied, and its payload, referenced, returns the sequence number after the payload */
+static esp_err_t tcp_zc_send(tcp_zc_t *zc, const void *header, size_t header_len, const void *data, size_t size,
+                             u32_t *end)
+{
+    size_t written;
+
+    if (header_len && netconn_write_partly(zc->conn, header, header_len, NETCONN_COPY | NETCONN_MORE,
+                                           &written) != ERR_OK) {
+        return ESP_FAIL;
+    }
+    while (size) {
+        if (netconn_write_partly(zc->conn, data, size, NETCONN_NOCOPY, &written) != ERR_OK) {
+            return ESP_FAIL;
+        }
+        data = (const uint8_t *)data + written;
+        size -= written;
+    }
+    ESP_RETURN_ON_FALSE(tcpip_api_call(tcp_zc_read_seq, &zc->call) == ERR_OK, ESP_FAIL, TAG, "connection closed");
+    *end = zc->snd_lbb;
+    return ESP_OK;
+}
+
+/* Wait until the peer acknowledged everything before end, the buffers queued before can be reused then */
+static esp_err_t tcp_zc_wait_acked(tcp_zc_t *zc, u32_t end)
+{
+    int64_t deadline = esp_timer_get_time() + TCP_SEND_TIMEOUT_S * 1000000LL;
+
+    while (true) {
+        if (tcpip_api_call(tcp_zc_read_seq, &zc->call) != ERR_OK) {
+            return ESP_FAIL;
+        }
+        if (TCP_SEQ_GEQ(zc->lastack, end)) {
+            return ESP_OK;
+        }
+        if (esp_timer_get_time() > deadline) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+}
+
+/* Close with a reset, lwIP drops the queued segments still referencing a buffer right away */
+static void tcp_zc_abort(int sock)
+{
+    struct linger linger = {
+        .l_onoff = 1,
+        .l_linger = 0,
+    };
+
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(sock);
+}
+#endif
+
+static esp_err_t tcp_send_str(int sock, const char *str)
+{
+    struct iovec iov = {
+        .iov_base = (void *)str,
+        .iov_len = strlen(str),
+    };
+
+    return tcp_sendv(sock, &iov, 1);
+}
+
+/* Read the request head, returns the path with its query string */
+static esp_err_t tcp_read_request(int sock, char *path, size_t path_len)
+{
+    char request[TCP_REQUEST_MAX_LEN];
+    size_t len = 0;
+
+    /* The body is never used, stop at the end of the header block */
+    while (len < sizeof(request) - 1) {
+        int ret = recv(sock, request + len, sizeof(request) - 1 - len, 0);
+        if (ret <= 0) {
+            return ESP_FAIL;
+        }
+        len += ret;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+
+    char *start = strchr(request, ' ');
+    char *end = start ? strchr(start + 1, ' ') : NULL;
+    ESP_RETURN_ON_FALSE(!strncmp(request, "GET ", 4) && end, ESP_ERR_INVALID_ARG, TAG, "malformed request");
+
+    *end = '\0';
+    strlcpy(path, start + 1, path_len);
+    return ESP_OK;
+}
+
+/* Map /stream, /stream.preview, ... to a stream kind */
+static esp_err_t tcp_get_stream_kind(const char *path, stream_kind_t *kind)
+{
+    size_t len = strcspn(path, "?");
+
+    if (len == strlen("/stream") && !strncmp(path, "/stream", len)) {
+        *kind = STREAM_KIND_RAW;
+    } else if (len == strlen("/stream.preview") && !strncmp(path, "/stream.preview", len)) {
+        *kind = STREAM_KIND_PREVIEW;
+    } else if (len == strlen("/stream.mjpeg") && !strncmp(path, "/stream.mjpeg", len)) {
+        *kind = STREAM_KIND_MJPEG;
+    } else if (len == strlen("/stream.lossless") && !strncmp(path, "/stream.lossless", len)) {
+        *kind = STREAM_KIND_LOSSLESS;
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_EXAMPLE_TCP_BENCH
+/*
+ * GET /bench?mb=N sends N MiB from one PSRAM buffer the way frame payloads
+ * are sent, zero-copy unless copy=1, and logs the rate. The client can
+ * measure it as well, e.g. curl -o /dev/null http://<ip>:8081/bench?mb=256
+ */
+static void tcp_run_bench(int sock, const char *query)
+{
+    char value[8];
+    char header[128];
+    uint32_t mb = 64;
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    bool copy = false;
+#else
+    bool copy = true;
+#endif
+    esp_err_t ret = ESP_OK;
+
+    if (httpd_query_key_value(query, "mb", value, sizeof(value)) == ESP_OK) {
+        mb = MIN(MAX(strtoul(value, NULL, 10), 1), TCP_BENCH_MAX_MB);
+    }
+    if (httpd_query_key_value(query, "copy", value, sizeof(value)) == ESP_OK) {
+        copy = copy || atoi(value);
+    }
+
+    uint8_t *chunk = heap_caps_malloc(TCP_BENCH_CHUNK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!chunk) {
+        tcp_send_str(sock, "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n");
+        close(sock);
+        return;
+    }
+    for (uint32_t i = 0; i < TCP_BENCH_CHUNK_SIZE; i++) {
+        chunk[i] = i;
+    }
+
+    snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+             "Content-Length: %llu\r\nConnection: close\r\n\r\n", (unsigned long long)mb * TCP_BENCH_CHUNK_SIZE);
+
+    int64_t start = esp_timer_get_time();
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    tcp_zc_t zc;
+    u32_t end = 0;
+
+    if (!copy) {
+        ret = tcp_zc_init(&zc, sock);
+        for (uint32_t i = 0; i < mb && ret == ESP_OK; i++) {
+            ret = tcp_zc_send(&zc, header, i ? 0 : strlen(header), chunk, TCP_BENCH_CHUNK_SIZE, &end);
+        }
+        /* The buffer is freed below, every byte of it must be acknowledged first */
+        if (ret == ESP_OK) {
+            ret = tcp_zc_wait_acked(&zc, end);
+        }
+    }
+#endif
+    if (copy) {
+        ret = tcp_send_str(sock, header);
+        for (uint32_t i = 0; i < mb && ret == ESP_OK; i++) {
+            struct iovec iov = {
+                .iov_base = chunk,
+                .iov_len = TCP_BENCH_CHUNK_SIZE,
+            };
+            ret = tcp_sendv(sock, &iov, 1);
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "TCP bench: %"PRIu32" MiB in %lld ms, %.1f Mbit/s (%s)", mb, elapsed / 1000,
+                 mb * TCP_BENCH_CHUNK_SIZE * 8.0 / elapsed, copy ? "copy" : "zero-copy");
+    } else {
+        ESP_LOGW(TAG, "TCP bench aborted after %lld ms", elapsed / 1000);
+    }
+
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    if (!copy && ret != ESP_OK) {
+        tcp_zc_abort(sock);
+        free(chunk);
+        return;
+    }
+#endif
+    close(sock);
+    free(chunk);
+}
+#endif
+
+static void tcp_worker_task(void *arg)
+{
+    tcp_client_t *client = (tcp_client_t *)arg;
+    char path[TCP_REQUEST_MAX_LEN];
+    char part_header[160];
+    const char *query;
+    const frame_t *frame;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_count = 0;
+    frame_subscriber_config_t sub_config;
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    tcp_zc_t zc;
+    const frame_t *inflight = NULL;     /* Last frame queued, referenced by lwIP until acknowledged */
+    u32_t inflight_end = 0;
+#endif
+
+    if (tcp_read_request(client->sock, path, sizeof(path)) != ESP_OK) {
+        goto exit;
+    }
+#if CONFIG_EXAMPLE_TCP_BENCH
+    if (!strncmp(path, "/bench", strlen("/bench")) && (path[strlen("/bench")] == '\0' || path[strlen("/bench")] == '?')) {
+        tcp_run_bench(client->sock, strchr(path, '?') ? strchr(path, '?') + 1 : "");
+        client->sock = -1;
+        goto exit;
+    }
+#endif
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    if (tcp_zc_init(&zc, client->sock) != ESP_OK) {
+        goto exit;
+    }
+#endif
+    if (tcp_get_stream_kind(path, &client->kind) != ESP_OK) {
+        tcp_send_str(client->sock, "HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n");
+        goto exit;
+    }
+
+    query = strchr(path, '?') ? strchr(path, '?') + 1 : "";
+    stream_parse_delivery(query, &sub_config);
+    sub_config.name = client->name;
+    if (stream_subscribe(query, client->kind, &sub_config, &client->sub, &width, &height) != ESP_OK || !client->sub) {
+        tcp_send_str(client->sock, "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n");
+        goto exit;
+    }
+
+    snprintf(part_header, sizeof(part_header),
+             "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nAccess-Control-Allow-Origin: *\r\n"
+             "X-Frame-Width: %"PRIu32"\r\nX-Frame-Height: %"PRIu32"\r\nConnection: close\r\n\r\n",
+             STREAM_CONTENT_TYPE, width, height);
+    if (tcp_send_str(client->sock, part_header) != ESP_OK) {
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "TCP stream client %s connected", client->name);
+
+    while (true) {
+        if (frame_subscriber_wait(client->sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            continue;
+        }
+
+        int hlen = snprintf(part_header, sizeof(part_header), stream_get_part_format(client->kind),
+                            frame->size, frame->width, frame->height, frame_clock_to_wall_us(frame->timestamp_us));
+        uint32_t size = frame->size;
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_START, frame->sequence);
+        int64_t send_start = stream_metrics_send_start(frame);
+        latency_probe_record_send(frame);
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+        u32_t end = 0;
+        esp_err_t ret = tcp_zc_send(&zc, part_header, hlen, frame->data, size, &end);
+
+        /* The previous frame is ahead of this one in the send queue, it is acknowledged by now */
+        if (inflight && ret == ESP_OK) {
+            ret = tcp_zc_wait_acked(&zc, inflight_end);
+        }
+        if (ret != ESP_OK) {
+            /* Both frames may still be referenced, they are released once the segments are dropped */
+            tcp_zc_abort(client->sock);
+            client->sock = -1;
+            frame_subscriber_release(client->sub, frame);
+        } else {
+            if (inflight) {
+                frame_subscriber_release(client->sub, inflight);
+            }
+            inflight = frame;
+            inflight_end = end;
+        }
+#else
+        struct iovec iov[2] = {
+            { .iov_base = part_header, .iov_len = hlen },
+            { .iov_base = frame->data, .iov_len = size },
+        };
+        esp_err_t ret = tcp_sendv(client->sock, iov, 2);
+
+        frame_subscriber_release(client->sub, frame);
+#endif
+        if (ret != ESP_OK) {
+            TRACE_RING_RECORD(TRACE_EVENT_SEND_ERROR, frame_count);
+            break;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_SEND_DONE, hlen + size);
+        stream_metrics_send_done(send_start, hlen + size);
+        frame_count++;
+    }
+
+    ESP_LOGI(TAG, "TCP stream client %s disconnected after %"PRIu32" frames", client->name, frame_count);
+
+exit:
+#if CONFIG_EXAMPLE_TCP_STREAM_ZERO_COPY
+    if (inflight) {
+        if (client->sock >= 0) {
+            tcp_zc_abort(client->sock);
+            client->sock = -1;
+        }
+        frame_subscriber_release(client->sub, inflight);
+    }
+#endif
+    if (client->sub) {
+        frame_broadcaster_unsubscribe(client->sub);
+    }
+    if (client->sock >= 0) {
+        close(client->sock);
+    }
+    free(client);
+    s_stream_clients--;
+    vTaskDelete(NULL);
+}
+
+static void tcp_server_task(void *arg)
+{
+    int listen_sock = (int)(intptr_t)arg;
+    int nodelay = 1;
+    struct timeval timeout = {
+        .tv_sec = TCP_SEND_TIMEOUT_S,
+    };
+
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int sock = accept(listen_sock, (struct sockaddr *)&addr, &addr_len);
+        if (sock < 0) {
+            ESP_LOGE(TAG, "TCP accept failed (errno=%d)", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        tcp_client_t *client = calloc(1, sizeof(tcp_client_t));
+        if (!client || !stream_client_reserve()) {
+            ESP_LOGW(TAG, "Too many stream clients, closing TCP connection");
+            free(client);
+            close(sock);
+            continue;
+        }
+
+        /*
+         * Part headers are sent together with the payload, so Nagle only adds latency.
+         * lwIP has no SO_SNDBUF, the send buffer is CONFIG_LWIP_TCP_SND_BUF_DEFAULT.
+         */
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        client->sock = sock;
+        inet_ntop(AF_INET, &addr.sin_addr, client->name, sizeof(client->name));
+
+        if (xTaskCreatePinnedToCore(tcp_worker_task, "tcp_stream", STREAM_TASK_STACK_SIZE, client,
+                                    STREAM_TASK_PRIORITY, NULL, STREAM_TASK_CORE) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create TCP stream worker");
+            s_stream_clients--;
+            close(sock);
+            free(client);
+        }
+    }
+}
+
+static esp_err_t init_tcp_server(void)
+{
+    int sock;
+    int reuse = 1;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_EXAMPLE_TCP_STREAM_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ESP_RETURN_ON_FALSE(sock >= 0, ESP_FAIL, TAG, "Failed to create TCP socket");
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 2) != 0 ||
+            xTaskCreatePinnedToCore(tcp_server_task, "tcp_server", 4096, (void *)(intptr_t)sock, STREAM_TASK_PRIORITY,
+                                    NULL, STREAM_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start TCP stream server (errno=%d)", errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "TCP stream server started on port %d", CONFIG_EXAMPLE_TCP_STREAM_PORT);
+    return ESP_OK;
+}
+#endif
+
+/* Send one printf formatted part of a chunked response, a part never exceeds STATUS_PART_SIZE */
+static esp_err_t send_chunk_printf(httpd_req_t *req, const char *fmt, ...)
+{
+    char part[STATUS_PART_SIZE];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(part, sizeof(part), fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send_chunk(req, part, MIN((size_t)len, sizeof(part) - 1));
+}
+
+/*
+ * Status endpoint
+ *
+ * The JSON is sent in chunks, one per object, so it is complete whatever the
+ * number of subscribers, the internal ones (JPEG, RTSP, recorder, probe)
+ * included.
+ */
+static esp_err_t status_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+    frame_subscriber_stats_t *stats;
+    uint32_t subscribers = frame_broadcaster_subscriber_count(s_camera.frames);
+    uint32_t count;
+    uint32_t exposure;
+    uint32_t gain;
+
+    /* Subscribers joining in between are left out, get_stats() never returns more than asked for */
+    stats = calloc(MAX(subscribers, 1), sizeof(*stats));
+    if (!stats) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    count = frame_broadcaster_get_stats(s_camera.frames, stats, MAX(subscribers, 1));
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    camera_get_exposure(&exposure, &gain);
+    ret = send_chunk_printf(req,
+                            "{\"width\":%"PRIu32",\"height\":%"PRIu32",\"format\":\"%s\",\"buffer_size\":%"PRIu32","
+                            "\"roi\":{\"x\":%"PRIi32",\"y\":%"PRIi32",\"w\":%"PRIu32",\"h\":%"PRIu32"},"
+                            "\"buffers\":{\"count\":%"PRIu32",\"mem\":\"%s\"},"
+                            "\"exposure\":%"PRIu32",\"gain\":%"PRIu32",\"subscribers\":%"PRIu32",\"clients\":[",
+                            s_camera.width, s_camera.height, camera_format_name(), s_camera.buffer_size,
+                            s_camera.roi.left, s_camera.roi.top, s_camera.roi.width, s_camera.roi.height,
+                            s_camera.bufs.count, capture_buffers_mem_to_str(s_camera.bufs.config.mem), exposure, gain,
+                            subscribers);
+
+    for (uint32_t i = 0; i < count && ret == ESP_OK; i++) {
+        ret = send_chunk_printf(req,
+                                "%s{\"id\":%"PRIu32",\"name\":\"%s\",\"policy\":\"%s\",\"delivered\":%"PRIu32","
+                                "\"dropped\":%"PRIu32",\"decimated\":%"PRIu32",\"copied\":%"PRIu32",\"max_fps\":%"PRIu32"}",
+                                i ? "," : "", stats[i].id, stats[i].name, frame_delivery_policy_to_str(stats[i].policy),
+                                stats[i].delivered, stats[i].dropped, stats[i].decimated, stats[i].copied,
+                                stats[i].max_fps);
+    }
+    free(stats);
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, "]");
+    }
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    if (ret == ESP_OK) {
+        ret = send_chunk_printf(req, ",\"jpeg_encoded\":%"PRIu32, jpeg_pipeline_get_encoded_count());
+    }
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    if (ret == ESP_OK) {
+        raw_codec_pipeline_stats_t codec_stats;
+
+        raw_codec_pipeline_get_stats(&codec_stats);
+        ret = send_chunk_printf(req, ",\"lossless\":{\"frames\":%"PRIu32",\"ratio\":%.2f}", codec_stats.frames,
+                                codec_stats.out_bytes ? (double)codec_stats.in_bytes / codec_stats.out_bytes : 0.0);
+    }
+#endif
+    if (ret == ESP_OK) {
+        uint32_t preview_width;
+        uint32_t preview_height;
+
+        preview_pipeline_get_size(s_camera.width, s_camera.height, &preview_width, &preview_height);
+        ret = send_chunk_printf(req, ",\"preview\":{\"w\":%"PRIu32",\"h\":%"PRIu32",\"frames\":%"PRIu32"}",
+                                preview_width, preview_height, preview_pipeline_get_frame_count());
+    }
+#if CONFIG_EXAMPLE_INFERENCE_TAP
+    if (ret == ESP_OK) {
+        ret = send_chunk_printf(req, ",\"inference\":{\"levels\":%"PRIu32",\"frames\":%"PRIu32"}",
+                                inference_tap_get_level_count(), inference_tap_get_frame_count());
+    }
+#endif
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+    if (ret == ESP_OK) {
+        sd_recorder_stats_t rec_stats;
+
+        sd_recorder_get_stats(&rec_stats);
+        ret = send_chunk_printf(req,
+                                ",\"record\":{\"mounted\":%s,\"recording\":%s,\"files\":%"PRIu32",\"frames\":%"PRIu32","
+                                "\"dropped\":%"PRIu32"}",
+                                rec_stats.mounted ? "true" : "false", rec_stats.recording ? "true" : "false",
+                                rec_stats.files, rec_stats.frames, rec_stats.dropped);
+    }
+#endif
+#if CONFIG_EXAMPLE_UDP_STREAM
+    if (ret == ESP_OK) {
+        ret = send_chunk_printf(req, ",\"udp\":{\"frames\":%"PRIu32",\"datagrams\":%"PRIu32",\"send_errors\":%"PRIu32"}",
+                                s_udp.frames, s_udp.datagrams, s_udp.send_errors);
+    }
+#endif
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, "}");
+    }
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, NULL);
+    }
+
+    return ret;
+}
+
+/* Budget of one buffer configuration as a JSON object */
+static int buffers_format_budget(char *buf, size_t size, const capture_buffers_config_t *config)
+{
+    capture_buffers_budget_t budget;
+
+    capture_buffers_get_budget(&s_camera.bufs, config, &budget);
+    return snprintf(buf, size,
+                    "{\"count\":%"PRIu32",\"buffer_size\":%u,\"required\":%u,\"in_use\":%u,"
+                    "\"free\":%u,\"largest_block\":%u,\"fits\":%s}",
+                    config->count, (unsigned)budget.buffer_size, (unsigned)budget.required, (unsigned)budget.in_use,
+                    (unsigned)budget.free, (unsigned)budget.largest_block, budget.fits ? "true" : "false");
+}
+
+/*
+ * Capture buffers: GET /buffers reports the current buffers and what the same count
+ * would cost in each memory, /buffers?count=N&mem=mmap|psram|internal&align=A
+ * reallocates them. Missing parameters keep their current value.
+ */
+static esp_err_t buffers_handler(httpd_req_t *req)
+{
+    char json[768];
+    char query[96] = {0};
+    char value[16];
+    int len;
+    esp_err_t ret = ESP_OK;
+    bool change = false;
+    capture_buffers_config_t config = s_camera.bufs.config;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "count", value, sizeof(value)) == ESP_OK) {
+            config.count = strtoul(value, NULL, 10);
+            change = true;
+        }
+        if (httpd_query_key_value(query, "mem", value, sizeof(value)) == ESP_OK) {
+            if (capture_buffers_mem_from_str(value, &config.mem) != ESP_OK) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mem must be mmap, psram or internal");
+            }
+            change = true;
+        }
+        if (httpd_query_key_value(query, "align", value, sizeof(value)) == ESP_OK) {
+            config.alignment = strtoul(value, NULL, 10);
+            change = true;
+        }
+    }
+
+    if (change) {
+        capture_buffers_budget_t budget;
+
+        if (config.count < 1 || config.count > CAPTURE_BUFFERS_MAX || (config.alignment & (config.alignment - 1))) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "count must be 1-16, align a power of two");
+        }
+
+        /* The buffer size follows the capture format, a smaller window would leave them too small for the full frame */
+        if (s_camera.roi.width != s_camera.sensor_width || s_camera.roi.height != s_camera.sensor_height) {
+            httpd_resp_set_status(req, "409 Conflict");
+            return httpd_resp_sendstr(req, "{\"error\":\"reset the capture window to the full frame first\"}");
+        }
+
+        capture_buffers_get_budget(&s_camera.bufs, &config, &budget);
+        if (!budget.fits) {
+            len = snprintf(json, sizeof(json), "{\"error\":\"not enough memory\",\"budget\":");
+            buffers_format_budget(json + len, sizeof(json) - len, &config);
+            strlcat(json, "}", sizeof(json));
+            httpd_resp_set_status(req, "409 Conflict");
+            return httpd_resp_sendstr(req, json);
+        }
+
+        ret = frame_broadcaster_resize_capture(s_camera.frames, &config, BUFFERS_RESIZE_TIMEOUT_MS);
+        s_camera.buffer_size = s_camera.bufs.size;
+        ESP_LOGI(TAG, "Capture buffers: %"PRIu32" %s%s", s_camera.bufs.count,
+                 capture_buffers_mem_to_str(s_camera.bufs.config.mem), ret == ESP_OK ? "" : " (request failed)");
+    }
+
+    len = snprintf(json, sizeof(json), "{\"count\":%"PRIu32",\"mem\":\"%s\",\"alignment\":%"PRIu32",\"buffer_size\":%"PRIu32",",
+                   s_camera.bufs.count, capture_buffers_mem_to_str(s_camera.bufs.config.mem),
+                   s_camera.bufs.config.alignment, s_camera.bufs.size);
+    if (ret != ESP_OK && len < sizeof(json)) {
+        len += snprintf(json + len, sizeof(json) - len, "\"error\":\"%s\",", esp_err_to_name(ret));
+    }
+    if (len < sizeof(json)) {
+        len += snprintf(json + len, sizeof(json) - len, "\"budget\":{");
+    }
+    for (int mem = CAPTURE_BUFFERS_MEM_MMAP; mem <= CAPTURE_BUFFERS_MEM_INTERNAL && len < sizeof(json); mem++) {
+        capture_buffers_config_t budget_config = s_camera.bufs.config;
+
+        budget_config.mem = (capture_buffers_mem_t)mem;
+        len += snprintf(json + len, sizeof(json) - len, "%s\"%s\":", mem ? "," : "", capture_buffers_mem_to_str(mem));
+        if (len < sizeof(json)) {
+            len += buffers_format_budget(json + len, sizeof(json) - len, &budget_config);
+        }
+    }
+    if (len < sizeof(json)) {
+        snprintf(json + len, sizeof(json) - len, "}}");
+    }
+
+    if (ret != ESP_OK) {
+        httpd_resp_set_status(req, ret == ESP_ERR_TIMEOUT ? "503 Service Unavailable" : HTTPD_500);
+    }
+    return httpd_resp_sendstr(req, json);
+}
+
+#if CONFIG_EXAMPLE_STREAM_METRICS
+/* Prometheus metrics */
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    char *text = malloc(STREAM_METRICS_TEXT_SIZE);
+
+    if (!text) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    size_t len = stream_metrics_format(text, STREAM_METRICS_TEXT_SIZE, s_camera.fd);
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t ret = httpd_resp_send(req, text, len);
+
+    free(text);
+    return ret;
+}
+#endif
+
+#if CONFIG_EXAMPLE_TRACE_RING
+/*
+ * Trace ring dump, decoded as text by default. /trace?format=bin sends the raw
+ * trace_record_t array (little endian, 12 bytes each) for offline tools.
+ */
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    char query[32];
+    char format[8];
+    char line[96];
+    esp_err_t ret = ESP_OK;
+    trace_record_t *records = malloc(TRACE_RING_MAX_RECORDS * sizeof(trace_record_t));
+
+    if (!records) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    size_t count = trace_ring_snapshot(records, TRACE_RING_MAX_RECORDS);
+
+    stream_get_query(req, query, sizeof(query));
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if (httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK && !strcmp(format, "bin")) {
+        httpd_resp_set_type(req, "application/octet-stream");
+        ret = httpd_resp_send(req, (const char *)records, count * sizeof(trace_record_t));
+        free(records);
+        return ret;
+    }
+
+    httpd_resp_set_type(req, "text/plain");
+    for (size_t i = 0; i < count && ret == ESP_OK; i++) {
+        uint32_t delta = i ? records[i].timestamp_us - records[i - 1].timestamp_us : 0;
+        int len = snprintf(line, sizeof(line), "%10"PRIu32" +%7"PRIu32" core%u %-20s %"PRIu32"\n",
+                           records[i].timestamp_us, delta, records[i].core,
+                           trace_ring_event_name(records[i].event), records[i].arg);
+
+        ret = httpd_resp_send_chunk(req, line, len);
+    }
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    free(records);
+    return ret;
+}
+#endif
+
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+/*
+ * SD recording: GET /record reports the recorder, /record?enable=0|1 stops or
+ * starts it. Stopping closes the file, the live streams are not affected.
+ */
+static esp_err_t record_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[8];
+    char json[256];
+    sd_recorder_stats_t stats;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    stream_get_query(req, query, sizeof(query));
+    if (httpd_query_key_value(query, "enable", value, sizeof(value)) == ESP_OK &&
+        sd_recorder_set_enabled(atoi(value) != 0) != ESP_OK) {
+        return httpd_resp_sendstr(req, "{\"error\":\"no SD card\"}");
+    }
+
+    sd_recorder_get_stats(&stats);
+    snprintf(json, sizeof(json),
+             "{\"mounted\":%s,\"recording\":%s,\"path\":\"%s\",\"files\":%"PRIu32",\"frames\":%"PRIu32","
+             "\"bytes\":%"PRIu64",\"skipped\":%"PRIu32",\"dropped\":%"PRIu32"}",
+             stats.mounted ? "true" : "false", stats.recording ? "true" : "false", stats.path,
+             stats.files, stats.frames, stats.bytes, stats.skipped, stats.dropped);
+    return httpd_resp_sendstr(req, json);
+}
+#endif
+
+#if CONFIG_EXAMPLE_LATENCY_PROBE
+/* One latency distribution as a JSON object */
+static int latency_format_dist(char *buf, size_t size, const char *name, const latency_probe_dist_t *dist)
+{
+    return snprintf(buf, size,
+                    ",\"%s\":{\"count\":%"PRIu32",\"min_us\":%"PRIu32",\"p50_us\":%"PRIu32",\"p90_us\":%"PRIu32","
+                    "\"p99_us\":%"PRIu32",\"max_us\":%"PRIu32"}",
+                    name, dist->count, dist->min_us, dist->p50_us, dist->p90_us, dist->p99_us, dist->max_us);
+}
+
+/*
+ * LED latency probe: GET /latency reports the distributions,
+ * /latency?echo=<X-Frame-Time> records a client showing that frame.
+ */
+static esp_err_t latency_handler(httpd_req_t *req)
+{
+    char query[48];
+    char value[24];
+    char json[768];
+    latency_probe_stats_t stats;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    stream_get_query(req, query, sizeof(query));
+    if (httpd_query_key_value(query, "echo", value, sizeof(value)) == ESP_OK) {
+        esp_err_t ret = latency_probe_echo(strtoll(value, NULL, 10));
+
+        return httpd_resp_sendstr(req, ret == ESP_OK ? "{\"edge\":true}" : "{\"edge\":false}");
+    }
+
+    latency_probe_get_stats(&stats);
+    int len = snprintf(json, sizeof(json),
+                       "{\"edges\":%"PRIu32",\"detected\":%"PRIu32",\"missed\":%"PRIu32",\"level\":%"PRIu32,
+                       stats.edges, stats.detected, stats.missed, stats.level);
+    if (len < sizeof(json)) {
+        len += latency_format_dist(json + len, sizeof(json) - len, "led_to_dqbuf", &stats.led_to_dqbuf);
+    }
+    if (len < sizeof(json)) {
+        len += latency_format_dist(json + len, sizeof(json) - len, "dqbuf_to_send", &stats.dqbuf_to_send);
+    }
+    if (len < sizeof(json)) {
+        len += latency_format_dist(json + len, sizeof(json) - len, "glass_to_glass", &stats.glass_to_glass);
+    }
+    if (len < sizeof(json)) {
+        snprintf(json + len, sizeof(json) - len, "}");
+    }
+
+    return httpd_resp_sendstr(req, json);
+}
+#endif
+
+#if CONFIG_EXAMPLE_ISP_STATS
+/* Latest ISP statistics set as JSON */
+static esp_err_t isp_stats_handler(httpd_req_t *req)
+{
+    esp_video_isp_frame_stats_t stats;
+    char *text;
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    if (isp_stats_feed_get_latest(&stats) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No ISP statistics yet");
+        return ESP_OK;
+    }
+
+    text = malloc(ISP_STATS_JSON_SIZE);
+    if (!text) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    size_t len = isp_stats_format_json(&stats, text, ISP_STATS_JSON_SIZE);
+
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t ret = httpd_resp_send(req, text, len);
+
+    free(text);
+    return ret;
+}
+
+#if CONFIG_HTTPD_WS_SUPPORT
+typedef struct {
+    httpd_handle_t hd;
+    int fd;
+    isp_stats_reader_t *reader;
+    _Atomic bool closed;        /* Set when httpd closes the session */
+} ws_stats_client_t;
+
+static void ws_stats_client_close(void *ctx)
+{
+    ws_stats_client_t *client = (ws_stats_client_t *)ctx;
+
+    client->closed = true;
+}
+
+/* One JSON text message per statistics set, slow clients get the latest set */
+static void ws_stats_worker_task(void *arg)
+{
+    ws_stats_client_t *client = (ws_stats_client_t *)arg;
+    esp_video_isp_frame_stats_t stats;
+    uint32_t skipped;
+    uint32_t count = 0;
+    char *text = malloc(ISP_STATS_JSON_SIZE);
+
+    while (text && !client->closed) {
+        if (isp_stats_reader_wait(client->reader, &stats, &skipped, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            continue;
+        }
+
+        httpd_ws_frame_t ws_frame = {
+            .final = true,
+            .type = HTTPD_WS_TYPE_TEXT,
+            .payload = (uint8_t *)text,
+            .len = isp_stats_format_json(&stats, text, ISP_STATS_JSON_SIZE),
+        };
+
+        if (httpd_ws_send_frame_async(client->hd, client->fd, &ws_frame) != ESP_OK) {
+            break;
+        }
+        count++;
+    }
+    if (!client->closed) {
+        httpd_sess_trigger_close(client->hd, client->fd);
+    }
+
+    /* Wait for httpd to drop the session context before freeing it */
+    while (!client->closed) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    ESP_LOGI(TAG, "ISP statistics client disconnected after %"PRIu32" sets", count);
+    isp_stats_reader_close(client->reader);
+    free(text);
+    free(client);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t ws_stats_open(httpd_req_t *req)
+{
+    esp_err_t ret = ESP_OK;
+    ws_stats_client_t *client = calloc(1, sizeof(ws_stats_client_t));
+
+    ESP_RETURN_ON_FALSE(client, ESP_ERR_NO_MEM, TAG, "no memory for ISP statistics client");
+
+    client->hd = req->handle;
+    client->fd = httpd_req_to_sockfd(req);
+    ESP_GOTO_ON_ERROR(isp_stats_reader_open(&client->reader), fail, TAG, "too many ISP statistics clients");
+    if (xTaskCreatePinnedToCore(ws_stats_worker_task, "ws_isp_stats", 4096, client,
+                                STREAM_TASK_PRIORITY, NULL, STREAM_TASK_CORE) != pdPASS) {
+        isp_stats_reader_close(client->reader);
+        ESP_GOTO_ON_FALSE(false, ESP_ERR_NO_MEM, fail, TAG, "failed to create ISP statistics worker");
+    }
+
+    req->sess_ctx = client;
+    req->free_ctx = ws_stats_client_close;
+
+    ESP_LOGI(TAG, "ISP statistics client connected");
+    return ESP_OK;
+
+fail:
+    free(client);
+    return ret;
+}
+
+static esp_err_t ws_stats_handler(httpd_req_t *req)
+{
+    uint8_t buf[WS_CONTROL_MAX_LEN + 1];
+    httpd_ws_frame_t ws_frame;
+
+    if (req->method == HTTP_GET) {
+        return ws_stats_open(req);
+    }
+
+    /* Nothing is expected from the client, messages are read and dropped */
+    memset(&ws_frame, 0, sizeof(ws_frame));
+    ESP_RETURN_ON_ERROR(httpd_ws_recv_frame(req, &ws_frame, 0), TAG, "failed to get WebSocket frame length");
+    ESP_RETURN_ON_FALSE(ws_frame.len <= WS_CONTROL_MAX_LEN, ESP_ERR_INVALID_SIZE, TAG,
+                        "WebSocket message too long (%zu bytes)", ws_frame.len);
+    ws_frame.payload = buf;
+    return httpd_ws_recv_frame(req, &ws_frame, WS_CONTROL_MAX_LEN);
+}
+#endif
+#endif
+
+/* Index page */
+static esp_err_t index_handler(httpd_req_t *req)
+{
+    const char *html =
+        "<!DOCTYPE html><html><head><title>IMX662 RGB Streamer</title></head>"
+        "<body style='font-family:monospace;padding:20px'>"
+        "<h1>IMX662 RGB888 Streaming Server</h1>"
+        "<p>Resolution: 1936x1100, Format: RGB888 (ISP processed)</p>"
+        "<h2>Endpoints:</h2>"
+        "<ul>"
+        "<li><a href='/capture'>/capture</a> - Latest RAW frame (for Python viewer), ?mode=next waits for the next one</li>"
+        "<li><a href='/stream'>/stream</a> - Continuous RAW stream (?x=&amp;y=&amp;w=&amp;h= capture window)</li>"
+#if CONFIG_EXAMPLE_CHANGE_DETECT
+        "<li>/stream?changes=1 - Only frames that changed, with X-Change-Grid, X-Change-Blocks and X-Change-Mask part headers (also /stream.preview)</li>"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+        "<li><a href='/stream.mjpeg'>/stream.mjpeg</a> - Hardware JPEG stream (?quality=1-100)</li>"
+#endif
+#if CAPTURE_JPEG_CACHED
+        "<li><a href='/capture.jpg'>/capture.jpg</a> - Last JPEG encoded for the streams, a new one if older than ?max_age=ms (default 1000)</li>"
+#endif
+        "<li><a href='/stream.preview'>/stream.preview</a> - Decimated RGB888 stream (same query parameters as /stream)</li>"
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+        "<li>/stream.auto?fps=N - Steps between full frames, JPEG and preview to hold N fps on the client's link</li>"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+        "<li><a href='/stream.lossless'>/stream.lossless</a> - Losslessly compressed RAW10 stream</li>"
+#endif
+#if CONFIG_HTTPD_WS_SUPPORT
+        "<li>/ws - WebSocket stream with frame metadata and credit flow control (?stream=raw|preview|mjpeg|lossless&amp;credits=N)</li>"
+#endif
+#if CONFIG_EXAMPLE_TCP_STREAM
+        "<li>TCP - The /stream paths without chunked encoding on the configured TCP port</li>"
+#endif
+#if CONFIG_EXAMPLE_UDP_STREAM
+        "<li>UDP - Fragmented stream on the configured UDP port with optional XOR FEC (send stream=raw&amp;fec=K)</li>"
+#endif
+        "<li><a href='/status'>/status</a> - Camera status (JSON)</li>"
+        "<li><a href='/buffers'>/buffers</a> - Capture buffers and memory budget (?count=N&amp;mem=mmap|psram|internal&amp;align=A)</li>"
+#if CONFIG_EXAMPLE_STREAM_METRICS
+        "<li><a href='/metrics'>/metrics</a> - Latency histograms and rates (Prometheus)</li>"
+#endif
+#if CONFIG_EXAMPLE_TRACE_RING
+        "<li><a href='/trace'>/trace</a> - Trace ring dump, /trace?format=bin for raw records</li>"
+#endif
+#if CONFIG_EXAMPLE_ISP_STATS
+        "<li><a href='/isp_stats'>/isp_stats</a> - Latest AE, AWB, histogram, sharpen and AF statistics (JSON)</li>"
+#if CONFIG_HTTPD_WS_SUPPORT
+        "<li>/ws/isp_stats - WebSocket with one JSON message per statistics set</li>"
+#endif
+#endif
+        "</ul>"
+        "<h2>Python Viewer:</h2>"
+        "<pre>python raw_stream_viewer.py --host [THIS_IP] --port 80</pre>"
+        "</body></html>";
+
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_sendstr(req, html);
+}
+
+/* API compatibility endpoint */
+static esp_err_t api_capture_handler(httpd_req_t *req)
+{
+    return capture_handler(req);
+}
+
+#if CAPTURE_JPEG_CACHED
+/*
+ * JPEG snapshot - the last frame the JPEG pipeline encoded for the streams is sent
+ * without a new encode while it is younger than /capture.jpg?max_age=ms, otherwise
+ * the next frame is encoded for the request.
+ */
+static esp_err_t capture_jpeg_handler(httpd_req_t *req)
+{
+    const frame_t *frame = NULL;
+    frame_subscriber_t *sub = NULL;
+    char query[64];
+    char value[12];
+    char age[12];
+    char wall_time[24];
+    int64_t max_age_us = CAPTURE_JPEG_MAX_AGE_MS * 1000LL;
+    esp_err_t ret;
+
+    stream_get_query(req, query, sizeof(query));
+    uint8_t quality = stream_get_jpeg_quality(query);
+    if (httpd_query_key_value(query, "max_age", value, sizeof(value)) == ESP_OK) {
+        max_age_us = strtoull(value, NULL, 10) * 1000;
+    }
+
+    if (jpeg_pipeline_get_latest(quality, &frame) == ESP_OK && esp_timer_get_time() - frame->timestamp_us > max_age_us) {
+        jpeg_pipeline_put_latest(quality, frame);
+        frame = NULL;
+    }
+    if (!frame) {
+        sub = jpeg_pipeline_subscribe(quality, NULL);
+        if (!sub || frame_subscriber_wait(sub, &frame, pdMS_TO_TICKS(CAPTURE_JPEG_TIMEOUT_MS)) != ESP_OK) {
+            if (sub) {
+                frame_broadcaster_unsubscribe(sub);
+            }
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "JPEG encoding failed");
+            return ESP_FAIL;
+        }
+    }
+
+    snprintf(age, sizeof(age), "%lld", (esp_timer_get_time() - frame->timestamp_us) / 1000);
+    snprintf(wall_time, sizeof(wall_time), "%lld", frame_clock_to_wall_us(frame->timestamp_us));
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "X-Frame-Time", wall_time);
+    httpd_resp_set_hdr(req, "X-Frame-Age", age);
+
+    ret = httpd_resp_send(req, (char *)frame->data, frame->size);
+
+    if (sub) {
+        frame_subscriber_release(sub, frame);
+        frame_broadcaster_unsubscribe(sub);
+    } else {
+        jpeg_pipeline_put_latest(quality, frame);
+    }
+
+    return ret;
+}
+#endif
+
+static esp_err_t init_http_server(void)
+{
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.stack_size = HTTP_TASK_STACK_SIZE;
+    config.max_uri_handlers = HTTP_MAX_URI_HANDLERS;
+    /* Async stream requests keep their socket, the API gets its own on top */
+    config.max_open_sockets = STREAM_MAX_CLIENTS + HTTP_API_SOCKETS;
+    config.lru_purge_enable = true;
+    config.core_id = TASK_NETWORK_CORE;
+
+#if CONFIG_EXAMPLE_HTTPS_STREAM
+    extern const unsigned char servercert_start[] asm("_binary_servercert_pem_start");
+    extern const unsigned char servercert_end[] asm("_binary_servercert_pem_end");
+    extern const unsigned char prvtkey_start[] asm("_binary_prvtkey_pem_start");
+    extern const unsigned char prvtkey_end[] asm("_binary_prvtkey_pem_end");
+    httpd_ssl_config_t ssl_config = HTTPD_SSL_CONFIG_DEFAULT();
+
+    /*
+     * Stream workers write whole frames, mbedTLS cuts them into records of
+     * CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN and the AES and SHA accelerators
+     * encrypt and authenticate each one, so the CPU cost stays per record.
+     */
+    ssl_config.httpd = config;
+    ssl_config.port_secure = CONFIG_EXAMPLE_HTTPS_PORT;
+    ssl_config.servercert = servercert_start;
+    ssl_config.servercert_len = servercert_end - servercert_start;
+    ssl_config.prvtkey_pem = prvtkey_start;
+    ssl_config.prvtkey_len = prvtkey_end - prvtkey_start;
+    ESP_RETURN_ON_ERROR(httpd_ssl_start(&server, &ssl_config), TAG, "Failed to start HTTPS server");
+    config.server_port = ssl_config.port_secure;
+#else
+    ESP_RETURN_ON_ERROR(httpd_start(&server, &config), TAG, "Failed to start HTTP server");
+#endif
+
+    /* Register handlers */
+    httpd_uri_t index_uri = { .uri = "/", .method = HTTP_GET, .handler = index_handler };
+    httpd_uri_t capture_uri = { .uri = "/capture", .method = HTTP_GET, .handler = capture_handler };
+    httpd_uri_t stream_uri = { .uri = "/stream", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_KIND_RAW };
+    httpd_uri_t status_uri = { .uri = "/status", .method = HTTP_GET, .handler = status_handler };
+    httpd_uri_t api_uri = { .uri = "/api/capture_binary", .method = HTTP_GET, .handler = api_capture_handler };
+    httpd_uri_t buffers_uri = { .uri = "/buffers", .method = HTTP_GET, .handler = buffers_handler };
+
+    httpd_register_uri_handler(server, &index_uri);
+    httpd_register_uri_handler(server, &capture_uri);
+    httpd_register_uri_handler(server, &stream_uri);
+    httpd_register_uri_handler(server, &status_uri);
+    httpd_register_uri_handler(server, &api_uri);
+    httpd_register_uri_handler(server, &buffers_uri);
+
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+    httpd_uri_t auto_uri = { .uri = "/stream.auto", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_KIND_ADAPTIVE };
+    httpd_register_uri_handler(server, &auto_uri);
+#endif
+    httpd_uri_t preview_uri = { .uri = "/stream.preview", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_KIND_PREVIEW };
+    httpd_register_uri_handler(server, &preview_uri);
+
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    httpd_uri_t mjpeg_uri = { .uri = "/stream.mjpeg", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_KIND_MJPEG };
+    httpd_register_uri_handler(server, &mjpeg_uri);
+#endif
+#if CAPTURE_JPEG_CACHED
+    httpd_uri_t capture_jpeg_uri = { .uri = "/capture.jpg", .method = HTTP_GET, .handler = capture_jpeg_handler };
+    httpd_register_uri_handler(server, &capture_jpeg_uri);
+#endif
+
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    httpd_uri_t lossless_uri = { .uri = "/stream.lossless", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_KIND_LOSSLESS };
+    httpd_register_uri_handler(server, &lossless_uri);
+#endif
+
+#if CONFIG_HTTPD_WS_SUPPORT
+    httpd_uri_t ws_uri = { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true };
+    httpd_register_uri_handler(server, &ws_uri);
+#endif
+#if CONFIG_EXAMPLE_STREAM_METRICS
+    httpd_uri_t metrics_uri = { .uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler };
+    httpd_register_uri_handler(server, &metrics_uri);
+#endif
+#if CONFIG_EXAMPLE_TRACE_RING
+    httpd_uri_t trace_uri = { .uri = "/trace", .method = HTTP_GET, .handler = trace_handler };
+    httpd_register_uri_handler(server, &trace_uri);
+#endif
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+    httpd_uri_t record_uri = { .uri = "/record", .method = HTTP_GET, .handler = record_handler };
+    httpd_register_uri_handler(server, &record_uri);
+#endif
+#if CONFIG_EXAMPLE_LATENCY_PROBE
+    httpd_uri_t latency_uri = { .uri = "/latency", .method = HTTP_GET, .handler = latency_handler };
+    httpd_register_uri_handler(server, &latency_uri);
+#endif
+#if CONFIG_EXAMPLE_ISP_STATS
+    httpd_uri_t isp_stats_uri = { .uri = "/isp_stats", .method = HTTP_GET, .handler = isp_stats_handler };
+    httpd_register_uri_handler(server, &isp_stats_uri);
+#if CONFIG_HTTPD_WS_SUPPORT
+    httpd_uri_t ws_isp_stats_uri = { .uri = "/ws/isp_stats", .method = HTTP_GET, .handler = ws_stats_handler, .is_websocket = true };
+    httpd_register_uri_handler(server, &ws_isp_stats_uri);
+#endif
+#endif
+
+#if CONFIG_EXAMPLE_HTTPS_STREAM
+    ESP_LOGI(TAG, "HTTPS server started on port %d", config.server_port);
+#else
+    ESP_LOGI(TAG, "HTTP server started on port %d", config.server_port);
+#endif
+    return ESP_OK;
+}
+
+/* ========== Main ========== */
+
+/* Boot phases are logged in ms since reset, time to first frame is one of them */
+static void boot_log_phase(const char *phase)
+{
+    ESP_LOGI(TAG, "Boot: %s at %lld ms", phase, (long long)(esp_timer_get_time() / 1000));
+}
+
+typedef struct {
+    TaskHandle_t waiter;        /* Notified when init_camera() returns */
+    esp_err_t ret;
+} boot_camera_t;
+
+/*
+ * Sensor detection, format setup, buffer allocation and the stream start do
+ * not need the network. Streaming starts here, so AE converges while WiFi
+ * still associates.
+ */
+static void boot_camera_task(void *arg)
+{
+    boot_camera_t *boot = (boot_camera_t *)arg;
+
+    boot->ret = init_camera();
+    boot_log_phase(boot->ret == ESP_OK ? "camera streaming" : "camera failed");
+
+    xTaskNotifyGive(boot->waiter);
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    boot_camera_t boot_camera = {
+        .waiter = xTaskGetCurrentTaskHandle(),
+        .ret = ESP_FAIL,
+    };
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║     IMX662 RGB888 HTTP Streaming Server            ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+
+    /* Initialize NVS */
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+
+    boot_log_phase("NVS ready");
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    /* The camera comes up while WiFi associates, that often takes seconds */
+    if (xTaskCreatePinnedToCore(boot_camera_task, "boot_camera", BOOT_CAMERA_TASK_STACK_SIZE, &boot_camera,
+                                TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create camera boot task");
+        ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+    }
+
+    /* Initialize network (WiFi via protocol_examples_common) */
+    ESP_ERROR_CHECK(example_connect());
+    boot_log_phase("WiFi connected");
+
+#if CONFIG_EXAMPLE_FRAME_CLOCK_SNTP
+    /* Frame times stay on the esp_timer clock only, the streams work without SNTP */
+    if (frame_clock_start() != ESP_OK) {
+        ESP_LOGW(TAG, "Wall clock frame times not available");
+    }
+#endif
+
+    /* The servers below serve camera frames */
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_ERROR_CHECK(boot_camera.ret);
+
+#if CONFIG_EXAMPLE_ISP_STATS
+    /* Statistics are optional, the streams work without them */
+    if (isp_stats_feed_start() != ESP_OK) {
+        ESP_LOGW(TAG, "ISP statistics not available");
+    }
+#endif
+
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+    /* Recording is optional, streaming goes on without a card */
+    sd_recorder_config_t rec_config = {
+        .source = s_camera.frames,
+        .pixel_format = s_camera.pixel_format,
+        .get_exposure = camera_get_exposure,
+    };
+    if (sd_recorder_start(&rec_config) != ESP_OK) {
+        ESP_LOGW(TAG, "No SD card, recording disabled");
+    }
+#endif
+
+    /* Start HTTP Server */
+    ESP_ERROR_CHECK(init_http_server());
+
+#if CONFIG_EXAMPLE_TCP_STREAM
+    /* The raw TCP sink is optional as well */
+    if (init_tcp_server() != ESP_OK) {
+        ESP_LOGW(TAG, "TCP stream not available");
+    }
+#endif
+
+#if CONFIG_EXAMPLE_UDP_STREAM
+    /* UDP streaming is optional, HTTP keeps working without it */
+    if (init_udp_server() != ESP_OK) {
+        ESP_LOGW(TAG, "UDP stream not available");
+    }
+#endif
+
+    boot_log_phase("servers ready");
 
     ESP_LOGI(TAG, "");
     ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
@@ -383,7 +3349,42 @@ void app_main(void)
     ESP_LOGI(TAG, "║    /         - Info page                           ║");
     ESP_LOGI(TAG, "║    /capture  - Single RAW frame                    ║");
     ESP_LOGI(TAG, "║    /stream   - Continuous stream                   ║");
+    ESP_LOGI(TAG, "║    /stream.preview - Decimated stream              ║");
+#if CONFIG_EXAMPLE_ADAPTIVE_STREAM
+    ESP_LOGI(TAG, "║    /stream.auto - Adaptive stream                  ║");
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_HW_JPEG_VIDEO_DEVICE
+    ESP_LOGI(TAG, "║    /stream.mjpeg - Hardware JPEG stream            ║");
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+    ESP_LOGI(TAG, "║    /stream.lossless - Lossless RAW10 stream        ║");
+#endif
+#if CONFIG_HTTPD_WS_SUPPORT
+    ESP_LOGI(TAG, "║    /ws       - WebSocket stream                    ║");
+#endif
     ESP_LOGI(TAG, "║    /status   - JSON status                         ║");
+    ESP_LOGI(TAG, "║    /buffers  - Capture buffers and memory budget   ║");
+#if CONFIG_EXAMPLE_STREAM_METRICS
+    ESP_LOGI(TAG, "║    /metrics  - Prometheus metrics                  ║");
+#endif
+#if CONFIG_EXAMPLE_TRACE_RING
+    ESP_LOGI(TAG, "║    /trace    - Trace ring dump                     ║");
+#endif
+#if CONFIG_EXAMPLE_ISP_STATS
+    ESP_LOGI(TAG, "║    /isp_stats - ISP statistics (JSON)              ║");
+#endif
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD
+    ESP_LOGI(TAG, "║    /record   - SD recording status and control     ║");
+#endif
+#if CONFIG_EXAMPLE_LATENCY_PROBE
+    ESP_LOGI(TAG, "║    /latency  - LED latency probe                   ║");
+#endif
+#if CONFIG_EXAMPLE_TCP_STREAM
+    ESP_LOGI(TAG, "║  TCP stream on port %-5d (same /stream paths)     ║", CONFIG_EXAMPLE_TCP_STREAM_PORT);
+#endif
+#if CONFIG_EXAMPLE_UDP_STREAM
+    ESP_LOGI(TAG, "║  UDP stream on port %-5d                          ║", CONFIG_EXAMPLE_UDP_STREAM_PORT);
+#endif
     ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
     ESP_LOGI(TAG, "");
     ESP_LOGI(TAG, "Use Python viewer:");
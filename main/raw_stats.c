@@ -0,0 +1,107 @@
+/*
+ * Exposure statistics of RAW10 Bayer frames
+ *
+ * Samples are read straight from the packed frame, a group of five bytes
+ * holds the upper bits of four pixels and their two lower bits each, so no
+ * row is unpacked. The sums are kept in aligned locals and only copied to
+ * the packed record once the frame is done.
+ */
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_check.h"
+#include "raw_stats.h"
+
+#define RAW_STATS_STEP              CONFIG_EXAMPLE_SD_RAW_STATS_STEP
+#define RAW_STATS_SATURATION        CONFIG_EXAMPLE_SD_RAW_STATS_SATURATION
+#define RAW_STATS_BIN_SHIFT         4       /* 10-bit samples to RAW_STATS_BINS bins */
+
+static const char *TAG = "raw_stats";
+
+typedef struct {
+    uint32_t hist[RAW_STATS_CHANNELS][RAW_STATS_BINS];
+    uint32_t sum[RAW_STATS_CHANNELS];
+    uint32_t saturated[RAW_STATS_CHANNELS];
+    uint16_t min[RAW_STATS_CHANNELS];
+    uint16_t max[RAW_STATS_CHANNELS];
+    uint16_t clip_map[RAW_STATS_GRID_ROWS * RAW_STATS_GRID_COLS];
+} raw_stats_acc_t;
+
+static inline void raw_stats_sample(raw_stats_acc_t *acc, uint32_t ch, uint32_t value, uint32_t x, uint32_t cell_row,
+                                    uint32_t width)
+{
+    acc->hist[ch][value >> RAW_STATS_BIN_SHIFT]++;
+    acc->sum[ch] += value;
+    if (value < acc->min[ch]) {
+        acc->min[ch] = value;
+    }
+    if (value > acc->max[ch]) {
+        acc->max[ch] = value;
+    }
+    if (value >= RAW_STATS_SATURATION) {
+        uint16_t *cell = &acc->clip_map[cell_row + x * RAW_STATS_GRID_COLS / width];
+
+        acc->saturated[ch]++;
+        if (*cell < UINT16_MAX) {
+            (*cell)++;
+        }
+    }
+}
+
+esp_err_t raw_stats_compute(const raw_stats_config_t *config, const uint8_t *frame, raw_stats_t *stats)
+{
+    raw_stats_acc_t acc;
+    uint32_t groups = config->width / 4;
+    uint32_t samples = 0;
+
+    ESP_RETURN_ON_FALSE(config->width && config->height && config->width % 4 == 0 && config->height % 2 == 0 &&
+                        config->bytesperline >= config->width * 5 / 4, ESP_ERR_INVALID_ARG, TAG, "invalid geometry");
+
+    memset(&acc, 0, sizeof(acc));
+    for (int ch = 0; ch < RAW_STATS_CHANNELS; ch++) {
+        acc.min[ch] = UINT16_MAX;
+    }
+
+    for (uint32_t y = 0; y < config->height; y += 2 * RAW_STATS_STEP) {
+        for (uint32_t row = 0; row < 2; row++) {
+            const uint8_t *line = frame + (y + row) * config->bytesperline;
+            uint32_t cell_row = (y + row) * RAW_STATS_GRID_ROWS / config->height * RAW_STATS_GRID_COLS;
+            uint32_t ch = row * 2;
+
+            for (uint32_t g = 0; g < groups; g += RAW_STATS_STEP) {
+                const uint8_t *src = line + g * 5;
+                uint32_t x = g * 4;
+                uint8_t lsb = src[4];
+
+                raw_stats_sample(&acc, ch + 0, (src[0] << 2) | ((lsb >> 0) & 0x3), x + 0, cell_row, config->width);
+                raw_stats_sample(&acc, ch + 1, (src[1] << 2) | ((lsb >> 2) & 0x3), x + 1, cell_row, config->width);
+                raw_stats_sample(&acc, ch + 0, (src[2] << 2) | ((lsb >> 4) & 0x3), x + 2, cell_row, config->width);
+                raw_stats_sample(&acc, ch + 1, (src[3] << 2) | ((lsb >> 6) & 0x3), x + 3, cell_row, config->width);
+            }
+        }
+        samples += 2 * ((groups + RAW_STATS_STEP - 1) / RAW_STATS_STEP);
+    }
+
+    memset(stats, 0, sizeof(raw_stats_t));
+    memcpy(stats->magic, RAW_STATS_MAGIC, sizeof(stats->magic));
+    stats->version = RAW_STATS_VERSION;
+    stats->size = sizeof(raw_stats_t);
+    stats->pixel_format = config->pixel_format;
+    stats->step = RAW_STATS_STEP;
+    stats->saturation = RAW_STATS_SATURATION;
+
+    /* A channel has two samples in every sampled group of its row of the pair */
+    for (int ch = 0; ch < RAW_STATS_CHANNELS; ch++) {
+        raw_stats_channel_t *channel = &stats->channel[ch];
+
+        channel->samples = samples;
+        channel->min = acc.min[ch];
+        channel->max = acc.max[ch];
+        channel->mean_x16 = ((uint64_t)acc.sum[ch] * 16 + samples / 2) / samples;
+        channel->saturated = acc.saturated[ch];
+        memcpy(channel->hist, acc.hist[ch], sizeof(channel->hist));
+    }
+    memcpy(stats->clip_map, acc.clip_map, sizeof(stats->clip_map));
+
+    return ESP_OK;
+}
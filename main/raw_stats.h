@@ -0,0 +1,83 @@
+/*
+ * Exposure statistics of RAW10 Bayer frames
+ *
+ * Without the ISP in the data path there are no hardware statistics, so
+ * the CPU samples the packed frame itself: every CONFIG_EXAMPLE_SD_RAW_STATS_STEP-th
+ * pair of rows and every CONFIG_EXAMPLE_SD_RAW_STATS_STEP-th group of four
+ * pixels, which keeps both rows of the Bayer pattern. The statistics of a
+ * frame are one raw_stats_t, saved next to the frames as a sidecar file of
+ * such records. All fields are little endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_STATS_MAGIC             "RSTA"
+#define RAW_STATS_VERSION           1
+#define RAW_STATS_CHANNELS          4       /* CFA positions, channel i is row i >> 1, column i & 1 of the pattern */
+#define RAW_STATS_BINS              64      /* 16 10-bit levels per histogram bin */
+#define RAW_STATS_GRID_COLS         16
+#define RAW_STATS_GRID_ROWS         16
+
+/**
+ * @brief Statistics of one Bayer channel
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t min;                   /*!< Smallest sample, 10-bit LSB */
+    uint16_t max;                   /*!< Largest sample, 10-bit LSB */
+    uint16_t mean_x16;              /*!< Mean in 1/16 LSB */
+    uint32_t samples;               /*!< Samples taken */
+    uint32_t saturated;             /*!< Samples at or above the saturation level */
+    uint32_t hist[RAW_STATS_BINS];  /*!< Histogram of the samples */
+} raw_stats_channel_t;
+
+/**
+ * @brief Statistics of one frame
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];                  /*!< RAW_STATS_MAGIC */
+    uint16_t version;               /*!< RAW_STATS_VERSION */
+    uint16_t size;                  /*!< Size of this structure */
+    uint32_t sequence;              /*!< V4L2 frame sequence number, matches the container index */
+    uint64_t timestamp_us;          /*!< Capture time in microseconds */
+    uint32_t pixel_format;          /*!< V4L2 pixel format, gives the colour of every channel */
+    uint16_t step;                  /*!< Sampling step in row pairs and pixel groups */
+    uint16_t saturation;            /*!< Saturation level, 10-bit LSB */
+    raw_stats_channel_t channel[RAW_STATS_CHANNELS];
+    uint16_t clip_map[RAW_STATS_GRID_ROWS * RAW_STATS_GRID_COLS];   /*!< Saturated samples per cell, row-major */
+} raw_stats_t;
+
+/**
+ * @brief Frame geometry
+ */
+typedef struct {
+    uint32_t width;                 /*!< Frame width in pixels, a multiple of 4 */
+    uint32_t height;                /*!< Frame height, a multiple of 2 */
+    uint32_t bytesperline;          /*!< Packed RAW10 line size */
+    uint32_t pixel_format;          /*!< V4L2 pixel format */
+} raw_stats_config_t;
+
+/**
+ * @brief Compute the statistics of a frame
+ *
+ * The sequence and timestamp are left to the caller.
+ *
+ * @param config Frame geometry
+ * @param frame  Packed RAW10 frame
+ * @param stats  Returned statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the geometry is not RAW10 Bayer
+ */
+esp_err_t raw_stats_compute(const raw_stats_config_t *config, const uint8_t *frame, raw_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
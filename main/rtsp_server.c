@@ -0,0 +1,849 @@
+/*
+ * Minimal RTSP server streaming H.264 over RTP
+ *
+ * Each accepted RTSP connection gets its own session task. Once playing, the
+ * session subscribes to the H.264 broadcaster, splits every access unit into
+ * NAL units and sends them as RTP packets. When frames had to be dropped the
+ * session waits for the next IDR frame so the client never decodes against a
+ * missing reference, and asks the encoder for one instead of waiting a GOP.
+ *
+ * The multicast group has a sender of its own, created at start and running
+ * whether anybody listens or not. Multicast sessions only hand out the group
+ * address and keep their RTSP connection alive.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/base64.h"
+#include "rtsp_server.h"
+#include "task_topology.h"
+
+#define RTSP_SERVER_TASK_STACK_SIZE     4096
+#define RTSP_SESSION_TASK_STACK_SIZE    6144
+#define RTSP_TASK_PRIORITY              TASK_NETWORK_PRIORITY
+#define RTSP_TASK_CORE                  TASK_NETWORK_CORE
+#define RTSP_REQUEST_MAX_SIZE           1024
+#define RTSP_RESPONSE_MAX_SIZE          1024
+#define RTSP_SESSION_TIMEOUT_S          60
+#define RTSP_FRAME_WAIT_MS              20
+#define RTSP_IDLE_POLL_MS               100
+#define RTSP_SEND_TIMEOUT_S             5
+
+#define RTP_PAYLOAD_TYPE                96
+#define RTP_HEADER_SIZE                 12
+#define RTP_MAX_PAYLOAD                 1400
+#define RTP_CLOCK_RATE                  90000
+#define RTP_INTERLEAVED_HEADER_SIZE     4
+
+#define H264_NAL_TYPE(b)                ((b) & 0x1f)
+#define H264_NAL_IDR                    5
+#define H264_NAL_SPS                    7
+#define H264_NAL_PPS                    8
+#define H264_PARAM_SETS_SIZE            128
+#define H264_NAL_FU_A                   28
+
+static const char *TAG = "rtsp_server";
+
+typedef enum {
+    RTSP_TRANSPORT_NONE = 0,
+    RTSP_TRANSPORT_UDP,
+    RTSP_TRANSPORT_TCP,
+    RTSP_TRANSPORT_MULTICAST,
+} rtsp_transport_t;
+
+typedef struct {
+    int sock;
+    struct sockaddr_in6 peer;
+    char request[RTSP_REQUEST_MAX_SIZE + 1];
+    size_t request_len;
+
+    uint32_t session_id;
+    rtsp_transport_t transport;
+    bool playing;
+    bool closing;
+    int64_t last_activity_us;
+
+    /* UDP transport */
+    int rtp_sock;
+    struct sockaddr_in6 rtp_dest;
+    uint16_t server_rtp_port;
+    uint16_t client_rtp_port;
+
+    /* TCP interleaved transport */
+    uint8_t rtp_channel;
+
+    /* RTP state */
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t ts_base;
+    int64_t first_frame_us;
+    bool need_idr;
+    uint32_t last_dropped;
+
+    frame_subscriber_t *sub;
+    uint8_t packet[RTP_INTERLEAVED_HEADER_SIZE + RTP_HEADER_SIZE + RTP_MAX_PAYLOAD];
+} rtsp_session_t;
+
+static rtsp_server_config_t s_config;
+static _Atomic uint32_t s_session_count;
+static rtsp_session_t *s_multicast;     /* Sender of the multicast group, NULL without one */
+
+static void rtsp_request_key_frame(rtsp_session_t *session)
+{
+    session->need_idr = true;
+    if (s_config.request_key_frame) {
+        s_config.request_key_frame(s_config.arg);
+    }
+}
+
+/* ========== Socket helpers ========== */
+
+static esp_err_t sock_send_all(int sock, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len) {
+        int n = send(sock, p, len, 0);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return ESP_OK;
+}
+
+static void rtsp_get_local_addr(int sock, char *buf, size_t len)
+{
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0 &&
+            inet_ntop(AF_INET6, &addr.sin6_addr, buf, len)) {
+        /* Strip the IPv4-mapped prefix */
+        if (!strncmp(buf, "::ffff:", 7)) {
+            memmove(buf, buf + 7, strlen(buf + 7) + 1);
+        }
+    } else {
+        strlcpy(buf, "0.0.0.0", len);
+    }
+}
+
+/* ========== RTP packetization ========== */
+
+static esp_err_t rtp_send_packet(rtsp_session_t *session, const uint8_t *hdr, size_t hdr_len,
+                                 const uint8_t *payload, size_t payload_len, bool marker, uint32_t ts)
+{
+    uint8_t *rtp = session->packet + RTP_INTERLEAVED_HEADER_SIZE;
+    size_t rtp_len = RTP_HEADER_SIZE + hdr_len + payload_len;
+
+    rtp[0] = 0x80;
+    rtp[1] = (marker ? 0x80 : 0x00) | RTP_PAYLOAD_TYPE;
+    rtp[2] = session->seq >> 8;
+    rtp[3] = session->seq & 0xff;
+    rtp[4] = ts >> 24;
+    rtp[5] = (ts >> 16) & 0xff;
+    rtp[6] = (ts >> 8) & 0xff;
+    rtp[7] = ts & 0xff;
+    rtp[8] = session->ssrc >> 24;
+    rtp[9] = (session->ssrc >> 16) & 0xff;
+    rtp[10] = (session->ssrc >> 8) & 0xff;
+    rtp[11] = session->ssrc & 0xff;
+    memcpy(rtp + RTP_HEADER_SIZE, hdr, hdr_len);
+    memcpy(rtp + RTP_HEADER_SIZE + hdr_len, payload, payload_len);
+    session->seq++;
+
+    if (session->transport == RTSP_TRANSPORT_TCP) {
+        uint8_t *frame = session->packet;
+
+        frame[0] = '$';
+        frame[1] = session->rtp_channel;
+        frame[2] = rtp_len >> 8;
+        frame[3] = rtp_len & 0xff;
+        return sock_send_all(session->sock, frame, RTP_INTERLEAVED_HEADER_SIZE + rtp_len);
+    }
+
+    if (sendto(session->rtp_sock, rtp, rtp_len, 0, (struct sockaddr *)&session->rtp_dest,
+               sizeof(session->rtp_dest)) < 0) {
+        /* UDP is lossy anyway, only a full send buffer is expected here */
+        if (errno != ENOMEM && errno != EAGAIN) {
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t rtp_send_nal(rtsp_session_t *session, const uint8_t *nal, size_t len, bool last, uint32_t ts)
+{
+    if (len <= RTP_MAX_PAYLOAD) {
+        return rtp_send_packet(session, NULL, 0, nal, len, last, ts);
+    }
+
+    /* FU-A fragmentation, the NAL header is rebuilt from the FU indicator and header */
+    uint8_t fu[2];
+    const uint8_t *p = nal + 1;
+    size_t remaining = len - 1;
+    bool start = true;
+
+    fu[0] = (nal[0] & 0xe0) | H264_NAL_FU_A;
+    while (remaining) {
+        size_t chunk = MIN(remaining, RTP_MAX_PAYLOAD - sizeof(fu));
+        bool end = chunk == remaining;
+
+        fu[1] = (start ? 0x80 : 0x00) | (end ? 0x40 : 0x00) | H264_NAL_TYPE(nal[0]);
+        ESP_RETURN_ON_ERROR(rtp_send_packet(session, fu, sizeof(fu), p, chunk, end && last, ts), TAG, "send failed");
+
+        p += chunk;
+        remaining -= chunk;
+        start = false;
+    }
+
+    return ESP_OK;
+}
+
+/* Find the next Annex-B start code, returns the NAL start or NULL */
+static const uint8_t *h264_next_nal(const uint8_t *p, const uint8_t *end)
+{
+    while (p + 3 <= end) {
+        if (p[0] == 0 && p[1] == 0) {
+            if (p[2] == 1) {
+                return p + 3;
+            } else if (p[2] == 0 && p + 4 <= end && p[3] == 1) {
+                return p + 4;
+            }
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+static bool h264_is_keyframe(const uint8_t *data, size_t size)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *nal = h264_next_nal(data, end);
+
+    while (nal && nal < end) {
+        uint8_t type = H264_NAL_TYPE(nal[0]);
+        if (type == H264_NAL_IDR || type == H264_NAL_SPS) {
+            return true;
+        }
+        nal = h264_next_nal(nal, end);
+    }
+
+    return false;
+}
+
+static esp_err_t rtp_send_access_unit(rtsp_session_t *session, const frame_t *frame)
+{
+    const uint8_t *end = frame->data + frame->size;
+    const uint8_t *nal = h264_next_nal(frame->data, end);
+    uint32_t ts;
+
+    if (!session->first_frame_us) {
+        session->first_frame_us = frame->timestamp_us;
+    }
+    ts = session->ts_base + (uint32_t)((frame->timestamp_us - session->first_frame_us) * RTP_CLOCK_RATE / 1000000);
+
+    while (nal) {
+        const uint8_t *next = h264_next_nal(nal, end);
+        const uint8_t *nal_end = end;
+
+        if (next) {
+            /* Back up over the start code and any trailing zero byte */
+            nal_end = next - 3;
+            while (nal_end > nal && nal_end[-1] == 0) {
+                nal_end--;
+            }
+        }
+
+        if (nal_end > nal) {
+            ESP_RETURN_ON_ERROR(rtp_send_nal(session, nal, nal_end - nal, !next, ts), TAG, "send failed");
+        }
+        nal = next;
+    }
+
+    return ESP_OK;
+}
+
+/* ========== RTSP protocol ========== */
+
+static const char *rtsp_get_header(const char *request, const char *name, char *value, size_t len)
+{
+    size_t name_len = strlen(name);
+    const char *line = strstr(request, "\r\n");
+
+    while (line && line[2] != '\r') {
+        line += 2;
+        if (!strncasecmp(line, name, name_len) && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            const char *eol = strstr(v, "\r\n");
+
+            while (*v == ' ') {
+                v++;
+            }
+            size_t n = MIN((size_t)(eol - v), len - 1);
+            memcpy(value, v, n);
+            value[n] = '\0';
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+static esp_err_t rtsp_send_response(rtsp_session_t *session, int cseq, const char *status,
+                                    const char *headers, const char *body)
+{
+    char response[RTSP_RESPONSE_MAX_SIZE];
+    size_t body_len = body ? strlen(body) : 0;
+    int len;
+
+    len = snprintf(response, sizeof(response), "RTSP/1.0 %s\r\nCSeq: %d\r\n%s", status, cseq, headers ? headers : "");
+    if (session->session_id && len < sizeof(response)) {
+        len += snprintf(response + len, sizeof(response) - len, "Session: %08"PRIx32";timeout=%d\r\n",
+                        session->session_id, RTSP_SESSION_TIMEOUT_S);
+    }
+    if (body_len && len < sizeof(response)) {
+        len += snprintf(response + len, sizeof(response) - len, "Content-Length: %u\r\n", (unsigned)body_len);
+    }
+    if (len < sizeof(response)) {
+        len += snprintf(response + len, sizeof(response) - len, "\r\n");
+    }
+    ESP_RETURN_ON_FALSE(len < sizeof(response), ESP_ERR_NO_MEM, TAG, "response too long");
+
+    ESP_RETURN_ON_ERROR(sock_send_all(session->sock, response, len), TAG, "failed to send response");
+    if (body_len) {
+        ESP_RETURN_ON_ERROR(sock_send_all(session->sock, body, body_len), TAG, "failed to send body");
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Format the profile-level-id and sprop-parameter-sets of the fmtp line (RFC 6184),
+ * so a client can set up its decoder before the first IDR frame arrives
+ */
+static void sdp_format_param_sets(char *fmtp, size_t size)
+{
+    uint8_t sets[H264_PARAM_SETS_SIZE];
+    size_t sets_size;
+    const uint8_t *end;
+    const uint8_t *nal;
+    const uint8_t *sps = NULL;
+    size_t len = 0;
+
+    fmtp[0] = '\0';
+    if (!s_config.get_param_sets || !(sets_size = s_config.get_param_sets(sets, sizeof(sets), s_config.arg))) {
+        return;
+    }
+
+    end = sets + sets_size;
+    for (nal = h264_next_nal(sets, end); nal; ) {
+        const uint8_t *next = h264_next_nal(nal, end);
+        const uint8_t *nal_end = next ? next - 3 : end;
+        uint8_t type = H264_NAL_TYPE(nal[0]);
+        size_t olen;
+
+        while (nal_end > nal && !nal_end[-1]) {
+            nal_end--;
+        }
+
+        if (type == H264_NAL_SPS && nal_end - nal >= 4) {
+            sps = nal;
+        }
+        if ((type == H264_NAL_SPS || type == H264_NAL_PPS) && len + 2 < size) {
+            len += snprintf(fmtp + len, size - len, "%s", len ? "," : ";sprop-parameter-sets=");
+            if (len < size && mbedtls_base64_encode((unsigned char *)fmtp + len, size - len, &olen, nal, nal_end - nal) == 0) {
+                len += olen;
+            } else {
+                fmtp[0] = '\0';
+                return;
+            }
+        }
+        nal = next;
+    }
+
+    if (sps && len < size) {
+        snprintf(fmtp + len, size - len, ";profile-level-id=%02X%02X%02X", sps[1], sps[2], sps[3]);
+    }
+}
+
+static esp_err_t rtsp_handle_describe(rtsp_session_t *session, int cseq, const char *url)
+{
+    char sdp[768];
+    char fmtp[320];
+    char headers[256];
+    char addr[INET6_ADDRSTRLEN];
+
+    rtsp_get_local_addr(session->sock, addr, sizeof(addr));
+    sdp_format_param_sets(fmtp, sizeof(fmtp));
+    snprintf(sdp, sizeof(sdp),
+             "v=0\r\n"
+             "o=- %"PRIu32" 1 IN IP4 %s\r\n"
+             "s=%s\r\n"
+             "c=IN IP4 0.0.0.0\r\n"
+             "t=0 0\r\n"
+             "a=control:*\r\n"
+             "m=video 0 RTP/AVP %d\r\n"
+             "a=rtpmap:%d H264/%d\r\n"
+             "a=fmtp:%d packetization-mode=1%s\r\n"
+             "a=control:trackID=0\r\n",
+             esp_random(), addr, s_config.name ? s_config.name : "ESP video",
+             RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE, RTP_CLOCK_RATE, RTP_PAYLOAD_TYPE, fmtp);
+    snprintf(headers, sizeof(headers), "Content-Base: %s/\r\nContent-Type: application/sdp\r\n", url);
+
+    return rtsp_send_response(session, cseq, "200 OK", headers, sdp);
+}
+
+static esp_err_t rtsp_setup_udp(rtsp_session_t *session, const char *transport)
+{
+    const char *p = strstr(transport, "client_port=");
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
+
+    ESP_RETURN_ON_FALSE(p, ESP_ERR_INVALID_ARG, TAG, "no client_port in transport");
+    session->client_rtp_port = atoi(p + strlen("client_port="));
+
+    if (session->rtp_sock < 0) {
+        session->rtp_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+        ESP_RETURN_ON_FALSE(session->rtp_sock >= 0, ESP_FAIL, TAG, "failed to create RTP socket");
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = 0;
+        ESP_RETURN_ON_FALSE(bind(session->rtp_sock, (struct sockaddr *)&addr, sizeof(addr)) == 0, ESP_FAIL,
+                            TAG, "failed to bind RTP socket");
+        ESP_RETURN_ON_FALSE(getsockname(session->rtp_sock, (struct sockaddr *)&addr, &addr_len) == 0, ESP_FAIL,
+                            TAG, "failed to get RTP port");
+        session->server_rtp_port = ntohs(addr.sin6_port);
+    }
+
+    session->rtp_dest = session->peer;
+    session->rtp_dest.sin6_port = htons(session->client_rtp_port);
+    session->transport = RTSP_TRANSPORT_UDP;
+
+    return ESP_OK;
+}
+
+static esp_err_t rtsp_handle_setup(rtsp_session_t *session, int cseq)
+{
+    char transport[128];
+    char headers[192];
+
+    if (!rtsp_get_header(session->request, "Transport", transport, sizeof(transport))) {
+        return rtsp_send_response(session, cseq, "461 Unsupported Transport", NULL, NULL);
+    }
+
+    if (strstr(transport, "RTP/AVP/TCP")) {
+        const char *p = strstr(transport, "interleaved=");
+
+        session->rtp_channel = p ? atoi(p + strlen("interleaved=")) : 0;
+        session->transport = RTSP_TRANSPORT_TCP;
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u;ssrc=%08"PRIX32"\r\n",
+                 session->rtp_channel, session->rtp_channel + 1, session->ssrc);
+    } else if (strstr(transport, "multicast") && s_multicast) {
+        session->transport = RTSP_TRANSPORT_MULTICAST;
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP;multicast;destination=%s;port=%u-%u;ttl=%u;ssrc=%08"PRIX32"\r\n",
+                 s_config.multicast_addr, s_config.multicast_port, s_config.multicast_port + 1,
+                 s_config.multicast_ttl, s_multicast->ssrc);
+    } else if (rtsp_setup_udp(session, transport) == ESP_OK) {
+        snprintf(headers, sizeof(headers),
+                 "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08"PRIX32"\r\n",
+                 session->client_rtp_port, session->client_rtp_port + 1,
+                 session->server_rtp_port, session->server_rtp_port + 1, session->ssrc);
+    } else {
+        return rtsp_send_response(session, cseq, "461 Unsupported Transport", NULL, NULL);
+    }
+
+    if (!session->session_id) {
+        session->session_id = esp_random() | 1;
+    }
+
+    return rtsp_send_response(session, cseq, "200 OK", headers, NULL);
+}
+
+static esp_err_t rtsp_subscribe(rtsp_session_t *session, const char *name)
+{
+    frame_subscriber_config_t sub_config = {
+        .policy = FRAME_DELIVERY_DROP_OLDEST,
+        .queue_depth = 2,
+        .name = name,
+    };
+
+    session->sub = frame_broadcaster_subscribe(s_config.source, &sub_config);
+    ESP_RETURN_ON_FALSE(session->sub, ESP_ERR_NO_MEM, TAG, "failed to subscribe %s", name);
+    session->last_dropped = 0;
+    rtsp_request_key_frame(session);
+
+    return ESP_OK;
+}
+
+static esp_err_t rtsp_handle_play(rtsp_session_t *session, int cseq, const char *url)
+{
+    char headers[256];
+    char name[FRAME_SUBSCRIBER_NAME_LEN];
+    /* Multicast viewers join a running stream */
+    rtsp_session_t *rtp = session->transport == RTSP_TRANSPORT_MULTICAST ? s_multicast : session;
+
+    if (session->transport == RTSP_TRANSPORT_NONE) {
+        return rtsp_send_response(session, cseq, "455 Method Not Valid in This State", NULL, NULL);
+    }
+
+    if (rtp == session && !session->sub) {
+        snprintf(name, sizeof(name), "rtsp-%08"PRIx32, session->session_id);
+        if (rtsp_subscribe(session, name) != ESP_OK) {
+            return rtsp_send_response(session, cseq, "503 Service Unavailable", NULL, NULL);
+        }
+    }
+
+    snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%s;seq=%u;rtptime=%"PRIu32"\r\n",
+             url, rtp->seq, rtp->ts_base);
+    session->playing = true;
+
+    return rtsp_send_response(session, cseq, "200 OK", headers, NULL);
+}
+
+static esp_err_t rtsp_handle_request(rtsp_session_t *session)
+{
+    char method[16];
+    char url[128];
+    char cseq_str[16];
+    int cseq = 0;
+
+    if (sscanf(session->request, "%15s %127s", method, url) != 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (rtsp_get_header(session->request, "CSeq", cseq_str, sizeof(cseq_str))) {
+        cseq = atoi(cseq_str);
+    }
+
+    ESP_LOGD(TAG, "%s %s", method, url);
+
+    if (!strcmp(method, "OPTIONS")) {
+        return rtsp_send_response(session, cseq, "200 OK",
+                                  "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n", NULL);
+    } else if (!strcmp(method, "DESCRIBE")) {
+        return rtsp_handle_describe(session, cseq, url);
+    } else if (!strcmp(method, "SETUP")) {
+        return rtsp_handle_setup(session, cseq);
+    } else if (!strcmp(method, "PLAY")) {
+        return rtsp_handle_play(session, cseq, url);
+    } else if (!strcmp(method, "TEARDOWN")) {
+        session->closing = true;
+        return rtsp_send_response(session, cseq, "200 OK", NULL, NULL);
+    } else if (!strcmp(method, "GET_PARAMETER") || !strcmp(method, "SET_PARAMETER")) {
+        return rtsp_send_response(session, cseq, "200 OK", NULL, NULL);
+    }
+
+    return rtsp_send_response(session, cseq, "501 Not Implemented", NULL, NULL);
+}
+
+/* Consume complete requests (and interleaved RTCP) from the receive buffer */
+static esp_err_t rtsp_process_input(rtsp_session_t *session)
+{
+    while (session->request_len) {
+        char *req = session->request;
+
+        if (req[0] == '$') {
+            /* Interleaved RTCP receiver report from the client, skip it */
+            if (session->request_len < RTP_INTERLEAVED_HEADER_SIZE) {
+                break;
+            }
+            size_t frame_len = RTP_INTERLEAVED_HEADER_SIZE + (((uint8_t)req[2] << 8) | (uint8_t)req[3]);
+            if (session->request_len < frame_len) {
+                if (frame_len > RTSP_REQUEST_MAX_SIZE) {
+                    /* Too large to buffer, drop what we have, the stream re-syncs on the next text request */
+                    session->request_len = 0;
+                }
+                break;
+            }
+            memmove(req, req + frame_len, session->request_len - frame_len);
+            session->request_len -= frame_len;
+            continue;
+        }
+
+        req[session->request_len] = '\0';
+        char *end = strstr(req, "\r\n\r\n");
+        if (!end) {
+            ESP_RETURN_ON_FALSE(session->request_len < RTSP_REQUEST_MAX_SIZE, ESP_ERR_INVALID_SIZE, TAG,
+                                "request too large");
+            break;
+        }
+
+        /* Requests from common clients carry no body we need, skip it if present */
+        size_t req_len = end + 4 - req;
+        char content_len[16];
+        end[2] = '\0';
+        if (rtsp_get_header(req, "Content-Length", content_len, sizeof(content_len))) {
+            req_len += atoi(content_len);
+        }
+        if (req_len > session->request_len) {
+            end[2] = '\r';
+            break;
+        }
+
+        ESP_RETURN_ON_ERROR(rtsp_handle_request(session), TAG, "failed to handle request");
+
+        memmove(req, req + req_len, session->request_len - req_len);
+        session->request_len -= req_len;
+    }
+
+    return ESP_OK;
+}
+
+/* Wait up to timeout_ms for control data, returns ESP_FAIL if the connection is gone */
+static esp_err_t rtsp_poll_control(rtsp_session_t *session, uint32_t timeout_ms)
+{
+    fd_set rfds;
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    FD_ZERO(&rfds);
+    FD_SET(session->sock, &rfds);
+    if (select(session->sock + 1, &rfds, NULL, NULL, &tv) <= 0) {
+        return ESP_OK;
+    }
+
+    int n = recv(session->sock, session->request + session->request_len,
+                 RTSP_REQUEST_MAX_SIZE - session->request_len, 0);
+    if (n <= 0) {
+        return ESP_FAIL;
+    }
+
+    session->request_len += n;
+    session->last_activity_us = esp_timer_get_time();
+
+    return rtsp_process_input(session);
+}
+
+static esp_err_t rtsp_stream_frame(rtsp_session_t *session)
+{
+    const frame_t *frame;
+    frame_subscriber_stats_t stats;
+    esp_err_t ret = ESP_OK;
+
+    if (frame_subscriber_wait(session->sub, &frame, pdMS_TO_TICKS(RTSP_FRAME_WAIT_MS)) != ESP_OK) {
+        return ESP_OK;
+    }
+
+    /* After a drop the decoder is missing references, resume at the next keyframe */
+    if (frame_subscriber_get_stats(session->sub, &stats) == ESP_OK && stats.dropped != session->last_dropped) {
+        session->last_dropped = stats.dropped;
+        rtsp_request_key_frame(session);
+    }
+
+    if (session->need_idr && h264_is_keyframe(frame->data, frame->size)) {
+        session->need_idr = false;
+    }
+
+    if (!session->need_idr) {
+        ret = rtp_send_access_unit(session, frame);
+    }
+
+    frame_subscriber_release(session->sub, frame);
+    return ret;
+}
+
+static void rtsp_session_task(void *arg)
+{
+    rtsp_session_t *session = (rtsp_session_t *)arg;
+    char peer[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, &session->peer.sin6_addr, peer, sizeof(peer));
+    ESP_LOGI(TAG, "Session from %s started", peer);
+
+    while (!session->closing) {
+        bool streaming = session->playing && session->sub;
+
+        if (rtsp_poll_control(session, streaming ? 0 : RTSP_IDLE_POLL_MS) != ESP_OK) {
+            break;
+        }
+
+        if (streaming && !session->closing) {
+            if (rtsp_stream_frame(session) != ESP_OK) {
+                break;
+            }
+        }
+
+        /* UDP clients only show they are alive through RTSP keep-alive requests */
+        if ((session->transport == RTSP_TRANSPORT_UDP || session->transport == RTSP_TRANSPORT_MULTICAST) &&
+                esp_timer_get_time() - session->last_activity_us > RTSP_SESSION_TIMEOUT_S * 1000000LL) {
+            ESP_LOGW(TAG, "Session %08"PRIx32" timed out", session->session_id);
+            break;
+        }
+    }
+
+    ESP_LOGI(TAG, "Session from %s closed", peer);
+
+    frame_broadcaster_unsubscribe(session->sub);
+    if (session->rtp_sock >= 0) {
+        close(session->rtp_sock);
+    }
+    close(session->sock);
+    free(session);
+    s_session_count--;
+    vTaskDelete(NULL);
+}
+
+/* One sender for every multicast viewer, the device load does not depend on their number */
+static void rtsp_multicast_task(void *arg)
+{
+    rtsp_session_t *session = (rtsp_session_t *)arg;
+
+    while (true) {
+        if (rtsp_stream_frame(session) != ESP_OK) {
+            /* No route while the link is down, the group gets the stream again once it is back */
+            vTaskDelay(pdMS_TO_TICKS(RTSP_IDLE_POLL_MS));
+        }
+    }
+}
+
+static esp_err_t rtsp_multicast_start(void)
+{
+    uint8_t ttl = s_config.multicast_ttl;
+    struct in_addr group;
+    rtsp_session_t *session;
+
+    ESP_RETURN_ON_FALSE(inet_aton(s_config.multicast_addr, &group) && IN_MULTICAST(ntohl(group.s_addr)),
+                        ESP_ERR_INVALID_ARG, TAG, "%s is not a multicast group", s_config.multicast_addr);
+    session = calloc(1, sizeof(rtsp_session_t));
+    ESP_RETURN_ON_FALSE(session, ESP_ERR_NO_MEM, TAG, "no memory for multicast sender");
+
+    /* IPv4-mapped destination, the RTP path is the one of the unicast UDP sessions */
+    session->sock = -1;
+    session->transport = RTSP_TRANSPORT_UDP;
+    session->rtp_dest.sin6_family = AF_INET6;
+    session->rtp_dest.sin6_port = htons(s_config.multicast_port);
+    session->rtp_dest.sin6_addr.un.u32_addr[2] = htonl(0xffff);
+    session->rtp_dest.sin6_addr.un.u32_addr[3] = group.s_addr;
+    session->ssrc = esp_random();
+    session->seq = esp_random() & 0xffff;
+    session->ts_base = esp_random();
+
+    session->rtp_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (session->rtp_sock < 0) {
+        free(session);
+        ESP_LOGE(TAG, "failed to create multicast socket");
+        return ESP_FAIL;
+    }
+    setsockopt(session->rtp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    if (rtsp_subscribe(session, "rtsp-multicast") != ESP_OK ||
+            xTaskCreatePinnedToCore(rtsp_multicast_task, "rtsp_mcast", RTSP_SESSION_TASK_STACK_SIZE, session,
+                                    RTSP_TASK_PRIORITY, NULL, RTSP_TASK_CORE) != pdPASS) {
+        frame_broadcaster_unsubscribe(session->sub);
+        close(session->rtp_sock);
+        free(session);
+        ESP_LOGE(TAG, "failed to start multicast sender");
+        return ESP_FAIL;
+    }
+
+    s_multicast = session;
+    ESP_LOGI(TAG, "RTP multicast to %s:%u, ttl %u", s_config.multicast_addr, s_config.multicast_port, ttl);
+    return ESP_OK;
+}
+
+static void rtsp_server_task(void *arg)
+{
+    int listen_sock = (int)(intptr_t)arg;
+
+    while (true) {
+        struct sockaddr_in6 peer;
+        socklen_t peer_len = sizeof(peer);
+        int sock = accept(listen_sock, (struct sockaddr *)&peer, &peer_len);
+
+        if (sock < 0) {
+            ESP_LOGE(TAG, "accept failed (errno=%d)", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (s_session_count >= s_config.max_sessions) {
+            ESP_LOGW(TAG, "Too many sessions, rejecting client");
+            close(sock);
+            continue;
+        }
+
+        rtsp_session_t *session = calloc(1, sizeof(rtsp_session_t));
+        if (!session) {
+            close(sock);
+            continue;
+        }
+
+        struct timeval tv = { .tv_sec = RTSP_SEND_TIMEOUT_S };
+        int nodelay = 1;
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        session->sock = sock;
+        session->peer = peer;
+        session->rtp_sock = -1;
+        session->ssrc = esp_random();
+        session->seq = esp_random() & 0xffff;
+        session->ts_base = esp_random();
+        session->last_activity_us = esp_timer_get_time();
+
+        s_session_count++;
+        if (xTaskCreatePinnedToCore(rtsp_session_task, "rtsp_session", RTSP_SESSION_TASK_STACK_SIZE, session,
+                                    RTSP_TASK_PRIORITY, NULL, RTSP_TASK_CORE) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create session task");
+            s_session_count--;
+            close(sock);
+            free(session);
+        }
+    }
+}
+
+esp_err_t rtsp_server_start(const rtsp_server_config_t *config)
+{
+    int sock;
+    int opt = 1;
+    esp_err_t ret = ESP_OK;
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+    };
+
+    ESP_RETURN_ON_FALSE(config && config->source && config->max_sessions, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    s_config = *config;
+
+    sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    ESP_RETURN_ON_FALSE(sock >= 0, ESP_FAIL, TAG, "failed to create socket");
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    addr.sin6_port = htons(config->port);
+    ESP_GOTO_ON_FALSE(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0, ESP_FAIL, fail, TAG,
+                      "failed to bind port %u", config->port);
+    ESP_GOTO_ON_FALSE(listen(sock, 2) == 0, ESP_FAIL, fail, TAG, "failed to listen");
+    if (config->multicast_addr) {
+        ESP_GOTO_ON_ERROR(rtsp_multicast_start(), fail, TAG, "failed to start multicast");
+    }
+
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(rtsp_server_task, "rtsp_server", RTSP_SERVER_TASK_STACK_SIZE,
+                                              (void *)(intptr_t)sock, RTSP_TASK_PRIORITY, NULL, RTSP_TASK_CORE) == pdPASS,
+                      ESP_ERR_NO_MEM, fail, TAG, "failed to create server task");
+
+    ESP_LOGI(TAG, "RTSP server listening on port %u", config->port);
+    return ESP_OK;
+
+fail:
+    close(sock);
+    return ret;
+}
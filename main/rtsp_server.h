@@ -0,0 +1,53 @@
+/*
+ * Minimal RTSP server streaming H.264 over RTP
+ *
+ * Supports OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN and GET_PARAMETER with
+ * one H.264 video track. RTP is sent over UDP, or interleaved on the RTSP TCP
+ * connection when the client asks for it. With a multicast group configured,
+ * the stream is also sent once to the group and clients asking for a
+ * multicast transport share it. NAL units are packetized as single NAL unit
+ * packets or FU-A fragments (RFC 6184, packetization-mode=1).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief RTSP server configuration
+ */
+typedef struct {
+    uint16_t port;                          /*!< RTSP listening port */
+    uint32_t max_sessions;                  /*!< Maximum number of concurrent sessions */
+    frame_broadcaster_handle_t source;      /*!< Broadcaster of H.264 Annex-B access units */
+    const char *name;                       /*!< Session name in the SDP, can be NULL */
+    void (*request_key_frame)(void *arg);   /*!< Called when a session waits for an IDR frame, can be NULL */
+    size_t (*get_param_sets)(uint8_t *buf, size_t size, void *arg);
+                                            /*!< Copies the Annex-B SPS and PPS for the SDP, returns their size, can be NULL */
+    void *arg;                              /*!< Argument of request_key_frame and get_param_sets */
+    const char *multicast_addr;             /*!< IPv4 multicast group, NULL to stream unicast only */
+    uint16_t multicast_port;                /*!< RTP port of the multicast group */
+    uint8_t multicast_ttl;                  /*!< Router hops the multicast packets may cross */
+} rtsp_server_config_t;
+
+/**
+ * @brief Start the RTSP server task
+ *
+ * @param config Server configuration
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if failed
+ */
+esp_err_t rtsp_server_start(const rtsp_server_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
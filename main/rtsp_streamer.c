@@ -0,0 +1,555 @@
+/*
+ * RTSP H.264 Streaming Server for IMX662
+ *
+ * Pipeline:
+ *   RAW10 (sensor) → ISP → YUV420 → H.264 (hardware M2M device) → RTP/RTSP
+ *
+ * The camera frames are published by the capture broadcaster, the encoder
+ * task feeds the latest one to /dev/video11 and publishes the resulting access
+ * units on a second broadcaster that the RTSP sessions subscribe to.
+ *
+ * The RTSP service, and the multicast group when enabled, are announced over
+ * mDNS so viewers find the camera without knowing its address.
+ *
+ * With CONFIG_EXAMPLE_RTSP_RECORD a recorder task subscribes to the access
+ * units as well and writes them to the SD card as fragmented MP4.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "mdns.h"
+#include "protocol_examples_common.h"
+#include "example_video_common.h"
+#include "frame_broadcaster.h"
+#include "capture_buffers.h"
+#include "rtsp_server.h"
+#include "task_topology.h"
+#if CONFIG_EXAMPLE_RTSP_RECORD
+#include <sys/stat.h>
+#include "sd_card.h"
+#include "fmp4_writer.h"
+#endif
+
+/* Configuration */
+#define H264_BUFFER_COUNT       2   /* The H.264 device sizes each capture buffer at width * height * 4 */
+#define FRAME_WIDTH             1936
+#define FRAME_HEIGHT            1100
+#define H264_ALIGN              16  /* The hardware encoder needs 16-pixel aligned dimensions */
+#define H264_TASK_STACK_SIZE    4096
+#define H264_TASK_PRIORITY      TASK_ENCODE_PRIORITY
+#define H264_TASK_CORE          TASK_ENCODE_CORE
+#define KEY_FRAME_MIN_INTERVAL_US   500000  /* Sessions losing frames must not turn the stream into IDR frames */
+#define PARAM_SETS_SIZE         128
+
+#if CONFIG_EXAMPLE_RTSP_RECORD
+#define MOUNT_POINT             SD_CARD_MOUNT_POINT
+#define RECORD_MAX_FILES        2
+#define RECORD_BUFFER_SIZE      (CONFIG_EXAMPLE_RTSP_RECORD_BUFFER_KB * 1024)
+#define RECORD_SEGMENT_US       (CONFIG_EXAMPLE_RTSP_RECORD_SEGMENT_MIN * 60 * 1000000LL)
+#define RECORD_TASK_STACK_SIZE  4096
+#define RECORD_TASK_PRIORITY    TASK_ENCODE_PRIORITY
+#define RECORD_TASK_CORE        TASK_CAPTURE_CORE
+#endif
+
+static const char *TAG = "rtsp_streamer";
+
+/* Camera state */
+typedef struct {
+    int fd;
+    capture_buffers_t bufs;
+    uint32_t width;
+    uint32_t height;
+    frame_broadcaster_handle_t frames;
+} camera_t;
+
+/* H.264 encoder state */
+typedef struct {
+    int fd;
+    uint8_t *buffer[H264_BUFFER_COUNT];
+    uint32_t width;
+    uint32_t height;
+    SemaphoreHandle_t free_sem;     /* Counts capture buffers queued to the device */
+    frame_broadcaster_handle_t frames;
+    atomic_bool key_frame_request;  /* An RTSP session waits for an IDR frame */
+    int64_t last_key_frame_us;
+    portMUX_TYPE param_sets_lock;
+    size_t param_sets_size;         /* SPS and PPS read from the device after the first frame */
+    uint8_t param_sets[PARAM_SETS_SIZE];
+} encoder_t;
+
+static camera_t s_camera = {.fd = -1};
+static encoder_t s_encoder = {.fd = -1, .param_sets_lock = portMUX_INITIALIZER_UNLOCKED};
+
+/* ========== Camera Functions ========== */
+static esp_err_t init_camera(void)
+{
+    int fd;
+    struct v4l2_format format;
+    capture_buffers_config_t buffers_config = CAPTURE_BUFFERS_DEFAULT_CONFIG();
+
+    ESP_LOGI(TAG, "Initializing camera...");
+
+    ESP_RETURN_ON_ERROR(example_video_init(), TAG, "Failed to init video");
+
+    fd = open(ESP_VIDEO_MIPI_CSI_DEVICE_NAME, O_RDWR);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to open video device");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* YUV420 output from the ISP, the only input format of the H.264 device */
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = FRAME_WIDTH;
+    format.fmt.pix.height = FRAME_HEIGHT;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, TAG, "Failed to set YUV420 format");
+
+    s_camera.fd = fd;
+    s_camera.width = format.fmt.pix.width;
+    s_camera.height = format.fmt.pix.height;
+
+    /* YUV420 frames are 3.2 MB each */
+    ESP_RETURN_ON_ERROR(capture_buffers_alloc(fd, &buffers_config, &s_camera.bufs), TAG, "Failed to allocate buffers");
+
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "STREAMON failed");
+
+    ESP_RETURN_ON_ERROR(frame_broadcaster_start_capture(&s_camera.bufs, &s_camera.frames),
+                        TAG, "Failed to start frame broadcaster");
+
+    ESP_LOGI(TAG, "Camera initialized, %"PRIu32"x%"PRIu32" YUV420", s_camera.width, s_camera.height);
+    return ESP_OK;
+}
+
+/* ========== H.264 Encoder ========== */
+static esp_err_t set_codec_control(int fd, uint32_t id, int32_t value, const char *name)
+{
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_CODEC_CLASS;
+    controls.count = 1;
+    controls.controls = control;
+    control[0].id = id;
+    control[0].value = value;
+    if (ioctl(fd, VIDIOC_S_EXT_CTRLS, &controls) != 0) {
+        ESP_LOGW(TAG, "Failed to set H.264 %s", name);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static void encoder_queue_capture_buffer(uint32_t index, void *arg)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(s_encoder.fd, VIDIOC_QBUF, &buf) != 0) {
+        ESP_LOGE(TAG, "QBUF H.264 %"PRIu32" failed (errno=%d)", index, errno);
+        return;
+    }
+
+    xSemaphoreGive(s_encoder.free_sem);
+}
+
+static esp_err_t init_encoder(void)
+{
+    int fd;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+
+    /*
+     * The sensor height is not a multiple of 16. The YUV420 layout used here is line
+     * interleaved, so encoding the first aligned rows of the frame is a plain crop.
+     */
+    s_encoder.width = s_camera.width & ~(H264_ALIGN - 1);
+    s_encoder.height = s_camera.height & ~(H264_ALIGN - 1);
+    ESP_RETURN_ON_FALSE(s_encoder.width == s_camera.width, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "width %"PRIu32" is not %d-pixel aligned", s_camera.width, H264_ALIGN);
+
+    fd = open(ESP_VIDEO_H264_DEVICE_NAME, O_RDONLY);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_ERR_NOT_FOUND, TAG, "Failed to open %s", ESP_VIDEO_H264_DEVICE_NAME);
+
+    set_codec_control(fd, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, CONFIG_EXAMPLE_H264_I_PERIOD, "intra frame period");
+    set_codec_control(fd, V4L2_CID_MPEG_VIDEO_BITRATE, CONFIG_EXAMPLE_H264_BITRATE, "bitrate");
+    set_codec_control(fd, V4L2_CID_MPEG_VIDEO_H264_MIN_QP, CONFIG_EXAMPLE_H264_MIN_QP, "minimum QP");
+    set_codec_control(fd, V4L2_CID_MPEG_VIDEO_H264_MAX_QP, CONFIG_EXAMPLE_H264_MAX_QP, "maximum QP");
+    /* A session joining on a periodic IDR frame gets the parameter sets with it */
+    set_codec_control(fd, V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1, "sequence header repeat");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = s_encoder.width;
+    format.fmt.pix.height = s_encoder.height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_FAIL, TAG, "Failed to set encoder input format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, TAG, "Failed to request encoder input buffer");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = s_encoder.width;
+    format.fmt.pix.height = s_encoder.height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_H264;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_FAIL, TAG, "Failed to set encoder output format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = H264_BUFFER_COUNT;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, TAG, "Failed to request encoder output buffers");
+
+    for (int i = 0; i < H264_BUFFER_COUNT; i++) {
+        struct v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+
+        ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, TAG, "QUERYBUF failed");
+
+        s_encoder.buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        ESP_RETURN_ON_FALSE(s_encoder.buffer[i] != MAP_FAILED, ESP_ERR_NO_MEM, TAG, "mmap failed");
+
+        ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_QBUF, &buf) == 0, ESP_FAIL, TAG, "QBUF failed");
+    }
+
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "Failed to start encoder output");
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ESP_RETURN_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "Failed to start encoder input");
+
+    s_encoder.fd = fd;
+
+    s_encoder.free_sem = xSemaphoreCreateCounting(H264_BUFFER_COUNT, H264_BUFFER_COUNT);
+    ESP_RETURN_ON_FALSE(s_encoder.free_sem, ESP_ERR_NO_MEM, TAG, "Failed to create semaphore");
+
+    frame_broadcaster_config_t bcast_config = {
+        .name = "h264",
+        .buffers = s_encoder.buffer,
+        .buffer_count = H264_BUFFER_COUNT,
+        .release_cb = encoder_queue_capture_buffer,
+        .width = s_encoder.width,
+        .height = s_encoder.height,
+    };
+    ESP_RETURN_ON_ERROR(frame_broadcaster_create(&bcast_config, &s_encoder.frames), TAG, "Failed to create broadcaster");
+
+    ESP_LOGI(TAG, "H.264 encoder initialized, %"PRIu32"x%"PRIu32", %d bps, GOP %d",
+             s_encoder.width, s_encoder.height, CONFIG_EXAMPLE_H264_BITRATE, CONFIG_EXAMPLE_H264_I_PERIOD);
+    return ESP_OK;
+}
+
+/* Encode one camera frame, returns the capture buffer index holding the access unit */
+static esp_err_t encode_frame(const frame_t *frame, uint32_t *index, uint32_t *size)
+{
+    struct v4l2_buffer out_buf;
+    struct v4l2_buffer cap_buf;
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.index = 0;
+    out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    out_buf.memory = V4L2_MEMORY_USERPTR;
+    out_buf.m.userptr = (unsigned long)frame->data;
+    out_buf.length = s_encoder.width * s_encoder.height * 3 / 2;
+    ESP_RETURN_ON_FALSE(ioctl(s_encoder.fd, VIDIOC_QBUF, &out_buf) == 0, ESP_FAIL, TAG, "QBUF input failed");
+
+    /* The H.264 device encodes synchronously when the capture buffer is dequeued */
+    memset(&cap_buf, 0, sizeof(cap_buf));
+    cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cap_buf.memory = V4L2_MEMORY_MMAP;
+    esp_err_t ret = ioctl(s_encoder.fd, VIDIOC_DQBUF, &cap_buf) == 0 ? ESP_OK : ESP_FAIL;
+
+    ESP_RETURN_ON_FALSE(ioctl(s_encoder.fd, VIDIOC_DQBUF, &out_buf) == 0, ESP_FAIL, TAG, "DQBUF input failed");
+    ESP_RETURN_ON_ERROR(ret, TAG, "DQBUF output failed");
+
+    *index = cap_buf.index;
+    *size = cap_buf.bytesused;
+    return ESP_OK;
+}
+
+/* Called by the RTSP sessions, the control is set by the encoder task between two frames */
+static void encoder_request_key_frame(void *arg)
+{
+    atomic_store(&s_encoder.key_frame_request, true);
+}
+
+static void encoder_force_key_frame(void)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (!atomic_load(&s_encoder.key_frame_request) || now_us - s_encoder.last_key_frame_us < KEY_FRAME_MIN_INTERVAL_US) {
+        return;
+    }
+
+    atomic_store(&s_encoder.key_frame_request, false);
+    if (set_codec_control(s_encoder.fd, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1, "key frame") == ESP_OK) {
+        s_encoder.last_key_frame_us = now_us;
+    }
+}
+
+/* The SPS and PPS only change with the resolution, they are read once from the encoder task */
+static void encoder_read_param_sets(void)
+{
+    uint8_t sets[PARAM_SETS_SIZE];
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_CODEC_CLASS;
+    controls.count = 1;
+    controls.controls = control;
+    control[0].id = V4L2_CID_MPEG_VIDEO_H264_ESP_PARAM_SETS;
+    control[0].size = sizeof(sets);
+    control[0].p_u8 = sets;
+    if (ioctl(s_encoder.fd, VIDIOC_G_EXT_CTRLS, &controls) != 0 || !control[0].size) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_encoder.param_sets_lock);
+    memcpy(s_encoder.param_sets, sets, control[0].size);
+    s_encoder.param_sets_size = control[0].size;
+    portEXIT_CRITICAL(&s_encoder.param_sets_lock);
+}
+
+static size_t encoder_get_param_sets(uint8_t *buf, size_t size, void *arg)
+{
+    size_t sets_size;
+
+    portENTER_CRITICAL(&s_encoder.param_sets_lock);
+    sets_size = s_encoder.param_sets_size <= size ? s_encoder.param_sets_size : 0;
+    memcpy(buf, s_encoder.param_sets, sets_size);
+    portEXIT_CRITICAL(&s_encoder.param_sets_lock);
+
+    return sets_size;
+}
+
+static void encoder_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_config_t sub_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+    sub_config.name = "h264";
+    frame_subscriber_t *sub = frame_broadcaster_subscribe(s_camera.frames, &sub_config);
+
+    assert(sub);
+
+    while (true) {
+        uint32_t index;
+        uint32_t size;
+
+        if (frame_subscriber_wait(sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            continue;
+        }
+
+        /*
+         * Keep encoding even without RTSP clients, so a new session starts on a GOP
+         * that is already running instead of re-initializing the encoder.
+         */
+        xSemaphoreTake(s_encoder.free_sem, portMAX_DELAY);
+        encoder_force_key_frame();
+        if (encode_frame(frame, &index, &size) != ESP_OK) {
+            xSemaphoreGive(s_encoder.free_sem);
+        } else {
+            if (!s_encoder.param_sets_size) {
+                encoder_read_param_sets();
+            }
+
+            if (!size || !frame_broadcaster_publish(s_encoder.frames, index, size, frame->timestamp_us)) {
+                encoder_queue_capture_buffer(index, NULL);
+            }
+        }
+
+        frame_subscriber_release(sub, frame);
+    }
+}
+
+#if CONFIG_EXAMPLE_RTSP_RECORD
+/* ========== SD Card Recording ========== */
+static sd_card_config_t s_card_config = SD_CARD_DEFAULT_CONFIG();
+
+static esp_err_t init_sdcard(void)
+{
+    sdmmc_card_t *card;
+
+    s_card_config.max_files = RECORD_MAX_FILES;
+    sd_card_load_config(&s_card_config);
+
+    return sd_card_mount(&s_card_config, &card);
+}
+
+/* Next free recNNNN.mp4 */
+static void record_next_path(char *path, size_t len)
+{
+    static uint32_t s_index;
+    struct stat st;
+
+    do {
+        snprintf(path, len, MOUNT_POINT "/rec%04"PRIu32".mp4", s_index++);
+    } while (stat(path, &st) == 0);
+}
+
+static void record_task(void *arg)
+{
+    const frame_t *frame;
+    fmp4_writer_t *writer = NULL;
+    uint8_t param_sets[PARAM_SETS_SIZE];
+    char path[32];
+    frame_subscriber_config_t sub_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+    fmp4_writer_config_t writer_config = {
+        .width = s_encoder.width,
+        .height = s_encoder.height,
+        .param_sets = param_sets,
+        .buffer_size = RECORD_BUFFER_SIZE,
+        .unit_size = sd_card_allocation_unit(&s_card_config),
+    };
+
+    /* Every access unit is needed, the task only copies it so the encoder hardly waits */
+    sub_config.name = "record";
+    sub_config.policy = FRAME_DELIVERY_LOSSLESS;
+    sub_config.queue_depth = H264_BUFFER_COUNT;
+    frame_subscriber_t *sub = frame_broadcaster_subscribe(s_encoder.frames, &sub_config);
+    assert(sub);
+
+    while (true) {
+        if (frame_subscriber_wait(sub, &frame, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            continue;
+        }
+
+        bool key_frame = fmp4_writer_is_key_frame(frame->data, frame->size);
+
+        /* Files start and end on IDR frames */
+        if (writer && key_frame && fmp4_writer_get_duration_us(writer) >= RECORD_SEGMENT_US) {
+            fmp4_writer_close(writer);
+            writer = NULL;
+        }
+        if (!writer && key_frame) {
+            writer_config.param_sets_size = encoder_get_param_sets(param_sets, sizeof(param_sets), NULL);
+            record_next_path(path, sizeof(path));
+            if (fmp4_writer_create(path, &writer_config, &writer) == ESP_OK) {
+                ESP_LOGI(TAG, "Recording to %s", path);
+            } else {
+                writer = NULL;
+            }
+        }
+
+        if (writer && fmp4_writer_add(writer, frame->data, frame->size, frame->timestamp_us, key_frame) == ESP_FAIL) {
+            ESP_LOGE(TAG, "Recording to %s failed, starting a new file", path);
+            fmp4_writer_close(writer);
+            writer = NULL;
+        }
+
+        frame_subscriber_release(sub, frame);
+    }
+}
+#endif
+
+/* ========== Service Announcement ========== */
+static esp_err_t init_mdns(void)
+{
+#if CONFIG_EXAMPLE_RTP_MULTICAST
+    char port[8];
+
+    snprintf(port, sizeof(port), "%d", CONFIG_EXAMPLE_RTP_MULTICAST_PORT);
+#endif
+    mdns_txt_item_t txt[] = {
+        {"board", CONFIG_IDF_TARGET},
+        {"path", "/"},
+#if CONFIG_EXAMPLE_RTP_MULTICAST
+        {"multicast", CONFIG_EXAMPLE_RTP_MULTICAST_ADDR},
+        {"multicast_port", port},
+#endif
+    };
+
+    ESP_RETURN_ON_ERROR(mdns_init(), TAG, "Failed to init mDNS");
+    ESP_RETURN_ON_ERROR(mdns_hostname_set(CONFIG_EXAMPLE_MDNS_HOST_NAME), TAG, "Failed to set mDNS host name");
+    ESP_RETURN_ON_ERROR(mdns_instance_name_set(CONFIG_EXAMPLE_MDNS_INSTANCE), TAG, "Failed to set mDNS instance");
+    ESP_RETURN_ON_ERROR(mdns_service_add(NULL, "_rtsp", "_tcp", CONFIG_EXAMPLE_RTSP_PORT, txt,
+                                         sizeof(txt) / sizeof(txt[0])), TAG, "Failed to add mDNS service");
+
+    ESP_LOGI(TAG, "Announced as rtsp://%s.local:%d/", CONFIG_EXAMPLE_MDNS_HOST_NAME, CONFIG_EXAMPLE_RTSP_PORT);
+    return ESP_OK;
+}
+
+/* ========== Main ========== */
+void app_main(void)
+{
+    ESP_LOGI(TAG, "IMX662 RTSP H.264 Streaming Server");
+
+    /* Initialize NVS */
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+
+    /* Initialize network (WiFi via protocol_examples_common) */
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(example_connect());
+
+    ESP_ERROR_CHECK(init_camera());
+    ESP_ERROR_CHECK(init_encoder());
+
+    ESP_ERROR_CHECK(xTaskCreatePinnedToCore(encoder_task, "h264_enc", H264_TASK_STACK_SIZE, NULL,
+                                            H264_TASK_PRIORITY, NULL, H264_TASK_CORE) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM);
+
+#if CONFIG_EXAMPLE_RTSP_RECORD
+    /* Streaming goes on without a card */
+    if (init_sdcard() == ESP_OK) {
+        ESP_ERROR_CHECK(xTaskCreatePinnedToCore(record_task, "record", RECORD_TASK_STACK_SIZE, NULL,
+                                                RECORD_TASK_PRIORITY, NULL, RECORD_TASK_CORE) == pdPASS ?
+                        ESP_OK : ESP_ERR_NO_MEM);
+    } else {
+        ESP_LOGW(TAG, "No SD card, recording disabled");
+    }
+#endif
+
+    rtsp_server_config_t rtsp_config = {
+        .port = CONFIG_EXAMPLE_RTSP_PORT,
+        .max_sessions = CONFIG_EXAMPLE_RTSP_MAX_SESSIONS,
+        .source = s_encoder.frames,
+        .name = "IMX662",
+        .request_key_frame = encoder_request_key_frame,
+        .get_param_sets = encoder_get_param_sets,
+#if CONFIG_EXAMPLE_RTP_MULTICAST
+        .multicast_addr = CONFIG_EXAMPLE_RTP_MULTICAST_ADDR,
+        .multicast_port = CONFIG_EXAMPLE_RTP_MULTICAST_PORT,
+        .multicast_ttl = CONFIG_EXAMPLE_RTP_MULTICAST_TTL,
+#endif
+    };
+    ESP_ERROR_CHECK(rtsp_server_start(&rtsp_config));
+
+    /* Discovery is a convenience, the server works by address without it */
+    if (init_mdns() != ESP_OK) {
+        ESP_LOGW(TAG, "mDNS announcement not available");
+    }
+
+    ESP_LOGI(TAG, "Server ready: rtsp://<IP>:%d/", CONFIG_EXAMPLE_RTSP_PORT);
+}
@@ -0,0 +1,103 @@
+/*
+ * SD card write throughput measurement
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/errno.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sd_benchmark.h"
+
+#define SD_BENCHMARK_NVS_NAMESPACE  "sd_bench"
+
+static const char *TAG = "sd_benchmark";
+
+esp_err_t sd_benchmark_write(const char *path, uint32_t total_size, const uint8_t *data, uint32_t write_size,
+                             uint32_t *kb_per_s)
+{
+    esp_err_t ret = ESP_OK;
+    FILE *f;
+
+    ESP_RETURN_ON_FALSE(path && data && write_size && total_size >= write_size && kb_per_s, ESP_ERR_INVALID_ARG,
+                        TAG, "invalid argument");
+
+    f = fopen(path, "wb");
+    ESP_RETURN_ON_FALSE(f, ESP_FAIL, TAG, "failed to open %s (errno=%d)", path, errno);
+    /* Every write goes to FATFS as it is, the measurement is about the write size */
+    setvbuf(f, NULL, _IONBF, 0);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t written = 0; written + write_size <= total_size; written += write_size) {
+        ESP_GOTO_ON_FALSE(fwrite(data, 1, write_size, f) == write_size, ESP_FAIL, exit, TAG,
+                          "write failed at %"PRIu32" (errno=%d)", written, errno);
+    }
+    ESP_GOTO_ON_FALSE(fsync(fileno(f)) == 0, ESP_FAIL, exit, TAG, "sync failed (errno=%d)", errno);
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    *kb_per_s = (uint32_t)((uint64_t)(total_size / write_size * write_size) * 1000000 / 1024 / (elapsed ? elapsed : 1));
+
+exit:
+    fclose(f);
+    remove(path);
+    return ret;
+}
+
+esp_err_t sd_benchmark_load(sd_benchmark_result_t *result)
+{
+    esp_err_t ret;
+    nvs_handle_t handle;
+    uint8_t ddr = 0;
+
+    ret = nvs_open(SD_BENCHMARK_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to open NVS");
+
+    ret = nvs_get_u32(handle, "freq_khz", &result->max_freq_khz);
+    if (ret == ESP_OK) {
+        nvs_get_u8(handle, "ddr", &ddr);
+        result->ddr = ddr;
+        result->allocation_unit = 0;
+        result->write_size = 0;
+        result->kb_per_s = 0;
+        nvs_get_u32(handle, "alloc_unit", &result->allocation_unit);
+        nvs_get_u32(handle, "write_size", &result->write_size);
+        nvs_get_u32(handle, "kb_per_s", &result->kb_per_s);
+    }
+    nvs_close(handle);
+
+    return ret == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : ret;
+}
+
+esp_err_t sd_benchmark_save(const sd_benchmark_result_t *result)
+{
+    esp_err_t ret;
+    nvs_handle_t handle;
+
+    ESP_RETURN_ON_ERROR(nvs_open(SD_BENCHMARK_NVS_NAMESPACE, NVS_READWRITE, &handle), TAG, "failed to open NVS");
+
+    ret = nvs_set_u32(handle, "freq_khz", result->max_freq_khz);
+    if (ret == ESP_OK) {
+        ret = nvs_set_u8(handle, "ddr", result->ddr);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_set_u32(handle, "alloc_unit", result->allocation_unit);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_set_u32(handle, "write_size", result->write_size);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_set_u32(handle, "kb_per_s", result->kb_per_s);
+    }
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to save benchmark result");
+    return ESP_OK;
+}
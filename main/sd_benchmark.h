@@ -0,0 +1,75 @@
+/*
+ * SD card write throughput measurement
+ *
+ * Measures sustained sequential writes to a file and keeps the fastest
+ * host and write configuration in NVS, so the capture modes can mount the
+ * card with it on the next boot.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Card and write configuration with its measured throughput
+ */
+typedef struct {
+    uint32_t max_freq_khz;      /*!< SDMMC bus frequency */
+    bool ddr;                   /*!< DDR bus mode */
+    uint32_t allocation_unit;   /*!< FAT cluster size the card was formatted with, 0 if unchanged */
+    uint32_t write_size;        /*!< Size of one write */
+    uint32_t kb_per_s;          /*!< Measured throughput in KB/s */
+} sd_benchmark_result_t;
+
+/**
+ * @brief Write a file and measure the throughput
+ *
+ * The file is written with unbuffered writes of write_size bytes, synced,
+ * closed and removed again. The time includes the sync.
+ *
+ * @param path       File to write
+ * @param total_size Bytes to write
+ * @param data       Source buffer of write_size bytes
+ * @param write_size Size of one write
+ * @param kb_per_s   Returned throughput in KB/s
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is invalid
+ *      - ESP_FAIL if the file could not be written
+ */
+esp_err_t sd_benchmark_write(const char *path, uint32_t total_size, const uint8_t *data, uint32_t write_size,
+                             uint32_t *kb_per_s);
+
+/**
+ * @brief Load the persisted result
+ *
+ * @param result Returned result
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if no benchmark was saved
+ *      - Others if NVS could not be read
+ */
+esp_err_t sd_benchmark_load(sd_benchmark_result_t *result);
+
+/**
+ * @brief Persist a result in NVS
+ *
+ * @param result Result to save
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - Others if NVS could not be written
+ */
+esp_err_t sd_benchmark_save(const sd_benchmark_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
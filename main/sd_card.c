@@ -0,0 +1,109 @@
+/*
+ * SD card slot of the ESP32-P4 Function EV Board
+ */
+
+#include <stdio.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "driver/sdmmc_host.h"
+#include "sd_pwr_ctrl_by_on_chip_ldo.h"
+#include "sd_benchmark.h"
+#include "sd_card.h"
+
+#define SD_PIN_CLK              43
+#define SD_PIN_CMD              44
+#define SD_PIN_D0               39
+#define SD_PIN_D1               40
+#define SD_PIN_D2               41
+#define SD_PIN_D3               42
+#define SD_LDO_CHANNEL_ID       4
+
+static const char *TAG = "sd_card";
+
+/* Kept across remounts, the LDO channel can only be acquired once */
+static sd_pwr_ctrl_handle_t s_pwr_ctrl;
+
+esp_err_t sd_card_load_config(sd_card_config_t *config)
+{
+    esp_err_t ret;
+    sd_benchmark_result_t benchmark;
+
+    ESP_RETURN_ON_FALSE(config, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    /* Nothing saved is the normal case until the benchmark mode has run */
+    ret = sd_benchmark_load(&benchmark);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    config->max_freq_khz = benchmark.max_freq_khz;
+    config->ddr = benchmark.ddr;
+    config->allocation_unit = benchmark.allocation_unit;
+    ESP_LOGI(TAG, "Using benchmarked SD settings: %"PRIu32" kHz%s, %.2f MB/s measured", benchmark.max_freq_khz,
+             benchmark.ddr ? " DDR" : "", benchmark.kb_per_s / 1024.0f);
+    return ESP_OK;
+}
+
+esp_err_t sd_card_mount(const sd_card_config_t *config, sdmmc_card_t **card)
+{
+    esp_err_t ret;
+
+    ESP_RETURN_ON_FALSE(config && card, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = config->max_files,
+        .allocation_unit_size = sd_card_allocation_unit(config),
+    };
+
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    if (config->max_freq_khz) {
+        host.max_freq_khz = config->max_freq_khz;
+    }
+    if (config->ddr) {
+        host.flags |= SDMMC_HOST_FLAG_DDR;
+    }
+
+    /* Configure internal LDO for SD card power (ESP32-P4 specific) */
+    if (s_pwr_ctrl == NULL) {
+        sd_pwr_ctrl_ldo_config_t ldo_config = {
+            .ldo_chan_id = SD_LDO_CHANNEL_ID,
+        };
+
+        ESP_RETURN_ON_ERROR(sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &s_pwr_ctrl), TAG,
+                            "Failed to initialize SD card LDO power control");
+    }
+    host.pwr_ctrl_handle = s_pwr_ctrl;
+
+    /* Configure SDMMC slot with explicit pins */
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = 4;
+    slot_config.clk = SD_PIN_CLK;
+    slot_config.cmd = SD_PIN_CMD;
+    slot_config.d0 = SD_PIN_D0;
+    slot_config.d1 = SD_PIN_D1;
+    slot_config.d2 = SD_PIN_D2;
+    slot_config.d3 = SD_PIN_D3;
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    ret = esp_vfs_fat_sdmmc_mount(SD_CARD_MOUNT_POINT, &host, &slot_config, &mount_config, card);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount filesystem");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize SD card: %s", esp_err_to_name(ret));
+        }
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "SD card mounted at %s", SD_CARD_MOUNT_POINT);
+    sdmmc_card_print_info(stdout, *card);
+    return ESP_OK;
+}
+
+void sd_card_unmount(sdmmc_card_t *card)
+{
+    esp_vfs_fat_sdcard_unmount(SD_CARD_MOUNT_POINT, card);
+    ESP_LOGI(TAG, "SD card unmounted");
+}
@@ -0,0 +1,92 @@
+/*
+ * SD card slot of the ESP32-P4 Function EV Board
+ *
+ * The slot is powered by the on-chip LDO and the card is mounted as FAT in
+ * 4-bit mode. Every streamer mode mounts it here, with the bus settings and
+ * the allocation unit the write benchmark saved in NVS when there are any.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_CARD_MOUNT_POINT                 "/sdcard"
+#define SD_CARD_DEFAULT_ALLOCATION_UNIT     (16 * 1024)
+
+/**
+ * @brief Mount configuration
+ */
+typedef struct {
+    int max_files;              /*!< Files open at the same time */
+    uint32_t max_freq_khz;      /*!< SDMMC bus frequency, 0 for the SDMMC default */
+    bool ddr;                   /*!< DDR bus mode */
+    uint32_t allocation_unit;   /*!< Cluster size the card is formatted with, 0 for SD_CARD_DEFAULT_ALLOCATION_UNIT */
+} sd_card_config_t;
+
+#define SD_CARD_DEFAULT_CONFIG()    \
+    {                               \
+        .max_files = 5,             \
+        .max_freq_khz = 0,          \
+        .ddr = false,               \
+        .allocation_unit = 0,       \
+    }
+
+/**
+ * @brief Apply the settings saved by the write benchmark
+ *
+ * The configuration is left as it is if no benchmark was saved.
+ *
+ * @param config Configuration to update
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if no benchmark was saved
+ *      - Others if NVS could not be read
+ */
+esp_err_t sd_card_load_config(sd_card_config_t *config);
+
+/**
+ * @brief Power the slot and mount the card at SD_CARD_MOUNT_POINT
+ *
+ * The LDO stays on after sd_card_unmount(), so the card can be mounted again
+ * with other bus settings.
+ *
+ * @param config Mount configuration
+ * @param card   Returned card
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the card has no FAT file system
+ *      - Others if the slot could not be powered or the card initialized
+ */
+esp_err_t sd_card_mount(const sd_card_config_t *config, sdmmc_card_t **card);
+
+/**
+ * @brief Unmount a card mounted with sd_card_mount()
+ *
+ * @param card Card to unmount
+ */
+void sd_card_unmount(sdmmc_card_t *card);
+
+/**
+ * @brief Allocation unit the files on the card are aligned to
+ *
+ * @param config Configuration the card was mounted with
+ *
+ * @return Cluster size in bytes
+ */
+static inline uint32_t sd_card_allocation_unit(const sd_card_config_t *config)
+{
+    return config->allocation_unit ? config->allocation_unit : SD_CARD_DEFAULT_ALLOCATION_UNIT;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,390 @@
+/*
+ * HTTP file server for the files on the SD card
+ *
+ * Files are sent with a Content-Length, written to the socket with
+ * httpd_send() instead of chunked encoding, so download tools see the size
+ * and can resume with "Range: bytes=N-". The ETag is made of the size and
+ * the modification time; a range with an If-Range that no longer matches is
+ * answered with the whole file.
+ *
+ * esp_http_server runs the handlers in one task, so there is one transfer at
+ * a time and its chunks are allocated once. The reader task reads whole
+ * chunks with read() from sector aligned offsets, which FATFS hands to the
+ * card as multi-sector transfers straight into the DMA capable chunk, while
+ * the HTTP task sends the chunks read before.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "sd_file_server.h"
+#include "task_topology.h"
+
+#define FILE_SERVER_PORT            CONFIG_EXAMPLE_SD_FILE_SERVER_PORT
+#define FILE_SERVER_CHUNK_SIZE      (CONFIG_EXAMPLE_SD_FILE_SERVER_CHUNK_KB * 1024)
+#define FILE_SERVER_CHUNK_COUNT     CONFIG_EXAMPLE_SD_FILE_SERVER_CHUNKS
+#define FILE_SERVER_SECTOR_SIZE     512
+#define FILE_SERVER_PATH_LEN        64
+#define FILE_SERVER_NAME_LEN        32
+#define FILE_SERVER_HEADER_LEN      320
+#define FILE_SERVER_READER_STACK    4096
+/* Below the recorder's writer, a running recording keeps the card */
+#define FILE_SERVER_READER_PRIORITY 1
+#define FILE_SERVER_READER_CORE     TASK_CAPTURE_CORE
+
+static const char *TAG = "sd_file_server";
+
+typedef struct {
+    uint8_t *data;
+    int len;                        /* Bytes read, 0 or negative if the read failed */
+} file_chunk_t;
+
+typedef struct {
+    int fd;
+    uint32_t offset;                /* First byte to read */
+    uint32_t remaining;             /* Bytes the reader has yet to read */
+    file_chunk_t chunks[FILE_SERVER_CHUNK_COUNT];
+    QueueHandle_t free_q;           /* Chunks the reader may fill */
+    QueueHandle_t full_q;           /* Chunks ready to be sent, in file order */
+    SemaphoreHandle_t done;         /* Given when the reader task exits */
+    volatile bool abort;
+} file_transfer_t;
+
+static struct {
+    httpd_handle_t server;
+    char base_path[FILE_SERVER_PATH_LEN - FILE_SERVER_NAME_LEN];
+    file_transfer_t xfer;
+} s_server = {
+    .xfer.fd = -1,
+};
+
+static void file_reader_task(void *arg)
+{
+    file_transfer_t *xfer = (file_transfer_t *)arg;
+    file_chunk_t *chunk;
+    /* The first read ends on a sector boundary, all later ones read whole sectors */
+    uint32_t len = FILE_SERVER_CHUNK_SIZE - xfer->offset % FILE_SERVER_SECTOR_SIZE;
+
+    while (xfer->remaining && xQueueReceive(xfer->free_q, &chunk, portMAX_DELAY) == pdTRUE && !xfer->abort) {
+        chunk->len = read(xfer->fd, chunk->data, MIN(len, xfer->remaining));
+        xQueueSend(xfer->full_q, &chunk, portMAX_DELAY);
+        if (chunk->len <= 0) {
+            break;
+        }
+
+        xfer->remaining -= chunk->len;
+        len = FILE_SERVER_CHUNK_SIZE;
+    }
+
+    xSemaphoreGive(xfer->done);
+    vTaskDelete(NULL);
+}
+
+/* httpd_send() may take only a part of the buffer */
+static esp_err_t file_send_all(httpd_req_t *req, const char *buf, size_t len)
+{
+    while (len) {
+        int sent = httpd_send(req, buf, len);
+
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        buf += sent;
+        len -= sent;
+    }
+
+    return ESP_OK;
+}
+
+/* Send bytes [offset, offset + length) of the open file, read ahead by the reader task */
+static esp_err_t file_send_range(httpd_req_t *req, int fd, uint32_t offset, uint32_t length)
+{
+    file_transfer_t *xfer = &s_server.xfer;
+    file_chunk_t *chunk;
+    esp_err_t ret = ESP_OK;
+    uint32_t sent = 0;
+    int64_t start = esp_timer_get_time();
+
+    ESP_RETURN_ON_FALSE(lseek(fd, offset, SEEK_SET) == offset, ESP_FAIL, TAG, "seek failed");
+
+    xQueueReset(xfer->free_q);
+    xQueueReset(xfer->full_q);
+    for (int i = 0; i < FILE_SERVER_CHUNK_COUNT; i++) {
+        chunk = &xfer->chunks[i];
+        xQueueSend(xfer->free_q, &chunk, 0);
+    }
+    xfer->fd = fd;
+    xfer->offset = offset;
+    xfer->remaining = length;
+    xfer->abort = false;
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(file_reader_task, "file_read", FILE_SERVER_READER_STACK, xfer,
+                                                FILE_SERVER_READER_PRIORITY, NULL, FILE_SERVER_READER_CORE) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "failed to create reader task");
+
+    while (sent < length) {
+        xQueueReceive(xfer->full_q, &chunk, portMAX_DELAY);
+        if (chunk->len <= 0) {
+            ESP_LOGE(TAG, "read failed at %"PRIu32, offset + sent);
+            ret = ESP_FAIL;
+            break;
+        }
+
+        ret = file_send_all(req, (const char *)chunk->data, chunk->len);
+        xQueueSend(xfer->free_q, &chunk, 0);
+        if (ret != ESP_OK) {
+            break;
+        }
+        sent += chunk->len;
+    }
+
+    /* Wake the reader if it waits for a chunk, it stops before the next read */
+    if (ret != ESP_OK) {
+        xfer->abort = true;
+        chunk = &xfer->chunks[0];
+        xQueueSend(xfer->free_q, &chunk, 0);
+    }
+    xSemaphoreTake(xfer->done, portMAX_DELAY);
+    xfer->fd = -1;
+
+    if (ret == ESP_OK) {
+        int64_t elapsed = MAX(esp_timer_get_time() - start, 1);
+
+        ESP_LOGI(TAG, "Sent %"PRIu32" bytes from %"PRIu32" at %.2f MB/s", sent, offset,
+                 sent / (float)elapsed * 1000000 / (1024 * 1024));
+    } else {
+        ESP_LOGW(TAG, "Transfer stopped after %"PRIu32" of %"PRIu32" bytes", sent, length);
+    }
+
+    return ret;
+}
+
+/*
+ * Parse "bytes=a-b", "bytes=a-" or "bytes=-n" against a file of the given
+ * size. Returns false if the range cannot be satisfied; multiple ranges are
+ * not supported and are treated like a missing header by the caller.
+ */
+static bool file_parse_range(const char *value, uint32_t size, uint32_t *first, uint32_t *last)
+{
+    char *end;
+
+    if (strncmp(value, "bytes=", 6) || !size) {
+        return false;
+    }
+    value += 6;
+
+    if (*value == '-') {
+        unsigned long long suffix = strtoull(value + 1, &end, 10);
+
+        if (end == value + 1 || *end || !suffix) {
+            return false;
+        }
+        *first = suffix >= size ? 0 : size - suffix;
+        *last = size - 1;
+        return true;
+    }
+
+    unsigned long long a = strtoull(value, &end, 10);
+    if (end == value || *end != '-' || a >= size) {
+        return false;
+    }
+    value = end + 1;
+    *first = a;
+    *last = size - 1;
+    if (*value) {
+        unsigned long long b = strtoull(value, &end, 10);
+
+        if (*end || b < a) {
+            return false;
+        }
+        *last = MIN(b, size - 1);
+    }
+
+    return true;
+}
+
+/* GET /files, the files of the card as a JSON array of names and sizes */
+static esp_err_t file_list_handler(httpd_req_t *req)
+{
+    char entry[FILE_SERVER_NAME_LEN + 48];
+    char path[FILE_SERVER_PATH_LEN];
+    struct dirent *dirent;
+    struct stat st;
+    bool first = true;
+    DIR *dir = opendir(s_server.base_path);
+
+    if (!dir) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Card not readable");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send_chunk(req, "[", 1);
+    while ((dirent = readdir(dir)) != NULL) {
+        if (dirent->d_type != DT_REG || strlen(dirent->d_name) >= FILE_SERVER_NAME_LEN) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", s_server.base_path, dirent->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        int len = snprintf(entry, sizeof(entry), "%s{\"name\":\"%s\",\"size\":%ld}", first ? "" : ",",
+                           dirent->d_name, (long)st.st_size);
+        if (httpd_resp_send_chunk(req, entry, len) != ESP_OK) {
+            closedir(dir);
+            return ESP_FAIL;
+        }
+        first = false;
+    }
+    closedir(dir);
+
+    httpd_resp_send_chunk(req, "]", 1);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* GET and HEAD /files/<name>, with a single byte range */
+static esp_err_t file_get_handler(httpd_req_t *req)
+{
+    const char *name = req->uri + strlen("/files/");
+    size_t name_len = strcspn(name, "?");
+    char path[FILE_SERVER_PATH_LEN];
+    char range[48];
+    char if_range[32];
+    char etag[24];
+    char header[FILE_SERVER_HEADER_LEN];
+    struct stat st;
+    uint32_t size;
+    uint32_t first = 0;
+    uint32_t last;
+    bool partial = false;
+    int len;
+
+    /* Only plain file names directly in the mount point */
+    if (!name_len || name_len >= FILE_SERVER_NAME_LEN || memchr(name, '/', name_len) || name[0] == '.') {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file name");
+        return ESP_FAIL;
+    }
+    snprintf(path, sizeof(path), "%s/%.*s", s_server.base_path, (int)name_len, name);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File not found");
+        return ESP_FAIL;
+    }
+    size = st.st_size;
+    last = size ? size - 1 : 0;
+    snprintf(etag, sizeof(etag), "\"%"PRIx32"-%llx\"", size, (unsigned long long)st.st_mtime);
+
+    if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK) {
+        /* A range of another version of the file is answered with the whole file */
+        bool same = httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+                    !strcmp(if_range, etag);
+
+        if (same && !strchr(range, ',')) {
+            if (!file_parse_range(range, size, &first, &last)) {
+                close(fd);
+                len = snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                               "Content-Range: bytes */%"PRIu32"\r\nContent-Length: 0\r\n\r\n", size);
+                return file_send_all(req, header, len);
+            }
+            partial = true;
+        }
+    }
+
+    uint32_t length = size ? last - first + 1 : 0;
+    len = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\n"
+                   "Content-Length: %"PRIu32"\r\nAccept-Ranges: bytes\r\nETag: %s\r\n"
+                   "Access-Control-Allow-Origin: *\r\n", partial ? "206 Partial Content" : "200 OK", length, etag);
+    if (partial) {
+        len += snprintf(header + len, sizeof(header) - len, "Content-Range: bytes %"PRIu32"-%"PRIu32"/%"PRIu32"\r\n",
+                        first, last, size);
+    }
+    len += snprintf(header + len, sizeof(header) - len, "\r\n");
+
+    esp_err_t ret = file_send_all(req, header, len);
+    if (ret == ESP_OK && req->method != HTTP_HEAD && length) {
+        ret = file_send_range(req, fd, first, length);
+    }
+    close(fd);
+
+    return ret;
+}
+
+esp_err_t sd_file_server_start(const char *base_path)
+{
+    esp_err_t ret = ESP_OK;
+    file_transfer_t *xfer = &s_server.xfer;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    ESP_RETURN_ON_FALSE(base_path && strlen(base_path) < sizeof(s_server.base_path), ESP_ERR_INVALID_ARG, TAG,
+                        "invalid base path");
+    ESP_RETURN_ON_FALSE(!s_server.server, ESP_ERR_INVALID_STATE, TAG, "already started");
+    strcpy(s_server.base_path, base_path);
+
+    xfer->free_q = xQueueCreate(FILE_SERVER_CHUNK_COUNT, sizeof(file_chunk_t *));
+    xfer->full_q = xQueueCreate(FILE_SERVER_CHUNK_COUNT, sizeof(file_chunk_t *));
+    xfer->done = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(xfer->free_q && xfer->full_q && xfer->done, ESP_ERR_NO_MEM, fail, TAG,
+                      "failed to create queues");
+    for (int i = 0; i < FILE_SERVER_CHUNK_COUNT; i++) {
+        xfer->chunks[i].data = heap_caps_aligned_alloc(FILE_SERVER_SECTOR_SIZE, FILE_SERVER_CHUNK_SIZE,
+                                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA | MALLOC_CAP_CACHE_ALIGNED);
+        ESP_GOTO_ON_FALSE(xfer->chunks[i].data, ESP_ERR_NO_MEM, fail, TAG, "failed to allocate read-ahead chunk");
+    }
+
+    config.server_port = FILE_SERVER_PORT;
+    config.ctrl_port = FILE_SERVER_PORT + 1;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.core_id = TASK_NETWORK_CORE;
+    config.task_priority = TASK_NETWORK_PRIORITY;
+    config.lru_purge_enable = true;
+    ESP_GOTO_ON_ERROR(httpd_start(&s_server.server, &config), fail, TAG, "failed to start HTTP server");
+
+    httpd_uri_t list_uri = { .uri = "/files", .method = HTTP_GET, .handler = file_list_handler };
+    httpd_uri_t get_uri = { .uri = "/files/*", .method = HTTP_GET, .handler = file_get_handler };
+    httpd_uri_t head_uri = { .uri = "/files/*", .method = HTTP_HEAD, .handler = file_get_handler };
+    httpd_register_uri_handler(s_server.server, &list_uri);
+    httpd_register_uri_handler(s_server.server, &get_uri);
+    httpd_register_uri_handler(s_server.server, &head_uri);
+
+    ESP_LOGI(TAG, "Serving %s on port %d, %d KB read-ahead", base_path, FILE_SERVER_PORT,
+             FILE_SERVER_CHUNK_COUNT * FILE_SERVER_CHUNK_SIZE / 1024);
+    return ESP_OK;
+
+fail:
+    for (int i = 0; i < FILE_SERVER_CHUNK_COUNT; i++) {
+        heap_caps_free(xfer->chunks[i].data);
+        xfer->chunks[i].data = NULL;
+    }
+    if (xfer->free_q) {
+        vQueueDelete(xfer->free_q);
+    }
+    if (xfer->full_q) {
+        vQueueDelete(xfer->full_q);
+    }
+    if (xfer->done) {
+        vSemaphoreDelete(xfer->done);
+    }
+    memset(xfer, 0, sizeof(*xfer));
+    xfer->fd = -1;
+    return ret;
+}
@@ -0,0 +1,39 @@
+/*
+ * HTTP file server for the files on the SD card
+ *
+ * GET /files lists the files of the card as JSON, GET and HEAD /files/<name>
+ * serve one of them. A single byte range is honoured, so an interrupted
+ * download of a long recording resumes where it stopped instead of starting
+ * over, and connections are kept alive between requests.
+ *
+ * While a file is sent, a reader task reads ahead into a ring of large
+ * chunks, so the SD card reads and the network sends overlap.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the file server
+ *
+ * The network must be up. Only the files directly in base_path are served.
+ *
+ * @param base_path Mount point of the card, e.g. "/sdcard"
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if base_path is invalid
+ *      - ESP_ERR_INVALID_STATE if the server is already running
+ *      - ESP_ERR_NO_MEM if the read-ahead chunks could not be allocated
+ *      - Others if the HTTP server could not be started
+ */
+esp_err_t sd_file_server_start(const char *base_path);
+
+#ifdef __cplusplus
+}
+#endif
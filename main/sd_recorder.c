@@ -0,0 +1,268 @@
+/*
+ * SD card recorder for the HTTP streamer
+ *
+ * The recorder task subscribes only while recording, so with the JPEG
+ * format nothing is encoded for it while it is stopped. A container file is
+ * created on the first frame of a recording, sized for the geometry of that
+ * frame, and closed when it is full, when the geometry changes, e.g. after a
+ * new capture window, or when recording stops.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#include "frame_container.h"
+#include "frame_clock.h"
+#include "sd_card.h"
+#include "sd_recorder.h"
+#include "task_topology.h"
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD_JPEG
+#include "jpeg_pipeline.h"
+#endif
+
+#define MOUNT_POINT                 SD_CARD_MOUNT_POINT
+#define RECORD_MAX_FILES            2
+#define RECORD_MAX_FPS              CONFIG_EXAMPLE_HTTP_SD_RECORD_FPS
+#define RECORD_MAX_FRAMES           CONFIG_EXAMPLE_HTTP_SD_RECORD_MAX_FRAMES
+#define RECORD_FILE_LIMIT           (0xFFFFFFFFULL - 1024 * 1024)   /* FAT32 file size limit, with room for the index */
+#define RECORD_WAIT_MS              500
+#define RECORD_TASK_STACK_SIZE      4096
+#define RECORD_TASK_PRIORITY        TASK_PREVIEW_PRIORITY
+#define RECORD_TASK_CORE            TASK_CAPTURE_CORE
+
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD_JPEG
+#define RECORD_FORMAT               "JPEG"
+#define RECORD_JPEG_SLOT_SIZE       (CONFIG_EXAMPLE_HTTP_SD_RECORD_JPEG_SLOT_KB * 1024)
+#else
+#define RECORD_FORMAT               "captured"
+#endif
+
+static const char *TAG = "sd_recorder";
+
+typedef struct {
+    sd_recorder_config_t config;
+    TaskHandle_t task;
+    sdmmc_card_t *card;
+    sd_card_config_t card_config;
+    frame_subscriber_t *sub;
+    frame_container_t *container;
+    uint32_t width;                 /* Geometry of the frames in the container */
+    uint32_t height;
+    uint32_t capacity;
+    uint32_t next_index;            /* First recNNNN.rfc number that may be free */
+    volatile bool enabled;
+    portMUX_TYPE lock;              /* Guards stats */
+    sd_recorder_stats_t stats;
+} sd_recorder_t;
+
+static sd_recorder_t s_rec = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static esp_err_t sd_recorder_mount(void)
+{
+    s_rec.card_config = (sd_card_config_t)SD_CARD_DEFAULT_CONFIG();
+    s_rec.card_config.max_files = RECORD_MAX_FILES;
+    sd_card_load_config(&s_rec.card_config);
+
+    return sd_card_mount(&s_rec.card_config, &s_rec.card);
+}
+
+/* Frames of the recorded format, taken at the recorder rate */
+static frame_subscriber_t *sd_recorder_subscribe(void)
+{
+    frame_subscriber_config_t sub_config = FRAME_SUBSCRIBER_DEFAULT_CONFIG();
+
+    /* Only the latest frame waits, a slow card never holds more than two buffers */
+    sub_config.name = "sd_record";
+    sub_config.policy = FRAME_DELIVERY_LATEST_ONLY;
+    sub_config.max_fps = RECORD_MAX_FPS;
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD_JPEG
+    return jpeg_pipeline_subscribe(CONFIG_EXAMPLE_JPEG_COMPRESSION_QUALITY, &sub_config);
+#else
+    return frame_broadcaster_subscribe(s_rec.config.source, &sub_config);
+#endif
+}
+
+static void sd_recorder_close(void)
+{
+    if (!s_rec.container) {
+        return;
+    }
+
+    if (frame_container_close(s_rec.container) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write the index of %s", s_rec.stats.path);
+    } else {
+        ESP_LOGI(TAG, "Closed %s", s_rec.stats.path);
+    }
+    s_rec.container = NULL;
+
+    portENTER_CRITICAL(&s_rec.lock);
+    s_rec.stats.path[0] = '\0';
+    portEXIT_CRITICAL(&s_rec.lock);
+}
+
+/* Create the next free recNNNN.rfc for frames of this geometry */
+static esp_err_t sd_recorder_open(const frame_t *frame)
+{
+    char path[SD_RECORDER_PATH_LEN];
+    struct stat st;
+    frame_container_config_t container_config = {
+        .width = frame->width,
+        .height = frame->height,
+        .unit_size = sd_card_allocation_unit(&s_rec.card_config),
+    };
+
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD_JPEG
+    container_config.pixel_format = V4L2_PIX_FMT_JPEG;
+    container_config.frame_size = RECORD_JPEG_SLOT_SIZE;
+#else
+    container_config.pixel_format = s_rec.config.pixel_format;
+    container_config.bytesperline = frame->height ? frame->size / frame->height : 0;
+    container_config.frame_size = frame->size;
+#endif
+
+    /* Slots are allocation unit aligned, one more unit per slot is the worst case */
+    container_config.capacity = MIN(RECORD_MAX_FRAMES,
+                                    RECORD_FILE_LIMIT / (container_config.frame_size + container_config.unit_size));
+
+    do {
+        snprintf(path, sizeof(path), MOUNT_POINT "/rec%04"PRIu32".rfc", s_rec.next_index++);
+    } while (stat(path, &st) == 0);
+
+    ESP_RETURN_ON_ERROR(frame_container_create(MOUNT_POINT, path, &container_config, &s_rec.container),
+                        TAG, "Failed to create %s", path);
+    s_rec.width = frame->width;
+    s_rec.height = frame->height;
+    s_rec.capacity = container_config.capacity;
+
+    portENTER_CRITICAL(&s_rec.lock);
+    strlcpy(s_rec.stats.path, path, sizeof(s_rec.stats.path));
+    s_rec.stats.files++;
+    portEXIT_CRITICAL(&s_rec.lock);
+
+    ESP_LOGI(TAG, "Recording %s frames of %"PRIu32"x%"PRIu32" to %s", RECORD_FORMAT, frame->width, frame->height, path);
+    return ESP_OK;
+}
+
+static void sd_recorder_write(const frame_t *frame)
+{
+    esp_err_t ret = ESP_FAIL;
+    uint32_t exposure = 0;
+    uint32_t gain = 0;
+
+    if (s_rec.container && (frame->width != s_rec.width || frame->height != s_rec.height ||
+                            frame_container_get_count(s_rec.container) >= s_rec.capacity)) {
+        sd_recorder_close();
+    }
+    if (!s_rec.container && sd_recorder_open(frame) != ESP_OK) {
+        goto exit;
+    }
+
+    if (s_rec.config.get_exposure) {
+        s_rec.config.get_exposure(&exposure, &gain);
+    }
+
+    frame_container_entry_t entry = {
+        .timestamp_us = frame->timestamp_us,
+        .sequence = frame->sequence,
+        .size = frame->size,
+        .exposure = exposure,
+        .gain = gain,
+        .wall_time_us = frame_clock_to_wall_us(frame->timestamp_us),
+    };
+    ret = frame_container_append(s_rec.container, frame->data, &entry);
+
+exit:
+    portENTER_CRITICAL(&s_rec.lock);
+    if (ret == ESP_OK) {
+        s_rec.stats.frames++;
+        s_rec.stats.bytes += frame->size;
+    } else {
+        s_rec.stats.skipped++;
+    }
+    portEXIT_CRITICAL(&s_rec.lock);
+}
+
+static void sd_recorder_task(void *arg)
+{
+    const frame_t *frame;
+    frame_subscriber_stats_t sub_stats;
+
+    while (true) {
+        if (!s_rec.enabled) {
+            if (s_rec.sub) {
+                frame_broadcaster_unsubscribe(s_rec.sub);
+                s_rec.sub = NULL;
+            }
+            sd_recorder_close();
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!s_rec.sub) {
+            s_rec.sub = sd_recorder_subscribe();
+            if (!s_rec.sub) {
+                ESP_LOGE(TAG, "Failed to subscribe, recording stopped");
+                s_rec.enabled = false;
+                continue;
+            }
+        }
+
+        if (frame_subscriber_wait(s_rec.sub, &frame, pdMS_TO_TICKS(RECORD_WAIT_MS)) != ESP_OK) {
+            continue;
+        }
+        sd_recorder_write(frame);
+        frame_subscriber_release(s_rec.sub, frame);
+
+        if (frame_subscriber_get_stats(s_rec.sub, &sub_stats) == ESP_OK) {
+            portENTER_CRITICAL(&s_rec.lock);
+            s_rec.stats.dropped = sub_stats.dropped;
+            portEXIT_CRITICAL(&s_rec.lock);
+        }
+    }
+}
+
+esp_err_t sd_recorder_start(const sd_recorder_config_t *config)
+{
+    ESP_RETURN_ON_FALSE(config && config->source, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(!s_rec.task, ESP_ERR_INVALID_STATE, TAG, "already started");
+
+    ESP_RETURN_ON_ERROR(sd_recorder_mount(), TAG, "No SD card");
+    s_rec.config = *config;
+    s_rec.stats.mounted = true;
+#if CONFIG_EXAMPLE_HTTP_SD_RECORD_START
+    s_rec.enabled = true;
+#endif
+
+    ESP_RETURN_ON_FALSE(xTaskCreatePinnedToCore(sd_recorder_task, "sd_record", RECORD_TASK_STACK_SIZE, NULL,
+                                                RECORD_TASK_PRIORITY, &s_rec.task, RECORD_TASK_CORE) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "Failed to create recorder task");
+
+    ESP_LOGI(TAG, "Recorder ready, %s frames at up to %d fps, %s", RECORD_FORMAT, RECORD_MAX_FPS,
+             s_rec.enabled ? "recording" : "stopped");
+    return ESP_OK;
+}
+
+esp_err_t sd_recorder_set_enabled(bool enable)
+{
+    ESP_RETURN_ON_FALSE(s_rec.task, ESP_ERR_INVALID_STATE, TAG, "recorder not started");
+
+    s_rec.enabled = enable;
+    xTaskNotifyGive(s_rec.task);
+    return ESP_OK;
+}
+
+void sd_recorder_get_stats(sd_recorder_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_rec.lock);
+    *stats = s_rec.stats;
+    portEXIT_CRITICAL(&s_rec.lock);
+    stats->recording = s_rec.task && s_rec.enabled;
+}
@@ -0,0 +1,95 @@
+/*
+ * SD card recorder for the HTTP streamer
+ *
+ * The recorder is one more subscriber of the capture pipeline: it takes
+ * camera frames, or the JPEG frames of the JPEG pipeline, at its own rate
+ * and appends them to indexed container files on the SD card, see
+ * frame_container.h. The network clients and the recorder share the same
+ * capture, the sensor and the ISP do no extra work for the recording.
+ *
+ * The recorder only keeps the latest frame queued, a card that falls behind
+ * drops recorder frames instead of holding capture buffers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_RECORDER_PATH_LEN    32
+
+/**
+ * @brief Read the sensor exposure and gain stamped on the recorded frames
+ *
+ * @param exposure Returned exposure
+ * @param gain     Returned gain
+ */
+typedef void (*sd_recorder_exposure_cb_t)(uint32_t *exposure, uint32_t *gain);
+
+/**
+ * @brief Recorder configuration
+ */
+typedef struct {
+    frame_broadcaster_handle_t source;      /*!< Broadcaster of the camera frames */
+    uint32_t pixel_format;                  /*!< Camera pixel format */
+    sd_recorder_exposure_cb_t get_exposure; /*!< Exposure and gain of the frames, can be NULL */
+} sd_recorder_config_t;
+
+/**
+ * @brief Recorder statistics
+ */
+typedef struct {
+    bool mounted;                           /*!< The SD card is mounted */
+    bool recording;                         /*!< The recorder takes frames */
+    char path[SD_RECORDER_PATH_LEN];        /*!< File being recorded, empty if none */
+    uint32_t files;                         /*!< Files started */
+    uint32_t frames;                        /*!< Frames written */
+    uint64_t bytes;                         /*!< Frame bytes written */
+    uint32_t skipped;                       /*!< Frames not written, too large for a slot or a failed write */
+    uint32_t dropped;                       /*!< Frames the card was too slow for */
+} sd_recorder_stats_t;
+
+/**
+ * @brief Mount the SD card and start the recorder task
+ *
+ * With CONFIG_EXAMPLE_HTTP_SD_RECORD_START the recorder starts recording at
+ * once, otherwise after sd_recorder_set_enabled().
+ *
+ * @param config Recorder configuration
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - Others if the card could not be mounted or the task not created
+ */
+esp_err_t sd_recorder_start(const sd_recorder_config_t *config);
+
+/**
+ * @brief Start or stop recording
+ *
+ * Stopping closes the file being recorded, starting records into a new file.
+ *
+ * @param enable Record frames
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the recorder is not started
+ */
+esp_err_t sd_recorder_set_enabled(bool enable);
+
+/**
+ * @brief Get the recorder statistics
+ *
+ * @param stats Returned statistics
+ */
+void sd_recorder_get_stats(sd_recorder_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
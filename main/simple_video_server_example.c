@@ -16,110 +16,249 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_err.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
+#include "esp_cache.h"
 #include "nvs_flash.h"
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
 #include "driver/sdmmc_host.h"
-#include "sd_pwr_ctrl_by_on_chip_ldo.h"
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+#include "esp_attr.h"
+#include "driver/gpio.h"
+#endif
 #include "example_video_common.h"
+#include "capture_buffers.h"
+#include "frame_clock.h"
+#include "trace_ring.h"
+#include "task_topology.h"
+#include "sd_benchmark.h"
+#include "sd_card.h"
+#if CONFIG_EXAMPLE_SD_RECORD || CONFIG_EXAMPLE_SD_BURST
+#include "frame_container.h"
+#endif
+#if CONFIG_EXAMPLE_SD_SNAPSHOT_DNG_PACKED10 || CONFIG_EXAMPLE_SD_SNAPSHOT_DNG_UNPACKED16
+#include <math.h>
+#include "dng_writer.h"
+#endif
+#if (CONFIG_EXAMPLE_SD_SNAPSHOT && CONFIG_EXAMPLE_SD_STACK_FRAMES > 1) || \
+    CONFIG_EXAMPLE_SD_CALIB_CAPTURE_DARK || CONFIG_EXAMPLE_SD_CALIB_CAPTURE_FLAT
+#include "frame_stack.h"
+#endif
+#if CONFIG_EXAMPLE_SD_SNAPSHOT && CONFIG_EXAMPLE_SD_CALIB
+#include "raw_calib.h"
+#endif
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+#include "raw_stats.h"
+#endif
+#if CONFIG_EXAMPLE_SD_TIMELAPSE
+#include <math.h>
+#include <sys/param.h>
+#include "esp_video_ioctl.h"
+#endif
+#if CONFIG_EXAMPLE_SD_THUMBNAIL
+#include "thumbnail.h"
+#endif
+#if CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE
+#include "esp_video_ioctl.h"
+#endif
+#if CONFIG_EXAMPLE_SD_ASYNC_COPY
+#include "esp_attr.h"
+#include "esp_video_async_copy.h"
+#endif
+#if CONFIG_EXAMPLE_SD_FILE_SERVER
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "protocol_examples_common.h"
+#include "sd_file_server.h"
+#endif
 
 /* Configuration */
-#define VIDEO_BUFFER_COUNT      2
-#define MOUNT_POINT             "/sdcard"
+#define MOUNT_POINT             SD_CARD_MOUNT_POINT
+#define FRAME_COPY_TIMEOUT_MS   100     /* A full frame copy by the DMA takes a few ms */
 #define FRAMES_TO_CAPTURE       3       /* Number of frames to save */
 #define FRAME_INTERVAL_MS       2000    /* Interval between saves (ms) */
 
-/* SD Card Pin Configuration for ESP32-P4 */
-#define SD_PIN_CLK              43
-#define SD_PIN_CMD              44
-#define SD_PIN_D0               39
-#define SD_PIN_D1               40
-#define SD_PIN_D2               41
-#define SD_PIN_D3               42
-#define SD_LDO_CHANNEL_ID       4
+#if CONFIG_EXAMPLE_SD_RECORD
+#define RECORD_SLOT_STOP        0xFF    /* Sent to the writer after the last frame */
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+/* The pre-trigger window is held in the ring on top of the slots that absorb write stalls */
+#define RECORD_PRE_FRAMES       CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER_FRAMES
+#else
+#define RECORD_PRE_FRAMES       0
+#endif
+#define RECORD_RING_SLOTS       (CONFIG_EXAMPLE_SD_RECORD_RING_FRAMES + RECORD_PRE_FRAMES)
+#define RECORD_WRITER_PRIORITY  (TASK_CAPTURE_PRIORITY > 1 ? TASK_CAPTURE_PRIORITY - 1 : 1)
+#define RECORD_STATS_BUFFER     16384   /* Statistics records are written in chunks, not one per frame */
+#endif
+
+#if CONFIG_EXAMPLE_SD_TIMELAPSE
+#define TIMELAPSE_INTERVAL_US   (CONFIG_EXAMPLE_SD_TIMELAPSE_INTERVAL_S * 1000000LL)
+#define TIMELAPSE_MAX_FRAMES    (CONFIG_EXAMPLE_SD_TIMELAPSE_SKIP_FRAMES + 4 * CONFIG_EXAMPLE_SD_TIMELAPSE_AE_FRAMES)
+#define TIMELAPSE_BLACK_LEVEL   50      /* IMX662 BLKLEVEL in 10-bit mode */
+#define TIMELAPSE_AE_TOLERANCE  0.125f  /* Relative level error a frame is saved with */
+#define TIMELAPSE_AE_MAX_STEP   16.0f   /* Largest exposure change of one AE step */
+#define TIMELAPSE_GAIN_STEP_DB  0.3f
+#endif
+
+#if CONFIG_EXAMPLE_SD_RECORD || CONFIG_EXAMPLE_SD_BURST
+#define EXPOSURE_REFRESH_US     100000  /* Sensor exposure and gain read for the container index */
+#endif
+
+/* Snapshots are converted to DNG, or else compressed losslessly when the RAW codec is enabled */
+#if CONFIG_EXAMPLE_SD_SNAPSHOT_DNG_PACKED10 || CONFIG_EXAMPLE_SD_SNAPSHOT_DNG_UNPACKED16
+#define SNAPSHOT_DNG            1
+#define FRAME_FILE_EXT          "dng"
+#elif CONFIG_ESP_VIDEO_ENABLE_RAW_CODEC_VIDEO_DEVICE && CONFIG_EXAMPLE_SD_SNAPSHOT
+#define SNAPSHOT_RAW_CODEC      1
+#define FRAME_FILE_EXT          "r10r"
+#else
+#define FRAME_FILE_EXT          "raw"
+#endif
+
+/* In low light a snapshot is the mean of several consecutive frames */
+#if CONFIG_EXAMPLE_SD_SNAPSHOT && CONFIG_EXAMPLE_SD_STACK_FRAMES > 1
+#define SNAPSHOT_STACK          1
+#endif
+
+/* Snapshots are corrected with the master dark and flat frames, the masters are stacked as well */
+#if CONFIG_EXAMPLE_SD_SNAPSHOT && CONFIG_EXAMPLE_SD_CALIB
+#define SNAPSHOT_CALIB          1
+#define CALIB_FILE              MOUNT_POINT"/calib.rcb"
+#endif
+#if CONFIG_EXAMPLE_SD_CALIB_CAPTURE_DARK || CONFIG_EXAMPLE_SD_CALIB_CAPTURE_FLAT
+#define CALIB_CAPTURE           1
+#endif
+#if SNAPSHOT_STACK || CALIB_CAPTURE
+#define USE_FRAME_STACK         1
+#endif
+#if !SNAPSHOT_STACK && (!SNAPSHOT_DNG || SNAPSHOT_CALIB) && !CONFIG_EXAMPLE_SD_TIMELAPSE
+#define FRAME_COPY              1
+#endif
+
+#if SNAPSHOT_DNG
+#define SENSOR_LINE_TIME_NS     26667   /* IMX662 1H period, HMAX 1980 at 74.25 MHz */
+#define SENSOR_GAIN_STEP_DB     0.3f
+#endif
+
+#if CONFIG_EXAMPLE_SD_THUMBNAIL
+/* Black level of the frames thumbnails are made of, corrected snapshots sit at the pedestal */
+#if SNAPSHOT_CALIB
+#define THUMBNAIL_BLACK_LEVEL   CONFIG_EXAMPLE_SD_CALIB_PEDESTAL
+#elif SNAPSHOT_DNG
+#define THUMBNAIL_BLACK_LEVEL   CONFIG_EXAMPLE_SD_DNG_BLACK_LEVEL
+#else
+#define THUMBNAIL_BLACK_LEVEL   50      /* IMX662 BLKLEVEL in 10-bit mode */
+#endif
+#if !SNAPSHOT_DNG
+#define THUMBNAIL_SIDECAR       1       /* DNG snapshots carry the thumbnail as their preview */
+#endif
+#endif
 
 static const char *TAG = "raw_capture";
 
 /* Camera state */
 typedef struct {
     int fd;
-    uint8_t *buffer[VIDEO_BUFFER_COUNT];
+    capture_buffers_t bufs;
     uint32_t buffer_size;
     uint32_t width;
     uint32_t height;
     uint32_t pixel_format;
     uint32_t bytesperline;  /* Stride - bytes per line including padding */
     uint8_t *save_buffer;  /* Buffer for saving to SD (to avoid DMA corruption) */
+    size_t cache_align;     /* Cache line size of the frame buffers */
+#if CONFIG_EXAMPLE_SD_ASYNC_COPY
+    esp_video_async_copy_handle_t copy;
+    SemaphoreHandle_t copy_done;
+#endif
+#if SNAPSHOT_RAW_CODEC
+    int codec_fd;           /* Lossless RAW codec M2M device */
+    uint8_t *codec_buffer;  /* Compressed frame */
+#endif
+#if USE_FRAME_STACK
+    frame_stack_t *stack;   /* Accumulator of the snapshot frames, the mean goes to save_buffer */
+#endif
+#if SNAPSHOT_CALIB
+    raw_calib_t *calib;     /* Dark and flat correction, NULL if it could not be set up */
+#endif
+#if CONFIG_EXAMPLE_SD_THUMBNAIL
+    thumbnail_t *thumb;     /* Thumbnail encoder, NULL if the JPEG device could not be set up */
+#endif
 } camera_t;
 
 /* SD Card state */
 typedef struct {
     sdmmc_card_t *card;
     bool mounted;
+    sd_card_config_t config;    /* Bus settings, changed by the benchmark between remounts */
 } sdcard_t;
 
-static camera_t s_camera = {.fd = -1};
-static sdcard_t s_sdcard = {0};
+static camera_t s_camera = {
+    .fd = -1,
+#if SNAPSHOT_RAW_CODEC
+    .codec_fd = -1,
+#endif
+};
+static sdcard_t s_sdcard = {
+    .config = SD_CARD_DEFAULT_CONFIG(),
+};
+
+#if CONFIG_EXAMPLE_SD_RECORD
+/* Continuous recording, frames travel from the capture task to the writer through a ring in PSRAM */
+typedef struct {
+    uint8_t *slots[RECORD_RING_SLOTS];
+    frame_container_entry_t entries[RECORD_RING_SLOTS];
+    QueueHandle_t free_queue;   /* Slot indices the capture task can fill */
+    QueueHandle_t full_queue;   /* Slot indices waiting for the writer */
+    TaskHandle_t capture_task;
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    TaskHandle_t writer_task;
+    volatile bool triggered;
+    int64_t trigger_time;
+    uint32_t pre_dropped;       /* Frames that aged out of the pre-trigger window */
+#endif
+    frame_container_t *container;
+    char filename[32];
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+    raw_stats_t *stats;         /* Statistics of the frame in every slot */
+    FILE *stats_file;
+#endif
+    uint32_t frames_queued;
+    uint32_t frames_written;
+    uint64_t bytes_written;
+    uint32_t overruns;          /* Frames dropped because every slot was waiting for the card */
+    uint32_t write_errors;
+} record_t;
+
+static record_t s_record;
+#endif
+
+#if CONFIG_EXAMPLE_SD_BURST
+/* Burst capture, every frame of the burst has its own PSRAM buffer */
+typedef struct {
+    uint8_t **frames;
+    frame_container_entry_t *entries;
+    uint32_t count;
+} burst_t;
+
+static burst_t s_burst;
+#endif
 
 /*
- * Initialize SD Card with LDO power control (ESP32-P4 specific)
+ * Mount the SD card and check that it can be written
  */
 static esp_err_t init_sdcard(void)
 {
-    esp_err_t ret;
-
     ESP_LOGI(TAG, "Initializing SD card...");
 
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024
-    };
-
-    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
-
-    /* Configure internal LDO for SD card power (ESP32-P4 specific) */
-    sd_pwr_ctrl_ldo_config_t ldo_config = {
-        .ldo_chan_id = SD_LDO_CHANNEL_ID,
-    };
-    sd_pwr_ctrl_handle_t pwr_ctrl_handle = NULL;
-
-    ret = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &pwr_ctrl_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize SD card LDO power control");
-        return ret;
-    }
-    host.pwr_ctrl_handle = pwr_ctrl_handle;
-
-    /* Configure SDMMC slot with explicit pins */
-    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
-    slot_config.width = 4;
-    slot_config.clk = SD_PIN_CLK;
-    slot_config.cmd = SD_PIN_CMD;
-    slot_config.d0 = SD_PIN_D0;
-    slot_config.d1 = SD_PIN_D1;
-    slot_config.d2 = SD_PIN_D2;
-    slot_config.d3 = SD_PIN_D3;
-    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
-
-    ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &s_sdcard.card);
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount filesystem");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize SD card: %s", esp_err_to_name(ret));
-        }
-        return ret;
-    }
-
+    ESP_RETURN_ON_ERROR(sd_card_mount(&s_sdcard.config, &s_sdcard.card), TAG, "SD card mount failed");
     s_sdcard.mounted = true;
-    ESP_LOGI(TAG, "SD card mounted at %s", MOUNT_POINT);
-    sdmmc_card_print_info(stdout, s_sdcard.card);
 
     /* Verify we can write to the SD card */
     FILE *test = fopen(MOUNT_POINT "/test.txt", "w");
@@ -141,12 +280,64 @@ static esp_err_t init_sdcard(void)
 static void deinit_sdcard(void)
 {
     if (s_sdcard.mounted) {
-        esp_vfs_fat_sdcard_unmount(MOUNT_POINT, s_sdcard.card);
+        sd_card_unmount(s_sdcard.card);
         s_sdcard.mounted = false;
-        ESP_LOGI(TAG, "SD card unmounted");
     }
 }
 
+#if !CONFIG_EXAMPLE_SD_BENCHMARK
+#if (!SNAPSHOT_DNG || USE_FRAME_STACK || SNAPSHOT_CALIB) && !CONFIG_EXAMPLE_SD_TIMELAPSE
+#define FRAME_ALIGN(size)       (((size) + s_camera.cache_align - 1) / s_camera.cache_align * s_camera.cache_align)
+
+/*
+ * Allocate a PSRAM frame buffer, cache line aligned for the DMA copy and the codec
+ */
+static uint8_t *alloc_frame_buffer(void)
+{
+    return heap_caps_aligned_alloc(s_camera.cache_align, FRAME_ALIGN(s_camera.buffer_size), MALLOC_CAP_SPIRAM);
+}
+#endif
+
+/* Stacked snapshots need no copy, a corrected DNG is converted from one as the capture buffer is not written by the CPU */
+#if FRAME_COPY
+
+#if CONFIG_EXAMPLE_SD_ASYNC_COPY
+static bool IRAM_ATTR frame_copy_done(void *dst, size_t size, void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    xSemaphoreGiveFromISR(s_camera.copy_done, &woken);
+    return woken == pdTRUE;
+}
+#endif
+
+/*
+ * Copy a dequeued frame out of its capture buffer
+ *
+ * With the DMA copy the task sleeps until the copy lands, so the other tasks
+ * on the core run meanwhile and the buffer can be queued again right after.
+ */
+static esp_err_t copy_frame(uint8_t *dst, const struct v4l2_buffer *buf)
+{
+    const uint8_t *src = s_camera.bufs.data[buf->index];
+
+#if CONFIG_EXAMPLE_SD_ASYNC_COPY
+    /* Capture buffers are queued with NO_CACHE_CLEAN, the driver clears it if its CPU preprocessing wrote the frame */
+    uint32_t flags = (buf->flags & V4L2_BUF_FLAG_NO_CACHE_CLEAN) ? ESP_VIDEO_ASYNC_COPY_FLAG_NO_SRC_CLEAN : 0;
+
+    /* Both buffers are padded to the cache line, so the tail of the last line is copied along */
+    if (s_camera.copy && esp_video_async_copy_start(s_camera.copy, dst, src, FRAME_ALIGN(buf->bytesused), flags,
+                                                    frame_copy_done, NULL) == ESP_OK) {
+        ESP_RETURN_ON_FALSE(xSemaphoreTake(s_camera.copy_done, pdMS_TO_TICKS(FRAME_COPY_TIMEOUT_MS)) == pdTRUE,
+                            ESP_ERR_TIMEOUT, TAG, "Frame copy timed out");
+        return ESP_OK;
+    }
+#endif
+    memcpy(dst, src, buf->bytesused);
+    return ESP_OK;
+}
+#endif
+
 /*
  * Initialize Camera
  */
@@ -154,7 +345,7 @@ static esp_err_t init_camera(void)
 {
     int fd;
     struct v4l2_format format;
-    struct v4l2_requestbuffers req;
+    capture_buffers_config_t buffers_config = CAPTURE_BUFFERS_DEFAULT_CONFIG();
 
     ESP_LOGI(TAG, "Initializing camera...");
 
@@ -215,59 +406,162 @@ static esp_err_t init_camera(void)
         ESP_LOGW(TAG, "Bytesperline mismatch! Image may have padding.");
     }
 
-    /* Request buffers */
-    memset(&req, 0, sizeof(req));
-    req.count = VIDEO_BUFFER_COUNT;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (ioctl(fd, VIDIOC_REQBUFS, &req) != 0) {
-        ESP_LOGE(TAG, "Failed to request buffers");
+    /* Request, allocate and queue buffers */
+    if (capture_buffers_alloc(fd, &buffers_config, &s_camera.bufs) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to allocate buffers");
         close(fd);
         return ESP_FAIL;
     }
-
-    /* Map buffers */
-    for (int i = 0; i < VIDEO_BUFFER_COUNT; i++) {
-        struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-
-        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) != 0) {
-            ESP_LOGE(TAG, "Failed to query buffer %d", i);
-            close(fd);
-            return ESP_FAIL;
-        }
-
-        s_camera.buffer[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
-        if (s_camera.buffer[i] == MAP_FAILED) {
-            ESP_LOGE(TAG, "Failed to mmap buffer %d", i);
-            close(fd);
-            return ESP_FAIL;
-        }
-        s_camera.buffer_size = buf.length;
-
-        /* Queue buffer */
-        if (ioctl(fd, VIDIOC_QBUF, &buf) != 0) {
-            ESP_LOGE(TAG, "Failed to queue buffer %d", i);
-            close(fd);
-            return ESP_FAIL;
-        }
+    s_camera.buffer_size = s_camera.bufs.size;
+    ESP_RETURN_ON_ERROR(esp_cache_get_alignment(MALLOC_CAP_SPIRAM, &s_camera.cache_align), TAG,
+                        "Failed to get cache alignment");
+
+#if CONFIG_EXAMPLE_SD_ASYNC_COPY && FRAME_COPY
+    /* Without the DMA channel frames are still copied, by the CPU */
+    s_camera.copy_done = xSemaphoreCreateBinary();
+    if (s_camera.copy_done == NULL || esp_video_async_copy_create(NULL, &s_camera.copy) != ESP_OK) {
+        ESP_LOGW(TAG, "DMA frame copy not available, copying with the CPU");
     }
+#endif
 
-    /* Allocate save buffer in PSRAM for SD card writing */
-    s_camera.save_buffer = heap_caps_malloc(s_camera.buffer_size, MALLOC_CAP_SPIRAM);
+#if CONFIG_EXAMPLE_SD_SNAPSHOT && (!SNAPSHOT_DNG || USE_FRAME_STACK || SNAPSHOT_CALIB)
+    /* Allocate save buffer in PSRAM for SD card writing, it is also the codec's input buffer */
+    s_camera.save_buffer = alloc_frame_buffer();
     if (s_camera.save_buffer == NULL) {
         ESP_LOGE(TAG, "Failed to allocate save buffer");
         close(fd);
         return ESP_ERR_NO_MEM;
     }
+#endif
+
+#if USE_FRAME_STACK
+    if (frame_stack_create(s_camera.width, s_camera.height, s_camera.bytesperline > 0 ? s_camera.bytesperline : expected_bpl,
+                           &s_camera.stack) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the frame stack");
+        close(fd);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+#if CONFIG_EXAMPLE_SD_THUMBNAIL
+    thumbnail_config_t thumb_config = {
+        .width = s_camera.width,
+        .height = s_camera.height,
+        .bytesperline = s_camera.bytesperline > 0 ? s_camera.bytesperline : expected_bpl,
+        .pixel_format = s_camera.pixel_format,
+        .black_level = THUMBNAIL_BLACK_LEVEL,
+        .max_width = CONFIG_EXAMPLE_SD_THUMBNAIL_WIDTH,
+        .quality = CONFIG_EXAMPLE_SD_THUMBNAIL_QUALITY,
+    };
+    /* The frames are still saved without thumbnails */
+    if (thumbnail_create(&thumb_config, &s_camera.thumb) != ESP_OK) {
+        ESP_LOGW(TAG, "Thumbnails not available");
+    }
+#endif
 
     ESP_LOGI(TAG, "Camera initialized, buffer_size=%"PRIu32" bytes", s_camera.buffer_size);
     return ESP_OK;
 }
 
+#if SNAPSHOT_RAW_CODEC
+/*
+ * Initialize the lossless RAW codec, compressing from the save buffer
+ */
+static esp_err_t init_raw_codec(void)
+{
+    int fd;
+    esp_err_t ret = ESP_OK;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    int type;
+
+    fd = open(ESP_VIDEO_RAW_CODEC_DEVICE_NAME, O_RDONLY);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_ERR_NOT_FOUND, TAG, "Failed to open RAW codec device");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = s_camera.width;
+    format.fmt.pix.height = s_camera.height;
+    format.fmt.pix.pixelformat = s_camera.pixel_format;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG, "Failed to set codec input format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "Failed to request codec input buffer");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = s_camera.width;
+    format.fmt.pix.height = s_camera.height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_ESP_RAW10_RICE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_ERR_NOT_SUPPORTED, fail, TAG, "Failed to set codec output format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "Failed to request codec output buffer");
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = 0;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, fail, TAG, "Failed to query codec output buffer");
+
+    s_camera.codec_buffer = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+    ESP_GOTO_ON_FALSE(s_camera.codec_buffer != MAP_FAILED, ESP_ERR_NO_MEM, fail, TAG, "Failed to mmap codec output buffer");
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "Failed to start codec output");
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "Failed to start codec input");
+
+    s_camera.codec_fd = fd;
+    ESP_LOGI(TAG, "RAW codec initialized, frames are saved as ." FRAME_FILE_EXT);
+    return ESP_OK;
+
+fail:
+    close(fd);
+    return ret;
+}
+
+/*
+ * Compress one frame, the result stays valid until the next call
+ */
+static esp_err_t compress_raw_frame(uint8_t *data, size_t size, uint8_t **out, size_t *out_size)
+{
+    struct v4l2_buffer out_buf;
+    struct v4l2_buffer cap_buf;
+
+    memset(&cap_buf, 0, sizeof(cap_buf));
+    cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cap_buf.memory = V4L2_MEMORY_MMAP;
+    cap_buf.index = 0;
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.codec_fd, VIDIOC_QBUF, &cap_buf) == 0, ESP_FAIL, TAG, "Codec QBUF output failed");
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.index = 0;
+    out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    out_buf.memory = V4L2_MEMORY_USERPTR;
+    out_buf.m.userptr = (unsigned long)data;
+    out_buf.length = size;
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.codec_fd, VIDIOC_QBUF, &out_buf) == 0, ESP_FAIL, TAG, "Codec QBUF input failed");
+
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.codec_fd, VIDIOC_DQBUF, &cap_buf) == 0, ESP_FAIL, TAG, "Codec DQBUF output failed");
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.codec_fd, VIDIOC_DQBUF, &out_buf) == 0, ESP_FAIL, TAG, "Codec DQBUF input failed");
+    ESP_RETURN_ON_FALSE(cap_buf.bytesused, ESP_FAIL, TAG, "Compression failed");
+
+    ESP_LOGI(TAG, "Compressed %zu -> %"PRIu32" bytes (%.2fx)", size, cap_buf.bytesused, (float)size / cap_buf.bytesused);
+    *out = s_camera.codec_buffer;
+    *out_size = cap_buf.bytesused;
+    return ESP_OK;
+}
+#endif
+
+#if !CONFIG_EXAMPLE_SD_TIMELAPSE
 /*
  * Start camera streaming
  */
@@ -295,7 +589,10 @@ static esp_err_t stop_camera_stream(void)
     ESP_LOGI(TAG, "Camera stream stopped");
     return ESP_OK;
 }
+#endif
+#endif
 
+#if CONFIG_EXAMPLE_SD_SNAPSHOT || CONFIG_EXAMPLE_SD_TIMELAPSE
 /*
  * Save RAW12 frame to SD card
  */
@@ -304,8 +601,8 @@ static esp_err_t save_raw_frame(uint8_t *data, size_t size, uint32_t frame_num)
     char filename[32];
     FILE *f;
 
-    /* Simple filename: /sdcard/imgXXXX.raw */
-    snprintf(filename, sizeof(filename), MOUNT_POINT"/img%04"PRIu32".raw", frame_num);
+    /* Simple filename: /sdcard/imgXXXX.raw, .r10r when compressed */
+    snprintf(filename, sizeof(filename), MOUNT_POINT"/img%04"PRIu32"." FRAME_FILE_EXT, frame_num);
 
     ESP_LOGI(TAG, "Saving %s (%zu bytes)...", filename, size);
 
@@ -315,8 +612,10 @@ static esp_err_t save_raw_frame(uint8_t *data, size_t size, uint32_t frame_num)
         return ESP_FAIL;
     }
 
+    TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_START, size);
     size_t written = fwrite(data, 1, size, f);
     fclose(f);
+    TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_DONE, written);
 
     if (written != size) {
         ESP_LOGE(TAG, "Write error: wrote %zu of %zu bytes", written, size);
@@ -326,170 +625,1515 @@ static esp_err_t save_raw_frame(uint8_t *data, size_t size, uint32_t frame_num)
     ESP_LOGI(TAG, "Saved successfully");
     return ESP_OK;
 }
+#endif
 
+#if USE_FRAME_STACK
 /*
- * Capture and save frames task
+ * Stack the dequeued frame and the count - 1 ones that follow it, the mean lands in the save buffer
+ *
+ * Every buffer is queued again as soon as it is added, so the stream keeps
+ * running and the frames are consecutive as long as adding one is faster
+ * than the frame period.
  */
-static void capture_task(void *arg)
+static esp_err_t stack_frames(struct v4l2_buffer *buf, uint32_t count)
 {
-    struct v4l2_buffer buf;
-    uint32_t frame_count = 0;
-    uint32_t saved_count = 0;
-    int64_t start_time = esp_timer_get_time();
-    int64_t last_save_time = start_time - (FRAME_INTERVAL_MS * 1000);  /* Force first save immediately */
-
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
-    ESP_LOGI(TAG, "║       RAW10 CAPTURE TO SD CARD STARTING            ║");
-    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "Resolution: %"PRIu32"x%"PRIu32, s_camera.width, s_camera.height);
-    ESP_LOGI(TAG, "Format: RAW10 Bayer RGGB (SRGGB10), pixfmt=0x%08lx", (unsigned long)s_camera.pixel_format);
-    ESP_LOGI(TAG, "Bytesperline (stride): %"PRIu32, s_camera.bytesperline);
-    ESP_LOGI(TAG, "Frame size: %"PRIu32" bytes (RAW10 expected: %d)", s_camera.buffer_size, (1936*1100*10)/8);
-    ESP_LOGI(TAG, "Frames to capture: %d", FRAMES_TO_CAPTURE);
-    ESP_LOGI(TAG, "Interval: %d ms", FRAME_INTERVAL_MS);
-    ESP_LOGI(TAG, "");
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret;
 
-    while (saved_count < FRAMES_TO_CAPTURE) {
-        /* Dequeue buffer */
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
+    frame_stack_reset(s_camera.stack);
+    while (1) {
+        ret = frame_stack_add(s_camera.stack, s_camera.bufs.data[buf->index]);
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_QBUF, buf->index);
+        capture_buffers_queue(&s_camera.bufs, buf->index);
+        ESP_RETURN_ON_ERROR(ret, TAG, "Failed to stack frame");
+        if (frame_stack_count(s_camera.stack) == count) {
+            break;
+        }
 
-        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+        memset(buf, 0, sizeof(*buf));
+        buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf->memory = s_camera.bufs.memory;
+        if (ioctl(s_camera.fd, VIDIOC_DQBUF, buf) != 0) {
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
             ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
-            vTaskDelay(pdMS_TO_TICKS(100));
-            continue;
+            return ESP_FAIL;
         }
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf->index);
+    }
 
-        frame_count++;
-        int64_t now = esp_timer_get_time();
-
-        /* Log frame reception */
-        float elapsed = (now - start_time) / 1000000.0f;
-        float fps = frame_count / elapsed;
-        ESP_LOGI(TAG, "Frame %"PRIu32": %"PRIu32" bytes @ %.1f fps",
-                 frame_count, buf.bytesused, fps);
-
-        /* Debug: Show first bytes of first few lines to check alignment */
-        if (frame_count <= 2) {
-            uint8_t *frame_data = s_camera.buffer[buf.index];
-            /* RAW10: 5 bytes per 4 pixels, RAW12: 3 bytes per 2 pixels */
-            uint32_t bpl = s_camera.bytesperline > 0 ? s_camera.bytesperline : (s_camera.width * 5) / 4;
-            ESP_LOGI(TAG, "DEBUG: First 12 bytes of lines 0-3 (bytesperline=%"PRIu32"):", bpl);
-            for (int line = 0; line < 4; line++) {
-                uint8_t *line_ptr = frame_data + (line * bpl);
-                ESP_LOGI(TAG, "  Line %d: %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
-                         line,
-                         line_ptr[0], line_ptr[1], line_ptr[2], line_ptr[3],
-                         line_ptr[4], line_ptr[5], line_ptr[6], line_ptr[7],
-                         line_ptr[8], line_ptr[9], line_ptr[10], line_ptr[11]);
-            }
-        }
+    ESP_RETURN_ON_ERROR(frame_stack_get_mean(s_camera.stack, s_camera.save_buffer), TAG, "Failed to get the mean");
+    ESP_LOGI(TAG, "Stacked %"PRIu32" frames in %"PRId64" ms, %"PRIu32" pixels clipped",
+             frame_stack_count(s_camera.stack), (esp_timer_get_time() - start) / 1000,
+             frame_stack_clipped(s_camera.stack));
+    return ESP_OK;
+}
+#endif
 
-        /* Check if it's time to save */
-        if ((now - last_save_time) >= (FRAME_INTERVAL_MS * 1000)) {
-            /* Copy data to save buffer */
-            memcpy(s_camera.save_buffer, s_camera.buffer[buf.index], buf.bytesused);
-            size_t bytes_to_save = buf.bytesused;
+#if SNAPSHOT_CALIB
+/*
+ * Load the calibration from the card, after capturing a new master if configured
+ *
+ * Snapshots are saved uncorrected if it cannot be set up.
+ */
+static void init_calibration(void)
+{
+    uint32_t bpl = s_camera.bytesperline > 0 ? s_camera.bytesperline : (s_camera.width * 5) / 4;
+    esp_err_t ret;
 
-            /* Stop streaming while writing to SD to avoid DMA overflow */
-            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+    if (raw_calib_create(s_camera.width, s_camera.height, bpl, CONFIG_EXAMPLE_SD_CALIB_PEDESTAL,
+                         &s_camera.calib) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the calibration, snapshots are not corrected");
+        return;
+    }
 
-            /* Write to SD card (slow operation) */
-            esp_err_t ret = save_raw_frame(s_camera.save_buffer, bytes_to_save, saved_count + 1);
-            if (ret == ESP_OK) {
-                saved_count++;
-                last_save_time = esp_timer_get_time();  /* Update after save completes */
-            }
+    ret = raw_calib_load(s_camera.calib, CALIB_FILE);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "No " CALIB_FILE " on the card");
+    } else if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Ignoring " CALIB_FILE);
+    }
 
-            /* Re-queue all buffers and restart streaming */
-            for (int i = 0; i < VIDEO_BUFFER_COUNT; i++) {
-                struct v4l2_buffer qbuf;
-                memset(&qbuf, 0, sizeof(qbuf));
-                qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                qbuf.memory = V4L2_MEMORY_MMAP;
-                qbuf.index = i;
-                ioctl(s_camera.fd, VIDIOC_QBUF, &qbuf);
-            }
-            ioctl(s_camera.fd, VIDIOC_STREAMON, &type);
+#if CALIB_CAPTURE
+    struct v4l2_buffer buf = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory = s_camera.bufs.memory,
+    };
 
-            /* Reset timing for accurate FPS after pause */
-            start_time = esp_timer_get_time();
-            frame_count = 0;
-        } else {
-            /* Re-queue buffer */
-            ioctl(s_camera.fd, VIDIOC_QBUF, &buf);
-        }
+#if CONFIG_EXAMPLE_SD_CALIB_CAPTURE_DARK
+    ESP_LOGI(TAG, "Capturing the dark master, the lens must be covered");
+#else
+    ESP_LOGI(TAG, "Capturing the flat master, the sensor must see a uniform light source");
+    if (!(raw_calib_get_flags(s_camera.calib) & RAW_CALIB_FLAG_DARK)) {
+        ESP_LOGW(TAG, "No dark master yet, the flat field is taken against the pedestal");
     }
+#endif
+    if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+        ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
+        ret = ESP_FAIL;
+    } else {
+        ret = stack_frames(&buf, CONFIG_EXAMPLE_SD_CALIB_FRAMES);
+    }
+    if (ret == ESP_OK) {
+#if CONFIG_EXAMPLE_SD_CALIB_CAPTURE_DARK
+        raw_calib_set_dark(s_camera.calib, s_camera.save_buffer);
+#else
+        ret = raw_calib_set_flat(s_camera.calib, s_camera.save_buffer);
+#endif
+    }
+    if (ret == ESP_OK) {
+        /* The card write is long, the stream is stopped meanwhile as for the snapshots */
+        int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+        ret = raw_calib_save(s_camera.calib, CALIB_FILE);
+        capture_buffers_queue_all(&s_camera.bufs);
+        ioctl(s_camera.fd, VIDIOC_STREAMON, &type);
+    }
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Master of %d frames saved to " CALIB_FILE, CONFIG_EXAMPLE_SD_CALIB_FRAMES);
+    } else {
+        ESP_LOGE(TAG, "Failed to capture the master: %s", esp_err_to_name(ret));
+    }
+#endif
 
-    /* Final report */
-    int64_t total_time = esp_timer_get_time() - start_time;
-    float total_sec = total_time / 1000000.0f;
+    ESP_LOGI(TAG, "Snapshot correction: dark %s, flat %s",
+             (raw_calib_get_flags(s_camera.calib) & RAW_CALIB_FLAG_DARK) ? "yes" : "no",
+             (raw_calib_get_flags(s_camera.calib) & RAW_CALIB_FLAG_FLAT) ? "yes" : "no");
+}
 
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
-    ESP_LOGI(TAG, "║           CAPTURE COMPLETE                         ║");
-    ESP_LOGI(TAG, "╠════════════════════════════════════════════════════╣");
-    ESP_LOGI(TAG, "║  Frames received:  %4"PRIu32"                           ║", frame_count);
-    ESP_LOGI(TAG, "║  Frames saved:     %4"PRIu32"                           ║", saved_count);
-    ESP_LOGI(TAG, "║  Average FPS:      %5.1f                          ║", frame_count / total_sec);
-    ESP_LOGI(TAG, "║  Total time:       %5.1f sec                      ║", total_sec);
-    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "Files saved to SD card:");
-    for (uint32_t i = 1; i <= saved_count; i++) {
-        ESP_LOGI(TAG, "  - img%04"PRIu32".raw", i);
+/*
+ * Correct the snapshot in the save buffer
+ */
+static void correct_snapshot(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    if (s_camera.calib && raw_calib_get_flags(s_camera.calib)) {
+        raw_calib_apply(s_camera.calib, s_camera.save_buffer);
+        ESP_LOGI(TAG, "Corrected in %"PRId64" ms", (esp_timer_get_time() - start) / 1000);
     }
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "To decode RAW10 RGGB, use Python script or dcraw");
+}
+#endif
 
-    /* Stop streaming and cleanup */
-    stop_camera_stream();
-    deinit_sdcard();
+#if CONFIG_EXAMPLE_SD_RECORD || CONFIG_EXAMPLE_SD_BURST || SNAPSHOT_DNG || CONFIG_EXAMPLE_SD_TIMELAPSE
+/*
+ * Read the sensor exposure and gain, zero if the sensor does not report them
+ */
+static void camera_get_exposure(uint32_t *exposure, uint32_t *gain)
+{
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[2];
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+    controls.count = 2;
+    controls.controls = control;
+    control[0].id = V4L2_CID_EXPOSURE;
+    control[1].id = V4L2_CID_GAIN;
+    if (ioctl(s_camera.fd, VIDIOC_G_EXT_CTRLS, &controls) == 0) {
+        *exposure = control[0].value;
+        *gain = control[1].value;
+    }
+}
+#endif
 
-    ESP_LOGI(TAG, "Capture task finished. Safe to remove SD card.");
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+/*
+ * Statistics of a frame, with the sequence and timestamp of its buffer
+ */
+static void frame_stats(const uint8_t *data, uint32_t sequence, uint64_t timestamp_us, raw_stats_t *stats)
+{
+    raw_stats_config_t config = {
+        .width = s_camera.width,
+        .height = s_camera.height,
+        .bytesperline = s_camera.bytesperline > 0 ? s_camera.bytesperline : (s_camera.width * 5) / 4,
+        .pixel_format = s_camera.pixel_format,
+    };
 
-    /* Keep task alive */
-    while (1) {
-        vTaskDelay(pdMS_TO_TICKS(10000));
+    if (raw_stats_compute(&config, data, stats) != ESP_OK) {
+        memset(stats, 0, sizeof(*stats));
     }
+    stats->sequence = sequence;
+    stats->timestamp_us = timestamp_us;
 }
+#endif
 
-void app_main(void)
+#if ((CONFIG_EXAMPLE_SD_RECORD || CONFIG_EXAMPLE_SD_BURST) && CONFIG_EXAMPLE_SD_RAW_STATS) || THUMBNAIL_SIDECAR
+/*
+ * Sidecar file of a saved file, the same name with another extension
+ */
+static void sidecar_filename(const char *path, const char *extension, char *filename, size_t size)
 {
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "===========================================");
-    ESP_LOGI(TAG, "   IMX662 RAW10 Capture to SD Card");
-    ESP_LOGI(TAG, "===========================================");
-    ESP_LOGI(TAG, "");
+    const char *ext = strrchr(path, '.');
+    int len = ext ? ext - path : (int)strlen(path);
 
-    /* Initialize NVS */
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ESP_ERROR_CHECK(nvs_flash_init());
-    }
+    snprintf(filename, size, "%.*s.%s", len, path, extension);
+}
+#endif
 
-    /* Initialize SD Card first */
-    ret = init_sdcard();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "SD card initialization failed!");
-        ESP_LOGE(TAG, "Please insert SD card and restart.");
+#if THUMBNAIL_SIDECAR
+/*
+ * Save the thumbnail of a frame next to the file at path, the same name with .jpg
+ */
+static void save_thumbnail(const uint8_t *data, const char *path)
+{
+    const uint8_t *jpeg;
+    size_t size;
+    char filename[32];
+    FILE *f;
+
+    if (s_camera.thumb == NULL || thumbnail_encode(s_camera.thumb, data, &jpeg, &size) != ESP_OK) {
         return;
     }
 
-    /* Test write a simple file before camera init */
-    ESP_LOGI(TAG, ">>> Testing SD card write with simple file...");
-    FILE *testfile = fopen("/sdcard/test_raw.bin", "wb");
-    if (testfile) {
-        uint8_t testdata[1024];
-        memset(testdata, 0xAA, sizeof(testdata));
-        size_t written = fwrite(testdata, 1, sizeof(testdata), testfile);
-        fclose(testfile);
-        ESP_LOGI(TAG, ">>> Test file written: %zu bytes", written);
+    sidecar_filename(path, "jpg", filename, sizeof(filename));
+    f = fopen(filename, "wb");
+    if (f == NULL || fwrite(jpeg, 1, size, f) != size) {
+        ESP_LOGE(TAG, "Failed to write %s", filename);
+    } else {
+        ESP_LOGI(TAG, "Thumbnail saved to %s (%zu bytes)", filename, size);
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+#endif
+
+#if (CONFIG_EXAMPLE_SD_SNAPSHOT || CONFIG_EXAMPLE_SD_TIMELAPSE) && CONFIG_EXAMPLE_SD_RAW_STATS
+/*
+ * Save the statistics of a snapshot to /sdcard/imgXXXX.rst
+ */
+static void save_snapshot_stats(const uint8_t *data, const struct v4l2_buffer *buf, uint32_t frame_num)
+{
+    raw_stats_t stats;
+    char filename[32];
+    FILE *f;
+
+    frame_stats(data, buf->sequence, buf->timestamp.tv_sec * 1000000ULL + buf->timestamp.tv_usec, &stats);
+    for (int ch = 0; ch < RAW_STATS_CHANNELS; ch++) {
+        ESP_LOGI(TAG, "Channel %d: mean %.1f, min %u, max %u, %"PRIu32" of %"PRIu32" samples saturated", ch,
+                 stats.channel[ch].mean_x16 / 16.0f, stats.channel[ch].min, stats.channel[ch].max,
+                 stats.channel[ch].saturated, stats.channel[ch].samples);
+    }
+
+    snprintf(filename, sizeof(filename), MOUNT_POINT"/img%04"PRIu32".rst", frame_num);
+    f = fopen(filename, "wb");
+    if (f == NULL || fwrite(&stats, sizeof(stats), 1, f) != 1) {
+        ESP_LOGE(TAG, "Failed to write %s", filename);
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_RECORD || CONFIG_EXAMPLE_SD_BURST
+/*
+ * First unused /sdcard/<prefix>NNNN.rfc name
+ */
+static void next_container_filename(const char *prefix, char *filename, size_t size)
+{
+    struct stat st;
+
+    for (uint32_t i = 1; i <= 9999; i++) {
+        snprintf(filename, size, MOUNT_POINT"/%s%04"PRIu32".rfc", prefix, i);
+        if (stat(filename, &st) != 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Container entry of a dequeued frame
+ */
+static frame_container_entry_t container_entry(const struct v4l2_buffer *buf, uint32_t exposure, uint32_t gain)
+{
+    return (frame_container_entry_t) {
+        .timestamp_us = buf->timestamp.tv_sec * 1000000ULL + buf->timestamp.tv_usec,
+        .sequence = buf->sequence,
+        .size = buf->bytesused,
+        .exposure = exposure,
+        .gain = gain,
+        .wall_time_us = frame_clock_to_wall_us(buf->timestamp.tv_sec * 1000000LL + buf->timestamp.tv_usec),
+    };
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_RECORD
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+/*
+ * Trigger input, the first edge freezes the pre-trigger window and starts the writer
+ */
+static void IRAM_ATTR record_trigger_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (!s_record.triggered && s_record.writer_task) {
+        s_record.trigger_time = esp_timer_get_time();
+        s_record.triggered = true;
+        vTaskNotifyGiveFromISR(s_record.writer_task, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+#endif
+
+/*
+ * Allocate the frame ring and create the next free recording container
+ */
+static esp_err_t init_recording(void)
+{
+    uint8_t slot;
+
+    next_container_filename("rec", s_record.filename, sizeof(s_record.filename));
+
+    s_record.free_queue = xQueueCreate(RECORD_RING_SLOTS, sizeof(uint8_t));
+    s_record.full_queue = xQueueCreate(RECORD_RING_SLOTS + 1, sizeof(uint8_t));
+    ESP_RETURN_ON_FALSE(s_record.free_queue && s_record.full_queue, ESP_ERR_NO_MEM, TAG, "Failed to create ring queues");
+
+    for (slot = 0; slot < RECORD_RING_SLOTS; slot++) {
+        s_record.slots[slot] = alloc_frame_buffer();
+        ESP_RETURN_ON_FALSE(s_record.slots[slot], ESP_ERR_NO_MEM, TAG, "Failed to allocate ring slot %u", slot);
+        xQueueSend(s_record.free_queue, &slot, 0);
+    }
+
+    frame_container_config_t container_config = {
+        .width = s_camera.width,
+        .height = s_camera.height,
+        .pixel_format = s_camera.pixel_format,
+        .bytesperline = s_camera.bytesperline,
+        .frame_size = s_camera.buffer_size,
+        .capacity = CONFIG_EXAMPLE_SD_RECORD_MAX_FRAMES,
+        .unit_size = sd_card_allocation_unit(&s_sdcard.config),
+    };
+    ESP_RETURN_ON_ERROR(frame_container_create(MOUNT_POINT, s_record.filename, &container_config, &s_record.container),
+                        TAG, "Failed to create %s", s_record.filename);
+
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+    char filename[32];
+
+    s_record.stats = heap_caps_calloc(RECORD_RING_SLOTS, sizeof(raw_stats_t), MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(s_record.stats, ESP_ERR_NO_MEM, TAG, "Failed to allocate the slot statistics");
+    sidecar_filename(s_record.filename, "rst", filename, sizeof(filename));
+    s_record.stats_file = fopen(filename, "wb");
+    ESP_RETURN_ON_FALSE(s_record.stats_file, ESP_FAIL, TAG, "Failed to create %s", filename);
+    setvbuf(s_record.stats_file, NULL, _IOFBF, RECORD_STATS_BUFFER);
+#endif
+
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    gpio_config_t trigger_config = {
+        .pin_bit_mask = BIT64(CONFIG_EXAMPLE_SD_RECORD_TRIGGER_GPIO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    ESP_RETURN_ON_ERROR(gpio_config(&trigger_config), TAG, "Failed to configure trigger GPIO");
+    ESP_RETURN_ON_ERROR(gpio_install_isr_service(0), TAG, "Failed to install GPIO ISR service");
+    ESP_RETURN_ON_ERROR(gpio_isr_handler_add(CONFIG_EXAMPLE_SD_RECORD_TRIGGER_GPIO, record_trigger_isr, NULL),
+                        TAG, "Failed to add trigger handler");
+#endif
+
+    ESP_LOGI(TAG, "Recording to %s, ring of %d x %"PRIu32" bytes in PSRAM", s_record.filename,
+             RECORD_RING_SLOTS, s_camera.buffer_size);
+    return ESP_OK;
+}
+
+/*
+ * Append the filled ring slots to the recording file
+ */
+static void record_writer_task(void *arg)
+{
+    uint8_t slot;
+
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    /* Until the trigger the capture task keeps recycling the oldest frames */
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_LOGI(TAG, "Triggered, writing %"PRIu32" pre-trigger frames", (uint32_t)uxQueueMessagesWaiting(s_record.full_queue));
+#endif
+
+    while (xQueueReceive(s_record.full_queue, &slot, portMAX_DELAY) == pdTRUE && slot != RECORD_SLOT_STOP) {
+        TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_START, s_record.entries[slot].size);
+        esp_err_t ret = frame_container_append(s_record.container, s_record.slots[slot], &s_record.entries[slot]);
+        TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_DONE, ret == ESP_OK ? s_record.entries[slot].size : 0);
+
+        if (ret == ESP_OK) {
+            s_record.frames_written++;
+            s_record.bytes_written += s_record.entries[slot].size;
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+            fwrite(&s_record.stats[slot], sizeof(raw_stats_t), 1, s_record.stats_file);
+#endif
+        } else {
+            s_record.write_errors++;
+        }
+        xQueueSend(s_record.free_queue, &slot, 0);
+    }
+
+    if (frame_container_close(s_record.container) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write the index of %s", s_record.filename);
+    }
+    s_record.container = NULL;
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+    if (fclose(s_record.stats_file) != 0) {
+        ESP_LOGE(TAG, "Failed to write the statistics of %s", s_record.filename);
+    }
+    s_record.stats_file = NULL;
+#endif
+    xTaskNotifyGive(s_record.capture_task);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Record frames continuously, the camera keeps streaming during the writes
+ */
+static void record_task(void *arg)
+{
+    struct v4l2_buffer buf;
+    uint32_t frame_count = 0;
+    uint8_t slot;
+    int64_t start_time;
+    int64_t exposure_time = 0;
+    uint32_t exposure = 0;
+    uint32_t gain = 0;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║       RAW10 RECORDING TO SD CARD STARTING          ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Resolution: %"PRIu32"x%"PRIu32, s_camera.width, s_camera.height);
+    ESP_LOGI(TAG, "Frame size: %"PRIu32" bytes", s_camera.buffer_size);
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    ESP_LOGI(TAG, "Pre-trigger window: %d frames, trigger on GPIO %d", RECORD_PRE_FRAMES,
+             CONFIG_EXAMPLE_SD_RECORD_TRIGGER_GPIO);
+    ESP_LOGI(TAG, "Duration after the trigger: %d sec", CONFIG_EXAMPLE_SD_RECORD_SECONDS);
+#else
+    ESP_LOGI(TAG, "Duration: %d sec", CONFIG_EXAMPLE_SD_RECORD_SECONDS);
+#endif
+    ESP_LOGI(TAG, "");
+
+    s_record.capture_task = xTaskGetCurrentTaskHandle();
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    xTaskCreatePinnedToCore(record_writer_task, "sd_writer", 4096, NULL, RECORD_WRITER_PRIORITY, &s_record.writer_task,
+                            TASK_CAPTURE_CORE);
+#else
+    xTaskCreatePinnedToCore(record_writer_task, "sd_writer", 4096, NULL, RECORD_WRITER_PRIORITY, NULL, TASK_CAPTURE_CORE);
+#endif
+
+    start_time = esp_timer_get_time();
+    while (s_record.frames_queued < CONFIG_EXAMPLE_SD_RECORD_MAX_FRAMES) {
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+        /* The duration counts from the trigger */
+        if (s_record.triggered && esp_timer_get_time() >= s_record.trigger_time + CONFIG_EXAMPLE_SD_RECORD_SECONDS * 1000000LL) {
+            break;
+        }
+#else
+        if (esp_timer_get_time() >= start_time + CONFIG_EXAMPLE_SD_RECORD_SECONDS * 1000000LL) {
+            break;
+        }
+#endif
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = s_camera.bufs.memory;
+
+        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
+            ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        frame_count++;
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf.index);
+
+        if (esp_timer_get_time() - exposure_time >= EXPOSURE_REFRESH_US) {
+            camera_get_exposure(&exposure, &gain);
+            exposure_time = esp_timer_get_time();
+        }
+
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+        /* Before the trigger only the last frames are kept, the oldest one is recycled */
+        if (!s_record.triggered && uxQueueMessagesWaiting(s_record.full_queue) >= RECORD_PRE_FRAMES &&
+                xQueueReceive(s_record.full_queue, &slot, 0) == pdTRUE) {
+            s_record.frames_queued--;
+            s_record.pre_dropped++;
+            xQueueSend(s_record.free_queue, &slot, 0);
+        }
+#endif
+
+        /* Copy out and give the buffer straight back, the DMA never waits for the card */
+        if (xQueueReceive(s_record.free_queue, &slot, 0) == pdTRUE) {
+            if (copy_frame(s_record.slots[slot], &buf) == ESP_OK) {
+                s_record.entries[slot] = container_entry(&buf, exposure, gain);
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+                /* From the capture buffer, the slot is only read by the card DMA */
+                frame_stats(s_camera.bufs.data[buf.index], buf.sequence, s_record.entries[slot].timestamp_us,
+                            &s_record.stats[slot]);
+#endif
+                s_record.frames_queued++;
+                xQueueSend(s_record.full_queue, &slot, 0);
+            } else {
+                xQueueSend(s_record.free_queue, &slot, 0);
+            }
+        } else {
+            s_record.overruns++;
+            TRACE_RING_RECORD(TRACE_EVENT_SD_RING_OVERRUN, s_record.overruns);
+        }
+
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_QBUF, buf.index);
+        capture_buffers_queue(&s_camera.bufs, buf.index);
+    }
+
+    /* Let the writer drain the ring and close the file */
+    slot = RECORD_SLOT_STOP;
+    xQueueSend(s_record.full_queue, &slot, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    int64_t total_time = esp_timer_get_time() - start_time;
+    float total_sec = total_time / 1000000.0f;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║           RECORDING COMPLETE                       ║");
+    ESP_LOGI(TAG, "╠════════════════════════════════════════════════════╣");
+    ESP_LOGI(TAG, "║  Frames received:  %6"PRIu32"                         ║", frame_count);
+    ESP_LOGI(TAG, "║  Frames written:   %6"PRIu32"                         ║", s_record.frames_written);
+    ESP_LOGI(TAG, "║  Ring overruns:    %6"PRIu32"                         ║", s_record.overruns);
+    ESP_LOGI(TAG, "║  Write errors:     %6"PRIu32"                         ║", s_record.write_errors);
+    ESP_LOGI(TAG, "║  Write rate:       %6.2f MB/s                    ║", s_record.bytes_written / total_sec / 1e6f);
+    ESP_LOGI(TAG, "║  Total time:       %6.1f sec                     ║", total_sec);
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Recorded to %s", s_record.filename);
+#if CONFIG_EXAMPLE_SD_RECORD_PRE_TRIGGER
+    ESP_LOGI(TAG, "%"PRIu32" frames before the pre-trigger window were discarded", s_record.pre_dropped);
+#endif
+    if (s_record.overruns) {
+        ESP_LOGW(TAG, "The card could not keep up, %"PRIu32" frames were dropped", s_record.overruns);
+    }
+#if CONFIG_EXAMPLE_TRACE_RING
+    trace_ring_log_dump();
+#endif
+
+    stop_camera_stream();
+    deinit_sdcard();
+
+    ESP_LOGI(TAG, "Recording task finished. Safe to remove SD card.");
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_BURST
+/*
+ * Allocate one PSRAM buffer per burst frame, as many as fit
+ */
+static esp_err_t init_burst(void)
+{
+    size_t reserve = CONFIG_EXAMPLE_SD_BURST_PSRAM_RESERVE * 1024;
+    size_t free_size = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint32_t max_frames = free_size > reserve ? (free_size - reserve) / s_camera.buffer_size : 0;
+
+    if (CONFIG_EXAMPLE_SD_BURST_MAX_FRAMES && max_frames > CONFIG_EXAMPLE_SD_BURST_MAX_FRAMES) {
+        max_frames = CONFIG_EXAMPLE_SD_BURST_MAX_FRAMES;
+    }
+    ESP_RETURN_ON_FALSE(max_frames, ESP_ERR_NO_MEM, TAG, "No PSRAM for a burst frame (%zu bytes free)", free_size);
+
+    s_burst.frames = heap_caps_calloc(max_frames, sizeof(uint8_t *), MALLOC_CAP_8BIT);
+    s_burst.entries = heap_caps_calloc(max_frames, sizeof(frame_container_entry_t), MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(s_burst.frames && s_burst.entries, ESP_ERR_NO_MEM, TAG, "Failed to allocate burst index");
+
+    /* Separate buffers still fit when PSRAM is fragmented, stop at the reserve */
+    while (s_burst.count < max_frames && heap_caps_get_free_size(MALLOC_CAP_SPIRAM) >= s_camera.buffer_size + reserve) {
+        s_burst.frames[s_burst.count] = alloc_frame_buffer();
+        if (s_burst.frames[s_burst.count] == NULL) {
+            break;
+        }
+        s_burst.count++;
+    }
+    ESP_RETURN_ON_FALSE(s_burst.count, ESP_ERR_NO_MEM, TAG, "Failed to allocate burst frames");
+
+    ESP_LOGI(TAG, "Burst of %"PRIu32" frames, %.1f MB of PSRAM", s_burst.count,
+             (float)s_burst.count * s_camera.buffer_size / (1024 * 1024));
+    return ESP_OK;
+}
+
+/*
+ * Write the burst frames from PSRAM into a container
+ */
+static esp_err_t flush_burst(const char *filename, uint32_t *frames_written)
+{
+    esp_err_t ret = ESP_OK;
+    frame_container_t *container;
+    frame_container_config_t container_config = {
+        .width = s_camera.width,
+        .height = s_camera.height,
+        .pixel_format = s_camera.pixel_format,
+        .bytesperline = s_camera.bytesperline,
+        .frame_size = s_camera.buffer_size,
+        .capacity = s_burst.count,
+        .unit_size = sd_card_allocation_unit(&s_sdcard.config),
+    };
+
+    *frames_written = 0;
+    ESP_RETURN_ON_ERROR(frame_container_create(MOUNT_POINT, filename, &container_config, &container),
+                        TAG, "Failed to create %s", filename);
+
+    for (uint32_t i = 0; i < s_burst.count && ret == ESP_OK; i++) {
+        TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_START, s_burst.entries[i].size);
+        ret = frame_container_append(container, s_burst.frames[i], &s_burst.entries[i]);
+        TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_DONE, ret == ESP_OK ? s_burst.entries[i].size : 0);
+    }
+    *frames_written = frame_container_get_count(container);
+
+    if (frame_container_close(container) != ESP_OK && ret == ESP_OK) {
+        ret = ESP_FAIL;
+    }
+
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+    /* The frames are in PSRAM anyway, the statistics cost nothing during the burst */
+    char stats_name[32];
+    raw_stats_t *stats = heap_caps_malloc(sizeof(raw_stats_t), MALLOC_CAP_8BIT);
+    FILE *f;
+
+    sidecar_filename(filename, "rst", stats_name, sizeof(stats_name));
+    f = fopen(stats_name, "wb");
+    if (stats == NULL || f == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", stats_name);
+    } else {
+        for (uint32_t i = 0; i < *frames_written; i++) {
+            frame_stats(s_burst.frames[i], s_burst.entries[i].sequence, s_burst.entries[i].timestamp_us, stats);
+            fwrite(stats, sizeof(raw_stats_t), 1, f);
+        }
+    }
+    if (f && fclose(f) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s", stats_name);
+    }
+    heap_caps_free(stats);
+#endif
+#if THUMBNAIL_SIDECAR
+    /* One thumbnail stands for the whole burst */
+    if (*frames_written) {
+        save_thumbnail(s_burst.frames[0], filename);
+    }
+#endif
+    return ret;
+}
+
+/*
+ * Capture a burst of consecutive frames into PSRAM, then save it
+ */
+static void burst_task(void *arg)
+{
+    struct v4l2_buffer buf;
+    char filename[32];
+    uint32_t captured = 0;
+    uint32_t frames_written = 0;
+    uint32_t exposure = 0;
+    uint32_t gain = 0;
+    int64_t exposure_time = 0;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║       RAW10 BURST CAPTURE STARTING                 ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Resolution: %"PRIu32"x%"PRIu32, s_camera.width, s_camera.height);
+    ESP_LOGI(TAG, "Frame size: %"PRIu32" bytes", s_camera.buffer_size);
+    ESP_LOGI(TAG, "Burst length: %"PRIu32" frames", s_burst.count);
+    ESP_LOGI(TAG, "");
+
+    int64_t start_time = esp_timer_get_time();
+    while (captured < s_burst.count) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = s_camera.bufs.memory;
+
+        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
+            ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf.index);
+
+        if (esp_timer_get_time() - exposure_time >= EXPOSURE_REFRESH_US) {
+            camera_get_exposure(&exposure, &gain);
+            exposure_time = esp_timer_get_time();
+        }
+
+        /* Nothing but the copy between DQBUF and QBUF, the card is only touched after the burst */
+        if (copy_frame(s_burst.frames[captured], &buf) == ESP_OK) {
+            s_burst.entries[captured++] = container_entry(&buf, exposure, gain);
+        }
+
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_QBUF, buf.index);
+        capture_buffers_queue(&s_camera.bufs, buf.index);
+    }
+    float capture_sec = (esp_timer_get_time() - start_time) / 1000000.0f;
+    stop_camera_stream();
+
+    /* Gaps in the V4L2 sequence are frames the sensor delivered while every buffer was busy */
+    uint32_t missed = s_burst.entries[captured - 1].sequence - s_burst.entries[0].sequence + 1 - captured;
+
+    next_container_filename("burst", filename, sizeof(filename));
+    ESP_LOGI(TAG, "Burst captured in %.2f sec, flushing to %s...", capture_sec, filename);
+
+    int64_t flush_start = esp_timer_get_time();
+    esp_err_t ret = flush_burst(filename, &frames_written);
+    float flush_sec = (esp_timer_get_time() - flush_start) / 1000000.0f;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║           BURST COMPLETE                           ║");
+    ESP_LOGI(TAG, "╠════════════════════════════════════════════════════╣");
+    ESP_LOGI(TAG, "║  Frames captured:  %6"PRIu32"                         ║", captured);
+    ESP_LOGI(TAG, "║  Frames missed:    %6"PRIu32"                         ║", missed);
+    ESP_LOGI(TAG, "║  Burst FPS:        %6.1f                         ║", captured / capture_sec);
+    ESP_LOGI(TAG, "║  Frames written:   %6"PRIu32"                         ║", frames_written);
+    ESP_LOGI(TAG, "║  Flush time:       %6.1f sec                     ║", flush_sec);
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Burst saved to %s", filename);
+    } else {
+        ESP_LOGE(TAG, "Failed to save the burst: %s", esp_err_to_name(ret));
+    }
+#if CONFIG_EXAMPLE_TRACE_RING
+    trace_ring_log_dump();
+#endif
+
+    deinit_sdcard();
+
+    ESP_LOGI(TAG, "Burst task finished. Safe to remove SD card.");
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_BENCHMARK
+/* Host settings tried by the benchmark, DDR only counts when the card switched to it */
+typedef struct {
+    const char *name;
+    uint32_t max_freq_khz;
+    bool ddr;
+} benchmark_host_t;
+
+/* Source buffers tried by the benchmark */
+typedef enum {
+    BENCHMARK_BUF_INTERNAL = 0,     /* Internal DMA capable RAM, written by the card DMA directly */
+    BENCHMARK_BUF_PSRAM,            /* Cache line aligned PSRAM, like the capture buffers */
+    BENCHMARK_BUF_PSRAM_UNALIGNED,  /* PSRAM at an odd address */
+    BENCHMARK_BUF_MAX,
+} benchmark_buf_t;
+
+static const benchmark_host_t s_benchmark_hosts[] = {
+    {"default", SDMMC_FREQ_DEFAULT, false},
+    {"high speed", SDMMC_FREQ_HIGHSPEED, false},
+    {"DDR50", SDMMC_FREQ_DDR50, true},
+};
+static const char *s_benchmark_buf_names[] = {"internal", "psram", "psram+1"};
+static const uint32_t s_benchmark_write_sizes[] = {4096, 16384, 65536, 262144, 1048576};
+static const uint32_t s_benchmark_allocation_units[] = {16384, 32768, 65536};
+
+#define BENCHMARK_INTERNAL_MAX      65536   /* Largest internal RAM buffer tried */
+#define BENCHMARK_FILE              MOUNT_POINT"/bench.tmp"
+#define BENCHMARK_TOTAL_SIZE        (CONFIG_EXAMPLE_SD_BENCHMARK_SIZE_MB * 1024 * 1024)
+#define BENCHMARK_FRAME_SIZE        (1936 * 1100 * 10 / 8)  /* Full resolution RAW10 frame */
+
+/*
+ * Mount the card again with other host settings
+ */
+static esp_err_t benchmark_remount(uint32_t max_freq_khz, bool ddr)
+{
+    deinit_sdcard();
+    s_sdcard.config.max_freq_khz = max_freq_khz;
+    s_sdcard.config.ddr = ddr;
+    return init_sdcard();
+}
+
+/*
+ * Measure every write size and source buffer with the current host settings
+ */
+static void benchmark_host(uint8_t *buffers[BENCHMARK_BUF_MAX], const benchmark_host_t *host, sd_benchmark_result_t *best)
+{
+    uint32_t kb_per_s;
+
+    for (int b = 0; b < BENCHMARK_BUF_MAX; b++) {
+        for (int i = 0; i < sizeof(s_benchmark_write_sizes) / sizeof(s_benchmark_write_sizes[0]); i++) {
+            uint32_t write_size = s_benchmark_write_sizes[i];
+
+            if (buffers[b] == NULL || (b == BENCHMARK_BUF_INTERNAL && write_size > BENCHMARK_INTERNAL_MAX)) {
+                continue;
+            }
+            if (sd_benchmark_write(BENCHMARK_FILE, BENCHMARK_TOTAL_SIZE, buffers[b], write_size, &kb_per_s) != ESP_OK) {
+                ESP_LOGW(TAG, "  %-10s %-8s %7"PRIu32" B: failed", host->name, s_benchmark_buf_names[b], write_size);
+                continue;
+            }
+
+            ESP_LOGI(TAG, "  %-10s %-8s %7"PRIu32" B: %6.2f MB/s", host->name, s_benchmark_buf_names[b], write_size,
+                     kb_per_s / 1024.0f);
+            /* Only buffers like the capture buffers decide the persisted configuration */
+            if (b != BENCHMARK_BUF_PSRAM_UNALIGNED && kb_per_s > best->kb_per_s) {
+                best->max_freq_khz = host->max_freq_khz;
+                best->ddr = host->ddr;
+                best->write_size = write_size;
+                best->kb_per_s = kb_per_s;
+            }
+        }
+    }
+}
+
+#if CONFIG_EXAMPLE_SD_BENCHMARK_FORMAT
+/*
+ * Reformat the card with every allocation unit, the best one is left on the card
+ */
+static void benchmark_allocation_units(const uint8_t *buffer, sd_benchmark_result_t *best)
+{
+    uint32_t best_unit = 0;
+    uint32_t best_kb_per_s = 0;
+    uint32_t kb_per_s;
+
+    for (int i = 0; i <= sizeof(s_benchmark_allocation_units) / sizeof(s_benchmark_allocation_units[0]); i++) {
+        bool last = i == sizeof(s_benchmark_allocation_units) / sizeof(s_benchmark_allocation_units[0]);
+        esp_vfs_fat_mount_config_t format_config = {
+            .max_files = 5,
+            .allocation_unit_size = last ? best_unit : s_benchmark_allocation_units[i],
+        };
+
+        if (last && (best_unit == 0 || best_unit == s_benchmark_allocation_units[i - 1])) {
+            break;
+        }
+        if (esp_vfs_fat_sdcard_format_cfg(MOUNT_POINT, s_sdcard.card, &format_config) != ESP_OK) {
+            ESP_LOGW(TAG, "  Failed to format with %zu KB clusters", format_config.allocation_unit_size / 1024);
+            continue;
+        }
+        if (last) {
+            break;  /* Left formatted with the best allocation unit */
+        }
+        if (sd_benchmark_write(BENCHMARK_FILE, BENCHMARK_TOTAL_SIZE, buffer, best->write_size, &kb_per_s) == ESP_OK) {
+            ESP_LOGI(TAG, "  %3zu KB clusters: %6.2f MB/s", format_config.allocation_unit_size / 1024, kb_per_s / 1024.0f);
+            if (kb_per_s > best_kb_per_s) {
+                best_kb_per_s = kb_per_s;
+                best_unit = format_config.allocation_unit_size;
+            }
+        }
+    }
+
+    if (best_unit) {
+        best->allocation_unit = best_unit;
+        best->kb_per_s = best_kb_per_s;
+    }
+}
+#endif
+
+/*
+ * Measure the card, persist the fastest configuration and tell whether RAW10 recording keeps up
+ */
+static void benchmark_task(void *arg)
+{
+    uint8_t *buffers[BENCHMARK_BUF_MAX] = {0};
+    uint8_t *psram = NULL;
+    sd_benchmark_result_t best = {0};
+    size_t largest = s_benchmark_write_sizes[sizeof(s_benchmark_write_sizes) / sizeof(s_benchmark_write_sizes[0]) - 1];
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║       SD CARD WRITE BENCHMARK STARTING             ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "%d MB per test, writes of 4 KB to 1 MB", CONFIG_EXAMPLE_SD_BENCHMARK_SIZE_MB);
+    ESP_LOGI(TAG, "");
+
+    buffers[BENCHMARK_BUF_INTERNAL] = heap_caps_aligned_alloc(64, BENCHMARK_INTERNAL_MAX,
+                                                              MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    psram = heap_caps_aligned_alloc(64, largest + 64, MALLOC_CAP_SPIRAM);
+    if (psram) {
+        buffers[BENCHMARK_BUF_PSRAM] = psram;
+        buffers[BENCHMARK_BUF_PSRAM_UNALIGNED] = psram + 1;
+        memset(psram, 0x5A, largest + 64);
+    }
+    if (buffers[BENCHMARK_BUF_INTERNAL]) {
+        memset(buffers[BENCHMARK_BUF_INTERNAL], 0x5A, BENCHMARK_INTERNAL_MAX);
+    }
+
+    for (int h = 0; h < sizeof(s_benchmark_hosts) / sizeof(s_benchmark_hosts[0]); h++) {
+        const benchmark_host_t *host = &s_benchmark_hosts[h];
+
+        if (benchmark_remount(host->max_freq_khz, host->ddr) != ESP_OK) {
+            ESP_LOGW(TAG, "  %-10s not supported by the card or the slot", host->name);
+            continue;
+        }
+        if (host->ddr && !s_sdcard.card->is_ddr) {
+            ESP_LOGW(TAG, "  %-10s not supported by the card", host->name);
+            continue;
+        }
+        benchmark_host(buffers, host, &best);
+    }
+
+    if (best.kb_per_s && benchmark_remount(best.max_freq_khz, best.ddr) == ESP_OK) {
+#if CONFIG_EXAMPLE_SD_BENCHMARK_FORMAT
+        ESP_LOGW(TAG, "Reformatting the card to compare allocation units, its data is erased");
+        benchmark_allocation_units(best.write_size <= BENCHMARK_INTERNAL_MAX && buffers[BENCHMARK_BUF_INTERNAL] ?
+                                   buffers[BENCHMARK_BUF_INTERNAL] : buffers[BENCHMARK_BUF_PSRAM], &best);
+#endif
+        if (sd_benchmark_save(&best) == ESP_OK) {
+            ESP_LOGI(TAG, "Best configuration saved, the capture modes mount the card with it");
+        }
+    }
+
+    uint32_t required_kb_per_s = (uint64_t)BENCHMARK_FRAME_SIZE * CONFIG_EXAMPLE_SD_BENCHMARK_TARGET_FPS / 1024;
+    float max_fps = best.kb_per_s * 1024.0f / BENCHMARK_FRAME_SIZE;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║           BENCHMARK COMPLETE                       ║");
+    ESP_LOGI(TAG, "╠════════════════════════════════════════════════════╣");
+    ESP_LOGI(TAG, "║  Best bus:         %6"PRIu32" kHz%s                   ║", best.max_freq_khz, best.ddr ? " DDR" : "    ");
+    ESP_LOGI(TAG, "║  Best write size:  %6"PRIu32" KB                      ║", best.write_size / 1024);
+    ESP_LOGI(TAG, "║  Throughput:       %6.2f MB/s                    ║", best.kb_per_s / 1024.0f);
+    ESP_LOGI(TAG, "║  RAW10 needs:      %6.2f MB/s at %3d fps          ║", required_kb_per_s / 1024.0f,
+             CONFIG_EXAMPLE_SD_BENCHMARK_TARGET_FPS);
+    ESP_LOGI(TAG, "║  RAW10 sustained:  %6.1f fps                      ║", max_fps);
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    if (best.kb_per_s >= required_kb_per_s) {
+        ESP_LOGI(TAG, "The card sustains continuous RAW10 recording at %d fps", CONFIG_EXAMPLE_SD_BENCHMARK_TARGET_FPS);
+    } else {
+        ESP_LOGW(TAG, "The card cannot sustain RAW10 at %d fps, recordings will overrun", CONFIG_EXAMPLE_SD_BENCHMARK_TARGET_FPS);
+    }
+
+    heap_caps_free(buffers[BENCHMARK_BUF_INTERNAL]);
+    heap_caps_free(psram);
+    deinit_sdcard();
+
+    ESP_LOGI(TAG, "Benchmark task finished. Safe to remove SD card.");
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
+#endif
+
+#if SNAPSHOT_DNG
+/*
+ * Save a frame as DNG, converted straight from the capture buffer
+ */
+static esp_err_t save_dng_frame(const uint8_t *data, uint32_t frame_num)
+{
+    char filename[32];
+    uint32_t exposure = 0;
+    uint32_t gain = 0;
+    size_t written = 0;
+    FILE *f;
+
+    camera_get_exposure(&exposure, &gain);
+    dng_writer_config_t config = {
+        .width = s_camera.width,
+        .height = s_camera.height,
+        .pixel_format = s_camera.pixel_format,
+        .bytesperline = s_camera.bytesperline,
+#if CONFIG_EXAMPLE_SD_SNAPSHOT_DNG_UNPACKED16
+        .layout = DNG_WRITER_LAYOUT_UNPACKED16,
+#else
+        .layout = DNG_WRITER_LAYOUT_PACKED10,
+#endif
+        .black_level = CONFIG_EXAMPLE_SD_DNG_BLACK_LEVEL,
+        .white_level = 1023,
+        .exposure_us = (uint64_t)exposure * SENSOR_LINE_TIME_NS / 1000,
+        /* ISO 100 at 0 dB analog gain */
+        .iso = (uint16_t)(100.0f * powf(10.0f, gain * SENSOR_GAIN_STEP_DB / 20.0f)),
+        .model = "IMX662",
+    };
+
+#if CONFIG_EXAMPLE_SD_THUMBNAIL
+    /* The thumbnail is the preview of the DNG, there is no separate file */
+    if (s_camera.thumb && thumbnail_encode(s_camera.thumb, data, &config.preview, &config.preview_size) == ESP_OK) {
+        thumbnail_get_size(s_camera.thumb, &config.preview_width, &config.preview_height);
+    }
+#endif
+
+    snprintf(filename, sizeof(filename), MOUNT_POINT"/img%04"PRIu32"." FRAME_FILE_EXT, frame_num);
+    ESP_LOGI(TAG, "Saving %s (exposure %"PRIu32" us, ISO %u)...", filename, config.exposure_us, config.iso);
+
+    f = fopen(filename, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open file for writing: %s (errno=%d)", strerror(errno), errno);
+        return ESP_FAIL;
+    }
+
+    TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_START, frame_num);
+    esp_err_t ret = dng_writer_write(f, &config, data, &written);
+    fclose(f);
+    TRACE_RING_RECORD(TRACE_EVENT_SD_WRITE_DONE, written);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write %s: %s", filename, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Saved successfully (%zu bytes)", written);
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_SNAPSHOT
+/*
+ * Capture and save frames task
+ */
+static void capture_task(void *arg)
+{
+    struct v4l2_buffer buf;
+    uint32_t frame_count = 0;
+    uint32_t saved_count = 0;
+    int64_t start_time = esp_timer_get_time();
+    int64_t last_save_time = start_time - (FRAME_INTERVAL_MS * 1000);  /* Force first save immediately */
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║       RAW10 CAPTURE TO SD CARD STARTING            ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Resolution: %"PRIu32"x%"PRIu32, s_camera.width, s_camera.height);
+    ESP_LOGI(TAG, "Format: RAW10 Bayer RGGB (SRGGB10), pixfmt=0x%08lx", (unsigned long)s_camera.pixel_format);
+    ESP_LOGI(TAG, "Bytesperline (stride): %"PRIu32, s_camera.bytesperline);
+    ESP_LOGI(TAG, "Frame size: %"PRIu32" bytes (RAW10 expected: %d)", s_camera.buffer_size, (1936*1100*10)/8);
+    ESP_LOGI(TAG, "Frames to capture: %d", FRAMES_TO_CAPTURE);
+#if SNAPSHOT_STACK
+    ESP_LOGI(TAG, "Frames stacked per snapshot: %d", CONFIG_EXAMPLE_SD_STACK_FRAMES);
+#endif
+    ESP_LOGI(TAG, "Interval: %d ms", FRAME_INTERVAL_MS);
+    ESP_LOGI(TAG, "");
+
+#if SNAPSHOT_CALIB
+    init_calibration();
+#endif
+
+    while (saved_count < FRAMES_TO_CAPTURE) {
+        /* Dequeue buffer */
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = s_camera.bufs.memory;
+
+        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
+            ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        frame_count++;
+        int64_t now = esp_timer_get_time();
+
+        /* Frame reception goes to the trace ring, the UART is too slow for every frame */
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf.index);
+
+        /* Debug: Show first bytes of first few lines to check alignment */
+        if (frame_count <= 2 && esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+            uint8_t *frame_data = s_camera.bufs.data[buf.index];
+            /* RAW10: 5 bytes per 4 pixels, RAW12: 3 bytes per 2 pixels */
+            uint32_t bpl = s_camera.bytesperline > 0 ? s_camera.bytesperline : (s_camera.width * 5) / 4;
+            ESP_LOGD(TAG, "First 12 bytes of lines 0-3 (bytesperline=%"PRIu32"):", bpl);
+            for (int line = 0; line < 4; line++) {
+                uint8_t *line_ptr = frame_data + (line * bpl);
+                ESP_LOGD(TAG, "  Line %d: %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X",
+                         line,
+                         line_ptr[0], line_ptr[1], line_ptr[2], line_ptr[3],
+                         line_ptr[4], line_ptr[5], line_ptr[6], line_ptr[7],
+                         line_ptr[8], line_ptr[9], line_ptr[10], line_ptr[11]);
+            }
+        }
+
+        /* Check if it's time to save */
+        if ((now - last_save_time) >= (FRAME_INTERVAL_MS * 1000)) {
+#if SNAPSHOT_STACK
+            /* Stacking keeps the stream running, the mean is then saved like a single frame */
+            esp_err_t ret = stack_frames(&buf, CONFIG_EXAMPLE_SD_STACK_FRAMES);
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+
+            if (ret == ESP_OK) {
+#if SNAPSHOT_CALIB
+                correct_snapshot();
+#endif
+#if SNAPSHOT_DNG
+                ret = save_dng_frame(s_camera.save_buffer, saved_count + 1);
+#elif SNAPSHOT_RAW_CODEC
+                uint8_t *data_to_save;
+                size_t bytes_to_save;
+
+                ret = compress_raw_frame(s_camera.save_buffer, buf.bytesused, &data_to_save, &bytes_to_save);
+                if (ret == ESP_OK) {
+                    ret = save_raw_frame(data_to_save, bytes_to_save, saved_count + 1);
+                }
+#else
+                ret = save_raw_frame(s_camera.save_buffer, buf.bytesused, saved_count + 1);
+#endif
+            }
+#elif SNAPSHOT_DNG && SNAPSHOT_CALIB
+            copy_frame(s_camera.save_buffer, &buf);
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+
+            correct_snapshot();
+            esp_err_t ret = save_dng_frame(s_camera.save_buffer, saved_count + 1);
+#elif SNAPSHOT_DNG
+            /* The DMA is stopped, so the frame is converted from the capture buffer itself */
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+
+            esp_err_t ret = save_dng_frame(s_camera.bufs.data[buf.index], saved_count + 1);
+#else
+            /* Copy data to save buffer */
+            copy_frame(s_camera.save_buffer, &buf);
+            uint8_t *data_to_save = s_camera.save_buffer;
+            size_t bytes_to_save = buf.bytesused;
+
+            /* Stop streaming while writing to SD to avoid DMA overflow */
+            int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+
+#if SNAPSHOT_CALIB
+            correct_snapshot();
+#endif
+#if SNAPSHOT_RAW_CODEC
+            /* Fewer bytes to write, the SD card is the bottleneck */
+            esp_err_t ret = compress_raw_frame(s_camera.save_buffer, bytes_to_save, &data_to_save, &bytes_to_save);
+            if (ret == ESP_OK) {
+                ret = save_raw_frame(data_to_save, bytes_to_save, saved_count + 1);
+            }
+#else
+            /* Write to SD card (slow operation) */
+            esp_err_t ret = save_raw_frame(data_to_save, bytes_to_save, saved_count + 1);
+#endif
+#endif
+#if CONFIG_EXAMPLE_SD_RAW_STATS
+#if SNAPSHOT_DNG && !SNAPSHOT_STACK && !SNAPSHOT_CALIB
+            const uint8_t *saved_frame = s_camera.bufs.data[buf.index];
+#else
+            const uint8_t *saved_frame = s_camera.save_buffer;
+#endif
+            if (ret == ESP_OK) {
+                save_snapshot_stats(saved_frame, &buf, saved_count + 1);
+            }
+#endif
+#if THUMBNAIL_SIDECAR
+            if (ret == ESP_OK) {
+                char saved_name[32];
+
+                snprintf(saved_name, sizeof(saved_name), MOUNT_POINT"/img%04"PRIu32"." FRAME_FILE_EXT, saved_count + 1);
+                save_thumbnail(s_camera.save_buffer, saved_name);
+            }
+#endif
+            if (ret == ESP_OK) {
+                saved_count++;
+                last_save_time = esp_timer_get_time();  /* Update after save completes */
+            }
+
+            /* Re-queue all buffers and restart streaming */
+            capture_buffers_queue_all(&s_camera.bufs);
+            ioctl(s_camera.fd, VIDIOC_STREAMON, &type);
+
+            /* Reset timing for accurate FPS after pause */
+            start_time = esp_timer_get_time();
+            frame_count = 0;
+        } else {
+            /* Re-queue buffer */
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_QBUF, buf.index);
+            capture_buffers_queue(&s_camera.bufs, buf.index);
+        }
+    }
+
+    /* Final report */
+    int64_t total_time = esp_timer_get_time() - start_time;
+    float total_sec = total_time / 1000000.0f;
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║           CAPTURE COMPLETE                         ║");
+    ESP_LOGI(TAG, "╠════════════════════════════════════════════════════╣");
+    ESP_LOGI(TAG, "║  Frames received:  %4"PRIu32"                           ║", frame_count);
+    ESP_LOGI(TAG, "║  Frames saved:     %4"PRIu32"                           ║", saved_count);
+    ESP_LOGI(TAG, "║  Average FPS:      %5.1f                          ║", frame_count / total_sec);
+    ESP_LOGI(TAG, "║  Total time:       %5.1f sec                      ║", total_sec);
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Files saved to SD card:");
+    for (uint32_t i = 1; i <= saved_count; i++) {
+        ESP_LOGI(TAG, "  - img%04"PRIu32"." FRAME_FILE_EXT, i);
+    }
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "To decode RAW10 RGGB, use Python script or dcraw");
+#if CONFIG_EXAMPLE_TRACE_RING
+    trace_ring_log_dump();
+#endif
+
+    /* Stop streaming and cleanup */
+    stop_camera_stream();
+    deinit_sdcard();
+
+    ESP_LOGI(TAG, "Capture task finished. Safe to remove SD card.");
+
+    /* Keep task alive */
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_TIMELAPSE
+/* Exposure carried from shot to shot, the sensor keeps it through standby as well */
+typedef struct {
+    uint32_t exposure;          /* Lines */
+    uint32_t gain;              /* V4L2_CID_GAIN index, 0.3 dB steps */
+    uint32_t exposure_min;
+    uint32_t exposure_max;
+    uint32_t gain_max;
+} timelapse_ae_t;
+
+static timelapse_ae_t s_timelapse_ae;
+
+/*
+ * Range of a sensor control, the defaults are kept if the sensor does not report it
+ */
+static void timelapse_query_range(uint32_t id, uint32_t *min, uint32_t *max)
+{
+    struct v4l2_query_ext_ctrl qctrl;
+
+    memset(&qctrl, 0, sizeof(qctrl));
+    qctrl.id = id;
+    if (ioctl(s_camera.fd, VIDIOC_QUERY_EXT_CTRL, &qctrl) == 0) {
+        *min = qctrl.minimum;
+        *max = qctrl.maximum;
+    }
+}
+
+static esp_err_t timelapse_set_exposure(uint32_t exposure, uint32_t gain)
+{
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[2];
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_CAMERA_CLASS;
+    controls.count = 2;
+    controls.controls = control;
+    control[0].id = V4L2_CID_EXPOSURE;
+    control[0].value = exposure;
+    control[1].id = V4L2_CID_GAIN;
+    control[1].value = gain;
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.fd, VIDIOC_S_EXT_CTRLS, &controls) == 0, ESP_FAIL, TAG,
+                        "Failed to set exposure");
+
+    s_timelapse_ae.exposure = exposure;
+    s_timelapse_ae.gain = gain;
+    return ESP_OK;
+}
+
+static void timelapse_init_ae(void)
+{
+    uint32_t gain_min = 0;
+
+    s_timelapse_ae.exposure_min = 1;
+    s_timelapse_ae.exposure_max = UINT16_MAX;
+    s_timelapse_ae.gain_max = 0;
+    timelapse_query_range(V4L2_CID_EXPOSURE, &s_timelapse_ae.exposure_min, &s_timelapse_ae.exposure_max);
+    timelapse_query_range(V4L2_CID_GAIN, &gain_min, &s_timelapse_ae.gain_max);
+    camera_get_exposure(&s_timelapse_ae.exposure, &s_timelapse_ae.gain);
+}
+
+/* Mean level of a frame above black, over the four Bayer channels */
+static float timelapse_level(const raw_stats_t *stats)
+{
+    float sum = 0;
+
+    for (int ch = 0; ch < RAW_STATS_CHANNELS; ch++) {
+        sum += stats->channel[ch].mean_x16 / 16.0f;
+    }
+
+    return sum / RAW_STATS_CHANNELS - TIMELAPSE_BLACK_LEVEL;
+}
+
+/*
+ * One AE step, true if the frame is within the tolerance or the exposure can not move any further.
+ * The sensor is linear above black, so the whole error is corrected at once: exposure time first,
+ * gain only for what the longest exposure does not reach.
+ */
+static bool timelapse_ae_step(const raw_stats_t *stats)
+{
+    const float target = CONFIG_EXAMPLE_SD_TIMELAPSE_AE_TARGET - TIMELAPSE_BLACK_LEVEL;
+    uint32_t saturated = 0;
+    uint32_t samples = 0;
+    float level = timelapse_level(stats);
+    float ratio;
+    float total;
+    uint32_t exposure;
+    uint32_t gain;
+
+    for (int ch = 0; ch < RAW_STATS_CHANNELS; ch++) {
+        saturated += stats->channel[ch].saturated;
+        samples += stats->channel[ch].samples;
+    }
+
+    ratio = target / MAX(level, 1.0f);
+    /* A clipped frame reads darker than it is, back off in big steps until it is not */
+    if (samples && saturated > samples / 100 && ratio > 0.5f) {
+        ratio = 0.5f;
+    }
+    if (fabsf(ratio - 1.0f) <= TIMELAPSE_AE_TOLERANCE) {
+        return true;
+    }
+
+    ratio = MIN(MAX(ratio, 1.0f / TIMELAPSE_AE_MAX_STEP), TIMELAPSE_AE_MAX_STEP);
+    total = s_timelapse_ae.exposure * powf(10.0f, s_timelapse_ae.gain * TIMELAPSE_GAIN_STEP_DB / 20.0f) * ratio;
+    exposure = MIN(MAX((uint32_t)lroundf(total), s_timelapse_ae.exposure_min), s_timelapse_ae.exposure_max);
+    gain = (uint32_t)lroundf(20.0f * log10f(MAX(total / exposure, 1.0f)) / TIMELAPSE_GAIN_STEP_DB);
+    gain = MIN(gain, s_timelapse_ae.gain_max);
+    if (exposure == s_timelapse_ae.exposure && gain == s_timelapse_ae.gain) {
+        return true;
+    }
+
+    return timelapse_set_exposure(exposure, gain) != ESP_OK;
+}
+
+/*
+ * Wake the sensor, let the AE settle on the first frames, save the first good one and put the sensor
+ * back to standby before writing it
+ */
+static esp_err_t timelapse_shot(uint32_t shot)
+{
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    struct v4l2_buffer buf;
+    struct esp_video_frame_meta meta;
+    raw_stats_t stats;
+    uint32_t frames = 0;
+    uint32_t measured = 0;
+    float level = 0;
+    int64_t wake_time = esp_timer_get_time();
+    int64_t sensor_on_us;
+    esp_err_t ret = ESP_OK;
+
+    capture_buffers_queue_all(&s_camera.bufs);
+    ESP_RETURN_ON_FALSE(ioctl(s_camera.fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, TAG, "Failed to wake the sensor");
+
+    while (true) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = s_camera.bufs.memory;
+        if (ioctl(s_camera.fd, VIDIOC_DQBUF, &buf) != 0) {
+            TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF_ERROR, errno);
+            ESP_LOGE(TAG, "VIDIOC_DQBUF failed: %s", strerror(errno));
+            ret = ESP_FAIL;
+            break;
+        }
+        TRACE_RING_RECORD(TRACE_EVENT_CAPTURE_DQBUF, buf.index);
+        frames++;
+
+        if (frames <= CONFIG_EXAMPLE_SD_TIMELAPSE_SKIP_FRAMES) {
+            capture_buffers_queue(&s_camera.bufs, buf.index);
+            continue;
+        }
+
+        /* Frames within the control delay of an AE step were exposed with the settings before it */
+        memset(&meta, 0, sizeof(meta));
+        meta.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        meta.index = buf.index;
+        if (frames < TIMELAPSE_MAX_FRAMES && ioctl(s_camera.fd, VIDIOC_G_FRAME_META, &meta) == 0 &&
+                (meta.flags & ESP_VIDEO_FRAME_META_EXPOSURE) && (meta.flags & ESP_VIDEO_FRAME_META_GAIN) &&
+                (meta.exposure != s_timelapse_ae.exposure || meta.gain != s_timelapse_ae.gain)) {
+            capture_buffers_queue(&s_camera.bufs, buf.index);
+            continue;
+        }
+
+        measured++;
+        frame_stats(s_camera.bufs.data[buf.index], buf.sequence,
+                    buf.timestamp.tv_sec * 1000000ULL + buf.timestamp.tv_usec, &stats);
+        level = timelapse_level(&stats) + TIMELAPSE_BLACK_LEVEL;
+        if (measured >= CONFIG_EXAMPLE_SD_TIMELAPSE_AE_FRAMES || frames >= TIMELAPSE_MAX_FRAMES ||
+                timelapse_ae_step(&stats)) {
+            break;
+        }
+        capture_buffers_queue(&s_camera.bufs, buf.index);
+    }
+
+    /* Back to standby first, the frame is written from the capture buffer with the DMA stopped */
+    ioctl(s_camera.fd, VIDIOC_STREAMOFF, &type);
+    sensor_on_us = esp_timer_get_time() - wake_time;
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Shot %"PRIu32": sensor on %"PRId64" ms, %"PRIu32" frames, exposure %"PRIu32" lines, gain %"PRIu32
+             ", level %.1f", shot, sensor_on_us / 1000, frames, s_timelapse_ae.exposure, s_timelapse_ae.gain,
+             level);
+
+    ret = save_raw_frame(s_camera.bufs.data[buf.index], buf.bytesused, shot);
+    if (ret == ESP_OK) {
+        save_snapshot_stats(s_camera.bufs.data[buf.index], &buf, shot);
+    }
+
+    return ret;
+}
+
+/*
+ * Timelapse task, the sensor is only out of standby while a shot is taken
+ */
+static void timelapse_task(void *arg)
+{
+    uint32_t saved_count = 0;
+    int64_t next_shot = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "╔════════════════════════════════════════════════════╗");
+    ESP_LOGI(TAG, "║       RAW10 TIMELAPSE TO SD CARD STARTING          ║");
+    ESP_LOGI(TAG, "╚════════════════════════════════════════════════════╝");
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "Resolution: %"PRIu32"x%"PRIu32, s_camera.width, s_camera.height);
+    ESP_LOGI(TAG, "Interval: %d s, shots: %d (0 = unlimited)", CONFIG_EXAMPLE_SD_TIMELAPSE_INTERVAL_S,
+             CONFIG_EXAMPLE_SD_TIMELAPSE_SHOTS);
+    ESP_LOGI(TAG, "AE target: %d, at most %d frames", CONFIG_EXAMPLE_SD_TIMELAPSE_AE_TARGET,
+             CONFIG_EXAMPLE_SD_TIMELAPSE_AE_FRAMES);
+    ESP_LOGI(TAG, "");
+
+    timelapse_init_ae();
+
+    for (uint32_t shot = 1; !CONFIG_EXAMPLE_SD_TIMELAPSE_SHOTS || shot <= CONFIG_EXAMPLE_SD_TIMELAPSE_SHOTS; shot++) {
+        int64_t now = esp_timer_get_time();
+
+        if (next_shot > now) {
+            vTaskDelay(pdMS_TO_TICKS((next_shot - now) / 1000));
+        }
+        /* Shots keep their cadence, one that ran over the interval moves the next ones */
+        next_shot = MAX(next_shot + TIMELAPSE_INTERVAL_US, esp_timer_get_time());
+
+        if (timelapse_shot(shot) == ESP_OK) {
+            saved_count++;
+        }
+    }
+
+    ESP_LOGI(TAG, "Timelapse complete, %"PRIu32" shots saved", saved_count);
+#if CONFIG_EXAMPLE_TRACE_RING
+    trace_ring_log_dump();
+#endif
+
+    deinit_sdcard();
+
+    ESP_LOGI(TAG, "Timelapse task finished. Safe to remove SD card.");
+
+    /* Keep task alive */
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
+#endif
+
+#if CONFIG_EXAMPLE_SD_FILE_SERVER
+/* WiFi association takes seconds, the capture starts meanwhile */
+static void file_server_task(void *arg)
+{
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(example_connect());
+
+    if (sd_file_server_start(MOUNT_POINT) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start file server");
+    }
+    vTaskDelete(NULL);
+}
+#endif
+
+void app_main(void)
+{
+    ESP_LOGI(TAG, "");
+    ESP_LOGI(TAG, "===========================================");
+    ESP_LOGI(TAG, "   IMX662 RAW10 Capture to SD Card");
+    ESP_LOGI(TAG, "===========================================");
+    ESP_LOGI(TAG, "");
+
+    /* Initialize NVS */
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+
+#if CONFIG_EXAMPLE_SD_USE_BENCHMARK_RESULT && !CONFIG_EXAMPLE_SD_BENCHMARK
+    /* Mount with the fastest settings measured by the benchmark mode */
+    sd_card_load_config(&s_sdcard.config);
+#endif
+
+    /* Initialize SD Card first */
+    ret = init_sdcard();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "SD card initialization failed!");
+        ESP_LOGE(TAG, "Please insert SD card and restart.");
+        return;
+    }
+
+#if CONFIG_EXAMPLE_SD_FILE_SERVER
+    xTaskCreatePinnedToCore(file_server_task, "file_server", 4096, NULL, TASK_NETWORK_PRIORITY, NULL,
+                            TASK_NETWORK_CORE);
+#endif
+
+#if CONFIG_EXAMPLE_SD_BENCHMARK
+    /* The benchmark does not need the camera */
+    xTaskCreatePinnedToCore(benchmark_task, "benchmark", 8192, NULL, TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE);
+
+    ESP_LOGI(TAG, "Benchmark task started");
+#else
+
+    /* Test write a simple file before camera init */
+    ESP_LOGI(TAG, ">>> Testing SD card write with simple file...");
+    FILE *testfile = fopen("/sdcard/test_raw.bin", "wb");
+    if (testfile) {
+        uint8_t testdata[1024];
+        memset(testdata, 0xAA, sizeof(testdata));
+        size_t written = fwrite(testdata, 1, sizeof(testdata), testfile);
+        fclose(testfile);
+        ESP_LOGI(TAG, ">>> Test file written: %zu bytes", written);
     } else {
         ESP_LOGE(TAG, ">>> FAILED to open test file: %s (errno=%d)", strerror(errno), errno);
     }
@@ -502,6 +2146,35 @@ void app_main(void)
         return;
     }
 
+#if SNAPSHOT_RAW_CODEC
+    ret = init_raw_codec();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "RAW codec initialization failed!");
+        deinit_sdcard();
+        return;
+    }
+#endif
+
+#if CONFIG_EXAMPLE_SD_RECORD
+    ret = init_recording();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Recording initialization failed!");
+        deinit_sdcard();
+        return;
+    }
+#elif CONFIG_EXAMPLE_SD_BURST
+    ret = init_burst();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Burst initialization failed!");
+        deinit_sdcard();
+        return;
+    }
+#endif
+
+#if CONFIG_EXAMPLE_SD_TIMELAPSE
+    /* The timelapse wakes the sensor for every shot, it stays in standby until then */
+    xTaskCreatePinnedToCore(timelapse_task, "timelapse", 8192, NULL, TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE);
+#else
     /* Start streaming */
     ret = start_camera_stream();
     if (ret != ESP_OK) {
@@ -511,7 +2184,15 @@ void app_main(void)
     }
 
     /* Start capture task */
-    xTaskCreate(capture_task, "capture", 8192, NULL, 5, NULL);
+#if CONFIG_EXAMPLE_SD_RECORD
+    xTaskCreatePinnedToCore(record_task, "record", 8192, NULL, TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE);
+#elif CONFIG_EXAMPLE_SD_BURST
+    xTaskCreatePinnedToCore(burst_task, "burst", 8192, NULL, TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE);
+#else
+    xTaskCreatePinnedToCore(capture_task, "capture", 8192, NULL, TASK_CAPTURE_PRIORITY, NULL, TASK_CAPTURE_CORE);
+#endif
+#endif
 
     ESP_LOGI(TAG, "Capture task started");
+#endif
 }
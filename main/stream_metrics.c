@@ -0,0 +1,316 @@
+/*
+ * Pipeline latency metrics for the HTTP streamer
+ *
+ * Samples are recorded from the capture task and from every sender task, so
+ * all updates go through one spinlock that is only held for a few additions.
+ * Rates are measured over windows of at least STREAM_METRICS_RATE_WINDOW_US
+ * and reported for the last complete window.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "linux/videodev2.h"
+#include "esp_video_ioctl.h"
+#include "stream_metrics.h"
+
+#define STREAM_METRICS_RATE_WINDOW_US   1000000
+#define STREAM_METRICS_MAX_SEQUENCE_GAP 1000
+
+#if CONFIG_EXAMPLE_HTTPS_STREAM
+#define STREAM_METRICS_TLS              1
+#else
+#define STREAM_METRICS_TLS              0
+#endif
+
+/* Bucket upper bounds in microseconds, the last bucket is +Inf */
+static const uint32_t s_bucket_bounds_us[] = {
+    250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000,
+};
+
+#define STREAM_METRICS_BUCKETS  (sizeof(s_bucket_bounds_us) / sizeof(s_bucket_bounds_us[0]) + 1)
+
+typedef struct {
+    const char *name;
+    const char *help;
+    uint32_t buckets[STREAM_METRICS_BUCKETS];
+    uint64_t sum_us;
+    uint32_t count;
+} histogram_t;
+
+typedef struct {
+    int64_t start_us;
+    uint64_t value;
+    float rate;
+} rate_window_t;
+
+typedef struct {
+    portMUX_TYPE lock;
+
+    histogram_t sensor_to_dqbuf;
+    histogram_t dqbuf_wait;
+    histogram_t dqbuf_to_first_byte;
+    histogram_t send;
+
+    rate_window_t fps;
+    rate_window_t send_rate;
+
+    uint32_t frames;
+    uint32_t backup_hits;
+    uint32_t dropped;
+    uint32_t last_sequence;
+    bool has_sequence;
+    uint64_t sent_frames;
+    uint64_t sent_bytes;
+} stream_metrics_t;
+
+static stream_metrics_t s_metrics = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+    .sensor_to_dqbuf = {
+        .name = "esp_stream_sensor_to_dqbuf_seconds",
+        .help = "Time from the end of the CSI transfer to the capture task dequeuing the buffer",
+    },
+    .dqbuf_wait = {
+        .name = "esp_stream_dqbuf_wait_seconds",
+        .help = "Time the capture task waited in VIDIOC_DQBUF",
+    },
+    .dqbuf_to_first_byte = {
+        .name = "esp_stream_dqbuf_to_first_byte_seconds",
+        .help = "Time from dequeuing a frame to the first byte sent to a client",
+    },
+    .send = {
+        .name = "esp_stream_send_duration_seconds",
+        .help = "Time to send one frame to a client",
+    },
+};
+
+/* Must be called with the lock held */
+static void histogram_observe(histogram_t *hist, int64_t value_us)
+{
+    uint32_t i = 0;
+
+    if (value_us < 0) {
+        value_us = 0;
+    }
+    while (i < STREAM_METRICS_BUCKETS - 1 && value_us > s_bucket_bounds_us[i]) {
+        i++;
+    }
+
+    hist->buckets[i]++;
+    hist->sum_us += value_us;
+    hist->count++;
+}
+
+/* Must be called with the lock held */
+static void rate_window_add(rate_window_t *window, uint64_t value, int64_t now_us)
+{
+    int64_t elapsed_us = now_us - window->start_us;
+
+    window->value += value;
+    if (elapsed_us >= STREAM_METRICS_RATE_WINDOW_US) {
+        window->rate = window->start_us ? window->value * 1000000.0f / elapsed_us : 0;
+        window->start_us = now_us;
+        window->value = 0;
+    }
+}
+
+void stream_metrics_record_capture(int64_t wait_us, int64_t sensor_us, int64_t dequeue_us, uint32_t sequence)
+{
+    portENTER_CRITICAL(&s_metrics.lock);
+    histogram_observe(&s_metrics.dqbuf_wait, wait_us);
+    if (sensor_us) {
+        histogram_observe(&s_metrics.sensor_to_dqbuf, dequeue_us - sensor_us);
+    }
+
+    /* Large jumps come from a stream restart, not from lost frames */
+    uint32_t gap = sequence - s_metrics.last_sequence - 1;
+    if (s_metrics.has_sequence && gap < STREAM_METRICS_MAX_SEQUENCE_GAP) {
+        s_metrics.backup_hits += gap;
+    }
+    s_metrics.last_sequence = sequence;
+    s_metrics.has_sequence = true;
+
+    s_metrics.frames++;
+    rate_window_add(&s_metrics.fps, 1, dequeue_us);
+    portEXIT_CRITICAL(&s_metrics.lock);
+}
+
+void stream_metrics_record_drop(void)
+{
+    portENTER_CRITICAL(&s_metrics.lock);
+    s_metrics.dropped++;
+    portEXIT_CRITICAL(&s_metrics.lock);
+}
+
+int64_t stream_metrics_send_start(const frame_t *frame)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_metrics.lock);
+    histogram_observe(&s_metrics.dqbuf_to_first_byte, now - frame->timestamp_us);
+    portEXIT_CRITICAL(&s_metrics.lock);
+
+    return now;
+}
+
+void stream_metrics_send_done(int64_t start_us, size_t bytes)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_metrics.lock);
+    histogram_observe(&s_metrics.send, now - start_us);
+    s_metrics.sent_frames++;
+    s_metrics.sent_bytes += bytes;
+    rate_window_add(&s_metrics.send_rate, bytes, now);
+    portEXIT_CRITICAL(&s_metrics.lock);
+}
+
+static size_t format_histogram(char *buf, size_t size, const histogram_t *hist)
+{
+    size_t len = 0;
+    uint32_t cumulative = 0;
+
+    len += snprintf(buf + len, size - len, "# HELP %s %s\n# TYPE %s histogram\n", hist->name, hist->help, hist->name);
+    for (uint32_t i = 0; i < STREAM_METRICS_BUCKETS && len < size; i++) {
+        cumulative += hist->buckets[i];
+        if (i < STREAM_METRICS_BUCKETS - 1) {
+            len += snprintf(buf + len, size - len, "%s_bucket{le=\"%g\"} %"PRIu32"\n",
+                            hist->name, s_bucket_bounds_us[i] / 1000000.0, cumulative);
+        } else {
+            len += snprintf(buf + len, size - len, "%s_bucket{le=\"+Inf\"} %"PRIu32"\n", hist->name, cumulative);
+        }
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "%s_sum %.6f\n%s_count %"PRIu32"\n",
+                        hist->name, hist->sum_us / 1000000.0, hist->name, hist->count);
+    }
+
+    return len;
+}
+
+static size_t format_driver_stats(char *buf, size_t size, int video_fd)
+{
+    struct esp_video_stream_stats stats = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+    };
+
+    if (ioctl(video_fd, VIDIOC_G_STREAM_STATS, &stats) != 0) {
+        return 0;
+    }
+
+    return snprintf(buf, size,
+                    "# HELP esp_video_frames_total Frames done by the capture driver since STREAMON\n"
+                    "# TYPE esp_video_frames_total counter\n"
+                    "esp_video_frames_total %"PRIu32"\n"
+                    "# HELP esp_video_delivered_frames_total Frames the capture driver made available to DQBUF\n"
+                    "# TYPE esp_video_delivered_frames_total counter\n"
+                    "esp_video_delivered_frames_total %"PRIu32"\n"
+                    "# HELP esp_video_dropped_frames_total Frames the capture driver lost or recycled\n"
+                    "# TYPE esp_video_dropped_frames_total counter\n"
+                    "esp_video_dropped_frames_total %"PRIu32"\n"
+                    "# HELP esp_video_skipped_frames_total Frames the capture driver skipped to lower the frame rate\n"
+                    "# TYPE esp_video_skipped_frames_total counter\n"
+                    "esp_video_skipped_frames_total %"PRIu32"\n"
+                    "# HELP esp_video_no_buffer_total Frames started with no capture buffer queued\n"
+                    "# TYPE esp_video_no_buffer_total counter\n"
+                    "esp_video_no_buffer_total %"PRIu32"\n"
+                    "# HELP esp_video_recycled_buffers_total Done buffers captured into again before DQBUF\n"
+                    "# TYPE esp_video_recycled_buffers_total counter\n"
+                    "esp_video_recycled_buffers_total %"PRIu32"\n"
+                    "# HELP esp_video_max_done_depth Most done buffers waiting for DQBUF at once\n"
+                    "# TYPE esp_video_max_done_depth gauge\n"
+                    "esp_video_max_done_depth %"PRIu32"\n"
+                    "# HELP esp_video_done_to_dqbuf_seconds Time from frame done to DQBUF since STREAMON\n"
+                    "# TYPE esp_video_done_to_dqbuf_seconds gauge\n"
+                    "esp_video_done_to_dqbuf_seconds{stat=\"min\"} %.6f\n"
+                    "esp_video_done_to_dqbuf_seconds{stat=\"avg\"} %.6f\n"
+                    "esp_video_done_to_dqbuf_seconds{stat=\"max\"} %.6f\n"
+                    "# HELP esp_video_rx_error_frames_total Frames the receiver reported an error in\n"
+                    "# TYPE esp_video_rx_error_frames_total counter\n"
+                    "esp_video_rx_error_frames_total{error=\"crc\"} %"PRIu32"\n"
+                    "esp_video_rx_error_frames_total{error=\"ecc\"} %"PRIu32"\n"
+                    "esp_video_rx_error_frames_total{error=\"phy\"} %"PRIu32"\n"
+                    "esp_video_rx_error_frames_total{error=\"frame\"} %"PRIu32"\n"
+                    "esp_video_rx_error_frames_total{error=\"overflow\"} %"PRIu32"\n"
+                    "# HELP esp_video_stream_recoveries_total Stalls the capture driver restarted the receiver from\n"
+                    "# TYPE esp_video_stream_recoveries_total counter\n"
+                    "esp_video_stream_recoveries_total %"PRIu32"\n",
+                    stats.sequence, stats.delivered, stats.dropped, stats.skipped, stats.no_buffer,
+                    stats.recycled, stats.max_done_depth, stats.latency_min_us / 1e6,
+                    stats.latency_avg_us / 1e6, stats.latency_max_us / 1e6, stats.rx_crc_errors,
+                    stats.rx_ecc_errors, stats.rx_phy_errors, stats.rx_frame_errors, stats.rx_overflows,
+                    stats.recoveries);
+}
+
+size_t stream_metrics_format(char *buf, size_t size, int video_fd)
+{
+    stream_metrics_t snapshot;
+    size_t len;
+    int64_t now = esp_timer_get_time();
+
+    /* Format from a copy, snprintf is far too slow to run in a critical section */
+    portENTER_CRITICAL(&s_metrics.lock);
+    memcpy(&snapshot, &s_metrics, sizeof(snapshot));
+    portEXIT_CRITICAL(&s_metrics.lock);
+
+    /* Windows only roll on new samples, a stalled stream would keep its last rate */
+    if (now - snapshot.fps.start_us > 2 * STREAM_METRICS_RATE_WINDOW_US) {
+        snapshot.fps.rate = 0;
+    }
+    if (now - snapshot.send_rate.start_us > 2 * STREAM_METRICS_RATE_WINDOW_US) {
+        snapshot.send_rate.rate = 0;
+    }
+
+    len = snprintf(buf, size,
+                   "# HELP esp_stream_capture_frames_total Frames dequeued by the capture task\n"
+                   "# TYPE esp_stream_capture_frames_total counter\n"
+                   "esp_stream_capture_frames_total %"PRIu32"\n"
+                   "# HELP esp_stream_capture_fps Capture frame rate over the last second\n"
+                   "# TYPE esp_stream_capture_fps gauge\n"
+                   "esp_stream_capture_fps %.2f\n"
+                   "# HELP esp_stream_backup_buffer_hits_total Frames lost because no capture buffer was queued\n"
+                   "# TYPE esp_stream_backup_buffer_hits_total counter\n"
+                   "esp_stream_backup_buffer_hits_total %"PRIu32"\n"
+                   "# HELP esp_stream_dropped_frames_total Frames dropped for slow subscribers\n"
+                   "# TYPE esp_stream_dropped_frames_total counter\n"
+                   "esp_stream_dropped_frames_total %"PRIu32"\n"
+                   "# HELP esp_stream_sent_frames_total Frames sent to clients\n"
+                   "# TYPE esp_stream_sent_frames_total counter\n"
+                   "esp_stream_sent_frames_total %"PRIu64"\n"
+                   "# HELP esp_stream_sent_bytes_total Bytes sent to clients\n"
+                   "# TYPE esp_stream_sent_bytes_total counter\n"
+                   "esp_stream_sent_bytes_total %"PRIu64"\n"
+                   "# HELP esp_stream_send_bytes_per_second Send rate over the last second\n"
+                   "# TYPE esp_stream_send_bytes_per_second gauge\n"
+                   "esp_stream_send_bytes_per_second %.0f\n",
+                   snapshot.frames, snapshot.fps.rate, snapshot.backup_hits, snapshot.dropped,
+                   snapshot.sent_frames, snapshot.sent_bytes, snapshot.send_rate.rate);
+
+    /* Encryption shows up as send time, compare with the plaintext server */
+    if (len < size) {
+        len += snprintf(buf + len, size - len,
+                        "# HELP esp_stream_send_seconds_per_megabyte Send time per MB sent to clients\n"
+                        "# TYPE esp_stream_send_seconds_per_megabyte gauge\n"
+                        "esp_stream_send_seconds_per_megabyte{tls=\"%d\"} %.6f\n",
+                        STREAM_METRICS_TLS, snapshot.sent_bytes ?
+                        snapshot.send.sum_us / 1e6 / (snapshot.sent_bytes / (1024.0 * 1024.0)) : 0.0);
+    }
+
+    const histogram_t *histograms[] = {
+        &snapshot.sensor_to_dqbuf,
+        &snapshot.dqbuf_wait,
+        &snapshot.dqbuf_to_first_byte,
+        &snapshot.send,
+    };
+    for (int i = 0; i < sizeof(histograms) / sizeof(histograms[0]) && len < size; i++) {
+        len += format_histogram(buf + len, size - len, histograms[i]);
+    }
+
+    if (video_fd >= 0 && len < size) {
+        len += format_driver_stats(buf + len, size - len, video_fd);
+    }
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * Pipeline latency metrics for the HTTP streamer
+ *
+ * The capture task and the stream senders feed latency samples into fixed
+ * bucket histograms, /metrics exposes them with the frame and byte rates in
+ * the Prometheus text format:
+ *
+ *   sensor -> DQBUF          CSI transfer done until the capture task has the buffer
+ *   DQBUF wait               time the capture task blocks in VIDIOC_DQBUF
+ *   DQBUF -> first byte      dequeue until a sender starts on the frame
+ *   send                     time a sender needs for one frame
+ *
+ * The driver counters of the capture stream, VIDIOC_G_STREAM_STATS, are
+ * appended as esp_video_* metrics.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "frame_broadcaster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_EXAMPLE_STREAM_METRICS
+
+/**
+ * @brief Record a dequeued capture buffer
+ *
+ * @param wait_us      Time spent in VIDIOC_DQBUF
+ * @param sensor_us    Driver timestamp of the buffer, esp_timer time, 0 if unknown
+ * @param dequeue_us   esp_timer time at which DQBUF returned
+ * @param sequence     Driver frame counter, gaps are frames lost to the backup buffer
+ */
+void stream_metrics_record_capture(int64_t wait_us, int64_t sensor_us, int64_t dequeue_us, uint32_t sequence);
+
+/**
+ * @brief Count a frame dropped for a slow subscriber
+ */
+void stream_metrics_record_drop(void);
+
+/**
+ * @brief Record the start of a frame send
+ *
+ * @param frame Frame about to be sent, its timestamp is the dequeue time
+ *
+ * @return Start time to pass to stream_metrics_send_done()
+ */
+int64_t stream_metrics_send_start(const frame_t *frame);
+
+/**
+ * @brief Record a completed frame send
+ *
+ * @param start_us Value returned by stream_metrics_send_start()
+ * @param bytes    Bytes sent for the frame, headers included
+ */
+void stream_metrics_send_done(int64_t start_us, size_t bytes);
+
+/**
+ * @brief Format all metrics in the Prometheus text exposition format
+ *
+ * @param buf      Output buffer
+ * @param size     Size of buf
+ * @param video_fd Capture video device, its driver statistics are added, -1 for none
+ *
+ * @return Length of the text, truncated to size - 1
+ */
+size_t stream_metrics_format(char *buf, size_t size, int video_fd);
+
+#else
+
+static inline void stream_metrics_record_capture(int64_t wait_us, int64_t sensor_us, int64_t dequeue_us, uint32_t sequence) {}
+static inline void stream_metrics_record_drop(void) {}
+static inline int64_t stream_metrics_send_start(const frame_t *frame)
+{
+    return 0;
+}
+static inline void stream_metrics_send_done(int64_t start_us, size_t bytes) {}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
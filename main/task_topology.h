@@ -0,0 +1,30 @@
+/*
+ * Core and priority assignment of the pipeline tasks
+ *
+ * On the dual-core ESP32-P4 the capture side (DQBUF, the ISP controller and
+ * the SD card writer) runs on one core and the encoders and network senders
+ * on the other, so a frame can be sent while the next one is dequeued. The
+ * stages are connected by the broadcaster's bounded subscriber queues.
+ */
+
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+
+#if CONFIG_EXAMPLE_PIN_TASKS
+#define TASK_CAPTURE_CORE       CONFIG_EXAMPLE_CAPTURE_TASK_CORE
+#define TASK_ENCODE_CORE        CONFIG_EXAMPLE_ENCODE_TASK_CORE
+#define TASK_NETWORK_CORE       CONFIG_EXAMPLE_NETWORK_TASK_CORE
+#else
+#define TASK_CAPTURE_CORE       tskNO_AFFINITY
+#define TASK_ENCODE_CORE        tskNO_AFFINITY
+#define TASK_NETWORK_CORE       tskNO_AFFINITY
+#endif
+
+#define TASK_CAPTURE_PRIORITY   CONFIG_EXAMPLE_CAPTURE_TASK_PRIORITY
+#define TASK_ENCODE_PRIORITY    CONFIG_EXAMPLE_ENCODE_TASK_PRIORITY
+#define TASK_NETWORK_PRIORITY   CONFIG_EXAMPLE_NETWORK_TASK_PRIORITY
+
+/* The preview only gets the cycles the full-size encoders leave */
+#define TASK_PREVIEW_PRIORITY   (TASK_ENCODE_PRIORITY > 1 ? TASK_ENCODE_PRIORITY - 1 : 1)
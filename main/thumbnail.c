@@ -0,0 +1,350 @@
+/*
+ * JPEG thumbnails of RAW10 Bayer frames
+ *
+ * The thumbnail is built one row at a time: the quads of the box are summed
+ * per CFA position into a row of sums in internal RAM, then turned into
+ * linear RGB without the black level, 12 bits per channel, in PSRAM. Once
+ * the whole frame is read the channel means give the white balance and
+ * brightness gains, and the gamma table maps the linear values into the
+ * RGB24 buffer the JPEG device reads.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#include "esp_video_device.h"
+#include "thumbnail.h"
+
+#define THUMB_BLOCK             8       /* JPEG block size without chroma subsampling */
+#define THUMB_LINEAR_MAX        4095    /* 12-bit linear values, upper eight bits of a sample times 16 */
+#define THUMB_TARGET_MEAN       737     /* 18% grey, the mean green is brought to this level */
+#define THUMB_MAX_GAIN          16      /* Brightening limit, more only shows noise */
+#define THUMB_MAX_WB_RATIO      4       /* White balance limit against the green channel */
+#define THUMB_GAIN_SHIFT        8
+#define THUMB_GAMMA             (1.0f / 2.2f)
+
+enum {
+    THUMB_RED = 0,
+    THUMB_GREEN,
+    THUMB_BLUE,
+};
+
+static const char *TAG = "thumbnail";
+
+struct thumbnail {
+    uint32_t bytesperline;
+    uint32_t factor;            /* Quads per thumbnail pixel in each direction */
+    uint32_t width;             /* Thumbnail size */
+    uint32_t height;
+    uint32_t quad_x;            /* First quad of the centred crop */
+    uint32_t quad_y;
+    uint8_t cfa[4];             /* Colour of each CFA position, row-major */
+    uint16_t black;             /* Black level in linear units */
+    uint32_t *sums;             /* One row of box sums, 4 per thumbnail pixel */
+    uint16_t *linear;           /* Linear RGB thumbnail */
+    uint8_t *gamma;             /* Linear value to 8-bit output */
+    uint8_t *rgb;               /* RGB24 input of the JPEG device */
+    size_t rgb_size;
+    int fd;
+    uint8_t *jpeg;
+};
+
+static esp_err_t thumbnail_get_cfa(uint32_t pixel_format, uint8_t cfa[4])
+{
+    static const uint8_t rggb[4] = {THUMB_RED, THUMB_GREEN, THUMB_GREEN, THUMB_BLUE};
+    static const uint8_t bggr[4] = {THUMB_BLUE, THUMB_GREEN, THUMB_GREEN, THUMB_RED};
+    static const uint8_t gbrg[4] = {THUMB_GREEN, THUMB_BLUE, THUMB_RED, THUMB_GREEN};
+    static const uint8_t grbg[4] = {THUMB_GREEN, THUMB_RED, THUMB_BLUE, THUMB_GREEN};
+
+    switch (pixel_format) {
+    case V4L2_PIX_FMT_SRGGB10:
+        memcpy(cfa, rggb, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SBGGR10:
+        memcpy(cfa, bggr, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SGBRG10:
+        memcpy(cfa, gbrg, 4);
+        return ESP_OK;
+    case V4L2_PIX_FMT_SGRBG10:
+        memcpy(cfa, grbg, 4);
+        return ESP_OK;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+static esp_err_t thumbnail_init_jpeg(thumbnail_t *thumb, uint8_t quality)
+{
+    esp_err_t ret = ESP_OK;
+    struct v4l2_format format;
+    struct v4l2_requestbuffers req;
+    struct v4l2_buffer buf;
+    struct v4l2_ext_controls controls;
+    struct v4l2_ext_control control[1];
+    int fd;
+    int type;
+
+    fd = open(ESP_VIDEO_JPEG_DEVICE_NAME, O_RDONLY);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_FAIL, TAG, "failed to open %s", ESP_VIDEO_JPEG_DEVICE_NAME);
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    format.fmt.pix.width = thumb->width;
+    format.fmt.pix.height = thumb->height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_FAIL, fail, TAG, "failed to set input format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_USERPTR;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request input buffer");
+
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = thumb->width;
+    format.fmt.pix.height = thumb->height;
+    format.fmt.pix.pixelformat = V4L2_PIX_FMT_JPEG;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_FMT, &format) == 0, ESP_FAIL, fail, TAG, "failed to set JPEG format");
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_REQBUFS, &req) == 0, ESP_FAIL, fail, TAG, "failed to request JPEG buffer");
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = 0;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_QUERYBUF, &buf) == 0, ESP_FAIL, fail, TAG, "failed to query JPEG buffer");
+    thumb->jpeg = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+    ESP_GOTO_ON_FALSE(thumb->jpeg != MAP_FAILED, ESP_ERR_NO_MEM, fail, TAG, "failed to map JPEG buffer");
+
+    memset(&controls, 0, sizeof(controls));
+    memset(control, 0, sizeof(control));
+    controls.ctrl_class = V4L2_CID_JPEG_CLASS;
+    controls.count = 1;
+    controls.controls = control;
+    control[0].id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+    control[0].value = quality;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_S_EXT_CTRLS, &controls) == 0, ESP_FAIL, fail, TAG,
+                      "failed to set JPEG quality %u", quality);
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start JPEG output");
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ESP_GOTO_ON_FALSE(ioctl(fd, VIDIOC_STREAMON, &type) == 0, ESP_FAIL, fail, TAG, "failed to start JPEG input");
+
+    thumb->fd = fd;
+    return ESP_OK;
+
+fail:
+    thumb->jpeg = NULL;
+    close(fd);
+    return ret;
+}
+
+esp_err_t thumbnail_create(const thumbnail_config_t *config, thumbnail_t **ret_thumb)
+{
+    esp_err_t ret = ESP_OK;
+    thumbnail_t *thumb;
+    uint8_t cfa[4];
+
+    ESP_RETURN_ON_FALSE(config && ret_thumb && config->width && config->width % 4 == 0 && config->height % 2 == 0 &&
+                        config->bytesperline >= config->width * 5 / 4 && config->max_width >= THUMB_BLOCK &&
+                        config->quality >= 1 && config->quality <= 100, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_ERROR(thumbnail_get_cfa(config->pixel_format, cfa), TAG,
+                        "pixel format 0x%08"PRIx32" is not RAW10 Bayer", config->pixel_format);
+
+    uint32_t quads_x = config->width / 2;
+    uint32_t quads_y = config->height / 2;
+    uint32_t factor = (quads_x + config->max_width - 1) / config->max_width;
+    uint32_t width = quads_x / factor / THUMB_BLOCK * THUMB_BLOCK;
+    uint32_t height = quads_y / factor / THUMB_BLOCK * THUMB_BLOCK;
+
+    ESP_RETURN_ON_FALSE(width && height, ESP_ERR_INVALID_ARG, TAG, "frame too small for a thumbnail");
+
+    thumb = calloc(1, sizeof(thumbnail_t));
+    ESP_RETURN_ON_FALSE(thumb, ESP_ERR_NO_MEM, TAG, "failed to allocate thumbnail");
+    thumb->fd = -1;
+    thumb->bytesperline = config->bytesperline;
+    thumb->factor = factor;
+    thumb->width = width;
+    thumb->height = height;
+    thumb->quad_x = (quads_x - width * factor) / 2;
+    thumb->quad_y = (quads_y - height * factor) / 2;
+    memcpy(thumb->cfa, cfa, sizeof(cfa));
+    /* 10-bit LSB to the 12-bit linear scale of the upper eight bits */
+    thumb->black = config->black_level * 4;
+
+    thumb->sums = heap_caps_malloc(width * 4 * sizeof(uint32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    thumb->gamma = heap_caps_malloc(THUMB_LINEAR_MAX + 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    thumb->linear = heap_caps_malloc(width * height * 3 * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    /* The JPEG device reads the RGB data by DMA */
+    thumb->rgb_size = width * height * 3;
+    thumb->rgb = heap_caps_calloc(1, thumb->rgb_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_DMA | MALLOC_CAP_CACHE_ALIGNED);
+    ESP_GOTO_ON_FALSE(thumb->sums && thumb->gamma && thumb->linear && thumb->rgb, ESP_ERR_NO_MEM, fail, TAG,
+                      "failed to allocate %"PRIu32"x%"PRIu32" thumbnail buffers", width, height);
+
+    for (uint32_t i = 0; i <= THUMB_LINEAR_MAX; i++) {
+        thumb->gamma[i] = (uint8_t)(255.0f * powf((float)i / THUMB_LINEAR_MAX, THUMB_GAMMA) + 0.5f);
+    }
+
+    ESP_GOTO_ON_ERROR(thumbnail_init_jpeg(thumb, config->quality), fail, TAG, "failed to set up JPEG device");
+
+    ESP_LOGI(TAG, "%"PRIu32"x%"PRIu32" thumbnails, 1/%"PRIu32" of the quads, quality %u", width, height,
+             factor * 2, config->quality);
+    *ret_thumb = thumb;
+    return ESP_OK;
+
+fail:
+    thumbnail_delete(thumb);
+    return ret;
+}
+
+void thumbnail_get_size(const thumbnail_t *thumb, uint32_t *width, uint32_t *height)
+{
+    *width = thumb->width;
+    *height = thumb->height;
+}
+
+/* Sum the upper eight bits of every CFA position over the boxes of one thumbnail row */
+static void thumbnail_sum_row(thumbnail_t *thumb, const uint8_t *frame, uint32_t row)
+{
+    uint32_t factor = thumb->factor;
+
+    memset(thumb->sums, 0, thumb->width * 4 * sizeof(uint32_t));
+    for (uint32_t j = 0; j < factor; j++) {
+        uint32_t quad_y = thumb->quad_y + row * factor + j;
+
+        for (uint32_t r = 0; r < 2; r++) {
+            const uint8_t *line = frame + (quad_y * 2 + r) * thumb->bytesperline;
+            uint32_t *sums = thumb->sums + r * 2;
+
+            for (uint32_t x = 0; x < thumb->width; x++, sums += 4) {
+                uint32_t quad_x = thumb->quad_x + x * factor;
+
+                /* Both pixels of a quad row are in the same five-byte group */
+                for (uint32_t i = 0; i < factor; i++, quad_x++) {
+                    const uint8_t *src = line + (quad_x >> 1) * 5 + (quad_x & 1) * 2;
+
+                    sums[0] += src[0];
+                    sums[1] += src[1];
+                }
+            }
+        }
+    }
+}
+
+/* Gain that brings the channel mean to the target, limited to [1, max] in THUMB_GAIN_SHIFT fixed point */
+static uint32_t thumbnail_gain(uint64_t mean, uint32_t target, uint32_t max)
+{
+    if (mean * max <= target) {
+        return max << THUMB_GAIN_SHIFT;
+    }
+    return MAX((target << THUMB_GAIN_SHIFT) / mean, 1 << THUMB_GAIN_SHIFT);
+}
+
+esp_err_t thumbnail_encode(thumbnail_t *thumb, const uint8_t *frame, const uint8_t **jpeg, size_t *size)
+{
+    uint32_t area = thumb->factor * thumb->factor;
+    uint32_t pixels = thumb->width * thumb->height;
+    uint64_t total[3] = {0};
+    uint16_t *linear = thumb->linear;
+
+    for (uint32_t y = 0; y < thumb->height; y++) {
+        thumbnail_sum_row(thumb, frame, y);
+
+        for (uint32_t x = 0; x < thumb->width; x++, linear += 3) {
+            const uint32_t *sums = thumb->sums + x * 4;
+            uint32_t rgb[3] = {0};
+
+            for (int pos = 0; pos < 4; pos++) {
+                uint32_t value = (sums[pos] * 16 + area / 2) / area;
+
+                rgb[thumb->cfa[pos]] += value > thumb->black ? value - thumb->black : 0;
+            }
+            rgb[THUMB_GREEN] /= 2;
+
+            for (int c = 0; c < 3; c++) {
+                linear[c] = rgb[c];
+                total[c] += rgb[c];
+            }
+        }
+    }
+
+    /* Grey world: the brightness gain is set on green, red and blue are matched to green */
+    uint32_t gain_g = thumbnail_gain(total[THUMB_GREEN] / pixels, THUMB_TARGET_MEAN, THUMB_MAX_GAIN);
+    uint32_t gain[3];
+
+    for (int c = 0; c < 3; c++) {
+        uint64_t ratio = total[c] ? (total[THUMB_GREEN] << THUMB_GAIN_SHIFT) / total[c] : 1 << THUMB_GAIN_SHIFT;
+
+        ratio = MIN(MAX(ratio, (1 << THUMB_GAIN_SHIFT) / THUMB_MAX_WB_RATIO), THUMB_MAX_WB_RATIO << THUMB_GAIN_SHIFT);
+        gain[c] = (gain_g * ratio) >> THUMB_GAIN_SHIFT;
+    }
+
+    linear = thumb->linear;
+    for (uint32_t i = 0; i < pixels * 3; i += 3) {
+        for (int c = 0; c < 3; c++) {
+            uint32_t value = (linear[i + c] * gain[c]) >> THUMB_GAIN_SHIFT;
+
+            thumb->rgb[i + c] = thumb->gamma[MIN(value, THUMB_LINEAR_MAX)];
+        }
+    }
+
+    struct v4l2_buffer out_buf;
+    struct v4l2_buffer cap_buf;
+
+    memset(&cap_buf, 0, sizeof(cap_buf));
+    cap_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cap_buf.memory = V4L2_MEMORY_MMAP;
+    cap_buf.index = 0;
+    ESP_RETURN_ON_FALSE(ioctl(thumb->fd, VIDIOC_QBUF, &cap_buf) == 0, ESP_FAIL, TAG, "QBUF JPEG failed");
+
+    memset(&out_buf, 0, sizeof(out_buf));
+    out_buf.index = 0;
+    out_buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    out_buf.memory = V4L2_MEMORY_USERPTR;
+    out_buf.m.userptr = (unsigned long)thumb->rgb;
+    out_buf.length = thumb->rgb_size;
+    out_buf.bytesused = thumb->rgb_size;
+    ESP_RETURN_ON_FALSE(ioctl(thumb->fd, VIDIOC_QBUF, &out_buf) == 0, ESP_FAIL, TAG, "QBUF RGB failed");
+
+    esp_err_t ret = ioctl(thumb->fd, VIDIOC_DQBUF, &cap_buf) == 0 ? ESP_OK : ESP_FAIL;
+    ESP_RETURN_ON_FALSE(ioctl(thumb->fd, VIDIOC_DQBUF, &out_buf) == 0, ESP_FAIL, TAG, "DQBUF RGB failed");
+    ESP_RETURN_ON_ERROR(ret, TAG, "DQBUF JPEG failed");
+    ESP_RETURN_ON_FALSE(cap_buf.bytesused, ESP_FAIL, TAG, "JPEG encoding failed");
+
+    *jpeg = thumb->jpeg;
+    *size = cap_buf.bytesused;
+    return ESP_OK;
+}
+
+void thumbnail_delete(thumbnail_t *thumb)
+{
+    if (!thumb) {
+        return;
+    }
+
+    if (thumb->fd >= 0) {
+        close(thumb->fd);
+    }
+    heap_caps_free(thumb->sums);
+    heap_caps_free(thumb->gamma);
+    heap_caps_free(thumb->linear);
+    heap_caps_free(thumb->rgb);
+    free(thumb);
+}
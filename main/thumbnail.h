@@ -0,0 +1,96 @@
+/*
+ * JPEG thumbnails of RAW10 Bayer frames
+ *
+ * Every 2 x 2 Bayer quad is one colour sample; the quads are box filtered
+ * down to the thumbnail size from the upper eight bits of each sample, so
+ * the packed frame is read without unpacking it. The thumbnail is white
+ * balanced on the grey world of the frame and brightened to a fixed mean
+ * level before the gamma curve, so that dark RAW frames still show in a
+ * gallery. It is then compressed by the hardware JPEG M2M device, which is
+ * otherwise idle in SD card mode.
+ *
+ * Thumbnails do not show how the frame was exposed; use the RAW statistics
+ * for that.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Thumbnail handle
+ */
+typedef struct thumbnail thumbnail_t;
+
+/**
+ * @brief Frame geometry and thumbnail settings
+ */
+typedef struct {
+    uint32_t width;                 /*!< Frame width in pixels, a multiple of 4 */
+    uint32_t height;                /*!< Frame height, a multiple of 2 */
+    uint32_t bytesperline;          /*!< Packed RAW10 line size */
+    uint32_t pixel_format;          /*!< V4L2_PIX_FMT_S{RGGB,BGGR,GBRG,GRBG}10 */
+    uint16_t black_level;           /*!< Sensor black level, 10-bit LSB */
+    uint16_t max_width;             /*!< Largest thumbnail width in pixels */
+    uint8_t quality;                /*!< JPEG quality, 1 to 100 */
+} thumbnail_config_t;
+
+/**
+ * @brief Create a thumbnail encoder
+ *
+ * The thumbnail is the frame downscaled by the smallest integer factor that
+ * makes it no wider than max_width, cropped to whole JPEG blocks.
+ *
+ * @param config    Frame geometry and thumbnail settings
+ * @param ret_thumb Returned thumbnail encoder
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the geometry is not RAW10 Bayer or too small
+ *      - ESP_ERR_NOT_SUPPORTED if the pixel format is no Bayer format
+ *      - ESP_ERR_NO_MEM if there is not enough memory
+ *      - ESP_FAIL if the JPEG device could not be set up
+ */
+esp_err_t thumbnail_create(const thumbnail_config_t *config, thumbnail_t **ret_thumb);
+
+/**
+ * @brief Get the thumbnail size
+ *
+ * @param thumb  Thumbnail encoder
+ * @param width  Returned width in pixels
+ * @param height Returned height in pixels
+ */
+void thumbnail_get_size(const thumbnail_t *thumb, uint32_t *width, uint32_t *height);
+
+/**
+ * @brief Make the thumbnail of a frame
+ *
+ * The JPEG data stays valid until the next call.
+ *
+ * @param thumb Thumbnail encoder
+ * @param frame Packed RAW10 frame
+ * @param jpeg  Returned JPEG data
+ * @param size  Returned JPEG size in bytes
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the JPEG device failed
+ */
+esp_err_t thumbnail_encode(thumbnail_t *thumb, const uint8_t *frame, const uint8_t **jpeg, size_t *size);
+
+/**
+ * @brief Delete a thumbnail encoder
+ *
+ * @param thumb Thumbnail encoder, can be NULL
+ */
+void thumbnail_delete(thumbnail_t *thumb);
+
+#ifdef __cplusplus
+}
+#endif
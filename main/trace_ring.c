@@ -0,0 +1,147 @@
+/*
+ * Binary trace ring for the streaming hot paths
+ *
+ * Each core owns one ring, so writers never share a cache line with the other
+ * core. A writer reserves a slot with an atomic increment of the ring head,
+ * which also orders it against an ISR or a preempting task on the same core,
+ * and publishes the slot by storing its sequence number last. Readers copy a
+ * slot only if its sequence number is the expected one before and after the
+ * copy, like a seqlock, and never block the writers.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "trace_ring.h"
+
+#define TRACE_RING_SIZE     (1U << CONFIG_EXAMPLE_TRACE_RING_ORDER)
+#define TRACE_RING_MASK     (TRACE_RING_SIZE - 1)
+
+typedef struct {
+    _Atomic uint32_t seq;               /* Record number + 1, 0 while the slot is written */
+    uint32_t timestamp_us;
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t arg;
+} trace_slot_t;
+
+typedef struct {
+    _Atomic uint32_t head;              /* Number of records ever reserved */
+    trace_slot_t slots[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static const char *TAG = "trace_ring";
+
+static trace_ring_t s_rings[portNUM_PROCESSORS];
+
+static const char *const s_event_names[TRACE_EVENT_MAX] = {
+    [TRACE_EVENT_CAPTURE_DQBUF] = "capture_dqbuf",
+    [TRACE_EVENT_CAPTURE_DQBUF_ERROR] = "capture_dqbuf_error",
+    [TRACE_EVENT_CAPTURE_QBUF] = "capture_qbuf",
+    [TRACE_EVENT_FRAME_PUBLISH] = "frame_publish",
+    [TRACE_EVENT_FRAME_DROP] = "frame_drop",
+    [TRACE_EVENT_JPEG_START] = "jpeg_start",
+    [TRACE_EVENT_JPEG_DONE] = "jpeg_done",
+    [TRACE_EVENT_PREVIEW_DONE] = "preview_done",
+    [TRACE_EVENT_RAW_CODEC_START] = "raw_codec_start",
+    [TRACE_EVENT_RAW_CODEC_DONE] = "raw_codec_done",
+    [TRACE_EVENT_SEND_START] = "send_start",
+    [TRACE_EVENT_SEND_DONE] = "send_done",
+    [TRACE_EVENT_SEND_ERROR] = "send_error",
+    [TRACE_EVENT_SD_WRITE_START] = "sd_write_start",
+    [TRACE_EVENT_SD_WRITE_DONE] = "sd_write_done",
+    [TRACE_EVENT_SD_RING_OVERRUN] = "sd_ring_overrun",
+    [TRACE_EVENT_INFERENCE_TAP_DONE] = "inference_tap_done",
+};
+
+void IRAM_ATTR trace_ring_record(trace_event_id_t event, uint32_t arg)
+{
+    trace_ring_t *ring = &s_rings[esp_cpu_get_core_id()];
+    uint32_t n = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    trace_slot_t *slot = &ring->slots[n & TRACE_RING_MASK];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->timestamp_us = (uint32_t)esp_timer_get_time();
+    slot->event = event;
+    slot->arg = arg;
+    atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+}
+
+/* Order by timestamp, the 32-bit microsecond clock wraps every 71 minutes */
+static int trace_record_compare(const void *a, const void *b)
+{
+    const trace_record_t *ra = (const trace_record_t *)a;
+    const trace_record_t *rb = (const trace_record_t *)b;
+    int32_t diff = (int32_t)(ra->timestamp_us - rb->timestamp_us);
+
+    return diff < 0 ? -1 : diff > 0;
+}
+
+size_t trace_ring_snapshot(trace_record_t *records, size_t max_records)
+{
+    size_t count = 0;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_ring_t *ring = &s_rings[core];
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint32_t n = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        for (; n != head && count < max_records; n++) {
+            trace_slot_t *slot = &ring->slots[n & TRACE_RING_MASK];
+            trace_record_t *record = &records[count];
+
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != n + 1) {
+                continue;
+            }
+            record->timestamp_us = slot->timestamp_us;
+            record->event = slot->event;
+            record->core = core;
+            record->reserved = 0;
+            record->arg = slot->arg;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == n + 1) {
+                count++;
+            }
+        }
+    }
+
+    qsort(records, count, sizeof(trace_record_t), trace_record_compare);
+    return count;
+}
+
+const char *trace_ring_event_name(uint16_t event)
+{
+    if (event >= TRACE_EVENT_MAX || !s_event_names[event]) {
+        return "unknown";
+    }
+
+    return s_event_names[event];
+}
+
+esp_err_t trace_ring_log_dump(void)
+{
+    trace_record_t *records = malloc(TRACE_RING_MAX_RECORDS * sizeof(trace_record_t));
+    size_t count;
+
+    if (!records) {
+        ESP_LOGE(TAG, "failed to allocate trace snapshot");
+        return ESP_ERR_NO_MEM;
+    }
+
+    count = trace_ring_snapshot(records, TRACE_RING_MAX_RECORDS);
+    ESP_LOGI(TAG, "%zu trace records:", count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t delta = i ? records[i].timestamp_us - records[i - 1].timestamp_us : 0;
+
+        ESP_LOGI(TAG, "%10"PRIu32" +%7"PRIu32" core%u %-20s %"PRIu32, records[i].timestamp_us, delta,
+                 records[i].core, trace_ring_event_name(records[i].event), records[i].arg);
+    }
+
+    free(records);
+    return ESP_OK;
+}
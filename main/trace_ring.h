@@ -0,0 +1,116 @@
+/*
+ * Binary trace ring for the streaming hot paths
+ *
+ * Logging every frame over the UART costs milliseconds and serializes the
+ * capture, encoder and network tasks on the log lock. Hot paths record a
+ * timestamped event ID and one argument instead: a single atomic increment
+ * and a 16-byte store into a ring owned by the current core. The rings are
+ * decoded on demand, over HTTP (/trace) or on the console.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Trace event IDs
+ */
+typedef enum {
+    TRACE_EVENT_CAPTURE_DQBUF = 1,      /*!< Capture buffer dequeued, arg: buffer index */
+    TRACE_EVENT_CAPTURE_DQBUF_ERROR,    /*!< Capture DQBUF failed, arg: errno */
+    TRACE_EVENT_CAPTURE_QBUF,           /*!< Capture buffer queued back, arg: buffer index */
+    TRACE_EVENT_FRAME_PUBLISH,          /*!< Frame published, arg: sequence */
+    TRACE_EVENT_FRAME_DROP,             /*!< Frame dropped for a slow subscriber, arg: subscriber ID */
+    TRACE_EVENT_JPEG_START,             /*!< JPEG encoding started, arg: sequence */
+    TRACE_EVENT_JPEG_DONE,              /*!< JPEG encoding done, arg: encoded size */
+    TRACE_EVENT_PREVIEW_DONE,           /*!< Preview frame downscaled, arg: sequence */
+    TRACE_EVENT_RAW_CODEC_START,        /*!< RAW compression started, arg: sequence */
+    TRACE_EVENT_RAW_CODEC_DONE,         /*!< RAW compression done, arg: compressed size */
+    TRACE_EVENT_SEND_START,             /*!< Network send of a frame started, arg: sequence */
+    TRACE_EVENT_SEND_DONE,              /*!< Network send of a frame done, arg: bytes */
+    TRACE_EVENT_SEND_ERROR,             /*!< Network send failed, arg: sequence */
+    TRACE_EVENT_SD_WRITE_START,         /*!< SD card write started, arg: bytes */
+    TRACE_EVENT_SD_WRITE_DONE,          /*!< SD card write done, arg: bytes written */
+    TRACE_EVENT_SD_RING_OVERRUN,        /*!< Frame dropped, the SD recording ring was full, arg: overrun count */
+    TRACE_EVENT_INFERENCE_TAP_DONE,     /*!< Inference pyramid built, arg: sequence */
+    TRACE_EVENT_MAX,
+} trace_event_id_t;
+
+/**
+ * @brief Decoded trace record
+ */
+typedef struct {
+    uint32_t timestamp_us;  /*!< Low 32 bits of the esp_timer time */
+    uint16_t event;         /*!< One of trace_event_id_t */
+    uint8_t core;           /*!< Core that recorded the event */
+    uint8_t reserved;
+    uint32_t arg;           /*!< Event argument */
+} trace_record_t;
+
+#if CONFIG_EXAMPLE_TRACE_RING
+
+/**
+ * @brief Maximum number of records returned by trace_ring_snapshot()
+ */
+#define TRACE_RING_MAX_RECORDS  (portNUM_PROCESSORS << CONFIG_EXAMPLE_TRACE_RING_ORDER)
+
+/**
+ * @brief Record an event in the ring of the current core
+ *
+ * Lock-free and safe to call from tasks and ISRs, the oldest record of the
+ * ring is overwritten when it is full.
+ *
+ * @param event Event ID
+ * @param arg   Event argument
+ */
+void trace_ring_record(trace_event_id_t event, uint32_t arg);
+
+/**
+ * @brief Copy the rings of all cores, oldest record first
+ *
+ * Records overwritten while they are being copied are skipped.
+ *
+ * @param records     Returned records
+ * @param max_records Capacity of records, TRACE_RING_MAX_RECORDS holds them all
+ *
+ * @return Number of records copied
+ */
+size_t trace_ring_snapshot(trace_record_t *records, size_t max_records);
+
+/**
+ * @brief Get the name of an event ID
+ *
+ * @param event Event ID
+ *
+ * @return Event name, "unknown" for an invalid ID
+ */
+const char *trace_ring_event_name(uint16_t event);
+
+/**
+ * @brief Decode all rings to the console
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NO_MEM if the snapshot could not be allocated
+ */
+esp_err_t trace_ring_log_dump(void);
+
+#define TRACE_RING_RECORD(event, arg)   trace_ring_record((event), (arg))
+
+#else
+
+#define TRACE_RING_RECORD(event, arg)   do { (void)(arg); } while (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,13 +13,17 @@ Supports:
     - RGB888: 3 bytes per pixel (ISP processed - full color correction)
     - RGB565: 2 bytes per pixel (ISP processed)
     - RAW8: 1 byte per pixel, Bayer RGGB pattern
-    - RAW10 packed: 5 bytes per 4 pixels (legacy)
+    - RAW10 packed: 5 bytes per 4 pixels, demosaiced here (EXAMPLE_HTTP_CAPTURE_RAW10)
+    - RAW10 lossless: Rice coded RAW10 from the ESP32 RAW codec device ("R10R")
+    - JPEG: hardware encoded frames, e.g. from the adaptive /stream.auto
 """
 
 import numpy as np
 import cv2
 import argparse
 import requests
+import ssl
+import struct
 import time
 import threading
 from queue import Queue
@@ -28,6 +32,133 @@ from queue import Queue
 DEFAULT_WIDTH = 1936
 DEFAULT_HEIGHT = 1100
 
+# Lossless RAW10 frames (V4L2_PIX_FMT_ESP_RAW10_RICE), see esp_video_raw_codec_device.c
+RAW10_RICE_MAGIC = b'R10R'
+RAW10_RICE_LINE_STORED = 0xff
+RAW10_RICE_PREDICTION_INIT = 512
+
+JPEG_SOI = b'\xff\xd8'
+JPEG_EOI = b'\xff\xd9'
+
+# Packed RAW10 frames name their Bayer pattern, by fourcc on /ws and UDP or by X-Bayer-Pattern on multipart parts
+BAYER_RAW10_FOURCCS = {b'RG10': 'RG', b'BG10': 'BG', b'GB10': 'GB', b'BA10': 'GR'}
+BAYER_PATTERNS = {b'RGGB': 'RG', b'BGGR': 'BG', b'GBRG': 'GB', b'GRBG': 'GR'}
+
+# /ws binary messages start with this header (ws_frame_header_t in raw_http_streamer.c)
+WS_FRAME_MAGIC = b'ESPF'
+WS_FRAME_HEADER = struct.Struct('<4sHHIqIIIIII')
+# Version 2 appends the capture time since the UNIX epoch in microseconds, 0 until the board clock is set
+WS_FRAME_WALL_TIME = struct.Struct('<q')
+
+# UDP datagrams start with this header (udp_fragment_header_t in raw_http_streamer.c)
+UDP_FRAGMENT_MAGIC = b'ESPU'
+UDP_FRAGMENT_HEADER = struct.Struct('<4sIHHIHBBqIII')
+UDP_FRAGMENT_FLAG_PARITY = 0x01
+UDP_KEEPALIVE_INTERVAL = 1.0
+
+
+class FrameAssembler:
+    """Reassemble one UDP frame, restores a single lost fragment per FEC group"""
+
+    def __init__(self, count, frame_size, fec_group):
+        self.count = count
+        self.frame_size = frame_size
+        self.fec_group = fec_group
+        self.fragments = {}
+        self.parity = {}
+
+    def add(self, index, flags, payload):
+        if flags & UDP_FRAGMENT_FLAG_PARITY:
+            self.parity[index] = payload
+        else:
+            self.fragments[index] = payload
+
+    def complete(self):
+        return len(self.fragments) == self.count
+
+    def recover(self):
+        """XOR the parity with the received fragments of each group missing exactly one"""
+        if not self.fec_group:
+            return
+        for group, parity in self.parity.items():
+            first = group * self.fec_group
+            indices = range(first, min(first + self.fec_group, self.count))
+            missing = [i for i in indices if i not in self.fragments]
+            if len(missing) != 1:
+                continue
+            restored = np.frombuffer(parity, dtype=np.uint8).copy()
+            for i in indices:
+                if i in self.fragments:
+                    data = np.frombuffer(self.fragments[i], dtype=np.uint8)
+                    restored[:len(data)] ^= data
+            size = min(len(parity), self.frame_size - missing[0] * len(parity))
+            self.fragments[missing[0]] = restored[:size].tobytes()
+
+    def data(self):
+        return b''.join(self.fragments[i] for i in range(self.count))
+
+
+def unpack_raw10(packed, width):
+    """Unpack MIPI RAW10 lines (5 bytes per 4 pixels) to uint16, works on the last axis"""
+    groups = packed.reshape(packed.shape[:-1] + (width // 4, 5)).astype(np.uint16)
+    pixels = (groups[..., :4] << 2) | ((groups[..., 4:5] >> np.array([0, 2, 4, 6], dtype=np.uint16)) & 0x3)
+    return pixels.reshape(packed.shape[:-1] + (width,))
+
+
+def decode_raw10_rice(data):
+    """Decode a lossless RAW10 frame
+
+    Every line carries its Rice parameter k, the k-bit remainders and the unary
+    coded quotients. Both are unpacked with numpy for the whole line, then the
+    same-color left prediction is undone with a cumulative sum per Bayer column.
+
+    Returns:
+        (bayer_img, fourcc): uint16 image of 10-bit samples and the source pixel format
+    """
+    magic, width, height, fourcc = struct.unpack_from('<4sHHI', data, 0)
+    if magic != RAW10_RICE_MAGIC:
+        raise ValueError('not a lossless RAW10 frame')
+
+    data = np.frombuffer(data, dtype=np.uint8)
+    line_size = width * 5 // 4
+    bayer_img = np.empty((height, width), dtype=np.uint16)
+    offset = 12
+
+    for y in range(height):
+        k = int(data[offset])
+        unary_len = int(data[offset + 2]) | (int(data[offset + 3]) << 8)
+        offset += 4
+
+        if k == RAW10_RICE_LINE_STORED:
+            bayer_img[y] = unpack_raw10(data[offset:offset + line_size], width)
+            offset += line_size
+            continue
+
+        rem_len = (width * k + 7) // 8
+        if k:
+            bits = np.unpackbits(data[offset:offset + rem_len])[:width * k].reshape(width, k)
+            remainders = bits.astype(np.int32) @ (1 << np.arange(k - 1, -1, -1, dtype=np.int32))
+        else:
+            remainders = 0
+        offset += rem_len
+
+        ones = np.flatnonzero(np.unpackbits(data[offset:offset + unary_len]))[:width]
+        offset += unary_len
+        if len(ones) != width:
+            raise ValueError(f'truncated line {y}')
+        quotients = np.diff(ones, prepend=-1) - 1
+
+        mapped = (quotients.astype(np.int32) << k) | remainders
+        residuals = (mapped >> 1) ^ -(mapped & 1)
+
+        line = np.empty(width, dtype=np.int32)
+        line[0::2] = RAW10_RICE_PREDICTION_INIT + np.cumsum(residuals[0::2])
+        line[1::2] = RAW10_RICE_PREDICTION_INIT + np.cumsum(residuals[1::2])
+        bayer_img[y] = line
+
+    return bayer_img, fourcc
+
+
 class ImageDecoder:
     """Decode image data from IMX662 (supports RGB888 and RAW formats)"""
 
@@ -56,6 +187,9 @@ class ImageDecoder:
         print(f"  RGB565 frame size: {self.frame_size_rgb565} bytes")
         print(f"  RAW8 frame size: {self.frame_size_raw8} bytes")
 
+        # Bayer pattern named by the stream, overrides the one picked in the viewer
+        self.stream_pattern = None
+
         # CLAHE for auto-enhancement
         self.clahe = cv2.createCLAHE(clipLimit=2.0, tileGridSize=(8, 8))
 
@@ -183,6 +317,13 @@ class ImageDecoder:
 
         return bayer_img
 
+    def set_raw10(self, pattern):
+        """Decode the following frames as packed RAW10 of a known Bayer pattern, skips size detection"""
+        if self.stream_pattern != pattern:
+            print(f"Stream sends packed RAW10, Bayer pattern {pattern}")
+        self.stream_pattern = pattern
+        self._cached_format = 'packed'
+
     def decode_raw16(self, raw_data):
         """Decode 16-bit RAW data (10-bit in 16-bit container)"""
         expected_size = self.frame_size_unpacked
@@ -210,6 +351,13 @@ class ImageDecoder:
         """
         data_len = len(data)
 
+        # Lossless frames are self-describing, their size depends on the scene
+        if data[:4] == RAW10_RICE_MAGIC:
+            bayer_img, _ = decode_raw10_rice(data)
+            return bayer_img, 'raw'
+        if data[:2] == JPEG_SOI:
+            return cv2.imdecode(np.frombuffer(data, dtype=np.uint8), cv2.IMREAD_COLOR), 'rgb'
+
         # Use cached format if available
         if hasattr(self, '_cached_format'):
             if self._cached_format == 'rgb888':
@@ -413,9 +561,20 @@ class ImageDecoder:
 class RawStreamViewer:
     """Real-time stream viewer for IMX662 (supports RGB888/RGB565 from ISP and RAW)"""
 
-    def __init__(self, host, port, width=DEFAULT_WIDTH, height=DEFAULT_HEIGHT):
+    def __init__(self, host, port, width=DEFAULT_WIDTH, height=DEFAULT_HEIGHT, roi=None, preview=False,
+                 lossless=False, websocket=False, udp_port=None, fec=0, auto_fps=None, tls=False):
         self.host = host
         self.port = port
+        self.tls = tls  # HTTPS / WSS, the device's development certificate is self-signed
+        self.roi = roi  # (x, y, w, h) capture window programmed on the sensor
+        self.preview = preview  # Decimated /stream.preview, the geometry comes from the part headers
+        self.lossless = lossless  # Compressed RAW10 /stream.lossless, variable size parts
+        self.websocket = websocket  # /ws transport with per-frame metadata and credit flow control
+        self.udp_port = udp_port  # UDP transport, incomplete frames are dropped instead of stalling
+        self.fec = fec  # Data fragments per XOR parity fragment, 0 disables FEC
+        self.auto_fps = auto_fps  # Adaptive /stream.auto target, parts switch between RGB, JPEG and preview
+        if roi:
+            width, height = roi[2], roi[3]
         self.decoder = ImageDecoder(width, height)
         self.frame_queue = Queue(maxsize=2)  # Small queue for low latency
         self.running = False
@@ -424,13 +583,207 @@ class RawStreamViewer:
         self.last_frame = None  # Keep last frame to avoid "waiting" screen
         self.dropped_frames = 0  # Count dropped frames for stats
 
+    @staticmethod
+    def parse_content_length(headers):
+        """Return the Content-Length of a part, or None"""
+        for line in headers.split(b'\r\n'):
+            name, _, value = line.partition(b':')
+            if name.strip().lower() == b'content-length':
+                try:
+                    return int(value.strip())
+                except ValueError:
+                    return None
+        return None
+
+    @staticmethod
+    def parse_geometry(headers):
+        """Return (width, height) from X-Frame-Width/X-Frame-Height part headers, or None"""
+        values = {}
+        for line in headers.split(b'\r\n'):
+            name, _, value = line.partition(b':')
+            values[name.strip().lower()] = value.strip()
+        try:
+            return int(values[b'x-frame-width']), int(values[b'x-frame-height'])
+        except (KeyError, ValueError):
+            return None
+
+    @staticmethod
+    def parse_bayer_pattern(headers):
+        """Return the Bayer pattern of a packed RAW10 part from X-Bayer-Pattern, or None"""
+        for line in headers.split(b'\r\n'):
+            name, _, value = line.partition(b':')
+            if name.strip().lower() == b'x-bayer-pattern':
+                return BAYER_PATTERNS.get(value.strip().upper())
+        return None
+
+    def ws_receiver_thread(self):
+        """Background thread using the /ws transport, one credit is returned per received frame"""
+        import websocket  # pip install websocket-client
+
+        stream = 'lossless' if self.lossless else 'preview' if self.preview else 'raw'
+        url = f"{'wss' if self.tls else 'ws'}://{self.host}:{self.port}/ws?stream={stream}&credits=2"
+        if self.roi:
+            x, y, w, h = self.roi
+            url += f"&x={x}&y={y}&w={w}&h={h}"
+        last_time = time.time()
+        frame_count = 0
+
+        while self.running:
+            try:
+                print(f"Connecting to WebSocket: {url}")
+                ws = websocket.create_connection(url, timeout=10,
+                                                 sslopt={'cert_reqs': ssl.CERT_NONE} if self.tls else None)
+                while self.running:
+                    message = ws.recv()
+                    if not isinstance(message, bytes) or message[:4] != WS_FRAME_MAGIC:
+                        continue
+
+                    (_, header_size, version, sequence, timestamp_us, width, height, fourcc,
+                     exposure, gain, payload_size) = WS_FRAME_HEADER.unpack_from(message)
+                    wall_time_us = 0
+                    if version >= 2:
+                        (wall_time_us,) = WS_FRAME_WALL_TIME.unpack_from(message, WS_FRAME_HEADER.size)
+                    data = message[header_size:header_size + payload_size]
+
+                    # Grant the next frame before decoding, so sending overlaps with our work
+                    ws.send_binary(struct.pack('<I', 1))
+
+                    if (width, height) != (self.decoder.width, self.decoder.height):
+                        print(f"Frame geometry changed to {width}x{height}")
+                        self.decoder = ImageDecoder(width, height)
+                    if fourcc.to_bytes(4, 'little') in BAYER_RAW10_FOURCCS:
+                        self.decoder.set_raw10(BAYER_RAW10_FOURCCS[fourcc.to_bytes(4, 'little')])
+
+                    if frame_count == 0:
+                        print(f"Frame {sequence}: {payload_size} bytes, fourcc={fourcc.to_bytes(4, 'little')}, "
+                              f"exposure={exposure}, gain={gain}, t={timestamp_us / 1e6:.3f}s, "
+                              f"wall={wall_time_us / 1e6:.6f}s")
+
+                    while not self.frame_queue.empty():
+                        try:
+                            self.frame_queue.get_nowait()
+                            self.dropped_frames += 1
+                        except:
+                            break
+                    self.frame_queue.put(data)
+
+                    frame_count += 1
+                    current_time = time.time()
+                    if current_time - last_time >= 1.0:
+                        self.fps = frame_count / (current_time - last_time)
+                        print(f"FPS: {self.fps:.1f} (exposure={exposure}, gain={gain})")
+                        frame_count = 0
+                        last_time = current_time
+            except Exception as e:
+                print(f"WebSocket error: {e}, reconnecting...")
+                time.sleep(0.5)
+
+    def udp_receiver_thread(self):
+        """Background thread using the UDP transport"""
+        import socket
+
+        stream = 'lossless' if self.lossless else 'preview' if self.preview else 'raw'
+        request = f"stream={stream}&fec={self.fec}"
+        if self.roi:
+            x, y, w, h = self.roi
+            request += f"&x={x}&y={y}&w={w}&h={h}"
+
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8 * 1024 * 1024)
+        sock.settimeout(0.2)
+        server = (self.host, self.udp_port)
+        print(f"Subscribing to udp://{self.host}:{self.udp_port} ({request})")
+
+        assembler = None
+        frame_id = None
+        last_keepalive = 0
+        last_time = time.time()
+        frame_count = 0
+        lost_frames = 0
+        recovered = 0
+
+        while self.running:
+            now = time.time()
+            if now - last_keepalive >= UDP_KEEPALIVE_INTERVAL:
+                sock.sendto(request.encode(), server)
+                last_keepalive = now
+
+            try:
+                datagram, _ = sock.recvfrom(65536)
+            except socket.timeout:
+                continue
+            if len(datagram) < UDP_FRAGMENT_HEADER.size or datagram[:4] != UDP_FRAGMENT_MAGIC:
+                continue
+
+            (_, fid, index, count, frame_size, payload_size, flags, fec_group,
+             timestamp_us, width, height, fourcc) = UDP_FRAGMENT_HEADER.unpack_from(datagram)
+            payload = datagram[UDP_FRAGMENT_HEADER.size:UDP_FRAGMENT_HEADER.size + payload_size]
+
+            # A new frame id means the previous frame will never complete, drop it
+            if fid != frame_id:
+                if assembler is not None:
+                    lost_frames += 1
+                assembler = FrameAssembler(count, frame_size, fec_group)
+                frame_id = fid
+            if assembler is None:
+                continue
+            assembler.add(index, flags, payload)
+
+            if not assembler.complete():
+                missing = assembler.count - len(assembler.fragments)
+                # The parity of a group is sent right after its last fragment
+                if fec_group and flags & UDP_FRAGMENT_FLAG_PARITY and missing <= len(assembler.parity):
+                    assembler.recover()
+                    if assembler.complete():
+                        recovered += 1
+                if not assembler.complete():
+                    continue
+
+            if (width, height) != (self.decoder.width, self.decoder.height):
+                print(f"Frame geometry changed to {width}x{height}")
+                self.decoder = ImageDecoder(width, height)
+            if fourcc.to_bytes(4, 'little') in BAYER_RAW10_FOURCCS:
+                self.decoder.set_raw10(BAYER_RAW10_FOURCCS[fourcc.to_bytes(4, 'little')])
+
+            while not self.frame_queue.empty():
+                try:
+                    self.frame_queue.get_nowait()
+                    self.dropped_frames += 1
+                except:
+                    break
+            self.frame_queue.put(assembler.data())
+            assembler = None
+
+            frame_count += 1
+            current_time = time.time()
+            if current_time - last_time >= 1.0:
+                self.fps = frame_count / (current_time - last_time)
+                print(f"FPS: {self.fps:.1f} (lost {lost_frames}, recovered by FEC {recovered})")
+                frame_count = 0
+                lost_frames = 0
+                recovered = 0
+                last_time = current_time
+
+        sock.sendto(b'bye', server)
+
     def receiver_thread(self):
         """Background thread using continuous streaming"""
         last_time = time.time()
         frame_count = 0
         debug_count = 0
 
-        url = f"http://{self.host}:{self.port}/stream"
+        if self.auto_fps:
+            endpoint = f'stream.auto?fps={self.auto_fps}'
+        elif self.lossless:
+            endpoint = 'stream.lossless'
+        elif self.preview:
+            endpoint = 'stream.preview'
+        else:
+            endpoint = 'stream'
+        url = f"{'https' if self.tls else 'http'}://{self.host}:{self.port}/{endpoint}"
+        if self.roi:
+            x, y, w, h = self.roi
+            url += ("&" if "?" in url else "?") + f"x={x}&y={y}&w={w}&h={h}"
         boundary = b'--raw_frame_boundary'
         # Use RGB888 size as primary (ISP output), can auto-detect others
         min_size = self.decoder.frame_size_rgb888
@@ -446,7 +799,7 @@ class RawStreamViewer:
             try:
                 print(f"Connecting to stream: {url}")
                 print(f"LOW LATENCY MODE: Dropping old frames, max buffer {max_buffer_size} bytes")
-                response = requests.get(url, stream=True, timeout=10)
+                response = requests.get(url, stream=True, timeout=10, verify=not self.tls)
                 buffer = b''
                 total_received = 0
 
@@ -473,23 +826,41 @@ class RawStreamViewer:
 
                         # Extract binary data (skip headers)
                         if b'\r\n\r\n' in frame_data:
-                            _, data = frame_data.split(b'\r\n\r\n', 1)
+                            headers, data = frame_data.split(b'\r\n\r\n', 1)
                             # Don't strip - raw data might end with \r\n
 
+                            # Every part carries its geometry, follow capture window changes
+                            geometry = self.parse_geometry(headers)
+                            if geometry and geometry != (self.decoder.width, self.decoder.height):
+                                print(f"Frame geometry changed to {geometry[0]}x{geometry[1]}")
+                                self.decoder = ImageDecoder(*geometry)
+                                max_buffer_size = self.decoder.frame_size_rgb888 * 2
+                            pattern = self.parse_bayer_pattern(headers)
+                            if pattern:
+                                self.decoder.set_raw10(pattern)
+
                             data_len = len(data)
-                            # Accept any valid frame size (RGB888, RGB565, RAW8)
+                            # Accept any valid frame size (RGB888, RGB565, RAW8, packed RAW10)
                             valid_sizes = [
                                 self.decoder.frame_size_rgb888,
                                 self.decoder.frame_size_rgb565,
                                 self.decoder.frame_size_raw8,
+                                self.decoder.frame_size_packed,
                             ]
 
                             # Find matching size (allow small tolerance)
                             matched_size = None
-                            for vs in valid_sizes:
-                                if abs(data_len - vs) < 1000:
-                                    matched_size = vs
-                                    break
+                            if data[:4] == RAW10_RICE_MAGIC or data[:2] == JPEG_SOI or pattern:
+                                # Compressed and self-described frames, trust the part header
+                                matched_size = self.parse_content_length(headers)
+                                if matched_size is None and data[:2] == JPEG_SOI:
+                                    # Strip encoded JPEG parts have no Content-Length, the frame ends at EOI
+                                    matched_size = data.rfind(JPEG_EOI) + 2
+                            else:
+                                for vs in valid_sizes:
+                                    if abs(data_len - vs) < 1000:
+                                        matched_size = vs
+                                        break
 
                             if frame_count == 0:  # Only print for first frame
                                 print(f"Frame data size: {data_len} bytes")
@@ -554,7 +925,13 @@ class RawStreamViewer:
             pass
 
         # Start receiver thread
-        receiver = threading.Thread(target=self.receiver_thread, daemon=True)
+        if self.udp_port:
+            target = self.udp_receiver_thread
+        elif self.websocket:
+            target = self.ws_receiver_thread
+        else:
+            target = self.receiver_thread
+        receiver = threading.Thread(target=target, daemon=True)
         receiver.start()
 
         print(f"Connecting to {self.host}:{self.port}...")
@@ -565,7 +942,7 @@ class RawStreamViewer:
         print("    q - Quit")
         print("    s - Save frame (JPG + RAW)")
         print("    e - Toggle CLAHE enhancement")
-        print("    p - Cycle Bayer pattern (RG/BG/GR/GB)")
+        print("    p - Cycle Bayer pattern (RG/BG/GR/GB), if the stream does not name it")
         print("    r - Rotate image (0/90/180/270)")
         print("    c - Toggle color correction panel")
         print("    0 - Reset color correction to defaults")
@@ -640,7 +1017,7 @@ class RawStreamViewer:
             if raw_data is not None:
                 last_raw_data = raw_data
 
-            current_pattern = patterns[pattern_idx]
+            current_pattern = self.decoder.stream_pattern or patterns[pattern_idx]
             current_rotation = rotations[rotation_idx]
 
             # Process new frame if available
@@ -812,18 +1189,37 @@ def test_with_file(filename, width=DEFAULT_WIDTH, height=DEFAULT_HEIGHT):
 def main():
     parser = argparse.ArgumentParser(description='RAW Bayer Stream Viewer for IMX662')
     parser.add_argument('--host', default='192.168.1.100', help='ESP32 IP address')
-    parser.add_argument('--port', type=int, default=80, help='HTTP port (default: 80)')
+    parser.add_argument('--port', type=int, default=None, help='HTTP port (default: 80, 443 with --tls)')
+    parser.add_argument('--tls', action='store_true',
+                        help='Connect with HTTPS / WSS to a streamer built with EXAMPLE_HTTPS_STREAM')
     parser.add_argument('--width', type=int, default=DEFAULT_WIDTH, help='Frame width')
     parser.add_argument('--height', type=int, default=DEFAULT_HEIGHT, help='Frame height')
+    parser.add_argument('--roi', type=int, nargs=4, metavar=('X', 'Y', 'W', 'H'),
+                        help='Capture window read out of the sensor (shared by all clients)')
+    parser.add_argument('--preview', action='store_true',
+                        help='Watch the decimated /stream.preview instead of full resolution frames')
+    parser.add_argument('--lossless', action='store_true',
+                        help='Watch the losslessly compressed RAW10 /stream.lossless')
+    parser.add_argument('--auto', type=int, nargs='?', const=10, metavar='FPS',
+                        help='Watch the adaptive /stream.auto, which holds FPS (default 10) on weak links')
+    parser.add_argument('--websocket', action='store_true',
+                        help='Receive over /ws with credit flow control (needs websocket-client)')
+    parser.add_argument('--udp', type=int, nargs='?', const=5000, metavar='PORT',
+                        help='Receive over the UDP transport (default port 5000)')
+    parser.add_argument('--fec', type=int, default=0, metavar='K',
+                        help='With --udp, ask for one XOR parity datagram per K fragments')
     parser.add_argument('--no-enhance', action='store_true', help='Disable CLAHE enhancement (faster)')
     parser.add_argument('--test-file', help='Test with a saved RAW file instead of streaming')
 
     args = parser.parse_args()
+    if args.port is None:
+        args.port = 443 if args.tls else 80
 
     if args.test_file:
         test_with_file(args.test_file, args.width, args.height)
     else:
-        viewer = RawStreamViewer(args.host, args.port, args.width, args.height)
+        viewer = RawStreamViewer(args.host, args.port, args.width, args.height, args.roi, args.preview,
+                                 args.lossless, args.websocket, args.udp, args.fec, args.auto, args.tls)
         viewer.run(enhance=not args.no_enhance)
 
 